@@ -47,6 +47,7 @@
 #include "gadgetmanager.h"
 #include "gadgetmeasure.h"
 #include "iotapi.h"
+#include "iottrace.h"
 
 
 /***************** Public Functions ****************/
@@ -80,11 +81,15 @@ void gadgetcontrol_execute(command_t *cmd) {
 
       // 3. This is a command I know how to execute!
       snprintf(url, sizeof(url), "%s/set.xml/%d", focusedGadget->ip, atoi(cmd->argument));
+      iottrace_mark(cmd->commandId, IOTTRACE_DEVICE_START, 0);
       if(0 != libhttpcomm_getMsg(NULL, url, NULL, NULL, rxBuffer, sizeof(rxBuffer), params, NULL)) {
+        iottrace_mark(cmd->commandId, IOTTRACE_DEVICE_DONE, IOT_RESULT_DEVICECONNECTIONERROR);
         iotxml_sendResult(cmd->commandId, IOT_RESULT_DEVICECONNECTIONERROR);
         return;
       }
 
+      iottrace_mark(cmd->commandId, IOTTRACE_DEVICE_DONE, 0);
+
       if(strstr(rxBuffer, "success") == NULL) {
         iotxml_sendResult(cmd->commandId, IOT_RESULT_DEVICEEXECUTIONERROR);
         return;
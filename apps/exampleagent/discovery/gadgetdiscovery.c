@@ -46,22 +46,29 @@
 #include <pthread.h>
 #include <rpc/types.h>
 
-#include "cJSON.h"
 #include "libhttpcomm.h"
+#include "jsonschema.h"
 #include "ioterror.h"
 #include "iotdebug.h"
+#include "ssdpdiscovery.h"
 #include "gadgetdiscovery.h"
 #include "gadgetmanager.h"
 #include "gadgetagent.h"
 
 
+/** Fields of the example gadget's reply */
+static const jsonschema_field_t sGadgetFields[] = {
+  JSONSCHEMA_FIELD("uuid", JSONSCHEMA_STRING, gadget_t, uuid, false),
+  JSONSCHEMA_FIELD("model", JSONSCHEMA_STRING, gadget_t, model, false),
+  JSONSCHEMA_FIELD("version", JSONSCHEMA_STRING, gadget_t, firmwareVersion, false),
+  JSONSCHEMA_END,
+};
+
 /***************** Private Prototypes ***************/
-static void _gadgetdiscovery_ssdpHandler(char *url);
+static error_t _gadgetdiscovery_ssdpHandler(const char *ip, const char *location);
 
 static error_t _gadgetdiscovery_captureGadgetDetails(gadget_t *gadget);
 
-void _gadgetdiscovery_poll(const char *ip);
-
 /***************** Public Functions ***************/
 /**
  * Discover new GADGET devices
@@ -72,177 +79,66 @@ void _gadgetdiscovery_poll(const char *ip);
  * gather information about those devices so we can pass the device on to
  * the gadgetmanager to manage its lifetime.
  *
- * This will run periodically and update the existing devices on each pass.
+ * The first call starts the SSDP discovery service, which keeps listening
+ * for devices in the background and only hands us devices it hasn't
+ * identified recently. Every call asks it to search again; the service
+ * decides how often a search actually goes out.
+ *
+ * @return SUCCESS if the discovery service is running
  */
 error_t gadgetdiscovery_runOnce() {
-  unsigned int len;
-  struct sockaddr_in cliaddr;
-  struct sockaddr_in destaddr;
-  struct timeval tv;
-  struct timeval curTime;
-  char buffer[GADGET_MAX_MSG_SIZE] = "TYPE: WM-DISCOVER\r\nVERSION:2.5\r\n\r\nservices: com.peoplepower.wm.system*\r\n\r\n";
-  char *token;
-  int count = 0;
-  struct ip_mreq mc_req;  int sock;
-  int ret;
-  int one = 1;
-  int ttl = 3;
-
-  // Create socket
-  sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
-  if (sock < 0) {
-    return FAIL;
-  }
-
-  // Allow socket reuse
-  ret = setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char *) &one, sizeof(one));
-
-  if (ret < 0) {
-    return FAIL;
-  }
-
-  if (fcntl(sock, F_SETFL, O_NONBLOCK) == -1) {
-    return FAIL;
-  }
-
-  ret = setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, (void*) &ttl,
-      sizeof(ttl));
-
-  if (ret < 0) {
-    return FAIL;
-  }
-
-  // construct a socket bind address structure
-  cliaddr.sin_family = AF_INET;
-  cliaddr.sin_addr.s_addr = htonl(INADDR_ANY);
-  cliaddr.sin_port = htons(0);
-
-  ret = bind(sock, (struct sockaddr *) &cliaddr, sizeof(cliaddr));
-
-  if (ret < 0) {
-    return FAIL;
-  }
-
-  // construct an IGMP join request structure
-  mc_req.imr_multiaddr.s_addr = inet_addr(GADGET_SSDP_ADDR);
-  mc_req.imr_interface.s_addr = htonl(INADDR_ANY);
-
-  // send an ADD MEMBERSHIP message via setsockopt
-  if ((setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, (void*) &mc_req,
-      sizeof(mc_req))) < 0) {
-    return FAIL;
-  }
-
-  // Set destination for multicast address
-  destaddr.sin_family = AF_INET;
-  destaddr.sin_addr.s_addr = inet_addr(GADGET_SSDP_ADDR);
-  destaddr.sin_port = htons(GADGET_SSDP_PORT);
-
-  // Send the multicast packet
-  len = strlen(buffer);
-  ret = sendto(sock, buffer, len, 0, (struct sockaddr *) &destaddr,
-      sizeof(destaddr));
-
-  if (ret < 0) {
-    return FAIL;
-  }
-
-  SYSLOG_DEBUG("[gadget] SSDP multicast sent, waiting...");
-  gettimeofday(&curTime, NULL);
-  tv.tv_sec = curTime.tv_sec;
-
-  while ((curTime.tv_sec - tv.tv_sec) < 3) {
-    gettimeofday(&curTime, NULL);
-
-    len = sizeof(destaddr);
-    ret = recvfrom(sock, buffer, GADGET_MAX_MSG_SIZE, 0, (struct sockaddr *) &destaddr, &len);
-
-    if (ret > 0) {
-      count++;
-
-      token = strtok(buffer, "\r\n");
-
-      while (token != NULL) {
-        if (!strncasecmp(token, GADGET_LOCATION_HDR, strlen(GADGET_LOCATION_HDR))) {
-          SYSLOG_DEBUG("Found a wireless microcontroller, base URI: %s", token + strlen(GADGET_LOCATION_HDR));
-          _gadgetdiscovery_ssdpHandler(token + strlen(GADGET_LOCATION_HDR));
-          break;
-        }
-
-        token = strtok(NULL, "\r\n");
-      }
-
-    } else {
-      usleep(500000);
-    }
-  }
-
-  /* send a DROP MEMBERSHIP message via setsockopt */
-  if ((setsockopt(sock, IPPROTO_IP, IP_DROP_MEMBERSHIP, (void*) &mc_req, sizeof(mc_req))) < 0) {
+  if(ssdpdiscovery_start(GADGET_SSDP_SEARCH_MSG, GADGET_SSDP_TARGET, &_gadgetdiscovery_ssdpHandler) != SUCCESS) {
     return FAIL;
   }
 
+  ssdpdiscovery_search();
   return SUCCESS;
 }
 
-
-
-/***************** Private Functions ****************/
 /**
- * Here I take the URL of a newly discovered device and extract its IP address
- * before passing it on to _gadgetdiscovery_poll(..) to update the device
- * details
+ * Stop discovering devices
  */
-static void _gadgetdiscovery_ssdpHandler(char *url) {
-  char ip[INET6_ADDRSTRLEN];
-  char *ptr;
-  char *ptr2;
-
-  ptr = strstr(url, "://");
-  if (ptr != NULL) {
-    ptr += 3; // advance pointer after "://"
-    ptr2 = strchr(ptr, '/');
-    if (ptr2 == NULL) {
-      strncpy(ip, ptr, sizeof(ip));
-    } else {
-      strncpy(ip, ptr, ptr2 - ptr);
-      ip[ptr2 - ptr] = 0;
-    }
-
-    _gadgetdiscovery_poll(ip);
-  }
+void gadgetdiscovery_stop() {
+  ssdpdiscovery_stop();
 }
 
 
+/***************** Private Functions ****************/
 /**
- * Once we found a new device at some IP address, we attempt to either grab
- * the gadget_t pointer from our gadgetmanager and update it... or if it
- * doesn't exist, we create a new gadget.  In either case, we query the
- * gadget for metadata details.
+ * The discovery service calls this on its own thread when it finds a device
+ * at some IP address that it hasn't identified recently.  We query the
+ * device for metadata details without holding the agent's mutex, because
+ * that can take a while, and then either update the gadget_t our
+ * gadgetmanager already has at that IP address or add a new one.
  *
- * The gadgetmanager_add(...) will happily return SUCCESS without making
- * multiple copies of the gadget if it is already tracking the gadget at that
- * IP address.
+ * @return SUCCESS if the device is one of our gadgets
  */
-void _gadgetdiscovery_poll(const char *ip) {
+static error_t _gadgetdiscovery_ssdpHandler(const char *ip, const char *location) {
   gadget_t gadget;
   gadget_t *gadgetPtr;
 
-  assert(ip);
+  bzero(&gadget, sizeof(gadget_t));
+  strncpy(gadget.ip, ip, sizeof(gadget.ip) - 1);
 
-  if ((gadgetPtr = gadgetmanager_getByIp(ip)) == NULL) {
-    gadgetPtr = &gadget;
-    bzero(gadgetPtr, sizeof(gadget_t));
-    strcpy(gadgetPtr->ip, ip);
-    SYSLOG_INFO("[gadget] Creating new device with IP %s", gadgetPtr->ip);
+  if(_gadgetdiscovery_captureGadgetDetails(&gadget) != SUCCESS) {
+    return FAIL;
+  }
 
-  } else {
+  pthread_mutex_lock(gadgetagent_getMutex());
+  if ((gadgetPtr = gadgetmanager_getByIp(ip)) != NULL && gadgetPtr->inUse) {
     SYSLOG_INFO("[gadget] Refreshing device IP %s", gadgetPtr->ip);
-  }
+    strcpy(gadgetPtr->uuid, gadget.uuid);
+    gadgetmanager_reindex(gadgetPtr);
+    strcpy(gadgetPtr->model, gadget.model);
+    strcpy(gadgetPtr->firmwareVersion, gadget.firmwareVersion);
 
-  if(_gadgetdiscovery_captureGadgetDetails(gadgetPtr) == SUCCESS) {
-    gadgetmanager_add(gadgetPtr);
+  } else {
+    SYSLOG_INFO("[gadget] Creating new device with IP %s", gadget.ip);
+    gadgetmanager_add(&gadget);
   }
+  pthread_mutex_unlock(gadgetagent_getMutex());
+
+  return SUCCESS;
 }
 
 /**
@@ -255,8 +151,6 @@ static error_t _gadgetdiscovery_captureGadgetDetails(gadget_t *gadget) {
   char url[PATH_MAX];
   char rxBuffer[GADGET_MAX_MSG_SIZE];
   http_param_t params;
-  cJSON *jsonMsg = NULL;
-  cJSON *jsonObject = NULL;
 
   assert(gadget);
 
@@ -266,20 +160,7 @@ static error_t _gadgetdiscovery_captureGadgetDetails(gadget_t *gadget) {
 
   snprintf(url, sizeof(url), "http://%s/get.xml", gadget->ip);
   if (libhttpcomm_getMsg(NULL, url, NULL, NULL, rxBuffer, sizeof(rxBuffer), params, NULL) == 0) {
-    if ((jsonMsg = cJSON_Parse(rxBuffer)) != NULL) {
-
-      if ((jsonObject = cJSON_GetObjectItem(jsonMsg, "uuid")) != NULL) {
-        strcpy(gadget->uuid, jsonObject->valuestring);
-      }
-
-      if ((jsonObject = cJSON_GetObjectItem(jsonMsg, "model")) != NULL) {
-        strcpy(gadget->model, jsonObject->valuestring);
-      }
-
-      if ((jsonObject = cJSON_GetObjectItem(jsonMsg, "version")) != NULL) {
-        strcpy(gadget->firmwareVersion, jsonObject->valuestring);
-      }
-    }
+    jsonschema_extract(sGadgetFields, rxBuffer, gadget, NULL);
   }
 
   return SUCCESS;
@@ -19,11 +19,11 @@
 #ifndef GADGETDISCOVERY_H
 #define GADGETDISCOVERY_H
 
-#define GADGET_LOCATION_HDR "Location:"
+/** Search multicast to find our gadgets */
+#define GADGET_SSDP_SEARCH_MSG "TYPE: WM-DISCOVER\r\nVERSION:2.5\r\n\r\nservices: com.peoplepower.wm.system*\r\n\r\n"
 
-#define GADGET_SSDP_ADDR "239.255.255.250"
-
-#define GADGET_SSDP_PORT 1900
+/** Service type our gadgets announce, anything else on the network is ignored */
+#define GADGET_SSDP_TARGET "com.peoplepower.wm.system"
 
 
 #define GADGET_JSON_ATTR_MODEL "model"
@@ -39,5 +39,7 @@
 /***************** Public Prototypes ****************/
 error_t gadgetdiscovery_runOnce();
 
+void gadgetdiscovery_stop();
+
 
 #endif
@@ -122,6 +122,8 @@
 #include "proxyserver.h"
 #include "clientsocket.h"
 #include "iotapi.h"
+#include "iotxmlcache.h"
+#include "iottrace.h"
 
 #include "gadgetagent.h"
 
@@ -140,9 +142,15 @@ static struct timeval lastDiscoveryTime;
 /** Last heartbeat time */
 static struct timeval lastHeartbeatTime;
 
+/** Last sample time */
+static struct timeval lastSampleTime;
+
 /** Last measurement time */
 static struct timeval lastMeasurementTime;
 
+/** Mutex to access gadgets, because discovery adds them from its own thread */
+static pthread_mutex_t gadgetMutex = PTHREAD_MUTEX_INITIALIZER;
+
 
 /***************** Functions ****************/
 /**
@@ -151,6 +159,19 @@ static struct timeval lastMeasurementTime;
 int main(int argc, char *argv[]) {
   SYSLOG_INFO("*************** GADGET Agent ***************");
 
+  // Log from a background thread instead of the threads doing the work
+  libiotlog_start(NULL);
+
+  if(gadgetmanager_init() != SUCCESS) {
+    SYSLOG_ERR("[gadget] Couldn't allocate the device registry");
+    return 1;
+  }
+
+  // Only report measurements that changed, but send everything again every
+  // once in a while
+  iotxmlcache_setPolicy(NULL, true, 0, 0);
+  iotxmlcache_setKeyframePeriod(GADGET_KEYFRAME_PERIOD_SEC);
+
   // Repetitively attempt to open a socket to the proxy server
   // DEFAULT_PROXY_PORT comes from proxyserver.h
   while(clientsocket_open("127.0.0.1", DEFAULT_PROXY_PORT) != SUCCESS) {
@@ -158,6 +179,10 @@ int main(int argc, char *argv[]) {
     sleep(5);
   }
 
+#if IOTTRACE_ENABLED
+  iottrace_start(IOTTRACE_FILENAME);
+#endif
+
   printf("Running gadget agent\n");
 
   // Listen for all commands of type 'set'
@@ -167,6 +192,8 @@ int main(int argc, char *argv[]) {
     struct timeval curTime = { 0, 0 };
 
     while (!gTerminate) {
+      pthread_mutex_lock(gadgetagent_getMutex());
+
       gettimeofday(&curTime, NULL);
 
       // Discover devices periodically
@@ -185,22 +212,33 @@ int main(int argc, char *argv[]) {
         gadgetheartbeat_send();
       }
 
-      // Take measurements and kill off stragglers periodically
+      // Sample the gadgets much more often than we upload
+      if ((curTime.tv_sec - lastSampleTime.tv_sec) >= GADGET_SAMPLE_PERIOD_SEC) {
+        lastSampleTime.tv_sec = curTime.tv_sec;
+
+        gadgetmeasure_capture();
+      }
+
+      // Send measurements and kill off stragglers periodically
       if ((curTime.tv_sec - lastMeasurementTime.tv_sec) >= measurementPeriod_sec) {
         SYSLOG_INFO("[gadget] Measure");
         lastMeasurementTime.tv_sec = curTime.tv_sec;
 
-        gadgetmeasure_capture();
-
         gadgetmanager_garbageCollection();
 
         gadgetmeasure_send();
       }
 
-      sleep(10);
+      pthread_mutex_unlock(gadgetagent_getMutex());
+
+      sleep(GADGET_SAMPLE_PERIOD_SEC);
     }
   }
 
+  gadgetdiscovery_stop();
+  iottrace_stop();
+  libiotlog_stop();
+
   return 0;
 }
 
@@ -271,3 +309,10 @@ void gadgetagent_setHeartbeatPeriod(int seconds) {
 void gadgetagent_refreshDevices() {
   lastMeasurementTime.tv_sec = 0;
 }
+
+/**
+ * @return the mutex for accessing gadgets
+ */
+pthread_mutex_t *gadgetagent_getMutex() {
+  return &gadgetMutex;
+}
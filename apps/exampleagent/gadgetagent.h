@@ -19,6 +19,8 @@
 #ifndef GADGETAGENT_H
 #define GADGETAGENT_H
 
+#include <pthread.h>
+
 #include "gadgetcontrol.h"
 #include "gadgetmanager.h"
 #include "gadgetdiscovery.h"
@@ -34,9 +36,21 @@
 /** Number of seconds between heartbeats */
 #define GADGET_HEARTBEAT_PERIOD_SEC 300
 
+/** Number of seconds between sampling the gadgets */
+#define GADGET_SAMPLE_PERIOD_SEC 1
+
 /** Number of seconds between measurements */
 #define GADGET_MEASUREMENT_PERIOD_SEC 60
 
+/** Longest time span the statistics of one batch of samples cover */
+#define GADGET_AGGREGATION_WINDOW_SEC 60
+
+/** Seconds after which measurements are sent again even if they didn't change */
+#define GADGET_KEYFRAME_PERIOD_SEC 900
+
+/** Byte budget of one frame of measurements sent to the proxy */
+#define GADGET_BATCH_MAX_BYTES 4096
+
 /** Maximum size of a message buffer to receive messages from the gadget */
 #define GADGET_MAX_MSG_SIZE 1024
 
@@ -47,6 +61,8 @@ void gadgetagent_setMeasurementPeriod(int seconds);
 
 void gadgetagent_refreshDevices();
 
+pthread_mutex_t *gadgetagent_getMutex();
+
 
 #endif
 
@@ -49,10 +49,8 @@
  * loop, and then send the complete message with all device information at
  * the end.
  *
- * If I don't have any devices under my control, I end up aborting the
- * message. Alternatively, you might want to implement a
- * int gadgetmanager_totalDevices() function that would let us abort the
- * message before we start it, if we don't have any devices under our control.
+ * If I don't have any devices under my control, gadgetmanager_totalDevices()
+ * lets me skip the message before I start it.
  *
  * EXAMPLE ONLY!
  */
@@ -63,6 +61,10 @@ void gadgetheartbeat_send() {
   int totalHeartbeats = 0;
   gadget_t *focusedGadget;
 
+  if(gadgetmanager_totalDevices() == 0) {
+    return;
+  }
+
   iotxml_newMsg(myMsg, sizeof(myMsg));
 
   for(i = 0; i < gadgetmanager_size(); i++) {
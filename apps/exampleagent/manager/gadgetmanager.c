@@ -27,42 +27,55 @@
 #include <string.h>
 #include <arpa/inet.h>
 #include <stdbool.h>
+#include <time.h>
+#include <sys/time.h>
 
 #include "ioterror.h"
 #include "iotdebug.h"
 
+#include "ssdpdiscovery.h"
+#include "deviceregistry.h"
 #include "gadgetmanager.h"
 #include "gadgetagent.h"
 
 /** Gadgets we are currently tracking */
-static gadget_t devices[GADGET_MAX_DEVICES];
+static deviceregistry_t devices;
 
 /***************** Public Functions ****************/
+/**
+ * Initialize the device registry before anything else touches it
+ */
+error_t gadgetmanager_init() {
+  return DEVICEREGISTRY_INIT(&devices, gadget_t, ip, uuid, GADGET_DEATH_PERIOD_SEC);
+}
+
 error_t gadgetmanager_add(gadget_t *gadget) {
-  int i;
+  gadget_t *added;
 
-  for(i = 0; i < GADGET_MAX_DEVICES; i++) {
-    if(devices[i].inUse && strcmp(gadget->ip, devices[i].ip) == 0) {
-      SYSLOG_INFO("[gadget] Device at IP %s is already being tracked", gadget->ip);
-      return SUCCESS;
-    }
+  if(gadgetmanager_getByIp(gadget->ip) != NULL) {
+    SYSLOG_INFO("[gadget] Device at IP %s is already being tracked", gadget->ip);
+    return SUCCESS;
   }
 
-  for(i = 0; i < GADGET_MAX_DEVICES; i++) {
-    if(!devices[i].inUse) {
-      SYSLOG_INFO("[gadget] Adding new device at ip %s!", gadget->ip);
+  SYSLOG_INFO("[gadget] Adding new device at ip %s!", gadget->ip);
 
-      // Always add the device to the ESP
-      iotxml_addDevice(gadget->uuid, GADGET_DEVICE_TYPE);
+  gadget->inUse = true;
+  gettimeofday(&gadget->lastTouchTime, NULL);
 
-      memcpy(&devices[i], gadget, sizeof(gadget_t));
-      devices[i].inUse = true;
-      gadgetagent_refreshDevices();
-      return SUCCESS;
-    }
+  if((added = deviceregistry_add(&devices, gadget)) == NULL) {
+    return FAIL;
   }
 
-  return FAIL;
+  // Upload statistics of the samples rather than every sample
+  sampleseries_init(&added->currentSamples, GADGET_AGGREGATION_WINDOW_SEC,
+      SAMPLESERIES_LAST | SAMPLESERIES_MEAN | SAMPLESERIES_MAX, 2);
+  sampleseries_init(&added->powerSamples, GADGET_AGGREGATION_WINDOW_SEC,
+      SAMPLESERIES_LAST | SAMPLESERIES_MEAN | SAMPLESERIES_MIN | SAMPLESERIES_MAX, 2);
+
+  // Always add the device to the ESP
+  iotxml_addDevice(added->uuid, GADGET_DEVICE_TYPE);
+  gadgetagent_refreshDevices();
+  return SUCCESS;
 }
 
 
@@ -72,14 +85,7 @@ error_t gadgetmanager_add(gadget_t *gadget) {
  * @return gadget_t if the device is being tracked
  */
 gadget_t *gadgetmanager_getByIp(const char *ip) {
-  int i;
-  for(i = 0; i < GADGET_MAX_DEVICES; i++) {
-    if(strncmp(ip, devices[i].ip, EUI64_STRING_SIZE) == 0) {
-      return &devices[i];
-    }
-  }
-
-  return NULL;
+  return deviceregistry_getByIp(&devices, ip);
 }
 
 
@@ -89,55 +95,89 @@ gadget_t *gadgetmanager_getByIp(const char *ip) {
  * @return gadget_t if we are tracking this device
  */
 gadget_t *gadgetmanager_getByUuid(const char *uuid) {
-  int i;
-  for(i = 0; i < GADGET_MAX_DEVICES; i++) {
-    if(strncmp(uuid, devices[i].uuid, EUI64_STRING_SIZE) == 0) {
-      return &devices[i];
-    }
-  }
-
-  return NULL;
+  return deviceregistry_getByUuid(&devices, uuid);
 }
 
 
 /**
- * @return the number of elements in our device array
+ * Call after changing the IP address or UUID of a device we're tracking
+ * @param gadget Device
+ */
+void gadgetmanager_reindex(gadget_t *gadget) {
+  deviceregistry_reindex(&devices, gadget);
+}
+
+/**
+ * @return the number of indices to iterate over with gadgetmanager_get(..)
  */
 int gadgetmanager_size() {
-  return GADGET_MAX_DEVICES;
+  return deviceregistry_size(&devices);
 }
 
 /**
- * @param index Index into the array of devices
- * @return the device at the given index
+ * @return the number of devices we are tracking
+ */
+int gadgetmanager_totalDevices() {
+  return deviceregistry_totalDevices(&devices);
+}
+
+/**
+ * @param index Index of a device, from 0 to gadgetmanager_size() - 1
+ * @return the device at the given index, NULL if the index is unused
  */
 gadget_t *gadgetmanager_get(int index) {
-  if(index < GADGET_MAX_DEVICES) {
-    return &devices[index];
-  } else {
-    return NULL;
+  return deviceregistry_get(&devices, index);
+}
+
+/**
+ * We heard from the device, so it isn't dead yet
+ * @param gadget Device
+ */
+void gadgetmanager_touch(gadget_t *gadget) {
+  gettimeofday(&gadget->lastTouchTime, NULL);
+  deviceregistry_touch(&devices, gadget);
+}
+
+/**
+ * The device has new measurements to send
+ * @param gadget Device
+ */
+void gadgetmanager_measurementsUpdated(gadget_t *gadget) {
+  gadget->measurementsUpdated = true;
+  deviceregistry_markDirty(&devices, gadget);
+}
+
+/**
+ * Obtain the next device with measurements to send, and clear its flag
+ * @return the device, NULL if there are no more
+ */
+gadget_t *gadgetmanager_nextUpdated() {
+  gadget_t *gadget;
+
+  if((gadget = deviceregistry_nextDirty(&devices)) != NULL) {
+    gadget->measurementsUpdated = false;
   }
+
+  return gadget;
 }
 
 /**
  * Kill off the devices we haven't heard from in a long time
  */
 void gadgetmanager_garbageCollection() {
-  int i;
-  struct timeval curTime = { 0, 0 };
+  gadget_t *gadget;
 
-  gettimeofday(&curTime, NULL);
+  while((gadget = deviceregistry_nextExpired(&devices, time(NULL))) != NULL) {
+    SYSLOG_INFO("[gadget] Killing device at IP %s", gadget->ip);
 
-  for(i = 0; i < GADGET_MAX_DEVICES; i++) {
-    if(devices[i].inUse) {
-      if ((curTime.tv_sec - devices[i].lastTouchTime.tv_sec) >= GADGET_DEATH_PERIOD_SEC) {
-        SYSLOG_INFO("[gadget] Killing device at IP %s", devices[i].ip);
+    // Alert that the device is gone
+    iotxml_alertDeviceIsGone(gadget->uuid);
 
-        // Alert that the device is gone
-        iotxml_alertDeviceIsGone(devices[i].uuid);
+    // Identify it from scratch if it ever comes back
+    ssdpdiscovery_forget(gadget->ip);
 
-        bzero(&devices[i], sizeof(gadget_t));
-      }
-    }
+    sampleseries_destroy(&gadget->currentSamples);
+    sampleseries_destroy(&gadget->powerSamples);
+    deviceregistry_remove(&devices, gadget);
   }
 }
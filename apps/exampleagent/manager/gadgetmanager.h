@@ -25,13 +25,7 @@
 
 #include "eui64.h"
 #include "ioterror.h"
-
-/**
- * Maximum number of gadgets can be set at compile time
- */
-#ifndef GADGET_MAX_DEVICES
-#define GADGET_MAX_DEVICES 8
-#endif
+#include "sampleseries.h"
 
 /** Amount of time after we haven't heard from an gadget that we think it's dead */
 #define GADGET_DEATH_PERIOD_SEC 600
@@ -71,6 +65,10 @@ typedef struct gadget_t {
   /** Power in watts */
   double power_watts;
 
+  /** Samples of the current and power since the last upload */
+  sampleseries_t currentSamples;
+  sampleseries_t powerSamples;
+
   /** Voltage */
   double voltage;
 
@@ -84,16 +82,28 @@ typedef struct gadget_t {
 
 
 /***************** Public Prototypes ****************/
+error_t gadgetmanager_init();
+
 error_t gadgetmanager_add(gadget_t *gadget);
 
 gadget_t *gadgetmanager_getByIp(const char *ip);
 
 gadget_t *gadgetmanager_getByUuid(const char *uuid);
 
+void gadgetmanager_reindex(gadget_t *gadget);
+
 int gadgetmanager_size();
 
+int gadgetmanager_totalDevices();
+
 gadget_t *gadgetmanager_get(int index);
 
+void gadgetmanager_touch(gadget_t *gadget);
+
+void gadgetmanager_measurementsUpdated(gadget_t *gadget);
+
+gadget_t *gadgetmanager_nextUpdated();
+
 void gadgetmanager_garbageCollection();
 
 #endif
@@ -30,7 +30,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
-#include "cJSON.h"
+#include "jsonschema.h"
 
 #include "libhttpcomm.h"
 #include "ioterror.h"
@@ -40,6 +40,33 @@
 #include "gadgetmeasure.h"
 #include "gadgetagent.h"
 #include "iotapi.h"
+#include "iotxmlbatch.h"
+#include "sampleseries.h"
+
+/** Positions of the fields in sGadgetFields */
+enum {
+  GADGETMEASURE_STATE,
+  GADGETMEASURE_AMPS,
+  GADGETMEASURE_WATTS,
+  GADGETMEASURE_VOLTS,
+  GADGETMEASURE_PF,
+  GADGETMEASURE_ENERGY,
+  GADGETMEASURE_TOTAL_FIELDS,
+};
+
+/** Fields of the example gadget's reply */
+static const jsonschema_field_t sGadgetFields[GADGETMEASURE_TOTAL_FIELDS + 1] = {
+  [GADGETMEASURE_STATE] = JSONSCHEMA_FIELD("state", JSONSCHEMA_BOOL, gadget_t, isOn, false),
+  [GADGETMEASURE_AMPS] = JSONSCHEMA_FIELD("amps", JSONSCHEMA_DOUBLE, gadget_t, current_amps, false),
+  [GADGETMEASURE_WATTS] = JSONSCHEMA_FIELD("watts", JSONSCHEMA_DOUBLE, gadget_t, power_watts, false),
+  [GADGETMEASURE_VOLTS] = JSONSCHEMA_FIELD("volts", JSONSCHEMA_DOUBLE, gadget_t, voltage, false),
+  [GADGETMEASURE_PF] = JSONSCHEMA_FIELD("pf", JSONSCHEMA_INT, gadget_t, powerFactor, false),
+  [GADGETMEASURE_ENERGY] = JSONSCHEMA_FIELD("energy", JSONSCHEMA_DOUBLE, gadget_t, energy_wh, false),
+  [GADGETMEASURE_TOTAL_FIELDS] = JSONSCHEMA_END,
+};
+
+/** Frame of measurements to the proxy, too large for the stack */
+static iotxmlbatch_t sBatch;
 
 
 /***************** Private Prototypes ****************/
@@ -55,12 +82,9 @@ void gadgetmeasure_capture() {
   gadget_t *focusedGadget;
   char url[PATH_MAX];
   char rxBuffer[GADGET_MAX_MSG_SIZE];
-  cJSON *jsonMsg = NULL;
-  cJSON *jsonObject = NULL;
+  unsigned int found;
   http_param_t params;
 
-  struct timeval curTime = { 0, 0 };
-
   params.verbose = false;
   params.timeouts.connectTimeout = 3;
   params.timeouts.transferTimeout = 15;
@@ -80,42 +104,21 @@ void gadgetmeasure_capture() {
         snprintf(url, sizeof(url), "http://%s/get.xml", focusedGadget->ip);
 
         if (libhttpcomm_getMsg(NULL, url, NULL, NULL, rxBuffer, sizeof(rxBuffer), params, NULL) == 0) {
-          if ((jsonMsg = cJSON_Parse(rxBuffer)) != NULL) {
-
-            // State of the example gadget's outlet, 1 or 0
-            if ((jsonObject = cJSON_GetObjectItem(jsonMsg, "state")) != NULL) {
-              focusedGadget->isOn = jsonObject->valueint;
-            }
-
-            // Current
-            if ((jsonObject = cJSON_GetObjectItem(jsonMsg, "amps")) != NULL) {
-              focusedGadget->current_amps = jsonObject->valuedouble;
-            }
-
-            // Power
-            if ((jsonObject = cJSON_GetObjectItem(jsonMsg, "watts")) != NULL) {
-              focusedGadget->power_watts = jsonObject->valuedouble;
-            }
-
-            // Volts
-            if ((jsonObject = cJSON_GetObjectItem(jsonMsg, "volts")) != NULL) {
-              focusedGadget->voltage = jsonObject->valuedouble;
-            }
+          // The state, current, power, volts, power factor and energy go
+          // straight into the gadget as they're read from the reply
+          if (jsonschema_extract(sGadgetFields, rxBuffer, focusedGadget, &found) == SUCCESS) {
 
-            // Power Factor
-            if ((jsonObject = cJSON_GetObjectItem(jsonMsg, "pf")) != NULL) {
-              focusedGadget->powerFactor = jsonObject->valueint;
+            if (JSONSCHEMA_FOUND(found, GADGETMEASURE_AMPS)) {
+              sampleseries_add(&focusedGadget->currentSamples, focusedGadget->current_amps);
             }
 
-            // Energy
-            if ((jsonObject = cJSON_GetObjectItem(jsonMsg, "energy")) != NULL) {
-              focusedGadget->energy_wh = jsonObject->valuedouble;
+            if (JSONSCHEMA_FOUND(found, GADGETMEASURE_WATTS)) {
+              sampleseries_add(&focusedGadget->powerSamples, focusedGadget->power_watts);
             }
 
             // Log that we updated the measurements and last contact time
-            focusedGadget->measurementsUpdated = true;
-            gettimeofday(&curTime, NULL);
-            focusedGadget->lastTouchTime.tv_sec = curTime.tv_sec;
+            gadgetmanager_measurementsUpdated(focusedGadget);
+            gadgetmanager_touch(focusedGadget);
           }
         }
       }
@@ -132,108 +135,106 @@ void gadgetmeasure_capture() {
  * 1. Create a new message with iotxml_newMsg(char *msg, int len)
  * 2. Add Strings and Ints to that message using iotxml_addString(..) and
  *    iotxml_addInt(..)
- * 3. Send the message with iotxml_send(char *msg, int len);
+ * 3. Hand the message to a batch with iotxmlbatch_add(..), which packs
+ *    the messages for many devices into one frame to the proxy. A single
+ *    device could also just send its message with iotxml_send(..)
  *
  * THIS IS AN EXAMPLE ONLY!
  */
 void gadgetmeasure_send() {
   char myMsg[PROXY_MAX_MSG_LEN];
   char buffer[10];
-  int i;
   int offset = 0;
   gadget_t *focusedGadget;
 
-
-  for(i = 0; i < gadgetmanager_size(); i++) {
-    if((focusedGadget = gadgetmanager_get(i)) != NULL) {
-      if(focusedGadget->inUse && focusedGadget->measurementsUpdated) {
-        focusedGadget->measurementsUpdated = false;
-
-        // I didn't want to fill up our buffer here, so each gadget gets
-        // its own message and we toss it like a hot potato
-        iotxml_newMsg(myMsg, sizeof(myMsg));
-        offset = 0;
-
-        // We have to print the floats / doubles to a string in order
-        // to format it as we want to see it at the server. That's why
-        // we do an snprintf(..) to a buffer, and then add that buffer
-        // to our message.
-        //
-        // Also, since my example gadget is a 1-socket smart outlet,
-        // I use 0 in place of the index because there are not multiple
-        // outlets on each example device.  If we had a multiple outlets,
-        // I would have used the character '0', '1', '2', .. as the index
-        // for each individual outlet.
-
-        // Current
-        snprintf(buffer, sizeof(buffer), "%4.2lf", focusedGadget->current_amps);
-        offset += iotxml_addString(myMsg + offset, sizeof(myMsg) - offset,
-            focusedGadget->uuid,
-            GADGET_DEVICE_TYPE,
-            IOT_PARAM_MEASURE,
-            "current",
-            "m",
-            0,
-            buffer);
-
-        // Power
-        snprintf(buffer, sizeof(buffer), "%4.2lf", focusedGadget->power_watts);
-        offset += iotxml_addString(myMsg + offset, sizeof(myMsg) - offset,
-            focusedGadget->uuid,
-            GADGET_DEVICE_TYPE,
-            IOT_PARAM_MEASURE,
-            "power",
-            "1",
-            0,
-            buffer);
-
-        // Voltage
-        snprintf(buffer, sizeof(buffer), "%3.1lf", focusedGadget->voltage);
-        offset += iotxml_addString(myMsg + offset, sizeof(myMsg) - offset,
-            focusedGadget->uuid,
-            GADGET_DEVICE_TYPE,
-            IOT_PARAM_MEASURE,
-            "volts",
-            "1",
-            0,
-            buffer);
-
-        // Energy
-        snprintf(buffer, sizeof(buffer), "%3.1lf", focusedGadget->energy_wh);
-        offset += iotxml_addString(myMsg + offset, sizeof(myMsg) - offset,
-            focusedGadget->uuid,
-            GADGET_DEVICE_TYPE,
-            IOT_PARAM_MEASURE,
-            "energy",
-            "k",
-            0,
-            buffer);
-
-        // Power Factor
-        offset += iotxml_addInt(myMsg + offset, sizeof(myMsg) - offset,
-            focusedGadget->uuid,
-            GADGET_DEVICE_TYPE,
-            IOT_PARAM_MEASURE,
-            "powerFactor",
-            NULL,
-            0,
-            focusedGadget->powerFactor);
-
-        // Outlet status
-        offset += iotxml_addInt(myMsg + offset, sizeof(myMsg) - offset,
-            focusedGadget->uuid,
-            GADGET_DEVICE_TYPE,
-            IOT_PARAM_MEASURE,
-            "outletStatus",
-            NULL,
-            0,
-            focusedGadget->isOn);
-
-        // Send the measurement
-        iotxml_send(myMsg, sizeof(myMsg));
-      }
-    }
+  iotxmlbatch_init(&sBatch, GADGET_BATCH_MAX_BYTES);
+
+  // Only visit the devices that have something new to say
+  while((focusedGadget = gadgetmanager_nextUpdated()) != NULL) {
+    iotxml_newMsg(myMsg, sizeof(myMsg));
+    offset = 0;
+
+    // We have to print the floats / doubles to a string in order
+    // to format it as we want to see it at the server. That's why
+    // we do an snprintf(..) to a buffer, and then add that buffer
+    // to our message.
+    //
+    // Also, since my example gadget is a 1-socket smart outlet,
+    // I use 0 in place of the index because there are not multiple
+    // outlets on each example device.  If we had a multiple outlets,
+    // I would have used the character '0', '1', '2', .. as the index
+    // for each individual outlet.
+
+    // Voltage
+    snprintf(buffer, sizeof(buffer), "%3.1lf", focusedGadget->voltage);
+    offset += iotxml_addString(myMsg + offset, sizeof(myMsg) - offset,
+        focusedGadget->uuid,
+        GADGET_DEVICE_TYPE,
+        IOT_PARAM_MEASURE,
+        "volts",
+        "1",
+        0,
+        buffer);
+
+    // Energy
+    snprintf(buffer, sizeof(buffer), "%3.1lf", focusedGadget->energy_wh);
+    offset += iotxml_addString(myMsg + offset, sizeof(myMsg) - offset,
+        focusedGadget->uuid,
+        GADGET_DEVICE_TYPE,
+        IOT_PARAM_MEASURE,
+        "energy",
+        "k",
+        0,
+        buffer);
+
+    // Power Factor
+    offset += iotxml_addInt(myMsg + offset, sizeof(myMsg) - offset,
+        focusedGadget->uuid,
+        GADGET_DEVICE_TYPE,
+        IOT_PARAM_MEASURE,
+        "powerFactor",
+        NULL,
+        0,
+        focusedGadget->powerFactor);
+
+    // Outlet status
+    offset += iotxml_addInt(myMsg + offset, sizeof(myMsg) - offset,
+        focusedGadget->uuid,
+        GADGET_DEVICE_TYPE,
+        IOT_PARAM_MEASURE,
+        "outletStatus",
+        NULL,
+        0,
+        focusedGadget->isOn);
+
+    // Current and power are sampled every GADGET_SAMPLE_PERIOD_SEC, so
+    // instead of the latest value we send statistics of the samples since
+    // the last upload, each stamped with the time of its last sample. They
+    // go last, because whatever doesn't fit waits for the next upload.
+    sampleseries_closeWindow(&focusedGadget->currentSamples);
+    offset += sampleseries_addToMsg(myMsg + offset, sizeof(myMsg) - offset,
+        &focusedGadget->currentSamples,
+        focusedGadget->uuid,
+        GADGET_DEVICE_TYPE,
+        "current",
+        "m",
+        0);
+
+    sampleseries_closeWindow(&focusedGadget->powerSamples);
+    offset += sampleseries_addToMsg(myMsg + offset, sizeof(myMsg) - offset,
+        &focusedGadget->powerSamples,
+        focusedGadget->uuid,
+        GADGET_DEVICE_TYPE,
+        "power",
+        "1",
+        0);
+
+    // Add the measurements to the frame, which goes out when it's full
+    iotxmlbatch_add(&sBatch, myMsg, sizeof(myMsg));
   }
+
+  // Send whatever is left
+  iotxmlbatch_flush(&sBatch);
 }
 
 
@@ -0,0 +1,578 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * Puts the proxy server under a known load on one machine, with no network.
+ *
+ * The driver starts the mock cloud server, then a proxy server configured
+ * to talk to it, then forks the requested number of synthetic agents. Each
+ * agent connects to the proxy server like any other agent, registers one
+ * device and sends a measurement at the configured rate, stamped with the
+ * CLOCK_MONOTONIC time it was sent at, and answers the commands for its
+ * device as soon as they arrive.  The mock server times both ends.
+ *
+ * After a warm-up, the driver samples the CPU time and memory of the proxy
+ * server and the client processes it forks, and when it's done it prints
+ * the mock server's throughput and latency percentiles next to them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "libconfigio.h"
+#include "libhttpcomm.h"
+
+#include "ioterror.h"
+#include "iotdebug.h"
+#include "iotapi.h"
+#include "proxy.h"
+#include "proxyserver.h"
+#include "clientsocket.h"
+#include "mockserver.h"
+#include "loaddriver.h"
+
+/** Number of agents to start */
+static int sTotalAgents = LOADDRIVER_DEFAULT_AGENTS;
+
+/** Measurements per second from each agent */
+static double sRate = LOADDRIVER_DEFAULT_RATE;
+
+/** Seconds to measure for */
+static int sDurationSec = LOADDRIVER_DEFAULT_DURATION_SEC;
+
+/** Seconds to settle before measuring */
+static int sWarmupSec = LOADDRIVER_DEFAULT_WARMUP_SEC;
+
+/** Options handed to the mock server */
+static const char *sCommandRate = "0";
+static const char *sDelayMs = "0";
+static const char *sLossPercent = "0";
+static const char *sErrorPercent = "0";
+static const char *sMode = "ack";
+
+/** Port the mock server listens on */
+static int sPort = MOCKSERVER_DEFAULT_PORT;
+
+/** Where to find the servers */
+static const char *sProxyServer = LOADDRIVER_DEFAULT_PROXYSERVER;
+static const char *sMockServer = LOADDRIVER_DEFAULT_MOCKSERVER;
+
+/** File the proxy server captures its traffic to, if any */
+static const char *sCaptureFilename;
+
+/** True to let the servers print to the console */
+static bool sVerbose;
+
+/** Set when the driver is interrupted, to clean up early */
+static volatile sig_atomic_t sInterrupted;
+
+/** Device ID of the agent in this process */
+static char sDeviceId[EUI64_STRING_SIZE];
+
+
+/***************** Private Prototypes ****************/
+static void _loaddriver_parse(int argc, char *argv[]);
+
+static void _loaddriver_printUsage();
+
+static void _loaddriver_writeConfig();
+
+static pid_t _loaddriver_spawn(char *const argv[]);
+
+static void _loaddriver_agent(int index);
+
+static void _loaddriver_execute(command_t *cmd);
+
+static error_t _loaddriver_getStats(const char *query, char *dest, int maxSize);
+
+static void _loaddriver_usage(pid_t root, loaddriver_usage_t *usage);
+
+static void _loaddriver_interrupt(int signum);
+
+static uint64_t _loaddriver_nowUsec();
+
+
+/***************** Functions ****************/
+/**
+ * Main function
+ */
+int main(int argc, char *argv[]) {
+  char port[8];
+  char devices[8];
+  char url[PATH_MAX];
+  char stats[LOADDRIVER_STATS_SIZE];
+  pid_t mockServer;
+  pid_t proxyServer;
+  pid_t agents[LOADDRIVER_MAX_AGENTS];
+  loaddriver_usage_t start;
+  loaddriver_usage_t end;
+  loaddriver_usage_t now;
+  long rssTotalKb = 0;
+  long rssMaxKb = 0;
+  int samples = 0;
+  int elapsedSec;
+  int i;
+  struct sigaction action;
+
+  _loaddriver_parse(argc, argv);
+
+  bzero(&action, sizeof(action));
+  action.sa_handler = _loaddriver_interrupt;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  _loaddriver_writeConfig();
+
+  snprintf(port, sizeof(port), "%d", sPort);
+  snprintf(devices, sizeof(devices), "%d", sTotalAgents);
+  {
+    char *mockArgv[] = { (char *) sMockServer, "-p", port, "-d", (char *) sDelayMs,
+        "-l", (char *) sLossPercent, "-e", (char *) sErrorPercent, "-c", (char *) sCommandRate,
+        "-m", (char *) sMode, "-n", devices, NULL };
+
+    if ((mockServer = _loaddriver_spawn(mockArgv)) < 0) {
+      exit(1);
+    }
+  }
+
+  usleep(200000);
+
+  snprintf(url, sizeof(url), "http://127.0.0.1:%d/cloud", sPort);
+  {
+    char *proxyArgv[] = { (char *) sProxyServer, "-c", LOADDRIVER_CONFIG_FILENAME, "-b", url,
+        "-l", LOADDRIVER_CLOUD_NAME, "-f", "xml", NULL };
+
+    if ((proxyServer = _loaddriver_spawn(proxyArgv)) < 0) {
+      kill(-mockServer, SIGTERM);
+      exit(1);
+    }
+  }
+
+  // Give the proxy server time to open its socket
+  sleep(1);
+
+  for (i = 0; i < sTotalAgents; i++) {
+    if ((agents[i] = fork()) == 0) {
+      _loaddriver_agent(i);
+      _exit(0);
+    }
+  }
+
+  printf("Started %d agents at %.1f measurements/s each, warming up for %d s\n", sTotalAgents, sRate, sWarmupSec);
+  fflush(stdout);
+
+  for (elapsedSec = 0; elapsedSec < sWarmupSec && !sInterrupted; elapsedSec++) {
+    sleep(1);
+  }
+
+  // Start the statistics over now that everything is running
+  _loaddriver_getStats("?reset=1", stats, sizeof(stats));
+  _loaddriver_usage(proxyServer, &start);
+
+  printf("Measuring for %d s\n", sDurationSec);
+  fflush(stdout);
+
+  for (elapsedSec = 0; elapsedSec < sDurationSec && !sInterrupted; elapsedSec++) {
+    sleep(1);
+
+    _loaddriver_usage(proxyServer, &now);
+    rssTotalKb += now.rssKb;
+    samples++;
+    if (now.rssKb > rssMaxKb) {
+      rssMaxKb = now.rssKb;
+    }
+  }
+
+  _loaddriver_usage(proxyServer, &end);
+
+  printf("\n--- load ---\n");
+  printf("agents %d\n", sTotalAgents);
+  printf("offered_measurements_per_sec %.1f\n", sTotalAgents * sRate);
+  printf("commands_per_sec %s\n", sCommandRate);
+  printf("delay_ms %s loss_percent %s error_percent %s mode %s\n", sDelayMs, sLossPercent, sErrorPercent, sMode);
+
+  printf("\n--- mock server ---\n");
+  if (_loaddriver_getStats("", stats, sizeof(stats)) == SUCCESS) {
+    printf("%s", stats);
+  } else {
+    printf("Couldn't get the statistics from the mock server\n");
+  }
+
+  printf("\n--- proxy server ---\n");
+  printf("processes %d\n", end.processes);
+  if (elapsedSec > 0) {
+    printf("cpu_percent %.1f\n", 100.0 * (end.cpuTicks - start.cpuTicks) / (sysconf(_SC_CLK_TCK) * (double) elapsedSec));
+  }
+  printf("rss_kb avg=%ld max=%ld\n", samples > 0 ? rssTotalKb / samples : 0, rssMaxKb);
+
+  for (i = 0; i < sTotalAgents; i++) {
+    kill(agents[i], SIGTERM);
+  }
+  kill(-proxyServer, SIGTERM);
+  kill(-mockServer, SIGTERM);
+
+  while (wait(NULL) > 0);
+
+  unlink(LOADDRIVER_CONFIG_FILENAME);
+  return 0;
+}
+
+/**
+ * The agent library is responsible for routing messages from the proxy
+ * server to the parser
+ *
+ * @param msg The received message
+ * @param len The length of the message
+ */
+void application_receive(const char *msg, int len) {
+  iotxml_parse(msg, len);
+}
+
+/**
+ * The agent library is responsible for routing outbound messages to the
+ * proxy server
+ *
+ * @param msg The constructed message to send
+ * @param len The size of the message
+ * @return SUCCESS if the message is sent
+ */
+error_t application_send(const char *msg, int len) {
+  return clientsocket_send(msg, len);
+}
+
+
+/***************** Private Functions ****************/
+/**
+ * Parse the command line arguments
+ */
+static void _loaddriver_parse(int argc, char *argv[]) {
+  int c;
+
+  while ((c = getopt(argc, argv, "a:r:d:w:c:L:x:e:m:p:s:k:C:vh")) != -1) {
+    switch (c) {
+    case 'a':
+      sTotalAgents = atoi(optarg);
+      if (sTotalAgents < 1 || sTotalAgents > LOADDRIVER_MAX_AGENTS) {
+        printf("The number of agents must be between 1 and %d\n", LOADDRIVER_MAX_AGENTS);
+        exit(1);
+      }
+      break;
+
+    case 'r':
+      sRate = atof(optarg);
+      if (sRate <= 0) {
+        printf("The measurement rate must be positive\n");
+        exit(1);
+      }
+      break;
+
+    case 'd':
+      sDurationSec = atoi(optarg);
+      break;
+
+    case 'w':
+      sWarmupSec = atoi(optarg);
+      break;
+
+    case 'c':
+      sCommandRate = optarg;
+      break;
+
+    case 'L':
+      sDelayMs = optarg;
+      break;
+
+    case 'x':
+      sLossPercent = optarg;
+      break;
+
+    case 'e':
+      sErrorPercent = optarg;
+      break;
+
+    case 'm':
+      sMode = optarg;
+      break;
+
+    case 'p':
+      sPort = atoi(optarg);
+      break;
+
+    case 's':
+      sProxyServer = optarg;
+      break;
+
+    case 'k':
+      sMockServer = optarg;
+      break;
+
+    case 'C':
+      sCaptureFilename = optarg;
+      break;
+
+    case 'v':
+      sVerbose = true;
+      break;
+
+    default:
+      _loaddriver_printUsage();
+      exit(c == 'h' ? 0 : 1);
+      break;
+    }
+  }
+}
+
+/**
+ * Print the command line usage
+ */
+static void _loaddriver_printUsage() {
+  printf("Usage: loaddriver [options]\n");
+  printf("\t-a [agents] : Number of synthetic agents, default %d\n", LOADDRIVER_DEFAULT_AGENTS);
+  printf("\t-r [rate] : Measurements per second from each agent, default %.1f\n", LOADDRIVER_DEFAULT_RATE);
+  printf("\t-d [seconds] : How long to measure, default %d\n", LOADDRIVER_DEFAULT_DURATION_SEC);
+  printf("\t-w [seconds] : How long to warm up first, default %d\n", LOADDRIVER_DEFAULT_WARMUP_SEC);
+  printf("\t-c [rate] : Commands per second from the mock server\n");
+  printf("\t-L [ms] : Mock server response delay\n");
+  printf("\t-x [percent] : Mock server requests dropped without an answer\n");
+  printf("\t-e [percent] : Mock server requests answered with ERR\n");
+  printf("\t-m [ack|cont] : Mock server status, default ack\n");
+  printf("\t-p [port] : Mock server port, default %d\n", MOCKSERVER_DEFAULT_PORT);
+  printf("\t-s [path] : Proxy server, default %s\n", LOADDRIVER_DEFAULT_PROXYSERVER);
+  printf("\t-k [path] : Mock server, default %s\n", LOADDRIVER_DEFAULT_MOCKSERVER);
+  printf("\t-C [file] : Capture the proxy server's traffic, see apps/proxyreplay\n");
+  printf("\t-v : Show the servers' output\n");
+  printf("\n");
+}
+
+/**
+ * Write a proxy configuration that points at the mock server
+ */
+static void _loaddriver_writeConfig() {
+  char host[PATH_MAX];
+
+  unlink(LOADDRIVER_CONFIG_FILENAME);
+
+  snprintf(host, sizeof(host), "127.0.0.1:%d%s", sPort, MOCKSERVER_DEVICEIO_PATH);
+  libconfigio_write(LOADDRIVER_CONFIG_FILENAME, CONFIGIO_CLOUD_HOST, host);
+  libconfigio_write(LOADDRIVER_CONFIG_FILENAME, CONFIGIO_CLOUD_USE_SSL, "false");
+  libconfigio_write(LOADDRIVER_CONFIG_FILENAME, CONFIGIO_CLOUD_NAME, LOADDRIVER_CLOUD_NAME);
+  libconfigio_write(LOADDRIVER_CONFIG_FILENAME, CONFIGIO_DATA_FORMAT_TOKEN_NAME, "xml");
+  libconfigio_write(LOADDRIVER_CONFIG_FILENAME, CONFIGIO_PROXY_LOG_LEVELS_TOKEN_NAME, LOADDRIVER_PROXY_LOG_LEVELS);
+
+  if (sCaptureFilename != NULL) {
+    libconfigio_write(LOADDRIVER_CONFIG_FILENAME, CONFIGIO_PROXY_CAPTURE_FILENAME_TOKEN_NAME, sCaptureFilename);
+  }
+}
+
+/**
+ * Start a server in its own process group, so it can be stopped along with
+ * the processes it forks
+ *
+ * @param argv Path to the server and its arguments
+ * @return The server's process ID, or -1 if it couldn't be started
+ */
+static pid_t _loaddriver_spawn(char *const argv[]) {
+  pid_t pid;
+  int devnull;
+
+  if ((pid = fork()) < 0) {
+    printf("Couldn't fork %s\n", argv[0]);
+    return -1;
+  }
+
+  if (pid == 0) {
+    setpgid(0, 0);
+
+    if (!sVerbose && (devnull = open("/dev/null", O_WRONLY)) >= 0) {
+      dup2(devnull, STDOUT_FILENO);
+      dup2(devnull, STDERR_FILENO);
+      close(devnull);
+    }
+
+    execv(argv[0], argv);
+    printf("Couldn't run %s\n", argv[0]);
+    _exit(127);
+  }
+
+  setpgid(pid, pid);
+  return pid;
+}
+
+/**
+ * Run one synthetic agent, which never returns
+ * @param index Index of the agent, which names its device
+ */
+static void _loaddriver_agent(int index) {
+  char msg[PROXY_MAX_MSG_LEN];
+  char sent[24];
+  uint64_t periodUsec = (uint64_t) (1000000 / sRate);
+  uint64_t next;
+  uint64_t now;
+  int offset;
+  int sequence = 0;
+
+  snprintf(sDeviceId, sizeof(sDeviceId), "load-%d", index);
+
+  // Stay out of the way of the process being measured
+  libiotlog_setLevels(LOADDRIVER_AGENT_LOG_LEVELS);
+  libiotlog_start(NULL);
+
+  while (clientsocket_open("127.0.0.1", DEFAULT_PROXY_PORT) != SUCCESS) {
+    sleep(1);
+  }
+
+  iotxml_addCommandListenerFor(&_loaddriver_execute, "set", sDeviceId, NULL);
+  iotxml_addDevice(sDeviceId, LOADDRIVER_DEVICE_TYPE);
+
+  // Spread the agents out over the period
+  next = _loaddriver_nowUsec() + (periodUsec * index) / sTotalAgents;
+
+  while (true) {
+    now = _loaddriver_nowUsec();
+    if (next > now) {
+      usleep(next - now);
+    }
+    next += periodUsec;
+
+    snprintf(sent, sizeof(sent), "%llu", (unsigned long long) _loaddriver_nowUsec());
+
+    iotxml_newMsg(msg, sizeof(msg));
+    offset = iotxml_addString(msg, sizeof(msg), sDeviceId, LOADDRIVER_DEVICE_TYPE,
+        IOT_PARAM_MEASURE, MOCKSERVER_SENT_PARAM, NULL, 0, sent);
+    offset += iotxml_addInt(msg + offset, sizeof(msg) - offset, sDeviceId, LOADDRIVER_DEVICE_TYPE,
+        IOT_PARAM_MEASURE, "sequence", NULL, 0, sequence++);
+    iotxml_send(msg, sizeof(msg));
+  }
+}
+
+/**
+ * Every command to our device executes right away
+ * @param cmd The command
+ */
+static void _loaddriver_execute(command_t *cmd) {
+  iotxml_sendResult(cmd->commandId, IOT_RESULT_EXECUTED);
+}
+
+/**
+ * Get the statistics from the mock server
+ * @param query Query string to add to the request
+ * @param dest Destination for the report
+ * @param maxSize Size of the destination
+ * @return SUCCESS if we got them
+ */
+static error_t _loaddriver_getStats(const char *query, char *dest, int maxSize) {
+  char url[PATH_MAX];
+  http_param_t params;
+
+  bzero(&params, sizeof(params));
+  params.timeouts.connectTimeout = HTTPCOMM_DEFAULT_CONNECT_TIMEOUT_SEC;
+  params.timeouts.transferTimeout = HTTPCOMM_DEFAULT_CONNECT_TIMEOUT_SEC;
+
+  snprintf(url, sizeof(url), "http://127.0.0.1:%d%s%s", sPort, MOCKSERVER_STATS_PATH, query);
+
+  dest[0] = '\0';
+  if (libhttpcomm_getMsg(NULL, url, NULL, NULL, dest, maxSize, params, NULL) != 0 || dest[0] == '\0') {
+    return FAIL;
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * Add up the CPU time and memory of a process and its children
+ * @param root Process ID of the parent
+ * @param usage Destination for the totals
+ */
+static void _loaddriver_usage(pid_t root, loaddriver_usage_t *usage) {
+  char path[64];
+  char stat[1024];
+  char *focus;
+  DIR *proc;
+  FILE *file;
+  struct dirent *entry;
+  pid_t pid;
+  int ppid;
+  unsigned long long utime;
+  unsigned long long stime;
+  long rssPages;
+  long pageKb = sysconf(_SC_PAGESIZE) / 1024;
+
+  bzero(usage, sizeof(loaddriver_usage_t));
+
+  if ((proc = opendir("/proc")) == NULL) {
+    return;
+  }
+
+  while ((entry = readdir(proc)) != NULL) {
+    if ((pid = atoi(entry->d_name)) <= 0) {
+      continue;
+    }
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    if ((file = fopen(path, "r")) == NULL) {
+      continue;
+    }
+
+    focus = fgets(stat, sizeof(stat), file);
+    fclose(file);
+
+    // The command name in parentheses can hold anything, so start after it
+    if (focus == NULL || (focus = strrchr(stat, ')')) == NULL) {
+      continue;
+    }
+
+    if (sscanf(focus + 2, "%*c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %*d %*d %*d %*d %*d %*d %*u %*u %ld",
+        &ppid, &utime, &stime, &rssPages) != 4) {
+      continue;
+    }
+
+    if (pid == root || ppid == root) {
+      usage->cpuTicks += utime + stime;
+      usage->rssKb += rssPages * pageKb;
+      usage->processes++;
+    }
+  }
+
+  closedir(proc);
+}
+
+/**
+ * Stop measuring and clean up
+ */
+static void _loaddriver_interrupt(int signum) {
+  sInterrupted = true;
+}
+
+/**
+ * @return CLOCK_MONOTONIC microseconds, which the mock server shares
+ */
+static uint64_t _loaddriver_nowUsec() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
@@ -0,0 +1,99 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef LOADDRIVER_H
+#define LOADDRIVER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/** Default number of synthetic agents */
+#ifndef LOADDRIVER_DEFAULT_AGENTS
+#define LOADDRIVER_DEFAULT_AGENTS 4
+#endif
+
+/** Most agents we'll start */
+#ifndef LOADDRIVER_MAX_AGENTS
+#define LOADDRIVER_MAX_AGENTS 256
+#endif
+
+/** Default measurements per second from each agent */
+#ifndef LOADDRIVER_DEFAULT_RATE
+#define LOADDRIVER_DEFAULT_RATE 1.0
+#endif
+
+/** Default seconds to measure for */
+#ifndef LOADDRIVER_DEFAULT_DURATION_SEC
+#define LOADDRIVER_DEFAULT_DURATION_SEC 60
+#endif
+
+/** Default seconds to let everything settle before we start measuring */
+#ifndef LOADDRIVER_DEFAULT_WARMUP_SEC
+#define LOADDRIVER_DEFAULT_WARMUP_SEC 10
+#endif
+
+/** Configuration file written for the proxy server */
+#ifndef LOADDRIVER_CONFIG_FILENAME
+#define LOADDRIVER_CONFIG_FILENAME "/tmp/loaddriver.conf"
+#endif
+
+/** Default location of the proxy server, relative to this directory */
+#ifndef LOADDRIVER_DEFAULT_PROXYSERVER
+#define LOADDRIVER_DEFAULT_PROXYSERVER "../proxyserver/bin/proxyserver"
+#endif
+
+/** Default location of the mock server, relative to this directory */
+#ifndef LOADDRIVER_DEFAULT_MOCKSERVER
+#define LOADDRIVER_DEFAULT_MOCKSERVER "../mockserver/bin/mockserver"
+#endif
+
+/** Log levels of the proxy server and the agents */
+#ifndef LOADDRIVER_PROXY_LOG_LEVELS
+#define LOADDRIVER_PROXY_LOG_LEVELS "*=warning"
+#endif
+
+#ifndef LOADDRIVER_AGENT_LOG_LEVELS
+#define LOADDRIVER_AGENT_LOG_LEVELS "*=warning"
+#endif
+
+/** Name the mock cloud goes by in the proxy's configuration */
+#define LOADDRIVER_CLOUD_NAME "mock"
+
+/** Device type the synthetic devices register with */
+#define LOADDRIVER_DEVICE_TYPE 10000
+
+/** Size of a statistics report from the mock server */
+#define LOADDRIVER_STATS_SIZE 4096
+
+/**
+ * CPU time and memory of the proxy server and the client processes it forked
+ */
+typedef struct loaddriver_usage_t {
+
+  /** User and system time, in clock ticks */
+  uint64_t cpuTicks;
+
+  /** Resident set size, in kB */
+  long rssKb;
+
+  /** Number of processes counted */
+  int processes;
+
+} loaddriver_usage_t;
+
+#endif
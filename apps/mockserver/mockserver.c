@@ -0,0 +1,908 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * A stand-in for the cloud's device API, so the proxy and the agents behind
+ * it can be exercised and measured on one machine without a network.
+ *
+ * It answers the proxy's long-poll GET and h2s POST on /deviceio/ml with
+ * ACK or CONT, hands out commands queued with /inject or generated at a
+ * steady rate, and can be told to answer slowly, drop connections, or
+ * answer ERR.  Measurements carrying a loadSentUsec param and results for
+ * the commands it handed out are timed end to end, and the statistics are
+ * served as text on /stats.
+ *
+ * Messages are expected in XML, so the proxy's DATA_FORMAT must be xml.
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "ioterror.h"
+#include "iotdebug.h"
+#include "mockserver.h"
+
+/** Set to true to stop serving */
+bool gTerminate;
+
+/** Port to listen on */
+static int sPort = MOCKSERVER_DEFAULT_PORT;
+
+/** Milliseconds to wait before answering the device API */
+static int sDelayMs;
+
+/** Percent of device API requests dropped without an answer */
+static int sLossPercent;
+
+/** Percent of device API requests answered with ERR */
+static int sErrorPercent;
+
+/** Commands per second to generate, 0 to only send injected commands */
+static double sCommandRate;
+
+/** True to answer CONT instead of ACK */
+static bool sContinuous;
+
+/** Number of devices generated commands are spread over, load-0 .. load-(n-1) */
+static int sTotalDevices = 1;
+
+/** Protects everything below */
+static pthread_mutex_t sMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Signaled when a command is queued */
+static pthread_cond_t sCommandQueued = PTHREAD_COND_INITIALIZER;
+
+/** Commands waiting for the proxy to pick them up */
+static mockserver_command_t sPending[MOCKSERVER_MAX_PENDING];
+static int sTotalPending;
+
+/** Commands handed out and waiting for a result, indexed by command ID */
+static mockserver_command_t sOutstanding[MOCKSERVER_MAX_OUTSTANDING];
+
+/** Last command ID handed out */
+static int sLastCommandId;
+
+/** Measurement and command latency */
+static mockserver_samples_t sMeasurementLatency;
+static mockserver_samples_t sCommandLatency;
+
+/** Counters since the start or the last reset */
+static uint64_t sStartUsec;
+static uint64_t sBytesReceived;
+static unsigned int sPosts;
+static unsigned int sPolls;
+static unsigned int sMeasurements;
+static unsigned int sCommandsQueued;
+static unsigned int sCommandsRejected;
+static unsigned int sCommandsSent;
+static unsigned int sResults;
+static unsigned int sLost;
+static unsigned int sErrors;
+
+
+/***************** Private Prototypes ****************/
+static void _mockserver_parse(int argc, char *argv[]);
+
+static void _mockserver_printUsage();
+
+static void *_mockserver_connection(void *arg);
+
+static void *_mockserver_generator(void *arg);
+
+static error_t _mockserver_readRequest(int fd, char *buffer, int *bufferLen, int *headerLen, int *requestLen);
+
+static bool _mockserver_handle(int fd, char *request, int headerLen, int requestLen, unsigned int *seed);
+
+static bool _mockserver_deviceio(int fd, const char *method, const char *query, char *body, bool keepAlive, unsigned int *seed);
+
+static void _mockserver_inject(int fd, const char *query, bool keepAlive);
+
+static void _mockserver_stats(int fd, const char *query, bool keepAlive);
+
+static void _mockserver_recordUpload(const char *body, int bodyLen);
+
+static void _mockserver_waitForCommands(const char *query);
+
+static int _mockserver_takeCommands(char *dest, int maxSize);
+
+static int _mockserver_queueCommand(const char *deviceId, const char *name, const char *value);
+
+static int _mockserver_percentiles(char *dest, int maxSize, const char *name, mockserver_samples_t *samples);
+
+static void _mockserver_reset();
+
+static void _mockserver_respond(int fd, int status, const char *contentType, const char *body, int bodyLen, bool keepAlive);
+
+static int _mockserver_getHeader(const char *headers, int headerLen, const char *name, char *dest, int maxSize);
+
+static int _mockserver_getParam(const char *query, const char *name, char *dest, int maxSize);
+
+static void _mockserver_addSample(mockserver_samples_t *samples, uint64_t usec);
+
+static int _mockserver_compare(const void *a, const void *b);
+
+static uint64_t _mockserver_nowUsec();
+
+
+/***************** Functions ****************/
+/**
+ * Main function
+ */
+int main(int argc, char *argv[]) {
+  int sockfd;
+  int clientfd;
+  int on = 1;
+  struct sockaddr_in serverAddress;
+  pthread_t thread;
+  pthread_attr_t attr;
+
+  signal(SIGPIPE, SIG_IGN);
+
+  _mockserver_parse(argc, argv);
+
+  libiotlog_start(NULL);
+
+  sStartUsec = _mockserver_nowUsec();
+
+  if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+    SYSLOG_ERR("[mockserver] Couldn't open a socket");
+    exit(1);
+  }
+
+  setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  bzero((char *) &serverAddress, sizeof(serverAddress));
+  serverAddress.sin_family = AF_INET;
+  serverAddress.sin_addr.s_addr = INADDR_ANY;
+  serverAddress.sin_port = htons(sPort);
+
+  if (bind(sockfd, (struct sockaddr *) &serverAddress, sizeof(serverAddress)) < 0) {
+    printf("Could not bind to port %d\n", sPort);
+    SYSLOG_ERR("[mockserver] Could not bind to port %d", sPort);
+    exit(1);
+  }
+
+  listen(sockfd, 64);
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  if (sCommandRate > 0) {
+    pthread_create(&thread, &attr, _mockserver_generator, NULL);
+  }
+
+  printf("Mock server running; port=%d; delay=%dms; loss=%d%%; errors=%d%%; commands=%.1f/s; mode=%s\n",
+      sPort, sDelayMs, sLossPercent, sErrorPercent, sCommandRate, sContinuous ? "CONT" : "ACK");
+  fflush(stdout);
+
+  while (!gTerminate) {
+    if ((clientfd = accept(sockfd, NULL, NULL)) < 0) {
+      if (errno != EINTR) {
+        SYSLOG_ERR("[mockserver] accept: %s", strerror(errno));
+      }
+      continue;
+    }
+
+    if (pthread_create(&thread, &attr, _mockserver_connection, (void *) (intptr_t) clientfd) != 0) {
+      SYSLOG_ERR("[mockserver] Couldn't create a connection thread");
+      close(clientfd);
+    }
+  }
+
+  close(sockfd);
+  libiotlog_stop();
+  return 0;
+}
+
+
+/***************** Private Functions ****************/
+/**
+ * Parse the command line arguments
+ */
+static void _mockserver_parse(int argc, char *argv[]) {
+  int c;
+
+  while ((c = getopt(argc, argv, "p:d:l:e:c:m:n:h")) != -1) {
+    switch (c) {
+    case 'p':
+      sPort = atoi(optarg);
+      break;
+
+    case 'd':
+      sDelayMs = atoi(optarg);
+      break;
+
+    case 'l':
+      sLossPercent = atoi(optarg);
+      break;
+
+    case 'e':
+      sErrorPercent = atoi(optarg);
+      break;
+
+    case 'c':
+      sCommandRate = atof(optarg);
+      break;
+
+    case 'm':
+      sContinuous = (strcasecmp(optarg, "cont") == 0);
+      break;
+
+    case 'n':
+      sTotalDevices = atoi(optarg);
+      if (sTotalDevices < 1) {
+        sTotalDevices = 1;
+      }
+      break;
+
+    default:
+      _mockserver_printUsage();
+      exit(c == 'h' ? 0 : 1);
+      break;
+    }
+  }
+}
+
+/**
+ * Print the command line usage
+ */
+static void _mockserver_printUsage() {
+  printf("Usage: mockserver [options]\n");
+  printf("\t-p [port] : Port to listen on, default %d\n", MOCKSERVER_DEFAULT_PORT);
+  printf("\t-d [ms] : Delay before answering the device API\n");
+  printf("\t-l [percent] : Drop this percent of device API requests without an answer\n");
+  printf("\t-e [percent] : Answer this percent of device API requests with ERR\n");
+  printf("\t-c [rate] : Generate this many commands per second\n");
+  printf("\t-m [ack|cont] : Status to answer with, default ack\n");
+  printf("\t-n [devices] : Spread generated commands over devices load-0 .. load-(n-1)\n");
+  printf("\n");
+  printf("\t%s?deviceId=..&name=..&value=.. : Queue a command\n", MOCKSERVER_INJECT_PATH);
+  printf("\t%s[?reset=1] : Statistics, optionally starting over afterwards\n", MOCKSERVER_STATS_PATH);
+  printf("\n");
+}
+
+/**
+ * Serve requests on one connection until the client closes it
+ * @param arg Socket file descriptor
+ */
+static void *_mockserver_connection(void *arg) {
+  int fd = (int) (intptr_t) arg;
+  char *buffer;
+  int bufferLen = 0;
+  int headerLen;
+  int requestLen;
+  unsigned int seed = (unsigned int) (fd ^ _mockserver_nowUsec());
+  bool keepAlive = true;
+
+  if ((buffer = malloc(MOCKSERVER_MAX_REQUEST_SIZE + 1)) == NULL) {
+    close(fd);
+    return NULL;
+  }
+
+  while (keepAlive && !gTerminate) {
+    if (_mockserver_readRequest(fd, buffer, &bufferLen, &headerLen, &requestLen) != SUCCESS) {
+      break;
+    }
+
+    keepAlive = _mockserver_handle(fd, buffer, headerLen, requestLen, &seed);
+
+    // Keep whatever the client sent after this request
+    bufferLen -= requestLen;
+    memmove(buffer, buffer + requestLen, bufferLen);
+  }
+
+  free(buffer);
+  close(fd);
+  return NULL;
+}
+
+/**
+ * Generate commands to random devices at the configured rate
+ */
+static void *_mockserver_generator(void *arg) {
+  char deviceId[MOCKSERVER_FIELD_SIZE];
+  unsigned int seed = (unsigned int) _mockserver_nowUsec();
+  uint64_t periodUsec = (uint64_t) (1000000 / sCommandRate);
+  uint64_t next = _mockserver_nowUsec();
+  uint64_t now;
+  int count = 0;
+
+  while (!gTerminate) {
+    next += periodUsec;
+    now = _mockserver_nowUsec();
+    if (next > now) {
+      usleep(next - now);
+    }
+
+    snprintf(deviceId, sizeof(deviceId), "load-%d", rand_r(&seed) % sTotalDevices);
+    _mockserver_queueCommand(deviceId, "outletStatus", (count++ & 1) ? "ON" : "OFF");
+  }
+
+  return NULL;
+}
+
+/**
+ * Read one HTTP request into the buffer, which may already hold the start
+ * of it. Clients that ask to hear back before sending the body are told to
+ * continue.
+ *
+ * @param fd Socket
+ * @param buffer Buffer of MOCKSERVER_MAX_REQUEST_SIZE + 1 bytes
+ * @param bufferLen Number of bytes in the buffer, updated as we read
+ * @param headerLen Returns the length of the headers, including the blank line
+ * @param requestLen Returns the length of the whole request
+ * @return SUCCESS if there's a complete request at the start of the buffer
+ */
+static error_t _mockserver_readRequest(int fd, char *buffer, int *bufferLen, int *headerLen, int *requestLen) {
+  char value[32];
+  char *headerEnd;
+  int received;
+
+  *requestLen = -1;
+  buffer[*bufferLen] = '\0';
+
+  while (*requestLen < 0 || *bufferLen < *requestLen) {
+    if (*requestLen < 0 && (headerEnd = strstr(buffer, "\r\n\r\n")) != NULL) {
+      // Headers are in, work out how much more there is
+      *headerLen = headerEnd + 4 - buffer;
+      *requestLen = *headerLen;
+
+      if (_mockserver_getHeader(buffer, *headerLen, "Content-Length", value, sizeof(value)) > 0) {
+        *requestLen += atoi(value);
+      }
+
+      if (*requestLen > MOCKSERVER_MAX_REQUEST_SIZE) {
+        SYSLOG_WARNING("[mockserver] Request of %d bytes is too big", *requestLen);
+        return FAIL;
+      }
+
+      if (*bufferLen < *requestLen
+          && _mockserver_getHeader(buffer, *headerLen, "Expect", value, sizeof(value)) > 0
+          && strcasecmp(value, "100-continue") == 0) {
+        send(fd, "HTTP/1.1 100 Continue\r\n\r\n", 25, MSG_NOSIGNAL);
+      }
+
+      continue;
+    }
+
+    if (*bufferLen >= MOCKSERVER_MAX_REQUEST_SIZE) {
+      return FAIL;
+    }
+
+    if ((received = recv(fd, buffer + *bufferLen, MOCKSERVER_MAX_REQUEST_SIZE - *bufferLen, 0)) <= 0) {
+      return FAIL;
+    }
+
+    *bufferLen += received;
+    buffer[*bufferLen] = '\0';
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * Route a request
+ * @return true to keep the connection open
+ */
+static bool _mockserver_handle(int fd, char *request, int headerLen, int requestLen, unsigned int *seed) {
+  char method[8];
+  char path[PATH_MAX];
+  char value[32];
+  char *query;
+  char *body = request + headerLen;
+  char saved = request[requestLen];
+  bool keepAlive = true;
+
+  if (sscanf(request, "%7s %4095s", method, path) != 2) {
+    _mockserver_respond(fd, 400, "text/plain", "", 0, false);
+    return false;
+  }
+
+  if (_mockserver_getHeader(request, headerLen, "Connection", value, sizeof(value)) > 0
+      && strcasecmp(value, "close") == 0) {
+    keepAlive = false;
+  }
+
+  if ((query = strchr(path, '?')) != NULL) {
+    *query++ = '\0';
+  } else {
+    query = "";
+  }
+
+  // Let the handlers treat the body as a string
+  request[requestLen] = '\0';
+
+  if (strcmp(path, MOCKSERVER_DEVICEIO_PATH) == 0) {
+    __sync_fetch_and_add(&sBytesReceived, requestLen - headerLen);
+    keepAlive = _mockserver_deviceio(fd, method, query, body, keepAlive, seed);
+
+  } else if (strcmp(path, MOCKSERVER_INJECT_PATH) == 0) {
+    _mockserver_inject(fd, query, keepAlive);
+
+  } else if (strcmp(path, MOCKSERVER_STATS_PATH) == 0) {
+    _mockserver_stats(fd, query, keepAlive);
+
+  } else if (strstr(path, MOCKSERVER_SETTINGS_PATH) != NULL) {
+    // No settings, the proxy sticks with the cloud in its configuration file
+    const char *settings = "<?xml version=\"1.0\" encoding=\"UTF-8\"?><response/>";
+    _mockserver_respond(fd, 200, "text/xml", settings, strlen(settings), keepAlive);
+
+  } else {
+    _mockserver_respond(fd, 404, "text/plain", "", 0, keepAlive);
+  }
+
+  request[requestLen] = saved;
+  return keepAlive;
+}
+
+/**
+ * Answer the device API, long-polling a GET until there's a command or it
+ * times out
+ *
+ * @return true to keep the connection open
+ */
+static bool _mockserver_deviceio(int fd, const char *method, const char *query, char *body, bool keepAlive, unsigned int *seed) {
+  char response[MOCKSERVER_MAX_RESPONSE_SIZE];
+  int responseLen;
+
+  if (sDelayMs > 0) {
+    usleep(sDelayMs * 1000);
+  }
+
+  if (sLossPercent > 0 && (rand_r(seed) % 100) < sLossPercent) {
+    __sync_fetch_and_add(&sLost, 1);
+    return false;
+  }
+
+  if (sErrorPercent > 0 && (rand_r(seed) % 100) < sErrorPercent) {
+    __sync_fetch_and_add(&sErrors, 1);
+    _mockserver_respond(fd, 200, "text/xml", "ERR", 3, keepAlive);
+    return keepAlive;
+  }
+
+  if (strcmp(method, "POST") == 0) {
+    __sync_fetch_and_add(&sPosts, 1);
+    _mockserver_recordUpload(body, strlen(body));
+
+  } else {
+    __sync_fetch_and_add(&sPolls, 1);
+    _mockserver_waitForCommands(query);
+  }
+
+  responseLen = _mockserver_takeCommands(response, sizeof(response));
+  _mockserver_respond(fd, 200, "text/xml", response, responseLen, keepAlive);
+  return keepAlive;
+}
+
+/**
+ * Queue a command from the query string
+ */
+static void _mockserver_inject(int fd, const char *query, bool keepAlive) {
+  char deviceId[MOCKSERVER_FIELD_SIZE];
+  char name[MOCKSERVER_FIELD_SIZE];
+  char value[MOCKSERVER_FIELD_SIZE];
+  char response[64];
+  int commandId;
+
+  if (_mockserver_getParam(query, "deviceId", deviceId, sizeof(deviceId)) <= 0
+      || _mockserver_getParam(query, "name", name, sizeof(name)) <= 0) {
+    _mockserver_respond(fd, 400, "text/plain", "deviceId and name are required\n", 31, keepAlive);
+    return;
+  }
+
+  _mockserver_getParam(query, "value", value, sizeof(value));
+
+  if ((commandId = _mockserver_queueCommand(deviceId, name, value)) < 0) {
+    _mockserver_respond(fd, 503, "text/plain", "Too many commands pending\n", 26, keepAlive);
+    return;
+  }
+
+  snprintf(response, sizeof(response), "%d\n", commandId);
+  _mockserver_respond(fd, 200, "text/plain", response, strlen(response), keepAlive);
+}
+
+/**
+ * Report the statistics as "name value" lines
+ */
+static void _mockserver_stats(int fd, const char *query, bool keepAlive) {
+  char response[MOCKSERVER_MAX_RESPONSE_SIZE];
+  char reset[8];
+  double elapsedSec;
+  int offset;
+
+  pthread_mutex_lock(&sMutex);
+
+  elapsedSec = (_mockserver_nowUsec() - sStartUsec) / 1000000.0;
+
+  offset = snprintf(response, sizeof(response),
+      "elapsed_sec %.1f\n"
+      "posts %u\n"
+      "polls %u\n"
+      "bytes_received %llu\n"
+      "measurements %u\n"
+      "measurements_per_sec %.1f\n"
+      "commands_queued %u\n"
+      "commands_rejected %u\n"
+      "commands_sent %u\n"
+      "command_results %u\n"
+      "requests_lost %u\n"
+      "requests_failed %u\n",
+      elapsedSec,
+      sPosts,
+      sPolls,
+      (unsigned long long) sBytesReceived,
+      sMeasurements,
+      elapsedSec > 0 ? sMeasurements / elapsedSec : 0,
+      sCommandsQueued,
+      sCommandsRejected,
+      sCommandsSent,
+      sResults,
+      sLost,
+      sErrors);
+
+  offset += _mockserver_percentiles(response + offset, sizeof(response) - offset, "measurement_latency_ms", &sMeasurementLatency);
+  offset += _mockserver_percentiles(response + offset, sizeof(response) - offset, "command_latency_ms", &sCommandLatency);
+
+  if (_mockserver_getParam(query, "reset", reset, sizeof(reset)) > 0 && atoi(reset)) {
+    _mockserver_reset();
+  }
+
+  pthread_mutex_unlock(&sMutex);
+
+  _mockserver_respond(fd, 200, "text/plain", response, offset, keepAlive);
+}
+
+/**
+ * Time the measurements and command results in an h2s message
+ * @param body The h2s message
+ * @param bodyLen Length of the message
+ */
+static void _mockserver_recordUpload(const char *body, int bodyLen) {
+  const char *focus;
+  const char *result;
+  const char *end;
+  uint64_t now = _mockserver_nowUsec();
+  uint64_t sent;
+  int commandId;
+  mockserver_command_t *command;
+
+  pthread_mutex_lock(&sMutex);
+
+  // <param name="loadSentUsec">123</param>
+  focus = body;
+  while ((focus = strstr(focus, "name=\"" MOCKSERVER_SENT_PARAM "\"")) != NULL) {
+    if ((focus = strchr(focus, '>')) == NULL) {
+      break;
+    }
+
+    sent = strtoull(++focus, NULL, 10);
+    if (sent > 0 && sent <= now) {
+      _mockserver_addSample(&sMeasurementLatency, now - sent);
+    }
+    sMeasurements++;
+  }
+
+  // <response cmdId="12" result="1"/>, where result 0 only says it arrived
+  focus = body;
+  while ((focus = strstr(focus, "<response cmdId=\"")) != NULL) {
+    focus += strlen("<response cmdId=\"");
+    commandId = atoi(focus);
+
+    end = strchr(focus, '>');
+    result = strstr(focus, "result=\"");
+    if (end == NULL || result == NULL || result > end || atoi(result + strlen("result=\"")) == 0) {
+      continue;
+    }
+
+    command = &sOutstanding[commandId & (MOCKSERVER_MAX_OUTSTANDING - 1)];
+    if (commandId > 0 && command->commandId == commandId) {
+      _mockserver_addSample(&sCommandLatency, now - command->queuedUsec);
+      command->commandId = 0;
+      sResults++;
+    }
+  }
+
+  pthread_mutex_unlock(&sMutex);
+}
+
+/**
+ * Hold a poll open until there's a command to send or it times out
+ * @param query Query string holding the timeout the proxy asked for
+ */
+static void _mockserver_waitForCommands(const char *query) {
+  char value[16];
+  int timeoutSec = MOCKSERVER_MAX_POLL_SEC;
+  struct timespec deadline;
+
+  if (_mockserver_getParam(query, "timeout", value, sizeof(value)) > 0 && atoi(value) > 0
+      && atoi(value) < MOCKSERVER_MAX_POLL_SEC) {
+    timeoutSec = atoi(value);
+  }
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += timeoutSec;
+
+  pthread_mutex_lock(&sMutex);
+  while (sTotalPending == 0 && !gTerminate) {
+    if (pthread_cond_timedwait(&sCommandQueued, &sMutex, &deadline) == ETIMEDOUT) {
+      break;
+    }
+  }
+  pthread_mutex_unlock(&sMutex);
+}
+
+/**
+ * Write an s2h message with as many pending commands as fit
+ * @param dest Destination buffer
+ * @param maxSize Size of the buffer
+ * @return Length of the message
+ */
+static int _mockserver_takeCommands(char *dest, int maxSize) {
+  char command[MOCKSERVER_FIELD_SIZE * 4];
+  int commandLen;
+  int offset;
+  int taken = 0;
+  const char *closing = "</s2h>";
+
+  offset = snprintf(dest, maxSize, "<?xml version=\"1.0\" encoding=\"UTF-8\"?><s2h ver=\"2\" status=\"%s\">",
+      sContinuous ? "CONT" : "ACK");
+
+  pthread_mutex_lock(&sMutex);
+
+  while (taken < sTotalPending) {
+    mockserver_command_t *pending = &sPending[taken];
+
+    commandLen = snprintf(command, sizeof(command),
+        "<command type=\"set\" cmdId=\"%d\" deviceId=\"%s\"><param name=\"%s\">%s</param></command>",
+        pending->commandId, pending->deviceId, pending->name, pending->value);
+
+    if (offset + commandLen + (int) strlen(closing) >= maxSize) {
+      break;
+    }
+
+    memcpy(dest + offset, command, commandLen);
+    offset += commandLen;
+
+    sOutstanding[pending->commandId & (MOCKSERVER_MAX_OUTSTANDING - 1)] = *pending;
+    taken++;
+  }
+
+  sTotalPending -= taken;
+  memmove(sPending, sPending + taken, sTotalPending * sizeof(mockserver_command_t));
+  sCommandsSent += taken;
+
+  pthread_mutex_unlock(&sMutex);
+
+  offset += snprintf(dest + offset, maxSize - offset, "%s", closing);
+  return offset;
+}
+
+/**
+ * Queue a command for the proxy to pick up
+ * @return The command ID, or -1 if too many commands are pending
+ */
+static int _mockserver_queueCommand(const char *deviceId, const char *name, const char *value) {
+  mockserver_command_t *command;
+  int commandId = -1;
+
+  pthread_mutex_lock(&sMutex);
+
+  if (sTotalPending < MOCKSERVER_MAX_PENDING) {
+    command = &sPending[sTotalPending++];
+    command->commandId = commandId = ++sLastCommandId;
+    snprintf(command->deviceId, sizeof(command->deviceId), "%s", deviceId);
+    snprintf(command->name, sizeof(command->name), "%s", name);
+    snprintf(command->value, sizeof(command->value), "%s", value);
+    command->queuedUsec = _mockserver_nowUsec();
+    sCommandsQueued++;
+    pthread_cond_broadcast(&sCommandQueued);
+
+  } else {
+    sCommandsRejected++;
+  }
+
+  pthread_mutex_unlock(&sMutex);
+  return commandId;
+}
+
+/**
+ * Write a line of latency percentiles, called with the mutex held
+ * @return Number of bytes written
+ */
+static int _mockserver_percentiles(char *dest, int maxSize, const char *name, mockserver_samples_t *samples) {
+  uint64_t *sorted;
+  uint32_t total = samples->total < MOCKSERVER_MAX_SAMPLES ? samples->total : MOCKSERVER_MAX_SAMPLES;
+  int written;
+
+  if (total == 0 || (sorted = malloc(total * sizeof(uint64_t))) == NULL) {
+    written = snprintf(dest, maxSize, "%s samples=0\n", name);
+    return written < maxSize ? written : maxSize - 1;
+  }
+
+  memcpy(sorted, samples->samples, total * sizeof(uint64_t));
+  qsort(sorted, total, sizeof(uint64_t), _mockserver_compare);
+
+  written = snprintf(dest, maxSize, "%s p50=%.2f p90=%.2f p99=%.2f max=%.2f samples=%u\n",
+      name,
+      sorted[total / 2] / 1000.0,
+      sorted[(total * 90) / 100] / 1000.0,
+      sorted[(total * 99) / 100] / 1000.0,
+      sorted[total - 1] / 1000.0,
+      total);
+
+  free(sorted);
+  return written < maxSize ? written : maxSize - 1;
+}
+
+/**
+ * Start the statistics over, called with the mutex held
+ */
+static void _mockserver_reset() {
+  sStartUsec = _mockserver_nowUsec();
+  sBytesReceived = 0;
+  sPosts = 0;
+  sPolls = 0;
+  sMeasurements = 0;
+  sCommandsQueued = 0;
+  sCommandsRejected = 0;
+  sCommandsSent = 0;
+  sResults = 0;
+  sLost = 0;
+  sErrors = 0;
+  sMeasurementLatency.total = 0;
+  sCommandLatency.total = 0;
+
+  // Results for commands handed out before now don't count
+  bzero(sOutstanding, sizeof(sOutstanding));
+}
+
+/**
+ * Send an HTTP response
+ */
+static void _mockserver_respond(int fd, int status, const char *contentType, const char *body, int bodyLen, bool keepAlive) {
+  char headers[256];
+  int headersLen;
+
+  headersLen = snprintf(headers, sizeof(headers),
+      "HTTP/1.1 %d %s\r\n"
+      "Content-Type: %s\r\n"
+      "Content-Length: %d\r\n"
+      "Connection: %s\r\n"
+      "\r\n",
+      status, status == 200 ? "OK" : "Error",
+      contentType,
+      bodyLen,
+      keepAlive ? "keep-alive" : "close");
+
+  if (send(fd, headers, headersLen, MSG_NOSIGNAL | (bodyLen > 0 ? MSG_MORE : 0)) == headersLen && bodyLen > 0) {
+    send(fd, body, bodyLen, MSG_NOSIGNAL);
+  }
+}
+
+/**
+ * Find the value of a header
+ * @param headers Request headers
+ * @param headerLen Length of the headers
+ * @param name Header name, matched without regard to case
+ * @param dest Destination for the value
+ * @param maxSize Size of the destination
+ * @return Length of the value, or -1 if the header isn't there
+ */
+static int _mockserver_getHeader(const char *headers, int headerLen, const char *name, char *dest, int maxSize) {
+  const char *line = headers;
+  const char *end = headers + headerLen;
+  const char *lineEnd;
+  int nameLen = strlen(name);
+  int valueLen;
+
+  while (line < end && (lineEnd = strstr(line, "\r\n")) != NULL && lineEnd < end) {
+    if (lineEnd - line > nameLen && strncasecmp(line, name, nameLen) == 0 && line[nameLen] == ':') {
+      line += nameLen + 1;
+      while (*line == ' ') {
+        line++;
+      }
+
+      valueLen = lineEnd - line;
+      if (valueLen >= maxSize) {
+        valueLen = maxSize - 1;
+      }
+
+      memcpy(dest, line, valueLen);
+      dest[valueLen] = '\0';
+      return valueLen;
+    }
+
+    line = lineEnd + 2;
+  }
+
+  return -1;
+}
+
+/**
+ * Find the value of a query string parameter
+ * @return Length of the value, or -1 if the parameter isn't there
+ */
+static int _mockserver_getParam(const char *query, const char *name, char *dest, int maxSize) {
+  const char *focus = query;
+  int nameLen = strlen(name);
+  int valueLen;
+
+  dest[0] = '\0';
+
+  while (*focus) {
+    if (strncmp(focus, name, nameLen) == 0 && focus[nameLen] == '=') {
+      focus += nameLen + 1;
+      valueLen = strcspn(focus, "&");
+      if (valueLen >= maxSize) {
+        valueLen = maxSize - 1;
+      }
+
+      memcpy(dest, focus, valueLen);
+      dest[valueLen] = '\0';
+      return valueLen;
+    }
+
+    focus += strcspn(focus, "&");
+    if (*focus == '&') {
+      focus++;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * Add a latency sample, called with the mutex held
+ */
+static void _mockserver_addSample(mockserver_samples_t *samples, uint64_t usec) {
+  samples->samples[samples->total % MOCKSERVER_MAX_SAMPLES] = usec;
+  samples->total++;
+}
+
+/**
+ * Order latency samples for qsort
+ */
+static int _mockserver_compare(const void *a, const void *b) {
+  uint64_t x = *((const uint64_t *) a);
+  uint64_t y = *((const uint64_t *) b);
+  return (x > y) - (x < y);
+}
+
+/**
+ * @return CLOCK_MONOTONIC microseconds, which agents on this machine share
+ */
+static uint64_t _mockserver_nowUsec() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
@@ -0,0 +1,106 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef MOCKSERVER_H
+#define MOCKSERVER_H
+
+#include <stdint.h>
+
+#ifndef MOCKSERVER_DEFAULT_PORT
+#define MOCKSERVER_DEFAULT_PORT 8090
+#endif
+
+/** Path the proxy pushes to and polls */
+#define MOCKSERVER_DEVICEIO_PATH "/deviceio/ml"
+
+/** Path that queues a command, i.e. /inject?deviceId=load-1&name=outletStatus&value=1 */
+#define MOCKSERVER_INJECT_PATH "/inject"
+
+/** Path that reports the statistics */
+#define MOCKSERVER_STATS_PATH "/stats"
+
+/** Path the proxy server looks up its connection settings on */
+#define MOCKSERVER_SETTINGS_PATH "/settings"
+
+/** Name of the measurement param that carries the CLOCK_MONOTONIC microseconds it was sent at */
+#define MOCKSERVER_SENT_PARAM "loadSentUsec"
+
+/** Largest request we accept */
+#ifndef MOCKSERVER_MAX_REQUEST_SIZE
+#define MOCKSERVER_MAX_REQUEST_SIZE 65536
+#endif
+
+/** Largest response we send */
+#ifndef MOCKSERVER_MAX_RESPONSE_SIZE
+#define MOCKSERVER_MAX_RESPONSE_SIZE 16384
+#endif
+
+/** Longest we hold a poll open, whatever the proxy asks for */
+#ifndef MOCKSERVER_MAX_POLL_SEC
+#define MOCKSERVER_MAX_POLL_SEC 30
+#endif
+
+/** Commands waiting to be picked up by the proxy */
+#ifndef MOCKSERVER_MAX_PENDING
+#define MOCKSERVER_MAX_PENDING 64
+#endif
+
+/** Commands delivered and waiting for a result, a power of 2 */
+#ifndef MOCKSERVER_MAX_OUTSTANDING
+#define MOCKSERVER_MAX_OUTSTANDING 1024
+#endif
+
+/** Latency samples kept for the percentiles */
+#ifndef MOCKSERVER_MAX_SAMPLES
+#define MOCKSERVER_MAX_SAMPLES 65536
+#endif
+
+/** Maximum size of a device ID, command name or value */
+#define MOCKSERVER_FIELD_SIZE 64
+
+/**
+ * A command the server sends to a device
+ */
+typedef struct mockserver_command_t {
+
+  int commandId;
+
+  char deviceId[MOCKSERVER_FIELD_SIZE];
+
+  char name[MOCKSERVER_FIELD_SIZE];
+
+  char value[MOCKSERVER_FIELD_SIZE];
+
+  /** CLOCK_MONOTONIC microseconds the command was queued at */
+  uint64_t queuedUsec;
+
+} mockserver_command_t;
+
+/**
+ * Latency samples in microseconds, the oldest overwritten once it's full
+ */
+typedef struct mockserver_samples_t {
+
+  uint64_t samples[MOCKSERVER_MAX_SAMPLES];
+
+  /** Number of samples ever added */
+  uint32_t total;
+
+} mockserver_samples_t;
+
+#endif
@@ -0,0 +1,430 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * Replays a capture of the proxy's traffic with the server, see
+ * iot/proxy/proxycapture.c, through the same code the proxy runs it through,
+ * with no server and no network.
+ *
+ * Every message the server sent is broadcast to the proxy listeners, where
+ * our listener parses it like an agent does and dispatches the commands in
+ * it.  Every batch the proxy pushed is framed for the server again, in the
+ * selected DATA_FORMAT.  The replay either keeps the pace the traffic was
+ * captured at, scaled by -s, or goes as fast as it can with -s 0 to measure
+ * the throughput of the proxy's own code.
+ *
+ * A replay is deterministic: the same capture always dispatches the same
+ * commands and frames the same bytes.  The digest printed at the end covers
+ * both, so two builds of the SDK can be checked to treat a capture the same
+ * way before their throughput is compared.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "libiotlog.h"
+
+#include "ioterror.h"
+#include "iotdebug.h"
+#include "iotapi.h"
+#include "proxy.h"
+#include "proxylisteners.h"
+#include "proxyconfig.h"
+#include "proxycapture.h"
+#include "h2swrapper.h"
+#include "proxyreplay.h"
+
+/** Defined by whatever links the proxy, see proxyserver.c */
+char *argEui64Bytes = NULL;
+char *argDeviceType = NULL;
+
+/** Capture file to replay */
+static const char *sFilename;
+
+/** Replay speed, 0 to go as fast as we can */
+static double sSpeed = PROXYREPLAY_DEFAULT_SPEED;
+
+/** Number of times to replay the capture */
+static int sRepeat = 1;
+
+/** DATA_FORMAT the batches are framed in */
+static const char *sDataFormat = "xml";
+
+/** Parser the agents' side of the replay uses */
+static iotxml_parser_e sParser = IOTXML_PARSER_STREAM;
+
+/** True to print the records instead of replaying them */
+static bool sDump;
+
+/** Replay statistics of the messages from and to the server */
+static proxyreplay_stats_t sInbound;
+static proxyreplay_stats_t sOutbound;
+
+/** Commands dispatched to our command listener */
+static long sCommands;
+
+/** FNV-1a digest of the commands dispatched and the bytes framed */
+static uint64_t sDigest = 0xcbf29ce484222325ULL;
+
+/** Scratch space to frame a batch in */
+static char sEncodedMsg[PROXY_MAX_HTTP_SEND_MESSAGE_LEN];
+
+
+/***************** Private Prototypes ****************/
+static void _proxyreplay_parse(int argc, char *argv[]);
+
+static void _proxyreplay_printUsage();
+
+static error_t _proxyreplay_replay();
+
+static void _proxyreplay_dump();
+
+static void _proxyreplay_inbound(const proxycapture_record_t *record);
+
+static void _proxyreplay_outbound(const proxycapture_record_t *record);
+
+static void _proxyreplay_serverListener(const char *msg, int len);
+
+static void _proxyreplay_execute(command_t *cmd);
+
+static void _proxyreplay_digest(const void *data, int len);
+
+static void _proxyreplay_count(proxyreplay_stats_t *stats, int len, uint64_t nsec);
+
+static void _proxyreplay_print(const char *name, const proxyreplay_stats_t *stats);
+
+static uint64_t _proxyreplay_nowNsec();
+
+
+/***************** Functions ****************/
+/**
+ * Main function
+ */
+int main(int argc, char *argv[]) {
+  uint64_t start;
+  double elapsedSec;
+  int i;
+
+  _proxyreplay_parse(argc, argv);
+
+  libiotlog_setLevels(PROXYREPLAY_LOG_LEVELS);
+
+  if (sDump) {
+    _proxyreplay_dump();
+    return 0;
+  }
+
+  proxyconfig_start();
+  proxylisteners_start();
+
+  if (proxyconfig_setDataFormat(sDataFormat) != SUCCESS) {
+    printf("Unknown data format %s\n", sDataFormat);
+    return 1;
+  }
+
+  iotxml_setParser(sParser);
+  iotxml_addCommandListener(&_proxyreplay_execute, NULL);
+  proxylisteners_addListener(&_proxyreplay_serverListener);
+
+  start = _proxyreplay_nowNsec();
+
+  for (i = 0; i < sRepeat; i++) {
+    if (_proxyreplay_replay() != SUCCESS) {
+      return 1;
+    }
+  }
+
+  elapsedSec = (_proxyreplay_nowNsec() - start) / 1e9;
+
+  printf("Replayed %s %d time(s) in %.3f s\n", sFilename, sRepeat, elapsedSec);
+  _proxyreplay_print("Inbound", &sInbound);
+  printf("  %ld commands dispatched\n", sCommands);
+  _proxyreplay_print("Outbound", &sOutbound);
+  printf("Digest %016llx\n", (unsigned long long) sDigest);
+
+  proxylisteners_stop();
+  proxyconfig_stop();
+  return 0;
+}
+
+/**
+ * Messages the command listener sends, i.e. results, go nowhere
+ */
+error_t application_send(const char *msg, int len) {
+  return SUCCESS;
+}
+
+
+/***************** Private Functions ****************/
+/**
+ * Parse the command line arguments
+ */
+static void _proxyreplay_parse(int argc, char *argv[]) {
+  int c;
+
+  while ((c = getopt(argc, argv, "f:s:n:F:p:dh")) != -1) {
+    switch (c) {
+    case 'f':
+      sFilename = optarg;
+      break;
+
+    case 's':
+      sSpeed = atof(optarg);
+      if (sSpeed < 0) {
+        printf("The speed can't be negative\n");
+        exit(1);
+      }
+      break;
+
+    case 'n':
+      sRepeat = atoi(optarg);
+      if (sRepeat < 1) {
+        printf("The capture must be replayed at least once\n");
+        exit(1);
+      }
+      break;
+
+    case 'F':
+      sDataFormat = optarg;
+      break;
+
+    case 'p':
+      if (strcmp(optarg, "libxml2") == 0) {
+        sParser = IOTXML_PARSER_LIBXML2;
+
+      } else if (strcmp(optarg, "stream") == 0) {
+        sParser = IOTXML_PARSER_STREAM;
+
+      } else {
+        printf("Unknown parser %s\n", optarg);
+        exit(1);
+      }
+      break;
+
+    case 'd':
+      sDump = true;
+      break;
+
+    default:
+      _proxyreplay_printUsage();
+      exit(c == 'h' ? 0 : 1);
+      break;
+    }
+  }
+
+  if (sFilename == NULL) {
+    _proxyreplay_printUsage();
+    exit(1);
+  }
+}
+
+/**
+ * Print the command line usage
+ */
+static void _proxyreplay_printUsage() {
+  printf("Usage: proxyreplay -f [capture] [options]\n");
+  printf("\t-f [capture] : Capture file written by the proxy, see PROXY_CAPTURE_FILENAME\n");
+  printf("\t-s [speed] : Times the captured pace, 0 to go as fast as possible, default %.1f\n", PROXYREPLAY_DEFAULT_SPEED);
+  printf("\t-n [times] : Replay the capture this many times, default 1\n");
+  printf("\t-F [xml|json|cbor] : DATA_FORMAT to frame the batches in, default xml\n");
+  printf("\t-p [stream|libxml2] : Parser for the server's messages, default stream\n");
+  printf("\t-d : Print the records instead of replaying them\n");
+  printf("\n");
+}
+
+/**
+ * Replay the capture once, keeping its pace unless the speed is 0
+ * @return SUCCESS if the capture could be read
+ */
+static error_t _proxyreplay_replay() {
+  proxycapture_reader_t reader;
+  proxycapture_record_t record;
+  uint64_t start;
+  uint64_t due;
+  uint64_t now;
+
+  if (proxycapture_open(&reader, sFilename) != SUCCESS) {
+    printf("Couldn't read the capture %s\n", sFilename);
+    return FAIL;
+  }
+
+  start = _proxyreplay_nowNsec();
+
+  while (proxycapture_next(&reader, &record) == SUCCESS) {
+    if (sSpeed > 0) {
+      due = start + (uint64_t) (record.usec * 1000 / sSpeed);
+      now = _proxyreplay_nowNsec();
+      if (due > now) {
+        usleep((due - now) / 1000);
+      }
+    }
+
+    if (record.direction == PROXYCAPTURE_INBOUND) {
+      _proxyreplay_inbound(&record);
+
+    } else {
+      _proxyreplay_outbound(&record);
+    }
+  }
+
+  proxycapture_close(&reader);
+  return SUCCESS;
+}
+
+/**
+ * Print the records of the capture, one line each
+ */
+static void _proxyreplay_dump() {
+  proxycapture_reader_t reader;
+  proxycapture_record_t record;
+  char line[PROXYREPLAY_DUMP_SIZE];
+  int i;
+
+  if (proxycapture_open(&reader, sFilename) != SUCCESS) {
+    printf("Couldn't read the capture %s\n", sFilename);
+    exit(1);
+  }
+
+  while (proxycapture_next(&reader, &record) == SUCCESS) {
+    snprintf(line, sizeof(line), "%s", record.msg);
+    for (i = 0; line[i] != '\0'; i++) {
+      if (line[i] == '\n' || line[i] == '\r') {
+        line[i] = ' ';
+      }
+    }
+
+    printf("%10.3f %s %6d %s\n", record.usec / 1e6,
+        (record.direction == PROXYCAPTURE_INBOUND) ? "<-" : "->", record.len, line);
+  }
+
+  proxycapture_close(&reader);
+}
+
+/**
+ * Hand a message from the server to the listeners, like the proxy thread
+ * does once it has read it
+ */
+static void _proxyreplay_inbound(const proxycapture_record_t *record) {
+  uint64_t start;
+
+  if (record->len == 0) {
+    // The proxy doesn't broadcast empty responses either
+    _proxyreplay_count(&sInbound, 0, 0);
+    return;
+  }
+
+  start = _proxyreplay_nowNsec();
+  proxylisteners_broadcast(record->msg, record->len);
+  _proxyreplay_count(&sInbound, record->len, _proxyreplay_nowNsec() - start);
+}
+
+/**
+ * Frame a batch for the server, like the proxy thread does before it pushes
+ * it, and fold the framed bytes into the digest
+ */
+static void _proxyreplay_outbound(const proxycapture_record_t *record) {
+  h2swrapper_frame_t frame;
+  uint64_t start;
+  uint64_t nsec;
+  int i;
+
+  start = _proxyreplay_nowNsec();
+  if (h2swrapper_frame(&frame, record->msg, sEncodedMsg, sizeof(sEncodedMsg)) < 0) {
+    SYSLOG_ERR("Couldn't frame a %d byte batch as %s", record->len, sDataFormat);
+    return;
+  }
+  nsec = _proxyreplay_nowNsec() - start;
+
+  for (i = 0; i < frame.totalSegments; i++) {
+    _proxyreplay_digest(frame.segments[i].iov_base, frame.segments[i].iov_len);
+  }
+
+  _proxyreplay_count(&sOutbound, record->len, nsec);
+}
+
+/**
+ * Parse the server's messages like an agent does
+ */
+static void _proxyreplay_serverListener(const char *msg, int len) {
+  iotxml_parse(msg, len);
+}
+
+/**
+ * Fold every command dispatched into the digest
+ */
+static void _proxyreplay_execute(command_t *cmd) {
+  sCommands++;
+  _proxyreplay_digest(&cmd->commandId, sizeof(cmd->commandId));
+  _proxyreplay_digest(cmd->deviceId, strlen(cmd->deviceId));
+  _proxyreplay_digest(cmd->commandName, strlen(cmd->commandName));
+  _proxyreplay_digest(cmd->argument, cmd->argSize);
+}
+
+/**
+ * Add bytes to the digest
+ */
+static void _proxyreplay_digest(const void *data, int len) {
+  const unsigned char *bytes = data;
+  int i;
+
+  for (i = 0; i < len; i++) {
+    sDigest ^= bytes[i];
+    sDigest *= 0x100000001b3ULL;
+  }
+}
+
+/**
+ * Count a replayed message
+ */
+static void _proxyreplay_count(proxyreplay_stats_t *stats, int len, uint64_t nsec) {
+  stats->messages++;
+  stats->bytes += len;
+  stats->nsec += nsec;
+  if (nsec > stats->maxNsec) {
+    stats->maxNsec = nsec;
+  }
+}
+
+/**
+ * Print the statistics of one direction
+ */
+static void _proxyreplay_print(const char *name, const proxyreplay_stats_t *stats) {
+  double sec = stats->nsec / 1e9;
+
+  printf("%s: %ld messages, %llu bytes\n", name, stats->messages, (unsigned long long) stats->bytes);
+
+  if (stats->messages > 0 && sec > 0) {
+    printf("  %.1f us/msg average, %.1f us slowest, %.0f msgs/s, %.2f MB/s in the proxy\n",
+        stats->nsec / 1e3 / stats->messages, stats->maxNsec / 1e3,
+        stats->messages / sec, stats->bytes / sec / 1e6);
+  }
+}
+
+/**
+ * @return CLOCK_MONOTONIC nanoseconds
+ */
+static uint64_t _proxyreplay_nowNsec() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
@@ -0,0 +1,56 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef PROXYREPLAY_H
+#define PROXYREPLAY_H
+
+#include <stdint.h>
+
+/** Default replay speed, 1 replays at the pace the traffic was captured */
+#ifndef PROXYREPLAY_DEFAULT_SPEED
+#define PROXYREPLAY_DEFAULT_SPEED 1.0
+#endif
+
+/** Log levels while replaying, the numbers are what we're after */
+#ifndef PROXYREPLAY_LOG_LEVELS
+#define PROXYREPLAY_LOG_LEVELS "*=err"
+#endif
+
+/** Longest line of a dumped message */
+#define PROXYREPLAY_DUMP_SIZE 160
+
+/**
+ * What it took to replay one direction of the traffic
+ */
+typedef struct proxyreplay_stats_t {
+
+  /** Messages replayed */
+  long messages;
+
+  /** Bytes of the captured messages */
+  uint64_t bytes;
+
+  /** Nanoseconds spent in the proxy's code */
+  uint64_t nsec;
+
+  /** Slowest message */
+  uint64_t maxNsec;
+
+} proxyreplay_stats_t;
+
+#endif
@@ -39,6 +39,7 @@
 #include "libhttpcomm.h"
 #include "libconfigio.h"
 #include "eui64.h"
+#include "hubid.h"
 #include "proxyserver.h"
 #include "getactivationinfo.h"
 #include "proxycli.h"
@@ -123,6 +124,7 @@ char *getactivationinfo_getDeviceActivationKey(const char *key, int locationId)
   if(libconfigio_read(proxycli_getConfigFilename(), CONFIGIO_PROXY_DEVICE_TYPE_TOKEN_NAME, deviceType, sizeof(deviceType)) == -1) {
     printf("Couldn't read %s in file %s, writing default value\n", CONFIGIO_PROXY_DEVICE_TYPE_TOKEN_NAME, proxycli_getConfigFilename());
     libconfigio_write(proxycli_getConfigFilename(), CONFIGIO_PROXY_DEVICE_TYPE_TOKEN_NAME, DEFAULT_PROXY_DEVICETYPE);
+    hubid_invalidate();
     strncpy(deviceType, DEFAULT_PROXY_DEVICETYPE, sizeof(deviceType));
   }
 
@@ -212,6 +214,7 @@ error_t registerDevice(void) {
   if(libconfigio_read(proxycli_getConfigFilename(), CONFIGIO_PROXY_DEVICE_TYPE_TOKEN_NAME, deviceType, sizeof(deviceType)) == -1) {
     printf("Couldn't read %s in file %s, writing default value\n", CONFIGIO_PROXY_DEVICE_TYPE_TOKEN_NAME, proxycli_getConfigFilename());
     libconfigio_write(proxycli_getConfigFilename(), CONFIGIO_PROXY_DEVICE_TYPE_TOKEN_NAME, DEFAULT_PROXY_DEVICETYPE);
+    hubid_invalidate();
     strncpy(deviceType, DEFAULT_PROXY_DEVICETYPE, sizeof(deviceType));
   }
 
@@ -222,7 +225,7 @@ error_t registerDevice(void) {
     strncpy(baseUrl, DEFAULT_ACTIVATION_URL, sizeof(baseUrl));
   }
 
-  eui64_toString(eui64, sizeof(eui64));
+  hubid_get(eui64, sizeof(eui64));
   // https://developer.presencepro.com/cloud/json/devices/001C42DE23CF-4-33F?productId=4
   snprintf(url, sizeof(url), "%s/devices/%s?productId=%s", baseUrl, eui64, deviceType);
 
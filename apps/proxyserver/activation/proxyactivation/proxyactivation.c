@@ -39,6 +39,7 @@
 #include "libhttpcomm.h"
 #include "libconfigio.h"
 #include "eui64.h"
+#include "hubid.h"
 #include "proxyserver.h"
 #include "proxyactivation.h"
 #include "proxycli.h"
@@ -112,7 +113,7 @@ error_t proxyactivation_activate(const char *activationKey, const char *optional
   bzero(deviceType, sizeof(deviceType));
 
   // Get the EUI64 unique device id for the proxy
-  if(eui64_toString(eui64, sizeof(eui64)) != SUCCESS) {
+  if(hubid_get(eui64, sizeof(eui64)) != SUCCESS) {
     return FAIL;
   }
 
@@ -127,6 +128,7 @@ error_t proxyactivation_activate(const char *activationKey, const char *optional
   if(libconfigio_read(proxycli_getConfigFilename(), CONFIGIO_PROXY_DEVICE_TYPE_TOKEN_NAME, deviceType, sizeof(deviceType)) == -1) {
     printf("Couldn't read %s in file %s, writing default value\n", CONFIGIO_PROXY_DEVICE_TYPE_TOKEN_NAME, proxycli_getConfigFilename());
     libconfigio_write(proxycli_getConfigFilename(), CONFIGIO_PROXY_DEVICE_TYPE_TOKEN_NAME, DEFAULT_PROXY_DEVICETYPE);
+    hubid_invalidate();
     strncpy(deviceType, DEFAULT_PROXY_DEVICETYPE, sizeof(deviceType));
   }
 
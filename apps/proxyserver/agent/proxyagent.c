@@ -32,8 +32,10 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <ctype.h>
 
 #include "libconfigio.h"
+#include "libmetrics.h"
 
 #include "ioterror.h"
 #include "iotdebug.h"
@@ -42,11 +44,37 @@
 #include "proxylisteners.h"
 #include "proxycli.h"
 #include "eui64.h"
+#include "hubid.h"
 #include "proxyserver.h"
 #include "proxyconfig.h"
 #include "iotapi.h"
 
 
+/** Bytes held back from the start of a server message to tell what it is */
+#define PROXYAGENT_MESSAGE_HEAD_SIZE 8
+
+/** What the server message arriving on a thread turned out to be */
+typedef enum proxyagent_message_e {
+  PROXYAGENT_MESSAGE_UNKNOWN = 0,
+  PROXYAGENT_MESSAGE_XML,
+  PROXYAGENT_MESSAGE_OTHER,
+} proxyagent_message_e;
+
+/**
+ * Server message arriving on this thread. Each transfer runs on its own
+ * thread, so overlapping transfers don't mix up their messages.
+ */
+static __thread struct {
+
+  proxyagent_message_e format;
+
+  /** First bytes of the message, without leading whitespace */
+  char head[PROXYAGENT_MESSAGE_HEAD_SIZE];
+
+  int headLen;
+
+} tMessage;
+
 /** Thread termination flag */
 static bool terminate;
 
@@ -72,7 +100,9 @@ static int deviceType;
 static char deviceId[EUI64_STRING_SIZE];
 
 /***************** Private Prototypes ****************/
-static void application_receive(const char *msg, int len);
+static void application_receiveChunk(const char *chunk, int len);
+
+static void _proxyagent_classifyMessage();
 
 static void *_proxyAgentThread(void *params);
 
@@ -91,13 +121,14 @@ static void _captureDeviceType();
 error_t proxyagent_start() {
 
   // Get our unique device ID of this proxy
-  if(eui64_toString(deviceId, sizeof(deviceId)) != SUCCESS) {
+  if(hubid_get(deviceId, sizeof(deviceId)) != SUCCESS) {
     SYSLOG_ERR("[proxyagent] Skipping heartbeat since we don't have an EUI64");
     return FAIL;
   }
 
-  // Add a listener directly to the inbound server messages
-  if(proxylisteners_addListener(&application_receive) != SUCCESS) {
+  // Add a listener directly to the inbound server messages, receiving them
+  // as they arrive so commands execute before the whole message is in
+  if(proxylisteners_addChunkListener(&application_receiveChunk) != SUCCESS) {
     SYSLOG_DEBUG("[proxyagent]: Proxy is out of listener slots");
     return FAIL;
   }
@@ -156,22 +187,68 @@ error_t application_send(const char *msg, int len) {
  * The application layer is responsible for routing inbound mesages
  * appropriately.
  *
- * Route inbound messages in this application directly to the XML parser.
+ * Route inbound messages in this application directly to the XML parser,
+ * piece by piece as they arrive from the server. The first bytes are held
+ * back until we can tell the message is XML, so error pages and bare
+ * statuses never reach the parser.
  *
- * @param msg Message received
- * @param len Length of the message received
+ * @param chunk Next piece of the message received
+ * @param len Length of the piece, 0 when the message is complete
  */
-void application_receive(const char *msg, int len) {
-  if(strstr(msg, "xml") != NULL) {
-     iotxml_parse(msg, len);
+static void application_receiveChunk(const char *chunk, int len) {
+  int used = 0;
 
-  } else {
-    SYSLOG_INFO("[proxyagent] Unknown message format: %s", msg);
+  if(len == 0) {
+    if(tMessage.format == PROXYAGENT_MESSAGE_UNKNOWN && tMessage.headLen > 0) {
+      _proxyagent_classifyMessage();
+    }
+
+    if(tMessage.format == PROXYAGENT_MESSAGE_XML) {
+      iotxml_parseFinish();
+    }
+
+    memset(&tMessage, 0x0, sizeof(tMessage));
+    return;
+  }
+
+  if(tMessage.format == PROXYAGENT_MESSAGE_UNKNOWN) {
+    for(; used < len && tMessage.headLen < PROXYAGENT_MESSAGE_HEAD_SIZE - 1; used++) {
+      if(tMessage.headLen > 0 || !isspace((unsigned char) chunk[used])) {
+        tMessage.head[tMessage.headLen++] = chunk[used];
+      }
+    }
+
+    if(tMessage.headLen < PROXYAGENT_MESSAGE_HEAD_SIZE - 1) {
+      return;
+    }
+
+    _proxyagent_classifyMessage();
+  }
+
+  if(tMessage.format == PROXYAGENT_MESSAGE_XML && used < len) {
+    iotxml_parseChunk(chunk + used, len - used);
   }
 }
 
 
 /***************** Private Functions ****************/
+/**
+ * Decide from its first bytes whether the message arriving on this thread
+ * is XML, and if it is, hand those bytes to the parser
+ */
+static void _proxyagent_classifyMessage() {
+  tMessage.head[tMessage.headLen] = '\0';
+
+  if(strncmp(tMessage.head, "<?xml", 5) == 0 || strncmp(tMessage.head, "<s2h", 4) == 0) {
+    tMessage.format = PROXYAGENT_MESSAGE_XML;
+    iotxml_parseChunk(tMessage.head, tMessage.headLen);
+
+  } else {
+    tMessage.format = PROXYAGENT_MESSAGE_OTHER;
+    SYSLOG_DEBUG("[proxyagent] Unknown message format: %s", tMessage.head);
+  }
+}
+
 /**
  * Thread to periodically send updates to the server
  */
@@ -218,22 +295,33 @@ static void _doCommand(command_t *cmd) {
       uploadInterval = atoi(argument);
       proxyconfig_setUploadIntervalSec(uploadInterval);
       iotxml_sendResult(cmd->commandId, IOT_RESULT_EXECUTED);
+
+    } else if(strcmp(cmd->commandName, "LogLevels") == 0) {
+      char argument[cmd->argSize + 1];
+      bzero(argument, sizeof(argument));
+
+      strncpy(argument, cmd->argument, cmd->argSize);
+      if(libiotlog_setLevels(argument) == SUCCESS) {
+        iotxml_sendResult(cmd->commandId, IOT_RESULT_EXECUTED);
+      } else {
+        iotxml_sendResult(cmd->commandId, IOT_RESULT_HUBERROR);
+      }
     }
   }
 
   /**
    * Debug code for your convenience
    **/
-  SYSLOG_INFO(">> RECEIVED COMMAND: ");
-  SYSLOG_INFO("noMoreCommands=%d", cmd->noMoreCommands);
-  SYSLOG_INFO("userIsWatching=%d", cmd->userIsWatching);
-  SYSLOG_INFO("deviceId=%s", cmd->deviceId);
-  SYSLOG_INFO("commandId=%d", cmd->commandId);
-  SYSLOG_INFO("commandName=%s", cmd->commandName);
-  SYSLOG_INFO("argSize=%d", cmd->argSize);
+  SYSLOG_DEBUG(">> RECEIVED COMMAND: ");
+  SYSLOG_DEBUG("noMoreCommands=%d", cmd->noMoreCommands);
+  SYSLOG_DEBUG("userIsWatching=%d", cmd->userIsWatching);
+  SYSLOG_DEBUG("deviceId=%s", cmd->deviceId);
+  SYSLOG_DEBUG("commandId=%d", cmd->commandId);
+  SYSLOG_DEBUG("commandName=%s", cmd->commandName);
+  SYSLOG_DEBUG("argSize=%d", cmd->argSize);
 
   if(cmd->asciiIndex > 0) {
-    SYSLOG_INFO("asciiIndex=%c", cmd->asciiIndex);
+    SYSLOG_DEBUG("asciiIndex=%c", cmd->asciiIndex);
   }
 
   if(cmd->argSize > 0) {
@@ -241,10 +329,10 @@ static void _doCommand(command_t *cmd) {
     char argument[cmd->argSize + 1];
     bzero(argument, sizeof(argument));
     strncpy(argument, cmd->argument, cmd->argSize);
-    SYSLOG_INFO("argument=%s",  argument);
+    SYSLOG_DEBUG("argument=%s",  argument);
   }
 
-  SYSLOG_INFO("<< RECEIVED COMMAND");
+  SYSLOG_DEBUG("<< RECEIVED COMMAND");
    //*/
 }
 
@@ -307,6 +395,45 @@ static void _sendHeartbeat() {
     0,
     (int) proxyconfig_getUploadIntervalSec());
 
+#if PROXY_AGENT_HEARTBEAT_METRICS
+  // Summary of the proxy metrics, the rest can be scraped from the proxy port
+  offset += iotxml_addInt(myMsg + offset, sizeof(myMsg) - offset,
+    deviceId,
+    deviceType,
+    IOT_PARAM_MEASURE,
+    PARAM_NAME_PUSH_RETRIES,
+    NULL,
+    0,
+    (int) libmetrics_value(libmetrics_counter("proxy_push_retries_total", "")));
+
+  offset += iotxml_addInt(myMsg + offset, sizeof(myMsg) - offset,
+    deviceId,
+    deviceType,
+    IOT_PARAM_MEASURE,
+    PARAM_NAME_PUSH_UNREACHABLE,
+    NULL,
+    0,
+    (int) libmetrics_value(libmetrics_counter("proxy_push_unreachable_total", "")));
+
+  offset += iotxml_addInt(myMsg + offset, sizeof(myMsg) - offset,
+    deviceId,
+    deviceType,
+    IOT_PARAM_MEASURE,
+    PARAM_NAME_HTTP_MEAN_MS,
+    NULL,
+    0,
+    (int) (libmetrics_mean(libmetrics_histogram("httpcomm_total_seconds", "")) * 1000));
+
+  offset += iotxml_addInt(myMsg + offset, sizeof(myMsg) - offset,
+    deviceId,
+    deviceType,
+    IOT_PARAM_MEASURE,
+    PARAM_NAME_SPOOL_BYTES,
+    NULL,
+    0,
+    (int) libmetrics_value(libmetrics_gauge("proxy_spool_bytes", "")));
+#endif
+
   // 3. Send the message
   if(iotxml_send(myMsg, sizeof(myMsg)) == SUCCESS) {
     SYSLOG_INFO("[proxyagent] Heartbeat");
@@ -38,6 +38,23 @@
 /** Parameter name for the passive upload interval of the proxy */
 #define PARAM_NAME_UPLOAD_INTERVAL "uploadInterval"
 
+/** Define to 1 to summarize the proxy metrics in every heartbeat */
+#ifndef PROXY_AGENT_HEARTBEAT_METRICS
+#define PROXY_AGENT_HEARTBEAT_METRICS 0
+#endif
+
+/** Parameter name for the number of pushes sent again since the proxy started */
+#define PARAM_NAME_PUSH_RETRIES "pushRetries"
+
+/** Parameter name for the number of pushes spooled since the proxy started */
+#define PARAM_NAME_PUSH_UNREACHABLE "pushUnreachable"
+
+/** Parameter name for the mean time of an HTTP transfer in milliseconds */
+#define PARAM_NAME_HTTP_MEAN_MS "httpMeanMs"
+
+/** Parameter name for the bytes of measurements in the spool */
+#define PARAM_NAME_SPOOL_BYTES "spoolBytes"
+
 
 /***************** Public Prototypes ****************/
 error_t proxyagent_start();
@@ -35,6 +35,7 @@
 #include "proxy.h"
 #include "proxyserver.h"
 #include "proxyconfig.h"
+#include "proxycapture.h"
 #include "proxycli.h"
 
 /**************** Private Prototypes ****************/
@@ -46,6 +47,8 @@ bool _proxymanager_useSslFromConfigFile();
 
 char *_proxymanager_getProxySslCertificateFromConfigFile(char *buffer, int maxsize);
 
+char *_proxymanager_getDeviceDataFormatFromConfigFile(char *buffer, int maxsize);
+
 
 /**************** Public Functions ****************/
 /**
@@ -66,6 +69,15 @@ void proxymanager_startProxy() {
   // Set the SSL certificate path, which may or may not exist
   proxyconfig_setCertificate(_proxymanager_getProxySslCertificateFromConfigFile(buffer, sizeof(buffer)));
 
+  // Select the wire format of the device API, XML unless told otherwise
+  proxyconfig_setDataFormat(_proxymanager_getDeviceDataFormatFromConfigFile(buffer, sizeof(buffer)));
+
+  // Capture the traffic with the server, if the configuration file asks for it
+  bzero(buffer, sizeof(buffer));
+  if(libconfigio_read(proxycli_getConfigFilename(), CONFIGIO_PROXY_CAPTURE_FILENAME_TOKEN_NAME, buffer, sizeof(buffer)) > -1 && buffer[0]) {
+    proxycapture_start(buffer);
+  }
+
   // Start the proxy with our URL
   proxy_start(_proxymanager_getUrlFromConfigFile(buffer, sizeof(buffer)));
 
@@ -177,5 +189,19 @@ char *_proxymanager_getProxySslCertificateFromConfigFile(char *buffer, int maxsi
   return buffer;
 }
 
+/**
+ * Get the wire format of the device API from our configuration file
+ * @param buffer Buffer to store the format in
+ * @param maxsize Maximum size of the buffer
+ * @return The buffer, holding the default format if none is configured
+ */
+char *_proxymanager_getDeviceDataFormatFromConfigFile(char *buffer, int maxsize) {
+  bzero(buffer, maxsize);
+  if(libconfigio_read(proxycli_getConfigFilename(), CONFIGIO_DEVICE_DATA_FORMAT_TOKEN_NAME, buffer, maxsize) < 0 || !buffer[0]) {
+    snprintf(buffer, maxsize, "%s", IOTCODEC_DEFAULT);
+  }
+  return buffer;
+}
+
 
 
@@ -34,13 +34,17 @@
 #include <netinet/in.h>
 #include <signal.h>
 #include <sys/ioctl.h>
+#include <poll.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <curl/curl.h>
 #include <libxml/parser.h>
 
 #include "libconfigio.h"
 #include "libpipecomm.h"
+#include "libmetrics.h"
+#include "libiotmem.h"
 
 #include "settings.h"
 #include "login.h"
@@ -57,6 +61,8 @@
 #include "proxycli.h"
 #include "proxymanager.h"
 #include "eui64.h"
+#include "hubid.h"
+#include "iottrace.h"
 
 
 
@@ -68,11 +74,26 @@ char *argDeviceType = NULL;
 /** Client socket FD */
 static int clientSocketFd;
 
+/** Listening socket, which the client processes close */
+static int sListenFd = -1;
+
+/** Serializes registering the connections classified on their own threads */
+static pthread_mutex_t sClientsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Number of clients the last server message was written to */
+static libmetrics_t *sClients;
+
 /***************** Prototypes ***************/
 void _proxyserver_processMessage(int clientSocketFd);
 
 void _proxyserver_listener(const char *message, int len);
 
+void *_proxyserver_connectionThread(void *arg);
+
+bool _proxyserver_isScrape(int clientSocketFd);
+
+void _proxyserver_serveScrape(int clientSocketFd);
+
 void _timer_handler ( int signum );
 
 void api_update_timer_init (void);
@@ -88,7 +109,8 @@ pthread_t timer_thread;
  */
 int main(int argc, char *argv[]) {
   int sockfd;
-  int pid;
+  pthread_t connectionThread;
+  pthread_attr_t connectionAttr;
   socklen_t clientLen;
   struct sockaddr_in serverAddress;
   struct sockaddr_in clientAddress;
@@ -99,14 +121,43 @@ int main(int argc, char *argv[]) {
   // Don't crash when we write to a broken pipe
   signal(SIGPIPE, SIG_IGN);
 
+  // Share metrics with the client processes we fork
+  libmetrics_start();
+  sClients = libmetrics_gauge("proxyserver_clients", "Client sockets the last server message was written to");
+
+  // Account for the heap of libxml2, libcurl and cJSON before they use it
+  libiotmem_start();
+
+#if IOTTRACE_ENABLED
+  iottrace_start(IOTTRACE_FILENAME);
+#endif
+
   // Parse the command line arguments
   proxycli_parse(argc, argv);
 
   printf("Using configuration file %s\n", proxycli_getConfigFilename());
   SYSLOG_INFO("Using configuration file %s", proxycli_getConfigFilename());
 
+  // Log from a background thread, at the levels in the configuration file
+  {
+    char logLevels[PATH_MAX];
+    if(libconfigio_read(proxycli_getConfigFilename(), CONFIGIO_PROXY_LOG_LEVELS_TOKEN_NAME, logLevels, sizeof(logLevels)) > -1) {
+      libiotlog_setLevels(logLevels);
+    }
+  }
+  libiotlog_start(NULL);
+
+  // Work out our hub ID once, and keep it current as interfaces come and go
+  {
+    char interfaces[HUBID_INTERFACES_SIZE];
+    if(libconfigio_read(proxycli_getConfigFilename(), CONFIGIO_PROXY_INTERFACES_TOKEN_NAME, interfaces, sizeof(interfaces)) > -1) {
+      hubid_setInterfaces(interfaces);
+    }
+  }
+  hubid_start();
+
   // Get Presto connection settings
-  eui64_toString(eui64, sizeof(eui64));
+  hubid_get(eui64, sizeof(eui64));
   printf("The proxy device ID is %s\n", eui64);
   SYSLOG_INFO("The proxy device ID is %s\n", eui64);
 
@@ -210,6 +261,7 @@ int main(int argc, char *argv[]) {
   if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
     SYSLOG_ERR("ERROR opening socket");
   }
+  sListenFd = sockfd;
 
   bzero((char *) &serverAddress, sizeof(serverAddress));
   serverAddress.sin_family = AF_INET;
@@ -232,6 +284,9 @@ int main(int argc, char *argv[]) {
   // Initial timer thread.
   timer_thread_init();
 
+  pthread_attr_init(&connectionAttr);
+  pthread_attr_setdetachstate(&connectionAttr, PTHREAD_CREATE_DETACHED);
+
   while (!gTerminate) {
     clientSocketFd = accept(sockfd, (struct sockaddr *) &clientAddress, &clientLen);
 
@@ -240,41 +295,24 @@ int main(int argc, char *argv[]) {
       continue;
     }
 
-    if (proxyclientmanager_add(clientSocketFd) != SUCCESS) {
-      SYSLOG_ERR("[%d]: Out of client elements to track sockets", getpid());
+    // Telling a scrape from an agent can take a while, so it's done on the
+    // connection's own thread instead of holding up the next accept
+    if (pthread_create(&connectionThread, &connectionAttr, &_proxyserver_connectionThread, (void *) (intptr_t) clientSocketFd) != 0) {
+      SYSLOG_ERR("[%d]: Couldn't start a thread for socket %d", getpid(), clientSocketFd);
       close(clientSocketFd);
-
-    } else {
-      pid = fork();
-      if (pid < 0) {
-        SYSLOG_ERR("ERROR on fork");
-
-      } else if (pid == 0) {
-        // Child process
-        SYSLOG_INFO("[%d]: New client listener created", getpid());
-        close(sockfd);
-
-
-	while (true) {
-          // Read messages from the client until the socket is closed
-          _proxyserver_processMessage(clientSocketFd);
-          sleep(1);
-        }
-
-        proxyclientmanager_remove(clientSocketFd);
-        SYSLOG_INFO("[%d]: Destroyed", getpid());
-        exit(0);
-
-      } else {
-	  // Parent process
-
-      }
     }
   }
 
+  pthread_attr_destroy(&connectionAttr);
+
   SYSLOG_INFO("*************** SHUTTING DOWN PROXY ***************");
   printf("Done!\n");
 
+  hubid_stop();
+  iottrace_stop();
+  libiotmem_stop();
+  libiotlog_stop();
+
   xmlCleanupParser();
   xmlMemoryDump();
 
@@ -311,6 +349,65 @@ void _proxyserver_listener(const char *message, int len) {
   }
 
   SYSLOG_DEBUG("Broadcast message to %d sockets", clients);
+  if (clients > 0) {
+    iottrace_markMessage(message, len, IOTTRACE_WRITTEN);
+  }
+  libmetrics_set(sClients, clients);
+}
+
+/**
+ * Thread for a new connection: answer it if it's a scrape, otherwise
+ * register it as an agent and fork the process that reads its messages
+ *
+ * @param arg The client socket file descriptor
+ */
+void *_proxyserver_connectionThread(void *arg) {
+  int clientSocketFd = (int) (intptr_t) arg;
+  error_t added;
+  int pid;
+
+  if (_proxyserver_isScrape(clientSocketFd)) {
+    // Never register a scrape, or server messages would be broadcast into its response
+    pid = fork();
+    if (pid < 0) {
+      SYSLOG_ERR("ERROR on fork");
+
+    } else if (pid == 0) {
+      close(sListenFd);
+      _proxyserver_serveScrape(clientSocketFd);
+    }
+
+    close(clientSocketFd);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&sClientsMutex);
+  added = proxyclientmanager_add(clientSocketFd);
+  pthread_mutex_unlock(&sClientsMutex);
+
+  if (added != SUCCESS) {
+    SYSLOG_ERR("[%d]: Out of client elements to track sockets", getpid());
+    close(clientSocketFd);
+    return NULL;
+  }
+
+  pid = fork();
+  if (pid < 0) {
+    SYSLOG_ERR("ERROR on fork");
+
+  } else if (pid == 0) {
+    // Child process
+    SYSLOG_INFO("[%d]: New client listener created", getpid());
+    close(sListenFd);
+
+    while (true) {
+      // Read messages from the client until the socket is closed
+      _proxyserver_processMessage(clientSocketFd);
+      sleep(1);
+    }
+  }
+
+  return NULL;
 }
 
 /**
@@ -325,6 +422,16 @@ void  _proxyserver_processMessage(int clientSocketFd) {
   bzero(buffer, PROXY_MAX_MSG_LEN);
 
   if ((n = read(clientSocketFd, buffer, PROXY_MAX_MSG_LEN)) > 0) {
+    if (strncmp(buffer, LIBMETRICS_REQUEST, strlen(LIBMETRICS_REQUEST)) == 0) {
+      // A scrape too slow for _proxyserver_isScrape(); don't forward it to the server
+      SYSLOG_WARNING("[%d]: Late scrape answered on an agent socket", getpid());
+      libmetrics_respond(clientSocketFd);
+      proxyclientmanager_remove(clientSocketFd);
+      shutdown(clientSocketFd, SHUT_RDWR);
+      close(clientSocketFd);
+      exit(0);
+    }
+
     proxy_send(buffer, n);
 
   } else if(n == 0) {
@@ -342,6 +449,49 @@ void  _proxyserver_processMessage(int clientSocketFd) {
 
 }
 
+/**
+ * Tell a scrape from an agent by peeking at what a new connection sends
+ * first, without consuming it
+ *
+ * @param clientSocketFd The client socket file descriptor
+ * @return true if the connection asked for the metrics
+ */
+bool _proxyserver_isScrape(int clientSocketFd) {
+  char request[sizeof(LIBMETRICS_REQUEST)];
+  struct pollfd pfd;
+  int n;
+
+  pfd.fd = clientSocketFd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  if (poll(&pfd, 1, PROXYSERVER_SCRAPE_WAIT_MS) <= 0 || !(pfd.revents & POLLIN)) {
+    // Agents may connect and wait for the server to speak first
+    return false;
+  }
+
+  n = recv(clientSocketFd, request, strlen(LIBMETRICS_REQUEST), MSG_PEEK | MSG_DONTWAIT);
+  return n == (int) strlen(LIBMETRICS_REQUEST)
+      && strncmp(request, LIBMETRICS_REQUEST, n) == 0;
+}
+
+/**
+ * Child process for a scrape: read the request, answer it and exit
+ *
+ * @param clientSocketFd The client socket file descriptor
+ */
+void _proxyserver_serveScrape(int clientSocketFd) {
+  char buffer[PROXY_MAX_MSG_LEN];
+
+  if (read(clientSocketFd, buffer, sizeof(buffer)) > 0) {
+    libmetrics_respond(clientSocketFd);
+  }
+
+  shutdown(clientSocketFd, SHUT_RDWR);
+  close(clientSocketFd);
+  exit(0);
+}
+
 /**
  * Application API update timer initiator
  * 
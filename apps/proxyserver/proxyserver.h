@@ -23,6 +23,11 @@
 #define DEFAULT_PROXY_PORT 60110
 #endif
 
+/** Milliseconds a new connection has to send a scrape request before it's taken for an agent */
+#ifndef PROXYSERVER_SCRAPE_WAIT_MS
+#define PROXYSERVER_SCRAPE_WAIT_MS 250
+#endif
+
 #ifndef DEFAULT_PROXY_URL
 #define DEFAULT_PROXY_URL "sbox.presencepro.com:8080/deviceio/ml"
 #endif
@@ -71,6 +76,18 @@
 /** Name of the token in our config file that data format interacting with Presto */
 #define CONFIGIO_DATA_FORMAT_TOKEN_NAME "DATA_FORMAT"
 
+/** Token for the wire format of the device API, "xml", "json" or "cbor" */
+#define CONFIGIO_DEVICE_DATA_FORMAT_TOKEN_NAME "DEVICE_DATA_FORMAT"
+
+/** Token for the comma-separated interfaces the hub ID may come from, in order */
+#define CONFIGIO_PROXY_INTERFACES_TOKEN_NAME "PROXY_INTERFACES"
+
+/** Token for the log levels of the modules, i.e. "proxy=info,*=warning" */
+#define CONFIGIO_PROXY_LOG_LEVELS_TOKEN_NAME "PROXY_LOG_LEVELS"
+
+/** Token for a file to capture the traffic with the server to, see apps/proxyreplay */
+#define CONFIGIO_PROXY_CAPTURE_FILENAME_TOKEN_NAME "PROXY_CAPTURE_FILENAME"
+
 /** Name of the token in our config file that stores the device type */
 #define CONFIGIO_PROXY_DEVICE_TYPE_TOKEN_NAME "PROXY_DEVICE_TYPE"
 
@@ -47,9 +47,8 @@
 #include <time.h>
 #include <pthread.h>
 
-#include <cJSON.h>
-
 #include "libhttpcomm.h"
+#include "jsonwriter.h"
 
 #include "ioterror.h"
 #include "iotdebug.h"
@@ -58,177 +57,171 @@
 #include "rtoamanager.h"
 #include "rtoameasure.h"
 #include "iotapi.h"
+#include "commandexecutor.h"
 
-/** The last command ID we executed */
-static int lastCommandId = -1;
+/***************** Prototypes ****************/
+static result_code_e _rtoacontrol_post(const char *url, const char *body, int timeout_sec);
+static bool _rtoacontrol_isDuplicate(command_t *cmds, int index);
 
 /***************** Public Functions ****************/
 /**
- * Besides the main loop, this is the only function to access the mutex.
- * We don't want to send a command to change the state of the thermostat
- * while in the middle of the main loop, otherwise the side effect could be
- * that we set the temperature and immediately touch the schedule which
- * will undo the temperature command.
+ * Execute the "set" commands one server message carried for a thermostat.
+ * The tmode, fmode, targetTempHeat and targetTempCool settings are merged
+ * into a single JSON body so the thermostat only sees one request, and its
+ * answer becomes the result of every merged command. When a setting comes
+ * more than once, the last one wins. Program schedules go to their own URLs
+ * and are sent one by one.
+ *
+ * This runs on a command executor worker, which never runs two batches for
+ * the same thermostat at once, so we don't hold the main loop's mutex across
+ * the HTTP requests. We only take it to copy the thermostat's address out of
+ * its record, since garbage collection may remove the record in between.
+ * The main loop stays away from thermostats that have commands in flight
+ * instead, see rtoacontrol_synchronizeTimes().
+ *
+ * @param cmds Commands to execute, all for the same thermostat
+ * @param results Result to send back to the server for each command,
+ *     which start out as IOT_RESULT_HUBERROR
+ * @param total Number of commands, at most COMMANDEXECUTOR_MAX_BATCH
+ * @param timeout_sec Seconds left before the earliest command deadline
  */
-void rtoacontrol_execute(command_t *cmd) {
+void rtoacontrol_execute(command_t *cmds, result_code_e *results, int total, int timeout_sec) {
   rtoa_t *focusedRtoa;
+  command_t *cmd;
+  char ip[INET6_ADDRSTRLEN];
   char jsonText[RTOA_MAX_MSG_SIZE];
-  char rxBuffer[RTOA_MAX_MSG_SIZE];
-  http_param_t params;
   char url[PATH_MAX];
+  bool merged[COMMANDEXECUTOR_MAX_BATCH];
+  bool executed = false;
+  result_code_e result;
+  jsonwriter_t writer;
+  bool setTmode = false;
+  bool setFmode = false;
+  bool setHeat = false;
+  bool setCool = false;
+  int tmode = 0;
+  int fmode = 0;
+  double heat = 0;
+  double cool = 0;
+  int i;
 
-  params.verbose = TRUE;
-  params.timeouts.connectTimeout = 3;
-  params.timeouts.transferTimeout = 10;
-
-  if((focusedRtoa = rtoamanager_getByUuid(cmd->deviceId)) != NULL) {
-    cJSON *jsonCmd;
-
-    // dmm: Adding this in because the server keeps sending commands
-    // for command ID's we've previously acknowledged and executed.
-    if((lastCommandId >= 0) && (cmd->commandId <= lastCommandId) && (cmd->commandId != 0)) {
-      SYSLOG_INFO("IGNORING DUPLICATE COMMAND ID: %d", cmd->commandId);
-      iotxml_sendResult(cmd->commandId, IOT_RESULT_HUBERROR);
-      return;
+  if(total > COMMANDEXECUTOR_MAX_BATCH) {
+    SYSLOG_ERR("[rtoa] Got %d commands, more than a batch holds", total);
+    return;
+  }
 
-    } else {
-      lastCommandId = cmd->commandId;
+  pthread_mutex_lock(rtoaagent_getMutex());
+  if((focusedRtoa = rtoamanager_getByUuid(cmds[0].deviceId)) == NULL) {
+    pthread_mutex_unlock(rtoaagent_getMutex());
+    for(i = 0; i < total; i++) {
+      results[i] = IOT_RESULT_DEVICENOTIDENTIFIED;
     }
+    return;
+  }
 
-    // tmode / fmode commands are integers
-    if(strcmp(cmd->commandName, RTOA_JSON_ATTR_TMODE) == 0
-        || strcmp(cmd->commandName, RTOA_JSON_ATTR_FMODE) == 0) {
-      if(cmd->argument == NULL) {
-        SYSLOG_INFO("[rtoa] Malformed command");
-        iotxml_sendResult(cmd->commandId, IOT_RESULT_WRONGFORMAT);
-        return;
-      }
-
-      jsonCmd = cJSON_CreateObject();
-      cJSON_AddNumberToObject(jsonCmd, cmd->commandName, atoi(cmd->argument));
-      strncpy(jsonText, cJSON_Print(jsonCmd), sizeof(jsonText));
-      cJSON_Delete(jsonCmd);
+  strncpy(ip, focusedRtoa->ip, sizeof(ip));
+  ip[sizeof(ip) - 1] = '\0';
+  pthread_mutex_unlock(rtoaagent_getMutex());
 
-      snprintf(url, sizeof(url), "%s/tstat", focusedRtoa->ip);
-      SYSLOG_DEBUG("RTOA command: %s/tstat %s", focusedRtoa->ip, jsonText);
+  memset(merged, 0x0, sizeof(merged));
 
-      pthread_mutex_lock(rtoaagent_getMutex());
-      if(0 != libhttpcomm_sendMsg(NULL, CURLOPT_POST, url, NULL, NULL, jsonText, strlen(jsonText), rxBuffer, sizeof(rxBuffer), params, NULL)) {
-        iotxml_sendResult(cmd->commandId, IOT_RESULT_DEVICECONNECTIONERROR);
-        pthread_mutex_unlock(rtoaagent_getMutex());
-        return;
-      }
-      pthread_mutex_unlock(rtoaagent_getMutex());
-
-      if(strstr(rxBuffer, "success") == NULL) {
-        iotxml_sendResult(cmd->commandId, IOT_RESULT_DEVICEEXECUTIONERROR);
-        return;
-      }
+  for(i = 0; i < total; i++) {
+    cmd = &cmds[i];
 
-      iotxml_sendResult(cmd->commandId, IOT_RESULT_EXECUTED);
-      rtoaagent_refreshDevices();
+    // dmm: Adding this in because the server keeps sending commands
+    // for command ID's we've previously acknowledged and executed.
+    if(_rtoacontrol_isDuplicate(cmds, i)) {
+      SYSLOG_INFO("IGNORING DUPLICATE COMMAND ID: %d", cmd->commandId);
+      results[i] = IOT_RESULT_HUBERROR;
+      continue;
     }
 
-    // t_heat is a double.  The server calls it "targetTempHeat"
-    if(strcmp(cmd->commandName, RTOA_TARGET_TEMP_HEAT) == 0) {
-      if(cmd->argument == NULL) {
-        SYSLOG_INFO("[rtoa] Malformed command");
-        iotxml_sendResult(cmd->commandId, IOT_RESULT_WRONGFORMAT);
-        return;
-      }
-
-      jsonCmd = cJSON_CreateObject();
-      cJSON_AddNumberToObject(jsonCmd, RTOA_JSON_ATTR_HEAT, atof(cmd->argument));
-      strncpy(jsonText, cJSON_Print(jsonCmd), sizeof(jsonText));
-      cJSON_Delete(jsonCmd);
-
-      snprintf(url, sizeof(url), "%s/tstat", focusedRtoa->ip);
-      SYSLOG_DEBUG("RTOA command: %s/tstat %s", focusedRtoa->ip, jsonText);
-
-      pthread_mutex_lock(rtoaagent_getMutex());
-      if(0 != libhttpcomm_sendMsg(NULL, CURLOPT_POST, url, NULL, NULL, jsonText, strlen(jsonText), rxBuffer, sizeof(rxBuffer), params, NULL)) {
-        iotxml_sendResult(cmd->commandId, IOT_RESULT_DEVICECONNECTIONERROR);
-        pthread_mutex_unlock(rtoaagent_getMutex());
-        return;
-      }
-      pthread_mutex_unlock(rtoaagent_getMutex());
-
-      if(strstr(rxBuffer, "success") == NULL) {
-        iotxml_sendResult(cmd->commandId, IOT_RESULT_DEVICEEXECUTIONERROR);
-        return;
-      }
-
-      iotxml_sendResult(cmd->commandId, IOT_RESULT_EXECUTED);
-      rtoaagent_refreshDevices();
+    if(cmd->argument == NULL) {
+      SYSLOG_INFO("[rtoa] Malformed command");
+      results[i] = IOT_RESULT_WRONGFORMAT;
+      continue;
     }
 
-    // t_cool is a double.  The server calls it "targetTempCool"
-    if(strcmp(cmd->commandName, RTOA_TARGET_TEMP_COOL) == 0) {
-      if(cmd->argument == NULL) {
-        SYSLOG_INFO("[rtoa] Malformed command");
-        iotxml_sendResult(cmd->commandId, IOT_RESULT_WRONGFORMAT);
-        return;
-      }
+    // program/cool and program/heat are special JSON strings that get forwarded
+    if(strstr(cmd->commandName, "program/heat") != NULL
+        || strstr(cmd->commandName, "program/cool") != NULL) {
+      snprintf(url, sizeof(url), "%s/tstat/%s", ip, cmd->commandName);
+      SYSLOG_DEBUG("RTOA command: %s/tstat/%s", ip, cmd->commandName);
+      results[i] = _rtoacontrol_post(url, cmd->argument, timeout_sec);
+      executed |= (results[i] == IOT_RESULT_EXECUTED);
+      continue;
+    }
 
-      jsonCmd = cJSON_CreateObject();
-      cJSON_AddNumberToObject(jsonCmd, RTOA_JSON_ATTR_COOL, atof(cmd->argument));
-      strncpy(jsonText, cJSON_Print(jsonCmd), sizeof(jsonText));
-      cJSON_Delete(jsonCmd);
+    if(strcmp(cmd->commandName, RTOA_JSON_ATTR_TMODE) == 0) {
+      // tmode / fmode commands are integers
+      tmode = atoi(cmd->argument);
+      setTmode = true;
 
-      snprintf(url, sizeof(url), "%s/tstat", focusedRtoa->ip);
-      SYSLOG_DEBUG("RTOA command: %s/tstat %s", focusedRtoa->ip, jsonText);
+    } else if(strcmp(cmd->commandName, RTOA_JSON_ATTR_FMODE) == 0) {
+      fmode = atoi(cmd->argument);
+      setFmode = true;
 
-      pthread_mutex_lock(rtoaagent_getMutex());
-      if(0 != libhttpcomm_sendMsg(NULL, CURLOPT_POST, url, NULL, NULL, jsonText, strlen(jsonText), rxBuffer, sizeof(rxBuffer), params, NULL)) {
-        iotxml_sendResult(cmd->commandId, IOT_RESULT_DEVICECONNECTIONERROR);
-        pthread_mutex_unlock(rtoaagent_getMutex());
-        return;
-      }
-      pthread_mutex_unlock(rtoaagent_getMutex());
+    } else if(strcmp(cmd->commandName, RTOA_TARGET_TEMP_HEAT) == 0) {
+      // t_heat is a double.  The server calls it "targetTempHeat"
+      heat = atof(cmd->argument);
+      setHeat = true;
 
-      if(strstr(rxBuffer, "success") == NULL) {
-        iotxml_sendResult(cmd->commandId, IOT_RESULT_DEVICEEXECUTIONERROR);
-        return;
-      }
+    } else if(strcmp(cmd->commandName, RTOA_TARGET_TEMP_COOL) == 0) {
+      // t_cool is a double.  The server calls it "targetTempCool"
+      cool = atof(cmd->argument);
+      setCool = true;
 
-      iotxml_sendResult(cmd->commandId, IOT_RESULT_EXECUTED);
-      rtoaagent_refreshDevices();
+    } else {
+      SYSLOG_INFO("[rtoa] Unsupported command %s", cmd->commandName);
+      results[i] = IOT_RESULT_DEVICENOTSUPPORTED;
+      continue;
     }
 
-    // program/cool and program/heat are special JSON strings that get forwarded
-    if(strstr(cmd->commandName, "program/heat") != NULL
-        || strstr(cmd->commandName, "program/cool") != NULL) {
-      char argument[cmd->argSize + 1];
-      memset(argument, 0x0, sizeof(argument));
-
-      if(cmd->argument == NULL) {
-        SYSLOG_INFO("[rtoa] Malformed command");
-        iotxml_sendResult(cmd->commandId, IOT_RESULT_WRONGFORMAT);
-        return;
-      }
+    merged[i] = true;
+  }
 
-      strncpy(argument, cmd->argument, cmd->argSize);
+  if(setTmode || setFmode || setHeat || setCool) {
+    jsonwriter_init(&writer, jsonText, sizeof(jsonText));
+    jsonwriter_beginObject(&writer);
+    if(setTmode) {
+      jsonwriter_key(&writer, RTOA_JSON_ATTR_TMODE);
+      jsonwriter_int(&writer, tmode);
+    }
+    if(setFmode) {
+      jsonwriter_key(&writer, RTOA_JSON_ATTR_FMODE);
+      jsonwriter_int(&writer, fmode);
+    }
+    if(setHeat) {
+      jsonwriter_key(&writer, RTOA_JSON_ATTR_HEAT);
+      jsonwriter_double(&writer, heat);
+    }
+    if(setCool) {
+      jsonwriter_key(&writer, RTOA_JSON_ATTR_COOL);
+      jsonwriter_double(&writer, cool);
+    }
+    jsonwriter_endObject(&writer);
 
-      snprintf(url, sizeof(url), "%s/tstat/%s", focusedRtoa->ip, cmd->commandName);
-      SYSLOG_DEBUG("RTOA command: %s/tstat/%s", focusedRtoa->ip, cmd->commandName);
+    if(jsonwriter_finish(&writer) != SUCCESS) {
+      SYSLOG_ERR("[rtoa] Command for %s didn't fit in %d bytes", ip, (int) sizeof(jsonText));
+      result = IOT_RESULT_HUBERROR;
 
-      pthread_mutex_lock(rtoaagent_getMutex());
-      if(0 != libhttpcomm_sendMsg(NULL, CURLOPT_POST, url, NULL, NULL, argument, strlen(argument), rxBuffer, sizeof(rxBuffer), params, NULL)) {
-        iotxml_sendResult(cmd->commandId, IOT_RESULT_DEVICECONNECTIONERROR);
-        pthread_mutex_unlock(rtoaagent_getMutex());
-        return;
-      }
-      pthread_mutex_unlock(rtoaagent_getMutex());
+    } else {
+      snprintf(url, sizeof(url), "%s/tstat", ip);
+      SYSLOG_DEBUG("RTOA command: %s/tstat %s", ip, jsonText);
+      result = _rtoacontrol_post(url, jsonText, timeout_sec);
+      executed |= (result == IOT_RESULT_EXECUTED);
+    }
 
-      if(strstr(rxBuffer, "success") == NULL) {
-        iotxml_sendResult(cmd->commandId, IOT_RESULT_DEVICEEXECUTIONERROR);
-        return;
+    for(i = 0; i < total; i++) {
+      if(merged[i]) {
+        results[i] = result;
       }
-
-      iotxml_sendResult(cmd->commandId, IOT_RESULT_EXECUTED);
-      rtoaagent_refreshDevices();
     }
   }
+
+  if(executed) {
+    rtoaagent_refreshDevices();
+  }
 }
 
 /**
@@ -247,8 +240,7 @@ void rtoacontrol_synchronizeTimes() {
   int i;
   time_t rawtime;
   struct tm *now;
-  cJSON *jsonMsg;
-  cJSON *timeJsonObject;
+  jsonwriter_t writer;
   rtoa_t *focusedRtoa;
   char url[PATH_MAX];
   char txBuffer[RTOA_MAX_MSG_SIZE];
@@ -262,14 +254,23 @@ void rtoacontrol_synchronizeTimes() {
   rawtime = time(NULL);
   now = localtime(&rawtime);
 
-  jsonMsg = cJSON_CreateObject();
-  timeJsonObject = cJSON_CreateObject();
-  cJSON_AddItemToObject(jsonMsg, "time", timeJsonObject);
-  cJSON_AddNumberToObject(timeJsonObject, "day", now->tm_wday - 1);
-  cJSON_AddNumberToObject(timeJsonObject, "hour", now->tm_hour);
-  cJSON_AddNumberToObject(timeJsonObject, "minute", now->tm_min);
-
-  strncpy(txBuffer, cJSON_Print(jsonMsg), sizeof(txBuffer));
+  jsonwriter_init(&writer, txBuffer, sizeof(txBuffer));
+  jsonwriter_beginObject(&writer);
+  jsonwriter_key(&writer, RTOA_JSON_ATTR_TIME);
+  jsonwriter_beginObject(&writer);
+  jsonwriter_key(&writer, RTOA_JSON_ATTR_DAY);
+  jsonwriter_int(&writer, now->tm_wday - 1);
+  jsonwriter_key(&writer, RTOA_JSON_ATTR_HOUR);
+  jsonwriter_int(&writer, now->tm_hour);
+  jsonwriter_key(&writer, RTOA_JSON_ATTR_MINUTE);
+  jsonwriter_int(&writer, now->tm_min);
+  jsonwriter_endObject(&writer);
+  jsonwriter_endObject(&writer);
+
+  if(jsonwriter_finish(&writer) != SUCCESS) {
+    SYSLOG_ERR("[rtoa] Time sync didn't fit in %d bytes", (int) sizeof(txBuffer));
+    return;
+  }
 
   for (i = 0; i < rtoamanager_size(); i++) {
     if ((focusedRtoa = rtoamanager_get(i)) != NULL) {
@@ -277,7 +278,10 @@ void rtoacontrol_synchronizeTimes() {
       // Only set the time when the thermostat is not in override mode,
       // or else you'll override the user's override and go back
       // to executing on a schedule.
-      if(focusedRtoa->inUse && focusedRtoa->override == 0) {
+      // Thermostats with commands in flight are left alone until the next
+      // sync, so we don't undo a command the main loop hasn't measured yet.
+      if(focusedRtoa->inUse && focusedRtoa->override == 0
+          && !commandexecutor_isBusy(focusedRtoa->uuid)) {
         SYSLOG_INFO("[rtoa] Synchronizing time at %s", focusedRtoa->ip);
         snprintf(url, sizeof(url), "%s/tstat", focusedRtoa->ip);
         SYSLOG_DEBUG("RTOA Command: %s/tstat %s", focusedRtoa->ip, txBuffer);
@@ -285,6 +289,60 @@ void rtoacontrol_synchronizeTimes() {
       }
     }
   }
+}
+
+/***************** Private Functions ****************/
+/**
+ * POST a message to a thermostat
+ * @param url URL to POST to
+ * @param body Message body
+ * @param timeout_sec Maximum number of seconds to spend on the request
+ * @return IOT_RESULT_EXECUTED if the thermostat reported success
+ */
+static result_code_e _rtoacontrol_post(const char *url, const char *body, int timeout_sec) {
+  char rxBuffer[RTOA_MAX_MSG_SIZE];
+  http_param_t params;
+
+  params.verbose = TRUE;
+  params.timeouts.connectTimeout = timeout_sec < RTOA_CONNECT_TIMEOUT_SEC ? timeout_sec : RTOA_CONNECT_TIMEOUT_SEC;
+  params.timeouts.transferTimeout = timeout_sec < RTOA_TRANSFER_TIMEOUT_SEC ? timeout_sec : RTOA_TRANSFER_TIMEOUT_SEC;
+
+  bzero(rxBuffer, sizeof(rxBuffer));
+  if(0 != libhttpcomm_sendMsg(NULL, CURLOPT_POST, url, NULL, NULL, (char *) body, strlen(body), rxBuffer, sizeof(rxBuffer), params, NULL)) {
+    return IOT_RESULT_DEVICECONNECTIONERROR;
+  }
+
+  if(strstr(rxBuffer, "success") == NULL) {
+    return IOT_RESULT_DEVICEEXECUTIONERROR;
+  }
+
+  return IOT_RESULT_EXECUTED;
+}
+
+/**
+ * The parameters of one command share its ID, and a command's parameters
+ * may be split across batches, so duplicates are only looked for within
+ * the batch: the same parameter name and index coming again under the
+ * same command ID.
+ *
+ * @param cmds Commands in the batch
+ * @param index Index of the command to check
+ * @return true if an earlier command in the batch is the same command
+ */
+static bool _rtoacontrol_isDuplicate(command_t *cmds, int index) {
+  int i;
+
+  if(cmds[index].commandId == 0) {
+    return false;
+  }
+
+  for(i = 0; i < index; i++) {
+    if(cmds[i].commandId == cmds[index].commandId
+        && cmds[i].asciiIndex == cmds[index].asciiIndex
+        && strcmp(cmds[i].commandName, cmds[index].commandName) == 0) {
+      return true;
+    }
+  }
 
-  cJSON_Delete(jsonMsg);
+  return false;
 }
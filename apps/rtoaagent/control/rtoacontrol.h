@@ -42,8 +42,18 @@
 
 #define RTOA_TARGET_TEMP_COOL "targetTempCool"
 
+/** Seconds allowed to connect to a thermostat when executing a command */
+#ifndef RTOA_CONNECT_TIMEOUT_SEC
+#define RTOA_CONNECT_TIMEOUT_SEC 3
+#endif
+
+/** Seconds allowed for a thermostat to answer a command */
+#ifndef RTOA_TRANSFER_TIMEOUT_SEC
+#define RTOA_TRANSFER_TIMEOUT_SEC 10
+#endif
+
 /***************** Public Prototypes ****************/
-void rtoacontrol_execute(command_t *cmd);
+void rtoacontrol_execute(command_t *cmds, result_code_e *results, int total, int timeout_sec);
 
 void rtoacontrol_discover(command_t *cmd);
 
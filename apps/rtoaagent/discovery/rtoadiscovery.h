@@ -36,11 +36,11 @@
 #ifndef RTOADISCOVERY_H
 #define RTOADISCOVERY_H
 
-#define RTOA_LOCATION_HDR "Location:"
+/** Search multicast to find the thermostats' wireless microcontrollers */
+#define RTOA_SSDP_SEARCH_MSG "TYPE: WM-DISCOVER\r\nVERSION:1.0\r\n\r\nservices: com.marvell.wm.system*\r\n\r\n"
 
-#define RTOA_SSDP_ADDR "239.255.255.250"
-
-#define RTOA_SSDP_PORT 1900
+/** Service type the thermostats announce, anything else on the network is ignored */
+#define RTOA_SSDP_TARGET "com.marvell.wm.system"
 
 
 #define RTOA_JSON_ATTR_MODEL "model"
@@ -56,5 +56,7 @@
 /***************** Public Prototypes ****************/
 error_t rtoadiscovery_runOnce();
 
+void rtoadiscovery_stop();
+
 
 #endif
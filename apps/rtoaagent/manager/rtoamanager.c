@@ -42,42 +42,48 @@
 #include <string.h>
 #include <arpa/inet.h>
 #include <stdbool.h>
+#include <time.h>
+#include <sys/time.h>
 
 #include "ioterror.h"
 #include "iotdebug.h"
 
+#include "ssdpdiscovery.h"
+#include "deviceregistry.h"
 #include "rtoamanager.h"
 #include "rtoaagent.h"
 
 /** Thermostats we are currently tracking */
-static rtoa_t thermostats[RTOA_MAX_THERMOSTATS];
+static deviceregistry_t thermostats;
 
 /***************** Public Functions ****************/
+/**
+ * Initialize the thermostat registry before anything else touches it
+ */
+error_t rtoamanager_init() {
+  return DEVICEREGISTRY_INIT(&thermostats, rtoa_t, ip, uuid, RTOA_DEATH_PERIOD_SEC);
+}
+
 error_t rtoamanager_add(rtoa_t *rtoa) {
-  int i;
+  rtoa_t *added;
 
-  for(i = 0; i < RTOA_MAX_THERMOSTATS; i++) {
-    if(thermostats[i].inUse && strcmp(rtoa->ip, thermostats[i].ip) == 0) {
-      SYSLOG_INFO("[rtoa] Thermostat at IP %s is already being tracked", rtoa->ip);
-      return SUCCESS;
-    }
+  if(rtoamanager_getByIp(rtoa->ip) != NULL) {
+    SYSLOG_INFO("[rtoa] Thermostat at IP %s is already being tracked", rtoa->ip);
+    return SUCCESS;
   }
 
-  for(i = 0; i < RTOA_MAX_THERMOSTATS; i++) {
-    if(!thermostats[i].inUse) {
-      SYSLOG_INFO("[rtoa] Adding new thermostat at ip %s!", rtoa->ip);
+  SYSLOG_INFO("[rtoa] Adding new thermostat at ip %s!", rtoa->ip);
 
-      // Always add the device to the ESP
-      iotxml_addDevice(rtoa->uuid, RTOA_DEVICE_TYPE);
-
-      memcpy(&thermostats[i], rtoa, sizeof(rtoa_t));
-      thermostats[i].inUse = true;
-      rtoaagent_refreshDevices();
-      return SUCCESS;
-    }
+  rtoa->inUse = true;
+  gettimeofday(&rtoa->lastTouchTime, NULL);
+  if((added = deviceregistry_add(&thermostats, rtoa)) == NULL) {
+    return FAIL;
   }
 
-  return FAIL;
+  // Always add the device to the ESP
+  iotxml_addDevice(added->uuid, RTOA_DEVICE_TYPE);
+  rtoaagent_refreshDevices();
+  return SUCCESS;
 }
 
 
@@ -87,14 +93,7 @@ error_t rtoamanager_add(rtoa_t *rtoa) {
  * @return rtoa_t if the thermostat is being tracked
  */
 rtoa_t *rtoamanager_getByIp(const char *ip) {
-  int i;
-  for(i = 0; i < RTOA_MAX_THERMOSTATS; i++) {
-    if(strncmp(ip, thermostats[i].ip, EUI64_STRING_SIZE) == 0) {
-      return &thermostats[i];
-    }
-  }
-
-  return NULL;
+  return deviceregistry_getByIp(&thermostats, ip);
 }
 
 
@@ -104,56 +103,86 @@ rtoa_t *rtoamanager_getByIp(const char *ip) {
  * @return rtoa_t if we are tracking this thermostat
  */
 rtoa_t *rtoamanager_getByUuid(const char *uuid) {
-  int i;
-  for(i = 0; i < RTOA_MAX_THERMOSTATS; i++) {
-    if(strncmp(uuid, thermostats[i].uuid, EUI64_STRING_SIZE) == 0) {
-      return &thermostats[i];
-    }
-  }
-
-  return NULL;
+  return deviceregistry_getByUuid(&thermostats, uuid);
 }
 
 
 /**
- * @return the number of elements in our device array
+ * Call after changing the IP address or UUID of a thermostat we're tracking
+ * @param rtoa Thermostat
+ */
+void rtoamanager_reindex(rtoa_t *rtoa) {
+  deviceregistry_reindex(&thermostats, rtoa);
+}
+
+/**
+ * @return the number of indices to iterate over with rtoamanager_get(..)
  */
 int rtoamanager_size() {
-  return RTOA_MAX_THERMOSTATS;
+  return deviceregistry_size(&thermostats);
+}
+
+/**
+ * @return the number of thermostats we are tracking
+ */
+int rtoamanager_totalDevices() {
+  return deviceregistry_totalDevices(&thermostats);
 }
 
 /**
- * @param index Index into the array of thermostats
- * @return the thermostat at the given index
+ * @param index Index of a thermostat, from 0 to rtoamanager_size() - 1
+ * @return the thermostat at the given index, NULL if the index is unused
  */
 rtoa_t *rtoamanager_get(int index) {
-  if(index < RTOA_MAX_THERMOSTATS) {
-    return &thermostats[index];
-  } else {
-    return NULL;
+  return deviceregistry_get(&thermostats, index);
+}
+
+/**
+ * We heard from the thermostat, so it isn't dead yet
+ * @param rtoa Thermostat
+ */
+void rtoamanager_touch(rtoa_t *rtoa) {
+  gettimeofday(&rtoa->lastTouchTime, NULL);
+  deviceregistry_touch(&thermostats, rtoa);
+}
+
+/**
+ * The thermostat has new measurements to send
+ * @param rtoa Thermostat
+ */
+void rtoamanager_measurementsUpdated(rtoa_t *rtoa) {
+  rtoa->measurementsUpdated = true;
+  deviceregistry_markDirty(&thermostats, rtoa);
+}
+
+/**
+ * Obtain the next thermostat with measurements to send, and clear its flag
+ * @return the thermostat, NULL if there are no more
+ */
+rtoa_t *rtoamanager_nextUpdated() {
+  rtoa_t *rtoa;
+
+  if((rtoa = deviceregistry_nextDirty(&thermostats)) != NULL) {
+    rtoa->measurementsUpdated = false;
   }
+
+  return rtoa;
 }
 
 /**
  * Kill off the thermostats we haven't heard from in a long time
  */
 void rtoamanager_garbageCollection() {
-  int i;
-  struct timeval curTime = { 0, 0 };
-
-  gettimeofday(&curTime, NULL);
+  rtoa_t *rtoa;
 
-  for(i = 0; i < RTOA_MAX_THERMOSTATS; i++) {
-    if(thermostats[i].inUse) {
-      if ((curTime.tv_sec - thermostats[i].lastTouchTime.tv_sec) >= RTOA_DEATH_PERIOD_SEC) {
-        thermostats[i].inUse = false;
+  while((rtoa = deviceregistry_nextExpired(&thermostats, time(NULL))) != NULL) {
+    // Alert that this device is gone
+    iotxml_alertDeviceIsGone(rtoa->uuid);
 
-        // Alert that this device is gone
-        iotxml_alertDeviceIsGone(thermostats[i].uuid);
+    SYSLOG_INFO("[rtoa] Killing thermostat at IP %s", rtoa->ip);
 
-        SYSLOG_INFO("[rtoa] Killing thermostat at IP %s", thermostats[i].ip);
-        memset(&thermostats[i], 0x0, sizeof(rtoa_t));
-      }
-    }
+    // Identify it from scratch if it ever comes back
+    ssdpdiscovery_forget(rtoa->ip);
+    deviceregistry_remove(&thermostats, rtoa);
   }
 }
@@ -43,13 +43,6 @@
 #include "eui64.h"
 #include "ioterror.h"
 
-/**
- * Maximum number of thermostats can be set at compile time
- */
-#ifndef RTOA_MAX_THERMOSTATS
-#define RTOA_MAX_THERMOSTATS 8
-#endif
-
 /* Size of a full week's JSON program with 4 digits in each element */
 #define RTOA_PROGRAM_SIZE 400
 
@@ -171,6 +164,8 @@ typedef enum {
 
 
 /***************** Public Prototypes ****************/
+error_t rtoamanager_init();
+
 error_t rtoamanager_add(rtoa_t *rtoa);
 
 rtoa_t *rtoamanager_getByIp(const char *ip);
@@ -179,8 +174,18 @@ rtoa_t *rtoamanager_getByUuid(const char *uuid);
 
 int rtoamanager_size();
 
+void rtoamanager_reindex(rtoa_t *rtoa);
+
+int rtoamanager_totalDevices();
+
 rtoa_t *rtoamanager_get(int index);
 
+void rtoamanager_touch(rtoa_t *rtoa);
+
+void rtoamanager_measurementsUpdated(rtoa_t *rtoa);
+
+rtoa_t *rtoamanager_nextUpdated();
+
 void rtoamanager_garbageCollection();
 
 #endif
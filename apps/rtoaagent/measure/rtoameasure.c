@@ -45,7 +45,9 @@
 #include <stdbool.h>
 
 #include "libhttpcomm.h"
-#include "cJSON.h"
+#include "jsonarena.h"
+#include "jsonscan.h"
+#include "jsonschema.h"
 
 #include "ioterror.h"
 #include "iotdebug.h"
@@ -54,9 +56,28 @@
 #include "rtoameasure.h"
 #include "rtoaagent.h"
 #include "iotapi.h"
-
+#include "iotxmlbatch.h"
+
+
+/** Fields of a thermostat's /tstat reply, in the order it sends them */
+static const jsonschema_field_t sTstatFields[] = {
+  JSONSCHEMA_FIELD(RTOA_JSON_ATTR_TEMP, JSONSCHEMA_DOUBLE, rtoa_t, temp, false),
+  JSONSCHEMA_FIELD(RTOA_JSON_ATTR_TMODE, JSONSCHEMA_INT, rtoa_t, tmode, false),
+  JSONSCHEMA_FIELD(RTOA_JSON_ATTR_FMODE, JSONSCHEMA_INT, rtoa_t, fmode, false),
+  JSONSCHEMA_FIELD(RTOA_JSON_ATTR_OVERRIDE, JSONSCHEMA_INT, rtoa_t, override, false),
+  JSONSCHEMA_FIELD(RTOA_JSON_ATTR_HOLD, JSONSCHEMA_INT, rtoa_t, hold, false),
+  JSONSCHEMA_FIELD(RTOA_JSON_ATTR_HEAT, JSONSCHEMA_DOUBLE, rtoa_t, heat, false),
+  JSONSCHEMA_FIELD(RTOA_JSON_ATTR_COOL, JSONSCHEMA_DOUBLE, rtoa_t, cool, false),
+  JSONSCHEMA_FIELD(RTOA_JSON_ATTR_TSTATE, JSONSCHEMA_INT, rtoa_t, tstate, false),
+  JSONSCHEMA_FIELD(RTOA_JSON_ATTR_FSTATE, JSONSCHEMA_INT, rtoa_t, fstate, false),
+  JSONSCHEMA_END,
+};
+
+/** Frame of measurements to the proxy, too large for the stack */
+static iotxmlbatch_t sBatch;
 
 /***************** Private Prototypes ****************/
+static error_t _rtoameasure_parse(const char *text, rtoa_t *rtoaBuffer);
 
 /***************** Public Functions ****************/
 /**
@@ -70,9 +91,6 @@ void rtoameasure_capture() {
   char url[PATH_MAX];
   char rxBuffer[RTOA_MAX_MSG_SIZE];
   http_param_t params;
-  cJSON *jsonMsg = NULL;
-  cJSON *jsonObject = NULL;
-  struct timeval curTime = { 0, 0 };
 
   params.verbose = false;
   params.timeouts.connectTimeout = 3;
@@ -98,95 +116,7 @@ void rtoameasure_capture() {
         if (libhttpcomm_getMsg(NULL, url, NULL, NULL, rxBuffer, sizeof(rxBuffer), params, NULL) == 0) {
           SYSLOG_DEBUG("http://%s/tstat returned: %s", focusedRtoa->ip, rxBuffer);
 
-          if ((jsonMsg = cJSON_Parse(rxBuffer)) != NULL) {
-
-            // Temperature
-            if ((jsonObject = cJSON_GetObjectItem(jsonMsg, RTOA_JSON_ATTR_TEMP)) != NULL) {
-              if(jsonObject->valueint != -1) {
-                rtoaBuffer.temp = jsonObject->valuedouble;
-              } else {
-                continue;
-              }
-            }
-
-            // Tmode
-            if ((jsonObject = cJSON_GetObjectItem(jsonMsg, RTOA_JSON_ATTR_TMODE)) != NULL) {
-              if(jsonObject->valueint != -1) {
-                rtoaBuffer.tmode = jsonObject->valueint;
-              } else {
-                continue;
-              }
-            }
-
-            // Fmode
-            if ((jsonObject = cJSON_GetObjectItem(jsonMsg, RTOA_JSON_ATTR_FMODE)) != NULL) {
-              if(jsonObject->valueint != -1) {
-                rtoaBuffer.fmode = jsonObject->valueint;
-              } else {
-                continue;
-              }
-            }
-
-            // Hold
-            if ((jsonObject = cJSON_GetObjectItem(jsonMsg, RTOA_JSON_ATTR_HOLD)) != NULL) {
-              if(jsonObject->valueint != -1) {
-                rtoaBuffer.hold = jsonObject->valueint;
-              } else {
-                continue;
-              }
-            }
-
-            // Override
-            if ((jsonObject = cJSON_GetObjectItem(jsonMsg, RTOA_JSON_ATTR_OVERRIDE)) != NULL) {
-              if(jsonObject->valueint != -1) {
-                rtoaBuffer.override = jsonObject->valueint;
-              } else {
-                continue;
-              }
-            }
-
-            // Heat
-            if ((jsonObject = cJSON_GetObjectItem(jsonMsg, RTOA_JSON_ATTR_HEAT)) != NULL) {
-              if(jsonObject->valueint != -1) {
-                rtoaBuffer.heat = jsonObject->valuedouble;
-              } else {
-                continue;
-              }
-            } else {
-              // We aren't in heater mode
-              rtoaBuffer.heat = 0;
-            }
-
-            // Cool
-            if ((jsonObject = cJSON_GetObjectItem(jsonMsg, RTOA_JSON_ATTR_COOL)) != NULL) {
-              if(jsonObject->valueint != -1) {
-                rtoaBuffer.cool = jsonObject->valuedouble;
-              } else {
-                continue;
-              }
-            } else {
-              // We aren't in cooler mode
-              rtoaBuffer.cool = 0;
-            }
-
-            // Tstate
-            if ((jsonObject = cJSON_GetObjectItem(jsonMsg, RTOA_JSON_ATTR_TSTATE)) != NULL) {
-              if(jsonObject->valueint != -1) {
-                rtoaBuffer.tstate = jsonObject->valueint;
-              } else {
-                continue;
-              }
-            }
-
-            // Fstate
-            if ((jsonObject = cJSON_GetObjectItem(jsonMsg, RTOA_JSON_ATTR_FSTATE)) != NULL) {
-              if(jsonObject->valueint != -1) {
-                rtoaBuffer.fstate = jsonObject->valueint;
-              } else {
-                continue;
-              }
-            }
-
+          if (_rtoameasure_parse(rxBuffer, &rtoaBuffer) == SUCCESS) {
             focusedRtoa->temp = rtoaBuffer.temp;
             focusedRtoa->tmode = rtoaBuffer.tmode;
             focusedRtoa->fmode = rtoaBuffer.fmode;
@@ -196,10 +126,8 @@ void rtoameasure_capture() {
             focusedRtoa->cool = rtoaBuffer.cool;
             focusedRtoa->tstate = rtoaBuffer.tstate;
             focusedRtoa->fstate = rtoaBuffer.fstate;
-            focusedRtoa->measurementsUpdated = true;
-
-            gettimeofday(&curTime, NULL);
-            focusedRtoa->lastTouchTime.tv_sec = curTime.tv_sec;
+            rtoamanager_measurementsUpdated(focusedRtoa);
+            rtoamanager_touch(focusedRtoa);
           }
         }
       }
@@ -228,6 +156,7 @@ void rtoameasure_captureSchedules() {
   char url[PATH_MAX];
   char rxBuffer[RTOA_MAX_MSG_SIZE];
   http_param_t params;
+  jsonarena_t *arena = jsonarena_local();
 
   params.verbose = false;
   params.timeouts.connectTimeout = 3;
@@ -251,7 +180,7 @@ void rtoameasure_captureSchedules() {
         snprintf(url, sizeof(url), "http://%s/tstat/program/cool", focusedRtoa->ip);
         if (libhttpcomm_getMsg(NULL, url, NULL, NULL, rxBuffer, sizeof(rxBuffer), params, NULL) == 0) {
           // We run the message through the JSON parser to make sure it's valid
-          if (cJSON_Parse(rxBuffer) != NULL) {
+          if (jsonarena_parse(arena, rxBuffer) != NULL) {
             strcpy(focusedRtoa->programCool, rxBuffer);
           }
         }
@@ -259,152 +188,187 @@ void rtoameasure_captureSchedules() {
         // Heat schedule
         snprintf(url, sizeof(url), "http://%s/tstat/program/heat", focusedRtoa->ip);
         if (libhttpcomm_getMsg(NULL, url, NULL, NULL, rxBuffer, sizeof(rxBuffer), params, NULL) == 0) {
-          if (cJSON_Parse(rxBuffer) != NULL) {
+          if (jsonarena_parse(arena, rxBuffer) != NULL) {
             strcpy(focusedRtoa->programHeat, rxBuffer);
           }
         }
       }
     }
   }
+
+  jsonarena_reset(arena);
 }
 
 
 /**
  * Send measurements for all thermostats
+ *
+ * Each thermostat's measurements are built as their own block and packed
+ * into as few frames to the proxy as the batch budgets allow.
  */
 void rtoameasure_send() {
   char myMsg[PROXY_MAX_MSG_LEN];
   char buffer[10];
-  int i;
   int offset = 0;
   rtoa_t *focusedRtoa;
 
+  iotxmlbatch_init(&sBatch, RTOA_BATCH_MAX_BYTES);
+
+  // Only visit the thermostats that have something new to say
+  while((focusedRtoa = rtoamanager_nextUpdated()) != NULL) {
+    offset = 0;
+
+    iotxml_newMsg(myMsg, sizeof(myMsg));
+
+    snprintf(buffer, sizeof(buffer), "%4.2f", focusedRtoa->temp);
+    offset += iotxml_addString(myMsg + offset, sizeof(myMsg) - offset,
+        focusedRtoa->uuid,
+        RTOA_DEVICE_TYPE,
+        IOT_PARAM_MEASURE,
+        "temp",
+        NULL,
+        0,
+        buffer);
+
+    snprintf(buffer, sizeof(buffer), "%3.1lf", focusedRtoa->heat);
+    offset += iotxml_addString(myMsg + offset, sizeof(myMsg) - offset,
+        focusedRtoa->uuid,
+        RTOA_DEVICE_TYPE,
+        IOT_PARAM_MEASURE,
+        "targetTempHeat",
+        NULL,
+        0,
+        buffer);
+
+    snprintf(buffer, sizeof(buffer), "%3.1lf", focusedRtoa->cool);
+    offset += iotxml_addString(myMsg + offset, sizeof(myMsg) - offset,
+        focusedRtoa->uuid,
+        RTOA_DEVICE_TYPE,
+        IOT_PARAM_MEASURE,
+        "targetTempCool",
+        NULL,
+        0,
+        buffer);
+
+    offset += iotxml_addString(myMsg + offset, sizeof(myMsg) - offset,
+        focusedRtoa->uuid,
+        RTOA_DEVICE_TYPE,
+        IOT_PARAM_MEASURE,
+        "program/cool",
+        NULL,
+        0,
+        focusedRtoa->programCool);
+
+    offset += iotxml_addString(myMsg + offset, sizeof(myMsg) - offset,
+        focusedRtoa->uuid,
+        RTOA_DEVICE_TYPE,
+        IOT_PARAM_MEASURE,
+        "program/heat",
+        NULL,
+        0,
+        focusedRtoa->programHeat);
+
+    offset += iotxml_addInt(myMsg + offset, sizeof(myMsg) - offset,
+        focusedRtoa->uuid,
+        RTOA_DEVICE_TYPE,
+        IOT_PARAM_MEASURE,
+        "tmode",
+        NULL,
+        0,
+        focusedRtoa->tmode);
+
+    offset += iotxml_addInt(myMsg + offset, sizeof(myMsg) - offset,
+        focusedRtoa->uuid,
+        RTOA_DEVICE_TYPE,
+        IOT_PARAM_MEASURE,
+        "fmode",
+        NULL,
+        0,
+        focusedRtoa->fmode);
+
+    offset += iotxml_addInt(myMsg + offset, sizeof(myMsg) - offset,
+        focusedRtoa->uuid,
+        RTOA_DEVICE_TYPE,
+        IOT_PARAM_MEASURE,
+        "hold",
+        NULL,
+        0,
+        focusedRtoa->hold);
+
+    offset += iotxml_addInt(myMsg + offset, sizeof(myMsg) - offset,
+        focusedRtoa->uuid,
+        RTOA_DEVICE_TYPE,
+        IOT_PARAM_MEASURE,
+        "override",
+        NULL,
+        0,
+        focusedRtoa->override);
+
+
+    if(focusedRtoa->tstate >= 0) {
+      offset += iotxml_addInt(myMsg + offset, sizeof(myMsg) - offset,
+          focusedRtoa->uuid,
+          RTOA_DEVICE_TYPE,
+          IOT_PARAM_MEASURE,
+          "tstate",
+          NULL,
+          0,
+          focusedRtoa->tstate);
+    }
 
-  for(i = 0; i < rtoamanager_size(); i++) {
-    if((focusedRtoa = rtoamanager_get(i)) != NULL) {
-      if(focusedRtoa->inUse && focusedRtoa->measurementsUpdated) {
-        focusedRtoa->measurementsUpdated = false;
-
-        offset = 0;
-
-        // I didn't want to fill up our buffer here, so each thermostat gets
-        // its own message and we toss it like a hot potato
-        iotxml_newMsg(myMsg, sizeof(myMsg));
-
-        snprintf(buffer, sizeof(buffer), "%4.2f", focusedRtoa->temp);
-        offset += iotxml_addString(myMsg + offset, sizeof(myMsg) - offset,
-            focusedRtoa->uuid,
-            RTOA_DEVICE_TYPE,
-            IOT_PARAM_MEASURE,
-            "temp",
-            NULL,
-            0,
-            buffer);
-
-        snprintf(buffer, sizeof(buffer), "%3.1lf", focusedRtoa->heat);
-        offset += iotxml_addString(myMsg + offset, sizeof(myMsg) - offset,
-            focusedRtoa->uuid,
-            RTOA_DEVICE_TYPE,
-            IOT_PARAM_MEASURE,
-            "targetTempHeat",
-            NULL,
-            0,
-            buffer);
-
-        snprintf(buffer, sizeof(buffer), "%3.1lf", focusedRtoa->cool);
-        offset += iotxml_addString(myMsg + offset, sizeof(myMsg) - offset,
-            focusedRtoa->uuid,
-            RTOA_DEVICE_TYPE,
-            IOT_PARAM_MEASURE,
-            "targetTempCool",
-            NULL,
-            0,
-            buffer);
-
-        offset += iotxml_addString(myMsg + offset, sizeof(myMsg) - offset,
-            focusedRtoa->uuid,
-            RTOA_DEVICE_TYPE,
-            IOT_PARAM_MEASURE,
-            "program/cool",
-            NULL,
-            0,
-            focusedRtoa->programCool);
-
-        offset += iotxml_addString(myMsg + offset, sizeof(myMsg) - offset,
-            focusedRtoa->uuid,
-            RTOA_DEVICE_TYPE,
-            IOT_PARAM_MEASURE,
-            "program/heat",
-            NULL,
-            0,
-            focusedRtoa->programHeat);
-
-        offset += iotxml_addInt(myMsg + offset, sizeof(myMsg) - offset,
-            focusedRtoa->uuid,
-            RTOA_DEVICE_TYPE,
-            IOT_PARAM_MEASURE,
-            "tmode",
-            NULL,
-            0,
-            focusedRtoa->tmode);
-
-        offset += iotxml_addInt(myMsg + offset, sizeof(myMsg) - offset,
-            focusedRtoa->uuid,
-            RTOA_DEVICE_TYPE,
-            IOT_PARAM_MEASURE,
-            "fmode",
-            NULL,
-            0,
-            focusedRtoa->fmode);
-
-        offset += iotxml_addInt(myMsg + offset, sizeof(myMsg) - offset,
-            focusedRtoa->uuid,
-            RTOA_DEVICE_TYPE,
-            IOT_PARAM_MEASURE,
-            "hold",
-            NULL,
-            0,
-            focusedRtoa->hold);
-
-        offset += iotxml_addInt(myMsg + offset, sizeof(myMsg) - offset,
-            focusedRtoa->uuid,
-            RTOA_DEVICE_TYPE,
-            IOT_PARAM_MEASURE,
-            "override",
-            NULL,
-            0,
-            focusedRtoa->override);
-
-
-        if(focusedRtoa->tstate >= 0) {
-          offset += iotxml_addInt(myMsg + offset, sizeof(myMsg) - offset,
-              focusedRtoa->uuid,
-              RTOA_DEVICE_TYPE,
-              IOT_PARAM_MEASURE,
-              "tstate",
-              NULL,
-              0,
-              focusedRtoa->tstate);
-        }
-
-        if(focusedRtoa->fstate >= 0) {
-          offset += iotxml_addInt(myMsg + offset, sizeof(myMsg) - offset,
-              focusedRtoa->uuid,
-              RTOA_DEVICE_TYPE,
-              IOT_PARAM_MEASURE,
-              "fstate",
-              NULL,
-              0,
-              focusedRtoa->fstate);
-        }
-
-        iotxml_send(myMsg, sizeof(myMsg));
-      }
+    if(focusedRtoa->fstate >= 0) {
+      offset += iotxml_addInt(myMsg + offset, sizeof(myMsg) - offset,
+          focusedRtoa->uuid,
+          RTOA_DEVICE_TYPE,
+          IOT_PARAM_MEASURE,
+          "fstate",
+          NULL,
+          0,
+          focusedRtoa->fstate);
     }
+
+    iotxmlbatch_add(&sBatch, myMsg, sizeof(myMsg));
   }
+
+  iotxmlbatch_flush(&sBatch);
 }
 
 
 /***************** Private Functions *****************/
+/**
+ * Read the measurements out of a thermostat's answer, straight from the
+ * text without building a JSON tree
+ *
+ * @param text Answer to GET /tstat
+ * @param rtoaBuffer Filled in with the measurements found
+ * @return FAIL if the answer isn't JSON, or any measurement was -1, which
+ *     means all of them are suspect
+ */
+static error_t _rtoameasure_parse(const char *text, rtoa_t *rtoaBuffer) {
+  const jsonschema_field_t *field;
+  const char *value;
+  unsigned int found;
+  int i;
+
+  // We aren't in heater or cooler mode unless the thermostat says so
+  rtoaBuffer->heat = 0;
+  rtoaBuffer->cool = 0;
 
+  if (jsonschema_extract(sTstatFields, text, rtoaBuffer, &found) != SUCCESS) {
+    return FAIL;
+  }
+
+  // A value the thermostat couldn't read comes back as -1
+  for (i = 0; sTstatFields[i].key != NULL; i++) {
+    field = &sTstatFields[i];
+    value = (const char *) rtoaBuffer + field->offset;
 
+    if (JSONSCHEMA_FOUND(found, i)) {
+      if ((field->type == JSONSCHEMA_DOUBLE ? jsonscan_toInt(*(const double *) value) : *(const int *) value) == -1) {
+        return FAIL;
+      }
+    }
+  }
+
+  return SUCCESS;
+}
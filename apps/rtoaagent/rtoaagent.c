@@ -50,11 +50,17 @@
 #include <stdbool.h>
 #include <pthread.h>
 
+#include "libiotmem.h"
+#include "libmetrics.h"
+
 #include "ioterror.h"
 #include "iotdebug.h"
 #include "proxyserver.h"
 #include "clientsocket.h"
+#include "commandexecutor.h"
+#include "iotxmlcache.h"
 #include "iotapi.h"
+#include "iottrace.h"
 
 #include "rtoaagent.h"
 
@@ -92,18 +98,48 @@ static pthread_mutex_t thermostatMutex;
 int main(int argc, char *argv[]) {
   SYSLOG_INFO("*************** RTOA Agent ***************");
 
+  // Log from a background thread instead of the threads doing the work
+  libiotlog_start(NULL);
+
+  // Account for the heap of libxml2, libcurl and cJSON before they use it,
+  // and publish it on our own port, because we don't share the proxy's metrics
+  libmetrics_start();
+  libiotmem_start();
+  libmetrics_serve(RTOA_METRICS_ADDRESS, RTOA_METRICS_PORT);
+
   pthread_mutex_init(rtoaagent_getMutex(), NULL);
 
+  if(rtoamanager_init() != SUCCESS) {
+    SYSLOG_ERR("[rtoa] Couldn't allocate the thermostat registry");
+    return 1;
+  }
+
+  // Only report measurements that changed, like the schedules which hardly
+  // ever do, but send everything again every once in a while
+  iotxmlcache_setPolicy(NULL, true, 0, 0);
+  iotxmlcache_setKeyframePeriod(RTOA_KEYFRAME_PERIOD_SEC);
+
   // Open a socket to the proxy server
   while(clientsocket_open("127.0.0.1", DEFAULT_PROXY_PORT) != SUCCESS) {
     SYSLOG_DEBUG("[rtoa] Couldn't open client socket");
     sleep(5);
   }
 
+  // Execute commands on worker threads, so a slow thermostat or a long
+  // measurement cycle doesn't hold up commands to the other thermostats
+  if(commandexecutor_start(RTOA_COMMAND_WORKERS) != SUCCESS) {
+    SYSLOG_ERR("[rtoa] Couldn't start the command executor");
+    return 1;
+  }
+
   // Listen for commands
-  iotxml_addCommandListener(&rtoacontrol_execute, "set");
+  commandexecutor_addBatchHandler(&rtoacontrol_execute, "set", RTOA_COMMAND_DEADLINE_SEC);
   iotxml_addCommandListener(&rtoaagent_discover, "discover");
 
+#if IOTTRACE_ENABLED
+  iottrace_start(IOTTRACE_FILENAME);
+#endif
+
   printf("Radio Thermostat of America Agent running\n");
   printf("Monitor the syslogs (/var/log/messages) for runtime information\n");
 
@@ -164,6 +200,11 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  rtoadiscovery_stop();
+  iottrace_stop();
+  libiotmem_stop();
+  libiotlog_stop();
+  commandexecutor_stop();
   pthread_mutex_destroy(rtoaagent_getMutex());
 
   return 0;
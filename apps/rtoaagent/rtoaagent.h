@@ -61,6 +61,28 @@
 /** Number of seconds between time synchronizations */
 #define RTOA_TIME_SYNC_PERIOD_SEC 3600
 
+/** Number of worker threads executing commands on thermostats */
+#define RTOA_COMMAND_WORKERS 4
+
+/** Seconds from receiving a command until it must be executed */
+#define RTOA_COMMAND_DEADLINE_SEC 30
+
+/** Seconds after which measurements are sent again even if they didn't change */
+#define RTOA_KEYFRAME_PERIOD_SEC 900
+
+/** Byte budget of one frame of measurements sent to the proxy */
+#define RTOA_BATCH_MAX_BYTES 4096
+
+/** Port the agent answers "GET /metrics" on, with the heap of libxml2, libcurl and cJSON */
+#ifndef RTOA_METRICS_PORT
+#define RTOA_METRICS_PORT 60111
+#endif
+
+/** Address the metrics are served on. NULL keeps them to this hub, or set e.g. "0.0.0.0" to open them to the LAN */
+#ifndef RTOA_METRICS_ADDRESS
+#define RTOA_METRICS_ADDRESS NULL
+#endif
+
 /** Maximum size of a message buffer to receive messages from the thermostat */
 #define RTOA_MAX_MSG_SIZE 1024
 
@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2011 People Power Company
+ * All rights reserved.
+ *
+ * This open source code was developed with funding from People Power Company
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the People Power Corporation nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * PEOPLE POWER CO. OR ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "cppunit/extensions/HelperMacros.h"
+
+#include "rtoacontrol_test.h"
+
+extern "C" {
+#include "iotdebug.h"
+#include "ioterror.h"
+#include "iotapi.h"
+#include "libhttpcomm.h"
+#include "rtoaagent.h"
+#include "rtoamanager.h"
+#include "rtoacontrol.h"
+#include "commandexecutor.h"
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION( RtoaControlTest );
+
+/** Most requests a test sends to the thermostat */
+#define TEST_MAX_POSTS 8
+
+/** The only thermostat the manager knows about */
+static rtoa_t thermostat;
+
+/** Requests sent to the thermostat */
+static struct {
+  char url[PATH_MAX];
+  char body[RTOA_MAX_MSG_SIZE];
+} posts[TEST_MAX_POSTS];
+
+static int totalPosts;
+
+/** How the thermostat answers */
+static const char *reply;
+
+/** True if the thermostat can't be reached */
+static bool unreachable;
+
+/** Number of times the agent was asked to measure again */
+static int refreshes;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/***************** Stubs ****************/
+extern "C" int libhttpcomm_sendMsg(CURLSH * shareCurlHandle, CURLoption httpMethod,
+    const char *url, const char *sslCertPath, const char *authToken,
+    char *msgToSendPtr, int msgToSendSize, char *rxBuffer, int maxRxBufferSize,
+    http_param_t params, int(*ProgressCallback)(void *clientp, double dltotal,
+        double dlnow, double ultotal, double ulnow)) {
+  if(totalPosts < TEST_MAX_POSTS) {
+    snprintf(posts[totalPosts].url, sizeof(posts[totalPosts].url), "%s", url);
+    snprintf(posts[totalPosts].body, sizeof(posts[totalPosts].body), "%.*s", msgToSendSize, msgToSendPtr);
+    totalPosts++;
+  }
+
+  if(unreachable) {
+    return -1;
+  }
+
+  snprintf(rxBuffer, maxRxBufferSize, "%s", reply);
+  return 0;
+}
+
+extern "C" pthread_mutex_t *rtoaagent_getMutex() {
+  return &mutex;
+}
+
+extern "C" void rtoaagent_refreshDevices() {
+  refreshes++;
+}
+
+extern "C" void rtoaagent_discover() {
+}
+
+extern "C" rtoa_t *rtoamanager_getByUuid(const char *uuid) {
+  return strcmp(uuid, thermostat.uuid) == 0 ? &thermostat : NULL;
+}
+
+extern "C" rtoa_t *rtoamanager_get(int index) {
+  return index == 0 ? &thermostat : NULL;
+}
+
+extern "C" int rtoamanager_size() {
+  return 1;
+}
+
+extern "C" bool commandexecutor_isBusy(const char *deviceId) {
+  return false;
+}
+
+/***************** Helpers ****************/
+static void reset() {
+  memset(&thermostat, 0, sizeof(thermostat));
+  thermostat.inUse = true;
+  snprintf(thermostat.ip, sizeof(thermostat.ip), "10.0.0.5");
+  snprintf(thermostat.uuid, sizeof(thermostat.uuid), "RTOA-1");
+  totalPosts = 0;
+  refreshes = 0;
+  reply = "{\"success\": 0}";
+  unreachable = false;
+}
+
+/**
+ * Fill in one command of a batch
+ */
+static void setCommand(command_t *cmd, int commandId, const char *deviceId, const char *name, const char *argument) {
+  memset(cmd, 0, sizeof(command_t));
+  cmd->commandId = commandId;
+  snprintf(cmd->deviceId, sizeof(cmd->deviceId), "%s", deviceId);
+  snprintf(cmd->commandType, sizeof(cmd->commandType), "set");
+  snprintf(cmd->commandName, sizeof(cmd->commandName), "%s", name);
+  cmd->argument = argument;
+  cmd->argSize = argument != NULL ? strlen(argument) : 0;
+}
+
+/**
+ * Execute a batch the way the command executor hands it over
+ */
+static void execute(command_t *cmds, result_code_e *results, int total) {
+  int i;
+
+  for(i = 0; i < total; i++) {
+    results[i] = IOT_RESULT_HUBERROR;
+  }
+
+  rtoacontrol_execute(cmds, results, total, 10);
+}
+
+/***************** Tests ****************/
+void RtoaControlTest::testMerge(void) {
+  command_t cmds[5];
+  result_code_e results[5];
+  int i;
+
+  reset();
+  setCommand(&cmds[0], 10, "RTOA-1", "tmode", "1");
+  setCommand(&cmds[1], 10, "RTOA-1", "fmode", "2");
+  setCommand(&cmds[2], 11, "RTOA-1", RTOA_TARGET_TEMP_HEAT, "68.5");
+  setCommand(&cmds[3], 11, "RTOA-1", RTOA_TARGET_TEMP_COOL, "75");
+  setCommand(&cmds[4], 12, "RTOA-1", "tmode", "2");
+  execute(cmds, results, 5);
+
+  // Every setting goes out in one request, and the later tmode wins
+  CPPUNIT_ASSERT_MESSAGE("Settings weren't merged into one request", totalPosts == 1);
+  CPPUNIT_ASSERT_MESSAGE("Wrong URL", strcmp(posts[0].url, "10.0.0.5/tstat") == 0);
+  CPPUNIT_ASSERT_MESSAGE("Wrong body", strcmp(posts[0].body, "{\"tmode\":2,\"fmode\":2,\"t_heat\":68.5,\"t_cool\":75}") == 0);
+
+  for(i = 0; i < 5; i++) {
+    CPPUNIT_ASSERT_MESSAGE("Merged command didn't get the thermostat's result", results[i] == IOT_RESULT_EXECUTED);
+  }
+  CPPUNIT_ASSERT_MESSAGE("Thermostat wasn't measured again", refreshes == 1);
+}
+
+void RtoaControlTest::testProgram(void) {
+  command_t cmds[2];
+  result_code_e results[2];
+
+  reset();
+  setCommand(&cmds[0], 20, "RTOA-1", "program/heat", "{\"0\":[360,70]}");
+  setCommand(&cmds[1], 21, "RTOA-1", "fmode", "0");
+  execute(cmds, results, 2);
+
+  CPPUNIT_ASSERT_MESSAGE("Wrong number of requests", totalPosts == 2);
+  CPPUNIT_ASSERT_MESSAGE("Program went to the wrong URL", strcmp(posts[0].url, "10.0.0.5/tstat/program/heat") == 0);
+  CPPUNIT_ASSERT_MESSAGE("Program wasn't forwarded as is", strcmp(posts[0].body, "{\"0\":[360,70]}") == 0);
+  CPPUNIT_ASSERT_MESSAGE("Setting went to the wrong URL", strcmp(posts[1].url, "10.0.0.5/tstat") == 0);
+  CPPUNIT_ASSERT_MESSAGE("Program failed", results[0] == IOT_RESULT_EXECUTED);
+  CPPUNIT_ASSERT_MESSAGE("Setting failed", results[1] == IOT_RESULT_EXECUTED);
+}
+
+void RtoaControlTest::testDuplicates(void) {
+  command_t cmds[3];
+  result_code_e results[3];
+
+  reset();
+  setCommand(&cmds[0], 30, "RTOA-1", "tmode", "1");
+  setCommand(&cmds[1], 30, "RTOA-1", "tmode", "3");
+  setCommand(&cmds[2], 30, "RTOA-1", "fmode", "1");
+  execute(cmds, results, 3);
+
+  CPPUNIT_ASSERT_MESSAGE("Repeated parameter wasn't ignored", results[1] == IOT_RESULT_HUBERROR);
+  CPPUNIT_ASSERT_MESSAGE("Repeated parameter was merged", strcmp(posts[0].body, "{\"tmode\":1,\"fmode\":1}") == 0);
+  CPPUNIT_ASSERT_MESSAGE("First parameter failed", results[0] == IOT_RESULT_EXECUTED);
+  CPPUNIT_ASSERT_MESSAGE("Other parameter of the command failed", results[2] == IOT_RESULT_EXECUTED);
+
+  // The rest of a command's parameters may come in the next batch
+  setCommand(&cmds[0], 30, "RTOA-1", RTOA_TARGET_TEMP_HEAT, "70");
+  execute(cmds, results, 1);
+  CPPUNIT_ASSERT_MESSAGE("Parameter in the next batch was taken for a duplicate", results[0] == IOT_RESULT_EXECUTED);
+  CPPUNIT_ASSERT_MESSAGE("Parameter in the next batch wasn't sent", totalPosts == 2);
+}
+
+void RtoaControlTest::testErrors(void) {
+  command_t cmds[COMMANDEXECUTOR_MAX_BATCH + 1];
+  result_code_e results[COMMANDEXECUTOR_MAX_BATCH + 1];
+  int i;
+
+  reset();
+  setCommand(&cmds[0], 40, "RTOA-2", "tmode", "1");
+  execute(cmds, results, 1);
+  CPPUNIT_ASSERT_MESSAGE("Unknown thermostat wasn't reported", results[0] == IOT_RESULT_DEVICENOTIDENTIFIED);
+
+  setCommand(&cmds[0], 41, "RTOA-1", "tmode", NULL);
+  setCommand(&cmds[1], 42, "RTOA-1", "bogus", "1");
+  execute(cmds, results, 2);
+  CPPUNIT_ASSERT_MESSAGE("Missing argument wasn't reported", results[0] == IOT_RESULT_WRONGFORMAT);
+  CPPUNIT_ASSERT_MESSAGE("Unsupported setting wasn't reported", results[1] == IOT_RESULT_DEVICENOTSUPPORTED);
+  CPPUNIT_ASSERT_MESSAGE("Nothing to send was sent", totalPosts == 0);
+
+  reply = "{\"error\": 1}";
+  setCommand(&cmds[0], 43, "RTOA-1", "tmode", "1");
+  setCommand(&cmds[1], 43, "RTOA-1", "fmode", "1");
+  execute(cmds, results, 2);
+  CPPUNIT_ASSERT_MESSAGE("Thermostat's failure wasn't reported", results[0] == IOT_RESULT_DEVICEEXECUTIONERROR && results[1] == IOT_RESULT_DEVICEEXECUTIONERROR);
+  CPPUNIT_ASSERT_MESSAGE("Failed command was measured again", refreshes == 0);
+
+  unreachable = true;
+  execute(cmds, results, 2);
+  CPPUNIT_ASSERT_MESSAGE("Unreachable thermostat wasn't reported", results[0] == IOT_RESULT_DEVICECONNECTIONERROR && results[1] == IOT_RESULT_DEVICECONNECTIONERROR);
+
+  // A batch never holds more than the executor hands over
+  unreachable = false;
+  totalPosts = 0;
+  for(i = 0; i < COMMANDEXECUTOR_MAX_BATCH + 1; i++) {
+    setCommand(&cmds[i], 50 + i, "RTOA-1", "tmode", "1");
+  }
+  execute(cmds, results, COMMANDEXECUTOR_MAX_BATCH + 1);
+  CPPUNIT_ASSERT_MESSAGE("Oversized batch was executed", totalPosts == 0 && results[0] == IOT_RESULT_HUBERROR);
+}
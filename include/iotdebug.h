@@ -20,6 +20,10 @@
 #define IOTDEBUG_H
 
 #include <syslog.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "ioterror.h"
 
 /** Dummy function for SYSLOG_* macros to use when we optimize out text */
 static void __attribute__((unused)) dummySyslog(__const char *__fmt, ...) { }
@@ -32,52 +36,119 @@ static void __attribute__((unused)) dummySyslog(__const char *__fmt, ...) { }
 #define SYSLOG_LEVEL_CRIT 5
 #define SYSLOG_LEVEL_ALERT 6
 
+/** Messages below this level are compiled out */
 #ifndef SYSLOG_LEVEL
 #define SYSLOG_LEVEL SYSLOG_LEVEL_DEBUG
 #endif
 
+/**
+ * Level of every module until it's changed at runtime. Debug messages stay
+ * compiled in, so they can still be turned on for one module at a time.
+ */
+#ifndef IOTLOG_DEFAULT_LEVEL
+#define IOTLOG_DEFAULT_LEVEL SYSLOG_LEVEL_INFO
+#endif
+
+/** Maximum size of a module name, including the null */
+#define IOTLOG_MODULE_NAME_SIZE 32
+
+/**
+ * Log level and rate limit of one module, i.e. one .c file, named after the
+ * file without its directory or extension
+ */
+typedef struct iotlog_module_t {
+
+  char name[IOTLOG_MODULE_NAME_SIZE];
+
+  /** Messages below this SYSLOG_LEVEL_* are skipped without evaluating their arguments */
+  volatile int level;
+
+  /** Second the module's messages are being counted in */
+  volatile time_t windowSec;
+
+  /** Messages logged in that second */
+  volatile uint32_t windowCount;
+
+  /** Messages dropped since the last time we said so */
+  volatile uint32_t dropped;
+
+} iotlog_module_t;
+
+/**
+ * Module the messages of this .c file belong to, looked up on the first
+ * message
+ */
+static iotlog_module_t __attribute__((unused)) *_iotlogModule;
+
+/***************** Public Prototypes ****************/
+iotlog_module_t *libiotlog_module(const char *file);
+
+void libiotlog_write(iotlog_module_t *module, int level, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+error_t libiotlog_start(const char *destination);
+
+void libiotlog_stop();
+
+error_t libiotlog_setLevel(const char *name, int level);
+
+error_t libiotlog_setLevels(const char *levels);
+
+
+#define _IOTLOG(messageLevel, formatString, ...) do { \
+    if (_iotlogModule == NULL) { \
+      _iotlogModule = libiotlog_module(__FILE__); \
+    } \
+    if ((messageLevel) >= _iotlogModule->level) { \
+      libiotlog_write(_iotlogModule, (messageLevel), "%s(): "formatString, __FUNCTION__, ##__VA_ARGS__); \
+    } \
+  } while (0)
+
+#define _IOTLOG_DUMMY(formatString, ...) do { \
+    if (0) { \
+      dummySyslog(""formatString, ##__VA_ARGS__); \
+    } \
+  } while (0)
 
 #if SYSLOG_LEVEL <= SYSLOG_LEVEL_ALERT
-#define SYSLOG_ALERT(formatString, ...) syslog (LOG_ALERT, "%s(): "formatString, __FUNCTION__, ##__VA_ARGS__)
+#define SYSLOG_ALERT(formatString, ...) _IOTLOG(SYSLOG_LEVEL_ALERT, formatString, ##__VA_ARGS__)
 #else
-#define SYSLOG_ALERT(formatString, ...) dummySyslog(""formatString, ##__VA_ARGS__);
+#define SYSLOG_ALERT(formatString, ...) _IOTLOG_DUMMY(formatString, ##__VA_ARGS__)
 #endif
 
-
 #if SYSLOG_LEVEL <= SYSLOG_LEVEL_CRIT
-#define SYSLOG_CRIT(formatString, ...) syslog (LOG_CRIT, "%s(): "formatString, __FUNCTION__, ##__VA_ARGS__)
+#define SYSLOG_CRIT(formatString, ...) _IOTLOG(SYSLOG_LEVEL_CRIT, formatString, ##__VA_ARGS__)
 #else
-#define SYSLOG_CRIT(formatString, ...) dummySyslog(""formatString, ##__VA_ARGS__);
+#define SYSLOG_CRIT(formatString, ...) _IOTLOG_DUMMY(formatString, ##__VA_ARGS__)
 #endif
 
 #if SYSLOG_LEVEL <= SYSLOG_LEVEL_ERR
-#define SYSLOG_ERR(formatString, ...) syslog (LOG_ERR, "%s(): "formatString, __FUNCTION__, ##__VA_ARGS__)
+#define SYSLOG_ERR(formatString, ...) _IOTLOG(SYSLOG_LEVEL_ERR, formatString, ##__VA_ARGS__)
 #else
-#define SYSLOG_ERR(formatString, ...) dummySyslog(""formatString, ##__VA_ARGS__);
+#define SYSLOG_ERR(formatString, ...) _IOTLOG_DUMMY(formatString, ##__VA_ARGS__)
 #endif
 
 #if SYSLOG_LEVEL <= SYSLOG_LEVEL_WARNING
-#define SYSLOG_WARNING(formatString, ...) syslog (LOG_WARNING, "%s(): "formatString, __FUNCTION__, ##__VA_ARGS__)
+#define SYSLOG_WARNING(formatString, ...) _IOTLOG(SYSLOG_LEVEL_WARNING, formatString, ##__VA_ARGS__)
 #else
-#define SYSLOG_WARNING(formatString, ...) dummySyslog(""formatString, ##__VA_ARGS__);
+#define SYSLOG_WARNING(formatString, ...) _IOTLOG_DUMMY(formatString, ##__VA_ARGS__)
 #endif
 
 #if SYSLOG_LEVEL <= SYSLOG_LEVEL_NOTICE
-#define SYSLOG_NOTICE(formatString, ...) syslog (LOG_NOTICE, "%s(): "formatString, __FUNCTION__, ##__VA_ARGS__)
+#define SYSLOG_NOTICE(formatString, ...) _IOTLOG(SYSLOG_LEVEL_NOTICE, formatString, ##__VA_ARGS__)
 #else
-#define SYSLOG_NOTICE(formatString, ...) dummySyslog(""formatString, ##__VA_ARGS__);
+#define SYSLOG_NOTICE(formatString, ...) _IOTLOG_DUMMY(formatString, ##__VA_ARGS__)
 #endif
 
 #if SYSLOG_LEVEL <= SYSLOG_LEVEL_INFO
-#define SYSLOG_INFO(formatString, ...) syslog (LOG_INFO, "%s(): "formatString, __FUNCTION__, ##__VA_ARGS__)
+#define SYSLOG_INFO(formatString, ...) _IOTLOG(SYSLOG_LEVEL_INFO, formatString, ##__VA_ARGS__)
 #else
-#define SYSLOG_INFO(formatString, ...) dummySyslog(""formatString, ##__VA_ARGS__);
+#define SYSLOG_INFO(formatString, ...) _IOTLOG_DUMMY(formatString, ##__VA_ARGS__)
 #endif
 
 #if SYSLOG_LEVEL <= SYSLOG_LEVEL_DEBUG
-#define SYSLOG_DEBUG(formatString, ...) syslog (LOG_DEBUG, "%s(): "formatString, __FUNCTION__, ##__VA_ARGS__)
+#define SYSLOG_DEBUG(formatString, ...) _IOTLOG(SYSLOG_LEVEL_DEBUG, formatString, ##__VA_ARGS__)
 #else
-#define SYSLOG_DEBUG(formatString, ...) dummySyslog(""formatString, ##__VA_ARGS__);
+#define SYSLOG_DEBUG(formatString, ...) _IOTLOG_DUMMY(formatString, ##__VA_ARGS__)
 #endif
 
 #endif
@@ -54,6 +54,9 @@ static pthread_attr_t sThreadAttr;
 /** Socket file descriptor */
 static int socketFd;
 
+/** Mutex to keep messages sent from different threads from interleaving */
+static pthread_mutex_t sSendMutex = PTHREAD_MUTEX_INITIALIZER;
+
 /**************** Prototypes ****************/
 static void *_clientCommThread(void *params);
 
@@ -134,10 +137,13 @@ error_t clientsocket_close() {
 error_t clientsocket_send(const char *message, int len) {
   assert(message);
 
+  pthread_mutex_lock(&sSendMutex);
   if (write(socketFd, message, len) < 0) {
+    pthread_mutex_unlock(&sSendMutex);
     SYSLOG_ERR("ERROR writing to socket");
     return FAIL;
   }
+  pthread_mutex_unlock(&sSendMutex);
 
   return SUCCESS;
 }
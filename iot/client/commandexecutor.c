@@ -0,0 +1,647 @@
+/*
+ *  Copyright 2013 People Power Company
+ *
+ *  This code was developed with funding from People Power Company
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * Agent-side command executor.
+ *
+ * Commands arrive on the client socket thread. Instead of executing them
+ * there, the executor acknowledges each command with IOT_RESULT_RECEIVED,
+ * copies it onto a FIFO queue for its device, and lets a small pool of
+ * worker threads execute the queues. Commands for one device run one at
+ * a time and in order, while commands for different devices run in
+ * parallel. Every command carries a deadline; a command still queued when
+ * its deadline passes is answered with IOT_RESULT_HUBERROR instead of being
+ * executed late.
+ *
+ * Commands for a batch handler wait until the server message that carried
+ * them is complete (the noMoreCommands notification), or for at most
+ * COMMANDEXECUTOR_BATCH_WINDOW_MS, and then all the commands queued for the
+ * device are handed over together.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+
+#include "iotdebug.h"
+#include "ioterror.h"
+#include "commandexecutor.h"
+#include "iottrace.h"
+
+/**
+ * A command waiting in a device queue, with its own copy of the argument
+ * because the parser's copy is gone once the listener returns
+ */
+typedef struct commandjob_t {
+
+  command_t command;
+
+  char argument[COMMANDEXECUTOR_ARGUMENT_SIZE];
+
+  commandhandler_f handler;
+
+  commandbatchhandler_f batchHandler;
+
+  /** CLOCK_MONOTONIC time the command must be finished by */
+  struct timespec deadline;
+
+  /** CLOCK_MONOTONIC time a batched command stops waiting for more commands */
+  struct timespec batchTime;
+
+  /** True once the server message that carried this command is complete */
+  bool sealed;
+
+  /** True once the server was told we received this command, workers leave it alone until then */
+  bool acknowledged;
+
+  struct commandjob_t *next;
+
+} commandjob_t;
+
+/** Handlers by command type */
+static struct {
+
+  commandhandler_f h;
+
+  commandbatchhandler_f batchHandler;
+
+  char type[IOT_COMMAND_TYPE_STRING_SIZE];
+
+  int deadline_sec;
+
+  bool inUse;
+
+} handlers[COMMANDEXECUTOR_MAX_HANDLERS];
+
+/**
+ * A device's FIFO queue
+ */
+typedef struct commanddevice_t {
+
+  char deviceId[EUI64_STRING_SIZE];
+
+  commandjob_t *head;
+
+  commandjob_t *tail;
+
+  /** True while a worker is executing a command for this device */
+  bool busy;
+
+  bool inUse;
+
+} commanddevice_t;
+
+/** Per-device queues, grown whenever every one of them is in use */
+static commanddevice_t *devices;
+
+/** Number of queues allocated */
+static int totalDevices;
+
+/**
+ * Jobs not currently queued or executing. Jobs are allocated as commands
+ * arrive and then kept here for reuse, so a busy executor stops touching
+ * the heap once it has enough.
+ */
+static commandjob_t *freeJobs;
+
+/** Device queue the next idle worker starts looking at, for fairness */
+static int nextDevice;
+
+/** Worker threads */
+static pthread_t workers[COMMANDEXECUTOR_MAX_WORKERS];
+
+/** Number of worker threads running */
+static int totalWorkers;
+
+/** Worker termination flag */
+static volatile bool gTerminate;
+
+/** Mutex to protect everything above */
+static pthread_mutex_t sCommandExecutorMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Signaled when a command is queued or a message is complete, waits on CLOCK_MONOTONIC once started */
+static pthread_cond_t sCommandExecutorCond = PTHREAD_COND_INITIALIZER;
+
+/***************** Prototypes ****************/
+static void _commandexecutor_receive(command_t *cmd);
+static void *_commandexecutor_workerThread(void *params);
+static int _commandexecutor_findDevice(const char *deviceId);
+static int _commandexecutor_addDevice(const char *deviceId);
+static commandjob_t *_commandexecutor_newJob();
+static void _commandexecutor_addMs(struct timespec *time, int ms);
+static bool _commandexecutor_isBefore(const struct timespec *a, const struct timespec *b);
+static error_t _commandexecutor_addHandler(commandhandler_f h, commandbatchhandler_f batchHandler, const char *type, int deadline_sec);
+static void _commandexecutor_execute(commandjob_t **batch, int total);
+
+/***************** Public Functions ****************/
+/**
+ * Start the worker threads
+ * @param total Number of workers, i.e. COMMANDEXECUTOR_DEFAULT_WORKERS
+ * @return SUCCESS if the workers are running
+ */
+error_t commandexecutor_start(int total) {
+  pthread_condattr_t condAttr;
+  int i;
+
+  if(total < 1 || total > COMMANDEXECUTOR_MAX_WORKERS) {
+    SYSLOG_ERR("[executor] Can't start %d workers", total);
+    return FAIL;
+  }
+
+  pthread_mutex_lock(&sCommandExecutorMutex);
+  if(totalWorkers > 0) {
+    pthread_mutex_unlock(&sCommandExecutorMutex);
+    return SUCCESS;
+  }
+
+  gTerminate = false;
+
+  // Deadlines are on CLOCK_MONOTONIC so setting the wall clock doesn't
+  // expire commands early or hold batches back
+  pthread_condattr_init(&condAttr);
+  pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+  pthread_cond_destroy(&sCommandExecutorCond);
+  pthread_cond_init(&sCommandExecutorCond, &condAttr);
+  pthread_condattr_destroy(&condAttr);
+
+  for(i = 0; i < total; i++) {
+    if(pthread_create(&workers[i], NULL, &_commandexecutor_workerThread, NULL)) {
+      SYSLOG_ERR("[executor] Creating worker thread failed: %s", strerror(errno));
+      break;
+    }
+    totalWorkers++;
+  }
+  pthread_mutex_unlock(&sCommandExecutorMutex);
+
+  if(totalWorkers < total) {
+    commandexecutor_stop();
+    return FAIL;
+  }
+
+  SYSLOG_INFO("[executor] Started %d workers", totalWorkers);
+  return SUCCESS;
+}
+
+/**
+ * Stop the worker threads once they finish the commands they are executing.
+ * Commands still queued are dropped without a result.
+ */
+void commandexecutor_stop() {
+  commandjob_t *job;
+  int i;
+  int total;
+
+  pthread_mutex_lock(&sCommandExecutorMutex);
+  gTerminate = true;
+  total = totalWorkers;
+  pthread_cond_broadcast(&sCommandExecutorCond);
+  pthread_mutex_unlock(&sCommandExecutorMutex);
+
+  for(i = 0; i < total; i++) {
+    pthread_join(workers[i], NULL);
+  }
+
+  pthread_mutex_lock(&sCommandExecutorMutex);
+  totalWorkers = 0;
+  for(i = 0; i < totalDevices; i++) {
+    while((job = devices[i].head) != NULL) {
+      devices[i].head = job->next;
+      job->next = freeJobs;
+      freeJobs = job;
+    }
+  }
+  bzero(devices, sizeof(commanddevice_t) * totalDevices);
+  pthread_mutex_unlock(&sCommandExecutorMutex);
+}
+
+/**
+ * Execute commands of the given type through the executor.  Don't also
+ * register a command listener for the type.
+ *
+ * @param h Handler to execute each command on a worker thread
+ * @param type Type attribute to handle, "set", "delete", etc.
+ * @param deadline_sec Seconds from the arrival of a command until it
+ *     must be finished
+ * @return SUCCESS if the handler was added
+ */
+error_t commandexecutor_addHandler(commandhandler_f h, const char *type, int deadline_sec) {
+  return _commandexecutor_addHandler(h, NULL, type, deadline_sec);
+}
+
+/**
+ * Execute commands of the given type through the executor, handing the
+ * commands for one device from one server message over together
+ *
+ * @param h Handler to execute a batch of commands on a worker thread
+ * @param type Type attribute to handle, "set", "delete", etc.
+ * @param deadline_sec Seconds from the arrival of a command until it
+ *     must be finished
+ * @return SUCCESS if the handler was added
+ */
+error_t commandexecutor_addBatchHandler(commandbatchhandler_f h, const char *type, int deadline_sec) {
+  return _commandexecutor_addHandler(NULL, h, type, deadline_sec);
+}
+
+/**
+ * @param deviceId Device ID
+ * @return true if the device has commands queued or executing
+ */
+bool commandexecutor_isBusy(const char *deviceId) {
+  bool busy;
+
+  pthread_mutex_lock(&sCommandExecutorMutex);
+  busy = (_commandexecutor_findDevice(deviceId) >= 0);
+  pthread_mutex_unlock(&sCommandExecutorMutex);
+
+  return busy;
+}
+
+/***************** Private Functions ****************/
+/**
+ * Command listener for every type.  Runs on the thread that parsed the
+ * command, so it only queues.
+ */
+static void _commandexecutor_receive(command_t *cmd) {
+  commandjob_t *job;
+  int device;
+  int i;
+
+  if(cmd->noMoreCommands) {
+    // Everything queued so far is a complete batch
+    pthread_mutex_lock(&sCommandExecutorMutex);
+    for(device = 0; device < totalDevices; device++) {
+      for(job = devices[device].head; job != NULL; job = job->next) {
+        job->sealed = true;
+      }
+    }
+    pthread_cond_broadcast(&sCommandExecutorCond);
+    pthread_mutex_unlock(&sCommandExecutorMutex);
+    return;
+  }
+
+  pthread_mutex_lock(&sCommandExecutorMutex);
+
+  for(i = 0; i < COMMANDEXECUTOR_MAX_HANDLERS; i++) {
+    if(handlers[i].inUse && strcmp(handlers[i].type, cmd->commandType) == 0) {
+      break;
+    }
+  }
+
+  if(i == COMMANDEXECUTOR_MAX_HANDLERS) {
+    // Somebody else's command listener handles this type
+    pthread_mutex_unlock(&sCommandExecutorMutex);
+    return;
+  }
+
+  if(totalWorkers == 0) {
+    pthread_mutex_unlock(&sCommandExecutorMutex);
+    SYSLOG_ERR("[executor] Not executing command %d of type %s", cmd->commandId, cmd->commandType);
+    iotxml_sendResult(cmd->commandId, IOT_RESULT_HUBERROR);
+    return;
+  }
+
+  if(cmd->argSize >= COMMANDEXECUTOR_ARGUMENT_SIZE) {
+    pthread_mutex_unlock(&sCommandExecutorMutex);
+    SYSLOG_ERR("[executor] Argument of command %d for %s is longer than %d bytes", cmd->commandId, cmd->deviceId, COMMANDEXECUTOR_ARGUMENT_SIZE - 1);
+    iotxml_sendResult(cmd->commandId, IOT_RESULT_HUBERROR);
+    return;
+  }
+
+  if((device = _commandexecutor_findDevice(cmd->deviceId)) < 0) {
+    device = _commandexecutor_addDevice(cmd->deviceId);
+  }
+
+  if(device < 0 || (job = _commandexecutor_newJob()) == NULL) {
+    pthread_mutex_unlock(&sCommandExecutorMutex);
+    SYSLOG_ERR("[executor] Out of memory queueing command %d for %s", cmd->commandId, cmd->deviceId);
+    iotxml_sendResult(cmd->commandId, IOT_RESULT_HUBERROR);
+    return;
+  }
+
+  memcpy(&job->command, cmd, sizeof(command_t));
+  bzero(job->argument, sizeof(job->argument));
+  if(cmd->argument != NULL) {
+    memcpy(job->argument, cmd->argument, cmd->argSize);
+    job->command.argument = job->argument;
+  }
+  job->handler = handlers[i].h;
+  job->batchHandler = handlers[i].batchHandler;
+  job->sealed = false;
+  job->acknowledged = false;
+  clock_gettime(CLOCK_MONOTONIC, &job->deadline);
+  job->batchTime = job->deadline;
+  _commandexecutor_addMs(&job->batchTime, COMMANDEXECUTOR_BATCH_WINDOW_MS);
+  job->deadline.tv_sec += handlers[i].deadline_sec;
+  job->next = NULL;
+
+  if(devices[device].tail == NULL) {
+    devices[device].head = job;
+  } else {
+    devices[device].tail->next = job;
+  }
+  devices[device].tail = job;
+
+  pthread_mutex_unlock(&sCommandExecutorMutex);
+
+  // Acknowledge before any worker can pick the command up, so the server
+  // never sees the final result ahead of the acknowledgement. The socket
+  // may back up, so the workers aren't kept waiting on the lock meanwhile.
+  iotxml_sendResult(cmd->commandId, IOT_RESULT_RECEIVED);
+
+  pthread_mutex_lock(&sCommandExecutorMutex);
+  job->acknowledged = true;
+  pthread_cond_signal(&sCommandExecutorCond);
+  pthread_mutex_unlock(&sCommandExecutorMutex);
+}
+
+/**
+ * Worker thread.  Takes the next command, or batch of commands, from a
+ * device that isn't already being served and executes it.
+ */
+static void *_commandexecutor_workerThread(void *params) {
+  commandjob_t *batch[COMMANDEXECUTOR_MAX_BATCH];
+  commandjob_t *job;
+  struct timespec curTime;
+  struct timespec wakeTime;
+  bool waiting;
+  int device;
+  int total;
+  int i;
+
+  pthread_mutex_lock(&sCommandExecutorMutex);
+
+  while(!gTerminate) {
+    clock_gettime(CLOCK_MONOTONIC, &curTime);
+    waiting = false;
+    device = -1;
+
+    for(i = 0; i < totalDevices; i++) {
+      int candidate = (nextDevice + i) % totalDevices;
+
+      job = devices[candidate].head;
+      if(!devices[candidate].inUse || devices[candidate].busy || job == NULL || !job->acknowledged) {
+        continue;
+      }
+
+      if(job->batchHandler == NULL || job->sealed || !_commandexecutor_isBefore(&curTime, &job->batchTime)) {
+        device = candidate;
+        break;
+      }
+
+      // Still waiting for more commands to this device
+      if(!waiting || _commandexecutor_isBefore(&job->batchTime, &wakeTime)) {
+        wakeTime = job->batchTime;
+        waiting = true;
+      }
+    }
+
+    if(device < 0) {
+      if(waiting) {
+        pthread_cond_timedwait(&sCommandExecutorCond, &sCommandExecutorMutex, &wakeTime);
+      } else {
+        pthread_cond_wait(&sCommandExecutorCond, &sCommandExecutorMutex);
+      }
+      continue;
+    }
+
+    nextDevice = (device + 1) % totalDevices;
+
+    // Take the head of the queue, along with the commands from the same
+    // server message queued right behind it for the same batch handler
+    total = 0;
+    job = devices[device].head;
+    do {
+      batch[total++] = job;
+      job = job->next;
+    } while(job != NULL && total < COMMANDEXECUTOR_MAX_BATCH
+        && batch[0]->batchHandler != NULL
+        && job->batchHandler == batch[0]->batchHandler
+        && job->sealed == batch[0]->sealed
+        && job->acknowledged);
+
+    devices[device].head = job;
+    if(job == NULL) {
+      devices[device].tail = NULL;
+    }
+    devices[device].busy = true;
+    pthread_mutex_unlock(&sCommandExecutorMutex);
+
+    _commandexecutor_execute(batch, total);
+
+    pthread_mutex_lock(&sCommandExecutorMutex);
+    devices[device].busy = false;
+    if(devices[device].head == NULL) {
+      devices[device].inUse = false;
+    }
+
+    for(i = 0; i < total; i++) {
+      batch[i]->next = freeJobs;
+      freeJobs = batch[i];
+    }
+  }
+
+  pthread_mutex_unlock(&sCommandExecutorMutex);
+  return NULL;
+}
+
+/**
+ * Execute a command, or a batch of commands for one device, and send the
+ * results.  Commands past their deadline are answered without executing.
+ */
+static void _commandexecutor_execute(commandjob_t **batch, int total) {
+  command_t commands[COMMANDEXECUTOR_MAX_BATCH];
+  result_code_e results[COMMANDEXECUTOR_MAX_BATCH];
+  struct timespec curTime;
+  int timeout_sec = 0;
+  int remaining;
+  int live = 0;
+  int i;
+
+  clock_gettime(CLOCK_MONOTONIC, &curTime);
+
+  for(i = 0; i < total; i++) {
+    remaining = batch[i]->deadline.tv_sec - curTime.tv_sec;
+
+    if(remaining <= 0) {
+      SYSLOG_ERR("[executor] Command %d for %s expired before it could execute", batch[i]->command.commandId, batch[i]->command.deviceId);
+      iotxml_sendResult(batch[i]->command.commandId, IOT_RESULT_HUBERROR);
+      continue;
+    }
+
+    if(live == 0 || remaining < timeout_sec) {
+      timeout_sec = remaining;
+    }
+
+    memcpy(&commands[live], &batch[i]->command, sizeof(command_t));
+    results[live] = IOT_RESULT_HUBERROR;
+    live++;
+  }
+
+  if(live == 0) {
+    return;
+  }
+
+  for(i = 0; i < live; i++) {
+    iottrace_mark(commands[i].commandId, IOTTRACE_DEVICE_START, 0);
+  }
+
+  if(batch[0]->batchHandler != NULL) {
+    batch[0]->batchHandler(commands, results, live, timeout_sec);
+  } else {
+    results[0] = batch[0]->handler(&commands[0], timeout_sec);
+  }
+
+  for(i = 0; i < live; i++) {
+    iottrace_mark(commands[i].commandId, IOTTRACE_DEVICE_DONE, results[i]);
+    iotxml_sendResult(commands[i].commandId, results[i]);
+  }
+}
+
+/**
+ * Call with the mutex held
+ * @param deviceId Device ID
+ * @return the index of the device's queue, or -1 if it has no queue
+ */
+static int _commandexecutor_findDevice(const char *deviceId) {
+  int i;
+
+  for(i = 0; i < totalDevices; i++) {
+    if(devices[i].inUse && strncmp(devices[i].deviceId, deviceId, sizeof(devices[i].deviceId)) == 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * Give a device a queue, adding queues if they're all in use. Call with
+ * the mutex held.
+ * @param deviceId Device ID
+ * @return the index of the device's new queue, or -1 if we're out of memory
+ */
+static int _commandexecutor_addDevice(const char *deviceId) {
+  commanddevice_t *grown;
+  int total;
+  int i;
+
+  for(i = 0; i < totalDevices; i++) {
+    if(!devices[i].inUse) {
+      break;
+    }
+  }
+
+  if(i == totalDevices) {
+    total = totalDevices > 0 ? totalDevices * 2 : COMMANDEXECUTOR_INITIAL_DEVICES;
+    if((grown = realloc(devices, sizeof(commanddevice_t) * total)) == NULL) {
+      return -1;
+    }
+
+    bzero(&grown[totalDevices], sizeof(commanddevice_t) * (total - totalDevices));
+    devices = grown;
+    totalDevices = total;
+  }
+
+  devices[i].inUse = true;
+  strncpy(devices[i].deviceId, deviceId, sizeof(devices[i].deviceId));
+  return i;
+}
+
+/**
+ * Call with the mutex held
+ * @return a job to queue a command in, NULL if we're out of memory
+ */
+static commandjob_t *_commandexecutor_newJob() {
+  commandjob_t *job;
+
+  if((job = freeJobs) != NULL) {
+    freeJobs = job->next;
+    return job;
+  }
+
+  return malloc(sizeof(commandjob_t));
+}
+
+/**
+ * Move a time forward
+ * @param time Time to change
+ * @param ms Milliseconds to add
+ */
+static void _commandexecutor_addMs(struct timespec *time, int ms) {
+  time->tv_sec += ms / 1000;
+  time->tv_nsec += (long) (ms % 1000) * 1000000;
+  if(time->tv_nsec >= 1000000000) {
+    time->tv_sec++;
+    time->tv_nsec -= 1000000000;
+  }
+}
+
+/**
+ * @return true if time a is before time b
+ */
+static bool _commandexecutor_isBefore(const struct timespec *a, const struct timespec *b) {
+  return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/**
+ * Add a handler, or a batch handler, for a command type
+ */
+static error_t _commandexecutor_addHandler(commandhandler_f h, commandbatchhandler_f batchHandler, const char *type, int deadline_sec) {
+  int i;
+
+  if(type == NULL || deadline_sec <= 0) {
+    return FAIL;
+  }
+
+  pthread_mutex_lock(&sCommandExecutorMutex);
+  for(i = 0; i < COMMANDEXECUTOR_MAX_HANDLERS; i++) {
+    if(handlers[i].inUse && strcmp(handlers[i].type, type) == 0) {
+      SYSLOG_DEBUG("[executor] Replacing handler for type %s", type);
+      break;
+    }
+  }
+
+  if(i == COMMANDEXECUTOR_MAX_HANDLERS) {
+    for(i = 0; i < COMMANDEXECUTOR_MAX_HANDLERS; i++) {
+      if(!handlers[i].inUse) {
+        break;
+      }
+    }
+  }
+
+  if(i == COMMANDEXECUTOR_MAX_HANDLERS) {
+    pthread_mutex_unlock(&sCommandExecutorMutex);
+    SYSLOG_ERR("[executor] No room for a handler for type %s", type);
+    return FAIL;
+  }
+
+  handlers[i].inUse = true;
+  handlers[i].h = h;
+  handlers[i].batchHandler = batchHandler;
+  handlers[i].deadline_sec = deadline_sec;
+  strncpy(handlers[i].type, type, sizeof(handlers[i].type) - 1);
+  pthread_mutex_unlock(&sCommandExecutorMutex);
+
+  // We listen to every type so we also hear the end of each server message,
+  // which carries whatever type the last command had.  Adding the same
+  // listener again is harmless.
+  return iotxml_addCommandListenerFor(&_commandexecutor_receive, NULL, NULL, NULL);
+}
@@ -0,0 +1,102 @@
+/*
+ *  Copyright 2013 People Power Company
+ *
+ *  This code was developed with funding from People Power Company
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef COMMANDEXECUTOR_H
+#define COMMANDEXECUTOR_H
+
+#include <stdbool.h>
+#include "ioterror.h"
+#include "iotapi.h"
+
+/** Default number of worker threads executing commands */
+#ifndef COMMANDEXECUTOR_DEFAULT_WORKERS
+#define COMMANDEXECUTOR_DEFAULT_WORKERS 4
+#endif
+
+/** Maximum number of worker threads */
+#ifndef COMMANDEXECUTOR_MAX_WORKERS
+#define COMMANDEXECUTOR_MAX_WORKERS 16
+#endif
+
+/** Maximum number of command handlers */
+#ifndef COMMANDEXECUTOR_MAX_HANDLERS
+#define COMMANDEXECUTOR_MAX_HANDLERS 8
+#endif
+
+/**
+ * Number of device queues allocated when the first command arrives. More
+ * are added whenever more devices have commands queued at once.
+ */
+#ifndef COMMANDEXECUTOR_INITIAL_DEVICES
+#define COMMANDEXECUTOR_INITIAL_DEVICES 16
+#endif
+
+/** Maximum number of commands handed to a batch handler at once */
+#ifndef COMMANDEXECUTOR_MAX_BATCH
+#define COMMANDEXECUTOR_MAX_BATCH 8
+#endif
+
+/**
+ * Milliseconds a command for a batch handler waits for more commands to the
+ * same device, when the server doesn't tell us the message is complete
+ */
+#ifndef COMMANDEXECUTOR_BATCH_WINDOW_MS
+#define COMMANDEXECUTOR_BATCH_WINDOW_MS 500
+#endif
+
+/** Largest command argument we will copy into the queue */
+#ifndef COMMANDEXECUTOR_ARGUMENT_SIZE
+#define COMMANDEXECUTOR_ARGUMENT_SIZE 512
+#endif
+
+/**
+ * Command handler function definitions take on the form:
+ *
+ *   result_code_e doCommand(command_t *cmd, int timeout_sec)
+ *
+ * The handler runs on a worker thread and never runs concurrently with
+ * another command for the same device. It should bound any blocking I/O to
+ * timeout_sec, the time left before the command's deadline, and return the
+ * result to send back to the server.
+ */
+typedef result_code_e (*commandhandler_f)(command_t *, int);
+
+/**
+ * Batch handler function definitions take on the form:
+ *
+ *   void doCommands(command_t *cmds, result_code_e *results, int total, int timeout_sec)
+ *
+ * The handler gets every command queued for one device from one server
+ * message, in order, so it can execute them with a single request to the
+ * device. It fills in results[i] for each cmds[i]; results start out as
+ * IOT_RESULT_HUBERROR.
+ */
+typedef void (*commandbatchhandler_f)(command_t *, result_code_e *, int, int);
+
+/***************** Public Prototypes ****************/
+error_t commandexecutor_start(int totalWorkers);
+
+void commandexecutor_stop();
+
+error_t commandexecutor_addHandler(commandhandler_f h, const char *type, int deadline_sec);
+
+error_t commandexecutor_addBatchHandler(commandbatchhandler_f h, const char *type, int deadline_sec);
+
+bool commandexecutor_isBusy(const char *deviceId);
+
+#endif
@@ -0,0 +1,347 @@
+/*
+ * Copyright (c) 2011 People Power Company
+ * All rights reserved.
+ *
+ * This open source code was developed with funding from People Power Company
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the People Power Corporation nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * PEOPLE POWER CO. OR ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "cppunit/extensions/HelperMacros.h"
+
+#include "commandexecutor_test.h"
+
+extern "C" {
+#include "iotdebug.h"
+#include "ioterror.h"
+#include "iotapi.h"
+#include "iottrace.h"
+#include "commandexecutor.h"
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION( CommandExecutorTest );
+
+/** Most results a test waits for */
+#define TEST_MAX_RESULTS 256
+
+/** Devices in the many devices test, more than the queues allocated at first */
+#define TEST_DEVICES (COMMANDEXECUTOR_INITIAL_DEVICES * 2 + 8)
+
+/** Results sent to the server, in the order they were sent */
+static struct {
+  int commandId;
+  result_code_e result;
+} sent[TEST_MAX_RESULTS];
+
+static int totalSent;
+
+/** Batches handed to the batch handler, as "id,id|" for each batch */
+static char batches[1024];
+
+/** Seconds the last command had left when its handler ran */
+static int lastTimeout;
+
+/** Set if two commands for the same device ever executed at once */
+static bool overlapped;
+
+/** Number of commands executing per device */
+static int running[TEST_DEVICES];
+
+static pthread_mutex_t sentMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** The executor's command listener */
+static commandlistener_f listener;
+
+/***************** Stubs ****************/
+extern "C" error_t iotxml_addCommandListenerFor(commandlistener_f l, const char *type, const char *deviceId, const char *commandName) {
+  listener = l;
+  return SUCCESS;
+}
+
+extern "C" error_t iotxml_sendResult(int commandId, result_code_e result) {
+  pthread_mutex_lock(&sentMutex);
+  if(totalSent < TEST_MAX_RESULTS) {
+    sent[totalSent].commandId = commandId;
+    sent[totalSent].result = result;
+    totalSent++;
+  }
+  pthread_mutex_unlock(&sentMutex);
+  return SUCCESS;
+}
+
+extern "C" void iottrace_mark(int commandId, iottrace_stage_e stage, int arg) {
+}
+
+/***************** Handlers ****************/
+static result_code_e pingHandler(command_t *cmd, int timeout_sec) {
+  int device = atoi(cmd->deviceId);
+
+  if(__sync_add_and_fetch(&running[device], 1) > 1) {
+    overlapped = true;
+  }
+  usleep(2000);
+  __sync_sub_and_fetch(&running[device], 1);
+  return IOT_RESULT_EXECUTED;
+}
+
+static result_code_e slowHandler(command_t *cmd, int timeout_sec) {
+  lastTimeout = timeout_sec;
+  usleep(1500000);
+  return IOT_RESULT_EXECUTED;
+}
+
+static void batchHandler(command_t *cmds, result_code_e *results, int total, int timeout_sec) {
+  int i;
+
+  pthread_mutex_lock(&sentMutex);
+  for(i = 0; i < total; i++) {
+    snprintf(batches + strlen(batches), sizeof(batches) - strlen(batches), "%d%s", cmds[i].commandId, i < total - 1 ? "," : "|");
+    results[i] = IOT_RESULT_EXECUTED;
+  }
+  pthread_mutex_unlock(&sentMutex);
+}
+
+/***************** Helpers ****************/
+static void reset() {
+  pthread_mutex_lock(&sentMutex);
+  totalSent = 0;
+  batches[0] = '\0';
+  overlapped = false;
+  pthread_mutex_unlock(&sentMutex);
+}
+
+/**
+ * Hand a command to the executor the way the parser would
+ */
+static void receive(int commandId, const char *deviceId, const char *type, bool noMoreCommands) {
+  command_t cmd;
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.commandId = commandId;
+  cmd.noMoreCommands = noMoreCommands;
+  snprintf(cmd.deviceId, sizeof(cmd.deviceId), "%s", deviceId);
+  snprintf(cmd.commandType, sizeof(cmd.commandType), "%s", type);
+  snprintf(cmd.commandName, sizeof(cmd.commandName), "name");
+  cmd.argument = "1";
+  cmd.argSize = 1;
+  listener(&cmd);
+}
+
+/**
+ * @return true if the given number of results was sent within timeout_ms
+ */
+static bool waitForResults(int total, int timeout_ms) {
+  int count;
+
+  for(; timeout_ms > 0; timeout_ms -= 10) {
+    pthread_mutex_lock(&sentMutex);
+    count = totalSent;
+    pthread_mutex_unlock(&sentMutex);
+
+    if(count >= total) {
+      return true;
+    }
+    usleep(10000);
+  }
+
+  return false;
+}
+
+/**
+ * @return the position of the result in the order results were sent, -1 if it wasn't
+ */
+static int positionOf(int commandId, bool final) {
+  int i;
+
+  for(i = 0; i < totalSent; i++) {
+    if(sent[i].commandId == commandId && (sent[i].result != IOT_RESULT_RECEIVED) == final) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+static long elapsedMs(const struct timespec *start) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/***************** Tests ****************/
+void CommandExecutorTest::testAckBeforeResult(void) {
+  int i;
+
+  reset();
+  CPPUNIT_ASSERT_MESSAGE("Couldn't add a handler", commandexecutor_addHandler(pingHandler, "ping", 10) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Couldn't start the workers", commandexecutor_start(4) == SUCCESS);
+
+  for(i = 1; i <= 10; i++) {
+    receive(i, "0", "ping", false);
+  }
+
+  CPPUNIT_ASSERT_MESSAGE("Results didn't arrive", waitForResults(20, 5000));
+  commandexecutor_stop();
+
+  for(i = 1; i <= 10; i++) {
+    CPPUNIT_ASSERT_MESSAGE("Command wasn't acknowledged", positionOf(i, false) >= 0);
+    CPPUNIT_ASSERT_MESSAGE("Result came before the acknowledgement", positionOf(i, false) < positionOf(i, true));
+    CPPUNIT_ASSERT_MESSAGE("Command failed", sent[positionOf(i, true)].result == IOT_RESULT_EXECUTED);
+    if(i > 1) {
+      CPPUNIT_ASSERT_MESSAGE("Commands for one device ran out of order", positionOf(i - 1, true) < positionOf(i, true));
+    }
+  }
+
+  CPPUNIT_ASSERT_MESSAGE("Commands for one device ran at once", !overlapped);
+}
+
+void CommandExecutorTest::testManyDevices(void) {
+  char deviceId[EUI64_STRING_SIZE];
+  int i;
+
+  reset();
+  commandexecutor_addHandler(pingHandler, "ping", 10);
+  commandexecutor_start(4);
+
+  // Every device gets its own queue, so none of them is turned away
+  for(i = 0; i < TEST_DEVICES * 2; i++) {
+    snprintf(deviceId, sizeof(deviceId), "%d", i % TEST_DEVICES);
+    receive(1000 + i, deviceId, "ping", false);
+  }
+
+  CPPUNIT_ASSERT_MESSAGE("Results didn't arrive", waitForResults(TEST_DEVICES * 4, 10000));
+  commandexecutor_stop();
+
+  for(i = 0; i < TEST_DEVICES * 2; i++) {
+    CPPUNIT_ASSERT_MESSAGE("Command wasn't executed", positionOf(1000 + i, true) >= 0 && sent[positionOf(1000 + i, true)].result == IOT_RESULT_EXECUTED);
+  }
+
+  CPPUNIT_ASSERT_MESSAGE("Commands for one device ran at once", !overlapped);
+}
+
+void CommandExecutorTest::testDeadline(void) {
+  reset();
+  commandexecutor_addHandler(slowHandler, "slow", 1);
+  commandexecutor_start(2);
+
+  // The second command waits behind the first past its deadline
+  receive(100, "1", "slow", false);
+  receive(101, "1", "slow", false);
+
+  CPPUNIT_ASSERT_MESSAGE("Results didn't arrive", waitForResults(4, 5000));
+  commandexecutor_stop();
+
+  CPPUNIT_ASSERT_MESSAGE("First command failed", sent[positionOf(100, true)].result == IOT_RESULT_EXECUTED);
+  CPPUNIT_ASSERT_MESSAGE("Handler wasn't bounded by the deadline", lastTimeout == 1);
+  CPPUNIT_ASSERT_MESSAGE("Expired command wasn't failed", sent[positionOf(101, true)].result == IOT_RESULT_HUBERROR);
+}
+
+void CommandExecutorTest::testSealing(void) {
+  struct timespec start;
+
+  reset();
+  commandexecutor_addBatchHandler(batchHandler, "set", 10);
+  commandexecutor_start(2);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // The end of the message hands each device's commands over together,
+  // without waiting out the batch window
+  receive(200, "2", "set", false);
+  receive(201, "3", "set", false);
+  receive(202, "2", "set", false);
+  receive(-1, "", "set", true);
+
+  CPPUNIT_ASSERT_MESSAGE("Results didn't arrive", waitForResults(6, 5000));
+  CPPUNIT_ASSERT_MESSAGE("Sealed batch waited for the window", elapsedMs(&start) < COMMANDEXECUTOR_BATCH_WINDOW_MS);
+  commandexecutor_stop();
+
+  CPPUNIT_ASSERT_MESSAGE("Commands for one device weren't batched", strstr(batches, "200,202|") != NULL);
+  CPPUNIT_ASSERT_MESSAGE("Commands for another device were batched in", strstr(batches, "201|") != NULL);
+  CPPUNIT_ASSERT_MESSAGE("Batched command wasn't executed", sent[positionOf(202, true)].result == IOT_RESULT_EXECUTED);
+}
+
+void CommandExecutorTest::testBatchWindow(void) {
+  struct timespec start;
+  bool waited;
+
+  reset();
+  commandexecutor_addBatchHandler(batchHandler, "set", 10);
+  commandexecutor_start(2);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // Without the end of the message, commands wait out the batch window
+  receive(300, "4", "set", false);
+  receive(301, "4", "set", false);
+  usleep(COMMANDEXECUTOR_BATCH_WINDOW_MS * 1000 / 4);
+
+  pthread_mutex_lock(&sentMutex);
+  waited = (batches[0] == '\0');
+  pthread_mutex_unlock(&sentMutex);
+  CPPUNIT_ASSERT_MESSAGE("Batch didn't wait for more commands", waited);
+
+  CPPUNIT_ASSERT_MESSAGE("Results didn't arrive", waitForResults(4, 5000));
+  CPPUNIT_ASSERT_MESSAGE("Batch left before the window closed", elapsedMs(&start) >= COMMANDEXECUTOR_BATCH_WINDOW_MS);
+  commandexecutor_stop();
+
+  CPPUNIT_ASSERT_MESSAGE("Commands weren't batched", strcmp(batches, "300,301|") == 0);
+}
+
+void CommandExecutorTest::testBatchLimit(void) {
+  char expected[256] = "";
+  int i;
+
+  reset();
+  commandexecutor_addBatchHandler(batchHandler, "set", 10);
+  commandexecutor_addHandler(pingHandler, "ping", 10);
+  commandexecutor_start(1);
+
+  // A long message is handed over COMMANDEXECUTOR_MAX_BATCH commands at a
+  // time, and a command for another handler ends the batch in front of it
+  for(i = 0; i < COMMANDEXECUTOR_MAX_BATCH + 2; i++) {
+    receive(400 + i, "5", "set", false);
+    snprintf(expected + strlen(expected), sizeof(expected) - strlen(expected), "%d%s", 400 + i,
+        (i == COMMANDEXECUTOR_MAX_BATCH - 1 || i == COMMANDEXECUTOR_MAX_BATCH + 1) ? "|" : ",");
+  }
+  receive(500, "5", "ping", false);
+  receive(501, "5", "set", false);
+  receive(-1, "", "set", true);
+  strcat(expected, "501|");
+
+  CPPUNIT_ASSERT_MESSAGE("Results didn't arrive", waitForResults((COMMANDEXECUTOR_MAX_BATCH + 4) * 2, 5000));
+  commandexecutor_stop();
+
+  CPPUNIT_ASSERT_MESSAGE("Commands were batched wrong", strcmp(batches, expected) == 0);
+  CPPUNIT_ASSERT_MESSAGE("Command between batches ran out of order", positionOf(500, true) > positionOf(400 + COMMANDEXECUTOR_MAX_BATCH + 1, true) && positionOf(500, true) < positionOf(501, true));
+}
@@ -0,0 +1,612 @@
+/*
+ *  Copyright 2013 People Power Company
+ *
+ *  This code was developed with funding from People Power Company
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * Long-lived SSDP discovery service.
+ *
+ * One UDP socket stays joined to the SSDP multicast group for the life of
+ * the agent, and a background thread listens on it for answers to our
+ * searches as well as unsolicited NOTIFY announcements. Active searches
+ * are rate limited. Every responder is cached by IP address, and the
+ * application's handler is only called to fetch a responder's details when
+ * it is new, moves to a new Location, or its cache entry expires.
+ */
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ioterror.h"
+#include "iotdebug.h"
+#include "ssdpdiscovery.h"
+
+/** A responder we've heard from */
+typedef struct ssdpresponder_t {
+
+  char ip[INET6_ADDRSTRLEN];
+
+  /** Location the responder announced last */
+  char location[SSDPDISCOVERY_LOCATION_SIZE];
+
+  /** Seconds the responder said its announcement is good for */
+  int ttl;
+
+  /** When we stop trusting what we know about this responder */
+  time_t expires;
+
+  /** Last time we heard from this responder */
+  time_t lastSeen;
+
+  /** True if the handler accepted this responder */
+  bool accepted;
+
+  /** True while the responder waits for the handler, or is in it */
+  bool pending;
+
+  bool inUse;
+
+} ssdpresponder_t;
+
+/** Responders we've heard from, grown as more of them show up */
+static ssdpresponder_t *cache;
+
+/** Number of entries allocated in the cache */
+static int cacheSize;
+
+/** Search message to multicast */
+static char searchMsg[SSDPDISCOVERY_MAX_MSG_SIZE];
+
+/** Service type our devices announce in their NT, ST or USN headers */
+static char target[SSDPDISCOVERY_TARGET_SIZE];
+
+/** Handler for new responders */
+static ssdphandler_f handler;
+
+/** Socket joined to the SSDP multicast group */
+static int sock = -1;
+
+/** Multicast membership, to drop it when we stop */
+static struct ip_mreq mcReq;
+
+/** True when somebody asked for an active search */
+static bool searchRequested;
+
+/** Last time we sent an active search */
+static time_t lastSearchTime;
+
+/** Discovery thread, which drains the socket */
+static pthread_t sThreadId;
+
+/** Fetch thread, which hands new responders to the handler */
+static pthread_t sFetchThreadId;
+
+/** Thread termination flag */
+static volatile bool gTerminate;
+
+/** Mutex to protect the cache and the search request */
+static pthread_mutex_t sSsdpMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Signaled when a responder is waiting for the handler, or when we stop */
+static pthread_cond_t sSsdpCond = PTHREAD_COND_INITIALIZER;
+
+/***************** Private Prototypes ***************/
+static int _ssdpdiscovery_open();
+
+static void *_ssdpdiscovery_thread(void *params);
+
+static void _ssdpdiscovery_sendSearch();
+
+static void *_ssdpdiscovery_fetchThread(void *params);
+
+static bool _ssdpdiscovery_isTarget(const char *msg);
+
+static void _ssdpdiscovery_process(char *msg, const struct sockaddr_in *from);
+
+static int _ssdpdiscovery_find(const char *ip);
+
+static int _ssdpdiscovery_allocate(const char *ip, time_t now);
+
+/***************** Public Functions ***************/
+/**
+ * Open the discovery socket and start listening in the background.  The
+ * first search goes out right away.
+ *
+ * @param search Search message to multicast, i.e. an M-SEARCH request
+ * @param type Service type our devices announce, packets that don't carry
+ *     it in an NT, ST, USN or services header are dropped
+ * @param h Handler to call for new responders
+ * @return SUCCESS if the discovery service is running
+ */
+error_t ssdpdiscovery_start(const char *search, const char *type, ssdphandler_f h) {
+  if(sock >= 0) {
+    return SUCCESS;
+  }
+
+  strncpy(searchMsg, search, sizeof(searchMsg) - 1);
+  strncpy(target, type, sizeof(target) - 1);
+  handler = h;
+
+  if((sock = _ssdpdiscovery_open()) < 0) {
+    return FAIL;
+  }
+
+  gTerminate = false;
+  searchRequested = true;
+  lastSearchTime = 0;
+
+  if(pthread_create(&sFetchThreadId, NULL, &_ssdpdiscovery_fetchThread, NULL)) {
+    SYSLOG_ERR("[ssdp] Creating fetch thread failed: %s", strerror(errno));
+    setsockopt(sock, IPPROTO_IP, IP_DROP_MEMBERSHIP, (void *) &mcReq, sizeof(mcReq));
+    close(sock);
+    sock = -1;
+    return FAIL;
+  }
+
+  if(pthread_create(&sThreadId, NULL, &_ssdpdiscovery_thread, NULL)) {
+    SYSLOG_ERR("[ssdp] Creating discovery thread failed: %s", strerror(errno));
+    pthread_mutex_lock(&sSsdpMutex);
+    gTerminate = true;
+    pthread_cond_broadcast(&sSsdpCond);
+    pthread_mutex_unlock(&sSsdpMutex);
+    pthread_join(sFetchThreadId, NULL);
+
+    setsockopt(sock, IPPROTO_IP, IP_DROP_MEMBERSHIP, (void *) &mcReq, sizeof(mcReq));
+    close(sock);
+    sock = -1;
+    return FAIL;
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * Stop listening and close the discovery socket.  Waits for a handler that
+ * is still fetching a device's details.
+ */
+void ssdpdiscovery_stop() {
+  if(sock < 0) {
+    return;
+  }
+
+  pthread_mutex_lock(&sSsdpMutex);
+  gTerminate = true;
+  pthread_cond_broadcast(&sSsdpCond);
+  pthread_mutex_unlock(&sSsdpMutex);
+
+  pthread_join(sThreadId, NULL);
+  pthread_join(sFetchThreadId, NULL);
+
+  if(setsockopt(sock, IPPROTO_IP, IP_DROP_MEMBERSHIP, (void *) &mcReq, sizeof(mcReq)) < 0) {
+    SYSLOG_ERR("[ssdp] %s, setsockopt() failed", strerror(errno));
+  }
+
+  close(sock);
+  sock = -1;
+
+  free(cache);
+  cache = NULL;
+  cacheSize = 0;
+}
+
+/**
+ * Ask for an active search.  The search goes out from the discovery thread,
+ * no more often than every SSDPDISCOVERY_MIN_SEARCH_PERIOD_SEC, so it's fine
+ * to call this as often as you like.
+ */
+void ssdpdiscovery_search() {
+  pthread_mutex_lock(&sSsdpMutex);
+  searchRequested = true;
+  pthread_mutex_unlock(&sSsdpMutex);
+}
+
+/**
+ * Forget what we know about a responder, so the handler gets called for it
+ * again the next time we hear from it.  Useful when the application gives up
+ * on a device.
+ *
+ * @param ip IP address of the responder
+ */
+void ssdpdiscovery_forget(const char *ip) {
+  int i;
+
+  pthread_mutex_lock(&sSsdpMutex);
+  if((i = _ssdpdiscovery_find(ip)) >= 0) {
+    cache[i].inUse = false;
+  }
+  pthread_mutex_unlock(&sSsdpMutex);
+}
+
+/***************** Private Functions ****************/
+/**
+ * Open a socket joined to the SSDP multicast group
+ * @return the socket, or -1 if it couldn't be opened
+ */
+static int _ssdpdiscovery_open() {
+  struct sockaddr_in addr;
+  int one = 1;
+  int ttl = 3;
+  int fd;
+
+  if((fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+    SYSLOG_ERR("[ssdp] Cannot open socket: %s", strerror(errno));
+    return -1;
+  }
+
+  if(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char *) &one, sizeof(one)) < 0) {
+    SYSLOG_ERR("[ssdp] Cannot prepare socket for reusing");
+    close(fd);
+    return -1;
+  }
+
+  if(fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+    SYSLOG_ERR("[ssdp] fcntl(sock), %s", strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  if(setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, (void *) &ttl, sizeof(ttl)) < 0) {
+    SYSLOG_ERR("[ssdp] Cannot set ttl to the socket");
+    close(fd);
+    return -1;
+  }
+
+  // Bind to the SSDP port so we hear NOTIFY announcements. If somebody
+  // else on this machine won't share it, we can still hear the answers to
+  // our own searches on any port.
+  bzero(&addr, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(SSDPDISCOVERY_PORT);
+
+  if(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+    SYSLOG_INFO("[ssdp] Cannot bind the SSDP port, only listening for search responses");
+    addr.sin_port = htons(0);
+    if(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+      SYSLOG_ERR("[ssdp] Cannot bind port: %s", strerror(errno));
+      close(fd);
+      return -1;
+    }
+  }
+
+  mcReq.imr_multiaddr.s_addr = inet_addr(SSDPDISCOVERY_ADDR);
+  mcReq.imr_interface.s_addr = htonl(INADDR_ANY);
+
+  if(setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, (void *) &mcReq, sizeof(mcReq)) < 0) {
+    SYSLOG_ERR("[ssdp] %s, setsockopt() failed", strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/**
+ * Discovery thread
+ */
+static void *_ssdpdiscovery_thread(void *params) {
+  char buffer[SSDPDISCOVERY_MAX_MSG_SIZE];
+  struct sockaddr_in from;
+  socklen_t fromLen;
+  struct timeval tv;
+  fd_set readFds;
+  bool search;
+  int ret;
+
+  while(!gTerminate) {
+    pthread_mutex_lock(&sSsdpMutex);
+    search = searchRequested && (time(NULL) - lastSearchTime >= SSDPDISCOVERY_MIN_SEARCH_PERIOD_SEC);
+    if(search) {
+      searchRequested = false;
+      lastSearchTime = time(NULL);
+    }
+    pthread_mutex_unlock(&sSsdpMutex);
+
+    if(search) {
+      _ssdpdiscovery_sendSearch();
+    }
+
+    FD_ZERO(&readFds);
+    FD_SET(sock, &readFds);
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+
+    if(select(sock + 1, &readFds, NULL, NULL, &tv) <= 0) {
+      continue;
+    }
+
+    while(!gTerminate) {
+      fromLen = sizeof(from);
+      ret = recvfrom(sock, buffer, sizeof(buffer) - 1, 0, (struct sockaddr *) &from, &fromLen);
+      if(ret <= 0) {
+        break;
+      }
+
+      buffer[ret] = '\0';
+      _ssdpdiscovery_process(buffer, &from);
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Multicast the search message
+ */
+static void _ssdpdiscovery_sendSearch() {
+  struct sockaddr_in destaddr;
+
+  bzero(&destaddr, sizeof(destaddr));
+  destaddr.sin_family = AF_INET;
+  destaddr.sin_addr.s_addr = inet_addr(SSDPDISCOVERY_ADDR);
+  destaddr.sin_port = htons(SSDPDISCOVERY_PORT);
+
+  SYSLOG_DEBUG("[ssdp] Sending search");
+  if(sendto(sock, searchMsg, strlen(searchMsg), 0, (struct sockaddr *) &destaddr, sizeof(destaddr)) < 0) {
+    SYSLOG_ERR("[ssdp] %s: Cannot send search", strerror(errno));
+  }
+}
+
+
+/**
+ * Fetch thread.  Hands the responders the discovery thread queued to the
+ * handler one at a time, so a slow device never holds up the socket.
+ */
+static void *_ssdpdiscovery_fetchThread(void *params) {
+  char ip[INET6_ADDRSTRLEN];
+  char location[SSDPDISCOVERY_LOCATION_SIZE];
+  error_t accepted;
+  int i;
+
+  pthread_mutex_lock(&sSsdpMutex);
+  while(!gTerminate) {
+    for(i = 0; i < cacheSize; i++) {
+      if(cache[i].inUse && cache[i].pending) {
+        break;
+      }
+    }
+
+    if(i == cacheSize) {
+      pthread_cond_wait(&sSsdpCond, &sSsdpMutex);
+      continue;
+    }
+
+    strcpy(ip, cache[i].ip);
+    strcpy(location, cache[i].location);
+    pthread_mutex_unlock(&sSsdpMutex);
+
+    SYSLOG_INFO("[ssdp] Found %s at %s", ip, location);
+    accepted = handler(ip, location);
+
+    pthread_mutex_lock(&sSsdpMutex);
+    // If the responder moved while we were fetching, it stays pending and
+    // goes around again with its new Location
+    if((i = _ssdpdiscovery_find(ip)) >= 0 && strcmp(cache[i].location, location) == 0) {
+      cache[i].pending = false;
+      cache[i].accepted = (accepted == SUCCESS);
+      cache[i].expires = time(NULL) + (cache[i].accepted ? cache[i].ttl : SSDPDISCOVERY_RETRY_SEC);
+    }
+  }
+  pthread_mutex_unlock(&sSsdpMutex);
+
+  return NULL;
+}
+
+/**
+ * Look for our service type in the NT, ST, USN or services headers, without
+ * touching the packet
+ *
+ * @param msg Null-terminated packet
+ * @return true if the packet came from one of our devices
+ */
+static bool _ssdpdiscovery_isTarget(const char *msg) {
+  static const char *headers[] = { "NT:", "ST:", "USN:", "services:" };
+  size_t targetLen = strlen(target);
+  const char *line;
+  const char *end;
+  const char *ptr;
+  int i;
+
+  if(targetLen == 0) {
+    return true;
+  }
+
+  for(line = msg; *line != '\0'; line = end + strspn(end, "\r\n")) {
+    end = line + strcspn(line, "\r\n");
+
+    for(i = 0; i < sizeof(headers) / sizeof(headers[0]); i++) {
+      if(strncasecmp(line, headers[i], strlen(headers[i])) != 0) {
+        continue;
+      }
+
+      for(ptr = line + strlen(headers[i]); ptr + targetLen <= end; ptr++) {
+        if(strncmp(ptr, target, targetLen) == 0) {
+          return true;
+        }
+      }
+    }
+  }
+
+  return false;
+}
+
+/**
+ * Handle one SSDP packet, which is either a response to a search, a NOTIFY
+ * announcement, or something we don't care about like somebody else's search.
+ * Responders that are new or have moved get queued for the fetch thread.
+ *
+ * @param msg Null-terminated packet, modified in place
+ * @param from Sender of the packet
+ */
+static void _ssdpdiscovery_process(char *msg, const struct sockaddr_in *from) {
+  char ip[INET6_ADDRSTRLEN];
+  char location[SSDPDISCOVERY_LOCATION_SIZE];
+  int ttl = SSDPDISCOVERY_DEFAULT_TTL_SEC;
+  bool byebye = false;
+  time_t now = time(NULL);
+  char *line;
+  char *save;
+  char *ptr;
+  char *ptr2;
+  int i;
+
+  if(strncasecmp(msg, "M-SEARCH", strlen("M-SEARCH")) == 0 || strcmp(msg, searchMsg) == 0) {
+    return;
+  }
+
+  if(!_ssdpdiscovery_isTarget(msg)) {
+    return;
+  }
+
+  location[0] = '\0';
+  for(line = strtok_r(msg, "\r\n", &save); line != NULL; line = strtok_r(NULL, "\r\n", &save)) {
+    if(strncasecmp(line, "Location:", strlen("Location:")) == 0) {
+      ptr = line + strlen("Location:");
+      while(*ptr == ' ') {
+        ptr++;
+      }
+      strncpy(location, ptr, sizeof(location) - 1);
+      location[sizeof(location) - 1] = '\0';
+
+    } else if(strncasecmp(line, "NTS:", strlen("NTS:")) == 0) {
+      byebye = (strstr(line, "byebye") != NULL);
+
+    } else if(strncasecmp(line, "CACHE-CONTROL:", strlen("CACHE-CONTROL:")) == 0) {
+      for(ptr = line; *ptr != '\0'; ptr++) {
+        if(strncasecmp(ptr, "max-age=", strlen("max-age=")) == 0) {
+          ttl = atoi(ptr + strlen("max-age="));
+          break;
+        }
+      }
+    }
+  }
+
+  // The device's address comes from the Location URL, or else the sender
+  ip[0] = '\0';
+  if((ptr = strstr(location, "://")) != NULL) {
+    ptr += 3;
+    if((ptr2 = strchr(ptr, '/')) == NULL) {
+      ptr2 = ptr + strlen(ptr);
+    }
+    if(ptr2 - ptr < sizeof(ip)) {
+      strncpy(ip, ptr, ptr2 - ptr);
+      ip[ptr2 - ptr] = '\0';
+    }
+  }
+
+  if(ip[0] == '\0') {
+    inet_ntop(AF_INET, &from->sin_addr, ip, sizeof(ip));
+  }
+
+  if(byebye) {
+    SYSLOG_DEBUG("[ssdp] %s is leaving", ip);
+    ssdpdiscovery_forget(ip);
+    return;
+  }
+
+  if(location[0] == '\0') {
+    return;
+  }
+
+  if(ttl <= 0) {
+    ttl = SSDPDISCOVERY_DEFAULT_TTL_SEC;
+  }
+
+  pthread_mutex_lock(&sSsdpMutex);
+  if((i = _ssdpdiscovery_allocate(ip, now)) >= 0) {
+    cache[i].lastSeen = now;
+    cache[i].ttl = ttl;
+
+    if(strcmp(cache[i].location, location) != 0 || (!cache[i].pending && now >= cache[i].expires)) {
+      strncpy(cache[i].location, location, sizeof(cache[i].location) - 1);
+      cache[i].pending = true;
+      pthread_cond_signal(&sSsdpCond);
+    }
+  }
+  pthread_mutex_unlock(&sSsdpMutex);
+}
+
+/**
+ * Call with the mutex held
+ * @return the cache index for the IP address, or -1
+ */
+static int _ssdpdiscovery_find(const char *ip) {
+  int i;
+
+  for(i = 0; i < cacheSize; i++) {
+    if(cache[i].inUse && strcmp(cache[i].ip, ip) == 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * Call with the mutex held.  A responder whose entry has expired would be
+ * handed to the handler again anyway, so its entry may be reused.  When
+ * there's none, the cache doubles.
+ *
+ * @param ip IP address of the responder
+ * @param now Current time
+ * @return the cache index for the IP address, creating it if needed, or -1
+ *     if we're out of memory
+ */
+static int _ssdpdiscovery_allocate(const char *ip, time_t now) {
+  ssdpresponder_t *grown;
+  int total;
+  int i;
+
+  if((i = _ssdpdiscovery_find(ip)) >= 0) {
+    return i;
+  }
+
+  for(i = 0; i < cacheSize; i++) {
+    if(!cache[i].inUse || (!cache[i].pending && now >= cache[i].expires)) {
+      break;
+    }
+  }
+
+  if(i == cacheSize) {
+    total = cacheSize > 0 ? cacheSize * 2 : SSDPDISCOVERY_INITIAL_DEVICES;
+    if((grown = realloc(cache, sizeof(ssdpresponder_t) * total)) == NULL) {
+      SYSLOG_ERR("[ssdp] No memory to remember %d responders", total);
+      return -1;
+    }
+
+    bzero(&grown[cacheSize], sizeof(ssdpresponder_t) * (total - cacheSize));
+    cache = grown;
+    cacheSize = total;
+  }
+
+  bzero(&cache[i], sizeof(cache[i]));
+  cache[i].inUse = true;
+  strncpy(cache[i].ip, ip, sizeof(cache[i].ip) - 1);
+  return i;
+}
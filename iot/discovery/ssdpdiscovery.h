@@ -0,0 +1,92 @@
+/*
+ *  Copyright 2013 People Power Company
+ *
+ *  This code was developed with funding from People Power Company
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef SSDPDISCOVERY_H
+#define SSDPDISCOVERY_H
+
+#include <netinet/in.h>
+#include "ioterror.h"
+
+#define SSDPDISCOVERY_ADDR "239.255.255.250"
+
+#define SSDPDISCOVERY_PORT 1900
+
+/**
+ * Number of responders the cache has room for at first.  It doubles whenever
+ * it fills up with responders we still trust.
+ */
+#ifndef SSDPDISCOVERY_INITIAL_DEVICES
+#define SSDPDISCOVERY_INITIAL_DEVICES 32
+#endif
+
+/** Maximum size of an SSDP packet */
+#ifndef SSDPDISCOVERY_MAX_MSG_SIZE
+#define SSDPDISCOVERY_MAX_MSG_SIZE 1024
+#endif
+
+/** Maximum size of the service type our devices announce */
+#ifndef SSDPDISCOVERY_TARGET_SIZE
+#define SSDPDISCOVERY_TARGET_SIZE 64
+#endif
+
+/** Maximum size of a Location URL */
+#ifndef SSDPDISCOVERY_LOCATION_SIZE
+#define SSDPDISCOVERY_LOCATION_SIZE 128
+#endif
+
+/** Minimum number of seconds between two active searches */
+#ifndef SSDPDISCOVERY_MIN_SEARCH_PERIOD_SEC
+#define SSDPDISCOVERY_MIN_SEARCH_PERIOD_SEC 30
+#endif
+
+/**
+ * Seconds we trust a device's identity when it doesn't announce a
+ * CACHE-CONTROL max-age
+ */
+#ifndef SSDPDISCOVERY_DEFAULT_TTL_SEC
+#define SSDPDISCOVERY_DEFAULT_TTL_SEC 1800
+#endif
+
+/** Seconds before we retry a responder the handler rejected */
+#ifndef SSDPDISCOVERY_RETRY_SEC
+#define SSDPDISCOVERY_RETRY_SEC 300
+#endif
+
+/**
+ * Handler called on the fetch thread for a responder that is new, has moved
+ * to a new Location, or whose cached identity has expired.  It's free to
+ * block while it fetches the device's details, the discovery thread keeps
+ * draining the socket meanwhile.
+ *
+ *   error_t newDevice(const char *ip, const char *location)
+ *
+ * Return SUCCESS if the responder is one of our devices.  Responders the
+ * handler rejects aren't handed over again for SSDPDISCOVERY_RETRY_SEC.
+ */
+typedef error_t (*ssdphandler_f)(const char *, const char *);
+
+/***************** Public Prototypes ****************/
+error_t ssdpdiscovery_start(const char *searchMsg, const char *target, ssdphandler_f handler);
+
+void ssdpdiscovery_stop();
+
+void ssdpdiscovery_search();
+
+void ssdpdiscovery_forget(const char *ip);
+
+#endif
@@ -47,14 +47,28 @@
  * @return SUCCESS if we are able to capture the EUI64
  */
 error_t eui64_toBytes(uint8_t *dest, int destLen) {
-  struct ifreq *ifr;
-  struct ifconf ifc;
-  char buf[1024];
-  int sock, i;
-  int ok = 0;
+  return eui64_toBytesFrom(dest, destLen, EUI64_DEFAULT_INTERFACES, NULL, 0);
+}
 
+/**
+ * Obtain the MAC address of the first interface in the list that exists
+ *
+ * @param dest Buffer of at least 8 bytes
+ * @param destLen Length of the buffer
+ * @param interfaces Comma-separated interface names, in order of preference
+ * @param ifname Buffer for the name of the interface used, or NULL
+ * @param ifnameSize Size of the ifname buffer
+ * @return SUCCESS if we are able to capture the EUI64
+ */
+error_t eui64_toBytesFrom(uint8_t *dest, int destLen, const char *interfaces, char *ifname, int ifnameSize) {
+  struct ifreq ifr;
+  const char *name;
+  int nameLen;
+  int sock;
+  int ok = 0;
 
   assert(dest);
+  assert(interfaces);
 
   if(destLen < EUI64_BYTES_SIZE) {
     return FAIL;
@@ -67,35 +81,34 @@ error_t eui64_toBytes(uint8_t *dest, int destLen) {
     return -1;
   }
 
-  ifc.ifc_len = sizeof(buf);
-  ifc.ifc_buf = buf;
-  ioctl(sock, SIOCGIFCONF, &ifc);
-
-  ifr = ifc.ifc_req;
-  for (i = 0; i < ifc.ifc_len / sizeof(struct ifreq); ifr++) {
-      if (strcmp(ifr->ifr_name, "eth0") == 0 || strcmp(ifr->ifr_name, "eth1")
-	      == 0 || strcmp(ifr->ifr_name, "wlan0") == 0 || strcmp(ifr->ifr_name,
-		  "br0") == 0) {
-	  if (ioctl(sock, SIOCGIFFLAGS, ifr) == 0) {
-	      if (!(ifr->ifr_flags & IFF_LOOPBACK)) {
-		  if (ioctl(sock, SIOCGIFHWADDR, ifr) == 0) {
-		      ok = 1;
-		      break;
-		  }
-	      }
-	  }
+  for (name = interfaces; *name && !ok; name += nameLen + (name[nameLen] == ',')) {
+    nameLen = strcspn(name, ",");
+    if (nameLen == 0 || nameLen >= IFNAMSIZ) {
+      continue;
+    }
+
+    memset(&ifr, 0x0, sizeof(ifr));
+    memcpy(ifr.ifr_name, name, nameLen);
+
+    if (ioctl(sock, SIOCGIFFLAGS, &ifr) == 0 && !(ifr.ifr_flags & IFF_LOOPBACK)) {
+      if (ioctl(sock, SIOCGIFHWADDR, &ifr) == 0) {
+        ok = 1;
       }
+    }
   }
 
   close(sock);
   if (ok) {
     /* Convert 48 bit MAC dest to EUI-64 */
-    memcpy(dest, ifr->ifr_hwaddr.sa_data, 6);
+    memcpy(dest, ifr.ifr_hwaddr.sa_data, 6);
     /* Insert the converting bits in the middle */
     /* dest[3] = 0xFF;
     dest[4] = 0xFE;
-    memcpy(&dest[5], &(ifr->ifr_hwaddr.sa_data[3]), 3);
+    memcpy(&dest[5], &(ifr.ifr_hwaddr.sa_data[3]), 3);
     */
+    if (ifname != NULL && ifnameSize > 0) {
+      snprintf(ifname, ifnameSize, "%s", ifr.ifr_name);
+    }
   } else {
     SYSLOG_ERR("Couldn't read MAC dest to seed EUI64");
     return FAIL;
@@ -108,12 +121,28 @@ error_t eui64_toBytes(uint8_t *dest, int destLen) {
  * Copy the EUI64 into a string
  * @return SUCCESS if we are able to capture the EUI64
  */
-extern char *argEui64Bytes;
 error_t eui64_toString(char *dest, int destLen) {
+  return eui64_toStringFrom(dest, destLen, EUI64_DEFAULT_INTERFACES, NULL, 0);
+}
+
+/**
+ * Copy the EUI64 of the first interface in the list that exists into a
+ * string. This reads the NIC and the configuration file every time, use
+ * hubid_get(..) for the cached copy.
+ *
+ * @param dest Buffer of at least EUI64_STRING_SIZE bytes
+ * @param destLen Length of the buffer
+ * @param interfaces Comma-separated interface names, in order of preference
+ * @param ifname Buffer for the name of the interface used, or NULL
+ * @param ifnameSize Size of the ifname buffer
+ * @return SUCCESS if we are able to capture the EUI64
+ */
+extern char *argEui64Bytes;
+error_t eui64_toStringFrom(char *dest, int destLen, const char *interfaces, char *ifname, int ifnameSize) {
   uint8_t byteAddress[EUI64_BYTES_SIZE], i;
   uint16_t checksum= 0;
   char deviceType[DEVICE_TYPE_SIZE];
-  char *tmp = NULL;
+  int len;
   extern char* argDeviceType;
 
   assert(dest);
@@ -123,7 +152,7 @@ error_t eui64_toString(char *dest, int destLen) {
   }
 
   /* new format: ${MAC_ADDRESS}-${PRODUCT_ID}-${CHECKSUM} */
-  if (eui64_toBytes(byteAddress, sizeof(byteAddress)) == SUCCESS) {
+  if (eui64_toBytesFrom(byteAddress, sizeof(byteAddress), interfaces, ifname, ifnameSize) == SUCCESS) {
 
     memset(deviceType, 0x0, DEVICE_TYPE_SIZE);
     readDeviceType(deviceType);
@@ -146,18 +175,12 @@ error_t eui64_toString(char *dest, int destLen) {
 		byteAddress[4], byteAddress[5], deviceType);
     }
 
-    for(i = 0; i < strlen(dest) ; i++ ) {
+    len = strlen(dest);
+    for(i = 0; i < len ; i++ ) {
         checksum+= dest[i];
     }
 
-    tmp = strdup(dest);
-
-    if ( tmp != NULL )
-    {
-	snprintf(dest, destLen, "%s%X", tmp, checksum);
-	free(tmp);
-    }
-
+    snprintf(dest + len, destLen - len, "%X", checksum);
 
     return SUCCESS;
   }
@@ -48,11 +48,20 @@
 
 #define DEVICE_TYPE_SIZE 8
 
+/** Interfaces the EUI64 can come from, in order of preference */
+#ifndef EUI64_DEFAULT_INTERFACES
+#define EUI64_DEFAULT_INTERFACES "eth0,eth1,wlan0,br0"
+#endif
+
 /***************** Public Prototypes ****************/
 error_t eui64_toBytes(uint8_t *dest, int destLen);
 
+error_t eui64_toBytesFrom(uint8_t *dest, int destLen, const char *interfaces, char *ifname, int ifnameSize);
+
 error_t eui64_toString(char *dest, int destLen);
 
+error_t eui64_toStringFrom(char *dest, int destLen, const char *interfaces, char *ifname, int ifnameSize);
+
 error_t readDeviceType(char *deviceType);
 
 #endif
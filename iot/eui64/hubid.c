@@ -0,0 +1,290 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * The hub ID, computed once and kept in memory. Working it out takes a
+ * socket, a few ioctls and a read of the configuration file, and it almost
+ * never changes, so it's only computed again when the configuration changes
+ * or the kernel tells us the interface it came from has changed.
+ *
+ * Readers never take a lock: the ID is published with a sequence counter
+ * that is odd while it's being rewritten, and readers copy it again if the
+ * counter moved under them.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "hubid.h"
+#include "eui64.h"
+#include "ioterror.h"
+#include "iotdebug.h"
+
+/** The hub ID */
+static char sHubId[EUI64_STRING_SIZE];
+
+/** Even while sHubId is stable, odd while it's being written. 0 until the first write. */
+static volatile unsigned int sSequence = 0;
+
+/** Interfaces the hub ID can come from, in order of preference */
+static char sInterfaces[HUBID_INTERFACES_SIZE] = EUI64_DEFAULT_INTERFACES;
+
+/** Serializes writers */
+static pthread_mutex_t sHubIdMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Netlink socket for link events */
+static int sNetlinkFd = -1;
+
+/** Link monitor thread */
+static pthread_t sThreadId;
+
+/** Thread termination flag */
+static bool gTerminate;
+
+/***************** Private Prototypes ***************/
+static error_t _hubid_refresh();
+
+static void *_hubid_thread(void *params);
+
+static bool _hubid_isWatched(const char *ifname);
+
+/***************** Public Functions ***************/
+/**
+ * Compute the hub ID and start watching for link changes that could change it
+ * @return SUCCESS if the hub ID is known
+ */
+error_t hubid_start() {
+  struct sockaddr_nl addr;
+  error_t result;
+
+  result = _hubid_refresh();
+
+  if(sNetlinkFd >= 0) {
+    return result;
+  }
+
+  if((sNetlinkFd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE)) < 0) {
+    SYSLOG_WARNING("Can't watch for link changes: %s", strerror(errno));
+    return result;
+  }
+
+  memset(&addr, 0x0, sizeof(addr));
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = RTMGRP_LINK;
+
+  if(bind(sNetlinkFd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+    SYSLOG_WARNING("Can't watch for link changes: %s", strerror(errno));
+    close(sNetlinkFd);
+    sNetlinkFd = -1;
+    return result;
+  }
+
+  gTerminate = false;
+
+  if(pthread_create(&sThreadId, NULL, &_hubid_thread, NULL)) {
+    SYSLOG_ERR("Creating link monitor thread failed: %s", strerror(errno));
+    close(sNetlinkFd);
+    sNetlinkFd = -1;
+  }
+
+  return result;
+}
+
+/**
+ * Stop watching for link changes. The hub ID stays cached.
+ */
+void hubid_stop() {
+  if(sNetlinkFd < 0) {
+    return;
+  }
+
+  gTerminate = true;
+  pthread_join(sThreadId, NULL);
+
+  close(sNetlinkFd);
+  sNetlinkFd = -1;
+}
+
+/**
+ * Copy the hub ID. It's worked out on the first call if hubid_start()
+ * hasn't been called.
+ *
+ * @param dest Buffer of at least EUI64_STRING_SIZE bytes
+ * @param destLen Length of the buffer
+ * @return SUCCESS if the hub ID is known
+ */
+error_t hubid_get(char *dest, int destLen) {
+  unsigned int sequence;
+
+  if(destLen < EUI64_STRING_SIZE) {
+    return FAIL;
+  }
+
+  if(sSequence == 0 && _hubid_refresh() != SUCCESS) {
+    return FAIL;
+  }
+
+  do {
+    sequence = sSequence;
+    __sync_synchronize();
+    memcpy(dest, sHubId, EUI64_STRING_SIZE);
+    __sync_synchronize();
+  } while((sequence & 1) || sequence != sSequence);
+
+  return SUCCESS;
+}
+
+/**
+ * Set the interfaces the hub ID can come from and compute it again
+ * @param interfaces Comma-separated interface names in order of preference, i.e. "eth0,wlan0"
+ * @return SUCCESS if the hub ID is known
+ */
+error_t hubid_setInterfaces(const char *interfaces) {
+  if(interfaces == NULL || !interfaces[0]) {
+    interfaces = EUI64_DEFAULT_INTERFACES;
+  }
+
+  pthread_mutex_lock(&sHubIdMutex);
+  snprintf(sInterfaces, sizeof(sInterfaces), "%s", interfaces);
+  pthread_mutex_unlock(&sHubIdMutex);
+
+  return _hubid_refresh();
+}
+
+/**
+ * Compute the hub ID again, i.e. after the device type in the configuration
+ * file has changed
+ */
+void hubid_invalidate() {
+  _hubid_refresh();
+}
+
+/***************** Private Functions ***************/
+/**
+ * Compute the hub ID and publish it if it changed
+ * @return SUCCESS if the hub ID is known
+ */
+static error_t _hubid_refresh() {
+  char hubId[EUI64_STRING_SIZE];
+  char ifname[IFNAMSIZ];
+  error_t result;
+
+  pthread_mutex_lock(&sHubIdMutex);
+
+  result = eui64_toStringFrom(hubId, sizeof(hubId), sInterfaces, ifname, sizeof(ifname));
+
+  if(result == SUCCESS) {
+    if(sSequence == 0 || strcmp(hubId, sHubId) != 0) {
+      SYSLOG_INFO("Hub ID is %s, from %s", hubId, ifname);
+
+      sSequence++;
+      __sync_synchronize();
+      memcpy(sHubId, hubId, sizeof(sHubId));
+      __sync_synchronize();
+      sSequence++;
+    }
+  }
+
+  pthread_mutex_unlock(&sHubIdMutex);
+
+  return result;
+}
+
+/**
+ * Link monitor thread. Any change to the interface the hub ID came from, or
+ * to one we would rather use, makes us compute it again.
+ */
+static void *_hubid_thread(void *params) {
+  char buffer[4096];
+  struct nlmsghdr *msg;
+  struct ifinfomsg *info;
+  struct rtattr *attr;
+  struct timeval tv;
+  fd_set readFds;
+  bool refresh;
+  int attrLen;
+  int len;
+
+  while(!gTerminate) {
+    FD_ZERO(&readFds);
+    FD_SET(sNetlinkFd, &readFds);
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+
+    if(select(sNetlinkFd + 1, &readFds, NULL, NULL, &tv) <= 0) {
+      continue;
+    }
+
+    if((len = recv(sNetlinkFd, buffer, sizeof(buffer), 0)) <= 0) {
+      continue;
+    }
+
+    refresh = false;
+
+    for(msg = (struct nlmsghdr *) buffer; NLMSG_OK(msg, len); msg = NLMSG_NEXT(msg, len)) {
+      if(msg->nlmsg_type != RTM_NEWLINK && msg->nlmsg_type != RTM_DELLINK) {
+        continue;
+      }
+
+      info = (struct ifinfomsg *) NLMSG_DATA(msg);
+      attrLen = IFLA_PAYLOAD(msg);
+
+      for(attr = IFLA_RTA(info); RTA_OK(attr, attrLen); attr = RTA_NEXT(attr, attrLen)) {
+        if(attr->rta_type == IFLA_IFNAME && _hubid_isWatched((const char *) RTA_DATA(attr))) {
+          refresh = true;
+        }
+      }
+    }
+
+    if(refresh) {
+      _hubid_refresh();
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * @return true if the interface is in our list of interfaces
+ */
+static bool _hubid_isWatched(const char *ifname) {
+  const char *name;
+  int nameLen;
+  bool watched = false;
+
+  pthread_mutex_lock(&sHubIdMutex);
+
+  for(name = sInterfaces; *name && !watched; name += nameLen + (name[nameLen] == ',')) {
+    nameLen = strcspn(name, ",");
+    watched = (nameLen > 0 && strncmp(name, ifname, nameLen) == 0 && ifname[nameLen] == '\0');
+  }
+
+  pthread_mutex_unlock(&sHubIdMutex);
+
+  return watched;
+}
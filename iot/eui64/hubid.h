@@ -0,0 +1,41 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef HUBID_H
+#define HUBID_H
+
+#include "ioterror.h"
+#include "eui64.h"
+
+/** Maximum size of the list of interfaces, including the null */
+#ifndef HUBID_INTERFACES_SIZE
+#define HUBID_INTERFACES_SIZE 128
+#endif
+
+/***************** Public Prototypes ****************/
+error_t hubid_start();
+
+void hubid_stop();
+
+error_t hubid_get(char *dest, int destLen);
+
+error_t hubid_setInterfaces(const char *interfaces);
+
+void hubid_invalidate();
+
+#endif
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2011 People Power Company
+ * All rights reserved.
+ *
+ * This open source code was developed with funding from People Power Company
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the People Power Corporation nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * PEOPLE POWER CO. OR ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE
+ */
+
+
+#include <string.h>
+
+#include "cppunit/extensions/HelperMacros.h"
+
+#include "hubid_test.h"
+
+extern "C" {
+#include "iotdebug.h"
+#include "ioterror.h"
+#include "eui64.h"
+#include "hubid.h"
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION( HubIdTest );
+
+
+void HubIdTest::testMatchesEui64(void) {
+  char expected[EUI64_STRING_SIZE];
+  char address[EUI64_STRING_SIZE];
+
+  hubid_setInterfaces(EUI64_DEFAULT_INTERFACES);
+  CPPUNIT_ASSERT_MESSAGE("Didn't get an EUI64 string\n", eui64_toString(expected, sizeof(expected)) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Didn't get a hub ID\n", hubid_get(address, sizeof(address)) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Hub ID doesn't match the EUI64\n", strcmp(expected, address) == 0);
+
+  // A second read comes from the cache
+  memset(address, 0, sizeof(address));
+  CPPUNIT_ASSERT_MESSAGE("Didn't get the cached hub ID\n", hubid_get(address, sizeof(address)) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Cached hub ID doesn't match the EUI64\n", strcmp(expected, address) == 0);
+}
+
+void HubIdTest::testTooSmall(void) {
+  char address[EUI64_STRING_SIZE - 1];
+  CPPUNIT_ASSERT_MESSAGE("Hub ID copied into too small of a buffer\n", hubid_get(address, sizeof(address)) != SUCCESS);
+}
+
+void HubIdTest::testMissingInterfaces(void) {
+  char expected[EUI64_STRING_SIZE];
+  char address[EUI64_STRING_SIZE];
+
+  hubid_setInterfaces(EUI64_DEFAULT_INTERFACES);
+  CPPUNIT_ASSERT_MESSAGE("Didn't get a hub ID\n", hubid_get(expected, sizeof(expected)) == SUCCESS);
+
+  // Losing every interface keeps the last hub ID we knew
+  CPPUNIT_ASSERT_MESSAGE("Found a hub ID without any interface\n", hubid_setInterfaces("nosuchif0") != SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Lost the hub ID\n", hubid_get(address, sizeof(address)) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Hub ID changed\n", strcmp(expected, address) == 0);
+
+  hubid_setInterfaces(EUI64_DEFAULT_INTERFACES);
+}
@@ -0,0 +1,422 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * Parse JSON into an arena.
+ *
+ * The trees are made of ordinary cJSON items, so cJSON_GetObjectItem(..)
+ * and friends work on them, but the items and their strings are bumped out
+ * of a jsonarena_t instead of being malloc'd one at a time.  Nothing is
+ * freed item by item: resetting the arena throws away every tree parsed
+ * into it since the last reset.
+ *
+ * Like cJSON_Parse(..), anything after the first complete value is ignored.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "jsonscan.h"
+#include "jsonarena.h"
+
+/** Everything the arena hands out is aligned for a double */
+#define JSONARENA_ALIGNMENT 8
+
+#define JSONARENA_ALIGN(x) (((x) + JSONARENA_ALIGNMENT - 1) & ~((uintptr_t) JSONARENA_ALIGNMENT - 1))
+
+/** Bytes of a chunk taken by its header */
+#define JSONARENA_HEADER_SIZE JSONARENA_ALIGN(sizeof(jsonarena_chunk_t))
+
+/** This thread's arena, see jsonarena_local() */
+static __thread jsonarena_t tArena;
+static __thread bool tArenaReady;
+
+/** Frees a thread's arena when it exits */
+static pthread_key_t sArenaKey;
+static pthread_once_t sArenaKeyOnce = PTHREAD_ONCE_INIT;
+
+/***************** Private Prototypes ****************/
+static jsonarena_chunk_t *_jsonarena_nextChunk(jsonarena_t *arena, size_t size);
+static void _jsonarena_createKey();
+static void _jsonarena_releaseLocal(void *arena);
+static cJSON *_jsonarena_newItem(jsonarena_t *arena);
+static const char *_jsonarena_parseValue(jsonarena_t *arena, cJSON *item, const char *in, int depth);
+static const char *_jsonarena_parseString(jsonarena_t *arena, char **out, const char *in);
+static const char *_jsonarena_parseArray(jsonarena_t *arena, cJSON *item, const char *in, int depth);
+static const char *_jsonarena_parseObject(jsonarena_t *arena, cJSON *item, const char *in, int depth);
+
+/***************** Public Functions ****************/
+/**
+ * Initialize an arena
+ *
+ * @param arena Arena to initialize
+ * @param buffer Memory the arena hands out, which it never grows beyond.
+ *     NULL for an arena that allocates chunks from the heap as it needs
+ *     them, and must be destroyed.
+ * @param size Size of the buffer in bytes
+ */
+void jsonarena_init(jsonarena_t *arena, void *buffer, size_t size) {
+  uintptr_t start;
+
+  bzero(arena, sizeof(jsonarena_t));
+
+  if(buffer == NULL) {
+    arena->growable = true;
+    return;
+  }
+
+  start = JSONARENA_ALIGN((uintptr_t) buffer);
+  if(start + JSONARENA_HEADER_SIZE > (uintptr_t) buffer + size) {
+    // Too small to hold anything, every allocation will fail
+    return;
+  }
+
+  arena->head = (jsonarena_chunk_t *) start;
+  arena->head->next = NULL;
+  arena->head->size = (uintptr_t) buffer + size - start - JSONARENA_HEADER_SIZE;
+  arena->current = arena->head;
+}
+
+/**
+ * Free the chunks a growing arena allocated.  Trees parsed into the arena
+ * are invalid after this.
+ *
+ * @param arena Arena to destroy
+ */
+void jsonarena_destroy(jsonarena_t *arena) {
+  jsonarena_chunk_t *chunk;
+
+  if(arena->growable) {
+    while((chunk = arena->head) != NULL) {
+      arena->head = chunk->next;
+      free(chunk);
+    }
+  }
+
+  bzero(arena, sizeof(jsonarena_t));
+}
+
+/**
+ * Release everything the arena handed out since the last reset, and every
+ * tree parsed into it with them.  The memory stays with the arena.
+ *
+ * @param arena Arena to reset
+ */
+void jsonarena_reset(jsonarena_t *arena) {
+  arena->current = arena->head;
+  arena->used = 0;
+}
+
+/**
+ * Allocate memory from the arena.  There is no way to free it other than
+ * resetting the arena.
+ *
+ * @param arena Arena to allocate from
+ * @param size Number of bytes
+ * @return Memory aligned for any JSON value, or NULL if the arena is full
+ */
+void *jsonarena_alloc(jsonarena_t *arena, size_t size) {
+  jsonarena_chunk_t *chunk;
+  void *ptr;
+
+  size = JSONARENA_ALIGN(size);
+
+  if(arena->current == NULL || arena->current->size - arena->used < size) {
+    if((chunk = _jsonarena_nextChunk(arena, size)) == NULL) {
+      return NULL;
+    }
+
+    arena->current = chunk;
+    arena->used = 0;
+  }
+
+  ptr = (char *) arena->current + JSONARENA_HEADER_SIZE + arena->used;
+  arena->used += size;
+  return ptr;
+}
+
+/**
+ * Parse JSON text into the arena.  The tree stays valid until the arena is
+ * reset or destroyed, and must not be passed to cJSON_Delete(..).
+ *
+ * A parse that fails gives back whatever it took from the arena.
+ *
+ * @param arena Arena to parse into
+ * @param text Null-terminated JSON text
+ * @return The root of the tree, or NULL if the text isn't JSON or the
+ *     arena ran out of memory
+ */
+cJSON *jsonarena_parse(jsonarena_t *arena, const char *text) {
+  jsonarena_chunk_t *current = arena->current;
+  size_t used = arena->used;
+  cJSON *item;
+
+  if(text == NULL) {
+    return NULL;
+  }
+
+  if((item = _jsonarena_newItem(arena)) == NULL
+      || _jsonarena_parseValue(arena, item, jsonscan_skip(text), 0) == NULL) {
+    arena->current = current;
+    arena->used = used;
+    return NULL;
+  }
+
+  return item;
+}
+
+/**
+ * The calling thread's own growing arena.  It is pooled for the life of the
+ * thread and freed when the thread exits, so the caller only ever resets it.
+ * Whoever resets it throws away every tree the thread parsed into it, so
+ * reset it at the end of a unit of work that doesn't hand its trees on.
+ *
+ * @return This thread's arena
+ */
+jsonarena_t *jsonarena_local() {
+  if(!tArenaReady) {
+    pthread_once(&sArenaKeyOnce, &_jsonarena_createKey);
+    jsonarena_init(&tArena, NULL, 0);
+    pthread_setspecific(sArenaKey, &tArena);
+    tArenaReady = true;
+  }
+
+  return &tArena;
+}
+
+
+/***************** Private Functions ****************/
+/**
+ * Find the next chunk with room for an allocation, adding one to a growing
+ * arena if we have to.  Any room left in the chunks we pass over goes
+ * unused until the arena is reset.
+ *
+ * @param arena Arena to allocate from
+ * @param size Aligned number of bytes we need
+ * @return The chunk, or NULL if the arena is full
+ */
+static jsonarena_chunk_t *_jsonarena_nextChunk(jsonarena_t *arena, size_t size) {
+  jsonarena_chunk_t *chunk;
+  jsonarena_chunk_t *last = arena->current;
+  size_t chunkSize;
+
+  for(chunk = (last != NULL) ? last->next : arena->head; chunk != NULL; chunk = chunk->next) {
+    if(chunk->size >= size) {
+      return chunk;
+    }
+    last = chunk;
+  }
+
+  if(!arena->growable) {
+    return NULL;
+  }
+
+  chunkSize = (size > JSONARENA_CHUNK_SIZE) ? size : JSONARENA_CHUNK_SIZE;
+  if((chunk = (jsonarena_chunk_t *) malloc(JSONARENA_HEADER_SIZE + chunkSize)) == NULL) {
+    return NULL;
+  }
+
+  chunk->next = NULL;
+  chunk->size = chunkSize;
+
+  if(last == NULL) {
+    arena->head = chunk;
+  } else {
+    last->next = chunk;
+  }
+
+  return chunk;
+}
+
+static void _jsonarena_createKey() {
+  pthread_key_create(&sArenaKey, &_jsonarena_releaseLocal);
+}
+
+/**
+ * Free a thread's arena when the thread exits
+ * @param arena The thread's arena
+ */
+static void _jsonarena_releaseLocal(void *arena) {
+  jsonarena_destroy((jsonarena_t *) arena);
+  tArenaReady = false;
+}
+
+/**
+ * @return A cleared item from the arena, or NULL if it's full
+ */
+static cJSON *_jsonarena_newItem(jsonarena_t *arena) {
+  cJSON *item;
+
+  if((item = (cJSON *) jsonarena_alloc(arena, sizeof(cJSON))) != NULL) {
+    bzero(item, sizeof(cJSON));
+  }
+
+  return item;
+}
+
+/**
+ * Parse any value
+ * @return The character after the value, or NULL if it isn't valid
+ */
+static const char *_jsonarena_parseValue(jsonarena_t *arena, cJSON *item, const char *in, int depth) {
+  switch(*in) {
+  case '"':
+    item->type = cJSON_String;
+    return _jsonarena_parseString(arena, &item->valuestring, in);
+
+  case '[':
+    return _jsonarena_parseArray(arena, item, in, depth + 1);
+
+  case '{':
+    return _jsonarena_parseObject(arena, item, in, depth + 1);
+
+  case 'n':
+    item->type = cJSON_NULL;
+    return (strncmp(in, "null", 4) == 0) ? in + 4 : NULL;
+
+  case 't':
+    item->type = cJSON_True;
+    item->valueint = 1;
+    return (strncmp(in, "true", 4) == 0) ? in + 4 : NULL;
+
+  case 'f':
+    item->type = cJSON_False;
+    return (strncmp(in, "false", 5) == 0) ? in + 5 : NULL;
+
+  default:
+    item->type = cJSON_Number;
+    if((in = jsonscan_number(in, &item->valuedouble)) != NULL) {
+      item->valueint = jsonscan_toInt(item->valuedouble);
+    }
+    return in;
+  }
+}
+
+/**
+ * Parse a string into the arena, decoding its escapes
+ * @param out Set to the decoded, null-terminated string
+ * @return The character after the closing quote, or NULL if it isn't valid
+ */
+static const char *_jsonarena_parseString(jsonarena_t *arena, char **out, const char *in) {
+  size_t length;
+
+  if(jsonscan_string(in, NULL, 0, &length) == NULL
+      || (*out = (char *) jsonarena_alloc(arena, length + 1)) == NULL) {
+    return NULL;
+  }
+
+  return jsonscan_string(in, *out, length + 1, NULL);
+}
+
+/**
+ * Parse an array
+ * @return The character after the closing bracket, or NULL if it isn't valid
+ */
+static const char *_jsonarena_parseArray(jsonarena_t *arena, cJSON *item, const char *in, int depth) {
+  cJSON *child;
+  cJSON *last = NULL;
+
+  if(depth > JSONSCAN_MAX_DEPTH) {
+    return NULL;
+  }
+
+  item->type = cJSON_Array;
+  in = jsonscan_skip(in + 1);
+  if(*in == ']') {
+    return in + 1;
+  }
+
+  while(true) {
+    if((child = _jsonarena_newItem(arena)) == NULL
+        || (in = _jsonarena_parseValue(arena, child, in, depth)) == NULL) {
+      return NULL;
+    }
+
+    if(last == NULL) {
+      item->child = child;
+    } else {
+      last->next = child;
+      child->prev = last;
+    }
+    last = child;
+
+    in = jsonscan_skip(in);
+    if(*in == ']') {
+      return in + 1;
+    }
+    if(*in != ',') {
+      return NULL;
+    }
+    in = jsonscan_skip(in + 1);
+  }
+}
+
+/**
+ * Parse an object
+ * @return The character after the closing brace, or NULL if it isn't valid
+ */
+static const char *_jsonarena_parseObject(jsonarena_t *arena, cJSON *item, const char *in, int depth) {
+  cJSON *child;
+  cJSON *last = NULL;
+
+  if(depth > JSONSCAN_MAX_DEPTH) {
+    return NULL;
+  }
+
+  item->type = cJSON_Object;
+  in = jsonscan_skip(in + 1);
+  if(*in == '}') {
+    return in + 1;
+  }
+
+  while(true) {
+    if(*in != '"' || (child = _jsonarena_newItem(arena)) == NULL
+        || (in = _jsonarena_parseString(arena, &child->string, in)) == NULL) {
+      return NULL;
+    }
+
+    in = jsonscan_skip(in);
+    if(*in != ':') {
+      return NULL;
+    }
+
+    if((in = _jsonarena_parseValue(arena, child, jsonscan_skip(in + 1), depth)) == NULL) {
+      return NULL;
+    }
+
+    if(last == NULL) {
+      item->child = child;
+    } else {
+      last->next = child;
+      child->prev = last;
+    }
+    last = child;
+
+    in = jsonscan_skip(in);
+    if(*in == '}') {
+      return in + 1;
+    }
+    if(*in != ',') {
+      return NULL;
+    }
+    in = jsonscan_skip(in + 1);
+  }
+}
@@ -0,0 +1,84 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef JSONARENA_H
+#define JSONARENA_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "cJSON.h"
+
+/** Size of each chunk a growing arena allocates */
+#ifndef JSONARENA_CHUNK_SIZE
+#define JSONARENA_CHUNK_SIZE 8192
+#endif
+
+/**
+ * A piece of memory the arena bumps through.  The header sits at the
+ * start of the memory it describes.
+ */
+typedef struct jsonarena_chunk_t {
+
+  /** Next chunk, which a growing arena moves on to when this one is full */
+  struct jsonarena_chunk_t *next;
+
+  /** Bytes available after the header */
+  size_t size;
+
+} jsonarena_chunk_t;
+
+/**
+ * A bump allocator for parsed JSON.  Every node and string of a tree parsed
+ * with jsonarena_parse(..) comes out of the arena, so the trees are never
+ * passed to cJSON_Delete(..).  Resetting the arena releases them all at
+ * once, and the memory is reused by the next parse.
+ *
+ * An arena over the application's own buffer never touches the heap and
+ * fails the parse when the buffer is full.  The per-thread arena from
+ * jsonarena_local() grows a chunk at a time and keeps its chunks across
+ * resets, so it stops allocating once it has seen the largest message.
+ */
+typedef struct jsonarena_t {
+
+  /** First chunk */
+  jsonarena_chunk_t *head;
+
+  /** Chunk we're allocating from, and the bytes of it already handed out */
+  jsonarena_chunk_t *current;
+  size_t used;
+
+  /** True if the arena may add chunks from the heap */
+  bool growable;
+
+} jsonarena_t;
+
+/***************** Public Prototypes ****************/
+void jsonarena_init(jsonarena_t *arena, void *buffer, size_t size);
+
+void jsonarena_destroy(jsonarena_t *arena);
+
+void jsonarena_reset(jsonarena_t *arena);
+
+void *jsonarena_alloc(jsonarena_t *arena, size_t size);
+
+cJSON *jsonarena_parse(jsonarena_t *arena, const char *text);
+
+jsonarena_t *jsonarena_local();
+
+#endif
@@ -0,0 +1,417 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * Scan the pieces of JSON text that the arena parser and the schema
+ * extractor both read: whitespace, numbers, strings, and whole values we
+ * only need to step over.  Nothing here allocates.
+ *
+ * Each function takes a pointer to the first character of what it scans
+ * and returns a pointer to the character after it, or NULL if the text
+ * isn't valid JSON.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+
+#include "jsonscan.h"
+
+/** Longest number we parse */
+#define JSONSCAN_MAX_NUMBER_LEN 64
+
+/** Most significant digits we convert ourselves, so they're exact in a double */
+#define JSONSCAN_MAX_FAST_DIGITS 15
+
+/** Largest power of ten that is exact in a double */
+#define JSONSCAN_MAX_FAST_EXPONENT 22
+
+static const double sPowersOf10[JSONSCAN_MAX_FAST_EXPONENT + 1] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/***************** Private Prototypes ****************/
+static const char *_jsonscan_hex(const char *in, unsigned int *code);
+static void _jsonscan_put(char *dst, size_t size, size_t *length, size_t *written, const char *bytes, size_t total);
+static const char *_jsonscan_container(const char *in, int depth);
+
+/***************** Public Functions ****************/
+/**
+ * @return The first character at or after 'in' that isn't whitespace
+ */
+const char *jsonscan_skip(const char *in) {
+  while(*in != '\0' && (unsigned char) *in <= ' ') {
+    in++;
+  }
+
+  return in;
+}
+
+/**
+ * Scan a number.  Numbers with few enough digits and a small enough
+ * exponent are exact in a double, and so is one multiplication or division
+ * by a power of ten, so we convert those here.  Everything else goes
+ * through strtod(..).
+ *
+ * @param value Set to the number
+ */
+const char *jsonscan_number(const char *in, double *value) {
+  char number[JSONSCAN_MAX_NUMBER_LEN + 1];
+  const char *start = in;
+  long long mantissa = 0;
+  bool negative = false;
+  bool fast = true;
+  bool expNegative = false;
+  int digits = 0;
+  int exponent = 0;
+  int fractionDigits = 0;
+
+  if(*in == '-') {
+    negative = true;
+    in++;
+  }
+
+  if(*in == '0') {
+    in++;
+
+  } else if(*in >= '1' && *in <= '9') {
+    while(*in >= '0' && *in <= '9') {
+      if(digits < JSONSCAN_MAX_FAST_DIGITS) {
+        mantissa = mantissa * 10 + (*in - '0');
+        digits++;
+      } else {
+        fast = false;
+      }
+      in++;
+    }
+
+  } else {
+    return NULL;
+  }
+
+  if(*in == '.') {
+    in++;
+    if(*in < '0' || *in > '9') {
+      return NULL;
+    }
+    while(*in >= '0' && *in <= '9') {
+      if(digits < JSONSCAN_MAX_FAST_DIGITS) {
+        mantissa = mantissa * 10 + (*in - '0');
+        digits += (mantissa != 0);
+        fractionDigits++;
+      } else {
+        fast = false;
+      }
+      in++;
+    }
+  }
+
+  if(*in == 'e' || *in == 'E') {
+    in++;
+    if(*in == '+' || *in == '-') {
+      expNegative = (*in == '-');
+      in++;
+    }
+    if(*in < '0' || *in > '9') {
+      return NULL;
+    }
+    while(*in >= '0' && *in <= '9') {
+      if(exponent < JSONSCAN_MAX_FAST_EXPONENT * 2) {
+        exponent = exponent * 10 + (*in - '0');
+      }
+      in++;
+    }
+  }
+
+  exponent = (expNegative ? -exponent : exponent) - fractionDigits;
+  if(exponent < -JSONSCAN_MAX_FAST_EXPONENT || exponent > JSONSCAN_MAX_FAST_EXPONENT) {
+    fast = false;
+  }
+
+  if(fast) {
+    *value = (double) mantissa;
+    if(exponent < 0) {
+      *value /= sPowersOf10[-exponent];
+    } else {
+      *value *= sPowersOf10[exponent];
+    }
+    if(negative) {
+      *value = -*value;
+    }
+
+  } else {
+    // Copy it out so strtod(..) doesn't read anything past the JSON number
+    if(in - start > JSONSCAN_MAX_NUMBER_LEN) {
+      return NULL;
+    }
+    memcpy(number, start, in - start);
+    number[in - start] = '\0';
+    *value = strtod(number, NULL);
+  }
+
+  return in;
+}
+
+/**
+ * Scan a string, decoding its escapes.  What doesn't fit in the
+ * destination is dropped, never part of a UTF-8 sequence.
+ *
+ * @param in The opening quote
+ * @param dst Where to put the decoded, null-terminated string, or NULL to
+ *     only step over it
+ * @param size Size of dst in bytes
+ * @param length Set to the length of the whole decoded string, which may be
+ *     longer than what fit.  May be NULL.
+ */
+const char *jsonscan_string(const char *in, char *dst, size_t size, size_t *length) {
+  const char *run;
+  char utf8[4];
+  unsigned int code;
+  unsigned int low;
+  size_t decoded = 0;
+  size_t written = 0;
+  size_t total;
+
+  for(in++; *in != '"'; in++) {
+    // Copy everything up to the next escape or the end in one go
+    run = in;
+    while(*in != '"' && *in != '\\' && *in != '\0') {
+      in++;
+    }
+    _jsonscan_put(dst, size, &decoded, &written, run, in - run);
+
+    if(*in == '"') {
+      break;
+    } else if(*in == '\0') {
+      return NULL;
+    }
+
+    in++;
+    switch(*in) {
+    case '\0':
+      return NULL;
+
+    case 'b': _jsonscan_put(dst, size, &decoded, &written, "\b", 1); break;
+    case 'f': _jsonscan_put(dst, size, &decoded, &written, "\f", 1); break;
+    case 'n': _jsonscan_put(dst, size, &decoded, &written, "\n", 1); break;
+    case 'r': _jsonscan_put(dst, size, &decoded, &written, "\r", 1); break;
+    case 't': _jsonscan_put(dst, size, &decoded, &written, "\t", 1); break;
+
+    case 'u':
+      if((in = _jsonscan_hex(in + 1, &code)) == NULL) {
+        return NULL;
+      }
+
+      if(code >= 0xD800 && code <= 0xDBFF) {
+        // High surrogate, which must be followed by the low one
+        if(in[0] != '\\' || in[1] != 'u'
+            || (in = _jsonscan_hex(in + 2, &low)) == NULL
+            || low < 0xDC00 || low > 0xDFFF) {
+          return NULL;
+        }
+        code = 0x10000 + (((code & 0x3FF) << 10) | (low & 0x3FF));
+
+      } else if(code >= 0xDC00 && code <= 0xDFFF) {
+        return NULL;
+      }
+
+      // Encode as UTF-8
+      if(code < 0x80) {
+        utf8[0] = (char) code;
+        total = 1;
+      } else if(code < 0x800) {
+        utf8[0] = (char) (0xC0 | (code >> 6));
+        utf8[1] = (char) (0x80 | (code & 0x3F));
+        total = 2;
+      } else if(code < 0x10000) {
+        utf8[0] = (char) (0xE0 | (code >> 12));
+        utf8[1] = (char) (0x80 | ((code >> 6) & 0x3F));
+        utf8[2] = (char) (0x80 | (code & 0x3F));
+        total = 3;
+      } else {
+        utf8[0] = (char) (0xF0 | (code >> 18));
+        utf8[1] = (char) (0x80 | ((code >> 12) & 0x3F));
+        utf8[2] = (char) (0x80 | ((code >> 6) & 0x3F));
+        utf8[3] = (char) (0x80 | (code & 0x3F));
+        total = 4;
+      }
+      _jsonscan_put(dst, size, &decoded, &written, utf8, total);
+
+      // Step back onto the last hex digit, the loop steps past it
+      in--;
+      break;
+
+    default:
+      // \" \\ \/ and anything else stand for themselves
+      _jsonscan_put(dst, size, &decoded, &written, in, 1);
+      break;
+    }
+  }
+
+  if(dst != NULL && size > 0) {
+    dst[written] = '\0';
+  }
+
+  if(length != NULL) {
+    *length = decoded;
+  }
+
+  return in + 1;
+}
+
+/**
+ * Step over any value, checking that it's valid
+ * @param depth Nesting of the value
+ */
+const char *jsonscan_value(const char *in, int depth) {
+  double number;
+
+  switch(*in) {
+  case '"':
+    return jsonscan_string(in, NULL, 0, NULL);
+
+  case '[':
+  case '{':
+    return _jsonscan_container(in, depth + 1);
+
+  case 'n':
+    return (strncmp(in, "null", 4) == 0) ? in + 4 : NULL;
+
+  case 't':
+    return (strncmp(in, "true", 4) == 0) ? in + 4 : NULL;
+
+  case 'f':
+    return (strncmp(in, "false", 5) == 0) ? in + 5 : NULL;
+
+  default:
+    return jsonscan_number(in, &number);
+  }
+}
+
+/**
+ * Truncate a number to an int the way cJSON's valueint does, except that
+ * numbers out of range clamp instead of overflowing
+ */
+int jsonscan_toInt(double value) {
+  if(value >= INT_MAX) {
+    return INT_MAX;
+  } else if(value <= INT_MIN) {
+    return INT_MIN;
+  }
+
+  return (int) value;
+}
+
+
+/***************** Private Functions ****************/
+/**
+ * Scan the 4 hex digits of a \u escape
+ * @param code Set to the code unit
+ */
+static const char *_jsonscan_hex(const char *in, unsigned int *code) {
+  int i;
+
+  *code = 0;
+  for(i = 0; i < 4; i++, in++) {
+    *code <<= 4;
+    if(*in >= '0' && *in <= '9') {
+      *code |= *in - '0';
+    } else if(*in >= 'a' && *in <= 'f') {
+      *code |= *in - 'a' + 10;
+    } else if(*in >= 'A' && *in <= 'F') {
+      *code |= *in - 'A' + 10;
+    } else {
+      return NULL;
+    }
+  }
+
+  return in;
+}
+
+/**
+ * Append decoded bytes to a string.  What doesn't fit is cut at the start
+ * of a UTF-8 sequence, and once something didn't fit nothing more is
+ * appended.
+ *
+ * @param length Length of the whole decoded string so far
+ * @param written Bytes of it actually in dst, which stops short of length
+ *     once something didn't fit
+ */
+static void _jsonscan_put(char *dst, size_t size, size_t *length, size_t *written, const char *bytes, size_t total) {
+  size_t fits = total;
+
+  if(dst != NULL && *written == *length) {
+    if(*written + total >= size) {
+      fits = (size > *written) ? size - 1 - *written : 0;
+      while(fits > 0 && ((unsigned char) bytes[fits] & 0xC0) == 0x80) {
+        fits--;
+      }
+    }
+    memcpy(dst + *written, bytes, fits);
+    *written += fits;
+  }
+
+  *length += total;
+}
+
+/**
+ * Step over an array or object
+ * @param depth Nesting of its members
+ */
+static const char *_jsonscan_container(const char *in, int depth) {
+  char close = (*in == '[') ? ']' : '}';
+
+  if(depth > JSONSCAN_MAX_DEPTH) {
+    return NULL;
+  }
+
+  in = jsonscan_skip(in + 1);
+  if(*in == close) {
+    return in + 1;
+  }
+
+  while(true) {
+    if(close == '}') {
+      if(*in != '"' || (in = jsonscan_string(in, NULL, 0, NULL)) == NULL) {
+        return NULL;
+      }
+
+      in = jsonscan_skip(in);
+      if(*in != ':') {
+        return NULL;
+      }
+      in = jsonscan_skip(in + 1);
+    }
+
+    if((in = jsonscan_value(in, depth)) == NULL) {
+      return NULL;
+    }
+
+    in = jsonscan_skip(in);
+    if(*in == close) {
+      return in + 1;
+    }
+    if(*in != ',') {
+      return NULL;
+    }
+    in = jsonscan_skip(in + 1);
+  }
+}
@@ -0,0 +1,40 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef JSONSCAN_H
+#define JSONSCAN_H
+
+#include <stddef.h>
+
+/** Deepest nesting of arrays and objects we parse */
+#ifndef JSONSCAN_MAX_DEPTH
+#define JSONSCAN_MAX_DEPTH 32
+#endif
+
+/***************** Public Prototypes ****************/
+const char *jsonscan_skip(const char *in);
+
+const char *jsonscan_number(const char *in, double *value);
+
+const char *jsonscan_string(const char *in, char *dst, size_t size, size_t *length);
+
+const char *jsonscan_value(const char *in, int depth);
+
+int jsonscan_toInt(double value);
+
+#endif
@@ -0,0 +1,211 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * Fill a C struct from a JSON object in one pass over its text.
+ *
+ * The application describes its record with a static table of fields, and
+ * each key of the object is looked up in the table as the object is read.
+ * Devices tend to send their keys in the same order every time, so the
+ * lookup starts right after the field that matched last and usually hits
+ * on the first compare.  No tree is built and nothing is allocated.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "jsonscan.h"
+#include "jsonschema.h"
+
+/***************** Private Prototypes ****************/
+static int _jsonschema_find(const jsonschema_field_t *schema, int totalFields, int start, const char *key);
+static const char *_jsonschema_store(const jsonschema_field_t *field, const char *in, void *record, bool *stored);
+
+/***************** Public Functions ****************/
+/**
+ * Extract the fields of a record from a JSON object.  Keys the schema
+ * doesn't know are stepped over, and only the first of duplicate keys
+ * counts.  A value of the wrong type counts as missing.  Fields that
+ * aren't found keep whatever the record held before, so the caller sets
+ * the defaults.
+ *
+ * @param schema Fields of the record, ending with JSONSCHEMA_END
+ * @param text Null-terminated JSON text holding an object
+ * @param record Record to fill in
+ * @param found Set to a bit for each field found, see JSONSCHEMA_FOUND(..).
+ *     May be NULL.
+ * @return SUCCESS if the text is a valid object with every required field.
+ *     The record may be partly filled in when it fails.
+ */
+error_t jsonschema_extract(const jsonschema_field_t *schema, const char *text, void *record, unsigned int *found) {
+  char key[JSONSCHEMA_MAX_KEY_SIZE];
+  unsigned int foundFields = 0;
+  int totalFields;
+  int next = 0;
+  int index;
+  size_t length;
+  bool stored;
+  const char *in;
+
+  for(totalFields = 0; schema[totalFields].key != NULL; totalFields++);
+  if(totalFields > JSONSCHEMA_MAX_FIELDS) {
+    return FAIL;
+  }
+
+  in = jsonscan_skip(text);
+  if(*in != '{') {
+    return FAIL;
+  }
+
+  in = jsonscan_skip(in + 1);
+  if(*in != '}') {
+    while(true) {
+      if(*in != '"' || (in = jsonscan_string(in, key, sizeof(key), &length)) == NULL) {
+        return FAIL;
+      }
+
+      in = jsonscan_skip(in);
+      if(*in != ':') {
+        return FAIL;
+      }
+      in = jsonscan_skip(in + 1);
+
+      // A key too long for our buffer can't be one of ours
+      index = (length < sizeof(key)) ? _jsonschema_find(schema, totalFields, next, key) : -1;
+
+      if(index >= 0 && !JSONSCHEMA_FOUND(foundFields, index)) {
+        if((in = _jsonschema_store(&schema[index], in, record, &stored)) == NULL) {
+          return FAIL;
+        }
+
+        if(stored) {
+          foundFields |= 1U << index;
+        }
+        next = index + 1;
+
+      } else if((in = jsonscan_value(in, 1)) == NULL) {
+        return FAIL;
+      }
+
+      in = jsonscan_skip(in);
+      if(*in == '}') {
+        break;
+      }
+      if(*in != ',') {
+        return FAIL;
+      }
+      in = jsonscan_skip(in + 1);
+    }
+  }
+
+  if(found != NULL) {
+    *found = foundFields;
+  }
+
+  for(index = 0; index < totalFields; index++) {
+    if(schema[index].required && !JSONSCHEMA_FOUND(foundFields, index)) {
+      return FAIL;
+    }
+  }
+
+  return SUCCESS;
+}
+
+
+/***************** Private Functions ****************/
+/**
+ * Look up a key in the schema, starting at a given field and wrapping
+ * around
+ *
+ * @return The position of the field in the schema, or -1 if it isn't there
+ */
+static int _jsonschema_find(const jsonschema_field_t *schema, int totalFields, int start, const char *key) {
+  int index;
+  int i;
+
+  for(i = 0; i < totalFields; i++) {
+    index = (start + i) % totalFields;
+    if(strcmp(schema[index].key, key) == 0) {
+      return index;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * Store a value in its field if it has the right type, or step over it
+ *
+ * @param field Field the value belongs to
+ * @param in First character of the value
+ * @param record Record to store the value in
+ * @param stored Set to true if the value was stored
+ * @return The character after the value, or NULL if it isn't valid
+ */
+static const char *_jsonschema_store(const jsonschema_field_t *field, const char *in, void *record, bool *stored) {
+  char *dst = (char *) record + field->offset;
+  bool isNumber = (*in == '-' || (*in >= '0' && *in <= '9'));
+  double number;
+
+  *stored = false;
+
+  switch(field->type) {
+  case JSONSCHEMA_INT:
+  case JSONSCHEMA_DOUBLE:
+    if(!isNumber) {
+      break;
+    }
+
+    if((in = jsonscan_number(in, &number)) != NULL) {
+      if(field->type == JSONSCHEMA_INT) {
+        *(int *) dst = jsonscan_toInt(number);
+      } else {
+        *(double *) dst = number;
+      }
+      *stored = true;
+    }
+    return in;
+
+  case JSONSCHEMA_BOOL:
+    if(isNumber) {
+      if((in = jsonscan_number(in, &number)) != NULL) {
+        *(bool *) dst = (number != 0);
+        *stored = true;
+      }
+      return in;
+
+    } else if(strncmp(in, "true", 4) == 0 || strncmp(in, "false", 5) == 0) {
+      *(bool *) dst = (*in == 't');
+      *stored = true;
+      return in + ((*in == 't') ? 4 : 5);
+    }
+    break;
+
+  case JSONSCHEMA_STRING:
+    if(*in != '"') {
+      break;
+    }
+
+    if((in = jsonscan_string(in, dst, field->size, NULL)) != NULL) {
+      *stored = true;
+    }
+    return in;
+  }
+
+  return jsonscan_value(in, 1);
+}
@@ -0,0 +1,91 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef JSONSCHEMA_H
+#define JSONSCHEMA_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "ioterror.h"
+
+/** Most fields in one schema */
+#define JSONSCHEMA_MAX_FIELDS 32
+
+/** Longest key we match, including the null terminator */
+#ifndef JSONSCHEMA_MAX_KEY_SIZE
+#define JSONSCHEMA_MAX_KEY_SIZE 64
+#endif
+
+/**
+ * C types the fields of a record can have
+ */
+typedef enum jsonschema_type_e {
+
+  /** int, from a number, truncated like cJSON's valueint */
+  JSONSCHEMA_INT,
+
+  /** double, from a number */
+  JSONSCHEMA_DOUBLE,
+
+  /** bool, from true, false or a number */
+  JSONSCHEMA_BOOL,
+
+  /** char array, from a string, truncated to fit */
+  JSONSCHEMA_STRING,
+
+} jsonschema_type_e;
+
+/**
+ * One field of a record, and the key of the JSON object it comes from
+ */
+typedef struct jsonschema_field_t {
+
+  /** Key in the JSON object, matched exactly */
+  const char *key;
+
+  /** Type of the field in the record */
+  jsonschema_type_e type;
+
+  /** Where the field is in the record, and its size */
+  size_t offset;
+  size_t size;
+
+  /** True if the object isn't valid without this field */
+  bool required;
+
+} jsonschema_field_t;
+
+/**
+ * Describe a field of a record, i.e.
+ *
+ *   JSONSCHEMA_FIELD("temp", JSONSCHEMA_DOUBLE, rtoa_t, temp, false)
+ */
+#define JSONSCHEMA_FIELD(key, type, record, member, required) \
+    { (key), (type), offsetof(record, member), sizeof(((record *) 0)->member), (required) }
+
+/** Ends a schema */
+#define JSONSCHEMA_END { NULL, JSONSCHEMA_INT, 0, 0, false }
+
+/** True if the field at this position in the schema was found */
+#define JSONSCHEMA_FOUND(found, index) (((found) & (1U << (index))) != 0)
+
+/***************** Public Prototypes ****************/
+error_t jsonschema_extract(const jsonschema_field_t *schema, const char *text, void *record, unsigned int *found);
+
+#endif
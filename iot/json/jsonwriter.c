@@ -0,0 +1,609 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * Write JSON text straight into a buffer.
+ *
+ * cJSON_Print(..) builds its text out of a malloc'd fragment per item and
+ * sprintf(..)s every number, and the caller still has to copy the result
+ * into its own buffer.  Here the caller's buffer is the output: a message
+ * is written a piece at a time with jsonwriter_key(..), jsonwriter_int(..)
+ * and friends, or a whole cJSON tree is written with jsonwriter_item(..),
+ * which measures the tree first so it's either written in full or not at
+ * all.
+ *
+ * Numbers are formatted by hand.  Integers and numbers with up to six
+ * decimal places, which is everything our devices send and receive, are
+ * written exactly and with no trailing zeros.  Anything else is written
+ * with the fewest digits that read back as the same double.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "jsonwriter.h"
+
+/** Integers larger than this aren't exact in a double */
+#define JSONWRITER_MAX_EXACT_INTEGER 9007199254740992.0
+
+/** Decimal places we format by hand, as a scale, and the largest number we scale */
+#define JSONWRITER_FIXED_DECIMALS 6
+#define JSONWRITER_FIXED_SCALE 1000000.0
+#define JSONWRITER_MAX_FIXED 1000000000.0
+
+/** True for the characters that go into a string as they are */
+#define JSONWRITER_PLAIN(c) ((unsigned char) (c) >= ' ' && (c) != '"' && (c) != '\\')
+
+/***************** Private Prototypes ****************/
+static bool _jsonwriter_reserve(jsonwriter_t *writer, size_t total);
+static char *_jsonwriter_claim(jsonwriter_t *writer, size_t total);
+static void _jsonwriter_put(jsonwriter_t *writer, const char *bytes, size_t total);
+static void _jsonwriter_separate(jsonwriter_t *writer);
+static void _jsonwriter_open(jsonwriter_t *writer, char c);
+static void _jsonwriter_close(jsonwriter_t *writer, char c);
+static void _jsonwriter_writeString(jsonwriter_t *writer, const char *value);
+static size_t _jsonwriter_escape(char c, char *dst);
+static size_t _jsonwriter_measureString(const char *value);
+static char *_jsonwriter_printString(const char *value, char *dst);
+static char *_jsonwriter_printItem(cJSON *item, char *dst);
+static size_t _jsonwriter_formatInteger(long long value, char *dst);
+static size_t _jsonwriter_formatFixed(long long scaled, char *dst);
+
+/***************** Public Functions ****************/
+/**
+ * Initialize a writer
+ *
+ * @param writer Writer to initialize
+ * @param buffer Buffer the text goes into, which the writer never grows
+ *     beyond.  NULL for a writer that grows its own buffer on the heap as
+ *     it needs to, and must be destroyed.
+ * @param size Size of the buffer in bytes
+ */
+void jsonwriter_init(jsonwriter_t *writer, char *buffer, size_t size) {
+  bzero(writer, sizeof(jsonwriter_t));
+
+  if(buffer == NULL) {
+    writer->growable = true;
+    return;
+  }
+
+  writer->buffer = buffer;
+  writer->size = size;
+  if(size > 0) {
+    buffer[0] = '\0';
+  }
+}
+
+/**
+ * Free the buffer of a growable writer.  The text is invalid after this.
+ */
+void jsonwriter_destroy(jsonwriter_t *writer) {
+  if(writer->growable) {
+    free(writer->buffer);
+    writer->buffer = NULL;
+    writer->size = 0;
+  }
+}
+
+/**
+ * Start an object.  Its members are written as a jsonwriter_key(..)
+ * followed by a value.
+ */
+void jsonwriter_beginObject(jsonwriter_t *writer) {
+  _jsonwriter_open(writer, '{');
+}
+
+/**
+ * Finish the object started last
+ */
+void jsonwriter_endObject(jsonwriter_t *writer) {
+  _jsonwriter_close(writer, '}');
+}
+
+/**
+ * Start an array
+ */
+void jsonwriter_beginArray(jsonwriter_t *writer) {
+  _jsonwriter_open(writer, '[');
+}
+
+/**
+ * Finish the array started last
+ */
+void jsonwriter_endArray(jsonwriter_t *writer) {
+  _jsonwriter_close(writer, ']');
+}
+
+/**
+ * Write the key of the next member of an object
+ */
+void jsonwriter_key(jsonwriter_t *writer, const char *key) {
+  _jsonwriter_separate(writer);
+  _jsonwriter_writeString(writer, key);
+  _jsonwriter_put(writer, ":", 1);
+  writer->comma = false;
+}
+
+/**
+ * Write a string, escaping what JSON needs escaped.  NULL is written as an
+ * empty string.
+ */
+void jsonwriter_string(jsonwriter_t *writer, const char *value) {
+  _jsonwriter_separate(writer);
+  _jsonwriter_writeString(writer, value);
+}
+
+void jsonwriter_int(jsonwriter_t *writer, int value) {
+  char number[JSONWRITER_MAX_NUMBER_LEN];
+
+  _jsonwriter_separate(writer);
+  _jsonwriter_put(writer, number, _jsonwriter_formatInteger(value, number));
+}
+
+void jsonwriter_double(jsonwriter_t *writer, double value) {
+  char number[JSONWRITER_MAX_NUMBER_LEN];
+
+  _jsonwriter_separate(writer);
+  _jsonwriter_put(writer, number, jsonwriter_formatNumber(value, number));
+}
+
+void jsonwriter_bool(jsonwriter_t *writer, bool value) {
+  _jsonwriter_separate(writer);
+  if(value) {
+    _jsonwriter_put(writer, "true", 4);
+  } else {
+    _jsonwriter_put(writer, "false", 5);
+  }
+}
+
+void jsonwriter_null(jsonwriter_t *writer) {
+  _jsonwriter_separate(writer);
+  _jsonwriter_put(writer, "null", 4);
+}
+
+/**
+ * Write a cJSON tree, compact like cJSON_PrintUnformatted(..).  The tree is
+ * measured first and its exact length reserved, so a growable writer grows
+ * at most once and a fixed buffer that can't hold it gets none of it.
+ *
+ * @param item Tree to write.  The top item's own name is not written; use
+ *     jsonwriter_key(..) first to make it the member of an object.
+ * @return SUCCESS if the whole tree was written
+ */
+error_t jsonwriter_item(jsonwriter_t *writer, cJSON *item) {
+  size_t total = jsonwriter_measure(item);
+  char *dst;
+
+  if((dst = _jsonwriter_claim(writer, total + (writer->comma ? 1 : 0))) == NULL) {
+    writer->comma = true;
+    return FAIL;
+  }
+
+  if(writer->comma) {
+    *dst++ = ',';
+  }
+  _jsonwriter_printItem(item, dst);
+  writer->comma = true;
+  return SUCCESS;
+}
+
+/**
+ * @return The length of the compact text of a cJSON tree, not counting
+ *     the '\0'
+ */
+size_t jsonwriter_measure(cJSON *item) {
+  char number[JSONWRITER_MAX_NUMBER_LEN];
+  cJSON *child;
+  size_t total;
+
+  switch(item->type & 0xFF) {
+  case cJSON_False:
+    return 5;
+
+  case cJSON_True:
+    return 4;
+
+  case cJSON_Number:
+    return jsonwriter_formatNumber(item->valuedouble, number);
+
+  case cJSON_String:
+    return _jsonwriter_measureString(item->valuestring);
+
+  case cJSON_Array:
+  case cJSON_Object:
+    total = 2;
+    for(child = item->child; child != NULL; child = child->next) {
+      if(child != item->child) {
+        total++;
+      }
+      if((item->type & 0xFF) == cJSON_Object) {
+        total += _jsonwriter_measureString(child->string) + 1;
+      }
+      total += jsonwriter_measure(child);
+    }
+    return total;
+
+  default:
+    return 4;
+  }
+}
+
+/**
+ * Format a number as JSON.  JSON has no infinity or NaN, so those are
+ * written as null.
+ *
+ * @param dst At least JSONWRITER_MAX_NUMBER_LEN bytes, null-terminated on return
+ * @return The length of the number
+ */
+size_t jsonwriter_formatNumber(double value, char *dst) {
+  long long scaled;
+  int length;
+
+  if(!isfinite(value)) {
+    strcpy(dst, "null");
+    return 4;
+  }
+
+  if(value == floor(value) && fabs(value) < JSONWRITER_MAX_EXACT_INTEGER) {
+    return _jsonwriter_formatInteger((long long) value, dst);
+  }
+
+  if(fabs(value) < JSONWRITER_MAX_FIXED) {
+    // Both the scaled number and the division are exact when the number
+    // really has this few decimal places
+    scaled = llround(value * JSONWRITER_FIXED_SCALE);
+    if((double) scaled / JSONWRITER_FIXED_SCALE == value) {
+      return _jsonwriter_formatFixed(scaled, dst);
+    }
+  }
+
+  length = snprintf(dst, JSONWRITER_MAX_NUMBER_LEN, "%.15g", value);
+  if(strtod(dst, NULL) != value) {
+    length = snprintf(dst, JSONWRITER_MAX_NUMBER_LEN, "%.17g", value);
+  }
+
+  return length;
+}
+
+/**
+ * @return The text written so far, which is always null-terminated
+ */
+const char *jsonwriter_text(jsonwriter_t *writer) {
+  if(writer->size == 0) {
+    return "";
+  }
+
+  return writer->buffer;
+}
+
+/**
+ * @return SUCCESS if everything written fit, and every array and object
+ *     was finished
+ */
+error_t jsonwriter_finish(jsonwriter_t *writer) {
+  if(writer->full || writer->depth != 0) {
+    return FAIL;
+  }
+
+  return SUCCESS;
+}
+
+/***************** Private Functions ****************/
+/**
+ * Make sure another 'total' bytes and the '\0' fit, growing the buffer if
+ * we're allowed to
+ *
+ * @return true if they fit
+ */
+static bool _jsonwriter_reserve(jsonwriter_t *writer, size_t total) {
+  size_t size;
+  char *buffer;
+
+  if(writer->length + total < writer->size) {
+    return true;
+  }
+
+  if(!writer->growable) {
+    return false;
+  }
+
+  size = writer->size > 0 ? writer->size : JSONWRITER_INITIAL_SIZE;
+  while(size <= writer->length + total) {
+    size *= 2;
+  }
+
+  if((buffer = realloc(writer->buffer, size)) == NULL) {
+    return false;
+  }
+
+  writer->buffer = buffer;
+  writer->size = size;
+  return true;
+}
+
+/**
+ * Claim the next 'total' bytes of the text.  Once anything doesn't fit
+ * nothing more is written, but the length keeps counting.
+ *
+ * @return Where the bytes go, already followed by the '\0', or NULL if
+ *     they don't fit
+ */
+static char *_jsonwriter_claim(jsonwriter_t *writer, size_t total) {
+  char *dst = NULL;
+
+  if(writer->full || !_jsonwriter_reserve(writer, total)) {
+    writer->full = true;
+
+  } else {
+    dst = writer->buffer + writer->length;
+    dst[total] = '\0';
+  }
+
+  writer->length += total;
+  return dst;
+}
+
+/**
+ * Append bytes to the text
+ */
+static void _jsonwriter_put(jsonwriter_t *writer, const char *bytes, size_t total) {
+  char *dst;
+
+  if((dst = _jsonwriter_claim(writer, total)) != NULL) {
+    memcpy(dst, bytes, total);
+  }
+}
+
+/**
+ * Put a comma in front of the next value if it isn't the first in its
+ * array or object
+ */
+static void _jsonwriter_separate(jsonwriter_t *writer) {
+  if(writer->comma) {
+    _jsonwriter_put(writer, ",", 1);
+  }
+  writer->comma = true;
+}
+
+static void _jsonwriter_open(jsonwriter_t *writer, char c) {
+  _jsonwriter_separate(writer);
+  _jsonwriter_put(writer, &c, 1);
+  writer->comma = false;
+  writer->depth++;
+}
+
+static void _jsonwriter_close(jsonwriter_t *writer, char c) {
+  _jsonwriter_put(writer, &c, 1);
+  writer->comma = true;
+  writer->depth--;
+}
+
+/**
+ * Write a quoted string
+ */
+static void _jsonwriter_writeString(jsonwriter_t *writer, const char *value) {
+  char *dst;
+
+  if((dst = _jsonwriter_claim(writer, _jsonwriter_measureString(value))) != NULL) {
+    _jsonwriter_printString(value, dst);
+  }
+}
+
+/**
+ * Escape a character, if it has to be
+ *
+ * @param dst Where the escape goes, or NULL to only measure it
+ * @return The length of the escape, 0 if the character goes in as it is
+ */
+static size_t _jsonwriter_escape(char c, char *dst) {
+  static const char hex[] = "0123456789abcdef";
+  const char *simple = NULL;
+
+  switch(c) {
+  case '"': simple = "\\\""; break;
+  case '\\': simple = "\\\\"; break;
+  case '\b': simple = "\\b"; break;
+  case '\f': simple = "\\f"; break;
+  case '\n': simple = "\\n"; break;
+  case '\r': simple = "\\r"; break;
+  case '\t': simple = "\\t"; break;
+  default:
+    if((unsigned char) c >= ' ') {
+      return 0;
+    }
+    break;
+  }
+
+  if(simple != NULL) {
+    if(dst != NULL) {
+      memcpy(dst, simple, 2);
+    }
+    return 2;
+  }
+
+  if(dst != NULL) {
+    memcpy(dst, "\\u00", 4);
+    dst[4] = hex[((unsigned char) c) >> 4];
+    dst[5] = hex[((unsigned char) c) & 0xF];
+  }
+  return 6;
+}
+
+/**
+ * @return The length of a string once it's quoted and escaped
+ */
+static size_t _jsonwriter_measureString(const char *value) {
+  size_t total = 2;
+
+  if(value != NULL) {
+    for(; *value != '\0'; value++) {
+      total += JSONWRITER_PLAIN(*value) ? 1 : _jsonwriter_escape(*value, NULL);
+    }
+  }
+
+  return total;
+}
+
+/**
+ * Print a quoted string into room we already know it fits in.  Runs of
+ * characters that need no escaping are copied in one go.
+ *
+ * @return The end of the string
+ */
+static char *_jsonwriter_printString(const char *value, char *dst) {
+  const char *run;
+
+  *dst++ = '"';
+
+  if(value != NULL) {
+    run = value;
+    while(*value != '\0') {
+      if(JSONWRITER_PLAIN(*value)) {
+        value++;
+        continue;
+      }
+
+      memcpy(dst, run, value - run);
+      dst += value - run;
+      dst += _jsonwriter_escape(*value, dst);
+      run = ++value;
+    }
+    memcpy(dst, run, value - run);
+    dst += value - run;
+  }
+
+  *dst++ = '"';
+  return dst;
+}
+
+/**
+ * Print a tree into room we already know it fits in
+ *
+ * @return The end of the tree
+ */
+static char *_jsonwriter_printItem(cJSON *item, char *dst) {
+  char number[JSONWRITER_MAX_NUMBER_LEN];
+  size_t length;
+  cJSON *child;
+
+  switch(item->type & 0xFF) {
+  case cJSON_False:
+    memcpy(dst, "false", 5);
+    return dst + 5;
+
+  case cJSON_True:
+    memcpy(dst, "true", 4);
+    return dst + 4;
+
+  case cJSON_Number:
+    length = jsonwriter_formatNumber(item->valuedouble, number);
+    memcpy(dst, number, length);
+    return dst + length;
+
+  case cJSON_String:
+    return _jsonwriter_printString(item->valuestring, dst);
+
+  case cJSON_Array:
+  case cJSON_Object:
+    *dst++ = ((item->type & 0xFF) == cJSON_Array) ? '[' : '{';
+    for(child = item->child; child != NULL; child = child->next) {
+      if(child != item->child) {
+        *dst++ = ',';
+      }
+      if((item->type & 0xFF) == cJSON_Object) {
+        dst = _jsonwriter_printString(child->string, dst);
+        *dst++ = ':';
+      }
+      dst = _jsonwriter_printItem(child, dst);
+    }
+    *dst++ = ((item->type & 0xFF) == cJSON_Array) ? ']' : '}';
+    return dst;
+
+  default:
+    memcpy(dst, "null", 4);
+    return dst + 4;
+  }
+}
+
+/**
+ * @param dst At least JSONWRITER_MAX_NUMBER_LEN bytes, null-terminated on return
+ * @return The length of the integer
+ */
+static size_t _jsonwriter_formatInteger(long long value, char *dst) {
+  char digits[JSONWRITER_MAX_NUMBER_LEN];
+  unsigned long long magnitude;
+  size_t length = 0;
+  int i = 0;
+
+  if(value < 0) {
+    dst[length++] = '-';
+    magnitude = -(unsigned long long) value;
+  } else {
+    magnitude = value;
+  }
+
+  do {
+    digits[i++] = '0' + (magnitude % 10);
+    magnitude /= 10;
+  } while(magnitude > 0);
+
+  while(i > 0) {
+    dst[length++] = digits[--i];
+  }
+
+  dst[length] = '\0';
+  return length;
+}
+
+/**
+ * Format a number that was scaled up by JSONWRITER_FIXED_SCALE and has a
+ * fractional part, dropping the trailing zeros of the fraction
+ *
+ * @param dst At least JSONWRITER_MAX_NUMBER_LEN bytes, null-terminated on return
+ * @return The length of the number
+ */
+static size_t _jsonwriter_formatFixed(long long scaled, char *dst) {
+  long long scale = (long long) JSONWRITER_FIXED_SCALE;
+  long long fraction;
+  size_t length = 0;
+  int i;
+
+  if(scaled < 0) {
+    dst[length++] = '-';
+    scaled = -scaled;
+  }
+
+  length += _jsonwriter_formatInteger(scaled / scale, dst + length);
+  fraction = scaled % scale;
+
+  dst[length++] = '.';
+  for(i = JSONWRITER_FIXED_DECIMALS - 1; i >= 0; i--) {
+    dst[length + i] = '0' + (fraction % 10);
+    fraction /= 10;
+  }
+  length += JSONWRITER_FIXED_DECIMALS;
+
+  while(dst[length - 1] == '0') {
+    length--;
+  }
+
+  dst[length] = '\0';
+  return length;
+}
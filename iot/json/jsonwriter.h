@@ -0,0 +1,104 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef JSONWRITER_H
+#define JSONWRITER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "cJSON.h"
+#include "ioterror.h"
+
+/** Size a growable writer starts with */
+#ifndef JSONWRITER_INITIAL_SIZE
+#define JSONWRITER_INITIAL_SIZE 256
+#endif
+
+/** Longest number we write */
+#define JSONWRITER_MAX_NUMBER_LEN 32
+
+/**
+ * Writes compact JSON text without building a cJSON tree, either into the
+ * application's own buffer or into a buffer the writer grows on the heap.
+ * The writer puts the commas in, so the caller only says what comes next.
+ *
+ * Nothing is ever written past the end of a fixed buffer.  Once something
+ * doesn't fit, the writer stops writing but keeps counting, so
+ * jsonwriter_finish(..) fails and 'length' tells how big the buffer needed
+ * to be.
+ */
+typedef struct jsonwriter_t {
+
+  /** Where the text goes, and how many bytes that is including the '\0' */
+  char *buffer;
+  size_t size;
+
+  /** Length of the text, which keeps counting after the buffer is full */
+  size_t length;
+
+  /** Arrays and objects that are still open */
+  int depth;
+
+  /** True if the next key or value needs a comma in front of it */
+  bool comma;
+
+  /** True if the buffer comes from the heap and grows */
+  bool growable;
+
+  /** True once something didn't fit */
+  bool full;
+
+} jsonwriter_t;
+
+/***************** Public Prototypes ****************/
+void jsonwriter_init(jsonwriter_t *writer, char *buffer, size_t size);
+
+void jsonwriter_destroy(jsonwriter_t *writer);
+
+void jsonwriter_beginObject(jsonwriter_t *writer);
+
+void jsonwriter_endObject(jsonwriter_t *writer);
+
+void jsonwriter_beginArray(jsonwriter_t *writer);
+
+void jsonwriter_endArray(jsonwriter_t *writer);
+
+void jsonwriter_key(jsonwriter_t *writer, const char *key);
+
+void jsonwriter_string(jsonwriter_t *writer, const char *value);
+
+void jsonwriter_int(jsonwriter_t *writer, int value);
+
+void jsonwriter_double(jsonwriter_t *writer, double value);
+
+void jsonwriter_bool(jsonwriter_t *writer, bool value);
+
+void jsonwriter_null(jsonwriter_t *writer);
+
+error_t jsonwriter_item(jsonwriter_t *writer, cJSON *item);
+
+size_t jsonwriter_measure(cJSON *item);
+
+size_t jsonwriter_formatNumber(double value, char *dst);
+
+const char *jsonwriter_text(jsonwriter_t *writer);
+
+error_t jsonwriter_finish(jsonwriter_t *writer);
+
+#endif
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2011 People Power Company
+ * All rights reserved.
+ *
+ * This open source code was developed with funding from People Power Company
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the People Power Corporation nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * PEOPLE POWER CO. OR ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE
+ */
+
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "cppunit/extensions/HelperMacros.h"
+
+#include "jsonarena_test.h"
+
+extern "C" {
+#include "jsonarena.h"
+}
+
+/** A thermostat's /tstat body */
+#define JSONARENA_TEST_TSTAT "{\"temp\":72.50,\"tmode\":2,\"fmode\":0,\"override\":0,\"hold\":0,\"t_cool\":75.00,\"time\":{\"day\":3,\"hour\":14,\"minute\":22},\"tstate\":2,\"fstate\":1}"
+
+CPPUNIT_TEST_SUITE_REGISTRATION( JsonArenaTest );
+
+
+void JsonArenaTest::testParse(void) {
+  char buffer[4096];
+  jsonarena_t arena;
+  cJSON *root;
+  cJSON *time;
+  cJSON *array;
+
+  jsonarena_init(&arena, buffer, sizeof(buffer));
+
+  root = jsonarena_parse(&arena, JSONARENA_TEST_TSTAT);
+  CPPUNIT_ASSERT_MESSAGE("Didn't parse the thermostat's status\n", root != NULL && root->type == cJSON_Object);
+  CPPUNIT_ASSERT_MESSAGE("Wrong temp\n", cJSON_GetObjectItem(root, "temp")->valuedouble == 72.5);
+  CPPUNIT_ASSERT_MESSAGE("Wrong tmode\n", cJSON_GetObjectItem(root, "tmode")->valueint == 2);
+  CPPUNIT_ASSERT_MESSAGE("Found a key that isn't there\n", cJSON_GetObjectItem(root, "t_heat") == NULL);
+
+  time = cJSON_GetObjectItem(root, "time");
+  CPPUNIT_ASSERT_MESSAGE("Didn't parse the nested object\n", time != NULL && time->type == cJSON_Object);
+  CPPUNIT_ASSERT_MESSAGE("Wrong minute\n", cJSON_GetObjectItem(time, "minute")->valueint == 22);
+
+  array = jsonarena_parse(&arena, " [ -1, 3.5e2, true, false, null, [] ] ");
+  CPPUNIT_ASSERT_MESSAGE("Didn't parse the array\n", array != NULL && cJSON_GetArraySize(array) == 6);
+  CPPUNIT_ASSERT_MESSAGE("Wrong negative number\n", cJSON_GetArrayItem(array, 0)->valueint == -1);
+  CPPUNIT_ASSERT_MESSAGE("Wrong exponent\n", cJSON_GetArrayItem(array, 1)->valuedouble == 350.0);
+  CPPUNIT_ASSERT_MESSAGE("Wrong literals\n", cJSON_GetArrayItem(array, 2)->type == cJSON_True
+      && cJSON_GetArrayItem(array, 3)->type == cJSON_False
+      && cJSON_GetArrayItem(array, 4)->type == cJSON_NULL);
+  CPPUNIT_ASSERT_MESSAGE("Wrong empty array\n", cJSON_GetArrayItem(array, 5)->type == cJSON_Array
+      && cJSON_GetArrayItem(array, 5)->child == NULL);
+
+  CPPUNIT_ASSERT_MESSAGE("Second parse clobbered the first\n", cJSON_GetObjectItem(root, "fstate")->valueint == 1);
+}
+
+void JsonArenaTest::testStrings(void) {
+  char buffer[1024];
+  jsonarena_t arena;
+  cJSON *root;
+
+  jsonarena_init(&arena, buffer, sizeof(buffer));
+
+  root = jsonarena_parse(&arena, "{\"model\":\"CT30 \\\"V1.94\\\"\",\"path\":\"a\\/b\\\\c\\n\",\"name\":\"caf\\u00e9 \\ud83d\\ude00\"}");
+  CPPUNIT_ASSERT_MESSAGE("Didn't parse the strings\n", root != NULL);
+  CPPUNIT_ASSERT_MESSAGE("Didn't decode escaped quotes\n", strcmp(cJSON_GetObjectItem(root, "model")->valuestring, "CT30 \"V1.94\"") == 0);
+  CPPUNIT_ASSERT_MESSAGE("Didn't decode escapes\n", strcmp(cJSON_GetObjectItem(root, "path")->valuestring, "a/b\\c\n") == 0);
+  CPPUNIT_ASSERT_MESSAGE("Didn't decode unicode to UTF-8\n", strcmp(cJSON_GetObjectItem(root, "name")->valuestring, "caf\xC3\xA9 \xF0\x9F\x98\x80") == 0);
+}
+
+void JsonArenaTest::testMalformed(void) {
+  const char *malformed[] = { "", "{", "[1,", "[1 2]", "{\"a\"}", "{\"a\":}", "{\"a\":1,}", "tru", "\"abc", "-", "1.", "1e", "\"\\ud800\"", NULL };
+  char buffer[1024];
+  char deep[64];
+  jsonarena_t arena;
+  int i;
+
+  jsonarena_init(&arena, buffer, sizeof(buffer));
+
+  for(i = 0; malformed[i] != NULL; i++) {
+    CPPUNIT_ASSERT_MESSAGE("Parsed malformed JSON\n", jsonarena_parse(&arena, malformed[i]) == NULL);
+  }
+  CPPUNIT_ASSERT_MESSAGE("Failed parses kept memory from the arena\n", arena.used == 0);
+
+  memset(deep, '[', sizeof(deep) - 1);
+  deep[sizeof(deep) - 1] = '\0';
+  CPPUNIT_ASSERT_MESSAGE("Parsed JSON nested too deep\n", jsonarena_parse(&arena, deep) == NULL);
+}
+
+void JsonArenaTest::testFixedBuffer(void) {
+  char buffer[256];
+  jsonarena_t arena;
+
+  jsonarena_init(&arena, buffer, sizeof(buffer));
+  CPPUNIT_ASSERT_MESSAGE("Parsed into an arena that's too small\n", jsonarena_parse(&arena, JSONARENA_TEST_TSTAT) == NULL);
+  CPPUNIT_ASSERT_MESSAGE("Couldn't parse a small message after a failure\n", jsonarena_parse(&arena, "{\"a\":1}") != NULL);
+}
+
+void JsonArenaTest::testReset(void) {
+  jsonarena_t *arena = jsonarena_local();
+  jsonarena_chunk_t *chunk;
+  int chunks = 0;
+  int i;
+
+  CPPUNIT_ASSERT_MESSAGE("Got a different arena on the same thread\n", jsonarena_local() == arena);
+
+  for(i = 0; i < 100; i++) {
+    CPPUNIT_ASSERT_MESSAGE("Couldn't parse into the growing arena\n", jsonarena_parse(arena, JSONARENA_TEST_TSTAT) != NULL);
+  }
+
+  for(chunk = arena->head; chunk != NULL; chunk = chunk->next) {
+    chunks++;
+  }
+  CPPUNIT_ASSERT_MESSAGE("The arena didn't grow\n", chunks > 1);
+
+  jsonarena_reset(arena);
+  for(i = 0; i < 100; i++) {
+    jsonarena_parse(arena, JSONARENA_TEST_TSTAT);
+  }
+
+  for(chunk = arena->head; chunk != NULL; chunk = chunk->next) {
+    chunks--;
+  }
+  CPPUNIT_ASSERT_MESSAGE("The arena allocated again after a reset\n", chunks == 0);
+
+  jsonarena_reset(arena);
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2011 People Power Company
+ * All rights reserved.
+ *
+ * This open source code was developed with funding from People Power Company
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the People Power Corporation nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * PEOPLE POWER CO. OR ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE
+ */
+
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "cppunit/extensions/HelperMacros.h"
+
+#include "jsonschema_test.h"
+
+extern "C" {
+#include "ioterror.h"
+#include "jsonschema.h"
+}
+
+/** A record like the ones the agents keep for their devices */
+typedef struct jsonschema_test_t {
+  char model[8];
+  int tmode;
+  double temp;
+  bool on;
+} jsonschema_test_t;
+
+enum {
+  JSONSCHEMA_TEST_MODEL,
+  JSONSCHEMA_TEST_TMODE,
+  JSONSCHEMA_TEST_TEMP,
+  JSONSCHEMA_TEST_ON,
+};
+
+static const jsonschema_field_t sFields[] = {
+  JSONSCHEMA_FIELD("model", JSONSCHEMA_STRING, jsonschema_test_t, model, false),
+  JSONSCHEMA_FIELD("tmode", JSONSCHEMA_INT, jsonschema_test_t, tmode, false),
+  JSONSCHEMA_FIELD("temp", JSONSCHEMA_DOUBLE, jsonschema_test_t, temp, false),
+  JSONSCHEMA_FIELD("on", JSONSCHEMA_BOOL, jsonschema_test_t, on, false),
+  JSONSCHEMA_END,
+};
+
+static const jsonschema_field_t sRequiredFields[] = {
+  JSONSCHEMA_FIELD("model", JSONSCHEMA_STRING, jsonschema_test_t, model, true),
+  JSONSCHEMA_FIELD("tmode", JSONSCHEMA_INT, jsonschema_test_t, tmode, false),
+  JSONSCHEMA_END,
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION( JsonSchemaTest );
+
+
+void JsonSchemaTest::testExtract(void) {
+  jsonschema_test_t record;
+  unsigned int found;
+
+  memset(&record, 0x0, sizeof(record));
+  CPPUNIT_ASSERT_MESSAGE("Didn't extract the fields\n", jsonschema_extract(sFields,
+      "{\"time\":{\"day\":3,\"list\":[1,{\"temp\":1}]},\"temp\":72.5,\"tmode\":2,\"x\":null,\"on\":true,\"model\":\"CT30\"}",
+      &record, &found) == SUCCESS);
+
+  CPPUNIT_ASSERT_MESSAGE("Wrong temp\n", record.temp == 72.5);
+  CPPUNIT_ASSERT_MESSAGE("Wrong tmode\n", record.tmode == 2);
+  CPPUNIT_ASSERT_MESSAGE("Wrong on\n", record.on);
+  CPPUNIT_ASSERT_MESSAGE("Wrong model\n", strcmp(record.model, "CT30") == 0);
+  CPPUNIT_ASSERT_MESSAGE("Didn't find every field\n", JSONSCHEMA_FOUND(found, JSONSCHEMA_TEST_MODEL)
+      && JSONSCHEMA_FOUND(found, JSONSCHEMA_TEST_TMODE)
+      && JSONSCHEMA_FOUND(found, JSONSCHEMA_TEST_TEMP)
+      && JSONSCHEMA_FOUND(found, JSONSCHEMA_TEST_ON));
+
+  // Missing fields keep their defaults, and the first of duplicate keys counts
+  record.tmode = -1;
+  CPPUNIT_ASSERT_MESSAGE("Didn't extract the duplicates\n", jsonschema_extract(sFields, "{\"temp\":70,\"temp\":80}", &record, &found) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Didn't keep the first duplicate\n", record.temp == 70.0);
+  CPPUNIT_ASSERT_MESSAGE("Overwrote a missing field\n", record.tmode == -1 && !JSONSCHEMA_FOUND(found, JSONSCHEMA_TEST_TMODE));
+
+  CPPUNIT_ASSERT_MESSAGE("Didn't extract an empty object\n", jsonschema_extract(sFields, " { } ", &record, &found) == SUCCESS && found == 0);
+}
+
+void JsonSchemaTest::testTypes(void) {
+  jsonschema_test_t record;
+  unsigned int found;
+
+  memset(&record, 0x0, sizeof(record));
+  CPPUNIT_ASSERT_MESSAGE("Didn't extract the fields\n", jsonschema_extract(sFields,
+      "{\"model\":\"CT80 \\\"Rev B\\\"\",\"tmode\":-1.5,\"temp\":\"hot\",\"on\":1}",
+      &record, &found) == SUCCESS);
+
+  CPPUNIT_ASSERT_MESSAGE("Didn't truncate the string\n", strcmp(record.model, "CT80 \"R") == 0);
+  CPPUNIT_ASSERT_MESSAGE("Didn't truncate the number\n", record.tmode == -1);
+  CPPUNIT_ASSERT_MESSAGE("Stored a string in a number\n", record.temp == 0 && !JSONSCHEMA_FOUND(found, JSONSCHEMA_TEST_TEMP));
+  CPPUNIT_ASSERT_MESSAGE("Didn't take a number as a bool\n", record.on && JSONSCHEMA_FOUND(found, JSONSCHEMA_TEST_ON));
+
+  // A UTF-8 sequence that doesn't fit is dropped whole, and the string ends
+  // right after what did, whatever the field held before
+  memset(record.model, 'X', sizeof(record.model));
+  CPPUNIT_ASSERT_MESSAGE("Didn't extract the UTF-8 string\n", jsonschema_extract(sFields,
+      "{\"model\":\"abcde\xf0\x9f\x98\x80zz\"}", &record, &found) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Didn't cut the UTF-8 string before the sequence\n", strcmp(record.model, "abcde") == 0);
+
+  memset(record.model, 'X', sizeof(record.model));
+  CPPUNIT_ASSERT_MESSAGE("Didn't extract the escaped string\n", jsonschema_extract(sFields,
+      "{\"model\":\"abcd\\u00e9\\u00e9\"}", &record, &found) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Didn't cut the escaped string before the sequence\n", strcmp(record.model, "abcd\xc3\xa9") == 0);
+}
+
+void JsonSchemaTest::testRequired(void) {
+  jsonschema_test_t record;
+
+  memset(&record, 0x0, sizeof(record));
+  CPPUNIT_ASSERT_MESSAGE("Extracted without a required field\n", jsonschema_extract(sRequiredFields, "{\"tmode\":1}", &record, NULL) == FAIL);
+  CPPUNIT_ASSERT_MESSAGE("Extracted with a required field of the wrong type\n", jsonschema_extract(sRequiredFields, "{\"model\":5}", &record, NULL) == FAIL);
+  CPPUNIT_ASSERT_MESSAGE("Didn't extract the required field\n", jsonschema_extract(sRequiredFields, "{\"model\":\"CT30\"}", &record, NULL) == SUCCESS);
+}
+
+void JsonSchemaTest::testMalformed(void) {
+  const char *malformed[] = { "", "[]", "{", "{\"model\"}", "{\"model\":}", "{\"tmode\":1,}", "{\"x\":[1 2]}", "{\"x\":tru}", "{\"model\":\"abc", NULL };
+  jsonschema_test_t record;
+  int i;
+
+  for(i = 0; malformed[i] != NULL; i++) {
+    CPPUNIT_ASSERT_MESSAGE("Extracted from malformed JSON\n", jsonschema_extract(sFields, malformed[i], &record, NULL) == FAIL);
+  }
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2011 People Power Company
+ * All rights reserved.
+ *
+ * This open source code was developed with funding from People Power Company
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the People Power Corporation nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * PEOPLE POWER CO. OR ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cppunit/extensions/HelperMacros.h"
+
+#include "jsonwriter_test.h"
+
+extern "C" {
+#include "ioterror.h"
+#include "cJSON.h"
+#include "jsonwriter.h"
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION( JsonWriterTest );
+
+
+void JsonWriterTest::testWrite(void) {
+  jsonwriter_t writer;
+  char buffer[128];
+
+  jsonwriter_init(&writer, buffer, sizeof(buffer));
+  jsonwriter_beginObject(&writer);
+  jsonwriter_key(&writer, "tmode");
+  jsonwriter_int(&writer, 2);
+  jsonwriter_key(&writer, "time");
+  jsonwriter_beginObject(&writer);
+  jsonwriter_key(&writer, "day");
+  jsonwriter_int(&writer, -1);
+  jsonwriter_key(&writer, "hour");
+  jsonwriter_int(&writer, 13);
+  jsonwriter_endObject(&writer);
+  jsonwriter_key(&writer, "list");
+  jsonwriter_beginArray(&writer);
+  jsonwriter_bool(&writer, true);
+  jsonwriter_null(&writer);
+  jsonwriter_beginArray(&writer);
+  jsonwriter_endArray(&writer);
+  jsonwriter_string(&writer, "a\"b\\c\n\x01\xc3\xa9");
+  jsonwriter_endArray(&writer);
+  jsonwriter_endObject(&writer);
+
+  CPPUNIT_ASSERT_MESSAGE("Didn't finish\n", jsonwriter_finish(&writer) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Wrong text\n", strcmp(jsonwriter_text(&writer),
+      "{\"tmode\":2,\"time\":{\"day\":-1,\"hour\":13},\"list\":[true,null,[],\"a\\\"b\\\\c\\n\\u0001\xc3\xa9\"]}") == 0);
+  CPPUNIT_ASSERT_MESSAGE("Wrong length\n", writer.length == strlen(buffer));
+
+  // An object that's never finished
+  jsonwriter_init(&writer, buffer, sizeof(buffer));
+  jsonwriter_beginObject(&writer);
+  CPPUNIT_ASSERT_MESSAGE("Finished an open object\n", jsonwriter_finish(&writer) == FAIL);
+}
+
+void JsonWriterTest::testNumbers(void) {
+  char number[JSONWRITER_MAX_NUMBER_LEN];
+  double values[] = { 0, -0.0, 72, -40, 72.5, -0.25, 0.1, 1.000001, 123456.789, 2147483648.0, -9007199254740991.0, 1e300, 1.0 / 3, 1e-7 };
+  const char *expected[] = { "0", "0", "72", "-40", "72.5", "-0.25", "0.1", "1.000001", "123456.789", "2147483648", "-9007199254740991", "1e+300", "0.33333333333333331", "1e-07" };
+  unsigned int i;
+
+  for(i = 0; i < sizeof(values) / sizeof(double); i++) {
+    CPPUNIT_ASSERT_MESSAGE("Wrong length\n", jsonwriter_formatNumber(values[i], number) == strlen(expected[i]));
+    CPPUNIT_ASSERT_MESSAGE("Wrong number\n", strcmp(number, expected[i]) == 0);
+    CPPUNIT_ASSERT_MESSAGE("Doesn't read back\n", strtod(number, NULL) == values[i]);
+  }
+
+  jsonwriter_formatNumber(1.0 / 0.0, number);
+  CPPUNIT_ASSERT_MESSAGE("Wrote infinity\n", strcmp(number, "null") == 0);
+}
+
+void JsonWriterTest::testFull(void) {
+  jsonwriter_t writer;
+  char buffer[16];
+
+  memset(buffer, 'x', sizeof(buffer));
+  jsonwriter_init(&writer, buffer, 12);
+  jsonwriter_beginObject(&writer);
+  jsonwriter_key(&writer, "t_heat");
+  jsonwriter_double(&writer, 68.5);
+  jsonwriter_endObject(&writer);
+
+  CPPUNIT_ASSERT_MESSAGE("Finished a full buffer\n", jsonwriter_finish(&writer) == FAIL);
+  CPPUNIT_ASSERT_MESSAGE("Didn't count what didn't fit\n", writer.length == strlen("{\"t_heat\":68.5}"));
+  CPPUNIT_ASSERT_MESSAGE("Wrote past the buffer\n", buffer[12] == 'x');
+  CPPUNIT_ASSERT_MESSAGE("Didn't terminate the text\n", strlen(jsonwriter_text(&writer)) < 12);
+
+  // Exactly enough room
+  jsonwriter_init(&writer, buffer, writer.length + 1);
+  jsonwriter_beginObject(&writer);
+  jsonwriter_key(&writer, "t_heat");
+  jsonwriter_double(&writer, 68.5);
+  jsonwriter_endObject(&writer);
+  CPPUNIT_ASSERT_MESSAGE("Didn't fit\n", jsonwriter_finish(&writer) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Wrong text\n", strcmp(buffer, "{\"t_heat\":68.5}") == 0);
+}
+
+void JsonWriterTest::testGrowable(void) {
+  jsonwriter_t writer;
+  int i;
+
+  jsonwriter_init(&writer, NULL, 0);
+  CPPUNIT_ASSERT_MESSAGE("Empty text\n", strcmp(jsonwriter_text(&writer), "") == 0);
+
+  jsonwriter_beginArray(&writer);
+  for(i = 0; i < 1000; i++) {
+    jsonwriter_int(&writer, i);
+  }
+  jsonwriter_endArray(&writer);
+
+  CPPUNIT_ASSERT_MESSAGE("Didn't grow\n", jsonwriter_finish(&writer) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Wrong length\n", writer.length == strlen(jsonwriter_text(&writer)) && writer.length > JSONWRITER_INITIAL_SIZE);
+  CPPUNIT_ASSERT_MESSAGE("Wrong text\n", strncmp(jsonwriter_text(&writer), "[0,1,2,", 7) == 0
+      && strcmp(jsonwriter_text(&writer) + writer.length - 5, ",999]") == 0);
+
+  jsonwriter_destroy(&writer);
+}
+
+void JsonWriterTest::testItem(void) {
+  const char *text = "{\"temp\":72.5,\"tmode\":2,\"name\":\"a\\\"b\",\"on\":false,\"x\":null,\"time\":{\"day\":3,\"list\":[1,-2.25,{}]}}";
+  jsonwriter_t writer;
+  char buffer[128];
+  cJSON *tree;
+
+  tree = cJSON_Parse(text);
+  CPPUNIT_ASSERT_MESSAGE("Couldn't parse\n", tree != NULL);
+  CPPUNIT_ASSERT_MESSAGE("Wrong measurement\n", jsonwriter_measure(tree) == strlen(text));
+
+  jsonwriter_init(&writer, buffer, sizeof(buffer));
+  CPPUNIT_ASSERT_MESSAGE("Didn't write the tree\n", jsonwriter_item(&writer, tree) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Wrong text\n", strcmp(buffer, text) == 0);
+
+  // Inside an array of our own, after another value
+  jsonwriter_init(&writer, buffer, sizeof(buffer));
+  jsonwriter_beginArray(&writer);
+  jsonwriter_int(&writer, 1);
+  jsonwriter_item(&writer, cJSON_GetObjectItem(tree, "time"));
+  jsonwriter_endArray(&writer);
+  CPPUNIT_ASSERT_MESSAGE("Didn't finish\n", jsonwriter_finish(&writer) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Wrong text\n", strcmp(buffer, "[1,{\"day\":3,\"list\":[1,-2.25,{}]}]") == 0);
+
+  // A tree that doesn't fit isn't written at all
+  jsonwriter_init(&writer, buffer, 16);
+  jsonwriter_beginArray(&writer);
+  CPPUNIT_ASSERT_MESSAGE("Wrote a tree that didn't fit\n", jsonwriter_item(&writer, tree) == FAIL);
+  CPPUNIT_ASSERT_MESSAGE("Wrote part of the tree\n", strcmp(buffer, "[") == 0);
+  CPPUNIT_ASSERT_MESSAGE("Didn't count the tree\n", writer.length == strlen(text) + 1);
+
+  // A growable writer makes room for the whole tree at once
+  jsonwriter_init(&writer, NULL, 0);
+  CPPUNIT_ASSERT_MESSAGE("Didn't grow for the tree\n", jsonwriter_item(&writer, tree) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Wrong grown text\n", strcmp(jsonwriter_text(&writer), text) == 0);
+  jsonwriter_destroy(&writer);
+
+  cJSON_Delete(tree);
+}
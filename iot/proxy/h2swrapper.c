@@ -29,40 +29,123 @@
 #include <stdio.h>
 
 #include "eui64.h"
+#include "hubid.h"
 #include "ioterror.h"
 #include "iotdebug.h"
+#include "iotcodec.h"
+#include "proxyconfig.h"
+#include "h2swrapper.h"
+
+/** Closes every XML message to the server */
+#define H2SWRAPPER_FOOTER "</h2s>"
 
 static uint32_t sequenceNum = 0;
 
 /**
- * Wraps the message to the server inside an XML header and footer
+ * Frame a message to the server once, so it can be sent as many times as it
+ * takes with the same sequence number. An XML message is framed in place:
+ * the header, the message and the footer are sent one after the other
+ * without copying them together. In other codecs the message has to be
+ * translated anyway, so it's written out whole to the scratch buffer.
+ *
+ * @param frame Frame to fill in
+ * @param message The null-terminated XML message to wrap. Must not change
+ *     while the frame is in use.
+ * @param scratch Buffer for messages translated to another codec
+ * @param scratchSize Size of the scratch buffer
+ * @return Number of bytes in the framed message, or -1 for error
+ */
+int h2swrapper_frame(h2swrapper_frame_t *frame, const char *message, char *scratch, int scratchSize) {
+  char localAddress[EUI64_STRING_SIZE];
+  char seq[16];
+  const char *atts[] = { "ver", "2", "hubId", localAddress, "seq", seq, NULL };
+  iotcodec_writer_t w;
+
+  assert(frame);
+  assert(message);
+
+  frame->seq = ++sequenceNum;
+  frame->codec = proxyconfig_getCodec();
+  frame->totalSegments = 0;
+  frame->len = -1;
+
+  hubid_get(localAddress, sizeof(localAddress));
+
+  if(frame->codec != &iotcodecxml) {
+    if(scratch == NULL) {
+      return -1;
+    }
+
+    // Agents always give us XML, translate it as we wrap it
+    snprintf(seq, sizeof(seq), "%u", frame->seq);
+
+    iotcodec_initWriter(&w, frame->codec, scratch, scratchSize);
+    iotcodec_startElement(&w, "h2s", atts);
+    if(iotcodec_copy(&w, &iotcodecxml, message, strlen(message)) != SUCCESS) {
+      return -1;
+    }
+
+    iotcodec_endElement(&w, "h2s");
+    frame->len = iotcodec_finish(&w);
+
+    if(frame->len >= 0) {
+      frame->segments[0].iov_base = scratch;
+      frame->segments[0].iov_len = frame->len;
+      frame->totalSegments = 1;
+    }
+
+    return frame->len;
+  }
+
+  snprintf(frame->header, sizeof(frame->header),
+      "<?xml version=\"1.0\" encoding=\"utf-8\" ?>"
+        "<h2s ver=\"2\" hubId=\"%s\" seq=\"%u\">", localAddress, frame->seq);
+
+  frame->segments[0].iov_base = frame->header;
+  frame->segments[0].iov_len = strlen(frame->header);
+  frame->segments[1].iov_base = (char *) message;
+  frame->segments[1].iov_len = strlen(message);
+  frame->segments[2].iov_base = H2SWRAPPER_FOOTER;
+  frame->segments[2].iov_len = strlen(H2SWRAPPER_FOOTER);
+  frame->totalSegments = 3;
+
+  frame->len = frame->segments[0].iov_len + frame->segments[1].iov_len + frame->segments[2].iov_len;
+  return frame->len;
+}
+
+/**
+ * Wraps the message to the server inside an XML header and footer, or
+ * the header of the codec selected for the server, in one buffer
  *
  * @param msg The message to wrap
  * @param maxSize The maximum size of the message buffer
- * @param sequenceNum Sequence number of the XML message
  * @return Number of bytes written or -1 for error
  */
 int h2swrapper_wrap(char *dest, char *message, int destSize) {
+  h2swrapper_frame_t frame;
   int bytesWritten = 0;
-  char localAddress[EUI64_STRING_SIZE];
+  int i;
 
   assert(dest);
-  assert(message);
-
-  sequenceNum++;
 
-  eui64_toString(localAddress, sizeof(localAddress));
+  if(h2swrapper_frame(&frame, message, dest, destSize) < 0) {
+    return -1;
+  }
 
-  bytesWritten += snprintf(dest, destSize - bytesWritten,
-      "<?xml version=\"1.0\" encoding=\"utf-8\" ?>"
-        "<h2s ver=\"2\" hubId=\"%s\" seq=\"%u\">", localAddress, sequenceNum);
-
-  strncpy(dest + bytesWritten, message, destSize - bytesWritten);
+  if(frame.codec != &iotcodecxml) {
+    // Already written to dest
+    return frame.len;
+  }
 
-  bytesWritten += strlen(message);
+  if(frame.len >= destSize) {
+    return -1;
+  }
 
-  bytesWritten += snprintf(dest + bytesWritten, destSize - bytesWritten, "</h2s>");
+  for(i = 0; i < frame.totalSegments; i++) {
+    memcpy(dest + bytesWritten, frame.segments[i].iov_base, frame.segments[i].iov_len);
+    bytesWritten += frame.segments[i].iov_len;
+  }
 
+  dest[bytesWritten] = '\0';
   return bytesWritten;
 }
-
@@ -19,7 +19,44 @@
 #ifndef H2SWRAPPER_H
 #define H2SWRAPPER_H
 
+#include <stdint.h>
+#include <sys/uio.h>
+#include "iotcodec.h"
+
+/** Maximum size of the XML header, including the null */
+#ifndef H2SWRAPPER_HEADER_SIZE
+#define H2SWRAPPER_HEADER_SIZE 128
+#endif
+
+/** Header, message and footer */
+#define H2SWRAPPER_MAX_SEGMENTS 3
+
+/**
+ * A message to the server, framed once and sent as many times as needed
+ */
+typedef struct h2swrapper_frame_t {
+
+  /** Sequence number, the same on every retry so the server can drop duplicates */
+  uint32_t seq;
+
+  /** Codec the message was framed in */
+  const iotcodec_t *codec;
+
+  /** XML header */
+  char header[H2SWRAPPER_HEADER_SIZE];
+
+  /** Pieces of the framed message, in order */
+  struct iovec segments[H2SWRAPPER_MAX_SEGMENTS];
+  int totalSegments;
+
+  /** Total length of the framed message */
+  int len;
+
+} h2swrapper_frame_t;
+
 /***************** Public Prototypes ****************/
+int h2swrapper_frame(h2swrapper_frame_t *frame, const char *message, char *scratch, int scratchSize);
+
 int h2swrapper_wrap(char *dest, char *message, int destSize);
 
 #endif
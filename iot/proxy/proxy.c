@@ -54,14 +54,21 @@
 #include <stdbool.h>
 #include <rpc/types.h>
 #include <fcntl.h>
+#include <time.h>
 
 #include "libpipecomm.h"
 #include "libhttpcomm.h"
+#include "libmetrics.h"
 #include "proxy.h"
 #include "proxylisteners.h"
 #include "proxyconfig.h"
+#include "proxyspool.h"
+#include "proxycapture.h"
 #include "h2swrapper.h"
+#include "iotcodec.h"
 #include "eui64.h"
+#include "hubid.h"
+#include "iottrace.h"
 #include "ioterror.h"
 #include "iotdebug.h"
 
@@ -90,6 +97,28 @@ static char sMsgToServer[PROXY_MAX_HTTP_SEND_MESSAGE_LEN];
 /** Size of the message to send to the server */
 static uint16_t sMsgToServerLen = 0;
 
+/** False while we can't contact the server and are spooling measurements */
+static bool sServerReachable = true;
+
+/** True once part of the current response went to the chunk listeners */
+static bool sResponseDispatched;
+
+/** Server response translated to XML for the listeners, as big as the response buffer */
+static char sDecodedMsg[PROXY_MAX_RESPONSE_LEN];
+
+/** Message to the server translated to a codec other than XML */
+static char sEncodedMsg[PROXY_MAX_HTTP_SEND_MESSAGE_LEN];
+
+/** Proxy metrics */
+static libmetrics_t *sPushes;
+static libmetrics_t *sPushRetries;
+static libmetrics_t *sPushUnreachable;
+static libmetrics_t *sPushDuration;
+static libmetrics_t *sPolls;
+static libmetrics_t *sQueueBytes;
+static libmetrics_t *sSpoolBytes;
+static libmetrics_t *sContModeMs;
+
 
 /***************** Private Prototypes ***************/
 static void *_serverCommThread(void *params);
@@ -100,6 +129,12 @@ static void _serverCommPoll(CURLSH * curlHandle, char *pollMsg, int pollMsgMaxLe
 
 int _httpProgressCallback(void *clientp, double dltotal, double dlnow, double ultotal, double ulnow);
 
+static void _httpRxCallback(const char *chunk, int len, void *arg);
+
+static error_t _serverCommDecode(char *response, int responseLen, int responseMaxLen);
+
+static double _proxy_now();
+
 
 /***************** Proxy Public ****************/
 /**
@@ -112,6 +147,16 @@ error_t proxy_start(const char *url) {
 
 	proxyconfig_start();
 	proxylisteners_start();
+	proxyspool_start();
+
+  sPushes = libmetrics_counter("proxy_push_total", "Messages pushed to the server");
+  sPushRetries = libmetrics_counter("proxy_push_retries_total", "Pushes sent again after an error");
+  sPushUnreachable = libmetrics_counter("proxy_push_unreachable_total", "Pushes spooled because the server was unreachable");
+  sPushDuration = libmetrics_histogram("proxy_push_seconds", "Time to push a message, including retries");
+  sPolls = libmetrics_counter("proxy_polls_total", "Persistent GET connections opened to the server");
+  sQueueBytes = libmetrics_gauge("proxy_queue_bytes", "Bytes read from the agents and waiting to be pushed");
+  sSpoolBytes = libmetrics_gauge("proxy_spool_bytes", "Bytes of measurements spooled for later");
+  sContModeMs = libmetrics_counter("proxy_cont_mode_milliseconds_total", "Time spent pushing in continuous mode instead of polling");
   pthread_mutex_init(&sProxyToServerMutex, NULL);
 
 	if(proxyconfig_setUrl(url) != SUCCESS) {
@@ -172,6 +217,8 @@ error_t proxy_start(const char *url) {
 void proxy_stop() {
   proxyconfig_stop();
   proxylisteners_stop();
+  proxyspool_stop();
+  proxycapture_stop();
   pthread_mutex_destroy(&sProxyToServerMutex);
   gTerminate = true;
 }
@@ -196,6 +243,27 @@ error_t proxy_removeListener(proxylistener l) {
   return proxylisteners_removeListener(l);
 }
 
+/**
+ * Add a listener to receive messages from the server piece by piece as they
+ * arrive. This is a convenience function that simply forwards to the
+ * proxylisteners module.
+ *
+ * @param listener Function pointer to a function(const char *chunk, int len)
+ */
+error_t proxy_addChunkListener(proxychunklistener l) {
+  return proxylisteners_addChunkListener(l);
+}
+
+/**
+ * Remove a chunk listener. This is a convenience function that simply
+ * forwards to the proxylisteners module.
+ *
+ * @param listener Function pointer to a function(const char *chunk, int len)
+ */
+error_t proxy_removeChunkListener(proxychunklistener l) {
+  return proxylisteners_removeChunkListener(l);
+}
+
 /**
  * Use this function to send a message to the server.
  *
@@ -223,11 +291,14 @@ error_t proxy_send(const char *data, int len) {
  * Main thread function for server communication
  */
 static void *_serverCommThread(void *params) {
-  char msgFromServer[PROXY_MAX_MSG_LEN];
+  char msgFromServer[PROXY_MAX_RESPONSE_LEN];
   bool poll = true;
   int msgLen = 0;
   int forcedPushLoops = 0;
   bool sentEmptyMsg = false;
+  bool contMode = false;
+  double loopStart = _proxy_now();
+  double now;
   CURLSH *curlHandle = NULL; // curl handle shared across connections for DNS caching
 
   // Sleep briefly to obtain init messages from application
@@ -245,6 +316,20 @@ static void *_serverCommThread(void *params) {
   while (!gTerminate) {
     sentEmptyMsg = false;
 
+    // Count the time the last loop spent in CONT mode
+    now = _proxy_now();
+    if (contMode) {
+      libmetrics_add(sContModeMs, (uint64_t) ((now - loopStart) * 1000));
+    }
+    loopStart = now;
+    contMode = !poll;
+
+    // Catch up on measurements spooled while the server was unreachable,
+    // leaving room to read what the agents are sending now
+    if (sServerReachable && sMsgToServerLen == 0 && !proxyspool_isEmpty()) {
+      sMsgToServerLen = proxyspool_expand(sMsgToServer, sizeof(sMsgToServer) - PROXY_MAX_MSG_LEN);
+    }
+
     // Read until the pipe is empty or our buffer is full
     msgLen = 0;
 
@@ -271,10 +356,19 @@ static void *_serverCommThread(void *params) {
 
     msgFromServer[0] = '\0';
 
+    libmetrics_set(sQueueBytes, sMsgToServerLen);
+
     if (sMsgToServerLen > 0) {
       _serverCommPush(curlHandle, sMsgToServer, msgFromServer, sizeof(msgFromServer));
-      bzero(sMsgToServer, sizeof(sMsgToServer));
-      sMsgToServerLen = 0;
+
+      if (sServerReachable) {
+        bzero(sMsgToServer, sizeof(sMsgToServer));
+        sMsgToServerLen = 0;
+
+      } else {
+        // The measurements were spooled, try the rest again
+        sMsgToServerLen = strlen(sMsgToServer);
+      }
 
     } else if (poll == false) {
 
@@ -342,8 +436,9 @@ static void *_serverCommThread(void *params) {
       }
     }
 
-    // Dedicated GET connection
-    if (poll == true) {
+    // Dedicated GET connection, unless we have spooled measurements to catch
+    // up on first
+    if (poll == true && (proxyspool_isEmpty() || !sServerReachable)) {
       msgFromServer[0] = '\0';
       // Only poll (GET) if the server wants you to.
       _serverCommPoll(curlHandle, msgFromServer, sizeof(msgFromServer));
@@ -385,16 +480,27 @@ static void *_serverCommThread(void *params) {
  */
 static void _serverCommPush(CURLSH *curlHandle, char *message, char *response, int responseMaxLen) {
   bool serverRetry = false;
-  int wrappedMessageLen = 0;
-  char wrappedMessage[PROXY_MAX_HTTP_SEND_MESSAGE_LEN];
-  char url[PATH_MAX];
+  bool serverReachable = true;
+  int spooled = 0;
   int retries = 0;
+  int responseLen;
+  double start = _proxy_now();
+  const proxyconfig_t *config;
+  h2swrapper_frame_t frame;
   http_param_t params;
 
   assert(message);
   assert(response);
 
-  bzero(wrappedMessage, sizeof(wrappedMessage));
+  // Frame the message once, every retry sends it with the same sequence number
+  if (h2swrapper_frame(&frame, message, sEncodedMsg, sizeof(sEncodedMsg)) < 0) {
+    SYSLOG_ERR("Couldn't wrap the message as %s", frame.codec->name);
+    return;
+  }
+
+  SYSLOG_DEBUG("Wrapped %d bytes as %s, seq=%u", frame.len, frame.codec->name, frame.seq);
+
+  proxycapture_record(PROXYCAPTURE_OUTBOUND, message, strlen(message));
 
   params.timeouts.connectTimeout = HTTPCOMM_DEFAULT_CONNECT_TIMEOUT_SEC;
   params.timeouts.transferTimeout = HTTPCOMM_DEFAULT_TRANSFER_TIMEOUT_SEC;
@@ -406,18 +512,26 @@ static void _serverCommPush(CURLSH *curlHandle, char *message, char *response, i
       sleep(1);
     }
 
-    wrappedMessageLen = h2swrapper_wrap(wrappedMessage, message, sizeof(wrappedMessage));
-
-    SYSLOG_DEBUG("Wrapped: %s", wrappedMessage);
+    // One consistent view of the configuration for the whole attempt
+    config = proxyconfig_acquire();
 
-    proxyconfig_getUrl(url, sizeof(url));
+    SYSLOG_DEBUG("POST URL: %s", config->url);
 
-    SYSLOG_INFO("POST URL: %s", url);
+    responseLen = 0;
+    response[0] = '\0';
+    sResponseDispatched = false;
+    if (libhttpcomm_sendMsgVector(curlHandle, CURLOPT_POST, config->url,
+        config->certificate, config->activationToken, frame.segments,
+        frame.totalSegments, response, responseMaxLen, params, NULL, _httpRxCallback,
+        (frame.codec == &iotcodecxml) ? NULL : &responseLen,
+        (frame.codec == &iotcodecxml) ? NULL : frame.codec->contentType) == SUCCESS) {
 
-    if (libhttpcomm_sendMsg(curlHandle, CURLOPT_POST, url,
-        proxyconfig_getCertificate(), proxyconfig_getActivationToken(), wrappedMessage,
-        wrappedMessageLen, response, responseMaxLen, params, NULL) == SUCCESS) {
+       _serverCommDecode(response, responseLen, responseMaxLen);
+       iottrace_markMessage(response, strlen(response), IOTTRACE_RECEIVED);
+       proxycapture_record(PROXYCAPTURE_INBOUND, response, strlen(response));
+       proxylisteners_broadcastChunk("", 0);
 
+       serverReachable = true;
        serverRetry = (strlen(response) == 0) || (strstr(response, "ERR") != NULL);
 
        if(!serverRetry) {
@@ -428,14 +542,44 @@ static void _serverCommPush(CURLSH *curlHandle, char *message, char *response, i
 
     } else {
       // Either the Internet or the server is down
-      // If the Internet is down, buffer messages and do not lose data
+      // If the Internet is down, spool measurements and do not lose data
       SYSLOG_INFO("Couldn't contact the server");
-      retries = 0;
+      proxylisteners_broadcastChunk("", 0);
+      serverReachable = false;
       serverRetry = true;
     }
 
+    if (serverRetry && sResponseDispatched && strstr(response, "command") != NULL) {
+      // The listeners already have commands from the answer, so the server got
+      // the message. Sending it again would hand them the same commands twice.
+      SYSLOG_WARNING("Not retrying, commands from the server were already dispatched");
+      serverReachable = true;
+      serverRetry = false;
+    }
+
+    proxyconfig_release(config);
+
   } while (serverRetry == true && retries < PROXY_MAX_HTTP_RETRIES);
 
+  sServerReachable = serverReachable;
+
+  if (!serverRetry) {
+    iottrace_markMessage(message, strlen(message), IOTTRACE_PUSHED);
+  }
+
+  libmetrics_add(sPushes, 1);
+  libmetrics_add(sPushRetries, retries);
+  libmetrics_observe(sPushDuration, _proxy_now() - start);
+
+  if (!serverReachable) {
+    // Keep the measurements compact until the server is back, instead of
+    // holding up everything behind them
+    spooled = proxyspool_addMsg(message);
+    SYSLOG_INFO("Spooled %d measurements, %d bytes in the spool", spooled, proxyspool_size());
+    libmetrics_add(sPushUnreachable, 1);
+  }
+
+  libmetrics_set(sSpoolBytes, proxyspool_size());
 
 }
 
@@ -449,31 +593,110 @@ static void _serverCommPush(CURLSH *curlHandle, char *message, char *response, i
  * @return  none
  */
 static void _serverCommPoll(CURLSH * curlHandle, char *pollMsg, int pollMsgMaxLen) {
-  int urlOffset = 0;
   char url[PATH_MAX];
-  char tempUrl[PATH_MAX];
   char localAddress[EUI64_STRING_SIZE];
+  int pollMsgLen = 0;
+  const iotcodec_t *codec = proxyconfig_getCodec();
+  const proxyconfig_t *config;
   http_param_t params;
 
-  eui64_toString(localAddress, sizeof(localAddress));
+  hubid_get(localAddress, sizeof(localAddress));
 
-  proxyconfig_getUrl(tempUrl, sizeof(tempUrl));
+  config = proxyconfig_acquire();
 
   params.timeouts.connectTimeout = HTTPCOMM_DEFAULT_CONNECT_TIMEOUT_SEC;
-  params.timeouts.transferTimeout = proxyconfig_getUploadIntervalSec();
+  params.timeouts.transferTimeout = config->uploadIntervalSec;
   params.verbose = false;
 
-  snprintf(url + urlOffset, sizeof(url) - urlOffset, "%s?id=%s&timeout=%lu",
-      tempUrl, localAddress, params.timeouts.transferTimeout);
+  snprintf(url, sizeof(url), "%s?id=%s&timeout=%lu",
+      config->url, localAddress, params.timeouts.transferTimeout);
 
   // 30-second buffer to let server notify the timeout
   params.timeouts.transferTimeout += 30;
 
+  libmetrics_add(sPolls, 1);
+
   SYSLOG_DEBUG("GET URL: %s", url);
 
-  libhttpcomm_sendMsg(curlHandle, CURLOPT_HTTPGET, url,
-      proxyconfig_getCertificate(), proxyconfig_getActivationToken(), NULL, 0, pollMsg, pollMsgMaxLen,
-      params, _httpProgressCallback);
+  if (libhttpcomm_sendMsgStreamWithType(curlHandle, CURLOPT_HTTPGET, url,
+      config->certificate, config->activationToken, NULL, 0, pollMsg, pollMsgMaxLen,
+      params, _httpProgressCallback, _httpRxCallback,
+      (codec == &iotcodecxml) ? NULL : &pollMsgLen,
+      (codec == &iotcodecxml) ? NULL : codec->contentType) == SUCCESS) {
+    // The server answered, so measurements spooled while it was away can go
+    // out now, even if the agents have nothing new to push
+    sServerReachable = true;
+
+    _serverCommDecode(pollMsg, pollMsgLen, pollMsgMaxLen);
+    iottrace_markMessage(pollMsg, strlen(pollMsg), IOTTRACE_RECEIVED);
+    proxycapture_record(PROXYCAPTURE_INBOUND, pollMsg, strlen(pollMsg));
+  }
+
+  proxyconfig_release(config);
+
+  proxylisteners_broadcastChunk("", 0);
+}
+
+/**
+ * Hands each piece of a server response to the chunk listeners as it arrives,
+ * so commands at the front of a long response can execute while the rest of
+ * it is still in flight.
+ *
+ * Responses in another codec can't be handed over until they've been
+ * translated to XML, so for those we only count the bytes received.
+ *
+ * @param chunk Bytes just received from the server
+ * @param len Number of bytes received
+ * @param arg Length of the response so far if it needs to be decoded, or NULL
+ */
+static void _httpRxCallback(const char *chunk, int len, void *arg) {
+  if (arg != NULL) {
+    *((int *) arg) += len;
+    return;
+  }
+
+  if (len > 0) {
+    sResponseDispatched = true;
+  }
+  proxylisteners_broadcastChunk(chunk, len);
+}
+
+/**
+ * Translate a complete response in the server's codec to XML in place, and
+ * hand it to the chunk listeners. The server may still answer in XML, or
+ * with a bare status, which is passed through as it is.
+ *
+ * A response we can't decode is emptied instead of handed over, so the
+ * caller treats it like no answer at all rather than reading the raw bytes.
+ *
+ * @param response Response received, null-terminated XML on return
+ * @param responseLen Number of bytes received, 0 if the response was XML all along
+ * @param responseMaxLen Size of the response buffer
+ * @return SUCCESS if the response is XML now
+ */
+static error_t _serverCommDecode(char *response, int responseLen, int responseMaxLen) {
+  const iotcodec_t *codec = proxyconfig_getCodec();
+  int decodedLen;
+
+  if (responseLen == 0) {
+    return SUCCESS;
+  }
+
+  if (response[0] != '<') {
+    decodedLen = iotcodec_transcode(codec, &iotcodecxml, response, responseLen, sDecodedMsg, sizeof(sDecodedMsg));
+
+    if (decodedLen <= 0 || decodedLen >= responseMaxLen) {
+      SYSLOG_ERR("Couldn't decode a %d byte %s response", responseLen, codec->name);
+      response[0] = '\0';
+      return FAIL;
+    }
+
+    memcpy(response, sDecodedMsg, decodedLen + 1);
+  }
+
+  sResponseDispatched = true;
+  proxylisteners_broadcastChunk(response, strlen(response));
+  return SUCCESS;
 }
 
 
@@ -536,3 +759,13 @@ int _httpProgressCallback(void *clientp, double dltotal, double dlnow, double ul
   // keep the GET connection until the timeout occurs or the push buffer is full.
   return false;
 }
+
+/**
+ * @return seconds on a clock that doesn't jump when the time is set
+ */
+static double _proxy_now() {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1000000000.0;
+}
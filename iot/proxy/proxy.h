@@ -25,6 +25,7 @@
 enum {
   PROXY_MAX_HTTP_RETRIES = 3,
   PROXY_MAX_MSG_LEN = 8192,
+  PROXY_MAX_RESPONSE_LEN = 32768,
   PROXY_NUM_SERVER_CONNECTIONS_BEFORE_SYSLOG_NOTIFICATION = 20,
   PROXY_MAX_PUSHES_ON_RECEIVED_COMMAND = 2,
   PROXY_HEADER_PASSWORD_LEN = 64,
@@ -40,6 +41,10 @@ error_t proxy_addListener(proxylistener l);
 
 error_t proxy_removeListener(proxylistener l);
 
+error_t proxy_addChunkListener(proxychunklistener l);
+
+error_t proxy_removeChunkListener(proxychunklistener l);
+
 error_t proxy_send(const char *data, int len);
 
 #endif
@@ -0,0 +1,300 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * Proxy traffic capture
+ *
+ * While capturing, the proxy appends every message it gets from the server
+ * and every batch it pushes to the server to a binary file, so a problem seen
+ * in the field can be replayed on a desk, and a change to the parser or the
+ * framing can be measured against real traffic, see apps/proxyreplay.
+ *
+ * The file starts with PROXYCAPTURE_MAGIC, followed by one record per
+ * message:
+ *
+ *   1 byte    proxycapture_direction_e
+ *   4 bytes   length of the message, little-endian
+ *   8 bytes   CLOCK_MONOTONIC microseconds since the capture started,
+ *             little-endian
+ *   length    the message
+ *
+ * Inbound messages are captured after they were translated to XML, and
+ * outbound batches before they're framed, so a capture doesn't depend on the
+ * DEVICE_DATA_FORMAT the proxy talked to the server in.  Each record is
+ * flushed as it's written, so a capture survives the proxy being killed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "proxycapture.h"
+#include "ioterror.h"
+#include "iotdebug.h"
+
+/***************** Module Variables ****************/
+/** File we're capturing to, NULL when we're not */
+static FILE *sFile;
+
+/** Bytes written to the file so far */
+static long sFileSize;
+
+/** When the capture started */
+static uint64_t sStartUsec;
+
+/** Records come from the proxy thread and the agents' threads */
+static pthread_mutex_t sCaptureMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/***************** Private Prototypes ****************/
+static uint64_t _proxycapture_nowUsec();
+
+static void _proxycapture_putLittleEndian(unsigned char *dest, uint64_t value, int size);
+
+static uint64_t _proxycapture_getLittleEndian(const unsigned char *src, int size);
+
+/***************** Public Functions ****************/
+/**
+ * Start capturing the proxy's traffic
+ * @param filename File to write the capture to, it's overwritten
+ * @return SUCCESS if we're capturing
+ */
+error_t proxycapture_start(const char *filename) {
+  FILE *file;
+
+  if (proxycapture_isCapturing()) {
+    return SUCCESS;
+  }
+
+  if ((file = fopen(filename, "wb")) == NULL) {
+    SYSLOG_ERR("[capture] Couldn't open %s: %s", filename, strerror(errno));
+    return FAIL;
+  }
+
+  if (fwrite(PROXYCAPTURE_MAGIC, PROXYCAPTURE_MAGIC_SIZE, 1, file) != 1) {
+    SYSLOG_ERR("[capture] Couldn't write to %s", filename);
+    fclose(file);
+    return FAIL;
+  }
+
+  fflush(file);
+
+  pthread_mutex_lock(&sCaptureMutex);
+  sFile = file;
+  sFileSize = PROXYCAPTURE_MAGIC_SIZE;
+  sStartUsec = _proxycapture_nowUsec();
+  pthread_mutex_unlock(&sCaptureMutex);
+
+  SYSLOG_INFO("[capture] Capturing the server traffic to %s", filename);
+  return SUCCESS;
+}
+
+/**
+ * Stop capturing and close the file
+ */
+void proxycapture_stop() {
+  pthread_mutex_lock(&sCaptureMutex);
+  if (sFile != NULL) {
+    fclose(sFile);
+    sFile = NULL;
+    SYSLOG_INFO("[capture] Captured %ld bytes", sFileSize);
+  }
+  pthread_mutex_unlock(&sCaptureMutex);
+}
+
+/**
+ * @return true if the traffic is being captured
+ */
+bool proxycapture_isCapturing() {
+  bool capturing;
+
+  pthread_mutex_lock(&sCaptureMutex);
+  capturing = (sFile != NULL);
+  pthread_mutex_unlock(&sCaptureMutex);
+
+  return capturing;
+}
+
+/**
+ * Capture a message, if we're capturing
+ * @param direction PROXYCAPTURE_INBOUND or PROXYCAPTURE_OUTBOUND
+ * @param msg Message to capture
+ * @param len Length of the message
+ */
+void proxycapture_record(proxycapture_direction_e direction, const char *msg, int len) {
+  unsigned char header[PROXYCAPTURE_RECORD_HEADER_SIZE];
+
+  if (len < 0) {
+    return;
+  }
+
+  pthread_mutex_lock(&sCaptureMutex);
+
+  if (sFile != NULL) {
+    if (sFileSize + PROXYCAPTURE_RECORD_HEADER_SIZE + len > PROXYCAPTURE_MAX_FILE_SIZE) {
+      SYSLOG_WARNING("[capture] The capture reached %d bytes, stopped capturing", PROXYCAPTURE_MAX_FILE_SIZE);
+      fclose(sFile);
+      sFile = NULL;
+
+    } else {
+      header[0] = (unsigned char) direction;
+      _proxycapture_putLittleEndian(&header[1], len, 4);
+      _proxycapture_putLittleEndian(&header[5], _proxycapture_nowUsec() - sStartUsec, 8);
+
+      if (fwrite(header, sizeof(header), 1, sFile) != 1
+          || (len > 0 && fwrite(msg, len, 1, sFile) != 1)
+          || fflush(sFile) != 0) {
+        SYSLOG_ERR("[capture] Couldn't write the capture, stopped capturing");
+        fclose(sFile);
+        sFile = NULL;
+
+      } else {
+        sFileSize += sizeof(header) + len;
+      }
+    }
+  }
+
+  pthread_mutex_unlock(&sCaptureMutex);
+}
+
+/**
+ * Open a capture file to read its records
+ * @param reader Reader to initialize
+ * @param filename Capture file
+ * @return SUCCESS if it's a capture file we can read
+ */
+error_t proxycapture_open(proxycapture_reader_t *reader, const char *filename) {
+  char magic[PROXYCAPTURE_MAGIC_SIZE];
+
+  bzero(reader, sizeof(proxycapture_reader_t));
+
+  if ((reader->file = fopen(filename, "rb")) == NULL) {
+    SYSLOG_ERR("[capture] Couldn't open %s: %s", filename, strerror(errno));
+    return FAIL;
+  }
+
+  if (fread(magic, sizeof(magic), 1, reader->file) != 1
+      || memcmp(magic, PROXYCAPTURE_MAGIC, sizeof(magic)) != 0) {
+    SYSLOG_ERR("[capture] %s isn't a capture file", filename);
+    proxycapture_close(reader);
+    return FAIL;
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * Read the next record of a capture file
+ * @param reader Reader opened with proxycapture_open(..)
+ * @param record Filled in with the record
+ * @return SUCCESS if we read a record, FAIL at the end of the file or if
+ *     the rest of the file is corrupt
+ */
+error_t proxycapture_next(proxycapture_reader_t *reader, proxycapture_record_t *record) {
+  unsigned char header[PROXYCAPTURE_RECORD_HEADER_SIZE];
+  char *buffer;
+  uint64_t len;
+
+  if (reader->file == NULL || fread(header, sizeof(header), 1, reader->file) != 1) {
+    return FAIL;
+  }
+
+  len = _proxycapture_getLittleEndian(&header[1], 4);
+
+  if ((header[0] != PROXYCAPTURE_INBOUND && header[0] != PROXYCAPTURE_OUTBOUND)
+      || len > PROXYCAPTURE_MAX_RECORD_SIZE) {
+    SYSLOG_ERR("[capture] Corrupt record at offset %ld", ftell(reader->file) - (long) sizeof(header));
+    return FAIL;
+  }
+
+  if ((int) len + 1 > reader->bufferSize) {
+    if ((buffer = realloc(reader->buffer, len + 1)) == NULL) {
+      SYSLOG_ERR("[capture] Out of memory for a %d byte record", (int) len);
+      return FAIL;
+    }
+
+    reader->buffer = buffer;
+    reader->bufferSize = len + 1;
+  }
+
+  if (len > 0 && fread(reader->buffer, len, 1, reader->file) != 1) {
+    SYSLOG_WARNING("[capture] The last record was cut short");
+    return FAIL;
+  }
+
+  reader->buffer[len] = '\0';
+
+  record->direction = header[0];
+  record->usec = _proxycapture_getLittleEndian(&header[5], 8);
+  record->msg = reader->buffer;
+  record->len = len;
+  return SUCCESS;
+}
+
+/**
+ * Close a capture file
+ * @param reader Reader opened with proxycapture_open(..)
+ */
+void proxycapture_close(proxycapture_reader_t *reader) {
+  if (reader->file != NULL) {
+    fclose(reader->file);
+  }
+
+  free(reader->buffer);
+  bzero(reader, sizeof(proxycapture_reader_t));
+}
+
+/***************** Private Functions ****************/
+/**
+ * @return CLOCK_MONOTONIC microseconds
+ */
+static uint64_t _proxycapture_nowUsec() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * Write a number in the byte order of the file, whatever the hub's is
+ */
+static void _proxycapture_putLittleEndian(unsigned char *dest, uint64_t value, int size) {
+  int i;
+
+  for (i = 0; i < size; i++) {
+    dest[i] = (unsigned char) (value >> (8 * i));
+  }
+}
+
+/**
+ * Read a number in the byte order of the file
+ */
+static uint64_t _proxycapture_getLittleEndian(const unsigned char *src, int size) {
+  uint64_t value = 0;
+  int i;
+
+  for (i = 0; i < size; i++) {
+    value |= (uint64_t) src[i] << (8 * i);
+  }
+
+  return value;
+}
@@ -0,0 +1,102 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef PROXYCAPTURE_H
+#define PROXYCAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "ioterror.h"
+
+/** First bytes of every capture file, the last one is the format version */
+#define PROXYCAPTURE_MAGIC "IOTCAP\n1"
+
+#define PROXYCAPTURE_MAGIC_SIZE 8
+
+/** Bytes in front of each message in the file: direction, length, time */
+#define PROXYCAPTURE_RECORD_HEADER_SIZE 13
+
+/** Stop capturing once the file is this big, so it can't fill the disk */
+#ifndef PROXYCAPTURE_MAX_FILE_SIZE
+#define PROXYCAPTURE_MAX_FILE_SIZE (64 * 1024 * 1024)
+#endif
+
+/** Largest message a capture file may hold, anything bigger is corrupt */
+#ifndef PROXYCAPTURE_MAX_RECORD_SIZE
+#define PROXYCAPTURE_MAX_RECORD_SIZE (1024 * 1024)
+#endif
+
+/**
+ * Which way a captured message was going
+ */
+typedef enum proxycapture_direction_e {
+  /** A message from the server, translated to XML, as the listeners got it */
+  PROXYCAPTURE_INBOUND = 1,
+
+  /** A batch of messages to the server, before it was framed */
+  PROXYCAPTURE_OUTBOUND = 2,
+} proxycapture_direction_e;
+
+/**
+ * One message read back from a capture file
+ */
+typedef struct proxycapture_record_t {
+
+  /** proxycapture_direction_e */
+  int direction;
+
+  /** Microseconds since the capture started */
+  uint64_t usec;
+
+  /** Null-terminated message, valid until the next record is read */
+  const char *msg;
+
+  int len;
+
+} proxycapture_record_t;
+
+/**
+ * Reads the records of a capture file in order
+ */
+typedef struct proxycapture_reader_t {
+
+  FILE *file;
+
+  /** Holds the last message read */
+  char *buffer;
+  int bufferSize;
+
+} proxycapture_reader_t;
+
+/***************** Public Prototypes ****************/
+error_t proxycapture_start(const char *filename);
+
+void proxycapture_stop();
+
+bool proxycapture_isCapturing();
+
+void proxycapture_record(proxycapture_direction_e direction, const char *msg, int len);
+
+error_t proxycapture_open(proxycapture_reader_t *reader, const char *filename);
+
+error_t proxycapture_next(proxycapture_reader_t *reader, proxycapture_record_t *record);
+
+void proxycapture_close(proxycapture_reader_t *reader);
+
+#endif
@@ -17,7 +17,15 @@
  */
 
 /**
- * This module manages configuration information for the proxy
+ * This module manages configuration information for the proxy.
+ *
+ * The configuration is published as an immutable, reference counted
+ * snapshot. Setters are serialized, copy the current snapshot into a free
+ * slot, change it and swap it in. Readers bump the reference count of the
+ * current snapshot and check it's still current, which needs no lock. A slot
+ * is only reused once nobody holds it, and slots are never freed, so a
+ * reader racing a swap only ever touches a valid reference count.
+ *
  * @author David Moss
  */
 
@@ -33,82 +41,85 @@
 #include <rpc/types.h>
 
 #include "proxyconfig.h"
+#include "iotcodec.h"
 #include "ioterror.h"
 #include "iotdebug.h"
 
-/** Mutex to protect the command URL access */
-static pthread_mutex_t sUrlMutex;
-
-/** Mutex to protect upload interval access */
-static pthread_mutex_t sUploadIntervalMutex;
-
-/** Mutex to protect SSL flag access */
-static pthread_mutex_t sUseSslMutex;
-
-/** Mutex to protect certificate path */
-static pthread_mutex_t sCertificatePathMutex;
-
-/** Mutex to protect activation token */
-static pthread_mutex_t sActivationTokenMutex;
+/** Snapshot slots, the first one holds the defaults */
+static proxyconfig_t sSnapshots[PROXYCONFIG_MAX_SNAPSHOTS] = {
+  { 1, "http://", "", "", NULL, false, NULL, "", PROXY_DEFAULT_UPLOAD_INTERVAL_SEC, NULL },
+};
 
-/** Upload interval in seconds */
-static long sUploadIntervalSec = PROXY_DEFAULT_UPLOAD_INTERVAL_SEC;
+/** The published snapshot */
+static proxyconfig_t * volatile sCurrent = &sSnapshots[0];
 
-/** Server URL */
-static char sUrl[PROXY_URL_SIZE];
+/** Serializes writers, readers never take it */
+static pthread_mutex_t sWriteMutex = PTHREAD_MUTEX_INITIALIZER;
 
-/** Flag to use SSL for server connections */
-static bool sUseSsl = false;
 
-/** SSL certificate path */
-static char sCertificatePath[PATH_MAX];
-
-/** Cloud activation token */
-static char sActivationToken[PROXY_MAX_ACTIVATION_TOKEN_SIZE];
-
-static bool sActivationTokenSet = false;
+/***************** Private Prototypes ****************/
+static proxyconfig_t *_proxyconfig_edit();
 
+static void _proxyconfig_publish(proxyconfig_t *next);
 
 
 /***************** Proxyconfig Public ****************/
 /**
- * Start proxyconfig by initializing mutexes
+ * Start proxyconfig. The configuration can be set before it starts.
  */
 void proxyconfig_start() {
-  pthread_mutex_init(&sUploadIntervalMutex, NULL);
-  pthread_mutex_init(&sUrlMutex, NULL);
-  pthread_mutex_init(&sUseSslMutex, NULL);
-  pthread_mutex_init(&sCertificatePathMutex, NULL);
-  pthread_mutex_init(&sActivationTokenMutex, NULL);
 }
 
 /**
- * Stop proxyconfig by destroying mutexes
+ * Stop proxyconfig
  */
 void proxyconfig_stop() {
-  pthread_mutex_destroy(&sUploadIntervalMutex);
-  pthread_mutex_destroy(&sUrlMutex);
-  pthread_mutex_destroy(&sUseSslMutex);
-  pthread_mutex_destroy(&sCertificatePathMutex);
-  pthread_mutex_destroy(&sActivationTokenMutex);
+  int i;
+
+  for(i = 0; i < PROXYCONFIG_MAX_SNAPSHOTS; i++) {
+    if(&sSnapshots[i] != sCurrent && sSnapshots[i].refCount > 0) {
+      SYSLOG_WARNING("Configuration snapshot %d is still held", i);
+    }
+  }
+}
+
+/**
+ * Get the current configuration. It won't change until it's released.
+ * @return the current configuration snapshot, to be given back with proxyconfig_release(..)
+ */
+const proxyconfig_t *proxyconfig_acquire() {
+  proxyconfig_t *config;
+
+  while(true) {
+    config = sCurrent;
+    __sync_fetch_and_add(&config->refCount, 1);
+
+    if(config == sCurrent) {
+      return config;
+    }
+
+    // Swapped out before we got hold of it
+    __sync_fetch_and_sub(&config->refCount, 1);
+  }
 }
 
+/**
+ * Give back a configuration snapshot
+ * @param config Snapshot from proxyconfig_acquire()
+ */
+void proxyconfig_release(const proxyconfig_t *config) {
+  assert(config);
+  __sync_fetch_and_sub(&((proxyconfig_t *) config)->refCount, 1);
+}
 
 /**
  * Get the upload interval in seconds
  * @return the upload interval in seconds
  */
 long proxyconfig_getUploadIntervalSec() {
-  long uploadInterval;
-
-  // Must be protected since multiple threads are accessing it
-  pthread_mutex_lock(&sUploadIntervalMutex);
-  uploadInterval = sUploadIntervalSec;
-  pthread_mutex_unlock(&sUploadIntervalMutex);
-
-  if(uploadInterval == 0) {
-    return PROXY_DEFAULT_UPLOAD_INTERVAL_SEC;
-  }
+  const proxyconfig_t *config = proxyconfig_acquire();
+  long uploadInterval = config->uploadIntervalSec;
+  proxyconfig_release(config);
 
   return uploadInterval;
 }
@@ -118,13 +129,16 @@ long proxyconfig_getUploadIntervalSec() {
  * @param uploadIntervalSec
  */
 void proxyconfig_setUploadIntervalSec(long uploadIntervalSec) {
+  proxyconfig_t *next;
+
   if(uploadIntervalSec == 0) {
     return;
   }
 
-  pthread_mutex_lock(&sUploadIntervalMutex);
-  sUploadIntervalSec = uploadIntervalSec;
-  pthread_mutex_unlock(&sUploadIntervalMutex);
+  next = _proxyconfig_edit();
+  next->uploadIntervalSec = uploadIntervalSec;
+  _proxyconfig_publish(next);
+
   SYSLOG_DEBUG("Upload interval set to %ld", uploadIntervalSec);
 }
 
@@ -134,27 +148,13 @@ void proxyconfig_setUploadIntervalSec(long uploadIntervalSec) {
  * @param destLen Maximum size of the buffer
  */
 void proxyconfig_getUrl(char *dest, int destLen) {
-  int bytesWritten = 0;
+  const proxyconfig_t *config;
 
   assert(dest);
 
-  memset(dest, 0x0, destLen);
-
-  // Must be protected since multiple threads are accessing it
-  pthread_mutex_lock(&sUrlMutex);
-
-  // Ensure we have an http(s)://
-  if (strstr(sUrl, "http") == NULL) {
-    if (sUseSsl == true && access(sCertificatePath, F_OK) == 0) {
-      bytesWritten += snprintf(dest, destLen, "https://");
-    } else {
-      bytesWritten += snprintf(dest, destLen, "http://");
-    }
-  }
-
-  strncpy(dest + bytesWritten, sUrl, destLen - bytesWritten);
-
-  pthread_mutex_unlock(&sUrlMutex);
+  config = proxyconfig_acquire();
+  snprintf(dest, destLen, "%s", config->url);
+  proxyconfig_release(config);
 }
 
 /**
@@ -163,13 +163,15 @@ void proxyconfig_getUrl(char *dest, int destLen) {
  * @return SUCCESS if the URL is set, FAIL if the URL is invalid
  */
 error_t proxyconfig_setUrl(const char *url) {
+  proxyconfig_t *next;
+
   assert(url);
 
   if (*url) {
-    // Must be protected since multiple threads are accessing it
-    pthread_mutex_lock(&sUrlMutex);
-    strncpy(sUrl, url, sizeof(sUrl));
-    pthread_mutex_unlock(&sUrlMutex);
+    next = _proxyconfig_edit();
+    snprintf(next->serverUrl, sizeof(next->serverUrl), "%s", url);
+    _proxyconfig_publish(next);
+
     SYSLOG_DEBUG("Server URL set to %s", url);
     return SUCCESS;
   }
@@ -179,88 +181,172 @@ error_t proxyconfig_setUrl(const char *url) {
 }
 
 /**
- * Set the certificate path
+ * Set the certificate path. The certificate is only used if it exists
+ * by the time SSL is turned on or the path is set.
+ *
  * @param certificatePath Pointer to a string containing the certificate path
  */
 void proxyconfig_setCertificate(const char *certificatePath) {
-  pthread_mutex_lock(&sCertificatePathMutex);
-  strncpy(sCertificatePath, certificatePath, sizeof(sCertificatePath));
-  pthread_mutex_unlock(&sCertificatePathMutex);
+  proxyconfig_t *next = _proxyconfig_edit();
+  snprintf(next->certificatePath, sizeof(next->certificatePath), "%s", certificatePath);
+  _proxyconfig_publish(next);
 
   SYSLOG_DEBUG("SSL certificate path set to %s", certificatePath);
 }
 
-
 /**
- * @return a pointer to the certificate path if we are using SSL, else NULL
+ * Set the activation token
+ * @param token Pointer to a string containing the activation token
  */
-const char *proxyconfig_getCertificate() {
-  const char *certificate = NULL;
+void proxyconfig_setActivationToken(const char *token) {
+  proxyconfig_t *next = _proxyconfig_edit();
 
-  if (proxyconfig_getSsl() == true) {
-    pthread_mutex_lock(&sCertificatePathMutex);
-    if (access(sCertificatePath, F_OK) == 0) {
-      certificate = sCertificatePath;
-    }
-    pthread_mutex_unlock(&sCertificatePathMutex);
+  if(token != NULL) {
+    snprintf(next->activationTokenBuffer, sizeof(next->activationTokenBuffer), "%s", token);
+    next->activationToken = next->activationTokenBuffer;
+    SYSLOG_DEBUG("Authentication token set to %s", token);
+
+  } else {
+    SYSLOG_DEBUG("No authentication token in use");
+    next->activationToken = NULL;
   }
 
-  return certificate;
+  _proxyconfig_publish(next);
 }
 
 /**
- * @return a pointer to the activation token
+ * @param ssl True to use SSL
  */
-const char *proxyconfig_getActivationToken() {
-  const char *activation = NULL;
+void proxyconfig_setSsl(bool ssl) {
+  proxyconfig_t *next = _proxyconfig_edit();
+  next->ssl = ssl;
+  _proxyconfig_publish(next);
 
-  pthread_mutex_lock(&sActivationTokenMutex);
-  if(sActivationTokenSet) {
-    activation = sActivationToken;
-  }
-  pthread_mutex_unlock(&sActivationTokenMutex);
+  SYSLOG_DEBUG("Use SSL set to %d", ssl);
+}
+
+/**
+ * @return True if we are to use SSL
+ */
+bool proxyconfig_getSsl() {
+  const proxyconfig_t *config = proxyconfig_acquire();
+  bool ssl = config->ssl;
+  proxyconfig_release(config);
 
-  return activation;
+  return ssl;
 }
 
 /**
- * Set the activation token
- * @param token Pointer to a string containing the activation token
+ * Select the wire format of messages exchanged with the server
+ * @param format Codec name, i.e. "xml", "json" or "cbor"
+ * @return SUCCESS if the codec exists, FAIL if it doesn't
  */
-void proxyconfig_setActivationToken(const char *token) {
-  pthread_mutex_lock(&sActivationTokenMutex);
-  if(token != NULL) {
-    sActivationTokenSet = true;
-    strncpy(sActivationToken, token, sizeof(sActivationToken));
-    SYSLOG_DEBUG("Authentication token set to %s", token);
+error_t proxyconfig_setDataFormat(const char *format) {
+  const iotcodec_t *codec = iotcodec_find(format);
+  proxyconfig_t *next;
 
-  } else {
-    SYSLOG_DEBUG("No authentication token in use");
-    sActivationTokenSet = false;
+  if(codec == NULL) {
+    SYSLOG_ERR("Unknown data format %s", format != NULL ? format : "(null)");
+    return FAIL;
   }
-  pthread_mutex_unlock(&sActivationTokenMutex);
+
+  next = _proxyconfig_edit();
+  next->codec = codec;
+  _proxyconfig_publish(next);
+
+  SYSLOG_DEBUG("Data format set to %s", codec->name);
+  return SUCCESS;
 }
 
 /**
- * @param ssl True to use SSL
+ * @return the codec of messages exchanged with the server
  */
-void proxyconfig_setSsl(bool ssl) {
-  pthread_mutex_lock(&sUseSslMutex);
-  sUseSsl = ssl;
-  pthread_mutex_unlock(&sUseSslMutex);
-  SYSLOG_DEBUG("Use SSL set to %d", ssl);
+const iotcodec_t *proxyconfig_getCodec() {
+  const proxyconfig_t *config = proxyconfig_acquire();
+  const iotcodec_t *codec = config->codec;
+  proxyconfig_release(config);
+
+  if(codec == NULL) {
+    codec = iotcodec_find(IOTCODEC_DEFAULT);
+  }
+
+  return codec;
 }
 
+
+/***************** Proxyconfig Private ****************/
 /**
- * @return True if we are to use SSL
+ * Lock out other writers and copy the current snapshot into a free slot.
+ * Slots are held briefly, so if they're all taken we wait for one.
+ *
+ * @return the copy, to be changed and handed to _proxyconfig_publish(..)
  */
-bool proxyconfig_getSsl() {
-  bool ssl;
+static proxyconfig_t *_proxyconfig_edit() {
+  proxyconfig_t *next = NULL;
+  bool warned = false;
+  int i;
+
+  pthread_mutex_lock(&sWriteMutex);
+
+  while(next == NULL) {
+    for(i = 0; i < PROXYCONFIG_MAX_SNAPSHOTS && next == NULL; i++) {
+      if(&sSnapshots[i] != sCurrent && sSnapshots[i].refCount == 0) {
+        next = &sSnapshots[i];
+      }
+    }
 
-  pthread_mutex_lock(&sUseSslMutex);
-  ssl = sUseSsl;
-  pthread_mutex_unlock(&sUseSslMutex);
+    if(next == NULL) {
+      if(!warned) {
+        SYSLOG_WARNING("All %d configuration snapshots are held", PROXYCONFIG_MAX_SNAPSHOTS);
+        warned = true;
+      }
+      usleep(1000);
+    }
+  }
 
-  return ssl;
+  // A reader may still bump the count of a slot that was just swapped out,
+  // but it checks the slot is current before it looks at anything else
+  memcpy(next->url, sCurrent->url, sizeof(next->url));
+  memcpy(next->serverUrl, sCurrent->serverUrl, sizeof(next->serverUrl));
+  memcpy(next->certificatePath, sCurrent->certificatePath, sizeof(next->certificatePath));
+  memcpy(next->activationTokenBuffer, sCurrent->activationTokenBuffer, sizeof(next->activationTokenBuffer));
+  next->activationToken = (sCurrent->activationToken != NULL) ? next->activationTokenBuffer : NULL;
+  next->ssl = sCurrent->ssl;
+  next->uploadIntervalSec = sCurrent->uploadIntervalSec;
+  next->codec = sCurrent->codec;
+
+  return next;
 }
 
+/**
+ * Work out the values derived from the settings, swap the snapshot in and
+ * let other writers go. The certificate is checked here, so readers never
+ * have to.
+ *
+ * @param next Snapshot from _proxyconfig_edit()
+ */
+static void _proxyconfig_publish(proxyconfig_t *next) {
+  proxyconfig_t *previous = sCurrent;
+  bool useCertificate;
+
+  useCertificate = next->ssl && next->certificatePath[0] && access(next->certificatePath, F_OK) == 0;
+  next->certificate = useCertificate ? next->certificatePath : NULL;
+
+  // Ensure we have an http(s)://
+  if (strstr(next->serverUrl, "http") == NULL) {
+    snprintf(next->url, sizeof(next->url), "%s%s", useCertificate ? "https://" : "http://", next->serverUrl);
+  } else {
+    snprintf(next->url, sizeof(next->url), "%s", next->serverUrl);
+  }
+
+  // The published reference, added rather than stored so a reader's
+  // passing reference isn't lost
+  __sync_fetch_and_add(&next->refCount, 1);
+
+  sCurrent = next;
+  __sync_synchronize();
+
+  __sync_fetch_and_sub(&previous->refCount, 1);
+
+  pthread_mutex_unlock(&sWriteMutex);
+}
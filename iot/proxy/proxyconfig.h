@@ -20,24 +20,76 @@
 #define PROXYCONFIG_H
 
 #include <stdbool.h>
+#include <limits.h>
 #include "ioterror.h"
+#include "iotcodec.h"
 
 /** Default upload interval in seconds, can be overridden at compile time */
 #ifndef PROXY_DEFAULT_UPLOAD_INTERVAL_SEC
 #define PROXY_DEFAULT_UPLOAD_INTERVAL_SEC 60
 #endif
 
+/** Number of configuration snapshots that can be alive at the same time */
+#ifndef PROXYCONFIG_MAX_SNAPSHOTS
+#define PROXYCONFIG_MAX_SNAPSHOTS 8
+#endif
+
 enum {
   PROXY_URL_SIZE = 256,
   PROXY_MAX_HTTP_SEND_MESSAGE_LEN = 32768U,
   PROXY_MAX_ACTIVATION_TOKEN_SIZE = 128,
 };
 
+/**
+ * One consistent view of the proxy configuration. A snapshot is never
+ * modified while it's published or held: every set makes a new snapshot and
+ * swaps it in, so readers take no lock and make no system calls.
+ *
+ *   const proxyconfig_t *config = proxyconfig_acquire();
+ *   ... use config->url, config->certificate, config->activationToken ...
+ *   proxyconfig_release(config);
+ */
+typedef struct proxyconfig_t {
+
+  /** References held by readers, plus one while the snapshot is published */
+  volatile int refCount;
+
+  /** Server URL, including the http:// or https:// */
+  char url[PROXY_URL_SIZE + 8];
+
+  /** Server URL as it was set */
+  char serverUrl[PROXY_URL_SIZE];
+
+  /** SSL certificate path */
+  char certificatePath[PATH_MAX];
+
+  /** certificatePath if we're using SSL and the certificate existed when it was set, else NULL */
+  const char *certificate;
+
+  /** True to use SSL */
+  bool ssl;
+
+  /** Cloud activation token, NULL if there is none */
+  const char *activationToken;
+  char activationTokenBuffer[PROXY_MAX_ACTIVATION_TOKEN_SIZE];
+
+  /** Upload interval in seconds */
+  long uploadIntervalSec;
+
+  /** Codec of messages exchanged with the server */
+  const iotcodec_t *codec;
+
+} proxyconfig_t;
+
 /***************** Public Prototypes ****************/
 void proxyconfig_start();
 
 void proxyconfig_stop();
 
+const proxyconfig_t *proxyconfig_acquire();
+
+void proxyconfig_release(const proxyconfig_t *config);
+
 long proxyconfig_getUploadIntervalSec();
 
 void proxyconfig_setUploadIntervalSec(long uploadIntervalSec);
@@ -46,17 +98,17 @@ void proxyconfig_getUrl(char *dest, int destLen);
 
 error_t proxyconfig_setUrl(const char *url);
 
-const char *proxyconfig_getCertificate();
-
 void proxyconfig_setCertificate(const char *certificate);
 
-const char *proxyconfig_getActivationToken();
-
 void proxyconfig_setActivationToken(const char *token);
 
 void proxyconfig_setSsl(bool ssl);
 
 bool proxyconfig_getSsl();
 
+error_t proxyconfig_setDataFormat(const char *format);
+
+const iotcodec_t *proxyconfig_getCodec();
+
 
 #endif
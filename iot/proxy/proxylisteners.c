@@ -27,7 +27,9 @@
 #include <errno.h>
 #include <stdbool.h>
 
+#include "libmetrics.h"
 #include "proxylisteners.h"
+#include "iottrace.h"
 #include "iotdebug.h"
 #include "ioterror.h"
 
@@ -40,9 +42,22 @@ static struct {
 
 } proxyListeners[TOTAL_PROXY_LISTENERS];
 
+/** Array of chunk listeners */
+static struct {
+
+  proxychunklistener l;
+
+  bool inUse;
+
+} proxyChunkListeners[TOTAL_PROXY_CHUNK_LISTENERS];
+
 /** Mutex to protect proxyListeners */
 static pthread_mutex_t sProxyListenersMutex;
 
+/** Number of server messages broadcast, and how many listeners got them */
+static libmetrics_t *sBroadcasts;
+static libmetrics_t *sDeliveries;
+
 
 /***************** Proxylisteners Public ****************/
 /**
@@ -50,6 +65,9 @@ static pthread_mutex_t sProxyListenersMutex;
  */
 void proxylisteners_start() {
   pthread_mutex_init(&sProxyListenersMutex, NULL);
+
+  sBroadcasts = libmetrics_counter("proxy_broadcasts_total", "Server messages broadcast to the listeners");
+  sDeliveries = libmetrics_counter("proxy_broadcast_deliveries_total", "Server messages handed to a listener");
 }
 
 /**
@@ -122,20 +140,30 @@ error_t proxylisteners_removeListener(proxylistener l) {
  * @param len Length of the message
  */
 error_t proxylisteners_broadcast(const char *msg, int len) {
+  proxylistener listeners[TOTAL_PROXY_LISTENERS];
   int i;
+  int delivered = 0;
 
   if(*msg && len > 0) {
-    SYSLOG_INFO("[broadcast]: %s", msg);
+    SYSLOG_DEBUG("[broadcast]: %s", msg);
+    iottrace_markMessage(msg, len, IOTTRACE_BROADCAST);
 
+    // Call the listeners without the lock, so they may add or remove listeners
     pthread_mutex_lock(&sProxyListenersMutex);
     for(i = 0; i < TOTAL_PROXY_LISTENERS; i++) {
       if(proxyListeners[i].inUse) {
-        SYSLOG_INFO("[broadcast]: Broadcasting to known client");
-        proxyListeners[i].l(msg, len);
+        listeners[delivered++] = proxyListeners[i].l;
       }
     }
     pthread_mutex_unlock(&sProxyListenersMutex);
 
+    for(i = 0; i < delivered; i++) {
+      listeners[i](msg, len);
+    }
+
+    libmetrics_add(sBroadcasts, 1);
+    libmetrics_add(sDeliveries, delivered);
+
   } else {
     SYSLOG_INFO("[broadcast]: Nobody to broadcast to :(");
     return FAIL;
@@ -161,3 +189,83 @@ int proxylisteners_totalListeners() {
 
   return total;
 }
+
+/**
+ * Add a listener to receive messages from the server piece by piece as they
+ * arrive, so it can act on the beginning of a message before the end of it
+ * has been received.
+ *
+ * @param proxychunklistener Function pointer to a function(const char *chunk, int len)
+ * @return SUCCESS if the listener was added
+ */
+error_t proxylisteners_addChunkListener(proxychunklistener l) {
+  int i;
+
+  pthread_mutex_lock(&sProxyListenersMutex);
+  for(i = 0; i < TOTAL_PROXY_CHUNK_LISTENERS; i++) {
+    if(proxyChunkListeners[i].inUse && proxyChunkListeners[i].l == l) {
+      SYSLOG_DEBUG("Chunk listener already exists");
+      pthread_mutex_unlock(&sProxyListenersMutex);
+      return SUCCESS;
+    }
+  }
+
+  for(i = 0; i < TOTAL_PROXY_CHUNK_LISTENERS; i++) {
+    if(!proxyChunkListeners[i].inUse) {
+      SYSLOG_DEBUG("Adding proxy chunk listener to element %d", i);
+      proxyChunkListeners[i].inUse = true;
+      proxyChunkListeners[i].l = l;
+      pthread_mutex_unlock(&sProxyListenersMutex);
+      return SUCCESS;
+    }
+  }
+  pthread_mutex_unlock(&sProxyListenersMutex);
+
+  return FAIL;
+}
+
+/**
+ * Remove a chunk listener from the proxy
+ * @param proxychunklistener Function pointer to remove
+ * @return SUCCESS if the listener was found and removed
+ */
+error_t proxylisteners_removeChunkListener(proxychunklistener l) {
+  int i;
+
+  pthread_mutex_lock(&sProxyListenersMutex);
+  for(i = 0; i < TOTAL_PROXY_CHUNK_LISTENERS; i++) {
+    if(proxyChunkListeners[i].inUse && proxyChunkListeners[i].l == l) {
+      SYSLOG_DEBUG("Removing proxy chunk listener at element %d", i);
+      proxyChunkListeners[i].inUse = false;
+      pthread_mutex_unlock(&sProxyListenersMutex);
+      return SUCCESS;
+    }
+  }
+  pthread_mutex_unlock(&sProxyListenersMutex);
+
+  return FAIL;
+}
+
+/**
+ * Hand the next piece of a server message to all chunk listeners. This runs
+ * inside the transfer, so the listeners are called without the lock held.
+ * @param chunk Next bytes of the message
+ * @param len Length of the chunk, 0 when the message is complete
+ */
+void proxylisteners_broadcastChunk(const char *chunk, int len) {
+  proxychunklistener listeners[TOTAL_PROXY_CHUNK_LISTENERS];
+  int total = 0;
+  int i;
+
+  pthread_mutex_lock(&sProxyListenersMutex);
+  for(i = 0; i < TOTAL_PROXY_CHUNK_LISTENERS; i++) {
+    if(proxyChunkListeners[i].inUse) {
+      listeners[total++] = proxyChunkListeners[i].l;
+    }
+  }
+  pthread_mutex_unlock(&sProxyListenersMutex);
+
+  for(i = 0; i < total; i++) {
+    listeners[i](chunk, len);
+  }
+}
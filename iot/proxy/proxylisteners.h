@@ -30,9 +30,25 @@
 #define TOTAL_PROXY_LISTENERS 10
 #endif
 
+/** Total listeners receiving server messages piece by piece */
+#ifndef TOTAL_PROXY_CHUNK_LISTENERS
+#define TOTAL_PROXY_CHUNK_LISTENERS 4
+#endif
+
 /** Proxy listener function pointer definition */
 typedef void (*proxylistener)(const char *, int);
 
+/**
+ * Proxy chunk listener function pointer definition. It gets each piece of a
+ * server message as it arrives, followed by a call with a length of 0 once
+ * the message is complete. A chunk is only valid during the call.
+ *
+ * Every piece of a message arrives on the thread running its transfer, and
+ * transfers on different threads can overlap, so keep per-message state
+ * per thread.
+ */
+typedef void (*proxychunklistener)(const char *, int);
+
 /***************** Public Prototypes ****************/
 void proxylisteners_start();
 
@@ -46,4 +62,10 @@ error_t proxylisteners_broadcast(const char *msg, int len);
 
 int proxylisteners_totalListeners();
 
+error_t proxylisteners_addChunkListener(proxychunklistener l);
+
+error_t proxylisteners_removeChunkListener(proxychunklistener l);
+
+void proxylisteners_broadcastChunk(const char *chunk, int len);
+
 #endif
@@ -0,0 +1,1075 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * Spool of measurements the proxy couldn't deliver to the server.
+ *
+ * Buffering the XML itself would fill sMsgToServer in minutes, so instead
+ * the <measure> blocks of an undelivered message are taken apart into one
+ * column per (device, param) series and compressed:
+ *
+ *   - Timestamps are stored as zigzag varints of the delta-of-delta, so a
+ *     device reporting on a steady period costs 1 byte per sample.
+ *   - Decimal values are stored as a mantissa and a number of decimal places,
+ *     and the mantissa as a zigzag varint of the delta from the last one, so
+ *     a slowly changing reading costs 1 or 2 bytes per sample. The text the
+ *     agent sent is reproduced exactly; anything that doesn't round-trip as a
+ *     decimal is stored as text.
+ *
+ * Samples are appended to fixed size chunks, and each chunk starts over with
+ * an absolute timestamp and value so it decodes on its own. When the spool
+ * is full, the oldest chunk is dropped. Once the server is reachable again,
+ * proxyspool_expand(..) turns the oldest chunks back into h2s XML, only as
+ * much as fits in the next message.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "proxyspool.h"
+#include "timestamp.h"
+#include "ioterror.h"
+#include "iotdebug.h"
+
+/** Total number of chunks that fit in PROXYSPOOL_MAX_BYTES */
+#define PROXYSPOOL_TOTAL_CHUNKS (PROXYSPOOL_MAX_BYTES / sizeof(spoolchunk_t))
+
+/** Most bytes one encoded sample can take */
+#define PROXYSPOOL_MAX_SAMPLE_SIZE (4 * 10 + PROXYSPOOL_VALUE_SIZE)
+
+/** Largest XML produced for one sample */
+#define PROXYSPOOL_MAX_SAMPLE_XML_SIZE 512
+
+/** Value token marking a value stored as text instead of a decimal */
+#define PROXYSPOOL_TEXT_TOKEN 31
+
+/** Most significant digits of a value stored as a decimal */
+#define PROXYSPOOL_MAX_DIGITS 17
+
+/** Maps signed integers to unsigned ones so small magnitudes stay small */
+#define ZIGZAG(n) (((uint64_t) (n) << 1) ^ (uint64_t) ((int64_t) (n) >> 63))
+#define UNZIGZAG(z) ((int64_t) ((z) >> 1) ^ -(int64_t) ((z) & 1))
+
+/** Identifies a spool file, and the version of its layout */
+#define PROXYSPOOL_FILE_MAGIC 0x4c505350
+#define PROXYSPOOL_FILE_VERSION 1
+
+/**
+ * Encoder state of a series, which is what each new sample is a delta from
+ */
+typedef struct spoolstate_t {
+
+  /** Timestamp of the last sample */
+  time_t lastTime;
+
+  /** Seconds between the last two samples */
+  long lastDelta;
+
+  /** Mantissa of the last decimal value */
+  long long lastMantissa;
+
+  /** Decimal places of the last value, -1 if it was text */
+  int scale;
+
+} spoolstate_t;
+
+/**
+ * One column of samples
+ */
+typedef struct spoolseries_t {
+
+  bool inUse;
+
+  char deviceId[PROXYSPOOL_DEVICE_ID_SIZE];
+
+  char paramName[PROXYSPOOL_NAME_SIZE];
+
+  char multiplier[PROXYSPOOL_MULTIPLIER_SIZE];
+
+  /** Param index, -1 if it has none */
+  int index;
+
+  /** Number of chunks holding samples of this series */
+  int totalChunks;
+
+  /** Chunk samples are appended to, -1 if none */
+  int openChunk;
+
+  /** State after the last sample appended to the open chunk */
+  spoolstate_t state;
+
+} spoolseries_t;
+
+/**
+ * A run of encoded samples from a single series
+ */
+typedef struct spoolchunk_t {
+
+  /** Series the samples belong to */
+  int series;
+
+  /** Next chunk in order of age, or in the free list */
+  int next;
+
+  /** Timestamp of the first sample */
+  time_t firstTime;
+
+  /** Number of samples in the chunk */
+  unsigned short totalSamples;
+
+  /** Number of samples already expanded into a message */
+  unsigned short sentSamples;
+
+  /** Bytes of data used */
+  unsigned short used;
+
+  unsigned char data[PROXYSPOOL_CHUNK_SIZE];
+
+} spoolchunk_t;
+
+/**
+ * Header of a spool file
+ */
+typedef struct spoolfile_t {
+
+  uint32_t magic;
+
+  uint32_t version;
+
+  uint32_t seriesSize;
+
+  uint32_t chunkSize;
+
+  uint32_t totalSeries;
+
+  uint32_t totalChunks;
+
+} spoolfile_t;
+
+/** Chunks of encoded samples */
+static spoolchunk_t spoolChunks[PROXYSPOOL_TOTAL_CHUNKS];
+
+/** Columns of samples */
+static spoolseries_t spoolSeries[PROXYSPOOL_MAX_SERIES];
+
+/** Oldest and newest chunks holding samples, -1 if the spool is empty */
+static int oldestChunk = -1;
+static int newestChunk = -1;
+
+/** Head of the list of free chunks */
+static int freeChunk = -1;
+
+/** Number of chunks holding samples */
+static int usedChunks = 0;
+
+/** Samples dropped because the spool was full, since the last warning */
+static unsigned long droppedSamples = 0;
+
+/** Last time the spool was saved to flash */
+static time_t lastSaveTime = 0;
+
+/** Mutex to protect the spool */
+static pthread_mutex_t spoolMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/***************** Private Prototypes ****************/
+static void _proxyspool_clear();
+
+static int _proxyspool_getSeries(const char *deviceId, const char *paramName, const char *multiplier, int index);
+
+static error_t _proxyspool_append(int series, time_t timestamp, const char *value);
+
+static int _proxyspool_allocChunk();
+
+static void _proxyspool_releaseOldest();
+
+static int _proxyspool_encode(unsigned char *dest, spoolstate_t *state, bool first, time_t timestamp, const char *value);
+
+static int _proxyspool_expandChunk(char *dest, int maxSize, spoolchunk_t *chunk);
+
+static int _proxyspool_putVarint(unsigned char *dest, uint64_t value);
+
+static int _proxyspool_getVarint(const unsigned char *src, int len, uint64_t *value);
+
+static bool _proxyspool_parseDecimal(const char *text, long long *mantissa, int *scale);
+
+static void _proxyspool_formatDecimal(char *dest, int maxSize, long long mantissa, int scale);
+
+static bool _proxyspool_getAttribute(const char *tag, int tagLen, const char *name, char *dest, int destSize);
+
+/***************** Public Functions ****************/
+/**
+ * Start the spool, restoring it from flash if PROXYSPOOL_FILENAME is defined
+ */
+void proxyspool_start() {
+  pthread_mutex_lock(&spoolMutex);
+  _proxyspool_clear();
+  pthread_mutex_unlock(&spoolMutex);
+
+#ifdef PROXYSPOOL_FILENAME
+  if(proxyspool_load(PROXYSPOOL_FILENAME) == SUCCESS) {
+    SYSLOG_INFO("Restored %d bytes of spooled measurements", proxyspool_size());
+  }
+#endif
+}
+
+/**
+ * Stop the spool, saving it to flash if PROXYSPOOL_FILENAME is defined
+ */
+void proxyspool_stop() {
+#ifdef PROXYSPOOL_FILENAME
+  proxyspool_save(PROXYSPOOL_FILENAME);
+#endif
+}
+
+/**
+ * Spool every measurement in a message the server didn't receive. The
+ * <measure> blocks are cut out of the message, leaving anything else in it
+ * to be sent again.
+ *
+ * @param msg Null-terminated XML of <measure> blocks and other elements, as
+ *     written by the agents
+ * @return the number of measurements spooled
+ */
+int proxyspool_addMsg(char *msg) {
+  char deviceId[PROXYSPOOL_DEVICE_ID_SIZE];
+  char paramName[PROXYSPOOL_NAME_SIZE];
+  char multiplier[PROXYSPOOL_MULTIPLIER_SIZE];
+  char indexText[PROXYSPOOL_NAME_SIZE];
+  char timestampText[TIMESTAMP_STAMP_SIZE];
+  char value[PROXYSPOOL_VALUE_SIZE];
+  char *block = msg;
+  char *blockTagEnd;
+  char *blockEnd;
+  const char *param;
+  const char *paramTagEnd;
+  const char *paramEnd;
+  time_t timestamp;
+  int valueLen;
+  int total = 0;
+
+  while((block = strstr(block, "<measure ")) != NULL) {
+    if((blockTagEnd = strchr(block, '>')) == NULL) {
+      break;
+    }
+
+    if(*(blockTagEnd - 1) == '/') {
+      // An empty block asking to push measurements now, which we're already
+      // trying to do
+      memmove(block, blockTagEnd + 1, strlen(blockTagEnd + 1) + 1);
+      continue;
+    }
+
+    if((blockEnd = strstr(blockTagEnd, "</measure>")) == NULL) {
+      break;
+    }
+
+    blockEnd += strlen("</measure>");
+
+    if(!_proxyspool_getAttribute(block, blockTagEnd - block, "deviceId", deviceId, sizeof(deviceId))) {
+      SYSLOG_WARNING("Can't spool a measurement without a device ID");
+      memmove(block, blockEnd, strlen(blockEnd) + 1);
+      continue;
+    }
+
+    timestamp = 0;
+    if(_proxyspool_getAttribute(block, blockTagEnd - block, "timestamp", timestampText, sizeof(timestampText))) {
+      timestamp = parseTimestamp(timestampText);
+    }
+
+    if(timestamp == 0) {
+      timestamp = time(NULL);
+    }
+
+    param = blockTagEnd;
+    while((param = strstr(param, "<param ")) != NULL && param < blockEnd) {
+      if((paramTagEnd = strchr(param, '>')) == NULL || (paramEnd = strstr(paramTagEnd, "</param>")) == NULL || paramEnd > blockEnd) {
+        break;
+      }
+
+      valueLen = paramEnd - (paramTagEnd + 1);
+
+      if(!_proxyspool_getAttribute(param, paramTagEnd - param, "name", paramName, sizeof(paramName)) || valueLen >= sizeof(value)) {
+        SYSLOG_WARNING("Can't spool a param of %s", deviceId);
+        param = paramEnd;
+        continue;
+      }
+
+      memcpy(value, paramTagEnd + 1, valueLen);
+      value[valueLen] = '\0';
+
+      if(!_proxyspool_getAttribute(param, paramTagEnd - param, "multiplier", multiplier, sizeof(multiplier))) {
+        multiplier[0] = '\0';
+      }
+
+      if(!_proxyspool_getAttribute(param, paramTagEnd - param, "index", indexText, sizeof(indexText))) {
+        strcpy(indexText, "-1");
+      }
+
+      if(proxyspool_add(timestamp, deviceId, paramName, multiplier, atoi(indexText), value) == SUCCESS) {
+        total++;
+      }
+
+      param = paramEnd;
+    }
+
+    memmove(block, blockEnd, strlen(blockEnd) + 1);
+  }
+
+#ifdef PROXYSPOOL_FILENAME
+  if(total > 0 && time(NULL) - lastSaveTime >= PROXYSPOOL_SAVE_PERIOD_SEC) {
+    proxyspool_save(PROXYSPOOL_FILENAME);
+  }
+#endif
+
+  return total;
+}
+
+/**
+ * Spool one measurement
+ *
+ * @param timestamp Time the measurement was taken
+ * @param deviceId Device ID
+ * @param paramName Param name
+ * @param multiplier Param multiplier, or an empty string
+ * @param index Param index, or -1
+ * @param value Param value as it appears in the XML
+ * @return SUCCESS if the measurement was spooled
+ */
+error_t proxyspool_add(time_t timestamp, const char *deviceId, const char *paramName, const char *multiplier, int index, const char *value) {
+  int series;
+  error_t result = FAIL;
+
+  if(strlen(value) >= PROXYSPOOL_VALUE_SIZE) {
+    return FAIL;
+  }
+
+  pthread_mutex_lock(&spoolMutex);
+
+  if((series = _proxyspool_getSeries(deviceId, paramName, multiplier, index)) < 0) {
+    SYSLOG_WARNING("Too many series to spool %s of %s", paramName, deviceId);
+
+  } else {
+    result = _proxyspool_append(series, timestamp, value);
+  }
+
+  pthread_mutex_unlock(&spoolMutex);
+  return result;
+}
+
+/**
+ * Write the oldest spooled measurements as h2s XML, as many as fit. The
+ * measurements written are removed from the spool.
+ *
+ * @param dest Destination buffer
+ * @param maxSize Size of the destination buffer
+ * @return the length of the XML written
+ */
+int proxyspool_expand(char *dest, int maxSize) {
+  spoolchunk_t *chunk;
+  int offset = 0;
+
+  if(maxSize <= 0) {
+    return 0;
+  }
+
+  dest[0] = '\0';
+
+  pthread_mutex_lock(&spoolMutex);
+
+  while(oldestChunk >= 0) {
+    chunk = &spoolChunks[oldestChunk];
+    offset += _proxyspool_expandChunk(dest + offset, maxSize - offset, chunk);
+
+    if(chunk->sentSamples < chunk->totalSamples) {
+      // Out of room
+      break;
+    }
+
+    _proxyspool_releaseOldest();
+  }
+
+  if(droppedSamples > 0) {
+    SYSLOG_WARNING("Spool was full, dropped %lu measurements", droppedSamples);
+    droppedSamples = 0;
+  }
+
+  pthread_mutex_unlock(&spoolMutex);
+  return offset;
+}
+
+/**
+ * @return true if no measurements are spooled
+ */
+bool proxyspool_isEmpty() {
+  bool empty;
+
+  pthread_mutex_lock(&spoolMutex);
+  empty = (oldestChunk < 0);
+  pthread_mutex_unlock(&spoolMutex);
+
+  return empty;
+}
+
+/**
+ * @return the number of bytes of encoded measurements
+ */
+int proxyspool_size() {
+  int size = 0;
+  int i;
+
+  pthread_mutex_lock(&spoolMutex);
+  for(i = oldestChunk; i >= 0; i = spoolChunks[i].next) {
+    size += spoolChunks[i].used;
+  }
+  pthread_mutex_unlock(&spoolMutex);
+
+  return size;
+}
+
+/**
+ * Save the spool to a file, so it can be restored after a restart. An empty
+ * spool removes the file.
+ *
+ * @param filename File to write
+ * @return SUCCESS if the spool was saved
+ */
+error_t proxyspool_save(const char *filename) {
+  spoolfile_t header;
+  FILE *file;
+  int position;
+  int open;
+  int i;
+  int j;
+  error_t result = SUCCESS;
+
+  pthread_mutex_lock(&spoolMutex);
+  lastSaveTime = time(NULL);
+
+  if(oldestChunk < 0) {
+    pthread_mutex_unlock(&spoolMutex);
+    remove(filename);
+    return SUCCESS;
+  }
+
+  if((file = fopen(filename, "wb")) == NULL) {
+    pthread_mutex_unlock(&spoolMutex);
+    SYSLOG_ERR("Couldn't write %s", filename);
+    return FAIL;
+  }
+
+  bzero(&header, sizeof(header));
+  header.magic = PROXYSPOOL_FILE_MAGIC;
+  header.version = PROXYSPOOL_FILE_VERSION;
+  header.seriesSize = sizeof(spoolseries_t);
+  header.chunkSize = sizeof(spoolchunk_t);
+  header.totalChunks = usedChunks;
+
+  for(i = 0; i < PROXYSPOOL_MAX_SERIES; i++) {
+    if(spoolSeries[i].inUse) {
+      header.totalSeries++;
+    }
+  }
+
+  if(fwrite(&header, sizeof(header), 1, file) != 1) {
+    result = FAIL;
+  }
+
+  // Series are written with their slot, and their open chunk as its position
+  // in order of age, which is the order the chunks are written in
+  for(i = 0; i < PROXYSPOOL_MAX_SERIES && result == SUCCESS; i++) {
+    if(spoolSeries[i].inUse) {
+      open = -1;
+      for(j = oldestChunk, position = 0; j >= 0; j = spoolChunks[j].next, position++) {
+        if(j == spoolSeries[i].openChunk) {
+          open = position;
+        }
+      }
+
+      if(fwrite(&i, sizeof(i), 1, file) != 1
+          || fwrite(&spoolSeries[i], sizeof(spoolseries_t), 1, file) != 1
+          || fwrite(&open, sizeof(open), 1, file) != 1) {
+        result = FAIL;
+      }
+    }
+  }
+
+  for(i = oldestChunk; i >= 0 && result == SUCCESS; i = spoolChunks[i].next) {
+    if(fwrite(&spoolChunks[i], sizeof(spoolchunk_t), 1, file) != 1) {
+      result = FAIL;
+    }
+  }
+
+  pthread_mutex_unlock(&spoolMutex);
+
+  if(fclose(file) != 0 || result != SUCCESS) {
+    SYSLOG_ERR("Couldn't write %s", filename);
+    return FAIL;
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * Replace the spool with one saved by proxyspool_save(..)
+ *
+ * @param filename File to read
+ * @return SUCCESS if the spool was restored
+ */
+error_t proxyspool_load(const char *filename) {
+  spoolfile_t header;
+  spoolseries_t series;
+  int openPositions[PROXYSPOOL_MAX_SERIES];
+  FILE *file;
+  int slot;
+  int open;
+  int chunk;
+  int i;
+  int j;
+  error_t result = SUCCESS;
+
+  if((file = fopen(filename, "rb")) == NULL) {
+    return FAIL;
+  }
+
+  if(fread(&header, sizeof(header), 1, file) != 1
+      || header.magic != PROXYSPOOL_FILE_MAGIC
+      || header.version != PROXYSPOOL_FILE_VERSION
+      || header.seriesSize != sizeof(spoolseries_t)
+      || header.chunkSize != sizeof(spoolchunk_t)
+      || header.totalSeries > PROXYSPOOL_MAX_SERIES) {
+    SYSLOG_ERR("%s is not a spool this proxy can read", filename);
+    fclose(file);
+    return FAIL;
+  }
+
+  pthread_mutex_lock(&spoolMutex);
+  _proxyspool_clear();
+
+  for(i = 0; i < PROXYSPOOL_MAX_SERIES; i++) {
+    openPositions[i] = -1;
+  }
+
+  for(i = 0; i < header.totalSeries && result == SUCCESS; i++) {
+    if(fread(&slot, sizeof(slot), 1, file) != 1
+        || fread(&series, sizeof(series), 1, file) != 1
+        || fread(&open, sizeof(open), 1, file) != 1
+        || slot < 0 || slot >= PROXYSPOOL_MAX_SERIES) {
+      result = FAIL;
+
+    } else {
+      spoolSeries[slot] = series;
+      spoolSeries[slot].totalChunks = 0;
+      spoolSeries[slot].openChunk = -1;
+      openPositions[slot] = open;
+    }
+  }
+
+  // Chunks that don't fit are the newest ones, which we'd drop next anyway
+  for(i = 0; i < header.totalChunks && result == SUCCESS && freeChunk >= 0; i++) {
+    chunk = _proxyspool_allocChunk();
+
+    if(fread(&spoolChunks[chunk], sizeof(spoolchunk_t), 1, file) != 1
+        || spoolChunks[chunk].series < 0 || spoolChunks[chunk].series >= PROXYSPOOL_MAX_SERIES
+        || !spoolSeries[spoolChunks[chunk].series].inUse
+        || spoolChunks[chunk].used > PROXYSPOOL_CHUNK_SIZE) {
+      result = FAIL;
+
+    } else {
+      spoolChunks[chunk].next = -1;
+      spoolSeries[spoolChunks[chunk].series].totalChunks++;
+
+      if(openPositions[spoolChunks[chunk].series] == i) {
+        spoolSeries[spoolChunks[chunk].series].openChunk = chunk;
+      }
+    }
+  }
+
+  if(result != SUCCESS) {
+    SYSLOG_ERR("%s is corrupt", filename);
+    _proxyspool_clear();
+
+  } else {
+    // Series without chunks are gone
+    for(j = 0; j < PROXYSPOOL_MAX_SERIES; j++) {
+      if(spoolSeries[j].totalChunks == 0) {
+        spoolSeries[j].inUse = false;
+      }
+    }
+  }
+
+  pthread_mutex_unlock(&spoolMutex);
+  fclose(file);
+  return result;
+}
+
+/***************** Private Functions ****************/
+/**
+ * Empty the spool
+ */
+static void _proxyspool_clear() {
+  int i;
+
+  bzero(spoolSeries, sizeof(spoolSeries));
+  for(i = 0; i < PROXYSPOOL_MAX_SERIES; i++) {
+    spoolSeries[i].openChunk = -1;
+  }
+
+  for(i = 0; i < PROXYSPOOL_TOTAL_CHUNKS; i++) {
+    spoolChunks[i].series = -1;
+    spoolChunks[i].next = (i + 1 < PROXYSPOOL_TOTAL_CHUNKS) ? i + 1 : -1;
+  }
+
+  freeChunk = 0;
+  oldestChunk = -1;
+  newestChunk = -1;
+  usedChunks = 0;
+  droppedSamples = 0;
+}
+
+/**
+ * Find the series of a param, or start a new one
+ * @return the series, or -1 if there's no room for another one
+ */
+static int _proxyspool_getSeries(const char *deviceId, const char *paramName, const char *multiplier, int index) {
+  int freeSeries = -1;
+  int i;
+
+  for(i = 0; i < PROXYSPOOL_MAX_SERIES; i++) {
+    if(!spoolSeries[i].inUse) {
+      if(freeSeries < 0) {
+        freeSeries = i;
+      }
+
+    } else if(spoolSeries[i].index == index
+        && strcmp(spoolSeries[i].deviceId, deviceId) == 0
+        && strcmp(spoolSeries[i].paramName, paramName) == 0
+        && strcmp(spoolSeries[i].multiplier, multiplier) == 0) {
+      return i;
+    }
+  }
+
+  if(freeSeries >= 0) {
+    bzero(&spoolSeries[freeSeries], sizeof(spoolseries_t));
+    spoolSeries[freeSeries].inUse = true;
+    spoolSeries[freeSeries].index = index;
+    spoolSeries[freeSeries].openChunk = -1;
+    strncpy(spoolSeries[freeSeries].deviceId, deviceId, PROXYSPOOL_DEVICE_ID_SIZE - 1);
+    strncpy(spoolSeries[freeSeries].paramName, paramName, PROXYSPOOL_NAME_SIZE - 1);
+    strncpy(spoolSeries[freeSeries].multiplier, multiplier, PROXYSPOOL_MULTIPLIER_SIZE - 1);
+  }
+
+  return freeSeries;
+}
+
+/**
+ * Append a sample to a series, starting a new chunk if it doesn't fit in the
+ * open one
+ */
+static error_t _proxyspool_append(int series, time_t timestamp, const char *value) {
+  unsigned char sample[PROXYSPOOL_MAX_SAMPLE_SIZE];
+  spoolseries_t *focusedSeries = &spoolSeries[series];
+  spoolchunk_t *chunk;
+  spoolstate_t state;
+  int len;
+
+  if(focusedSeries->openChunk >= 0) {
+    chunk = &spoolChunks[focusedSeries->openChunk];
+    state = focusedSeries->state;
+    len = _proxyspool_encode(sample, &state, false, timestamp, value);
+
+    if(chunk->used + len <= PROXYSPOOL_CHUNK_SIZE && chunk->totalSamples < 0xFFFF) {
+      memcpy(chunk->data + chunk->used, sample, len);
+      chunk->used += len;
+      chunk->totalSamples++;
+      focusedSeries->state = state;
+      return SUCCESS;
+    }
+  }
+
+  // The chunk we take may be this series' oldest, which can leave the series
+  // without chunks for a moment
+  chunk = &spoolChunks[_proxyspool_allocChunk()];
+  focusedSeries->inUse = true;
+  focusedSeries->totalChunks++;
+  focusedSeries->openChunk = chunk - spoolChunks;
+
+  bzero(&state, sizeof(state));
+  len = _proxyspool_encode(chunk->data, &state, true, timestamp, value);
+  chunk->series = series;
+  chunk->firstTime = timestamp;
+  chunk->totalSamples = 1;
+  chunk->sentSamples = 0;
+  chunk->used = len;
+  focusedSeries->state = state;
+  return SUCCESS;
+}
+
+/**
+ * Take a chunk off the free list and make it the newest one, dropping the
+ * oldest chunk if the spool is full
+ * @return the chunk
+ */
+static int _proxyspool_allocChunk() {
+  int chunk;
+
+  if(freeChunk < 0) {
+    droppedSamples += spoolChunks[oldestChunk].totalSamples - spoolChunks[oldestChunk].sentSamples;
+    _proxyspool_releaseOldest();
+  }
+
+  chunk = freeChunk;
+  freeChunk = spoolChunks[chunk].next;
+
+  spoolChunks[chunk].next = -1;
+  if(newestChunk >= 0) {
+    spoolChunks[newestChunk].next = chunk;
+  } else {
+    oldestChunk = chunk;
+  }
+
+  newestChunk = chunk;
+  usedChunks++;
+  return chunk;
+}
+
+/**
+ * Put the oldest chunk back on the free list
+ */
+static void _proxyspool_releaseOldest() {
+  int chunk = oldestChunk;
+  spoolseries_t *focusedSeries = &spoolSeries[spoolChunks[chunk].series];
+
+  if(focusedSeries->openChunk == chunk) {
+    focusedSeries->openChunk = -1;
+  }
+
+  if(--focusedSeries->totalChunks == 0) {
+    focusedSeries->inUse = false;
+  }
+
+  oldestChunk = spoolChunks[chunk].next;
+  if(oldestChunk < 0) {
+    newestChunk = -1;
+  }
+
+  spoolChunks[chunk].series = -1;
+  spoolChunks[chunk].next = freeChunk;
+  freeChunk = chunk;
+  usedChunks--;
+}
+
+/**
+ * Encode one sample. The first sample of a chunk carries its timestamp in the
+ * chunk, and an absolute value.
+ *
+ * @param dest Destination, at least PROXYSPOOL_MAX_SAMPLE_SIZE bytes
+ * @param state Encoder state, updated to include this sample
+ * @param first True if this is the first sample of a chunk
+ * @param timestamp Time of the sample
+ * @param value Text of the value
+ * @return the number of bytes written
+ */
+static int _proxyspool_encode(unsigned char *dest, spoolstate_t *state, bool first, time_t timestamp, const char *value) {
+  long long mantissa;
+  long long delta;
+  int scale;
+  int len = 0;
+  int valueLen;
+
+  if(!first) {
+    delta = (long long) (timestamp - state->lastTime);
+    len += _proxyspool_putVarint(dest + len, ZIGZAG(delta - state->lastDelta));
+    state->lastDelta = (long) delta;
+  }
+
+  state->lastTime = timestamp;
+
+  if(!_proxyspool_parseDecimal(value, &mantissa, &scale)) {
+    // Token, length, text
+    valueLen = strlen(value);
+    len += _proxyspool_putVarint(dest + len, (PROXYSPOOL_TEXT_TOKEN << 1) | 1);
+    len += _proxyspool_putVarint(dest + len, valueLen);
+    memcpy(dest + len, value, valueLen);
+    len += valueLen;
+    state->scale = -1;
+
+  } else if(first || scale != state->scale) {
+    // Token carrying the decimal places, absolute mantissa
+    len += _proxyspool_putVarint(dest + len, (scale << 1) | 1);
+    len += _proxyspool_putVarint(dest + len, ZIGZAG(mantissa));
+    state->lastMantissa = mantissa;
+    state->scale = scale;
+
+  } else {
+    // Delta from the last mantissa
+    len += _proxyspool_putVarint(dest + len, ZIGZAG(mantissa - state->lastMantissa) << 1);
+    state->lastMantissa = mantissa;
+  }
+
+  return len;
+}
+
+/**
+ * Decode a chunk and write the samples not sent yet as XML, as many as fit
+ * @return the length of the XML written
+ */
+static int _proxyspool_expandChunk(char *dest, int maxSize, spoolchunk_t *chunk) {
+  char xml[PROXYSPOOL_MAX_SAMPLE_XML_SIZE];
+  char timestamp[TIMESTAMP_STAMP_SIZE];
+  char value[PROXYSPOOL_VALUE_SIZE];
+  spoolseries_t *focusedSeries = &spoolSeries[chunk->series];
+  spoolstate_t state;
+  uint64_t token;
+  uint64_t valueLen;
+  int position = 0;
+  int xmlLen;
+  int offset = 0;
+  int sample;
+  int len;
+
+  bzero(&state, sizeof(state));
+  state.lastTime = chunk->firstTime;
+
+  for(sample = 0; sample < chunk->totalSamples; sample++) {
+    if(sample > 0) {
+      if((len = _proxyspool_getVarint(chunk->data + position, chunk->used - position, &token)) == 0) {
+        break;
+      }
+
+      position += len;
+      state.lastDelta += (long) UNZIGZAG(token);
+      state.lastTime += state.lastDelta;
+    }
+
+    if((len = _proxyspool_getVarint(chunk->data + position, chunk->used - position, &token)) == 0) {
+      break;
+    }
+
+    position += len;
+
+    if((token & 1) == 0) {
+      state.lastMantissa += UNZIGZAG(token >> 1);
+      _proxyspool_formatDecimal(value, sizeof(value), state.lastMantissa, state.scale);
+
+    } else if((token >> 1) == PROXYSPOOL_TEXT_TOKEN) {
+      if((len = _proxyspool_getVarint(chunk->data + position, chunk->used - position, &valueLen)) == 0
+          || valueLen >= sizeof(value) || position + len + valueLen > chunk->used) {
+        break;
+      }
+
+      position += len;
+      memcpy(value, chunk->data + position, valueLen);
+      value[valueLen] = '\0';
+      position += valueLen;
+      state.scale = -1;
+
+    } else {
+      state.scale = token >> 1;
+      if((len = _proxyspool_getVarint(chunk->data + position, chunk->used - position, &token)) == 0) {
+        break;
+      }
+
+      position += len;
+      state.lastMantissa = UNZIGZAG(token);
+      _proxyspool_formatDecimal(value, sizeof(value), state.lastMantissa, state.scale);
+    }
+
+    if(sample < chunk->sentSamples) {
+      continue;
+    }
+
+    getTimestampAt(timestamp, sizeof(timestamp), state.lastTime);
+    xmlLen = snprintf(xml, sizeof(xml), "<measure deviceId=\"%s\" timestamp=\"%s\"><param name=\"%s\"",
+        focusedSeries->deviceId, timestamp, focusedSeries->paramName);
+
+    if(focusedSeries->index >= 0) {
+      xmlLen += snprintf(xml + xmlLen, sizeof(xml) - xmlLen, " index=\"%d\"", focusedSeries->index);
+    }
+
+    if(strlen(focusedSeries->multiplier) > 0) {
+      xmlLen += snprintf(xml + xmlLen, sizeof(xml) - xmlLen, " multiplier=\"%s\"", focusedSeries->multiplier);
+    }
+
+    xmlLen += snprintf(xml + xmlLen, sizeof(xml) - xmlLen, ">%s</param></measure>", value);
+
+    if(xmlLen >= maxSize - offset) {
+      return offset;
+    }
+
+    memcpy(dest + offset, xml, xmlLen + 1);
+    offset += xmlLen;
+    chunk->sentSamples++;
+  }
+
+  if(sample < chunk->totalSamples) {
+    SYSLOG_ERR("Dropping a corrupt chunk of %s", focusedSeries->paramName);
+    chunk->sentSamples = chunk->totalSamples;
+  }
+
+  return offset;
+}
+
+/**
+ * Write an unsigned LEB128 varint
+ * @return the number of bytes written, at most 10
+ */
+static int _proxyspool_putVarint(unsigned char *dest, uint64_t value) {
+  int len = 0;
+
+  while(value >= 0x80) {
+    dest[len++] = (unsigned char) (value | 0x80);
+    value >>= 7;
+  }
+
+  dest[len++] = (unsigned char) value;
+  return len;
+}
+
+/**
+ * Read an unsigned LEB128 varint
+ * @return the number of bytes read, 0 if the varint runs past the end
+ */
+static int _proxyspool_getVarint(const unsigned char *src, int len, uint64_t *value) {
+  int shift = 0;
+  int i;
+
+  *value = 0;
+  for(i = 0; i < len && shift < 64; i++, shift += 7) {
+    *value |= (uint64_t) (src[i] & 0x7F) << shift;
+    if((src[i] & 0x80) == 0) {
+      return i + 1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Read a value as a decimal, if _proxyspool_formatDecimal(..) would write it
+ * back exactly the same way
+ * @return true if the value is a decimal
+ */
+static bool _proxyspool_parseDecimal(const char *text, long long *mantissa, int *scale) {
+  const char *c = text;
+  bool negative = false;
+  bool point = false;
+  int digits = 0;
+
+  *mantissa = 0;
+  *scale = 0;
+
+  if(*c == '-') {
+    negative = true;
+    c++;
+  }
+
+  // No leading zeros
+  if(*c < '0' || *c > '9' || (*c == '0' && c[1] >= '0' && c[1] <= '9')) {
+    return false;
+  }
+
+  for(; *c != '\0'; c++) {
+    if(*c >= '0' && *c <= '9') {
+      if(++digits > PROXYSPOOL_MAX_DIGITS) {
+        return false;
+      }
+
+      *mantissa = *mantissa * 10 + (*c - '0');
+      if(point) {
+        (*scale)++;
+      }
+
+    } else if(*c == '.' && !point && c[1] >= '0' && c[1] <= '9') {
+      point = true;
+
+    } else {
+      return false;
+    }
+  }
+
+  if(negative) {
+    if(*mantissa == 0) {
+      // Negative zero
+      return false;
+    }
+
+    *mantissa = -*mantissa;
+  }
+
+  return true;
+}
+
+/**
+ * Write a decimal value
+ */
+static void _proxyspool_formatDecimal(char *dest, int maxSize, long long mantissa, int scale) {
+  char digits[PROXYSPOOL_MAX_DIGITS + 2];
+  unsigned long long magnitude = (mantissa < 0) ? -(unsigned long long) mantissa : mantissa;
+  int totalDigits;
+  int offset = 0;
+
+  // At least one digit before the point
+  totalDigits = snprintf(digits, sizeof(digits), "%0*llu", scale + 1, magnitude);
+
+  if(mantissa < 0) {
+    offset += snprintf(dest + offset, maxSize - offset, "-");
+  }
+
+  offset += snprintf(dest + offset, maxSize - offset, "%.*s", totalDigits - scale, digits);
+
+  if(scale > 0) {
+    snprintf(dest + offset, maxSize - offset, ".%s", digits + totalDigits - scale);
+  }
+}
+
+/**
+ * Copy the value of an attribute out of an XML tag
+ *
+ * @param tag Start of the tag
+ * @param tagLen Length of the tag
+ * @param name Attribute name
+ * @param dest Destination for the value
+ * @param destSize Size of the destination
+ * @return true if the tag has the attribute, and its value fits
+ */
+static bool _proxyspool_getAttribute(const char *tag, int tagLen, const char *name, char *dest, int destSize) {
+  int nameLen = strlen(name);
+  int valueLen;
+  const char *value;
+  const char *end;
+  int i;
+
+  for(i = 1; i + nameLen + 2 < tagLen; i++) {
+    if(tag[i - 1] == ' ' && strncmp(tag + i, name, nameLen) == 0 && tag[i + nameLen] == '=' && tag[i + nameLen + 1] == '"') {
+      value = tag + i + nameLen + 2;
+      end = memchr(value, '"', tag + tagLen - value);
+      if(end == NULL || (valueLen = end - value) >= destSize) {
+        return false;
+      }
+
+      memcpy(dest, value, valueLen);
+      dest[valueLen] = '\0';
+      return true;
+    }
+  }
+
+  return false;
+}
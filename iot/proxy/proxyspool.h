@@ -0,0 +1,77 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef PROXYSPOOL_H
+#define PROXYSPOOL_H
+
+#include <stdbool.h>
+#include <time.h>
+#include "ioterror.h"
+
+/** Bytes of RAM the spool may use, including chunk bookkeeping */
+#ifndef PROXYSPOOL_MAX_BYTES
+#define PROXYSPOOL_MAX_BYTES (256 * 1024)
+#endif
+
+/** Bytes of encoded samples in one chunk */
+#ifndef PROXYSPOOL_CHUNK_SIZE
+#define PROXYSPOOL_CHUNK_SIZE 240
+#endif
+
+/** Maximum number of (device, param) series spooled at once */
+#ifndef PROXYSPOOL_MAX_SERIES
+#define PROXYSPOOL_MAX_SERIES 256
+#endif
+
+/** Minimum number of seconds between saving the spool to flash */
+#ifndef PROXYSPOOL_SAVE_PERIOD_SEC
+#define PROXYSPOOL_SAVE_PERIOD_SEC 300
+#endif
+
+/*
+ * Define PROXYSPOOL_FILENAME, i.e. "/opt/var/proxy.spool", to keep the spool
+ * on flash across restarts.
+ */
+
+enum {
+  PROXYSPOOL_DEVICE_ID_SIZE = 32,
+  PROXYSPOOL_NAME_SIZE = 32,
+  PROXYSPOOL_MULTIPLIER_SIZE = 8,
+  PROXYSPOOL_VALUE_SIZE = 64,
+};
+
+/***************** Public Prototypes ****************/
+void proxyspool_start();
+
+void proxyspool_stop();
+
+int proxyspool_addMsg(char *msg);
+
+error_t proxyspool_add(time_t timestamp, const char *deviceId, const char *paramName, const char *multiplier, int index, const char *value);
+
+int proxyspool_expand(char *dest, int maxSize);
+
+bool proxyspool_isEmpty();
+
+int proxyspool_size();
+
+error_t proxyspool_save(const char *filename);
+
+error_t proxyspool_load(const char *filename);
+
+#endif
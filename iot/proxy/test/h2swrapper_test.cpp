@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2011 People Power Company
+ * All rights reserved.
+ *
+ * This open source code was developed with funding from People Power Company
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the People Power Corporation nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * PEOPLE POWER CO. OR ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE
+ */
+
+
+
+#include <string.h>
+#include <stdio.h>
+#include <iostream>
+#include <fstream>
+#include <rpc/types.h>
+
+#include "cppunit/extensions/HelperMacros.h"
+
+extern "C" {
+#include "iotdebug.h"
+#include "ioterror.h"
+#include "h2swrapper.h"
+#include "h2swrapper_test.h"
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION( H2sWrapperTest );
+
+void H2sWrapperTest::testFrame(void) {
+  char message[] = "<measure deviceId=\"DEVICE-1\"><param name=\"power\">12</param></measure>";
+  h2swrapper_frame_t first;
+  h2swrapper_frame_t second;
+
+  CPPUNIT_ASSERT_MESSAGE("Couldn't frame the message", h2swrapper_frame(&first, message, NULL, 0) > 0);
+  CPPUNIT_ASSERT_MESSAGE("XML wasn't framed in place", first.totalSegments == 3 && first.segments[1].iov_base == message);
+  CPPUNIT_ASSERT_MESSAGE("Wrong framed length",
+      first.len == (int) (first.segments[0].iov_len + strlen(message) + first.segments[2].iov_len));
+
+  CPPUNIT_ASSERT_MESSAGE("Couldn't frame the next message", h2swrapper_frame(&second, message, NULL, 0) > 0);
+  CPPUNIT_ASSERT_MESSAGE("Sequence number didn't advance", second.seq == first.seq + 1);
+  CPPUNIT_ASSERT_MESSAGE("Sequence number isn't in the header", strstr(second.header, "seq=\"") != NULL);
+}
+
+void H2sWrapperTest::testWrap(void) {
+  char message[] = "<alert deviceId=\"DEVICE-1\" />";
+  char dest[256];
+  int len;
+
+  len = h2swrapper_wrap(dest, message, sizeof(dest));
+  CPPUNIT_ASSERT_MESSAGE("Couldn't wrap the message", len == (int) strlen(dest));
+  CPPUNIT_ASSERT_MESSAGE("Message isn't in the wrapper", strstr(dest, message) != NULL);
+  CPPUNIT_ASSERT_MESSAGE("Missing footer", strcmp(dest + len - strlen("</h2s>"), "</h2s>") == 0);
+
+  CPPUNIT_ASSERT_MESSAGE("Wrapped into a buffer that's too small", h2swrapper_wrap(dest, message, 32) < 0);
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2011 People Power Company
+ * All rights reserved.
+ *
+ * This open source code was developed with funding from People Power Company
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the People Power Corporation nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * PEOPLE POWER CO. OR ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE
+ */
+
+
+
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <rpc/types.h>
+
+#include "cppunit/extensions/HelperMacros.h"
+
+extern "C" {
+#include "iotdebug.h"
+#include "ioterror.h"
+#include "proxycapture.h"
+#include "proxycapture_test.h"
+}
+
+#define CAPTURE_TEST_FILENAME "/tmp/proxycapture_test.cap"
+
+CPPUNIT_TEST_SUITE_REGISTRATION( ProxyCaptureTest );
+
+void ProxyCaptureTest::testRoundTrip(void) {
+  const char *inbound = "<?xml version=\"1.0\" encoding=\"UTF-8\"?><s2h status=\"ACK\"/>";
+  const char *outbound = "<measure deviceId=\"a\"><param name=\"x\">1</param></measure>";
+  proxycapture_reader_t reader;
+  proxycapture_record_t record;
+  uint64_t lastUsec;
+
+  // Nothing is written before the capture starts
+  proxycapture_record(PROXYCAPTURE_INBOUND, inbound, strlen(inbound));
+
+  CPPUNIT_ASSERT_MESSAGE("Couldn't start capturing", proxycapture_start(CAPTURE_TEST_FILENAME) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Not capturing", proxycapture_isCapturing());
+
+  proxycapture_record(PROXYCAPTURE_OUTBOUND, outbound, strlen(outbound));
+  proxycapture_record(PROXYCAPTURE_OUTBOUND, "", 0);
+  usleep(2000);
+  proxycapture_record(PROXYCAPTURE_INBOUND, inbound, strlen(inbound));
+  proxycapture_stop();
+
+  CPPUNIT_ASSERT_MESSAGE("Still capturing", !proxycapture_isCapturing());
+
+  // Nothing is written after the capture stops
+  proxycapture_record(PROXYCAPTURE_INBOUND, inbound, strlen(inbound));
+
+  CPPUNIT_ASSERT_MESSAGE("Couldn't open the capture", proxycapture_open(&reader, CAPTURE_TEST_FILENAME) == SUCCESS);
+
+  CPPUNIT_ASSERT_MESSAGE("Missing the first record", proxycapture_next(&reader, &record) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Wrong direction", record.direction == PROXYCAPTURE_OUTBOUND);
+  CPPUNIT_ASSERT_MESSAGE("Wrong length", record.len == (int) strlen(outbound));
+  CPPUNIT_ASSERT_MESSAGE("Wrong message", strcmp(record.msg, outbound) == 0);
+  lastUsec = record.usec;
+
+  CPPUNIT_ASSERT_MESSAGE("Missing the empty record", proxycapture_next(&reader, &record) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Empty record isn't empty", record.len == 0 && record.msg[0] == '\0');
+
+  CPPUNIT_ASSERT_MESSAGE("Missing the last record", proxycapture_next(&reader, &record) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Wrong direction", record.direction == PROXYCAPTURE_INBOUND);
+  CPPUNIT_ASSERT_MESSAGE("Wrong message", strcmp(record.msg, inbound) == 0);
+  CPPUNIT_ASSERT_MESSAGE("Time went backwards", record.usec >= lastUsec + 2000);
+
+  CPPUNIT_ASSERT_MESSAGE("Too many records", proxycapture_next(&reader, &record) == FAIL);
+
+  proxycapture_close(&reader);
+  unlink(CAPTURE_TEST_FILENAME);
+}
+
+void ProxyCaptureTest::testTruncated(void) {
+  const char *msg = "<s2h status=\"CONT\"/>";
+  proxycapture_reader_t reader;
+  proxycapture_record_t record;
+  FILE *file;
+  long size;
+
+  CPPUNIT_ASSERT_MESSAGE("Couldn't open a file that isn't a capture", proxycapture_open(&reader, "/dev/null") == FAIL);
+
+  CPPUNIT_ASSERT_MESSAGE("Couldn't start capturing", proxycapture_start(CAPTURE_TEST_FILENAME) == SUCCESS);
+  proxycapture_record(PROXYCAPTURE_INBOUND, msg, strlen(msg));
+  proxycapture_record(PROXYCAPTURE_INBOUND, msg, strlen(msg));
+  proxycapture_stop();
+
+  // Cut the last record short, as if the proxy died while writing it
+  file = fopen(CAPTURE_TEST_FILENAME, "r+b");
+  fseek(file, 0, SEEK_END);
+  size = ftell(file);
+  fclose(file);
+  CPPUNIT_ASSERT_MESSAGE("Couldn't truncate the capture", truncate(CAPTURE_TEST_FILENAME, size - 3) == 0);
+
+  CPPUNIT_ASSERT_MESSAGE("Couldn't open the capture", proxycapture_open(&reader, CAPTURE_TEST_FILENAME) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Missing the first record", proxycapture_next(&reader, &record) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Wrong message", strcmp(record.msg, msg) == 0);
+  CPPUNIT_ASSERT_MESSAGE("Read a record that was cut short", proxycapture_next(&reader, &record) == FAIL);
+
+  proxycapture_close(&reader);
+  unlink(CAPTURE_TEST_FILENAME);
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2011 People Power Company
+ * All rights reserved.
+ *
+ * This open source code was developed with funding from People Power Company
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the People Power Corporation nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * PEOPLE POWER CO. OR ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE
+ */
+
+
+#include <string.h>
+#include <stdio.h>
+#include <rpc/types.h>
+
+#include "cppunit/extensions/HelperMacros.h"
+
+extern "C" {
+#include "iotdebug.h"
+#include "ioterror.h"
+#include "proxyconfig.h"
+#include "proxyconfig_test.h"
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION( ProxyConfigTest );
+
+void ProxyConfigTest::testSnapshot(void) {
+  const proxyconfig_t *before;
+  const proxyconfig_t *after;
+  char url[PROXY_URL_SIZE + 8];
+
+  proxyconfig_setUrl("first.example.com/deviceio/ml");
+  proxyconfig_setActivationToken("TOKEN-1");
+
+  before = proxyconfig_acquire();
+  CPPUNIT_ASSERT_MESSAGE("URL is missing its scheme", strcmp(before->url, "http://first.example.com/deviceio/ml") == 0);
+  CPPUNIT_ASSERT_MESSAGE("Wrong activation token", before->activationToken != NULL && strcmp(before->activationToken, "TOKEN-1") == 0);
+
+  proxyconfig_setUrl("https://second.example.com/deviceio/ml");
+  proxyconfig_setActivationToken(NULL);
+
+  CPPUNIT_ASSERT_MESSAGE("Held snapshot changed", strcmp(before->url, "http://first.example.com/deviceio/ml") == 0);
+  CPPUNIT_ASSERT_MESSAGE("Held activation token changed", before->activationToken != NULL && strcmp(before->activationToken, "TOKEN-1") == 0);
+
+  after = proxyconfig_acquire();
+  CPPUNIT_ASSERT_MESSAGE("New URL wasn't published", strcmp(after->url, "https://second.example.com/deviceio/ml") == 0);
+  CPPUNIT_ASSERT_MESSAGE("Activation token wasn't cleared", after->activationToken == NULL);
+  CPPUNIT_ASSERT_MESSAGE("No certificate without SSL", after->certificate == NULL);
+
+  proxyconfig_release(after);
+  proxyconfig_release(before);
+
+  proxyconfig_getUrl(url, sizeof(url));
+  CPPUNIT_ASSERT_MESSAGE("Wrong URL copied", strcmp(url, "https://second.example.com/deviceio/ml") == 0);
+}
+
+void ProxyConfigTest::testHeldSnapshots(void) {
+  const proxyconfig_t *held[PROXYCONFIG_MAX_SNAPSHOTS - 1];
+  int i;
+
+  // Hold every snapshot but the one the next set needs
+  for(i = 0; i < PROXYCONFIG_MAX_SNAPSHOTS - 1; i++) {
+    proxyconfig_setUploadIntervalSec(100 + i);
+    held[i] = proxyconfig_acquire();
+  }
+
+  for(i = 0; i < PROXYCONFIG_MAX_SNAPSHOTS - 1; i++) {
+    CPPUNIT_ASSERT_MESSAGE("Held snapshot changed", held[i]->uploadIntervalSec == 100 + i);
+  }
+
+  proxyconfig_setUploadIntervalSec(200);
+  CPPUNIT_ASSERT_MESSAGE("Last free snapshot wasn't used", proxyconfig_getUploadIntervalSec() == 200);
+
+  for(i = 0; i < PROXYCONFIG_MAX_SNAPSHOTS - 1; i++) {
+    proxyconfig_release(held[i]);
+  }
+
+  proxyconfig_setUploadIntervalSec(PROXY_DEFAULT_UPLOAD_INTERVAL_SEC);
+  CPPUNIT_ASSERT_MESSAGE("Released snapshots weren't reused", proxyconfig_getUploadIntervalSec() == PROXY_DEFAULT_UPLOAD_INTERVAL_SEC);
+}
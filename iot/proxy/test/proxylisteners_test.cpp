@@ -90,6 +90,27 @@ void dummylistener(const char *message, int len) {
   CPPUNIT_ASSERT_MESSAGE("Dummy listener got a message!", false);
 }
 
+static int chunkBytes;
+
+static int chunkEnds;
+
+void chunkListener2(const char *chunk, int len) {
+  chunkBytes += len;
+  if(len == 0) {
+    chunkEnds++;
+  }
+}
+
+/**
+ * Swaps itself for chunkListener2 on the first chunk, which needs the
+ * listeners to be called without the lock held
+ */
+void chunkListener1(const char *chunk, int len) {
+  chunkBytes += len;
+  CPPUNIT_ASSERT_MESSAGE("Couldn't remove a chunk listener while broadcasting", proxylisteners_removeChunkListener(&chunkListener1) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Couldn't add a chunk listener while broadcasting", proxylisteners_addChunkListener(&chunkListener2) == SUCCESS);
+}
+
 void ProxyListenersTest::testListeners(void) {
   char msg[] = "Hello";
 
@@ -131,3 +152,20 @@ void ProxyListenersTest::testListeners(void) {
 }
 
 
+
+void ProxyListenersTest::testChunkListeners(void) {
+  chunkBytes = 0;
+  chunkEnds = 0;
+
+  CPPUNIT_ASSERT_MESSAGE("Couldn't add chunkListener1", proxylisteners_addChunkListener(&chunkListener1) == SUCCESS);
+
+  proxylisteners_broadcastChunk("<s2h>", 5);
+  CPPUNIT_ASSERT_MESSAGE("chunkListener1 didn't get the first chunk", chunkBytes == 5);
+
+  proxylisteners_broadcastChunk("</s2h>", 6);
+  proxylisteners_broadcastChunk("", 0);
+  CPPUNIT_ASSERT_MESSAGE("chunkListener2 didn't get the rest of the message", chunkBytes == 11 && chunkEnds == 1);
+
+  CPPUNIT_ASSERT_MESSAGE("chunkListener1 is still registered", proxylisteners_removeChunkListener(&chunkListener1) == FAIL);
+  CPPUNIT_ASSERT_MESSAGE("Couldn't remove chunkListener2", proxylisteners_removeChunkListener(&chunkListener2) == SUCCESS);
+}
@@ -40,6 +40,7 @@ class ProxyListenersTest : public CppUnit::TestFixture
 {
     CPPUNIT_TEST_SUITE( ProxyListenersTest );
     CPPUNIT_TEST( testListeners );
+    CPPUNIT_TEST( testChunkListeners );
     CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -48,6 +49,7 @@ public:
 
 private:
     void testListeners (void);
+    void testChunkListeners (void);
 };
 
 #endif
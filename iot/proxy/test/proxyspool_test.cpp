@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2011 People Power Company
+ * All rights reserved.
+ *
+ * This open source code was developed with funding from People Power Company
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the People Power Corporation nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * PEOPLE POWER CO. OR ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE
+ */
+
+
+#include <limits.h>
+#include <time.h>
+#include <sys/time.h>
+#include <string.h>
+#include <stdio.h>
+#include <iostream>
+#include <fstream>
+#include <rpc/types.h>
+
+#include "cppunit/extensions/HelperMacros.h"
+
+extern "C" {
+#include "iotdebug.h"
+#include "ioterror.h"
+#include "proxyspool.h"
+#include "proxyspool_test.h"
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION( ProxySpoolTest );
+
+/** Measurements as an agent writes them, in UTC so the output is predictable */
+static const char *agentMsg =
+    "<add deviceId=\"DEVICE-1\" deviceType=\"2\" />"
+    "<measure deviceId=\"DEVICE-1\" timestamp=\"2013-05-01T12:00:00+00:00\">"
+    "<param name=\"power\" multiplier=\"1\">120.50</param>"
+    "<param name=\"current\" multiplier=\"m\">-0.75</param>"
+    "<param name=\"outletStatus\" index=\"2\">ON</param>"
+    "</measure>"
+    "<measure deviceId=\"DEVICE-1\" p=\"1\" />"
+    "<measure deviceId=\"DEVICE-1\" timestamp=\"2013-05-01T05:01:00-07:00\">"
+    "<param name=\"power\" multiplier=\"1\">121.5</param>"
+    "<param name=\"current\" multiplier=\"m\">007</param>"
+    "<param name=\"outletStatus\" index=\"2\">OFF</param>"
+    "</measure>";
+
+void ProxySpoolTest::testRoundTrip(void) {
+  char msg[4096];
+  int len;
+
+  setenv("TZ", "UTC", 1);
+  tzset();
+
+  proxyspool_start();
+  CPPUNIT_ASSERT_MESSAGE("Spool didn't start empty", proxyspool_isEmpty());
+
+  strcpy(msg, agentMsg);
+  CPPUNIT_ASSERT_MESSAGE("Wrong number of measurements spooled", proxyspool_addMsg(msg) == 6);
+  CPPUNIT_ASSERT_MESSAGE("Didn't leave the rest of the message", strcmp(msg, "<add deviceId=\"DEVICE-1\" deviceType=\"2\" />") == 0);
+  CPPUNIT_ASSERT_MESSAGE("Spool is empty", !proxyspool_isEmpty());
+
+  len = proxyspool_expand(msg, sizeof(msg));
+  CPPUNIT_ASSERT_MESSAGE("Wrong length", len == (int) strlen(msg));
+  CPPUNIT_ASSERT_MESSAGE("Spool isn't empty after expanding everything", proxyspool_isEmpty());
+
+  // Values come back exactly as the agent wrote them, one series at a time
+  CPPUNIT_ASSERT_MESSAGE("Lost the power",
+      strstr(msg, "<measure deviceId=\"DEVICE-1\" timestamp=\"2013-05-01T12:00:00+00:00\"><param name=\"power\" multiplier=\"1\">120.50</param></measure>"
+          "<measure deviceId=\"DEVICE-1\" timestamp=\"2013-05-01T12:01:00+00:00\"><param name=\"power\" multiplier=\"1\">121.5</param></measure>") != NULL);
+  CPPUNIT_ASSERT_MESSAGE("Lost the current",
+      strstr(msg, "<param name=\"current\" multiplier=\"m\">-0.75</param>") != NULL
+      && strstr(msg, "<param name=\"current\" multiplier=\"m\">007</param>") != NULL);
+  CPPUNIT_ASSERT_MESSAGE("Lost the outlet status",
+      strstr(msg, "<param name=\"outletStatus\" index=\"2\">ON</param>") != NULL
+      && strstr(msg, "<param name=\"outletStatus\" index=\"2\">OFF</param>") != NULL);
+  CPPUNIT_ASSERT_MESSAGE("Spooled something other than a measurement", strstr(msg, "<add") == NULL && strstr(msg, "p=\"1\"") == NULL);
+
+  // What we expand can be spooled again
+  CPPUNIT_ASSERT_MESSAGE("Couldn't spool expanded measurements", proxyspool_addMsg(msg) == 6);
+  proxyspool_stop();
+}
+
+void ProxySpoolTest::testCompression(void) {
+  char value[PROXYSPOOL_VALUE_SIZE];
+  char msg[1024];
+  time_t start = 1367409600;
+  int i;
+
+  proxyspool_start();
+
+  // A day of one-minute power readings that wander slowly
+  for(i = 0; i < 1440; i++) {
+    snprintf(value, sizeof(value), "%.2lf", 100.0 + (i % 50) * 0.25);
+    CPPUNIT_ASSERT_MESSAGE("Couldn't spool", proxyspool_add(start + i * 60, "DEVICE-1", "power", "1", -1, value) == SUCCESS);
+  }
+
+  CPPUNIT_ASSERT_MESSAGE("A day of readings takes more than 3 bytes per sample", proxyspool_size() < 1440 * 3);
+
+  // The last one comes back out intact
+  while(proxyspool_expand(msg, sizeof(msg)) > 0 && !proxyspool_isEmpty());
+  CPPUNIT_ASSERT_MESSAGE("Lost the last reading", strstr(msg, ">109.75</param>") != NULL);
+  proxyspool_stop();
+}
+
+void ProxySpoolTest::testPartialExpand(void) {
+  char msg[256];
+  char all[8192];
+  int total = 0;
+  int len;
+  int i;
+
+  proxyspool_start();
+
+  for(i = 0; i < 20; i++) {
+    proxyspool_add(1367409600 + i, "DEVICE-1", "temp", "", -1, "70");
+  }
+
+  all[0] = '\0';
+  while((len = proxyspool_expand(msg, sizeof(msg))) > 0) {
+    CPPUNIT_ASSERT_MESSAGE("Overflowed the buffer", len < (int) sizeof(msg));
+    strcat(all, msg);
+  }
+
+  CPPUNIT_ASSERT_MESSAGE("Spool isn't empty", proxyspool_isEmpty());
+
+  for(char *c = all; (c = strstr(c, "<measure ")) != NULL; c++) {
+    total++;
+  }
+
+  CPPUNIT_ASSERT_MESSAGE("Lost or repeated samples across messages", total == 20);
+  proxyspool_stop();
+}
+
+void ProxySpoolTest::testFull(void) {
+  char value[PROXYSPOOL_VALUE_SIZE];
+  char msg[1024];
+  int i;
+
+  proxyspool_start();
+
+  // Random-looking values with no room for all of them
+  for(i = 0; i < 200000; i++) {
+    snprintf(value, sizeof(value), "%d", (i * 7919) % 100003);
+    proxyspool_add(1367409600 + i, "DEVICE-1", "power", "", -1, value);
+  }
+
+  CPPUNIT_ASSERT_MESSAGE("Spool grew past its limit", proxyspool_size() <= PROXYSPOOL_MAX_BYTES);
+
+  // The oldest samples were dropped, the newest are still there
+  proxyspool_expand(msg, sizeof(msg));
+  CPPUNIT_ASSERT_MESSAGE("Kept the oldest sample", strstr(msg, ">0</param>") == NULL);
+  proxyspool_stop();
+}
+
+void ProxySpoolTest::testSaveLoad(void) {
+  char before[4096];
+  char after[4096];
+  const char *filename = "./proxyspool_test.spool";
+  const char *appended = "<measure deviceId=\"DEVICE-1\" timestamp=\"2013-05-01T12:02:00+00:00\"><param name=\"power\" multiplier=\"1\">122.5</param></measure>";
+
+  setenv("TZ", "UTC", 1);
+  tzset();
+
+  proxyspool_start();
+  strcpy(before, agentMsg);
+  proxyspool_addMsg(before);
+  CPPUNIT_ASSERT_MESSAGE("Couldn't save", proxyspool_save(filename) == SUCCESS);
+
+  proxyspool_expand(before, sizeof(before));
+
+  // Keep appending to a restored series
+  CPPUNIT_ASSERT_MESSAGE("Couldn't load", proxyspool_load(filename) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Couldn't append", proxyspool_add(1367409720, "DEVICE-1", "power", "1", -1, "122.5") == SUCCESS);
+
+  proxyspool_expand(after, sizeof(after));
+  CPPUNIT_ASSERT_MESSAGE("Lost the sample appended after loading", strstr(after, appended) != NULL);
+  CPPUNIT_ASSERT_MESSAGE("Restored samples are different", strlen(after) == strlen(before) + strlen(appended));
+
+  // An empty spool removes the file
+  proxyspool_save(filename);
+  CPPUNIT_ASSERT_MESSAGE("Empty spool left its file behind", proxyspool_load(filename) == FAIL);
+  proxyspool_stop();
+}
@@ -0,0 +1,628 @@
+/*
+ *  Copyright 2013 People Power Company
+ *
+ *  This code was developed with funding from People Power Company
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * Device registry for agents.
+ *
+ * Devices are found by IP address or UUID through hash indices instead of
+ * scanning an array. The registry grows a chunk at a time, keeps a dirty
+ * set so senders only visit devices with something new to report, and
+ * keeps devices in a min-heap by expiry time so garbage collection only
+ * looks at the devices that actually expired.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "iotdebug.h"
+#include "deviceregistry.h"
+
+/** Initial number of hash buckets */
+#define DEVICEREGISTRY_INITIAL_BUCKETS 16
+
+/**
+ * Header in front of each record in a chunk.  It holds the record's handle
+ * so a record pointer turns back into a handle without searching, and it's
+ * padded so the record that follows stays aligned.
+ */
+typedef union deviceregistry_header_t {
+  int handle;
+  long double align;
+} deviceregistry_header_t;
+
+/***************** Private Prototypes ****************/
+static void *_deviceregistry_record(deviceregistry_t *reg, int handle);
+static int _deviceregistry_handle(deviceregistry_t *reg, const void *record);
+static const char *_deviceregistry_ip(deviceregistry_t *reg, int handle);
+static const char *_deviceregistry_uuid(deviceregistry_t *reg, int handle);
+static unsigned int _deviceregistry_hash(const char *key);
+static error_t _deviceregistry_grow(deviceregistry_t *reg);
+static error_t _deviceregistry_rehash(deviceregistry_t *reg, int totalBuckets);
+static void _deviceregistry_index(deviceregistry_t *reg, int handle);
+static void _deviceregistry_unindex(deviceregistry_t *reg, int handle);
+static int _deviceregistry_findByIp(deviceregistry_t *reg, const char *ip);
+static void _deviceregistry_heapInsert(deviceregistry_t *reg, int handle);
+static void _deviceregistry_heapRemove(deviceregistry_t *reg, int handle);
+static void _deviceregistry_siftUp(deviceregistry_t *reg, int index);
+static void _deviceregistry_siftDown(deviceregistry_t *reg, int index);
+
+/***************** Public Functions ****************/
+/**
+ * Initialize a registry, see DEVICEREGISTRY_INIT(..)
+ *
+ * @param reg Registry to initialize
+ * @param recordSize Size of the application's record for one device
+ * @param ipOffset Offset of the IP address string within the record
+ * @param uuidOffset Offset of the UUID string within the record
+ * @param expiry_sec Seconds a device lives after it was last touched
+ * @return SUCCESS if the registry is ready
+ */
+error_t deviceregistry_init(deviceregistry_t *reg, size_t recordSize, size_t ipOffset, size_t uuidOffset, int expiry_sec) {
+  bzero(reg, sizeof(deviceregistry_t));
+  reg->recordSize = recordSize;
+  reg->ipOffset = ipOffset;
+  reg->uuidOffset = uuidOffset;
+  reg->recordStride = sizeof(deviceregistry_header_t)
+      + (recordSize + sizeof(deviceregistry_header_t) - 1) / sizeof(deviceregistry_header_t) * sizeof(deviceregistry_header_t);
+  reg->expiry_sec = expiry_sec;
+  reg->freeHead = -1;
+  reg->dirtyHead = -1;
+  pthread_mutex_init(&reg->mutex, NULL);
+
+  return _deviceregistry_rehash(reg, DEVICEREGISTRY_INITIAL_BUCKETS);
+}
+
+/**
+ * Free everything the registry holds.  Record pointers are invalid after this.
+ */
+void deviceregistry_destroy(deviceregistry_t *reg) {
+  int i;
+
+  for(i = 0; i < reg->totalChunks; i++) {
+    free(reg->chunks[i]);
+  }
+
+  free(reg->chunks);
+  free(reg->slots);
+  free(reg->ipBuckets);
+  free(reg->uuidBuckets);
+  free(reg->heap);
+  pthread_mutex_destroy(&reg->mutex);
+  bzero(reg, sizeof(deviceregistry_t));
+}
+
+/**
+ * Register a device.  If a device is already registered at the record's
+ * IP address, nothing changes.  The new device starts its expiry period now.
+ *
+ * @param record The application's record for the device, which is copied
+ * @return the registry's copy of the record, NULL if we're out of memory
+ */
+void *deviceregistry_add(deviceregistry_t *reg, const void *record) {
+  int handle;
+  void *copy;
+
+  pthread_mutex_lock(&reg->mutex);
+  if((handle = _deviceregistry_findByIp(reg, (const char *) record + reg->ipOffset)) >= 0) {
+    pthread_mutex_unlock(&reg->mutex);
+    return _deviceregistry_record(reg, handle);
+  }
+
+  if(reg->freeHead >= 0) {
+    handle = reg->freeHead;
+    reg->freeHead = reg->slots[handle].nextByIp;
+
+  } else {
+    if(reg->highWater == reg->totalChunks * DEVICEREGISTRY_CHUNK_SIZE) {
+      if(_deviceregistry_grow(reg) != SUCCESS) {
+        pthread_mutex_unlock(&reg->mutex);
+        SYSLOG_ERR("[registry] Out of memory");
+        return NULL;
+      }
+    }
+    handle = reg->highWater++;
+  }
+
+  copy = _deviceregistry_record(reg, handle);
+  memcpy(copy, record, reg->recordSize);
+
+  bzero(&reg->slots[handle], sizeof(deviceregistry_slot_t));
+  reg->slots[handle].inUse = true;
+  reg->slots[handle].heapIndex = -1;
+  reg->slots[handle].nextDirty = -1;
+  reg->slots[handle].expires = time(NULL) + reg->expiry_sec;
+
+  _deviceregistry_index(reg, handle);
+  _deviceregistry_heapInsert(reg, handle);
+  reg->totalDevices++;
+
+  if(reg->totalDevices > reg->totalBuckets) {
+    // Keep the chains short. If we can't, lookups are only slower.
+    _deviceregistry_rehash(reg, reg->totalBuckets * 2);
+  }
+
+  pthread_mutex_unlock(&reg->mutex);
+  return copy;
+}
+
+/**
+ * Remove a device.  Its record is zeroed and its slot will be reused.
+ * @param record The registry's copy of the record
+ */
+void deviceregistry_remove(deviceregistry_t *reg, void *record) {
+  int handle;
+  int *link;
+
+  pthread_mutex_lock(&reg->mutex);
+  if((handle = _deviceregistry_handle(reg, record)) < 0 || !reg->slots[handle].inUse) {
+    pthread_mutex_unlock(&reg->mutex);
+    return;
+  }
+
+  _deviceregistry_unindex(reg, handle);
+
+  if(reg->slots[handle].heapIndex >= 0) {
+    _deviceregistry_heapRemove(reg, handle);
+  }
+
+  if(reg->slots[handle].dirty) {
+    for(link = &reg->dirtyHead; *link >= 0; link = &reg->slots[*link].nextDirty) {
+      if(*link == handle) {
+        *link = reg->slots[handle].nextDirty;
+        break;
+      }
+    }
+  }
+
+  bzero(record, reg->recordSize);
+  bzero(&reg->slots[handle], sizeof(deviceregistry_slot_t));
+  reg->slots[handle].heapIndex = -1;
+  reg->slots[handle].nextByIp = reg->freeHead;
+  reg->freeHead = handle;
+  reg->totalDevices--;
+
+  pthread_mutex_unlock(&reg->mutex);
+}
+
+/**
+ * Call after changing the IP address or UUID inside a registered record
+ * @param record The registry's copy of the record
+ */
+void deviceregistry_reindex(deviceregistry_t *reg, void *record) {
+  int handle;
+
+  pthread_mutex_lock(&reg->mutex);
+  if((handle = _deviceregistry_handle(reg, record)) >= 0 && reg->slots[handle].inUse) {
+    _deviceregistry_unindex(reg, handle);
+    _deviceregistry_index(reg, handle);
+  }
+  pthread_mutex_unlock(&reg->mutex);
+}
+
+/**
+ * @param ip IP address
+ * @return the record of the device at the IP address, NULL if there is none
+ */
+void *deviceregistry_getByIp(deviceregistry_t *reg, const char *ip) {
+  void *record = NULL;
+  int handle;
+
+  pthread_mutex_lock(&reg->mutex);
+  if((handle = _deviceregistry_findByIp(reg, ip)) >= 0) {
+    record = _deviceregistry_record(reg, handle);
+  }
+  pthread_mutex_unlock(&reg->mutex);
+
+  return record;
+}
+
+/**
+ * @param uuid UUID
+ * @return the record of the device with the UUID, NULL if there is none
+ */
+void *deviceregistry_getByUuid(deviceregistry_t *reg, const char *uuid) {
+  void *record = NULL;
+  int handle;
+
+  pthread_mutex_lock(&reg->mutex);
+  handle = reg->uuidBuckets[_deviceregistry_hash(uuid) & (reg->totalBuckets - 1)];
+  for(; handle >= 0; handle = reg->slots[handle].nextByUuid) {
+    if(strcmp(_deviceregistry_uuid(reg, handle), uuid) == 0) {
+      record = _deviceregistry_record(reg, handle);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&reg->mutex);
+
+  return record;
+}
+
+/**
+ * @return the number of handles to iterate over with deviceregistry_get(..)
+ */
+int deviceregistry_size(deviceregistry_t *reg) {
+  int size;
+
+  pthread_mutex_lock(&reg->mutex);
+  size = reg->highWater;
+  pthread_mutex_unlock(&reg->mutex);
+
+  return size;
+}
+
+/**
+ * @return the number of devices registered
+ */
+int deviceregistry_totalDevices(deviceregistry_t *reg) {
+  int total;
+
+  pthread_mutex_lock(&reg->mutex);
+  total = reg->totalDevices;
+  pthread_mutex_unlock(&reg->mutex);
+
+  return total;
+}
+
+/**
+ * @param handle Handle from 0 to deviceregistry_size(..) - 1
+ * @return the record for the handle, NULL if no device is registered there
+ */
+void *deviceregistry_get(deviceregistry_t *reg, int handle) {
+  void *record = NULL;
+
+  pthread_mutex_lock(&reg->mutex);
+  if(handle >= 0 && handle < reg->highWater && reg->slots[handle].inUse) {
+    record = _deviceregistry_record(reg, handle);
+  }
+  pthread_mutex_unlock(&reg->mutex);
+
+  return record;
+}
+
+/**
+ * @param record The registry's copy of a record
+ * @return the stable handle of the record, -1 if the registry didn't hand it out
+ */
+int deviceregistry_getHandle(deviceregistry_t *reg, const void *record) {
+  int handle;
+
+  pthread_mutex_lock(&reg->mutex);
+  handle = _deviceregistry_handle(reg, record);
+  pthread_mutex_unlock(&reg->mutex);
+
+  return handle;
+}
+
+/**
+ * We heard from the device, so restart its expiry period
+ * @param record The registry's copy of the record
+ */
+void deviceregistry_touch(deviceregistry_t *reg, void *record) {
+  int handle;
+
+  pthread_mutex_lock(&reg->mutex);
+  if((handle = _deviceregistry_handle(reg, record)) >= 0 && reg->slots[handle].inUse) {
+    reg->slots[handle].expires = time(NULL) + reg->expiry_sec;
+
+    if(reg->slots[handle].heapIndex < 0) {
+      _deviceregistry_heapInsert(reg, handle);
+    } else {
+      _deviceregistry_siftDown(reg, reg->slots[handle].heapIndex);
+    }
+  }
+  pthread_mutex_unlock(&reg->mutex);
+}
+
+/**
+ * Add the device to the dirty set
+ * @param record The registry's copy of the record
+ */
+void deviceregistry_markDirty(deviceregistry_t *reg, void *record) {
+  int handle;
+
+  pthread_mutex_lock(&reg->mutex);
+  if((handle = _deviceregistry_handle(reg, record)) >= 0 && reg->slots[handle].inUse
+      && !reg->slots[handle].dirty) {
+    reg->slots[handle].dirty = true;
+    reg->slots[handle].nextDirty = reg->dirtyHead;
+    reg->dirtyHead = handle;
+  }
+  pthread_mutex_unlock(&reg->mutex);
+}
+
+/**
+ * Take the next device out of the dirty set
+ * @return the record of a dirty device, NULL when the dirty set is empty
+ */
+void *deviceregistry_nextDirty(deviceregistry_t *reg) {
+  void *record = NULL;
+  int handle;
+
+  pthread_mutex_lock(&reg->mutex);
+  if((handle = reg->dirtyHead) >= 0) {
+    reg->dirtyHead = reg->slots[handle].nextDirty;
+    reg->slots[handle].nextDirty = -1;
+    reg->slots[handle].dirty = false;
+    record = _deviceregistry_record(reg, handle);
+  }
+  pthread_mutex_unlock(&reg->mutex);
+
+  return record;
+}
+
+/**
+ * Take the next expired device off the expiry heap.  The caller should
+ * either remove the device, or touch it to give it another expiry period.
+ *
+ * @param now Current time
+ * @return the record of an expired device, NULL if none have expired
+ */
+void *deviceregistry_nextExpired(deviceregistry_t *reg, time_t now) {
+  void *record = NULL;
+  int handle;
+
+  pthread_mutex_lock(&reg->mutex);
+  if(reg->heapSize > 0 && reg->slots[reg->heap[0]].expires <= now) {
+    handle = reg->heap[0];
+    _deviceregistry_heapRemove(reg, handle);
+    record = _deviceregistry_record(reg, handle);
+  }
+  pthread_mutex_unlock(&reg->mutex);
+
+  return record;
+}
+
+/***************** Private Functions ****************/
+static void *_deviceregistry_record(deviceregistry_t *reg, int handle) {
+  return reg->chunks[handle / DEVICEREGISTRY_CHUNK_SIZE]
+      + (handle % DEVICEREGISTRY_CHUNK_SIZE) * reg->recordStride + sizeof(deviceregistry_header_t);
+}
+
+/**
+ * Read the handle out of the header in front of the record, and make sure
+ * it leads back to the same record
+ */
+static int _deviceregistry_handle(deviceregistry_t *reg, const void *record) {
+  int handle;
+
+  if(record == NULL) {
+    return -1;
+  }
+
+  // The pointer may not be aligned if it isn't one of ours
+  memcpy(&handle, (const char *) record - sizeof(deviceregistry_header_t), sizeof(handle));
+  if(handle < 0 || handle >= reg->totalChunks * DEVICEREGISTRY_CHUNK_SIZE
+      || _deviceregistry_record(reg, handle) != record) {
+    return -1;
+  }
+
+  return handle;
+}
+
+static const char *_deviceregistry_ip(deviceregistry_t *reg, int handle) {
+  return (const char *) _deviceregistry_record(reg, handle) + reg->ipOffset;
+}
+
+static const char *_deviceregistry_uuid(deviceregistry_t *reg, int handle) {
+  return (const char *) _deviceregistry_record(reg, handle) + reg->uuidOffset;
+}
+
+/**
+ * djb2 string hash
+ */
+static unsigned int _deviceregistry_hash(const char *key) {
+  unsigned int hash = 5381;
+
+  while(*key != '\0') {
+    hash = ((hash << 5) + hash) + (unsigned char) *key++;
+  }
+
+  return hash;
+}
+
+/**
+ * Add a chunk of records
+ */
+static error_t _deviceregistry_grow(deviceregistry_t *reg) {
+  int capacity = (reg->totalChunks + 1) * DEVICEREGISTRY_CHUNK_SIZE;
+  deviceregistry_slot_t *slots;
+  char **chunks;
+  char *chunk;
+  int *heap;
+  int i;
+
+  if((chunk = calloc(DEVICEREGISTRY_CHUNK_SIZE, reg->recordStride)) == NULL) {
+    return FAIL;
+  }
+
+  for(i = 0; i < DEVICEREGISTRY_CHUNK_SIZE; i++) {
+    ((deviceregistry_header_t *) (chunk + i * reg->recordStride))->handle = reg->totalChunks * DEVICEREGISTRY_CHUNK_SIZE + i;
+  }
+
+  if((chunks = realloc(reg->chunks, sizeof(char *) * (reg->totalChunks + 1))) == NULL) {
+    free(chunk);
+    return FAIL;
+  }
+  reg->chunks = chunks;
+
+  if((slots = realloc(reg->slots, sizeof(deviceregistry_slot_t) * capacity)) == NULL) {
+    free(chunk);
+    return FAIL;
+  }
+  reg->slots = slots;
+
+  if((heap = realloc(reg->heap, sizeof(int) * capacity)) == NULL) {
+    free(chunk);
+    return FAIL;
+  }
+  reg->heap = heap;
+
+  reg->chunks[reg->totalChunks++] = chunk;
+  return SUCCESS;
+}
+
+/**
+ * Rebuild the hash indices with a new number of buckets
+ */
+static error_t _deviceregistry_rehash(deviceregistry_t *reg, int totalBuckets) {
+  int *ipBuckets;
+  int *uuidBuckets;
+  int i;
+
+  ipBuckets = malloc(sizeof(int) * totalBuckets);
+  uuidBuckets = malloc(sizeof(int) * totalBuckets);
+
+  if(ipBuckets == NULL || uuidBuckets == NULL) {
+    free(ipBuckets);
+    free(uuidBuckets);
+    return FAIL;
+  }
+
+  free(reg->ipBuckets);
+  free(reg->uuidBuckets);
+  reg->ipBuckets = ipBuckets;
+  reg->uuidBuckets = uuidBuckets;
+  reg->totalBuckets = totalBuckets;
+
+  for(i = 0; i < totalBuckets; i++) {
+    reg->ipBuckets[i] = -1;
+    reg->uuidBuckets[i] = -1;
+  }
+
+  for(i = 0; i < reg->highWater; i++) {
+    if(reg->slots[i].inUse) {
+      _deviceregistry_index(reg, i);
+    }
+  }
+
+  return SUCCESS;
+}
+
+static void _deviceregistry_index(deviceregistry_t *reg, int handle) {
+  deviceregistry_slot_t *slot = &reg->slots[handle];
+  int bucket;
+
+  slot->ipHash = _deviceregistry_hash(_deviceregistry_ip(reg, handle));
+  bucket = slot->ipHash & (reg->totalBuckets - 1);
+  slot->nextByIp = reg->ipBuckets[bucket];
+  reg->ipBuckets[bucket] = handle;
+
+  slot->uuidHash = _deviceregistry_hash(_deviceregistry_uuid(reg, handle));
+  bucket = slot->uuidHash & (reg->totalBuckets - 1);
+  slot->nextByUuid = reg->uuidBuckets[bucket];
+  reg->uuidBuckets[bucket] = handle;
+}
+
+/**
+ * Unlink a slot from both indices, using the hashes it was indexed under
+ * because the keys in the record may have changed since
+ */
+static void _deviceregistry_unindex(deviceregistry_t *reg, int handle) {
+  deviceregistry_slot_t *slot = &reg->slots[handle];
+  int *link;
+
+  for(link = &reg->ipBuckets[slot->ipHash & (reg->totalBuckets - 1)]; *link >= 0; link = &reg->slots[*link].nextByIp) {
+    if(*link == handle) {
+      *link = slot->nextByIp;
+      break;
+    }
+  }
+
+  for(link = &reg->uuidBuckets[slot->uuidHash & (reg->totalBuckets - 1)]; *link >= 0; link = &reg->slots[*link].nextByUuid) {
+    if(*link == handle) {
+      *link = slot->nextByUuid;
+      break;
+    }
+  }
+}
+
+static int _deviceregistry_findByIp(deviceregistry_t *reg, const char *ip) {
+  int handle = reg->ipBuckets[_deviceregistry_hash(ip) & (reg->totalBuckets - 1)];
+
+  for(; handle >= 0; handle = reg->slots[handle].nextByIp) {
+    if(strcmp(_deviceregistry_ip(reg, handle), ip) == 0) {
+      return handle;
+    }
+  }
+
+  return -1;
+}
+
+static void _deviceregistry_heapInsert(deviceregistry_t *reg, int handle) {
+  reg->heap[reg->heapSize] = handle;
+  reg->slots[handle].heapIndex = reg->heapSize;
+  reg->heapSize++;
+  _deviceregistry_siftUp(reg, reg->heapSize - 1);
+}
+
+static void _deviceregistry_heapRemove(deviceregistry_t *reg, int handle) {
+  int index = reg->slots[handle].heapIndex;
+  int last = reg->heap[--reg->heapSize];
+
+  reg->slots[handle].heapIndex = -1;
+
+  if(last != handle) {
+    reg->heap[index] = last;
+    reg->slots[last].heapIndex = index;
+    _deviceregistry_siftUp(reg, index);
+    _deviceregistry_siftDown(reg, reg->slots[last].heapIndex);
+  }
+}
+
+static void _deviceregistry_siftUp(deviceregistry_t *reg, int index) {
+  int handle = reg->heap[index];
+  int parent;
+
+  while(index > 0) {
+    parent = (index - 1) / 2;
+    if(reg->slots[reg->heap[parent]].expires <= reg->slots[handle].expires) {
+      break;
+    }
+
+    reg->heap[index] = reg->heap[parent];
+    reg->slots[reg->heap[index]].heapIndex = index;
+    index = parent;
+  }
+
+  reg->heap[index] = handle;
+  reg->slots[handle].heapIndex = index;
+}
+
+static void _deviceregistry_siftDown(deviceregistry_t *reg, int index) {
+  int handle = reg->heap[index];
+  int child;
+
+  while((child = index * 2 + 1) < reg->heapSize) {
+    if(child + 1 < reg->heapSize
+        && reg->slots[reg->heap[child + 1]].expires < reg->slots[reg->heap[child]].expires) {
+      child++;
+    }
+
+    if(reg->slots[handle].expires <= reg->slots[reg->heap[child]].expires) {
+      break;
+    }
+
+    reg->heap[index] = reg->heap[child];
+    reg->slots[reg->heap[index]].heapIndex = index;
+    index = child;
+  }
+
+  reg->heap[index] = handle;
+  reg->slots[handle].heapIndex = index;
+}
@@ -0,0 +1,159 @@
+/*
+ *  Copyright 2013 People Power Company
+ *
+ *  This code was developed with funding from People Power Company
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef DEVICEREGISTRY_H
+#define DEVICEREGISTRY_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "ioterror.h"
+
+/** Number of records allocated at a time as the registry grows */
+#ifndef DEVICEREGISTRY_CHUNK_SIZE
+#define DEVICEREGISTRY_CHUNK_SIZE 16
+#endif
+
+/**
+ * Bookkeeping for one record slot
+ */
+typedef struct deviceregistry_slot_t {
+
+  /** True if this slot holds a device */
+  bool inUse;
+
+  /** True if the slot is in the dirty set */
+  bool dirty;
+
+  /** Next slot in the same IP hash bucket, or in the free list */
+  int nextByIp;
+
+  /** Next slot in the same UUID hash bucket */
+  int nextByUuid;
+
+  /** Next slot in the dirty set */
+  int nextDirty;
+
+  /** Hashes of the IP address and UUID the slot is indexed under */
+  unsigned int ipHash;
+  unsigned int uuidHash;
+
+  /** Position in the expiry heap, -1 if not in the heap */
+  int heapIndex;
+
+  /** When the device expires unless it gets touched again */
+  time_t expires;
+
+} deviceregistry_slot_t;
+
+/**
+ * A registry of devices.  Each device is a record of the application's own
+ * type, copied in by deviceregistry_add(..), which must hold the device's IP
+ * address and UUID as null-terminated strings.  Records live in chunks that
+ * are never moved or freed until the registry is destroyed, so a record
+ * pointer or handle stays valid while the device is registered.  Every
+ * function is thread-safe, but the application must coordinate writes to
+ * the records themselves.
+ */
+typedef struct deviceregistry_t {
+
+  /** Layout of the application's record */
+  size_t recordSize;
+  size_t ipOffset;
+  size_t uuidOffset;
+
+  /** Bytes from one record to the next in a chunk, including its header */
+  size_t recordStride;
+
+  /** Seconds a device lives after it was last touched */
+  int expiry_sec;
+
+  /** Records, DEVICEREGISTRY_CHUNK_SIZE at a time */
+  char **chunks;
+  int totalChunks;
+
+  /** Bookkeeping for each record slot */
+  deviceregistry_slot_t *slots;
+
+  /** Number of slots ever handed out, which bounds iteration */
+  int highWater;
+
+  /** Number of devices registered */
+  int totalDevices;
+
+  /** Head of the list of released slots */
+  int freeHead;
+
+  /** Hash indices on IP address and UUID, totalBuckets is a power of 2 */
+  int *ipBuckets;
+  int *uuidBuckets;
+  int totalBuckets;
+
+  /** Head of the dirty set */
+  int dirtyHead;
+
+  /** Min-heap of slots ordered by expiry time */
+  int *heap;
+  int heapSize;
+
+  pthread_mutex_t mutex;
+
+} deviceregistry_t;
+
+/**
+ * Initialize a registry for records of the given struct type, i.e.
+ *
+ *   DEVICEREGISTRY_INIT(&registry, rtoa_t, ip, uuid, RTOA_DEATH_PERIOD_SEC);
+ */
+#define DEVICEREGISTRY_INIT(reg, type, ipField, uuidField, expiry_sec) \
+    deviceregistry_init((reg), sizeof(type), offsetof(type, ipField), offsetof(type, uuidField), (expiry_sec))
+
+/***************** Public Prototypes ****************/
+error_t deviceregistry_init(deviceregistry_t *reg, size_t recordSize, size_t ipOffset, size_t uuidOffset, int expiry_sec);
+
+void deviceregistry_destroy(deviceregistry_t *reg);
+
+void *deviceregistry_add(deviceregistry_t *reg, const void *record);
+
+void deviceregistry_remove(deviceregistry_t *reg, void *record);
+
+void deviceregistry_reindex(deviceregistry_t *reg, void *record);
+
+void *deviceregistry_getByIp(deviceregistry_t *reg, const char *ip);
+
+void *deviceregistry_getByUuid(deviceregistry_t *reg, const char *uuid);
+
+int deviceregistry_size(deviceregistry_t *reg);
+
+int deviceregistry_totalDevices(deviceregistry_t *reg);
+
+void *deviceregistry_get(deviceregistry_t *reg, int handle);
+
+int deviceregistry_getHandle(deviceregistry_t *reg, const void *record);
+
+void deviceregistry_touch(deviceregistry_t *reg, void *record);
+
+void deviceregistry_markDirty(deviceregistry_t *reg, void *record);
+
+void *deviceregistry_nextDirty(deviceregistry_t *reg);
+
+void *deviceregistry_nextExpired(deviceregistry_t *reg, time_t now);
+
+#endif
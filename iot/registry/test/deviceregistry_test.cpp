@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2011 People Power Company
+ * All rights reserved.
+ *
+ * This open source code was developed with funding from People Power Company
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the People Power Corporation nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * PEOPLE POWER CO. OR ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "cppunit/extensions/HelperMacros.h"
+
+#include "deviceregistry_test.h"
+
+extern "C" {
+#include "iotdebug.h"
+#include "ioterror.h"
+#include "deviceregistry.h"
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION( DeviceRegistryTest );
+
+/** Seconds a test device lives after it was last touched */
+#define TEST_EXPIRY_SEC 60
+
+/** Enough devices to need several chunks */
+#define TEST_DEVICES (DEVICEREGISTRY_CHUNK_SIZE * 3 + 1)
+
+/** An odd-sized record, to check every record in a chunk stays aligned */
+typedef struct test_device_t {
+  char name[5];
+  char ip[16];
+  char uuid[40];
+  double reading;
+} test_device_t;
+
+static void makeDevice(test_device_t *device, int i) {
+  memset(device, 0, sizeof(test_device_t));
+  snprintf(device->name, sizeof(device->name), "d%d", i);
+  snprintf(device->ip, sizeof(device->ip), "10.0.0.%u", (unsigned char) i);
+  snprintf(device->uuid, sizeof(device->uuid), "uuid-%d", i);
+  device->reading = i;
+}
+
+void DeviceRegistryTest::testInsert(void) {
+  deviceregistry_t reg;
+  test_device_t device;
+  test_device_t *records[TEST_DEVICES];
+  test_device_t *record;
+  int i;
+
+  CPPUNIT_ASSERT_MESSAGE("Couldn't initialize the registry", DEVICEREGISTRY_INIT(&reg, test_device_t, ip, uuid, TEST_EXPIRY_SEC) == SUCCESS);
+
+  for(i = 0; i < TEST_DEVICES; i++) {
+    makeDevice(&device, i);
+    records[i] = (test_device_t *) deviceregistry_add(&reg, &device);
+    CPPUNIT_ASSERT_MESSAGE("Couldn't add a device", records[i] != NULL);
+    CPPUNIT_ASSERT_MESSAGE("Record wasn't copied", records[i] != &device && memcmp(records[i], &device, sizeof(device)) == 0);
+    CPPUNIT_ASSERT_MESSAGE("Record isn't aligned", ((size_t) records[i]) % __alignof__(test_device_t) == 0);
+  }
+
+  CPPUNIT_ASSERT_MESSAGE("Wrong number of devices", deviceregistry_totalDevices(&reg) == TEST_DEVICES);
+  CPPUNIT_ASSERT_MESSAGE("Wrong size", deviceregistry_size(&reg) == TEST_DEVICES);
+
+  for(i = 0; i < TEST_DEVICES; i++) {
+    makeDevice(&device, i);
+    CPPUNIT_ASSERT_MESSAGE("Device not found by IP", deviceregistry_getByIp(&reg, device.ip) == records[i]);
+    CPPUNIT_ASSERT_MESSAGE("Device not found by UUID", deviceregistry_getByUuid(&reg, device.uuid) == records[i]);
+    CPPUNIT_ASSERT_MESSAGE("Wrong handle", deviceregistry_getHandle(&reg, records[i]) == i);
+    CPPUNIT_ASSERT_MESSAGE("Handle doesn't lead back to the record", deviceregistry_get(&reg, i) == records[i]);
+  }
+
+  // Adding a device at an IP address that's already registered changes nothing
+  makeDevice(&device, 3);
+  device.reading = -1;
+  record = (test_device_t *) deviceregistry_add(&reg, &device);
+  CPPUNIT_ASSERT_MESSAGE("Duplicate IP got a new record", record == records[3] && record->reading == 3);
+  CPPUNIT_ASSERT_MESSAGE("Duplicate IP was counted", deviceregistry_totalDevices(&reg) == TEST_DEVICES);
+
+  CPPUNIT_ASSERT_MESSAGE("Unknown IP was found", deviceregistry_getByIp(&reg, "192.168.1.1") == NULL);
+  CPPUNIT_ASSERT_MESSAGE("Unknown UUID was found", deviceregistry_getByUuid(&reg, "nobody") == NULL);
+  CPPUNIT_ASSERT_MESSAGE("Handle past the end was found", deviceregistry_get(&reg, TEST_DEVICES) == NULL);
+  CPPUNIT_ASSERT_MESSAGE("A record inside another record got a handle", deviceregistry_getHandle(&reg, records[1]->uuid) < 0);
+
+  deviceregistry_destroy(&reg);
+}
+
+void DeviceRegistryTest::testUpdate(void) {
+  deviceregistry_t reg;
+  test_device_t device;
+  test_device_t *record;
+
+  DEVICEREGISTRY_INIT(&reg, test_device_t, ip, uuid, TEST_EXPIRY_SEC);
+  makeDevice(&device, 1);
+  record = (test_device_t *) deviceregistry_add(&reg, &device);
+
+  // The device moved to a new address and reported its real UUID
+  strcpy(record->ip, "10.1.1.1");
+  strcpy(record->uuid, "uuid-new");
+  deviceregistry_reindex(&reg, record);
+
+  CPPUNIT_ASSERT_MESSAGE("Old IP still found", deviceregistry_getByIp(&reg, device.ip) == NULL);
+  CPPUNIT_ASSERT_MESSAGE("Old UUID still found", deviceregistry_getByUuid(&reg, device.uuid) == NULL);
+  CPPUNIT_ASSERT_MESSAGE("New IP not found", deviceregistry_getByIp(&reg, "10.1.1.1") == record);
+  CPPUNIT_ASSERT_MESSAGE("New UUID not found", deviceregistry_getByUuid(&reg, "uuid-new") == record);
+  CPPUNIT_ASSERT_MESSAGE("Update changed the number of devices", deviceregistry_totalDevices(&reg) == 1);
+
+  deviceregistry_destroy(&reg);
+}
+
+void DeviceRegistryTest::testEvict(void) {
+  deviceregistry_t reg;
+  test_device_t device;
+  test_device_t *records[TEST_DEVICES];
+  test_device_t *record;
+  time_t later = time(NULL) + TEST_EXPIRY_SEC + 1;
+  int evicted = 0;
+  int i;
+
+  DEVICEREGISTRY_INIT(&reg, test_device_t, ip, uuid, TEST_EXPIRY_SEC);
+  for(i = 0; i < TEST_DEVICES; i++) {
+    makeDevice(&device, i);
+    records[i] = (test_device_t *) deviceregistry_add(&reg, &device);
+  }
+
+  CPPUNIT_ASSERT_MESSAGE("A device expired early", deviceregistry_nextExpired(&reg, time(NULL)) == NULL);
+
+  // Every device expires, except the even ones get touched and live on
+  while((record = (test_device_t *) deviceregistry_nextExpired(&reg, later)) != NULL) {
+    if(((int) record->reading) % 2 == 0) {
+      deviceregistry_touch(&reg, record);
+      if(deviceregistry_nextExpired(&reg, time(NULL)) != NULL) {
+        CPPUNIT_ASSERT_MESSAGE("A touched device expired", false);
+      }
+      continue;
+    }
+
+    deviceregistry_remove(&reg, record);
+    evicted++;
+  }
+
+  CPPUNIT_ASSERT_MESSAGE("Wrong number of devices evicted", evicted == TEST_DEVICES / 2);
+  CPPUNIT_ASSERT_MESSAGE("Wrong number of devices left", deviceregistry_totalDevices(&reg) == TEST_DEVICES - TEST_DEVICES / 2);
+
+  for(i = 0; i < TEST_DEVICES; i++) {
+    makeDevice(&device, i);
+    if(i % 2 == 0) {
+      CPPUNIT_ASSERT_MESSAGE("Touched device was evicted", deviceregistry_getByIp(&reg, device.ip) == records[i]);
+    } else {
+      CPPUNIT_ASSERT_MESSAGE("Evicted device still found by IP", deviceregistry_getByIp(&reg, device.ip) == NULL);
+      CPPUNIT_ASSERT_MESSAGE("Evicted device still found by UUID", deviceregistry_getByUuid(&reg, device.uuid) == NULL);
+      CPPUNIT_ASSERT_MESSAGE("Evicted device still found by handle", deviceregistry_get(&reg, i) == NULL);
+    }
+  }
+
+  deviceregistry_destroy(&reg);
+}
+
+void DeviceRegistryTest::testDirty(void) {
+  deviceregistry_t reg;
+  test_device_t device;
+  test_device_t *records[TEST_DEVICES];
+  test_device_t *record;
+  bool seen[TEST_DEVICES];
+  int total = 0;
+  int i;
+
+  DEVICEREGISTRY_INIT(&reg, test_device_t, ip, uuid, TEST_EXPIRY_SEC);
+  for(i = 0; i < TEST_DEVICES; i++) {
+    makeDevice(&device, i);
+    records[i] = (test_device_t *) deviceregistry_add(&reg, &device);
+  }
+
+  CPPUNIT_ASSERT_MESSAGE("New devices were dirty", deviceregistry_nextDirty(&reg) == NULL);
+
+  // Every third device gets marked twice, and one of them is removed
+  for(i = 0; i < TEST_DEVICES; i += 3) {
+    deviceregistry_markDirty(&reg, records[i]);
+    deviceregistry_markDirty(&reg, records[i]);
+  }
+  deviceregistry_remove(&reg, records[3]);
+
+  memset(seen, 0, sizeof(seen));
+  while((record = (test_device_t *) deviceregistry_nextDirty(&reg)) != NULL) {
+    i = deviceregistry_getHandle(&reg, record);
+    CPPUNIT_ASSERT_MESSAGE("Clean device was in the dirty set", i % 3 == 0 && i != 3);
+    CPPUNIT_ASSERT_MESSAGE("Dirty device came out twice", !seen[i]);
+    seen[i] = true;
+    total++;
+  }
+
+  CPPUNIT_ASSERT_MESSAGE("Wrong number of dirty devices", total == (TEST_DEVICES + 2) / 3 - 1);
+  CPPUNIT_ASSERT_MESSAGE("Dirty set wasn't emptied", deviceregistry_nextDirty(&reg) == NULL);
+
+  // Once taken out, a device can be marked again
+  deviceregistry_markDirty(&reg, records[0]);
+  CPPUNIT_ASSERT_MESSAGE("Device couldn't be marked again", deviceregistry_nextDirty(&reg) == records[0]);
+
+  deviceregistry_destroy(&reg);
+}
+
+void DeviceRegistryTest::testSlotReuse(void) {
+  deviceregistry_t reg;
+  test_device_t device;
+  test_device_t *first;
+  test_device_t *second;
+  test_device_t *record;
+  int handle;
+
+  DEVICEREGISTRY_INIT(&reg, test_device_t, ip, uuid, TEST_EXPIRY_SEC);
+  makeDevice(&device, 1);
+  first = (test_device_t *) deviceregistry_add(&reg, &device);
+  makeDevice(&device, 2);
+  second = (test_device_t *) deviceregistry_add(&reg, &device);
+  handle = deviceregistry_getHandle(&reg, first);
+
+  deviceregistry_remove(&reg, first);
+  CPPUNIT_ASSERT_MESSAGE("Removed record wasn't zeroed", first->ip[0] == '\0' && first->reading == 0);
+  CPPUNIT_ASSERT_MESSAGE("Removed device still counted", deviceregistry_totalDevices(&reg) == 1);
+
+  // A removed device is only removed once
+  deviceregistry_remove(&reg, first);
+  CPPUNIT_ASSERT_MESSAGE("Second remove changed the count", deviceregistry_totalDevices(&reg) == 1);
+
+  // The next device takes over the released slot instead of growing the registry
+  makeDevice(&device, 3);
+  record = (test_device_t *) deviceregistry_add(&reg, &device);
+  CPPUNIT_ASSERT_MESSAGE("Released slot wasn't reused", record == first);
+  CPPUNIT_ASSERT_MESSAGE("Reused slot has a new handle", deviceregistry_getHandle(&reg, record) == handle);
+  CPPUNIT_ASSERT_MESSAGE("Registry grew", deviceregistry_size(&reg) == 2);
+  CPPUNIT_ASSERT_MESSAGE("Reused slot has the old device", deviceregistry_getByIp(&reg, "10.0.0.1") == NULL);
+  CPPUNIT_ASSERT_MESSAGE("Reused slot has the wrong device", deviceregistry_getByUuid(&reg, "uuid-3") == record);
+  CPPUNIT_ASSERT_MESSAGE("Other device was disturbed", deviceregistry_getByIp(&reg, "10.0.0.2") == second);
+
+  deviceregistry_destroy(&reg);
+}
@@ -0,0 +1,323 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * Command latency tracing
+ *
+ * Each process marks the commands passing through it with a monotonic
+ * timestamp at every stage, into a ring of the last IOTTRACE_RING_SIZE trace
+ * points.  Marking takes no lock, so it can happen on the proxy thread while
+ * it waits on the server.  The ring is periodically appended to a file in the
+ * Chrome trace event format, as instant events with one row per command, so
+ * the traces of the proxy server and all the agents can be loaded together
+ * in chrome://tracing to see where a command spent its time.
+ *
+ * Nothing is marked until iottrace_start(..) was called.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "iottrace.h"
+#include "ioterror.h"
+#include "iotdebug.h"
+
+/** Longest event in the file */
+#define IOTTRACE_EVENT_SIZE 192
+
+/** Attribute holding the command ID in commands and results */
+#define IOTTRACE_COMMANDID_ATTR "cmdId=\""
+
+/***************** Module Variables ****************/
+/** Names of the stages in the trace file */
+static const char *sStageNames[IOTTRACE_TOTAL_STAGES] = {
+  "received",
+  "broadcast",
+  "written",
+  "parsed",
+  "deviceStart",
+  "deviceDone",
+  "result",
+  "pushed",
+};
+
+/** The last trace points */
+static iottrace_entry_t sRing[IOTTRACE_RING_SIZE];
+
+/** Position of the next trace point */
+static volatile uint32_t sNext;
+
+/** Position of the next trace point to export */
+static uint32_t sExported;
+
+/** True once tracing was started */
+static volatile bool sEnabled;
+
+/** File the export thread appends to */
+static char sFilename[PATH_MAX];
+
+/** Events on their way to the file */
+static char sExportBuffer[IOTTRACE_RING_SIZE * IOTTRACE_EVENT_SIZE];
+
+static bool gTerminate;
+
+static pthread_t sThreadId;
+
+/** Only one export at a time */
+static pthread_mutex_t sExportMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/***************** Private Prototypes ****************/
+static void *_iottrace_exportThread(void *params);
+
+static int _iottrace_format(char *dest, int maxSize, const iottrace_entry_t *entry);
+
+/***************** Public Functions ****************/
+/**
+ * Start marking trace points, and exporting them every
+ * IOTTRACE_EXPORT_PERIOD_SEC
+ * @param filename File to append the trace points to
+ * @return SUCCESS if tracing started
+ */
+error_t iottrace_start(const char *filename) {
+  if(sEnabled) {
+    return SUCCESS;
+  }
+
+  strncpy(sFilename, filename, sizeof(sFilename) - 1);
+  sFilename[sizeof(sFilename) - 1] = '\0';
+  gTerminate = false;
+
+  if(pthread_create(&sThreadId, NULL, &_iottrace_exportThread, NULL) != 0) {
+    SYSLOG_ERR("[trace] Couldn't create the export thread");
+    return FAIL;
+  }
+
+  sEnabled = true;
+  SYSLOG_INFO("[trace] Tracing commands to %s", sFilename);
+  return SUCCESS;
+}
+
+/**
+ * Stop marking trace points, and export the last ones
+ */
+void iottrace_stop() {
+  if(!sEnabled) {
+    return;
+  }
+
+  sEnabled = false;
+  gTerminate = true;
+  pthread_join(sThreadId, NULL);
+  iottrace_export(sFilename);
+}
+
+/**
+ * Mark a command reaching a stage
+ * @param commandId The command's ID, -1 for the end of the commands
+ * @param stage The stage it reached
+ * @param arg Extra information for the stage, i.e. the result code
+ */
+void iottrace_mark(int commandId, iottrace_stage_e stage, int arg) {
+  struct timespec now;
+  iottrace_entry_t *entry;
+  uint32_t position;
+
+  if(!sEnabled || commandId < 0) {
+    return;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  position = __sync_fetch_and_add(&sNext, 1);
+  entry = &sRing[position & (IOTTRACE_RING_SIZE - 1)];
+
+  // Readers skip the entry until it's complete
+  entry->seq = 0;
+  __sync_synchronize();
+
+  entry->commandId = commandId;
+  entry->stage = stage;
+  entry->arg = arg;
+  entry->nsec = (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+  __sync_synchronize();
+  entry->seq = position + 1;
+}
+
+/**
+ * Mark every command or result in a message reaching a stage
+ * @param msg The XML message, which doesn't have to be null-terminated
+ * @param len Length of the message
+ * @param stage The stage they reached
+ */
+void iottrace_markMessage(const char *msg, int len, iottrace_stage_e stage) {
+  const int attrLen = strlen(IOTTRACE_COMMANDID_ATTR);
+  const char *end = msg + len;
+  const char *ptr = msg;
+
+  if(!sEnabled || msg == NULL) {
+    return;
+  }
+
+  while(ptr + attrLen < end) {
+    if(*ptr == 'c' && memcmp(ptr, IOTTRACE_COMMANDID_ATTR, attrLen) == 0) {
+      ptr += attrLen;
+      iottrace_mark(atoi(ptr), stage, 0);
+
+    } else {
+      ptr++;
+    }
+  }
+}
+
+/**
+ * Append the trace points marked since the last export to a file.  The first
+ * process to write the file opens the JSON array, which the Chrome trace
+ * viewer doesn't need closed.
+ * @param filename File to append to
+ * @return the number of trace points exported, or -1 if the file couldn't be
+ *     written
+ */
+int iottrace_export(const char *filename) {
+  iottrace_entry_t entry;
+  struct stat fileStat;
+  uint32_t next;
+  uint32_t seq;
+  int offset = 0;
+  int exported = 0;
+  int fd;
+
+  pthread_mutex_lock(&sExportMutex);
+
+  next = sNext;
+
+  // Trace points that were overwritten before we got to them are lost
+  if(next - sExported > IOTTRACE_RING_SIZE) {
+    SYSLOG_WARNING("[trace] Lost %u trace points", next - sExported - IOTTRACE_RING_SIZE);
+    sExported = next - IOTTRACE_RING_SIZE;
+  }
+
+  while(sExported != next) {
+    seq = sRing[sExported & (IOTTRACE_RING_SIZE - 1)].seq;
+    __sync_synchronize();
+    memcpy(&entry, &sRing[sExported & (IOTTRACE_RING_SIZE - 1)], sizeof(entry));
+    __sync_synchronize();
+
+    if(seq != sExported + 1 || sRing[sExported & (IOTTRACE_RING_SIZE - 1)].seq != seq) {
+      if(seq == 0 || seq < sExported + 1) {
+        // Still being written, pick it up next time
+        break;
+      }
+
+      // Overwritten while we read it
+      sExported++;
+      continue;
+    }
+
+    offset += _iottrace_format(sExportBuffer + offset, sizeof(sExportBuffer) - offset, &entry);
+    exported++;
+    sExported++;
+  }
+
+  if(offset == 0) {
+    pthread_mutex_unlock(&sExportMutex);
+    return 0;
+  }
+
+  if((fd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0) {
+    SYSLOG_ERR("[trace] Couldn't open %s", filename);
+    pthread_mutex_unlock(&sExportMutex);
+    return -1;
+  }
+
+  // The other processes append to the same file
+  flock(fd, LOCK_EX);
+
+  if(fstat(fd, &fileStat) == 0 && fileStat.st_size >= IOTTRACE_MAX_FILE_SIZE) {
+    exported = 0;
+
+  } else if(fileStat.st_size == 0 && write(fd, "[\n", 2) != 2) {
+    exported = -1;
+
+  } else if(write(fd, sExportBuffer, offset) != offset) {
+    exported = -1;
+  }
+
+  flock(fd, LOCK_UN);
+  close(fd);
+
+  if(exported < 0) {
+    SYSLOG_ERR("[trace] Couldn't write %s", filename);
+  }
+
+  pthread_mutex_unlock(&sExportMutex);
+  return exported;
+}
+
+/***************** Private Functions ****************/
+/**
+ * Periodically export the trace points
+ */
+static void *_iottrace_exportThread(void *params) {
+  int i;
+
+  while(!gTerminate) {
+    for(i = 0; i < IOTTRACE_EXPORT_PERIOD_SEC && !gTerminate; i++) {
+      sleep(1);
+    }
+
+    iottrace_export(sFilename);
+  }
+
+  return NULL;
+}
+
+/**
+ * Write a trace point as a Chrome trace event, timestamped in microseconds
+ * @param dest Destination buffer
+ * @param maxSize Size of the destination buffer
+ * @param entry The trace point
+ * @return the number of bytes written
+ */
+static int _iottrace_format(char *dest, int maxSize, const iottrace_entry_t *entry) {
+  int len;
+
+  len = snprintf(dest, maxSize,
+      "{\"name\":\"%s\",\"cat\":\"command\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,"
+      "\"ts\":%llu.%03u,\"args\":{\"cmdId\":%d,\"arg\":%d}},\n",
+      (entry->stage >= 0 && entry->stage < IOTTRACE_TOTAL_STAGES) ? sStageNames[entry->stage] : "unknown",
+      (int) getpid(), entry->commandId,
+      (unsigned long long) (entry->nsec / 1000), (unsigned int) (entry->nsec % 1000),
+      entry->commandId, entry->arg);
+
+  if(len < 0 || len >= maxSize) {
+    return 0;
+  }
+
+  return len;
+}
@@ -0,0 +1,115 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef IOTTRACE_H
+#define IOTTRACE_H
+
+#include <stdint.h>
+
+#include "ioterror.h"
+
+/** Set to 1 to have the applications export traces */
+#ifndef IOTTRACE_ENABLED
+#define IOTTRACE_ENABLED 0
+#endif
+
+/** Number of trace points each process remembers, a power of 2 */
+#ifndef IOTTRACE_RING_SIZE
+#define IOTTRACE_RING_SIZE 256
+#endif
+
+/** File every process appends its trace points to */
+#ifndef IOTTRACE_FILENAME
+#define IOTTRACE_FILENAME "/tmp/iottrace.json"
+#endif
+
+/** Seconds between exports */
+#ifndef IOTTRACE_EXPORT_PERIOD_SEC
+#define IOTTRACE_EXPORT_PERIOD_SEC 5
+#endif
+
+/** Stop exporting once the file is this big, so it can't fill the disk */
+#ifndef IOTTRACE_MAX_FILE_SIZE
+#define IOTTRACE_MAX_FILE_SIZE 1048576
+#endif
+
+/**
+ * Stages a command goes through on its way from the server to the device,
+ * and its result on the way back
+ */
+typedef enum iottrace_stage_e {
+  /** The proxy received the command from the server */
+  IOTTRACE_RECEIVED = 0,
+
+  /** The proxy handed the command to its listeners */
+  IOTTRACE_BROADCAST,
+
+  /** The proxy server wrote the command to the agents' sockets */
+  IOTTRACE_WRITTEN,
+
+  /** An agent parsed the command */
+  IOTTRACE_PARSED,
+
+  /** The agent started talking to the device */
+  IOTTRACE_DEVICE_START,
+
+  /** The device answered, or didn't */
+  IOTTRACE_DEVICE_DONE,
+
+  /** The agent sent a result for the command */
+  IOTTRACE_RESULT,
+
+  /** The proxy pushed the result to the server */
+  IOTTRACE_PUSHED,
+
+  IOTTRACE_TOTAL_STAGES,
+} iottrace_stage_e;
+
+/**
+ * One trace point
+ */
+typedef struct iottrace_entry_t {
+
+  /** Position in the ring plus 1 once the entry is complete, 0 while it's written */
+  volatile uint32_t seq;
+
+  int commandId;
+
+  /** iottrace_stage_e */
+  int stage;
+
+  /** The result code, for IOTTRACE_RESULT */
+  int arg;
+
+  /** CLOCK_MONOTONIC, which all processes on the hub share */
+  uint64_t nsec;
+
+} iottrace_entry_t;
+
+/***************** Public Prototypes ****************/
+error_t iottrace_start(const char *filename);
+
+void iottrace_stop();
+
+void iottrace_mark(int commandId, iottrace_stage_e stage, int arg);
+
+void iottrace_markMessage(const char *msg, int len, iottrace_stage_e stage);
+
+int iottrace_export(const char *filename);
+
+#endif
@@ -0,0 +1,296 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * Sample series for measurements captured faster than they are uploaded.
+ *
+ * Each sample updates the running min/max/sum/last of the current
+ * aggregation window. Once a sample lands past the end of the window, the
+ * window is completed and queued for upload, and a new one starts. With
+ * SAMPLESERIES_RAW, the samples themselves are also kept in a ring buffer
+ * so they can be uploaded with their own timestamps.
+ *
+ * When the agent uploads, sampleseries_addToMsg(..) writes the completed
+ * windows and raw samples into the message, oldest first, and removes them
+ * from the series. Whatever doesn't fit in the message stays in the series
+ * for the next upload. If the agent falls behind, the oldest windows and
+ * samples are overwritten and counted as dropped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ioterror.h"
+#include "iotdebug.h"
+#include "iotapi.h"
+#include "timestamp.h"
+#include "sampleseries.h"
+
+/** Longest value we print */
+#define SAMPLESERIES_VALUE_SIZE 32
+
+/***************** Private Prototypes ****************/
+static int _sampleseries_valueSize(const char *deviceId, const char *multiplier);
+static int _sampleseries_addValue(char *dest, int maxSize, int precision, time_t timestamp, const char *deviceId, int deviceType, const char *paramName, const char *suffix, const char *multiplier, char asciiParamIndex, double value);
+
+/***************** Public Functions ****************/
+/**
+ * Start an empty series
+ * @param series Series to initialize
+ * @param window_sec Length of an aggregation window in seconds
+ * @param aggregates sampleseries_aggregate_e's to report, OR'd together
+ * @param precision Digits after the decimal point when values are sent
+ * @return SUCCESS, or FAIL if we couldn't allocate room for the raw samples
+ */
+error_t sampleseries_init(sampleseries_t *series, int window_sec, int aggregates, int precision) {
+  bzero(series, sizeof(sampleseries_t));
+  series->window_sec = window_sec;
+  series->aggregates = aggregates;
+  series->precision = precision;
+
+  if(aggregates & SAMPLESERIES_RAW) {
+    if((series->samples = malloc(SAMPLESERIES_MAX_SAMPLES * sizeof(sample_t))) == NULL) {
+      SYSLOG_ERR("[series] Couldn't allocate %d raw samples", SAMPLESERIES_MAX_SAMPLES);
+      series->aggregates &= ~SAMPLESERIES_RAW;
+      return FAIL;
+    }
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * Free the raw samples of a series that's no longer used
+ */
+void sampleseries_destroy(sampleseries_t *series) {
+  free(series->samples);
+  series->samples = NULL;
+  series->totalSamples = 0;
+}
+
+/**
+ * Add a sample taken now
+ */
+void sampleseries_add(sampleseries_t *series, double value) {
+  sampleseries_addAt(series, time(NULL), value);
+}
+
+/**
+ * Add a sample
+ * @param series Series to add to
+ * @param timestamp Time the sample was taken
+ * @param value Value of the sample
+ */
+void sampleseries_addAt(sampleseries_t *series, time_t timestamp, double value) {
+  sampleseries_window_t *current = &series->current;
+
+  if(current->count > 0 && timestamp - current->start >= series->window_sec) {
+    sampleseries_closeWindow(series);
+  }
+
+  if(current->count == 0) {
+    current->start = timestamp;
+    current->min = value;
+    current->max = value;
+  }
+
+  current->end = timestamp;
+  current->count++;
+  current->sum += value;
+  current->last = value;
+
+  if(value < current->min) {
+    current->min = value;
+  }
+
+  if(value > current->max) {
+    current->max = value;
+  }
+
+  if(series->aggregates & SAMPLESERIES_RAW) {
+    if(series->totalSamples == SAMPLESERIES_MAX_SAMPLES) {
+      // Overwrite the oldest sample
+      series->sampleHead = (series->sampleHead + 1) % SAMPLESERIES_MAX_SAMPLES;
+      series->totalSamples--;
+      series->droppedSamples++;
+    }
+
+    series->samples[(series->sampleHead + series->totalSamples) % SAMPLESERIES_MAX_SAMPLES].timestamp = timestamp;
+    series->samples[(series->sampleHead + series->totalSamples) % SAMPLESERIES_MAX_SAMPLES].value = value;
+    series->totalSamples++;
+  }
+}
+
+/**
+ * Complete the current window early, i.e. so its statistics go out with the
+ * next upload instead of waiting for the window to fill up
+ */
+void sampleseries_closeWindow(sampleseries_t *series) {
+  if(series->current.count == 0) {
+    return;
+  }
+
+  if(series->totalWindows == SAMPLESERIES_MAX_WINDOWS) {
+    // Overwrite the oldest window
+    series->windowHead = (series->windowHead + 1) % SAMPLESERIES_MAX_WINDOWS;
+    series->totalWindows--;
+    series->droppedWindows++;
+  }
+
+  memcpy(&series->windows[(series->windowHead + series->totalWindows) % SAMPLESERIES_MAX_WINDOWS], &series->current, sizeof(sampleseries_window_t));
+  series->totalWindows++;
+  bzero(&series->current, sizeof(sampleseries_window_t));
+}
+
+/**
+ * Take the oldest completed window out of the series
+ * @param window Destination for the window's statistics
+ * @return true if there was a completed window
+ */
+bool sampleseries_nextWindow(sampleseries_t *series, sampleseries_window_t *window) {
+  if(series->totalWindows == 0) {
+    return false;
+  }
+
+  memcpy(window, &series->windows[series->windowHead], sizeof(sampleseries_window_t));
+  series->windowHead = (series->windowHead + 1) % SAMPLESERIES_MAX_WINDOWS;
+  series->totalWindows--;
+  return true;
+}
+
+/**
+ * Take the oldest raw sample out of the series
+ * @param sample Destination for the sample
+ * @return true if there was a raw sample
+ */
+bool sampleseries_nextSample(sampleseries_t *series, sample_t *sample) {
+  if(series->totalSamples == 0) {
+    return false;
+  }
+
+  memcpy(sample, &series->samples[series->sampleHead], sizeof(sample_t));
+  series->sampleHead = (series->sampleHead + 1) % SAMPLESERIES_MAX_SAMPLES;
+  series->totalSamples--;
+  return true;
+}
+
+/**
+ * Add the completed windows, and the raw samples if we keep them, to a
+ * message built with iotxml_newMsg(..), and remove them from the series.
+ * Each window goes out stamped with the time of its last sample. This
+ * operates similar to snprintf, like iotxml_addString(..), except that it
+ * stops before the message would overflow, leaving the windows and samples
+ * that didn't fit for the next message. Add the series last, so the other
+ * params of the device still fit.
+ *
+ * @param dest Starting point in a destination buffer to write data
+ * @param maxSize maximum size remaining past the start point
+ * @param series Series to upload
+ * @param deviceId Device ID string
+ * @param deviceType Device type that is registered with the cloud service
+ * @param paramName Parameter name
+ * @param multiplier Multiplier, or NULL
+ * @param asciiParamIndex Index of this parameter, or 0
+ * @return the size of the string written to the destination pointer
+ */
+int sampleseries_addToMsg(char *dest, int maxSize, sampleseries_t *series, const char *deviceId, int deviceType, const char *paramName, const char *multiplier, char asciiParamIndex) {
+  sampleseries_window_t window;
+  sample_t sample;
+  int valueSize = _sampleseries_valueSize(deviceId, multiplier);
+  int totalValues = 0;
+  int offset = 0;
+  int i;
+
+  // Leave room for iotxml_closeMsg(..) to close off the last param block
+  maxSize -= sizeof("</measure>");
+
+  for(i = SAMPLESERIES_LAST; i <= SAMPLESERIES_COUNT; i <<= 1) {
+    if(series->aggregates & i) {
+      totalValues++;
+    }
+  }
+
+  if(series->droppedWindows > 0 || series->droppedSamples > 0) {
+    SYSLOG_WARNING("[series] %s of %s dropped %d windows and %d samples", paramName, deviceId, series->droppedWindows, series->droppedSamples);
+    series->droppedWindows = 0;
+    series->droppedSamples = 0;
+  }
+
+  // Only take out each window once we know all of its values fit
+  while(series->totalWindows > 0 && offset + totalValues * valueSize < maxSize) {
+    sampleseries_nextWindow(series, &window);
+
+    if(series->aggregates & SAMPLESERIES_LAST) {
+      offset += _sampleseries_addValue(dest + offset, maxSize - offset, series->precision, window.end, deviceId, deviceType, paramName, "", multiplier, asciiParamIndex, window.last);
+    }
+
+    if(series->aggregates & SAMPLESERIES_MEAN) {
+      offset += _sampleseries_addValue(dest + offset, maxSize - offset, series->precision, window.end, deviceId, deviceType, paramName, "Mean", multiplier, asciiParamIndex, window.sum / window.count);
+    }
+
+    if(series->aggregates & SAMPLESERIES_MIN) {
+      offset += _sampleseries_addValue(dest + offset, maxSize - offset, series->precision, window.end, deviceId, deviceType, paramName, "Min", multiplier, asciiParamIndex, window.min);
+    }
+
+    if(series->aggregates & SAMPLESERIES_MAX) {
+      offset += _sampleseries_addValue(dest + offset, maxSize - offset, series->precision, window.end, deviceId, deviceType, paramName, "Max", multiplier, asciiParamIndex, window.max);
+    }
+
+    if(series->aggregates & SAMPLESERIES_COUNT) {
+      offset += _sampleseries_addValue(dest + offset, maxSize - offset, 0, window.end, deviceId, deviceType, paramName, "Count", NULL, asciiParamIndex, window.count);
+    }
+  }
+
+  while(series->totalSamples > 0 && offset + valueSize < maxSize) {
+    sampleseries_nextSample(series, &sample);
+    offset += _sampleseries_addValue(dest + offset, maxSize - offset, series->precision, sample.timestamp, deviceId, deviceType, paramName, "", multiplier, asciiParamIndex, sample.value);
+  }
+
+  if(series->totalWindows > 0 || series->totalSamples > 0) {
+    SYSLOG_DEBUG("[series] %s of %s keeps %d windows and %d samples for the next message", paramName, deviceId, series->totalWindows, series->totalSamples);
+  }
+
+  return offset;
+}
+
+/***************** Private Functions ****************/
+/**
+ * @return the most iotxml_addStringAt(..) can write for one value: a new
+ *     param block with its timestamp, and a param with the longest name,
+ *     index and value
+ */
+static int _sampleseries_valueSize(const char *deviceId, const char *multiplier) {
+  return sizeof("</measure><measure deviceId=\"\" timestamp=\"\">") + strlen(deviceId) + TIMESTAMP_STAMP_SIZE
+      + sizeof("<param name=\"\" index=\"000\" multiplier=\"\"></param>") + SAMPLESERIES_NAME_SIZE
+      + (multiplier != NULL ? strlen(multiplier) : 0) + SAMPLESERIES_VALUE_SIZE;
+}
+
+static int _sampleseries_addValue(char *dest, int maxSize, int precision, time_t timestamp, const char *deviceId, int deviceType, const char *paramName, const char *suffix, const char *multiplier, char asciiParamIndex, double value) {
+  char name[SAMPLESERIES_NAME_SIZE];
+  char buffer[SAMPLESERIES_VALUE_SIZE];
+
+  if(maxSize <= 0) {
+    return 0;
+  }
+
+  snprintf(name, sizeof(name), "%s%s", paramName, suffix);
+  snprintf(buffer, sizeof(buffer), "%.*lf", precision, value);
+  return iotxml_addStringAt(dest, maxSize, timestamp, deviceId, deviceType, IOT_PARAM_MEASURE, name, multiplier, asciiParamIndex, buffer);
+}
@@ -0,0 +1,142 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef SAMPLESERIES_H
+#define SAMPLESERIES_H
+
+#include <stdbool.h>
+#include <time.h>
+
+#include "ioterror.h"
+#include "iotapi.h"
+
+/** Number of raw samples a series holds, i.e. 5 minutes at 1 Hz */
+#ifndef SAMPLESERIES_MAX_SAMPLES
+#define SAMPLESERIES_MAX_SAMPLES 300
+#endif
+
+/** Number of completed aggregation windows a series holds */
+#ifndef SAMPLESERIES_MAX_WINDOWS
+#define SAMPLESERIES_MAX_WINDOWS 16
+#endif
+
+/** Longest parameter name, including the aggregate's suffix */
+#ifndef SAMPLESERIES_NAME_SIZE
+#define SAMPLESERIES_NAME_SIZE 48
+#endif
+
+/**
+ * What a series reports for each aggregation window, OR'd together.
+ * SAMPLESERIES_LAST goes out under the parameter's own name, the others
+ * under the name with a suffix, i.e. "powerMean".
+ */
+typedef enum {
+  SAMPLESERIES_LAST = 0x01,
+  SAMPLESERIES_MEAN = 0x02,
+  SAMPLESERIES_MIN = 0x04,
+  SAMPLESERIES_MAX = 0x08,
+  SAMPLESERIES_COUNT = 0x10,
+
+  /** Also keep the raw samples and send each with its own timestamp */
+  SAMPLESERIES_RAW = 0x20,
+} sampleseries_aggregate_e;
+
+/**
+ * One sample
+ */
+typedef struct sample_t {
+  time_t timestamp;
+  double value;
+} sample_t;
+
+/**
+ * Statistics of the samples in one aggregation window
+ */
+typedef struct sampleseries_window_t {
+
+  /** Time of the first and last sample in the window */
+  time_t start;
+  time_t end;
+
+  int count;
+
+  double min;
+
+  double max;
+
+  double sum;
+
+  double last;
+
+} sampleseries_window_t;
+
+/**
+ * A series of samples of one measurement. Everything is fixed size, so
+ * sampling faster than we upload costs no more memory, only older data.
+ */
+typedef struct sampleseries_t {
+
+  /**
+   * Raw samples, oldest first starting at sampleHead. Only allocated with
+   * SAMPLESERIES_RAW, SAMPLESERIES_MAX_SAMPLES of them.
+   */
+  sample_t *samples;
+  int sampleHead;
+  int totalSamples;
+
+  /** Completed windows, oldest first starting at windowHead */
+  sampleseries_window_t windows[SAMPLESERIES_MAX_WINDOWS];
+  int windowHead;
+  int totalWindows;
+
+  /** Window we're adding samples to */
+  sampleseries_window_t current;
+
+  /** Length of an aggregation window in seconds */
+  int window_sec;
+
+  /** sampleseries_aggregate_e's to report */
+  int aggregates;
+
+  /** Digits after the decimal point when the values are sent */
+  int precision;
+
+  /** Samples and windows that were overwritten before they were sent */
+  int droppedSamples;
+  int droppedWindows;
+
+} sampleseries_t;
+
+/***************** Public Prototypes ****************/
+error_t sampleseries_init(sampleseries_t *series, int window_sec, int aggregates, int precision);
+
+void sampleseries_destroy(sampleseries_t *series);
+
+void sampleseries_add(sampleseries_t *series, double value);
+
+void sampleseries_addAt(sampleseries_t *series, time_t timestamp, double value);
+
+void sampleseries_closeWindow(sampleseries_t *series);
+
+bool sampleseries_nextWindow(sampleseries_t *series, sampleseries_window_t *window);
+
+bool sampleseries_nextSample(sampleseries_t *series, sample_t *sample);
+
+int sampleseries_addToMsg(char *dest, int maxSize, sampleseries_t *series, const char *deviceId, int deviceType, const char *paramName, const char *multiplier, char asciiParamIndex);
+
+#endif
@@ -28,6 +28,8 @@
 #include "ioterror.h"
 #include "iotdebug.h"
 
+/***************** Private Prototypes ****************/
+static void _timestamp_formatZone(char *dest, const struct tm *localTime);
 
 /**
  * Produces a timestamp in the format YYYY-MM-DDTHH:MM:SS[Z|[+|-]hh:mm]
@@ -36,33 +38,92 @@
  * @return The size of the timestamp string
  */
 int getTimestamp(char *dest, int maxSize) {
-  time_t epochTime = time(NULL);
-  struct tm *currentTime;
+  return getTimestampAt(dest, maxSize, time(NULL));
+}
+
+/**
+ * Produces a timestamp for the given time, in the format
+ * YYYY-MM-DDTHH:MM:SS[Z|[+|-]hh:mm]
+ * @param dest Destination to write the timestamp string
+ * @param maxSize Maximum size of the destination, at least TIMESTAMP_STAMP_SIZE
+ * @param epochTime Time to produce the timestamp for
+ * @return The size of the timestamp string
+ */
+int getTimestampAt(char *dest, int maxSize, time_t epochTime) {
+  struct tm currentTime;
   int offset = 0;
 
   if(maxSize < TIMESTAMP_STAMP_SIZE) {
     return FAIL;
   }
 
-  currentTime = localtime(&epochTime);
-  offset = strftime(dest, maxSize, "%Y-%m-%dT%H:%M:%S", currentTime);
-  getTimezone(dest + offset, maxSize - offset);
+  localtime_r(&epochTime, &currentTime);
+  offset = strftime(dest, maxSize, "%Y-%m-%dT%H:%M:%S", &currentTime);
+  _timestamp_formatZone(dest + offset, &currentTime);
 
   return strlen(dest);
 }
 
+/**
+ * Reads a timestamp in the format YYYY-MM-DDTHH:MM:SS[Z|[+|-]hh:mm], as
+ * produced by getTimestamp(..), back into an epoch time
+ * @param timestamp Timestamp string
+ * @return The epoch time, or 0 if the timestamp couldn't be read
+ */
+time_t parseTimestamp(const char *timestamp) {
+  int year, month, day, hour, minute, second;
+  int zoneHours = 0;
+  int zoneMinutes = 0;
+  char zone = 'Z';
+  long days;
+  long seconds;
+
+  if(sscanf(timestamp, "%4d-%2d-%2dT%2d:%2d:%2d%c%2d:%2d",
+      &year, &month, &day, &hour, &minute, &second, &zone, &zoneHours, &zoneMinutes) < 6) {
+    return 0;
+  }
+
+  // Days since 1970-01-01 in the proleptic Gregorian calendar
+  if(month <= 2) {
+    year--;
+    month += 12;
+  }
+
+  days = 365L * year + year / 4 - year / 100 + year / 400 + (153 * (month - 3) + 2) / 5 + day - 719469L;
+
+  seconds = days * 86400L + hour * 3600L + minute * 60L + second;
+
+  if(zone == '+') {
+    seconds -= zoneHours * 3600L + zoneMinutes * 60L;
+  } else if(zone == '-') {
+    seconds += zoneHours * 3600L + zoneMinutes * 60L;
+  }
+
+  return (time_t) seconds;
+}
+
 /**
  * Produces the time zone as specified by xsd:dateTime
  * @param dest Destination buffer to write the timezone into
  * @param size Size of the buffer, at least TIMESTAMP_ZONE_SIZE large
  */
 void getTimezone(char *dest, int size) {
-  struct tm *currentTime;
+  struct tm currentTime;
   time_t currtime;
   currtime = time(NULL);
 
-  currentTime = localtime(&currtime);
-  strftime(dest, TIMESTAMP_ZONE_SIZE, "%z", currentTime);
+  localtime_r(&currtime, &currentTime);
+  _timestamp_formatZone(dest, &currentTime);
+}
+
+/***************** Private Functions ****************/
+/**
+ * Write the time zone of a local time as specified by xsd:dateTime
+ * @param dest Destination buffer, at least TIMESTAMP_ZONE_SIZE large
+ * @param localTime Local time from localtime_r(..)
+ */
+static void _timestamp_formatZone(char *dest, const struct tm *localTime) {
+  strftime(dest, TIMESTAMP_ZONE_SIZE, "%z", localTime);
 
   //formatting from ISO 8601:2000 to Chapter 5.4 of ISO 8601
   // [+|-]hhmm will become [+|-]hh:mm
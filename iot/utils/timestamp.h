@@ -19,6 +19,8 @@
 #ifndef TIMESTAMP_H
 #define TIMESTAMP_H
 
+#include <time.h>
+
 enum {
   TIMESTAMP_ZONE_SIZE = 8,
   TIMESTAMP_STAMP_SIZE = 40,
@@ -27,6 +29,10 @@ enum {
 /***************** Public Prototypes ****************/
 int getTimestamp(char *dest, int maxSize);
 
+int getTimestampAt(char *dest, int maxSize, time_t epochTime);
+
+time_t parseTimestamp(const char *timestamp);
+
 void getTimezone(char *dest, int size);
 
 #endif
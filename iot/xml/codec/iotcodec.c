@@ -0,0 +1,230 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * Wire codecs. A message is a tree of elements with attributes and text, as
+ * in the XML we've always sent. Each codec writes that tree out in its own
+ * format and reads it back as the same element events, so a message can be
+ * translated from one codec to another without knowing what it means.
+ *
+ *   xml   The XML of the Device API, and the default
+ *   json  {"name":{"attribute":"value",...,"value":"text","items":[...]}}
+ *   cbor  The same layout as json in CBOR, with well known names interned
+ *
+ * Agents and the proxy keep talking XML to each other. The proxy translates
+ * to and from the codec chosen for the server when it wraps and unwraps a
+ * message, so nothing changes for the applications.
+ */
+
+#include <string.h>
+
+#include "iotcodec.h"
+#include "ioterror.h"
+#include "iotdebug.h"
+
+/** Codecs that can be selected by name */
+static const iotcodec_t *codecs[] = {
+    &iotcodecxml,
+    &iotcodecjson,
+    &iotcodeccbor,
+};
+
+/***************** Private Prototypes ****************/
+static void _iotcodec_startElementHandler(void *ctx, const char *name, const char **atts);
+
+static void _iotcodec_endElementHandler(void *ctx, const char *name);
+
+static void _iotcodec_charactersHandler(void *ctx, const char *ch, int len);
+
+/***************** Public Functions ****************/
+/**
+ * @param name Codec name, i.e. "json"
+ * @return the codec, or NULL if there is no codec by that name
+ */
+const iotcodec_t *iotcodec_find(const char *name) {
+  int i;
+
+  if(name == NULL) {
+    return NULL;
+  }
+
+  for(i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+    if(strcmp(codecs[i]->name, name) == 0) {
+      return codecs[i];
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Start writing a message
+ * @param w Writer
+ * @param codec Codec to write in
+ * @param dest Destination buffer
+ * @param maxSize Size of the destination buffer
+ */
+void iotcodec_initWriter(iotcodec_writer_t *w, const iotcodec_t *codec, char *dest, int maxSize) {
+  memset(w, 0x0, sizeof(iotcodec_writer_t));
+  w->codec = codec;
+  w->dest = dest;
+  w->maxSize = maxSize;
+
+  if(maxSize > 0) {
+    dest[0] = '\0';
+  }
+}
+
+/**
+ * Open an element
+ * @param w Writer
+ * @param name Element name
+ * @param atts NULL-terminated list of attribute name/value pairs, or NULL
+ */
+void iotcodec_startElement(iotcodec_writer_t *w, const char *name, const char **atts) {
+  if(w->depth >= IOTCODEC_MAX_DEPTH) {
+    // Too deep to keep track of, so the message can't be written correctly
+    w->overflow = true;
+    return;
+  }
+
+  w->flags[w->depth] = 0;
+  w->codec->startElement(w, name, atts);
+  w->depth++;
+}
+
+/**
+ * Write the text of the element that's open
+ * @param w Writer
+ * @param text Text, doesn't need to be null-terminated
+ * @param len Length of the text
+ */
+void iotcodec_characters(iotcodec_writer_t *w, const char *text, int len) {
+  if(w->depth > 0 && w->depth <= IOTCODEC_MAX_DEPTH) {
+    w->codec->characters(w, text, len);
+  }
+}
+
+/**
+ * Close the element that's open
+ * @param w Writer
+ * @param name Element name
+ */
+void iotcodec_endElement(iotcodec_writer_t *w, const char *name) {
+  if(w->depth > 0 && w->depth <= IOTCODEC_MAX_DEPTH) {
+    w->codec->endElement(w, name);
+    w->depth--;
+  }
+}
+
+/**
+ * Finish writing a message
+ * @param w Writer
+ * @return the length of the message, or -1 if it didn't fit or elements
+ *     were left open
+ */
+int iotcodec_finish(iotcodec_writer_t *w) {
+  if(w->overflow || w->depth != 0) {
+    return -1;
+  }
+
+  return w->offset;
+}
+
+/**
+ * Write a message encoded in another codec into this one, i.e. the body of
+ * a message into the writer that's writing its header
+ *
+ * @param w Writer
+ * @param from Codec the message is in
+ * @param msg Message
+ * @param len Length of the message
+ * @return SUCCESS if the message was read
+ */
+error_t iotcodec_copy(iotcodec_writer_t *w, const iotcodec_t *from, const char *msg, int len) {
+  return from->parse(msg, len,
+      _iotcodec_startElementHandler,
+      _iotcodec_endElementHandler,
+      _iotcodec_charactersHandler,
+      w);
+}
+
+/**
+ * Translate a message from one codec to another
+ *
+ * @param from Codec the message is in
+ * @param to Codec to write
+ * @param msg Message
+ * @param len Length of the message
+ * @param dest Destination buffer
+ * @param maxSize Size of the destination buffer
+ * @return the length of the translated message, or -1 on error
+ */
+int iotcodec_transcode(const iotcodec_t *from, const iotcodec_t *to, const char *msg, int len, char *dest, int maxSize) {
+  iotcodec_writer_t w;
+
+  iotcodec_initWriter(&w, to, dest, maxSize);
+
+  if(iotcodec_copy(&w, from, msg, len) != SUCCESS) {
+    SYSLOG_ERR("Couldn't read a %s message", from->name);
+    return -1;
+  }
+
+  return iotcodec_finish(&w);
+}
+
+/**
+ * Append bytes to the message. For codec implementations. The destination
+ * stays null-terminated while there is room, so text codecs can be logged.
+ *
+ * @param w Writer
+ * @param data Bytes to write
+ * @param len Number of bytes
+ */
+void iotcodec_write(iotcodec_writer_t *w, const void *data, int len) {
+  if(w->overflow || w->offset + len >= w->maxSize) {
+    w->overflow = true;
+    return;
+  }
+
+  memcpy(w->dest + w->offset, data, len);
+  w->offset += len;
+  w->dest[w->offset] = '\0';
+}
+
+/***************** Private Functions ****************/
+/**
+ * Start element handler of iotcodec_copy(..)
+ */
+static void _iotcodec_startElementHandler(void *ctx, const char *name, const char **atts) {
+  iotcodec_startElement((iotcodec_writer_t *) ctx, name, atts);
+}
+
+/**
+ * End element handler of iotcodec_copy(..)
+ */
+static void _iotcodec_endElementHandler(void *ctx, const char *name) {
+  iotcodec_endElement((iotcodec_writer_t *) ctx, name);
+}
+
+/**
+ * Character handler of iotcodec_copy(..)
+ */
+static void _iotcodec_charactersHandler(void *ctx, const char *ch, int len) {
+  iotcodec_characters((iotcodec_writer_t *) ctx, ch, len);
+}
@@ -0,0 +1,128 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef IOTCODEC_H
+#define IOTCODEC_H
+
+#include <stdbool.h>
+#include "ioterror.h"
+#include "iotstreamparser.h"
+
+/** Name of the codec messages are exchanged in until told otherwise */
+#ifndef IOTCODEC_DEFAULT
+#define IOTCODEC_DEFAULT "xml"
+#endif
+
+/** Deepest element nesting a codec will write or read */
+#ifndef IOTCODEC_MAX_DEPTH
+#define IOTCODEC_MAX_DEPTH 8
+#endif
+
+/** Maximum size of a text node a codec will read, including the null */
+#ifndef IOTCODEC_VALUE_SIZE
+#define IOTCODEC_VALUE_SIZE IOTPARSER_VALUE_SIZE
+#endif
+
+/** Member of an element holding its text, in codecs without text nodes */
+#define IOTCODEC_KEY_VALUE "value"
+
+/** Member of an element holding its child elements */
+#define IOTCODEC_KEY_ITEMS "items"
+
+/**
+ * Output of a codec. Codecs see a message as the same tree of elements,
+ * attributes and text as the XML, and write it out one event at a time.
+ */
+typedef struct iotcodec_writer_t {
+
+  /** Codec doing the writing */
+  const struct iotcodec_t *codec;
+
+  /** Destination buffer */
+  char *dest;
+  int maxSize;
+  int offset;
+
+  /** Element nesting depth */
+  int depth;
+
+  /** Codec-specific state of each open element */
+  unsigned char flags[IOTCODEC_MAX_DEPTH];
+
+  /** True if the destination was too small */
+  bool overflow;
+
+} iotcodec_writer_t;
+
+/**
+ * A wire format. Writing is done by the element handlers; reading replays a
+ * message as the same element events, so one codec can be translated into
+ * another, or into the command listeners.
+ *
+ * While an element handler runs, w->depth is the number of elements open
+ * around the element being handled, so its own flags are
+ * w->flags[w->depth] in startElement(..) and w->flags[w->depth - 1] in
+ * characters(..) and endElement(..).
+ */
+typedef struct iotcodec_t {
+
+  /** Name used to select the codec, i.e. "xml" */
+  const char *name;
+
+  /** HTTP content type of a message in this codec */
+  const char *contentType;
+
+  void (*startElement)(iotcodec_writer_t *w, const char *name, const char **atts);
+
+  void (*characters)(iotcodec_writer_t *w, const char *text, int len);
+
+  void (*endElement)(iotcodec_writer_t *w, const char *name);
+
+  error_t (*parse)(const char *msg, int len,
+      iotstreamparser_startElement_f startElement,
+      iotstreamparser_endElement_f endElement,
+      iotstreamparser_characters_f characters,
+      void *ctx);
+
+} iotcodec_t;
+
+/** Available codecs */
+extern const iotcodec_t iotcodecxml;
+extern const iotcodec_t iotcodecjson;
+extern const iotcodec_t iotcodeccbor;
+
+/***************** Public Prototypes ****************/
+const iotcodec_t *iotcodec_find(const char *name);
+
+void iotcodec_initWriter(iotcodec_writer_t *w, const iotcodec_t *codec, char *dest, int maxSize);
+
+void iotcodec_startElement(iotcodec_writer_t *w, const char *name, const char **atts);
+
+void iotcodec_characters(iotcodec_writer_t *w, const char *text, int len);
+
+void iotcodec_endElement(iotcodec_writer_t *w, const char *name);
+
+int iotcodec_finish(iotcodec_writer_t *w);
+
+error_t iotcodec_copy(iotcodec_writer_t *w, const iotcodec_t *from, const char *msg, int len);
+
+int iotcodec_transcode(const iotcodec_t *from, const iotcodec_t *to, const char *msg, int len, char *dest, int maxSize);
+
+void iotcodec_write(iotcodec_writer_t *w, const void *data, int len);
+
+#endif
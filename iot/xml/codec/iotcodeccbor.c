@@ -0,0 +1,643 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * CBOR codec (RFC 7049). The layout is the one of the JSON codec: each
+ * element is a map with a single member named after the element, holding an
+ * indefinite-length map of the attributes, "value" and "items".
+ *
+ * To keep messages small, element names, attribute names and the values of
+ * "name" attributes found in the dictionary below are sent as its index,
+ * and text that is a plain integer is sent as an integer. Reading turns
+ * them back into the same text. The dictionary can only ever be appended
+ * to, or the server and hubs will disagree on what the indices mean.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "iotcodec.h"
+#include "iotstreamparser.h"
+#include "ioterror.h"
+#include "iotdebug.h"
+
+/** Major types */
+enum {
+  IOTCODECCBOR_UINT = 0,
+  IOTCODECCBOR_NEGINT = 1,
+  IOTCODECCBOR_BYTES = 2,
+  IOTCODECCBOR_TEXT = 3,
+  IOTCODECCBOR_ARRAY = 4,
+  IOTCODECCBOR_MAP = 5,
+  IOTCODECCBOR_TAG = 6,
+  IOTCODECCBOR_SIMPLE = 7,
+};
+
+/** Additional information of an indefinite length item */
+#define IOTCODECCBOR_INDEFINITE 31
+
+/** Ends an indefinite length item */
+#define IOTCODECCBOR_BREAK 0xFF
+
+/** Flags of an open element */
+#define IOTCODECCBOR_ITEMS 0x01
+#define IOTCODECCBOR_VALUE 0x02
+
+/** Attribute whose values are interned */
+#define IOTCODECCBOR_KEY_NAME "name"
+
+/** Interned strings. Append only. */
+static const char *dictionary[] = {
+    "h2s", "s2h", "measure", "param", "alert", "add", "response", "command",
+    "deviceId", "deviceType", "timestamp", "name", "index", "multiplier",
+    IOTCODEC_KEY_VALUE, IOTCODEC_KEY_ITEMS, "ver", "hubId", "seq", "cmdId",
+    "result", "type", "status", "p", "power", "current", "energy", "temp",
+    "tmode", "fmode", "tstate", "fstate", "outletStatus", "noRead",
+};
+
+/**
+ * State of a message being read
+ */
+typedef struct iotcodeccbor_reader_t {
+
+  /** Next byte to read, and the end of the message */
+  const unsigned char *p;
+  const unsigned char *end;
+
+  /** Element nesting depth */
+  int depth;
+
+  iotstreamparser_startElement_f startElement;
+  iotstreamparser_endElement_f endElement;
+  iotstreamparser_characters_f characters;
+  void *ctx;
+
+} iotcodeccbor_reader_t;
+
+/***************** Private Prototypes ****************/
+static void _iotcodeccbor_startElement(iotcodec_writer_t *w, const char *name, const char **atts);
+
+static void _iotcodeccbor_characters(iotcodec_writer_t *w, const char *text, int len);
+
+static void _iotcodeccbor_endElement(iotcodec_writer_t *w, const char *name);
+
+static error_t _iotcodeccbor_parse(const char *msg, int len,
+    iotstreamparser_startElement_f startElement,
+    iotstreamparser_endElement_f endElement,
+    iotstreamparser_characters_f characters,
+    void *ctx);
+
+static void _iotcodeccbor_writeHead(iotcodec_writer_t *w, int major, unsigned long long value);
+
+static void _iotcodeccbor_writeName(iotcodec_writer_t *w, const char *text, int len);
+
+static void _iotcodeccbor_writeValue(iotcodec_writer_t *w, const char *text, int len);
+
+static int _iotcodeccbor_lookup(const char *text, int len);
+
+static error_t _iotcodeccbor_readElement(iotcodeccbor_reader_t *r);
+
+static error_t _iotcodeccbor_readHead(iotcodeccbor_reader_t *r, int *major, int *info, unsigned long long *value);
+
+static error_t _iotcodeccbor_readText(iotcodeccbor_reader_t *r, bool interned, char *dest, int destSize);
+
+static error_t _iotcodeccbor_skip(iotcodeccbor_reader_t *r, int depth);
+
+static bool _iotcodeccbor_isBreak(iotcodeccbor_reader_t *r);
+
+const iotcodec_t iotcodeccbor = {
+    "cbor",
+    "application/cbor",
+    _iotcodeccbor_startElement,
+    _iotcodeccbor_characters,
+    _iotcodeccbor_endElement,
+    _iotcodeccbor_parse,
+};
+
+/***************** Private Functions ****************/
+static void _iotcodeccbor_startElement(iotcodec_writer_t *w, const char *name, const char **atts) {
+  unsigned char *parent;
+  unsigned char head;
+  int i;
+
+  if(w->depth > 0) {
+    parent = &w->flags[w->depth - 1];
+
+    if(!(*parent & IOTCODECCBOR_ITEMS)) {
+      _iotcodeccbor_writeName(w, IOTCODEC_KEY_ITEMS, strlen(IOTCODEC_KEY_ITEMS));
+      head = (IOTCODECCBOR_ARRAY << 5) | IOTCODECCBOR_INDEFINITE;
+      iotcodec_write(w, &head, 1);
+      *parent |= IOTCODECCBOR_ITEMS;
+    }
+  }
+
+  _iotcodeccbor_writeHead(w, IOTCODECCBOR_MAP, 1);
+  _iotcodeccbor_writeName(w, name, strlen(name));
+  head = (IOTCODECCBOR_MAP << 5) | IOTCODECCBOR_INDEFINITE;
+  iotcodec_write(w, &head, 1);
+
+  for(i = 0; atts != NULL && atts[i] != NULL && atts[i + 1] != NULL; i += 2) {
+    _iotcodeccbor_writeName(w, atts[i], strlen(atts[i]));
+
+    if(strcmp(atts[i], IOTCODECCBOR_KEY_NAME) == 0 && _iotcodeccbor_lookup(atts[i + 1], strlen(atts[i + 1])) >= 0) {
+      _iotcodeccbor_writeName(w, atts[i + 1], strlen(atts[i + 1]));
+    } else {
+      _iotcodeccbor_writeValue(w, atts[i + 1], strlen(atts[i + 1]));
+    }
+  }
+}
+
+static void _iotcodeccbor_characters(iotcodec_writer_t *w, const char *text, int len) {
+  unsigned char *flags = &w->flags[w->depth - 1];
+  int i;
+
+  if(*flags & (IOTCODECCBOR_ITEMS | IOTCODECCBOR_VALUE)) {
+    // Only one text node, and only in elements without children
+    return;
+  }
+
+  // Whitespace between elements isn't text
+  for(i = 0; i < len && (text[i] == ' ' || text[i] == '\t' || text[i] == '\r' || text[i] == '\n'); i++);
+  if(i == len) {
+    return;
+  }
+
+  _iotcodeccbor_writeName(w, IOTCODEC_KEY_VALUE, strlen(IOTCODEC_KEY_VALUE));
+  _iotcodeccbor_writeValue(w, text, len);
+  *flags |= IOTCODECCBOR_VALUE;
+}
+
+static void _iotcodeccbor_endElement(iotcodec_writer_t *w, const char *name) {
+  unsigned char brk = IOTCODECCBOR_BREAK;
+
+  if(w->flags[w->depth - 1] & IOTCODECCBOR_ITEMS) {
+    iotcodec_write(w, &brk, 1);
+  }
+
+  iotcodec_write(w, &brk, 1);
+}
+
+/**
+ * Read a sequence of one or more top level elements
+ */
+static error_t _iotcodeccbor_parse(const char *msg, int len,
+    iotstreamparser_startElement_f startElement,
+    iotstreamparser_endElement_f endElement,
+    iotstreamparser_characters_f characters,
+    void *ctx) {
+  iotcodeccbor_reader_t r;
+
+  memset(&r, 0x0, sizeof(r));
+  r.p = (const unsigned char *) msg;
+  r.end = r.p + len;
+  r.startElement = startElement;
+  r.endElement = endElement;
+  r.characters = characters;
+  r.ctx = ctx;
+
+  while(r.p < r.end) {
+    if(_iotcodeccbor_readElement(&r) != SUCCESS) {
+      SYSLOG_ERR("Malformed CBOR at byte %d", (int) ((const char *) r.p - msg));
+      return FAIL;
+    }
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * Write the initial byte of an item and its argument in the fewest bytes
+ */
+static void _iotcodeccbor_writeHead(iotcodec_writer_t *w, int major, unsigned long long value) {
+  unsigned char head[9];
+  int size;
+  int i;
+
+  if(value < 24) {
+    head[0] = (major << 5) | value;
+    size = 1;
+
+  } else if(value <= 0xFF) {
+    head[0] = (major << 5) | 24;
+    size = 2;
+
+  } else if(value <= 0xFFFF) {
+    head[0] = (major << 5) | 25;
+    size = 3;
+
+  } else if(value <= 0xFFFFFFFFULL) {
+    head[0] = (major << 5) | 26;
+    size = 5;
+
+  } else {
+    head[0] = (major << 5) | 27;
+    size = 9;
+  }
+
+  for(i = size - 1; i > 0; i--) {
+    head[i] = value & 0xFF;
+    value >>= 8;
+  }
+
+  iotcodec_write(w, head, size);
+}
+
+/**
+ * Write a name, interned if it's in the dictionary
+ */
+static void _iotcodeccbor_writeName(iotcodec_writer_t *w, const char *text, int len) {
+  int index = _iotcodeccbor_lookup(text, len);
+
+  if(index >= 0) {
+    _iotcodeccbor_writeHead(w, IOTCODECCBOR_UINT, index);
+  } else {
+    _iotcodeccbor_writeHead(w, IOTCODECCBOR_TEXT, len);
+    iotcodec_write(w, text, len);
+  }
+}
+
+/**
+ * Write a value as an integer if it reads back as exactly the same text,
+ * otherwise as text
+ */
+static void _iotcodeccbor_writeValue(iotcodec_writer_t *w, const char *text, int len) {
+  unsigned long long value = 0;
+  bool negative = (len > 1 && text[0] == '-');
+  int start = negative ? 1 : 0;
+  int i;
+
+  // Up to 18 digits always fit, and leading zeros and "-0" wouldn't survive
+  if(len - start > 0 && len - start <= 18
+      && (text[start] != '0' || (len == 1))) {
+    for(i = start; i < len && text[i] >= '0' && text[i] <= '9'; i++) {
+      value = value * 10 + (text[i] - '0');
+    }
+
+    if(i == len) {
+      _iotcodeccbor_writeHead(w, negative ? IOTCODECCBOR_NEGINT : IOTCODECCBOR_UINT, negative ? value - 1 : value);
+      return;
+    }
+  }
+
+  _iotcodeccbor_writeHead(w, IOTCODECCBOR_TEXT, len);
+  iotcodec_write(w, text, len);
+}
+
+/**
+ * @return the dictionary index of the text, or -1 if it isn't interned
+ */
+static int _iotcodeccbor_lookup(const char *text, int len) {
+  int i;
+
+  for(i = 0; i < sizeof(dictionary) / sizeof(dictionary[0]); i++) {
+    if(strncmp(dictionary[i], text, len) == 0 && dictionary[i][len] == '\0') {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * Read one element and everything inside it, gathering the attributes and
+ * text first so they can go out with the start element
+ */
+static error_t _iotcodeccbor_readElement(iotcodeccbor_reader_t *r) {
+  char name[IOTSTREAMPARSER_NAME_SIZE];
+  char key[IOTSTREAMPARSER_NAME_SIZE];
+  char attrNames[IOTSTREAMPARSER_MAX_ATTRIBUTES][IOTSTREAMPARSER_NAME_SIZE];
+  char attrValues[IOTSTREAMPARSER_MAX_ATTRIBUTES][IOTSTREAMPARSER_ATTRIBUTE_VALUE_SIZE];
+  const char *atts[IOTSTREAMPARSER_MAX_ATTRIBUTES * 2 + 1];
+  char value[IOTCODEC_VALUE_SIZE];
+  const unsigned char *items = NULL;
+  const unsigned char *resume;
+  unsigned long long count;
+  unsigned long long i;
+  bool hasValue = false;
+  bool indefinite;
+  int totalAttrs = 0;
+  int major;
+  int info;
+
+  if(++r->depth > IOTCODEC_MAX_DEPTH) {
+    return FAIL;
+  }
+
+  if(_iotcodeccbor_readHead(r, &major, &info, &count) != SUCCESS
+      || major != IOTCODECCBOR_MAP || info == IOTCODECCBOR_INDEFINITE || count != 1
+      || _iotcodeccbor_readText(r, true, name, sizeof(name)) != SUCCESS
+      || _iotcodeccbor_readHead(r, &major, &info, &count) != SUCCESS
+      || major != IOTCODECCBOR_MAP) {
+    return FAIL;
+  }
+
+  indefinite = (info == IOTCODECCBOR_INDEFINITE);
+
+  for(i = 0; indefinite || i < count; i++) {
+    if(indefinite && _iotcodeccbor_isBreak(r)) {
+      r->p++;
+      break;
+    }
+
+    if(_iotcodeccbor_readText(r, true, key, sizeof(key)) != SUCCESS) {
+      return FAIL;
+    }
+
+    if(strcmp(key, IOTCODEC_KEY_ITEMS) == 0) {
+      items = r->p;
+      if(_iotcodeccbor_skip(r, 0) != SUCCESS) {
+        return FAIL;
+      }
+
+    } else if(strcmp(key, IOTCODEC_KEY_VALUE) == 0) {
+      if(_iotcodeccbor_readText(r, false, value, sizeof(value)) != SUCCESS) {
+        return FAIL;
+      }
+
+      hasValue = true;
+
+    } else if(totalAttrs < IOTSTREAMPARSER_MAX_ATTRIBUTES) {
+      strncpy(attrNames[totalAttrs], key, IOTSTREAMPARSER_NAME_SIZE);
+      if(_iotcodeccbor_readText(r, strcmp(key, IOTCODECCBOR_KEY_NAME) == 0,
+          attrValues[totalAttrs], IOTSTREAMPARSER_ATTRIBUTE_VALUE_SIZE) != SUCCESS) {
+        return FAIL;
+      }
+
+      atts[totalAttrs * 2] = attrNames[totalAttrs];
+      atts[totalAttrs * 2 + 1] = attrValues[totalAttrs];
+      totalAttrs++;
+
+    } else {
+      SYSLOG_WARNING("Too many attributes on <%s>, ignoring %s", name, key);
+      if(_iotcodeccbor_skip(r, 0) != SUCCESS) {
+        return FAIL;
+      }
+    }
+  }
+
+  atts[totalAttrs * 2] = NULL;
+
+  if(r->startElement != NULL) {
+    r->startElement(r->ctx, name, atts);
+  }
+
+  if(hasValue && r->characters != NULL) {
+    r->characters(r->ctx, value, strlen(value));
+  }
+
+  if(items != NULL) {
+    resume = r->p;
+    r->p = items;
+
+    if(_iotcodeccbor_readHead(r, &major, &info, &count) != SUCCESS || major != IOTCODECCBOR_ARRAY) {
+      return FAIL;
+    }
+
+    indefinite = (info == IOTCODECCBOR_INDEFINITE);
+
+    for(i = 0; indefinite || i < count; i++) {
+      if(indefinite && _iotcodeccbor_isBreak(r)) {
+        break;
+      }
+
+      if(_iotcodeccbor_readElement(r) != SUCCESS) {
+        return FAIL;
+      }
+    }
+
+    r->p = resume;
+  }
+
+  if(r->endElement != NULL) {
+    r->endElement(r->ctx, name);
+  }
+
+  r->depth--;
+  return SUCCESS;
+}
+
+/**
+ * Read the initial byte of an item and its argument
+ */
+static error_t _iotcodeccbor_readHead(iotcodeccbor_reader_t *r, int *major, int *info, unsigned long long *value) {
+  int size;
+
+  if(r->p >= r->end) {
+    return FAIL;
+  }
+
+  *major = *r->p >> 5;
+  *info = *r->p & 0x1F;
+  r->p++;
+
+  if(*info < 24 || *info == IOTCODECCBOR_INDEFINITE) {
+    *value = (*info < 24) ? *info : 0;
+    return SUCCESS;
+  }
+
+  if(*info > 27) {
+    return FAIL;
+  }
+
+  size = 1 << (*info - 24);
+  if(r->end - r->p < size) {
+    return FAIL;
+  }
+
+  for(*value = 0; size > 0; size--) {
+    *value = (*value << 8) | *r->p++;
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * Read a scalar as text
+ * @param interned True if integers are dictionary indices
+ * @return FAIL if the item isn't a scalar or the text doesn't fit
+ */
+static error_t _iotcodeccbor_readText(iotcodeccbor_reader_t *r, bool interned, char *dest, int destSize) {
+  unsigned long long value;
+  unsigned int bits;
+  double number;
+  float single;
+  int exponent;
+  int major;
+  int info;
+  int len;
+
+  if(_iotcodeccbor_readHead(r, &major, &info, &value) != SUCCESS) {
+    return FAIL;
+  }
+
+  switch(major) {
+  case IOTCODECCBOR_UINT:
+    if(interned) {
+      if(value >= sizeof(dictionary) / sizeof(dictionary[0])) {
+        SYSLOG_ERR("No interned string %llu", value);
+        return FAIL;
+      }
+
+      len = snprintf(dest, destSize, "%s", dictionary[value]);
+
+    } else {
+      len = snprintf(dest, destSize, "%llu", value);
+    }
+    break;
+
+  case IOTCODECCBOR_NEGINT:
+    len = snprintf(dest, destSize, "-%llu", value + 1);
+    break;
+
+  case IOTCODECCBOR_TEXT:
+    if(info == IOTCODECCBOR_INDEFINITE || value > (unsigned long long) (r->end - r->p)) {
+      return FAIL;
+    }
+
+    len = (int) value;
+    if(value < destSize) {
+      memcpy(dest, r->p, len);
+      dest[len] = '\0';
+    }
+    r->p += value;
+    break;
+
+  case IOTCODECCBOR_SIMPLE:
+    if(info == 20 || info == 21) {
+      len = snprintf(dest, destSize, "%s", (info == 21) ? "true" : "false");
+
+    } else if(info == 22 || info == 23) {
+      dest[0] = '\0';
+      len = 0;
+
+    } else if(info == 25) {
+      // Half precision: 1 sign, 5 exponent and 10 mantissa bits
+      bits = (unsigned int) value;
+      number = (bits & 0x3FF) / 1024.0;
+      if((bits >> 10) & 0x1F) {
+        number += 1.0;
+      }
+
+      for(exponent = ((bits >> 10) & 0x1F) ? ((bits >> 10) & 0x1F) : 1; exponent > 15; exponent--) {
+        number *= 2.0;
+      }
+
+      for(; exponent < 15; exponent++) {
+        number /= 2.0;
+      }
+
+      len = snprintf(dest, destSize, "%g", (bits & 0x8000) ? -number : number);
+
+    } else if(info == 26) {
+      bits = (unsigned int) value;
+      memcpy(&single, &bits, sizeof(single));
+      len = snprintf(dest, destSize, "%g", single);
+
+    } else if(info == 27) {
+      memcpy(&number, &value, sizeof(number));
+      len = snprintf(dest, destSize, "%.17g", number);
+
+    } else {
+      return FAIL;
+    }
+    break;
+
+  default:
+    return FAIL;
+  }
+
+  if(len < 0 || len >= destSize) {
+    SYSLOG_WARNING("Value longer than %d bytes", destSize - 1);
+    return FAIL;
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * Skip over any item
+ */
+static error_t _iotcodeccbor_skip(iotcodeccbor_reader_t *r, int depth) {
+  unsigned long long value;
+  unsigned long long i;
+  int major;
+  int info;
+
+  if(depth > IOTCODEC_MAX_DEPTH * 2 || _iotcodeccbor_readHead(r, &major, &info, &value) != SUCCESS) {
+    return FAIL;
+  }
+
+  switch(major) {
+  case IOTCODECCBOR_BYTES:
+  case IOTCODECCBOR_TEXT:
+    if(info == IOTCODECCBOR_INDEFINITE) {
+      while(!_iotcodeccbor_isBreak(r)) {
+        if(_iotcodeccbor_skip(r, depth + 1) != SUCCESS) {
+          return FAIL;
+        }
+      }
+
+      r->p++;
+
+    } else if(value > (unsigned long long) (r->end - r->p)) {
+      return FAIL;
+
+    } else {
+      r->p += value;
+    }
+    return SUCCESS;
+
+  case IOTCODECCBOR_ARRAY:
+  case IOTCODECCBOR_MAP:
+    if(info == IOTCODECCBOR_INDEFINITE) {
+      while(!_iotcodeccbor_isBreak(r)) {
+        if(_iotcodeccbor_skip(r, depth + 1) != SUCCESS) {
+          return FAIL;
+        }
+      }
+
+      r->p++;
+      return SUCCESS;
+    }
+
+    if(major == IOTCODECCBOR_MAP) {
+      value *= 2;
+    }
+
+    for(i = 0; i < value; i++) {
+      if(_iotcodeccbor_skip(r, depth + 1) != SUCCESS) {
+        return FAIL;
+      }
+    }
+    return SUCCESS;
+
+  case IOTCODECCBOR_TAG:
+    return _iotcodeccbor_skip(r, depth + 1);
+
+  default:
+    return SUCCESS;
+  }
+}
+
+/**
+ * @return true if the next byte ends an indefinite length item
+ */
+static bool _iotcodeccbor_isBreak(iotcodeccbor_reader_t *r) {
+  return r->p < r->end && *r->p == IOTCODECCBOR_BREAK;
+}
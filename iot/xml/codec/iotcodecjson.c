@@ -0,0 +1,575 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * JSON codec. Each element is an object with a single member named after
+ * the element, holding the attributes as strings, the text as "value" and
+ * the child elements in order as "items":
+ *
+ *   {"measure":{"deviceId":"ABC","items":[{"param":{"name":"power","value":"12"}}]}}
+ *
+ * Numbers, true and false are accepted wherever a string is expected.
+ * Reading is done in place with no heap allocation.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "iotcodec.h"
+#include "iotstreamparser.h"
+#include "ioterror.h"
+#include "iotdebug.h"
+
+/** The object has a member, so the next one needs a comma */
+#define IOTCODECJSON_MEMBERS 0x01
+
+/** The "items" array is open */
+#define IOTCODECJSON_ITEMS 0x02
+
+/** The "value" member was written */
+#define IOTCODECJSON_VALUE 0x04
+
+/**
+ * State of a message being read
+ */
+typedef struct iotcodecjson_reader_t {
+
+  /** Next character to read, and the end of the message */
+  const char *p;
+  const char *end;
+
+  /** Element nesting depth */
+  int depth;
+
+  iotstreamparser_startElement_f startElement;
+  iotstreamparser_endElement_f endElement;
+  iotstreamparser_characters_f characters;
+  void *ctx;
+
+} iotcodecjson_reader_t;
+
+/***************** Private Prototypes ****************/
+static void _iotcodecjson_startElement(iotcodec_writer_t *w, const char *name, const char **atts);
+
+static void _iotcodecjson_characters(iotcodec_writer_t *w, const char *text, int len);
+
+static void _iotcodecjson_endElement(iotcodec_writer_t *w, const char *name);
+
+static error_t _iotcodecjson_parse(const char *msg, int len,
+    iotstreamparser_startElement_f startElement,
+    iotstreamparser_endElement_f endElement,
+    iotstreamparser_characters_f characters,
+    void *ctx);
+
+static void _iotcodecjson_writeString(iotcodec_writer_t *w, const char *text, int len);
+
+static error_t _iotcodecjson_readElement(iotcodecjson_reader_t *r);
+
+static error_t _iotcodecjson_readScalar(iotcodecjson_reader_t *r, char *dest, int destSize);
+
+static error_t _iotcodecjson_readString(iotcodecjson_reader_t *r, char *dest, int destSize);
+
+static error_t _iotcodecjson_skipValue(iotcodecjson_reader_t *r, int depth);
+
+static bool _iotcodecjson_expect(iotcodecjson_reader_t *r, char c);
+
+static void _iotcodecjson_skipWhitespace(iotcodecjson_reader_t *r);
+
+const iotcodec_t iotcodecjson = {
+    "json",
+    "application/json",
+    _iotcodecjson_startElement,
+    _iotcodecjson_characters,
+    _iotcodecjson_endElement,
+    _iotcodecjson_parse,
+};
+
+/***************** Private Functions ****************/
+static void _iotcodecjson_startElement(iotcodec_writer_t *w, const char *name, const char **atts) {
+  unsigned char *parent;
+  int i;
+
+  if(w->depth > 0) {
+    parent = &w->flags[w->depth - 1];
+
+    if(*parent & IOTCODECJSON_ITEMS) {
+      iotcodec_write(w, ",", 1);
+
+    } else {
+      if(*parent & IOTCODECJSON_MEMBERS) {
+        iotcodec_write(w, ",", 1);
+      }
+
+      iotcodec_write(w, "\"" IOTCODEC_KEY_ITEMS "\":[", strlen(IOTCODEC_KEY_ITEMS) + 4);
+      *parent |= IOTCODECJSON_ITEMS | IOTCODECJSON_MEMBERS;
+    }
+  }
+
+  iotcodec_write(w, "{", 1);
+  _iotcodecjson_writeString(w, name, strlen(name));
+  iotcodec_write(w, ":{", 2);
+
+  for(i = 0; atts != NULL && atts[i] != NULL && atts[i + 1] != NULL; i += 2) {
+    if(i > 0) {
+      iotcodec_write(w, ",", 1);
+    }
+
+    _iotcodecjson_writeString(w, atts[i], strlen(atts[i]));
+    iotcodec_write(w, ":", 1);
+    _iotcodecjson_writeString(w, atts[i + 1], strlen(atts[i + 1]));
+    w->flags[w->depth] |= IOTCODECJSON_MEMBERS;
+  }
+}
+
+static void _iotcodecjson_characters(iotcodec_writer_t *w, const char *text, int len) {
+  unsigned char *flags = &w->flags[w->depth - 1];
+  int i;
+
+  if(*flags & (IOTCODECJSON_ITEMS | IOTCODECJSON_VALUE)) {
+    // Only one text node, and only in elements without children
+    return;
+  }
+
+  // Whitespace between elements isn't text
+  for(i = 0; i < len && (text[i] == ' ' || text[i] == '\t' || text[i] == '\r' || text[i] == '\n'); i++);
+  if(i == len) {
+    return;
+  }
+
+  if(*flags & IOTCODECJSON_MEMBERS) {
+    iotcodec_write(w, ",", 1);
+  }
+
+  iotcodec_write(w, "\"" IOTCODEC_KEY_VALUE "\":", strlen(IOTCODEC_KEY_VALUE) + 3);
+  _iotcodecjson_writeString(w, text, len);
+  *flags |= IOTCODECJSON_MEMBERS | IOTCODECJSON_VALUE;
+}
+
+static void _iotcodecjson_endElement(iotcodec_writer_t *w, const char *name) {
+  if(w->flags[w->depth - 1] & IOTCODECJSON_ITEMS) {
+    iotcodec_write(w, "]", 1);
+  }
+
+  iotcodec_write(w, "}}", 2);
+}
+
+/**
+ * Read a message of one or more top level elements
+ */
+static error_t _iotcodecjson_parse(const char *msg, int len,
+    iotstreamparser_startElement_f startElement,
+    iotstreamparser_endElement_f endElement,
+    iotstreamparser_characters_f characters,
+    void *ctx) {
+  iotcodecjson_reader_t r;
+
+  memset(&r, 0x0, sizeof(r));
+  r.p = msg;
+  r.end = msg + len;
+  r.startElement = startElement;
+  r.endElement = endElement;
+  r.characters = characters;
+  r.ctx = ctx;
+
+  _iotcodecjson_skipWhitespace(&r);
+
+  while(r.p < r.end && *r.p != '\0') {
+    if(_iotcodecjson_readElement(&r) != SUCCESS) {
+      SYSLOG_ERR("Malformed JSON near '%.*s'", (int) ((r.end - r.p) < 32 ? (r.end - r.p) : 32), r.p);
+      return FAIL;
+    }
+
+    _iotcodecjson_skipWhitespace(&r);
+    _iotcodecjson_expect(&r, ',');
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * Write a quoted JSON string
+ */
+static void _iotcodecjson_writeString(iotcodec_writer_t *w, const char *text, int len) {
+  char escaped[8];
+  int start = 0;
+  int i;
+
+  iotcodec_write(w, "\"", 1);
+
+  for(i = 0; i < len; i++) {
+    unsigned char c = (unsigned char) text[i];
+
+    if(c == '"' || c == '\\' || c < 0x20) {
+      iotcodec_write(w, text + start, i - start);
+
+      if(c == '"' || c == '\\') {
+        snprintf(escaped, sizeof(escaped), "\\%c", c);
+      } else if(c == '\n') {
+        snprintf(escaped, sizeof(escaped), "\\n");
+      } else if(c == '\r') {
+        snprintf(escaped, sizeof(escaped), "\\r");
+      } else if(c == '\t') {
+        snprintf(escaped, sizeof(escaped), "\\t");
+      } else {
+        snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      }
+
+      iotcodec_write(w, escaped, strlen(escaped));
+      start = i + 1;
+    }
+  }
+
+  iotcodec_write(w, text + start, len - start);
+  iotcodec_write(w, "\"", 1);
+}
+
+/**
+ * Read one element and everything inside it. The attributes and text are
+ * gathered first, so they can go out with the start element even if the
+ * "items" come before them in the object.
+ */
+static error_t _iotcodecjson_readElement(iotcodecjson_reader_t *r) {
+  char name[IOTSTREAMPARSER_NAME_SIZE];
+  char key[IOTSTREAMPARSER_NAME_SIZE];
+  char attrNames[IOTSTREAMPARSER_MAX_ATTRIBUTES][IOTSTREAMPARSER_NAME_SIZE];
+  char attrValues[IOTSTREAMPARSER_MAX_ATTRIBUTES][IOTSTREAMPARSER_ATTRIBUTE_VALUE_SIZE];
+  const char *atts[IOTSTREAMPARSER_MAX_ATTRIBUTES * 2 + 1];
+  char value[IOTCODEC_VALUE_SIZE];
+  const char *items = NULL;
+  const char *resume;
+  bool hasValue = false;
+  int totalAttrs = 0;
+  int i;
+
+  if(++r->depth > IOTCODEC_MAX_DEPTH) {
+    return FAIL;
+  }
+
+  if(!_iotcodecjson_expect(r, '{')
+      || _iotcodecjson_readString(r, name, sizeof(name)) != SUCCESS
+      || !_iotcodecjson_expect(r, ':')
+      || !_iotcodecjson_expect(r, '{')) {
+    return FAIL;
+  }
+
+  _iotcodecjson_skipWhitespace(r);
+
+  while(r->p < r->end && *r->p != '}') {
+    if(_iotcodecjson_readString(r, key, sizeof(key)) != SUCCESS || !_iotcodecjson_expect(r, ':')) {
+      return FAIL;
+    }
+
+    _iotcodecjson_skipWhitespace(r);
+
+    if(strcmp(key, IOTCODEC_KEY_ITEMS) == 0) {
+      items = r->p;
+      if(_iotcodecjson_skipValue(r, 0) != SUCCESS) {
+        return FAIL;
+      }
+
+    } else if(strcmp(key, IOTCODEC_KEY_VALUE) == 0) {
+      if(_iotcodecjson_readScalar(r, value, sizeof(value)) != SUCCESS) {
+        return FAIL;
+      }
+
+      hasValue = true;
+
+    } else if(totalAttrs < IOTSTREAMPARSER_MAX_ATTRIBUTES) {
+      strncpy(attrNames[totalAttrs], key, IOTSTREAMPARSER_NAME_SIZE);
+      if(_iotcodecjson_readScalar(r, attrValues[totalAttrs], IOTSTREAMPARSER_ATTRIBUTE_VALUE_SIZE) != SUCCESS) {
+        return FAIL;
+      }
+
+      atts[totalAttrs * 2] = attrNames[totalAttrs];
+      atts[totalAttrs * 2 + 1] = attrValues[totalAttrs];
+      totalAttrs++;
+
+    } else {
+      SYSLOG_WARNING("Too many attributes on <%s>, ignoring %s", name, key);
+      if(_iotcodecjson_skipValue(r, 0) != SUCCESS) {
+        return FAIL;
+      }
+    }
+
+    _iotcodecjson_skipWhitespace(r);
+    if(!_iotcodecjson_expect(r, ',')) {
+      break;
+    }
+
+    _iotcodecjson_skipWhitespace(r);
+  }
+
+  if(!_iotcodecjson_expect(r, '}') || !_iotcodecjson_expect(r, '}')) {
+    return FAIL;
+  }
+
+  atts[totalAttrs * 2] = NULL;
+
+  if(r->startElement != NULL) {
+    r->startElement(r->ctx, name, atts);
+  }
+
+  if(hasValue && r->characters != NULL) {
+    r->characters(r->ctx, value, strlen(value));
+  }
+
+  if(items != NULL) {
+    resume = r->p;
+    r->p = items;
+
+    if(!_iotcodecjson_expect(r, '[')) {
+      return FAIL;
+    }
+
+    _iotcodecjson_skipWhitespace(r);
+
+    for(i = 0; r->p < r->end && *r->p != ']'; i++) {
+      if((i > 0 && !_iotcodecjson_expect(r, ',')) || _iotcodecjson_readElement(r) != SUCCESS) {
+        return FAIL;
+      }
+
+      _iotcodecjson_skipWhitespace(r);
+    }
+
+    r->p = resume;
+  }
+
+  if(r->endElement != NULL) {
+    r->endElement(r->ctx, name);
+  }
+
+  r->depth--;
+  return SUCCESS;
+}
+
+/**
+ * Read a string, number, true, false or null as text
+ * @param dest Where to put the text, NULL to skip over it
+ * @return FAIL if the value is malformed or doesn't fit
+ */
+static error_t _iotcodecjson_readScalar(iotcodecjson_reader_t *r, char *dest, int destSize) {
+  int len = 0;
+
+  _iotcodecjson_skipWhitespace(r);
+
+  if(r->p < r->end && *r->p == '"') {
+    return _iotcodecjson_readString(r, dest, destSize);
+  }
+
+  while(r->p + len < r->end && strchr("+-.0123456789eEtruefalsn", r->p[len]) != NULL) {
+    len++;
+  }
+
+  if(len == 0) {
+    return FAIL;
+  }
+
+  if(dest != NULL) {
+    if(len >= destSize) {
+      SYSLOG_WARNING("Value longer than %d bytes", destSize - 1);
+      return FAIL;
+    }
+
+    if(len == 4 && strncmp(r->p, "null", 4) == 0) {
+      dest[0] = '\0';
+    } else {
+      memcpy(dest, r->p, len);
+      dest[len] = '\0';
+    }
+  }
+
+  r->p += len;
+  return SUCCESS;
+}
+
+/**
+ * Read a quoted string, decoding the escapes
+ * @param dest Where to put the string, NULL to skip over it
+ * @return FAIL if the string is malformed or doesn't fit
+ */
+static error_t _iotcodecjson_readString(iotcodecjson_reader_t *r, char *dest, int destSize) {
+  unsigned int code;
+  char utf8[3];
+  int size;
+  int len = 0;
+  char c;
+
+  _iotcodecjson_skipWhitespace(r);
+
+  if(!_iotcodecjson_expect(r, '"')) {
+    return FAIL;
+  }
+
+  while(true) {
+    if(r->p >= r->end) {
+      // Never closed
+      return FAIL;
+    }
+
+    if((c = *r->p++) == '"') {
+      break;
+    }
+
+    utf8[0] = c;
+    size = 1;
+
+    if(c == '\\') {
+      if(r->p >= r->end) {
+        return FAIL;
+      }
+
+      c = *r->p++;
+      switch(c) {
+      case 'n':
+        utf8[0] = '\n';
+        break;
+
+      case 'r':
+        utf8[0] = '\r';
+        break;
+
+      case 't':
+        utf8[0] = '\t';
+        break;
+
+      case 'b':
+        utf8[0] = '\b';
+        break;
+
+      case 'f':
+        utf8[0] = '\f';
+        break;
+
+      case 'u':
+        if(r->end - r->p < 4 || sscanf(r->p, "%4x", &code) != 1) {
+          return FAIL;
+        }
+
+        r->p += 4;
+
+        // Write the code point as UTF-8, surrogates aren't paired up
+        if(code >= 0x800) {
+          utf8[0] = 0xE0 | (code >> 12);
+          utf8[1] = 0x80 | ((code >> 6) & 0x3F);
+          utf8[2] = 0x80 | (code & 0x3F);
+          size = 3;
+
+        } else if(code >= 0x80) {
+          utf8[0] = 0xC0 | (code >> 6);
+          utf8[1] = 0x80 | (code & 0x3F);
+          size = 2;
+
+        } else {
+          utf8[0] = (char) code;
+        }
+        break;
+
+      default:
+        // \" \\ \/
+        utf8[0] = c;
+        break;
+      }
+    }
+
+    if(dest != NULL) {
+      if(len + size >= destSize) {
+        SYSLOG_WARNING("String longer than %d bytes", destSize - 1);
+        return FAIL;
+      }
+
+      memcpy(dest + len, utf8, size);
+      len += size;
+    }
+  }
+
+  if(dest != NULL) {
+    dest[len] = '\0';
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * Skip over any value
+ */
+static error_t _iotcodecjson_skipValue(iotcodecjson_reader_t *r, int depth) {
+  char close;
+
+  _iotcodecjson_skipWhitespace(r);
+
+  if(r->p >= r->end) {
+    return FAIL;
+  }
+
+  if(*r->p == '"') {
+    return _iotcodecjson_readString(r, NULL, 0);
+  }
+
+  if(*r->p != '{' && *r->p != '[') {
+    return _iotcodecjson_readScalar(r, NULL, 0);
+  }
+
+  if(depth >= IOTCODEC_MAX_DEPTH * 2) {
+    return FAIL;
+  }
+
+  close = (*r->p == '{') ? '}' : ']';
+  r->p++;
+  _iotcodecjson_skipWhitespace(r);
+
+  while(r->p < r->end && *r->p != close) {
+    if(close == '}') {
+      if(_iotcodecjson_readString(r, NULL, 0) != SUCCESS || !_iotcodecjson_expect(r, ':')) {
+        return FAIL;
+      }
+    }
+
+    if(_iotcodecjson_skipValue(r, depth + 1) != SUCCESS) {
+      return FAIL;
+    }
+
+    _iotcodecjson_skipWhitespace(r);
+    if(!_iotcodecjson_expect(r, ',')) {
+      break;
+    }
+
+    _iotcodecjson_skipWhitespace(r);
+  }
+
+  return _iotcodecjson_expect(r, close) ? SUCCESS : FAIL;
+}
+
+/**
+ * Consume the next non-whitespace character if it is the one expected
+ */
+static bool _iotcodecjson_expect(iotcodecjson_reader_t *r, char c) {
+  _iotcodecjson_skipWhitespace(r);
+
+  if(r->p < r->end && *r->p == c) {
+    r->p++;
+    return true;
+  }
+
+  return false;
+}
+
+static void _iotcodecjson_skipWhitespace(iotcodecjson_reader_t *r) {
+  while(r->p < r->end && (*r->p == ' ' || *r->p == '\t' || *r->p == '\r' || *r->p == '\n')) {
+    r->p++;
+  }
+}
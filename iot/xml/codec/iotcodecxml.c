@@ -0,0 +1,165 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * XML codec, the format of the Device API
+ */
+
+#include <string.h>
+
+#include "iotcodec.h"
+#include "iotstreamparser.h"
+#include "ioterror.h"
+#include "iotdebug.h"
+
+/** The start tag is still open, waiting for '>' or "/>" */
+#define IOTCODECXML_TAG_OPEN 0x01
+
+/***************** Private Prototypes ****************/
+static void _iotcodecxml_startElement(iotcodec_writer_t *w, const char *name, const char **atts);
+
+static void _iotcodecxml_characters(iotcodec_writer_t *w, const char *text, int len);
+
+static void _iotcodecxml_endElement(iotcodec_writer_t *w, const char *name);
+
+static error_t _iotcodecxml_parse(const char *msg, int len,
+    iotstreamparser_startElement_f startElement,
+    iotstreamparser_endElement_f endElement,
+    iotstreamparser_characters_f characters,
+    void *ctx);
+
+static void _iotcodecxml_closeStartTag(iotcodec_writer_t *w, int element);
+
+static void _iotcodecxml_writeEscaped(iotcodec_writer_t *w, const char *text, int len);
+
+const iotcodec_t iotcodecxml = {
+    "xml",
+    "text/xml",
+    _iotcodecxml_startElement,
+    _iotcodecxml_characters,
+    _iotcodecxml_endElement,
+    _iotcodecxml_parse,
+};
+
+/***************** Private Functions ****************/
+static void _iotcodecxml_startElement(iotcodec_writer_t *w, const char *name, const char **atts) {
+  int i;
+
+  if(w->depth > 0) {
+    _iotcodecxml_closeStartTag(w, w->depth - 1);
+  }
+
+  iotcodec_write(w, "<", 1);
+  iotcodec_write(w, name, strlen(name));
+
+  for(i = 0; atts != NULL && atts[i] != NULL && atts[i + 1] != NULL; i += 2) {
+    iotcodec_write(w, " ", 1);
+    iotcodec_write(w, atts[i], strlen(atts[i]));
+    iotcodec_write(w, "=\"", 2);
+    _iotcodecxml_writeEscaped(w, atts[i + 1], strlen(atts[i + 1]));
+    iotcodec_write(w, "\"", 1);
+  }
+
+  w->flags[w->depth] |= IOTCODECXML_TAG_OPEN;
+}
+
+static void _iotcodecxml_characters(iotcodec_writer_t *w, const char *text, int len) {
+  _iotcodecxml_closeStartTag(w, w->depth - 1);
+  _iotcodecxml_writeEscaped(w, text, len);
+}
+
+static void _iotcodecxml_endElement(iotcodec_writer_t *w, const char *name) {
+  if(w->flags[w->depth - 1] & IOTCODECXML_TAG_OPEN) {
+    iotcodec_write(w, " />", 3);
+
+  } else {
+    iotcodec_write(w, "</", 2);
+    iotcodec_write(w, name, strlen(name));
+    iotcodec_write(w, ">", 1);
+  }
+}
+
+/**
+ * Read XML with the streaming parser
+ */
+static error_t _iotcodecxml_parse(const char *msg, int len,
+    iotstreamparser_startElement_f startElement,
+    iotstreamparser_endElement_f endElement,
+    iotstreamparser_characters_f characters,
+    void *ctx) {
+  iotstreamparser_t parser;
+
+  iotstreamparser_init(&parser, startElement, endElement, characters, ctx);
+
+  if(iotstreamparser_parseChunk(&parser, msg, len) != SUCCESS) {
+    return FAIL;
+  }
+
+  return iotstreamparser_finish(&parser);
+}
+
+/**
+ * Finish the start tag of an element before writing what's inside it
+ */
+static void _iotcodecxml_closeStartTag(iotcodec_writer_t *w, int element) {
+  if(w->flags[element] & IOTCODECXML_TAG_OPEN) {
+    iotcodec_write(w, ">", 1);
+    w->flags[element] &= ~IOTCODECXML_TAG_OPEN;
+  }
+}
+
+/**
+ * Write text or an attribute value with the XML special characters escaped
+ */
+static void _iotcodecxml_writeEscaped(iotcodec_writer_t *w, const char *text, int len) {
+  int start = 0;
+  int i;
+
+  for(i = 0; i < len; i++) {
+    const char *entity = NULL;
+
+    switch(text[i]) {
+    case '&':
+      entity = "&amp;";
+      break;
+
+    case '<':
+      entity = "&lt;";
+      break;
+
+    case '>':
+      entity = "&gt;";
+      break;
+
+    case '"':
+      entity = "&quot;";
+      break;
+
+    default:
+      break;
+    }
+
+    if(entity != NULL) {
+      iotcodec_write(w, text + start, i - start);
+      iotcodec_write(w, entity, strlen(entity));
+      start = i + 1;
+    }
+  }
+
+  iotcodec_write(w, text + start, len - start);
+}
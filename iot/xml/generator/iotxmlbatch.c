@@ -0,0 +1,133 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * Batch encoder for agents reporting on many devices.
+ *
+ * Each device's measurements are still built as their own message with
+ * iotxml_newMsg(..) and iotxml_addString(..), but instead of sending it with
+ * iotxml_send(..), the agent hands the block to iotxmlbatch_add(..). Blocks
+ * are packed into one frame until the next block would break the byte
+ * budget. Then the frame goes out with one application_send(..) and the block
+ * starts the next frame, so nothing ever gets truncated at a frame boundary.
+ * The agent flushes whatever is left once it has added all of its blocks.
+ *
+ * The frame is as large as a message to the proxy, so keep the batch off
+ * the stack.
+ *
+ * The last-value cache counts a measurement as sent as soon as it is added to
+ * a block, so whenever a block is dropped or a frame can't be sent, the cache
+ * is cleared and every value goes out again with the next measurements.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ioterror.h"
+#include "iotdebug.h"
+#include "iotapi.h"
+#include "iotxmlbatch.h"
+#include "iotxmlcache.h"
+
+/***************** Public Functions ****************/
+/**
+ * Start with an empty frame
+ * @param batch Batch to initialize
+ * @param maxBytes Byte budget of one frame, limited to IOTXMLBATCH_FRAME_SIZE
+ */
+void iotxmlbatch_init(iotxmlbatch_t *batch, int maxBytes) {
+  batch->frameLen = 0;
+  batch->totalBlocks = 0;
+  batch->frame[0] = '\0';
+
+  if(maxBytes <= 0 || maxBytes > IOTXMLBATCH_FRAME_SIZE) {
+    maxBytes = IOTXMLBATCH_FRAME_SIZE;
+  }
+
+  batch->maxBytes = maxBytes;
+}
+
+/**
+ * Close off a device block started with iotxml_newMsg(..) and add it to the
+ * frame, in place of iotxml_send(..)
+ *
+ * @param batch Batch to add the block to
+ * @param block Block built with iotxml_newMsg(..) and iotxml_addString(..)
+ * @param maxSize Size of the block buffer
+ * @return SUCCESS if the block is in the frame or has been sent, FAIL if the
+ *     block overflowed its buffer or the frame couldn't be sent
+ */
+error_t iotxmlbatch_add(iotxmlbatch_t *batch, char *block, int maxSize) {
+  error_t result = SUCCESS;
+  int len = iotxml_closeMsg(block, maxSize);
+
+  if(len >= maxSize - 1) {
+    SYSLOG_ERR("[batch] Dropping a device block that overflowed its buffer");
+    iotxmlcache_clear();
+    return FAIL;
+  }
+
+  if(len == 0) {
+    return SUCCESS;
+  }
+
+  // Spill the frame we have if this block doesn't fit
+  if(batch->frameLen + len > batch->maxBytes) {
+    result = iotxmlbatch_flush(batch);
+  }
+
+  if(len > batch->maxBytes) {
+    // A single block larger than the budget still goes out whole, on its own
+    SYSLOG_DEBUG("Send: %s", block);
+    if(application_send(block, len) != SUCCESS) {
+      iotxmlcache_clear();
+      result = FAIL;
+    }
+    return result;
+  }
+
+  memcpy(batch->frame + batch->frameLen, block, len);
+  batch->frameLen += len;
+  batch->frame[batch->frameLen] = '\0';
+  batch->totalBlocks++;
+  return result;
+}
+
+/**
+ * Send whatever is in the frame now and start a new one
+ * @param batch Batch to flush
+ * @return SUCCESS if the frame is empty or was sent
+ */
+error_t iotxmlbatch_flush(iotxmlbatch_t *batch) {
+  error_t result;
+
+  if(batch->totalBlocks == 0) {
+    return SUCCESS;
+  }
+
+  SYSLOG_DEBUG("Send %d device blocks: %s", batch->totalBlocks, batch->frame);
+  if((result = application_send(batch->frame, batch->frameLen)) != SUCCESS) {
+    iotxmlcache_clear();
+  }
+
+  batch->frameLen = 0;
+  batch->totalBlocks = 0;
+  batch->frame[0] = '\0';
+  return result;
+}
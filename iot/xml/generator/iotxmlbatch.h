@@ -0,0 +1,61 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef IOTXMLBATCH_H
+#define IOTXMLBATCH_H
+
+#include <stdbool.h>
+
+#include "ioterror.h"
+
+/**
+ * Largest frame the batch encoder will build. The proxy server reads one
+ * frame at a time into a PROXY_MAX_MSG_LEN buffer, so stay below that.
+ */
+#ifndef IOTXMLBATCH_FRAME_SIZE
+#define IOTXMLBATCH_FRAME_SIZE 8191
+#endif
+
+/**
+ * Device blocks packed into one frame, sent together with a single
+ * application_send(..) instead of one frame per device
+ */
+typedef struct iotxmlbatch_t {
+
+  /** Frame under construction */
+  char frame[IOTXMLBATCH_FRAME_SIZE + 1];
+
+  /** Length of the frame so far */
+  int frameLen;
+
+  /** Number of device blocks in the frame */
+  int totalBlocks;
+
+  /** Byte budget of one frame, at most IOTXMLBATCH_FRAME_SIZE */
+  int maxBytes;
+
+} iotxmlbatch_t;
+
+/***************** Public Prototypes ****************/
+void iotxmlbatch_init(iotxmlbatch_t *batch, int maxBytes);
+
+error_t iotxmlbatch_add(iotxmlbatch_t *batch, char *block, int maxSize);
+
+error_t iotxmlbatch_flush(iotxmlbatch_t *batch);
+
+#endif
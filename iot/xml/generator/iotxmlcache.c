@@ -0,0 +1,435 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * Last-value cache for measurements.
+ *
+ * The generator asks the cache before it adds each measurement to a message.
+ * The cache remembers the last value sent for each (deviceId, param, index)
+ * and suppresses values according to the policy for the parameter name:
+ *
+ *   > onChange: only send a value that differs from the last one sent
+ *   > deadband: numeric values within the deadband of the last one sent
+ *     don't count as a change
+ *   > minInterval_sec: never send a value more often than this
+ *
+ * Regardless of the policy, every value is sent again once the keyframe
+ * period has passed since it was last sent, so the server can recover the
+ * full state of every device. Parameters without a policy of their own
+ * follow the default policy, which sends every value unless the application
+ * changes it with iotxmlcache_setPolicy(NULL, ...).
+ *
+ * Only a hash of each value is kept, plus the number for numeric values, so
+ * large values like schedules don't cost any more memory than small ones.
+ *
+ * A value counts as sent once it is added to a message, so the generator
+ * clears the cache whenever a message doesn't make it out to the proxy.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "ioterror.h"
+#include "iotdebug.h"
+#include "iotxmlgen.h"
+#include "iotxmlcache.h"
+
+/**
+ * Policy for one parameter name
+ */
+typedef struct iotxmlcache_policy_t {
+
+  /** True if this policy is in use */
+  bool inUse;
+
+  /** Parameter name the policy applies to */
+  char paramName[IOTXMLCACHE_NAME_SIZE];
+
+  /** Only send values that changed */
+  bool onChange;
+
+  /** Numeric changes up to this size don't count */
+  double deadband;
+
+  /** Minimum number of seconds between two values */
+  int minInterval_sec;
+
+} iotxmlcache_policy_t;
+
+/**
+ * State of a slot in the cache
+ */
+typedef enum {
+  IOTXMLCACHE_SLOT_EMPTY = 0,
+  IOTXMLCACHE_SLOT_USED,
+  IOTXMLCACHE_SLOT_DELETED,
+} iotxmlcache_slot_e;
+
+/**
+ * The last value sent for one (deviceId, param, index)
+ */
+typedef struct iotxmlcache_entry_t {
+
+  /** State of this slot */
+  iotxmlcache_slot_e state;
+
+  char deviceId[IOTGEN_DEVICE_ID_SIZE];
+
+  char paramName[IOTXMLCACHE_NAME_SIZE];
+
+  char asciiParamIndex;
+
+  /** Hash of the last value sent */
+  unsigned long long valueHash;
+
+  /** True if the last value sent was a number */
+  bool isNumeric;
+
+  /** The last value sent, if it was a number */
+  double number;
+
+  /** When we last sent a value */
+  time_t lastSent;
+
+} iotxmlcache_entry_t;
+
+/** Parameter policies */
+static iotxmlcache_policy_t policies[IOTXMLCACHE_MAX_POLICIES];
+
+/** Policy for parameters without one of their own: send everything */
+static iotxmlcache_policy_t defaultPolicy;
+
+/** Seconds after which every value is sent again, 0 to never force it */
+static int keyframePeriod_sec = IOTXMLCACHE_DEFAULT_KEYFRAME_PERIOD_SEC;
+
+/** Open-addressed hash table of entries */
+static iotxmlcache_entry_t *entries;
+
+/** Number of slots in the table, a power of 2 */
+static int totalSlots;
+
+/** Number of slots that aren't empty, including deleted ones */
+static int usedSlots;
+
+/** Protects the cache, which may be consulted from several threads */
+static pthread_mutex_t cacheMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/***************** Private Prototypes ****************/
+static iotxmlcache_policy_t *_iotxmlcache_getPolicy(const char *paramName);
+static unsigned long long _iotxmlcache_hash(const char *str, unsigned long long hash);
+static unsigned long long _iotxmlcache_keyHash(const char *deviceId, const char *paramName, char asciiParamIndex);
+static iotxmlcache_entry_t *_iotxmlcache_find(const char *deviceId, const char *paramName, char asciiParamIndex, bool *created);
+static error_t _iotxmlcache_resize(int newTotalSlots);
+
+/***************** Public Functions ****************/
+/**
+ * Set the reporting policy for a parameter name
+ *
+ * @param paramName Parameter name, or NULL to set the default policy for
+ *     parameters without a policy of their own
+ * @param onChange true to only send values that changed
+ * @param deadband Numeric changes up to this size don't count as a change
+ * @param minInterval_sec Minimum number of seconds between two values, 0 for
+ *     no limit
+ * @return SUCCESS if the policy was set, FAIL if we're out of policies
+ */
+error_t iotxmlcache_setPolicy(const char *paramName, bool onChange, double deadband, int minInterval_sec) {
+  iotxmlcache_policy_t *policy = NULL;
+  int i;
+
+  pthread_mutex_lock(&cacheMutex);
+  if(paramName == NULL) {
+    policy = &defaultPolicy;
+
+  } else if((policy = _iotxmlcache_getPolicy(paramName)) == &defaultPolicy) {
+    policy = NULL;
+    for(i = 0; i < IOTXMLCACHE_MAX_POLICIES; i++) {
+      if(!policies[i].inUse) {
+        policy = &policies[i];
+        policy->inUse = true;
+        strncpy(policy->paramName, paramName, sizeof(policy->paramName) - 1);
+        break;
+      }
+    }
+  }
+
+  if(policy == NULL) {
+    pthread_mutex_unlock(&cacheMutex);
+    SYSLOG_ERR("[cache] Out of policies for %s", paramName);
+    return FAIL;
+  }
+
+  policy->onChange = onChange;
+  policy->deadband = deadband;
+  policy->minInterval_sec = minInterval_sec;
+  pthread_mutex_unlock(&cacheMutex);
+  return SUCCESS;
+}
+
+/**
+ * @param seconds Seconds after which every value is sent again, even if it
+ *     didn't change. 0 to never force a value.
+ */
+void iotxmlcache_setKeyframePeriod(int seconds) {
+  pthread_mutex_lock(&cacheMutex);
+  keyframePeriod_sec = seconds;
+  pthread_mutex_unlock(&cacheMutex);
+}
+
+/**
+ * Decide whether a measurement should go into the message, and remember it
+ * as the last value sent if so
+ *
+ * @param deviceId Device ID string
+ * @param paramName Parameter name
+ * @param asciiParamIndex Index of the parameter, or 0
+ * @param paramValue Value of the parameter
+ * @return true if the value should be sent
+ */
+bool iotxmlcache_shouldSend(const char *deviceId, const char *paramName, char asciiParamIndex, const char *paramValue) {
+  iotxmlcache_policy_t *policy;
+  iotxmlcache_entry_t *entry;
+  unsigned long long valueHash;
+  bool created = false;
+  bool isNumeric;
+  double number;
+  char *end;
+  time_t now;
+  bool send;
+
+  pthread_mutex_lock(&cacheMutex);
+  policy = _iotxmlcache_getPolicy(paramName);
+
+  if(!policy->onChange && policy->minInterval_sec <= 0) {
+    pthread_mutex_unlock(&cacheMutex);
+    return true;
+  }
+
+  if((entry = _iotxmlcache_find(deviceId, paramName, asciiParamIndex, &created)) == NULL) {
+    // The cache is full, so we can't suppress anything for this value
+    pthread_mutex_unlock(&cacheMutex);
+    return true;
+  }
+
+  now = time(NULL);
+  valueHash = _iotxmlcache_hash(paramValue, 14695981039346656037ULL);
+  number = strtod(paramValue, &end);
+  isNumeric = (end != paramValue && *end == '\0');
+
+  if(created) {
+    send = true;
+
+  } else if(now - entry->lastSent < policy->minInterval_sec) {
+    send = false;
+
+  } else if(keyframePeriod_sec > 0 && now - entry->lastSent >= keyframePeriod_sec) {
+    send = true;
+
+  } else if(!policy->onChange) {
+    send = true;
+
+  } else if(isNumeric && entry->isNumeric && policy->deadband > 0) {
+    send = fabs(number - entry->number) > policy->deadband;
+
+  } else {
+    send = (valueHash != entry->valueHash);
+  }
+
+  if(send) {
+    entry->valueHash = valueHash;
+    entry->isNumeric = isNumeric;
+    entry->number = number;
+    entry->lastSent = now;
+  }
+
+  pthread_mutex_unlock(&cacheMutex);
+  return send;
+}
+
+/**
+ * Forget every value of a device, so its next values are all sent. Call this
+ * when the device is added or goes away.
+ *
+ * @param deviceId Device ID string
+ */
+void iotxmlcache_forget(const char *deviceId) {
+  int i;
+
+  pthread_mutex_lock(&cacheMutex);
+  for(i = 0; i < totalSlots; i++) {
+    if(entries[i].state == IOTXMLCACHE_SLOT_USED && strcmp(entries[i].deviceId, deviceId) == 0) {
+      entries[i].state = IOTXMLCACHE_SLOT_DELETED;
+    }
+  }
+  pthread_mutex_unlock(&cacheMutex);
+}
+
+/**
+ * Forget everything, so the next values of every device are sent. Call this
+ * when the server may have lost track of our state, i.e. when a message
+ * couldn't be sent or after reconnecting.
+ */
+void iotxmlcache_clear() {
+  pthread_mutex_lock(&cacheMutex);
+  free(entries);
+  entries = NULL;
+  totalSlots = 0;
+  usedSlots = 0;
+  pthread_mutex_unlock(&cacheMutex);
+}
+
+/***************** Private Functions ****************/
+/**
+ * @return the policy for the parameter name, or the default policy
+ */
+static iotxmlcache_policy_t *_iotxmlcache_getPolicy(const char *paramName) {
+  int i;
+
+  for(i = 0; i < IOTXMLCACHE_MAX_POLICIES; i++) {
+    if(policies[i].inUse && strcmp(policies[i].paramName, paramName) == 0) {
+      return &policies[i];
+    }
+  }
+
+  return &defaultPolicy;
+}
+
+/**
+ * FNV-1a hash of a string, continuing from the given hash
+ */
+static unsigned long long _iotxmlcache_hash(const char *str, unsigned long long hash) {
+  while(*str != '\0') {
+    hash ^= (unsigned char) *str++;
+    hash *= 1099511628211ULL;
+  }
+
+  return hash;
+}
+
+static unsigned long long _iotxmlcache_keyHash(const char *deviceId, const char *paramName, char asciiParamIndex) {
+  unsigned long long hash = _iotxmlcache_hash(deviceId, 14695981039346656037ULL);
+
+  hash = _iotxmlcache_hash(paramName, hash ^ '/');
+  hash ^= (unsigned char) asciiParamIndex;
+  return hash * 1099511628211ULL;
+}
+
+/**
+ * Find the entry for a value, creating it if it doesn't exist
+ * @param created Set to true if the entry was just created
+ * @return the entry, NULL if the cache is full or the key doesn't fit
+ */
+static iotxmlcache_entry_t *_iotxmlcache_find(const char *deviceId, const char *paramName, char asciiParamIndex, bool *created) {
+  iotxmlcache_entry_t *reusable = NULL;
+  iotxmlcache_entry_t *entry = NULL;
+  int slot;
+  int i;
+
+  if(strlen(deviceId) >= IOTGEN_DEVICE_ID_SIZE || strlen(paramName) >= IOTXMLCACHE_NAME_SIZE) {
+    return NULL;
+  }
+
+  // Keep the table at most 3/4 full, counting deleted slots
+  if((usedSlots + 1) * 4 > totalSlots * 3) {
+    if(totalSlots == 0) {
+      _iotxmlcache_resize(IOTXMLCACHE_INITIAL_ENTRIES);
+    } else if(totalSlots * 2 <= IOTXMLCACHE_MAX_ENTRIES) {
+      _iotxmlcache_resize(totalSlots * 2);
+    } else {
+      // Full size already, so at least clear out the deleted slots
+      _iotxmlcache_resize(totalSlots);
+    }
+  }
+
+  if(totalSlots == 0) {
+    return NULL;
+  }
+
+  slot = _iotxmlcache_keyHash(deviceId, paramName, asciiParamIndex) & (totalSlots - 1);
+  for(i = 0; i < totalSlots; i++) {
+    entry = &entries[(slot + i) & (totalSlots - 1)];
+
+    if(entry->state == IOTXMLCACHE_SLOT_EMPTY) {
+      break;
+
+    } else if(entry->state == IOTXMLCACHE_SLOT_DELETED) {
+      if(reusable == NULL) {
+        reusable = entry;
+      }
+
+    } else if(entry->asciiParamIndex == asciiParamIndex
+        && strcmp(entry->deviceId, deviceId) == 0
+        && strcmp(entry->paramName, paramName) == 0) {
+      *created = false;
+      return entry;
+    }
+  }
+
+  if(reusable == NULL) {
+    // No empty or deleted slot left to take
+    if(entry == NULL || i == totalSlots || (usedSlots + 1) * 4 > totalSlots * 3) {
+      return NULL;
+    }
+    reusable = entry;
+    usedSlots++;
+  }
+
+  bzero(reusable, sizeof(iotxmlcache_entry_t));
+  reusable->state = IOTXMLCACHE_SLOT_USED;
+  strcpy(reusable->deviceId, deviceId);
+  strcpy(reusable->paramName, paramName);
+  reusable->asciiParamIndex = asciiParamIndex;
+  *created = true;
+  return reusable;
+}
+
+/**
+ * Move every entry into a new table, leaving the deleted slots behind
+ */
+static error_t _iotxmlcache_resize(int newTotalSlots) {
+  iotxmlcache_entry_t *newEntries;
+  iotxmlcache_entry_t *entry;
+  int slot;
+  int i;
+
+  if((newEntries = calloc(newTotalSlots, sizeof(iotxmlcache_entry_t))) == NULL) {
+    SYSLOG_ERR("[cache] Out of memory");
+    return FAIL;
+  }
+
+  usedSlots = 0;
+  for(i = 0; i < totalSlots; i++) {
+    if(entries[i].state == IOTXMLCACHE_SLOT_USED) {
+      slot = _iotxmlcache_keyHash(entries[i].deviceId, entries[i].paramName, entries[i].asciiParamIndex) & (newTotalSlots - 1);
+      for(entry = &newEntries[slot]; entry->state != IOTXMLCACHE_SLOT_EMPTY; entry = &newEntries[slot]) {
+        slot = (slot + 1) & (newTotalSlots - 1);
+      }
+      memcpy(entry, &entries[i], sizeof(iotxmlcache_entry_t));
+      usedSlots++;
+    }
+  }
+
+  free(entries);
+  entries = newEntries;
+  totalSlots = newTotalSlots;
+  return SUCCESS;
+}
@@ -0,0 +1,65 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef IOTXMLCACHE_H
+#define IOTXMLCACHE_H
+
+#include <stdbool.h>
+
+#include "ioterror.h"
+
+/** Maximum number of parameter policies */
+#ifndef IOTXMLCACHE_MAX_POLICIES
+#define IOTXMLCACHE_MAX_POLICIES 16
+#endif
+
+/**
+ * Maximum number of (deviceId, param, index) values the cache remembers,
+ * a power of 2
+ */
+#ifndef IOTXMLCACHE_MAX_ENTRIES
+#define IOTXMLCACHE_MAX_ENTRIES 8192
+#endif
+
+/** Initial number of slots in the cache, a power of 2 that doubles as it fills */
+#ifndef IOTXMLCACHE_INITIAL_ENTRIES
+#define IOTXMLCACHE_INITIAL_ENTRIES 256
+#endif
+
+/** Longest parameter name we'll cache */
+#ifndef IOTXMLCACHE_NAME_SIZE
+#define IOTXMLCACHE_NAME_SIZE 32
+#endif
+
+/** Default number of seconds after which every value is sent again */
+#ifndef IOTXMLCACHE_DEFAULT_KEYFRAME_PERIOD_SEC
+#define IOTXMLCACHE_DEFAULT_KEYFRAME_PERIOD_SEC 900
+#endif
+
+/***************** Public Prototypes ****************/
+error_t iotxmlcache_setPolicy(const char *paramName, bool onChange, double deadband, int minInterval_sec);
+
+void iotxmlcache_setKeyframePeriod(int seconds);
+
+bool iotxmlcache_shouldSend(const char *deviceId, const char *paramName, char asciiParamIndex, const char *paramValue);
+
+void iotxmlcache_forget(const char *deviceId);
+
+void iotxmlcache_clear();
+
+#endif
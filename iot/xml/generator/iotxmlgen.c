@@ -28,7 +28,9 @@
 #include "iotdebug.h"
 #include "iotapi.h"
 #include "iotxmlgen.h"
+#include "iotxmlcache.h"
 #include "timestamp.h"
+#include "iottrace.h"
 
 
 /** Copy of the last Device ID we generated XML for */
@@ -37,6 +39,9 @@ static char lastDeviceId[IOTGEN_DEVICE_ID_SIZE];
 /** Copy of the last param type we generated XML for */
 static int lastParamType = -1;
 
+/** Explicit timestamp of the last param block, 0 if it was stamped now */
+static time_t lastTimestamp = 0;
+
 /** True if there is a message currently being constructed */
 static bool inProgress = false;
 
@@ -73,6 +78,7 @@ error_t iotxml_newMsg(char *destMsg, int maxSize) {
   bzero(lastDeviceId, sizeof(lastDeviceId));
   bzero(destMsg, maxSize);
   lastParamType = -1;
+  lastTimestamp = 0;
   return SUCCESS;
 }
 
@@ -94,13 +100,39 @@ error_t iotxml_newMsg(char *destMsg, int maxSize) {
  *     socket has its own index number.  Use NULL or 0 if your param doesn't
  *     need an index.
  * @param paramValue Param value string
- * @return the size of the string written to the destination pointer
+ * @return the size of the string written to the destination pointer, which
+ *     is 0 if the last-value cache suppressed a measurement
  */
 int iotxml_addString(char *dest, int maxSize, const char *deviceId, int deviceType, param_type_e paramType, const char *paramName, const char *multiplier, char asciiParamIndex, const char *paramValue) {
+  // Leave out measurements the server already knows, see iotxmlcache.c
+  if(paramType == IOT_PARAM_MEASURE && !iotxmlcache_shouldSend(deviceId, paramName, asciiParamIndex, paramValue)) {
+    return 0;
+  }
+
+  return iotxml_addStringAt(dest, maxSize, 0, deviceId, deviceType, paramType, paramName, multiplier, asciiParamIndex, paramValue);
+}
+
+/**
+ * Add a string to the message that was captured at an earlier time, such as
+ * a buffered sample.  Params with different timestamps go in different param
+ * blocks.  These values are history rather than the latest state, so they
+ * always go out and bypass the last-value cache.
+ *
+ * @param dest Starting point in a destination buffer to write data
+ * @param maxSize maximum size remaining past the start point
+ * @param timestamp Time the value was captured, 0 for now
+ * @param deviceId Device ID string
+ * @param deviceType Device type that is registered with the cloud service
+ * @param paramType Type of parameter, see param_type_e enum in iotapi.h
+ * @param asciiParamIndex Index of this parameter, or 0
+ * @param paramValue Param value string
+ * @return the size of the string written to the destination pointer
+ */
+int iotxml_addStringAt(char *dest, int maxSize, time_t timestamp, const char *deviceId, int deviceType, param_type_e paramType, const char *paramName, const char *multiplier, char asciiParamIndex, const char *paramValue) {
   int offset = 0;
 
   // First check if we need a new param block
-  if(strcmp(deviceId, lastDeviceId) != 0 || lastParamType != paramType) {
+  if(strcmp(deviceId, lastDeviceId) != 0 || lastParamType != paramType || lastTimestamp != timestamp) {
     // We need to start a new tag
     if(lastParamType >= 0) {
       // But first we need to close off the last tag
@@ -110,6 +142,7 @@ int iotxml_addString(char *dest, int maxSize, const char *deviceId, int deviceTy
     }
 
     lastParamType = paramType;
+    lastTimestamp = timestamp;
     strncpy(lastDeviceId, deviceId, sizeof(lastDeviceId));
 
     offset += snprintf(dest + offset, maxSize - offset,
@@ -117,7 +150,11 @@ int iotxml_addString(char *dest, int maxSize, const char *deviceId, int deviceTy
         paramTypeMap[lastParamType],
         deviceId);
 
-    offset += getTimestamp(dest + offset, maxSize - offset);
+    if(timestamp != 0) {
+      offset += getTimestampAt(dest + offset, maxSize - offset, timestamp);
+    } else {
+      offset += getTimestamp(dest + offset, maxSize - offset);
+    }
 
     offset += snprintf(dest + offset, maxSize - offset, "\">");
   }
@@ -173,26 +210,55 @@ int iotxml_addInt(char *dest, int maxSize, const char *deviceId, int deviceType,
 }
 
 /**
- * Close off the last tag and send the message. This will allow other message
- * creating functions to create a new message using iotxml_newMsg(...)
+ * Close off the last tag without sending the message, so the caller can
+ * combine it with others. This will allow other message creating functions
+ * to create a new message using iotxml_newMsg(...)
  *
  * @param destMsg Pointer to the start of the destination message
  * @param maxSize Maximum size of the message buffer
+ * @return the length of the complete message
  */
-error_t iotxml_send(char *destMsg, int maxSize) {
+int iotxml_closeMsg(char *destMsg, int maxSize) {
   int totalSize = strlen(destMsg);
 
   if(lastParamType >= 0) {
     // Close off the last tag
-    snprintf(destMsg + strlen(destMsg), maxSize - totalSize,
+    snprintf(destMsg + totalSize, maxSize - totalSize,
         "</%s>",
         paramTypeMap[lastParamType]);
   }
 
-  SYSLOG_INFO("Send: %s\n", destMsg);
   lastParamType = -1;
   inProgress = false;
-  return application_send(destMsg, strlen(destMsg));
+  return strlen(destMsg);
+}
+
+/**
+ * Close off the last tag and send the message. This will allow other message
+ * creating functions to create a new message using iotxml_newMsg(...)
+ *
+ * @param destMsg Pointer to the start of the destination message
+ * @param maxSize Maximum size of the message buffer
+ */
+error_t iotxml_send(char *destMsg, int maxSize) {
+  int len = iotxml_closeMsg(destMsg, maxSize);
+  error_t result;
+
+  if(len == 0) {
+    // Everything was left out, so there's nothing to say
+    return SUCCESS;
+  }
+
+  SYSLOG_DEBUG("Send: %s", destMsg);
+  result = application_send(destMsg, len);
+
+  if(result != SUCCESS || len >= maxSize - 1) {
+    // The cache remembers values the server never got, so start over
+    SYSLOG_WARNING("Message didn't go out whole, resending every value next time");
+    iotxmlcache_clear();
+  }
+
+  return result;
 }
 
 /**
@@ -215,6 +281,7 @@ error_t iotxml_sendResult(int commandId, result_code_e result) {
   bzero(xmlResult, IOTGEN_RESULT_XML_SIZE);
   snprintf(xmlResult, IOTGEN_RESULT_XML_SIZE, "<response cmdId=\"%d\" result=\"%d\"/>", commandId, result);
   SYSLOG_INFO("Sending result: %s", xmlResult);
+  iottrace_mark(commandId, IOTTRACE_RESULT, result);
   return application_send(xmlResult, strlen(xmlResult));
 }
 
@@ -229,6 +296,9 @@ error_t iotxml_addDevice(const char *deviceId, int deviceType) {
   bzero(xml, IOTGEN_ADD_REMOVE_XML_SIZE);
   snprintf(xml, IOTGEN_ADD_REMOVE_XML_SIZE, "<add deviceId=\"%s\" deviceType=\"%d\" />", deviceId, deviceType);
   SYSLOG_INFO("Adding device %s of type %d", deviceId, deviceType);
+
+  // The server needs to hear everything about the device again
+  iotxmlcache_forget(deviceId);
   return application_send(xml, strlen(xml));
 }
 
@@ -243,6 +313,7 @@ error_t iotxml_alertDeviceIsGone(const char *deviceId) {
   bzero(xml, IOTGEN_ADD_REMOVE_XML_SIZE);
   snprintf(xml, IOTGEN_ADD_REMOVE_XML_SIZE, "<alert deviceId=\"%s\" type=\"noRead\" />", deviceId);
   SYSLOG_INFO("Alerting that device %s is gone", deviceId);
+  iotxmlcache_forget(deviceId);
   return application_send(xml, strlen(xml));
 }
 
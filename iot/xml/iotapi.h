@@ -27,6 +27,7 @@
 #define IOTAPI_H
 
 #include <stdbool.h>
+#include <time.h>
 #include "ioterror.h"
 #include "eui64.h"
 
@@ -61,6 +62,14 @@ typedef enum result_code_e {
 } result_code_e;
 
 
+/**
+ * Parsers available to iotxml_parse(..)
+ */
+typedef enum iotxml_parser_e {
+  IOTXML_PARSER_STREAM = 0,   // in-place streaming parser, no heap allocation
+  IOTXML_PARSER_LIBXML2 = 1,  // libxml2 SAX parser
+} iotxml_parser_e;
+
 /**
  * Structure to store an individual command
  */
@@ -129,8 +138,12 @@ int iotxml_newMsg(char *destMsg, int maxSize);
 
 int iotxml_addString(char *dest, int maxSize, const char *deviceId, int deviceType, param_type_e paramType, const char *paramName, const char *multiplier, char asciiParamIndex, const char *paramValue);
 
+int iotxml_addStringAt(char *dest, int maxSize, time_t timestamp, const char *deviceId, int deviceType, param_type_e paramType, const char *paramName, const char *multiplier, char asciiParamIndex, const char *paramValue);
+
 int iotxml_addInt(char *dest, int maxSize, const char *deviceId, int deviceType, param_type_e paramType, const char *paramName, const char *multiplier, char asciiParamIndex, int paramValue);
 
+int iotxml_closeMsg(char *destMsg, int maxSize);
+
 error_t iotxml_send(char *destMsg, int maxSize);
 
 void iotxml_abortMsg();
@@ -139,8 +152,16 @@ error_t iotxml_sendResult(int commandId, result_code_e result);
 
 error_t iotxml_parse(const char *xml, int len);
 
+error_t iotxml_setParser(iotxml_parser_e type);
+
+error_t iotxml_parseChunk(const char *xml, int len);
+
+error_t iotxml_parseFinish();
+
 error_t iotxml_addCommandListener(commandlistener_f l, char *type);
 
+error_t iotxml_addCommandListenerFor(commandlistener_f l, const char *type, const char *deviceId, const char *commandName);
+
 error_t iotxml_removeCommandListener(commandlistener_f l);
 
 error_t iotxml_pushMeasurementNow(const char *deviceId);
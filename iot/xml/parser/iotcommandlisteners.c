@@ -19,28 +19,102 @@
 /**
  * This module tracks listener functions that want to receive commands from
  * the server.
+ *
+ * Listeners are indexed by their full command type in a hash table, and can
+ * also narrow down to one device ID and/or command name. The whole registry
+ * is an immutable snapshot: adding or removing a listener builds a new
+ * snapshot and publishes it with a single pointer swap, so broadcasting a
+ * command never takes a lock and listeners may add or remove listeners from
+ * inside their callback. Old snapshots are freed once no broadcast is
+ * reading them any more.
  * @author David Moss
  */
 
 #include <errno.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "iotapi.h"
 #include "iotdebug.h"
 #include "ioterror.h"
 #include "iotcommandlisteners.h"
+#include "iottrace.h"
 
-/** Array of listeners */
-static struct {
+/**
+ * A registered listener
+ */
+typedef struct commandlistener_t {
 
+  /** Function to call */
   commandlistener_f l;
 
-  char type[TYPE_ATTRIBUTE_CHARS_TO_MATCH];
+  /** True to receive commands of any type */
+  bool anyType;
+
+  /** Full type attribute to match, "set", "delete", "discover", etc. */
+  char type[IOT_COMMAND_TYPE_STRING_SIZE];
+
+  /** Device ID to match, empty for any device */
+  char deviceId[EUI64_STRING_SIZE];
+
+  /** Command name to match, empty for any command name */
+  char commandName[IOT_COMMAND_NAME_STRING_SIZE];
+
+  /** Index of the next listener in the same hash bucket, -1 at the end */
+  int next;
+
+} commandlistener_t;
+
+/**
+ * Immutable snapshot of every registered listener
+ */
+typedef struct commandlisteners_snapshot_t {
+
+  /** Total listeners, in the order they were added */
+  int totalListeners;
+
+  /** Listeners, in the order they were added */
+  commandlistener_t *listeners;
+
+  /** Total hash buckets, always a power of 2 */
+  unsigned int totalBuckets;
+
+  /** Index of the first listener in each bucket, -1 if empty */
+  int *buckets;
+
+  /** Index of the first listener of any type, -1 if none */
+  int anyTypeHead;
+
+  /** Next snapshot waiting to be freed */
+  struct commandlisteners_snapshot_t *nextRetired;
+
+} commandlisteners_snapshot_t;
 
-  bool inUse;
+/** Snapshot broadcasts read from */
+static commandlisteners_snapshot_t * volatile currentSnapshot;
 
-} listeners[TOTAL_COMMAND_LISTENERS];
+/** Total broadcasts in progress */
+static volatile int activeReaders;
+
+/** Snapshots replaced while a broadcast might still be reading them */
+static commandlisteners_snapshot_t *retiredSnapshots;
+
+/** Mutex to serialize changes to the registry */
+static pthread_mutex_t sCommandListenersMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/***************** Private Prototypes ****************/
+static error_t _iotcommandlisteners_add(commandlistener_f l, const char *type, const char *deviceId, const char *commandName);
+
+static commandlisteners_snapshot_t *_iotcommandlisteners_build(const commandlistener_t *listeners, int totalListeners);
+
+static void _iotcommandlisteners_publish(commandlisteners_snapshot_t *snapshot);
+
+static void _iotcommandlisteners_dispatch(const commandlisteners_snapshot_t *snapshot, int index, command_t *cmd);
+
+static unsigned int _iotcommandlisteners_hash(const char *type);
 
 
 /***************** Public Functions ****************/
@@ -49,81 +123,327 @@ static struct {
  *
  * @param commandlistener_f Function pointer to a function(command_t cmd)
  * @param type Type attribute to listen for, "set", "delete", "discover", etc.
+ *     The whole type must match. NULL listens to every type.
  * @return SUCCESS if the listener was added
  */
 error_t iotxml_addCommandListener(commandlistener_f l, char *type) {
+  return _iotcommandlisteners_add(l, type, NULL, NULL);
+}
+
+/**
+ * Add a listener to receive parsed commands for one device and/or one
+ * command name only
+ *
+ * @param commandlistener_f Function pointer to a function(command_t cmd)
+ * @param type Type attribute to listen for, NULL for every type
+ * @param deviceId Device ID to listen for, NULL for every device
+ * @param commandName Command name to listen for, NULL for every command name
+ * @return SUCCESS if the listener was added
+ */
+error_t iotxml_addCommandListenerFor(commandlistener_f l, const char *type, const char *deviceId, const char *commandName) {
+  return _iotcommandlisteners_add(l, type, deviceId, commandName);
+}
+
+/**
+ * Remove a listener from the command
+ * @param commandlistener_f Function pointer to remove, along with every
+ *     type, device and command name it was added for
+ * @return SUCCESS if the listener was found and removed
+ */
+error_t iotxml_removeCommandListener(commandlistener_f l) {
+  commandlisteners_snapshot_t *snapshot;
+  commandlistener_t *listeners;
+  int total = 0;
   int i;
 
-  for(i = 0; i < TOTAL_COMMAND_LISTENERS; i++) {
-    if(listeners[i].inUse && listeners[i].l == l) {
-      // Already in the log
-      return SUCCESS;
-    }
+  pthread_mutex_lock(&sCommandListenersMutex);
+  snapshot = currentSnapshot;
+
+  if(snapshot == NULL) {
+    pthread_mutex_unlock(&sCommandListenersMutex);
+    return FAIL;
   }
 
-  for(i = 0; i < TOTAL_COMMAND_LISTENERS; i++) {
-    if(!listeners[i].inUse) {
-      listeners[i].inUse = true;
-      strncpy(listeners[i].type, type, TYPE_ATTRIBUTE_CHARS_TO_MATCH);
-      listeners[i].l = l;
-      return SUCCESS;
+  if((listeners = malloc(sizeof(commandlistener_t) * (snapshot->totalListeners + 1))) == NULL) {
+    SYSLOG_ERR("Out of memory");
+    pthread_mutex_unlock(&sCommandListenersMutex);
+    return FAIL;
+  }
+
+  for(i = 0; i < snapshot->totalListeners; i++) {
+    if(snapshot->listeners[i].l != l) {
+      listeners[total++] = snapshot->listeners[i];
     }
   }
 
-  return FAIL;
+  if(total == snapshot->totalListeners) {
+    free(listeners);
+    pthread_mutex_unlock(&sCommandListenersMutex);
+    return FAIL;
+  }
+
+  if((snapshot = _iotcommandlisteners_build(listeners, total)) == NULL) {
+    free(listeners);
+    pthread_mutex_unlock(&sCommandListenersMutex);
+    return FAIL;
+  }
+
+  free(listeners);
+  _iotcommandlisteners_publish(snapshot);
+  pthread_mutex_unlock(&sCommandListenersMutex);
+  return SUCCESS;
 }
 
 /**
- * Remove a listener from the command
- * @param commandlistener_f Function pointer to remove
- * @return SUCCESS if the listener was found and removed
+ * Broadcast a command to all listeners that match its type, device ID
+ * and command name
+ * @param cmd Command to broadcast
  */
-error_t iotxml_removeCommandListener(commandlistener_f l) {
+error_t iotcommandlisteners_broadcast(command_t *cmd) {
+  const commandlisteners_snapshot_t *snapshot;
+
+  iottrace_mark(cmd->commandId, IOTTRACE_PARSED, 0);
+
+  // Announce ourselves before looking at the snapshot, so whoever replaces
+  // it knows not to free it underneath us
+  __sync_fetch_and_add(&activeReaders, 1);
+  snapshot = currentSnapshot;
+  __sync_synchronize();
+
+  if(snapshot != NULL) {
+    _iotcommandlisteners_dispatch(snapshot,
+        snapshot->buckets[_iotcommandlisteners_hash(cmd->commandType) & (snapshot->totalBuckets - 1)], cmd);
+    _iotcommandlisteners_dispatch(snapshot, snapshot->anyTypeHead, cmd);
+  }
+
+  __sync_fetch_and_sub(&activeReaders, 1);
+  return SUCCESS;
+}
+
+/**
+ * @return the total number of registered listeners
+ */
+int iotcommandlisteners_totalListeners() {
+  int total = 0;
+
+  __sync_fetch_and_add(&activeReaders, 1);
+  if(currentSnapshot != NULL) {
+    total = currentSnapshot->totalListeners;
+  }
+  __sync_fetch_and_sub(&activeReaders, 1);
+
+  return total;
+}
+
+
+/***************** Private Functions ****************/
+/**
+ * Add a listener with the given filters, NULL filters match anything
+ */
+static error_t _iotcommandlisteners_add(commandlistener_f l, const char *type, const char *deviceId, const char *commandName) {
+  commandlisteners_snapshot_t *snapshot;
+  commandlistener_t *listeners;
+  commandlistener_t *listener;
+  int total = 0;
   int i;
 
-  for(i = 0; i < TOTAL_COMMAND_LISTENERS; i++) {
-    if(listeners[i].inUse && listeners[i].l == l) {
-      listeners[i].inUse = false;
+  if(l == NULL) {
+    return FAIL;
+  }
+
+  pthread_mutex_lock(&sCommandListenersMutex);
+  snapshot = currentSnapshot;
+
+  if(snapshot != NULL) {
+    total = snapshot->totalListeners;
+  }
+
+  if((listeners = malloc(sizeof(commandlistener_t) * (total + 1))) == NULL) {
+    SYSLOG_ERR("Out of memory");
+    pthread_mutex_unlock(&sCommandListenersMutex);
+    return FAIL;
+  }
+
+  if(total > 0) {
+    memcpy(listeners, snapshot->listeners, sizeof(commandlistener_t) * total);
+  }
+
+  listener = &listeners[total];
+  memset(listener, 0x0, sizeof(commandlistener_t));
+  listener->l = l;
+  listener->anyType = (type == NULL);
+  if(type != NULL) {
+    strncpy(listener->type, type, sizeof(listener->type) - 1);
+  }
+  if(deviceId != NULL) {
+    strncpy(listener->deviceId, deviceId, sizeof(listener->deviceId) - 1);
+  }
+  if(commandName != NULL) {
+    strncpy(listener->commandName, commandName, sizeof(listener->commandName) - 1);
+  }
+
+  for(i = 0; i < total; i++) {
+    if(listeners[i].l == l
+        && listeners[i].anyType == listener->anyType
+        && strcmp(listeners[i].type, listener->type) == 0
+        && strcmp(listeners[i].deviceId, listener->deviceId) == 0
+        && strcmp(listeners[i].commandName, listener->commandName) == 0) {
+      // Already in the log
+      free(listeners);
+      pthread_mutex_unlock(&sCommandListenersMutex);
       return SUCCESS;
     }
   }
 
-  return FAIL;
+  if((snapshot = _iotcommandlisteners_build(listeners, total + 1)) == NULL) {
+    free(listeners);
+    pthread_mutex_unlock(&sCommandListenersMutex);
+    return FAIL;
+  }
+
+  free(listeners);
+  _iotcommandlisteners_publish(snapshot);
+  pthread_mutex_unlock(&sCommandListenersMutex);
+  return SUCCESS;
 }
 
 /**
- * Broadcast a command to all listeners
- * @param msg Message to broadcast
- * @param len Length of the message
- * @param type Type attribute of the command describing the action
+ * Build a new snapshot in a single allocation
+ * @param listeners Listeners in the order they were added
+ * @param totalListeners Number of listeners
+ * @return the new snapshot, NULL if we're out of memory
  */
-error_t iotcommandlisteners_broadcast(command_t *cmd) {
+static commandlisteners_snapshot_t *_iotcommandlisteners_build(const commandlistener_t *listeners, int totalListeners) {
+  commandlisteners_snapshot_t *snapshot;
+  unsigned int totalBuckets = 8;
+  unsigned int bucket;
+  int *tail;
+  int *tails;
+  int anyTypeTail = -1;
   int i;
 
-  for(i = 0; i < TOTAL_COMMAND_LISTENERS; i++) {
-    if(listeners[i].inUse) {
-      if(strncmp(listeners[i].type, cmd->commandType, TYPE_ATTRIBUTE_CHARS_TO_MATCH) == 0) {
-        listeners[i].l(cmd);
+  // Keep the buckets at least twice the listeners so chains stay short
+  while(totalBuckets < (unsigned int) totalListeners * 2) {
+    totalBuckets <<= 1;
+  }
+
+  snapshot = malloc(sizeof(commandlisteners_snapshot_t)
+      + sizeof(commandlistener_t) * totalListeners
+      + sizeof(int) * totalBuckets * 2);
+
+  if(snapshot == NULL) {
+    SYSLOG_ERR("Out of memory");
+    return NULL;
+  }
+
+  snapshot->totalListeners = totalListeners;
+  snapshot->listeners = (commandlistener_t *) (snapshot + 1);
+  snapshot->totalBuckets = totalBuckets;
+  snapshot->buckets = (int *) (snapshot->listeners + totalListeners);
+  snapshot->anyTypeHead = -1;
+  snapshot->nextRetired = NULL;
+  tails = snapshot->buckets + totalBuckets;
+
+  memcpy(snapshot->listeners, listeners, sizeof(commandlistener_t) * totalListeners);
+
+  for(bucket = 0; bucket < totalBuckets; bucket++) {
+    snapshot->buckets[bucket] = -1;
+    tails[bucket] = -1;
+  }
+
+  // Chain the listeners in the order they were added
+  for(i = 0; i < totalListeners; i++) {
+    snapshot->listeners[i].next = -1;
+
+    if(snapshot->listeners[i].anyType) {
+      if(anyTypeTail < 0) {
+        snapshot->anyTypeHead = i;
+      } else {
+        snapshot->listeners[anyTypeTail].next = i;
+      }
+      anyTypeTail = i;
+
+    } else {
+      bucket = _iotcommandlisteners_hash(snapshot->listeners[i].type) & (totalBuckets - 1);
+      tail = &tails[bucket];
+      if(*tail < 0) {
+        snapshot->buckets[bucket] = i;
+      } else {
+        snapshot->listeners[*tail].next = i;
       }
+      *tail = i;
     }
   }
 
-  return SUCCESS;
+  return snapshot;
 }
 
 /**
- * @return the total number of registered listeners
+ * Make a new snapshot visible to broadcasts, and free every old snapshot
+ * that no broadcast can still be reading. Call with the mutex locked.
  */
-int iotcommandlisteners_totalListeners() {
-  int i;
-  int total = 0;
+static void _iotcommandlisteners_publish(commandlisteners_snapshot_t *snapshot) {
+  commandlisteners_snapshot_t *retired;
+
+  if(currentSnapshot != NULL) {
+    currentSnapshot->nextRetired = retiredSnapshots;
+    retiredSnapshots = currentSnapshot;
+  }
+
+  __sync_synchronize();
+  currentSnapshot = snapshot;
+  __sync_synchronize();
 
-  for(i = 0; i < TOTAL_COMMAND_LISTENERS; i++) {
-    if(listeners[i].inUse) {
-      total++;
+  // A broadcast that started before the swap is still counted here. One that
+  // starts after it can only see the new snapshot.
+  if(activeReaders == 0) {
+    while(retiredSnapshots != NULL) {
+      retired = retiredSnapshots;
+      retiredSnapshots = retired->nextRetired;
+      free(retired);
     }
   }
+}
 
-  return total;
+/**
+ * Call every matching listener in one chain
+ */
+static void _iotcommandlisteners_dispatch(const commandlisteners_snapshot_t *snapshot, int index, command_t *cmd) {
+  const commandlistener_t *listener;
+
+  for(; index >= 0; index = listener->next) {
+    listener = &snapshot->listeners[index];
+
+    if(!listener->anyType && strncmp(listener->type, cmd->commandType, IOT_COMMAND_TYPE_STRING_SIZE) != 0) {
+      continue;
+    }
+
+    // The end-of-message notification carries no device or command name,
+    // so everybody listening for the type receives it
+    if(!cmd->noMoreCommands) {
+      if(listener->deviceId[0] != '\0' && strncmp(listener->deviceId, cmd->deviceId, EUI64_STRING_SIZE) != 0) {
+        continue;
+      }
+
+      if(listener->commandName[0] != '\0' && strncmp(listener->commandName, cmd->commandName, IOT_COMMAND_NAME_STRING_SIZE) != 0) {
+        continue;
+      }
+    }
+
+    listener->l(cmd);
+  }
 }
 
+/**
+ * djb2 hash of a command type, limited to the size of the type attribute
+ */
+static unsigned int _iotcommandlisteners_hash(const char *type) {
+  unsigned int hash = 5381;
+  int i;
+
+  for(i = 0; i < IOT_COMMAND_TYPE_STRING_SIZE && type[i] != '\0'; i++) {
+    hash = ((hash << 5) + hash) + (unsigned char) type[i];
+  }
+
+  return hash;
+}
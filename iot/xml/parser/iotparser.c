@@ -29,82 +29,194 @@
 #include <rpc/types.h>
 #include <stdio.h>
 
+#ifndef IOTPARSER_NO_LIBXML2
 #include <libxml/parser.h>
+#endif
 
 #include "ioterror.h"
 #include "iotdebug.h"
 #include "iotcommandlisteners.h"
 #include "iotparser.h"
+#include "iotstreamparser.h"
 #include "eui64.h"
 
 
-/** True if a param tag was found in the command */
-static bool paramTagFound;
+/** Parser used by iotxml_parse(..), selectable at runtime */
+static iotxml_parser_e parserType = IOTPARSER_DEFAULT_PARSER;
+
+/**
+ * Message being received piece by piece through iotxml_parseChunk(..). Each
+ * thread has its own, so transfers on different threads can overlap.
+ */
+static __thread struct {
+
+  iotparser_t parser;
+
+  iotstreamparser_t streamParser;
+
+  bool inProgress;
+
+} chunkParse;
 
 /***************** Private Prototypes ****************/
+static void _iotparser_init(iotparser_t *parser);
+
+static error_t _iotparser_streamParse(iotparser_t *parser, const char *xml, int len);
+
+static void _iotparser_startElementHandler(void *ctx, const char *name, const char **atts);
+
+static void _iotparser_endElementHandler(void *ctx, const char *name);
+
+static void _iotparser_charactersHandler(void *ctx, const char *ch, int len);
+
+#ifndef IOTPARSER_NO_LIBXML2
+static error_t _iotparser_xml_parse(iotparser_t *parser, const char *xml, int len);
+
 static void _iotparser_xml_startElementHandler(void *ctx, const xmlChar *name, const xmlChar **atts);
 
 static void _iotparser_xml_endElementHandler(void *ctx, const xmlChar *name);
 
 static void _iotparser_xml_charactersHandler(void *ctx, const xmlChar *ch, int len);
+#endif
 
 /***************** Public Functions ****************/
-error_t iotxml_parse(const char *xml, int len) {
-  command_t command;
-  memset(&command, 0x0, sizeof(command));
+/**
+ * Select the parser used by iotxml_parse(..)
+ * @param type IOTXML_PARSER_STREAM or IOTXML_PARSER_LIBXML2
+ * @return SUCCESS if that parser was compiled in
+ */
+error_t iotxml_setParser(iotxml_parser_e type) {
+#ifdef IOTPARSER_NO_LIBXML2
+  if(type == IOTXML_PARSER_LIBXML2) {
+    SYSLOG_ERR("libxml2 parser was not compiled in");
+    return FAIL;
+  }
+#endif
 
-  xmlSAXHandler saxHandler = {
-      NULL, // internalSubsetHandler,
-      NULL, // isStandaloneHandler,
-      NULL, // hasInternalSubsetHandler,
-      NULL, // hasExternalSubsetHandler,
-      NULL, // resolveEntityHandler,
-      NULL, // getEntityHandler,
-      NULL, // entityDeclHandler,
-      NULL, // notationDeclHandler,
-      NULL, // attributeDeclHandler,
-      NULL, // elementDeclHandler,
-      NULL, // unparsedEntityDeclHandler,
-      NULL, // setDocumentLocatorHandler,
-      NULL, // startDocument
-      NULL, // endDocument
-      _iotparser_xml_startElementHandler, // startElement
-      _iotparser_xml_endElementHandler, // endElement
-      NULL, // reference,
-      _iotparser_xml_charactersHandler, //characters
-      NULL, // ignorableWhitespace
-      NULL, // processingInstructionHandler,
-      NULL, // comment
-      NULL, // warning
-      NULL, // error
-      NULL, // fatal
-  };
+  parserType = type;
+  return SUCCESS;
+}
 
-  command.userIsWatching = (strstr(xml, "CONT") != NULL);
+/**
+ * Parse a complete message from the server and broadcast each command
+ * to the command listeners
+ * @param xml Message from the server
+ * @param len Length of the message
+ * @return SUCCESS if the message was parsed
+ */
+error_t iotxml_parse(const char *xml, int len) {
+  iotparser_t parser;
+  error_t result;
+
+  _iotparser_init(&parser);
 
   SYSLOG_DEBUG("Parsing XML: %s", xml);
-  if(0 != xmlSAXUserParseMemory(&saxHandler, &command, xml, len)) {
+
+#ifndef IOTPARSER_NO_LIBXML2
+  if(parserType == IOTXML_PARSER_LIBXML2) {
+    result = _iotparser_xml_parse(&parser, xml, len);
+  } else {
+    result = _iotparser_streamParse(&parser, xml, len);
+  }
+#else
+  result = _iotparser_streamParse(&parser, xml, len);
+#endif
+
+  if(result != SUCCESS) {
     SYSLOG_ERR("Couldn't parse XML");
-    return FAIL;
   }
 
-  return SUCCESS;
+  return result;
+}
+
+/**
+ * Parse the next piece of a message from the server as it arrives. Each
+ * command is broadcast to the command listeners as soon as its </param> or
+ * </command> tag is received, without waiting for the rest of the message.
+ * The first call starts a new message, iotxml_parseFinish() ends it.
+ *
+ * Each thread can parse one message this way at a time, and it always uses
+ * the streaming parser.
+ *
+ * @param xml Next bytes of the message, only needed for the duration of the call
+ * @param len Number of bytes
+ * @return SUCCESS if the message is well formed so far
+ */
+error_t iotxml_parseChunk(const char *xml, int len) {
+  if(!chunkParse.inProgress) {
+    _iotparser_init(&chunkParse.parser);
+    iotstreamparser_init(&chunkParse.streamParser,
+        _iotparser_startElementHandler,
+        _iotparser_endElementHandler,
+        _iotparser_charactersHandler,
+        &chunkParse.parser);
+    chunkParse.inProgress = true;
+  }
+
+  return iotstreamparser_parseChunk(&chunkParse.streamParser, xml, len);
+}
+
+/**
+ * The message being parsed with iotxml_parseChunk(..) is complete
+ * @return SUCCESS if the whole message was well formed
+ */
+error_t iotxml_parseFinish() {
+  error_t result = SUCCESS;
+
+  if(chunkParse.inProgress) {
+    result = iotstreamparser_finish(&chunkParse.streamParser);
+    chunkParse.inProgress = false;
+
+    if(result != SUCCESS) {
+      SYSLOG_ERR("Couldn't parse XML");
+    }
+  }
+
+  return result;
 }
 
 /***************** Private Functions ****************/
 /**
- * XML start element handler
+ * Clear out a parser context before a new message
  */
-static void _iotparser_xml_startElementHandler(void *ctx, const xmlChar *name, const xmlChar **atts) {
+static void _iotparser_init(iotparser_t *parser) {
+  memset(parser, 0x0, sizeof(iotparser_t));
+}
+
+/**
+ * Parse the message in place with the streaming parser
+ */
+static error_t _iotparser_streamParse(iotparser_t *parser, const char *xml, int len) {
+  iotstreamparser_t streamParser;
+
+  iotstreamparser_init(&streamParser,
+      _iotparser_startElementHandler,
+      _iotparser_endElementHandler,
+      _iotparser_charactersHandler,
+      parser);
+
+  if(iotstreamparser_parseChunk(&streamParser, xml, len) != SUCCESS) {
+    return FAIL;
+  }
+
+  return iotstreamparser_finish(&streamParser);
+}
+
+/**
+ * Start element handler
+ */
+static void _iotparser_startElementHandler(void *ctx, const char *name, const char **atts) {
   int i;
-  char *attr;
-  char *value;
-  command_t *command = (command_t *) ctx;
+  const char *attr;
+  const char *value;
+  iotparser_t *parser = (iotparser_t *) ctx;
+  command_t *command = &parser->command;
 
+  parser->inText = false;
 
-  if(strcmp((char *) name, IOTPARSER_TAG_COMMAND) == 0) {
+  if(strcmp(name, IOTPARSER_TAG_COMMAND) == 0) {
     // New command, clear out all the residual command and argument information
-    paramTagFound = false;
+    parser->paramTagFound = false;
     bzero(command->deviceId, EUI64_STRING_SIZE);
     bzero(command->commandName, IOT_COMMAND_NAME_STRING_SIZE);
     command->commandId = -1;
@@ -112,19 +224,27 @@ static void _iotparser_xml_startElementHandler(void *ctx, const xmlChar *name, c
     command->argument = NULL;
     command->argSize = 0;
 
-  } else if(strcmp((char *) name, IOTPARSER_TAG_PARAM) == 0) {
+  } else if(strcmp(name, IOTPARSER_TAG_PARAM) == 0) {
     // New parameter, clear out the residual argument information but leave
     // everything else intact
-    paramTagFound = true;
+    parser->paramTagFound = true;
     command->asciiIndex = 0;
     command->argument = NULL;
     command->argSize = 0;
+
+  } else if(strcmp(name, IOTPARSER_TAG_S2H) == 0 && atts != NULL) {
+    // The server signals a user is watching with CONT on the s2h tag
+    for (i = 1; (atts[i - 1] != NULL); i += 2) {
+      if(strstr(atts[i], "CONT") != NULL) {
+        command->userIsWatching = true;
+      }
+    }
   }
 
   if (atts != NULL) {
     for (i = 0; (atts[i] != NULL); i++) {
-      attr = (char *) atts[i++];
-      value = (char *) atts[i];
+      attr = atts[i++];
+      value = atts[i];
 
       if(strcmp(attr, IOTPARSER_ATTR_COMMANDID) == 0) {
         command->commandId = atoi(value);
@@ -152,12 +272,15 @@ static void _iotparser_xml_startElementHandler(void *ctx, const xmlChar *name, c
 }
 
 /**
- * XML end element handler
+ * End element handler
  */
-static void _iotparser_xml_endElementHandler(void *ctx, const xmlChar *name) {
-  if(strcmp((char *) name, IOTPARSER_TAG_S2H) == 0) {
-    command_t *command = (command_t *) ctx;
+static void _iotparser_endElementHandler(void *ctx, const char *name) {
+  iotparser_t *parser = (iotparser_t *) ctx;
+  command_t *command = &parser->command;
+
+  parser->inText = false;
 
+  if(strcmp(name, IOTPARSER_TAG_S2H) == 0) {
     // Send out a command to all listeners that there are no more commands
     // This is useful when we might receive several commands that we buffered
     // up because they need to execute simultaneously
@@ -178,25 +301,106 @@ static void _iotparser_xml_endElementHandler(void *ctx, const xmlChar *name) {
 
     iotcommandlisteners_broadcast(command);
 
-  } else if(strcmp((char *) name, IOTPARSER_TAG_PARAM) == 0) {
+  } else if(strcmp(name, IOTPARSER_TAG_PARAM) == 0) {
     // This is the end of a param tag
-    paramTagFound = true;
-    iotcommandlisteners_broadcast((command_t *) ctx);
+    parser->paramTagFound = true;
+    iotcommandlisteners_broadcast(command);
 
-  } else if(strcmp((char *) name, IOTPARSER_TAG_COMMAND) == 0 && !paramTagFound) {
+  } else if(strcmp(name, IOTPARSER_TAG_COMMAND) == 0 && !parser->paramTagFound) {
     // This is the end of a command tag where there were no param tags within it
-    iotcommandlisteners_broadcast((command_t *) ctx);
+    iotcommandlisteners_broadcast(command);
   }
 }
 
 
 /**
- * XML character handler
+ * Character handler, the streaming parser delivers each text node whole
  */
-static void _iotparser_xml_charactersHandler(void *ctx, const xmlChar *ch, int len) {
-  command_t *command = (command_t *) ctx;
-  command->argument = (char *) ch;
-  command->argSize = len;
+static void _iotparser_charactersHandler(void *ctx, const char *ch, int len) {
+  iotparser_t *parser = (iotparser_t *) ctx;
+
+  parser->inText = true;
+  parser->command.argument = ch;
+  parser->command.argSize = len;
 }
 
 
+#ifndef IOTPARSER_NO_LIBXML2
+/**
+ * Parse the message with libxml2's SAX parser
+ */
+static error_t _iotparser_xml_parse(iotparser_t *parser, const char *xml, int len) {
+  xmlSAXHandler saxHandler = {
+      NULL, // internalSubsetHandler,
+      NULL, // isStandaloneHandler,
+      NULL, // hasInternalSubsetHandler,
+      NULL, // hasExternalSubsetHandler,
+      NULL, // resolveEntityHandler,
+      NULL, // getEntityHandler,
+      NULL, // entityDeclHandler,
+      NULL, // notationDeclHandler,
+      NULL, // attributeDeclHandler,
+      NULL, // elementDeclHandler,
+      NULL, // unparsedEntityDeclHandler,
+      NULL, // setDocumentLocatorHandler,
+      NULL, // startDocument
+      NULL, // endDocument
+      _iotparser_xml_startElementHandler, // startElement
+      _iotparser_xml_endElementHandler, // endElement
+      NULL, // reference,
+      _iotparser_xml_charactersHandler, //characters
+      NULL, // ignorableWhitespace
+      NULL, // processingInstructionHandler,
+      NULL, // comment
+      NULL, // warning
+      NULL, // error
+      NULL, // fatal
+  };
+
+  if(0 != xmlSAXUserParseMemory(&saxHandler, parser, xml, len)) {
+    return FAIL;
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * libxml2 start element handler
+ */
+static void _iotparser_xml_startElementHandler(void *ctx, const xmlChar *name, const xmlChar **atts) {
+  _iotparser_startElementHandler(ctx, (const char *) name, (const char **) atts);
+}
+
+/**
+ * libxml2 end element handler
+ */
+static void _iotparser_xml_endElementHandler(void *ctx, const xmlChar *name) {
+  _iotparser_endElementHandler(ctx, (const char *) name);
+}
+
+/**
+ * libxml2 character handler. libxml2 may split one text node across
+ * several calls, and those pieces live in its own buffers, so gather
+ * them up in the parser's value buffer instead of keeping only the last.
+ */
+static void _iotparser_xml_charactersHandler(void *ctx, const xmlChar *ch, int len) {
+  iotparser_t *parser = (iotparser_t *) ctx;
+  command_t *command = &parser->command;
+
+  if(!parser->inText) {
+    parser->inText = true;
+    command->argument = parser->value;
+    command->argSize = 0;
+  }
+
+  if(len > (int) sizeof(parser->value) - 1 - command->argSize) {
+    SYSLOG_WARNING("Argument truncated to %d bytes", (int) sizeof(parser->value) - 1);
+    len = sizeof(parser->value) - 1 - command->argSize;
+  }
+
+  memcpy(parser->value + command->argSize, ch, len);
+  command->argSize += len;
+  parser->value[command->argSize] = '\0';
+}
+#endif
+
@@ -20,12 +20,23 @@
 #ifndef IOTPARSER_H
 #define IOTPARSER_H
 
+#include <stdbool.h>
+#include "iotapi.h"
+
 /**
  * Maximum size of the value to expect from the server,
  * configurable at compile time
  */
 #ifndef IOTPARSER_VALUE_SIZE
-#define IOTPARSER_VALUE_SIZE 128
+#define IOTPARSER_VALUE_SIZE 512
+#endif
+
+/**
+ * Parser used by iotxml_parse(..) until iotxml_setParser(..) is called.
+ * Define IOTPARSER_NO_LIBXML2 to build without libxml2 entirely.
+ */
+#ifndef IOTPARSER_DEFAULT_PARSER
+#define IOTPARSER_DEFAULT_PARSER IOTXML_PARSER_STREAM
 #endif
 
 /** <s2h ..> tag */
@@ -52,5 +63,24 @@
 /** index attribute */
 #define IOTPARSER_ATTR_INDEX "index"
 
+/**
+ * State of one message being parsed
+ */
+typedef struct iotparser_t {
+
+  /** Command being assembled and broadcast */
+  command_t command;
+
+  /** True if a param tag was found in the current command */
+  bool paramTagFound;
+
+  /** True while the characters of one text node are being received */
+  bool inText;
+
+  /** Text gathered up when it arrives in pieces */
+  char value[IOTPARSER_VALUE_SIZE];
+
+} iotparser_t;
+
 #endif
 
@@ -0,0 +1,650 @@
+/*
+ *  Copyright 2013 People Power Company
+ *
+ *  This code was developed with funding from People Power Company
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * Small streaming XML tokenizer for the server-to-hub (<s2h>) grammar.
+ *
+ * It understands just enough XML for the server messages: elements,
+ * attributes, text, CDATA sections, the predefined and numeric entity
+ * references, and it skips the XML declaration, comments and DOCTYPEs.
+ * End tags must match their start tags, and names that don't fit in
+ * IOTSTREAMPARSER_NAME_SIZE fail the parse instead of being cut short.
+ * Input may arrive in any number of chunks, split anywhere. All state lives
+ * in the iotstreamparser_t, so nothing is allocated while parsing.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <ctype.h>
+
+#include "ioterror.h"
+#include "iotdebug.h"
+#include "iotstreamparser.h"
+
+/***************** Private Prototypes ****************/
+static error_t _iotstreamparser_character(iotstreamparser_t *parser, const char *chunk, int i);
+
+static void _iotstreamparser_appendText(iotstreamparser_t *parser, const char *text, int len);
+
+static void _iotstreamparser_spillText(iotstreamparser_t *parser, const char *end);
+
+static void _iotstreamparser_flushText(iotstreamparser_t *parser);
+
+static error_t _iotstreamparser_decodeEntity(iotstreamparser_t *parser, char *dest, int *len);
+
+static error_t _iotstreamparser_startElement(iotstreamparser_t *parser);
+
+static error_t _iotstreamparser_endElement(iotstreamparser_t *parser);
+
+static bool _iotstreamparser_isNameStart(char c);
+
+static bool _iotstreamparser_isName(char c);
+
+/***************** Public Functions ****************/
+/**
+ * Initialize a parser context
+ * @param parser Parser context to initialize
+ * @param startElement Start element handler
+ * @param endElement End element handler
+ * @param characters Text handler
+ * @param ctx Opaque pointer passed back to every handler
+ */
+void iotstreamparser_init(iotstreamparser_t *parser,
+    iotstreamparser_startElement_f startElement,
+    iotstreamparser_endElement_f endElement,
+    iotstreamparser_characters_f characters,
+    void *ctx) {
+  memset(parser, 0x0, sizeof(iotstreamparser_t));
+  parser->startElement = startElement;
+  parser->endElement = endElement;
+  parser->characters = characters;
+  parser->ctx = ctx;
+  parser->state = IOTSTREAMPARSER_STATE_TEXT;
+}
+
+/**
+ * Feed the next chunk of the document to the parser.  Handlers are called
+ * as soon as each element opens or closes.  Text that sits inside this
+ * chunk is handed to the characters handler in place, so the chunk must
+ * stay valid until this function returns.
+ *
+ * @param parser Parser context
+ * @param chunk Next bytes of the document
+ * @param len Number of bytes in the chunk
+ * @return SUCCESS if the chunk was well formed so far
+ */
+error_t iotstreamparser_parseChunk(iotstreamparser_t *parser, const char *chunk, int len) {
+  int i;
+
+  if(parser->state == IOTSTREAMPARSER_STATE_ERROR) {
+    return FAIL;
+  }
+
+  for(i = 0; i < len; i++) {
+    if(_iotstreamparser_character(parser, chunk, i) != SUCCESS) {
+      SYSLOG_ERR("Malformed XML near '%.*s'", (len - i) < 32 ? (len - i) : 32, chunk + i);
+      parser->state = IOTSTREAMPARSER_STATE_ERROR;
+      return FAIL;
+    }
+  }
+
+  // Text that hasn't been handed out yet can't point into the caller's
+  // buffer any longer
+  if(parser->state == IOTSTREAMPARSER_STATE_TEXT) {
+    _iotstreamparser_spillText(parser, chunk + len);
+  } else {
+    _iotstreamparser_spillText(parser, parser->textEnd);
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * Tell the parser the document is complete
+ * @param parser Parser context
+ * @return SUCCESS if every element that was opened got closed
+ */
+error_t iotstreamparser_finish(iotstreamparser_t *parser) {
+  if(parser->state != IOTSTREAMPARSER_STATE_TEXT || parser->depth != 0) {
+    SYSLOG_ERR("Incomplete XML document");
+    parser->state = IOTSTREAMPARSER_STATE_ERROR;
+    return FAIL;
+  }
+
+  return SUCCESS;
+}
+
+/***************** Private Functions ****************/
+/**
+ * Run one character through the state machine
+ * @param parser Parser context
+ * @param chunk Current chunk
+ * @param i Index of the character inside the chunk
+ * @return SUCCESS if the character is legal here
+ */
+static error_t _iotstreamparser_character(iotstreamparser_t *parser, const char *chunk, int i) {
+  char c = chunk[i];
+  char decoded[4];
+  int decodedLen;
+
+  switch(parser->state) {
+  case IOTSTREAMPARSER_STATE_TEXT:
+    if(c == '<') {
+      if(parser->inEntity) {
+        return FAIL;
+      }
+      // The text is handed out once we know the tag that ends it
+      parser->textEnd = chunk + i;
+      parser->state = IOTSTREAMPARSER_STATE_TAG_OPEN;
+
+    } else if(parser->depth == 0) {
+      // Whitespace between the prolog and the root element
+      break;
+
+    } else if(parser->inEntity) {
+      if(c == ';') {
+        if(_iotstreamparser_decodeEntity(parser, decoded, &decodedLen) != SUCCESS) {
+          return FAIL;
+        }
+        _iotstreamparser_appendText(parser, decoded, decodedLen);
+        parser->inEntity = false;
+
+      } else if(parser->entityLen < IOTSTREAMPARSER_ENTITY_SIZE - 1) {
+        parser->entity[parser->entityLen++] = c;
+
+      } else {
+        return FAIL;
+      }
+
+    } else if(c == '&') {
+      // Entities force the text out of the caller's buffer
+      _iotstreamparser_spillText(parser, chunk + i);
+      parser->textSpilled = true;
+      parser->inEntity = true;
+      parser->entityLen = 0;
+
+    } else if(parser->textSpilled) {
+      _iotstreamparser_appendText(parser, &c, 1);
+
+    } else if(parser->textStart == NULL) {
+      parser->textStart = chunk + i;
+    }
+    break;
+
+  case IOTSTREAMPARSER_STATE_TAG_OPEN:
+    parser->nameLen = 0;
+    parser->matched = 0;
+
+    if(c == '/') {
+      parser->state = IOTSTREAMPARSER_STATE_END_TAG_NAME;
+
+    } else if(c == '?') {
+      // Text on either side of a comment or processing instruction is
+      // joined into a single text node
+      _iotstreamparser_spillText(parser, parser->textEnd);
+      parser->state = IOTSTREAMPARSER_STATE_PROCESSING_INSTRUCTION;
+
+    } else if(c == '!') {
+      _iotstreamparser_spillText(parser, parser->textEnd);
+      parser->state = IOTSTREAMPARSER_STATE_DECLARATION;
+
+    } else if(_iotstreamparser_isNameStart(c)) {
+      parser->name[parser->nameLen++] = c;
+      parser->totalAttrs = 0;
+      parser->state = IOTSTREAMPARSER_STATE_START_TAG_NAME;
+
+    } else {
+      return FAIL;
+    }
+    break;
+
+  case IOTSTREAMPARSER_STATE_START_TAG_NAME:
+    if(_iotstreamparser_isName(c)) {
+      if(parser->nameLen >= IOTSTREAMPARSER_NAME_SIZE - 1) {
+        return FAIL;
+      }
+      parser->name[parser->nameLen++] = c;
+
+    } else if(isspace((unsigned char) c)) {
+      parser->state = IOTSTREAMPARSER_STATE_IN_TAG;
+
+    } else if(c == '>') {
+      if(_iotstreamparser_startElement(parser) != SUCCESS) {
+        return FAIL;
+      }
+      parser->state = IOTSTREAMPARSER_STATE_TEXT;
+
+    } else if(c == '/') {
+      parser->state = IOTSTREAMPARSER_STATE_EMPTY_TAG;
+
+    } else {
+      return FAIL;
+    }
+    break;
+
+  case IOTSTREAMPARSER_STATE_IN_TAG:
+    if(isspace((unsigned char) c)) {
+      break;
+
+    } else if(c == '>') {
+      if(_iotstreamparser_startElement(parser) != SUCCESS) {
+        return FAIL;
+      }
+      parser->state = IOTSTREAMPARSER_STATE_TEXT;
+
+    } else if(c == '/') {
+      parser->state = IOTSTREAMPARSER_STATE_EMPTY_TAG;
+
+    } else if(_iotstreamparser_isNameStart(c)) {
+      // Attributes past IOTSTREAMPARSER_MAX_ATTRIBUTES are checked but not kept
+      parser->attrNameLen = 1;
+      parser->attrValueLen = 0;
+      if(parser->totalAttrs < IOTSTREAMPARSER_MAX_ATTRIBUTES) {
+        parser->attrNames[parser->totalAttrs][0] = c;
+      }
+      parser->state = IOTSTREAMPARSER_STATE_ATTRIBUTE_NAME;
+
+    } else {
+      return FAIL;
+    }
+    break;
+
+  case IOTSTREAMPARSER_STATE_ATTRIBUTE_NAME:
+    if(_iotstreamparser_isName(c)) {
+      if(parser->attrNameLen >= IOTSTREAMPARSER_NAME_SIZE - 1) {
+        return FAIL;
+      }
+      if(parser->totalAttrs < IOTSTREAMPARSER_MAX_ATTRIBUTES) {
+        parser->attrNames[parser->totalAttrs][parser->attrNameLen] = c;
+      }
+      parser->attrNameLen++;
+
+    } else if(isspace((unsigned char) c)) {
+      parser->state = IOTSTREAMPARSER_STATE_ATTRIBUTE_EQUALS;
+
+    } else if(c == '=') {
+      parser->state = IOTSTREAMPARSER_STATE_ATTRIBUTE_QUOTE;
+
+    } else {
+      return FAIL;
+    }
+    break;
+
+  case IOTSTREAMPARSER_STATE_ATTRIBUTE_EQUALS:
+    if(c == '=') {
+      parser->state = IOTSTREAMPARSER_STATE_ATTRIBUTE_QUOTE;
+
+    } else if(!isspace((unsigned char) c)) {
+      return FAIL;
+    }
+    break;
+
+  case IOTSTREAMPARSER_STATE_ATTRIBUTE_QUOTE:
+    if(c == '"' || c == '\'') {
+      parser->quote = c;
+      parser->state = IOTSTREAMPARSER_STATE_ATTRIBUTE_VALUE;
+
+    } else if(!isspace((unsigned char) c)) {
+      return FAIL;
+    }
+    break;
+
+  case IOTSTREAMPARSER_STATE_ATTRIBUTE_VALUE:
+    decodedLen = 0;
+
+    if(parser->inEntity) {
+      if(c == ';') {
+        if(_iotstreamparser_decodeEntity(parser, decoded, &decodedLen) != SUCCESS) {
+          return FAIL;
+        }
+        parser->inEntity = false;
+
+      } else if(parser->entityLen < IOTSTREAMPARSER_ENTITY_SIZE - 1) {
+        parser->entity[parser->entityLen++] = c;
+
+      } else {
+        return FAIL;
+      }
+
+    } else if(c == parser->quote) {
+      if(parser->totalAttrs < IOTSTREAMPARSER_MAX_ATTRIBUTES) {
+        parser->attrNames[parser->totalAttrs][parser->attrNameLen] = '\0';
+        parser->attrValues[parser->totalAttrs][parser->attrValueLen] = '\0';
+        parser->totalAttrs++;
+      }
+      parser->state = IOTSTREAMPARSER_STATE_IN_TAG;
+
+    } else if(c == '&') {
+      parser->inEntity = true;
+      parser->entityLen = 0;
+
+    } else if(c == '<') {
+      return FAIL;
+
+    } else {
+      decoded[0] = c;
+      decodedLen = 1;
+    }
+
+    if(parser->attrValueLen + decodedLen >= IOTSTREAMPARSER_ATTRIBUTE_VALUE_SIZE) {
+      return FAIL;
+    }
+    if(parser->totalAttrs < IOTSTREAMPARSER_MAX_ATTRIBUTES) {
+      memcpy(&parser->attrValues[parser->totalAttrs][parser->attrValueLen], decoded, decodedLen);
+    }
+    parser->attrValueLen += decodedLen;
+    break;
+
+  case IOTSTREAMPARSER_STATE_EMPTY_TAG:
+    if(c != '>') {
+      return FAIL;
+    }
+
+    if(_iotstreamparser_startElement(parser) != SUCCESS
+        || _iotstreamparser_endElement(parser) != SUCCESS) {
+      return FAIL;
+    }
+    parser->state = IOTSTREAMPARSER_STATE_TEXT;
+    break;
+
+  case IOTSTREAMPARSER_STATE_END_TAG_NAME:
+    if(_iotstreamparser_isName(c)) {
+      if(parser->nameLen >= IOTSTREAMPARSER_NAME_SIZE - 1) {
+        return FAIL;
+      }
+      parser->name[parser->nameLen++] = c;
+
+    } else if(isspace((unsigned char) c) && parser->nameLen > 0) {
+      parser->state = IOTSTREAMPARSER_STATE_END_TAG_CLOSE;
+
+    } else if(c == '>' && parser->nameLen > 0) {
+      if(_iotstreamparser_endElement(parser) != SUCCESS) {
+        return FAIL;
+      }
+      parser->state = IOTSTREAMPARSER_STATE_TEXT;
+
+    } else {
+      return FAIL;
+    }
+    break;
+
+  case IOTSTREAMPARSER_STATE_END_TAG_CLOSE:
+    if(c == '>') {
+      if(_iotstreamparser_endElement(parser) != SUCCESS) {
+        return FAIL;
+      }
+      parser->state = IOTSTREAMPARSER_STATE_TEXT;
+
+    } else if(!isspace((unsigned char) c)) {
+      return FAIL;
+    }
+    break;
+
+  case IOTSTREAMPARSER_STATE_PROCESSING_INSTRUCTION:
+    // Skip everything up to "?>"
+    if(c == '>' && parser->matched == 1) {
+      parser->state = IOTSTREAMPARSER_STATE_TEXT;
+    } else {
+      parser->matched = (c == '?');
+    }
+    break;
+
+  case IOTSTREAMPARSER_STATE_DECLARATION:
+    // "<!--" starts a comment, "<![CDATA[" starts a CDATA section,
+    // anything else (<!DOCTYPE ..>) is skipped up to the next '>'
+    if(parser->nameLen < IOTSTREAMPARSER_NAME_SIZE - 1) {
+      parser->name[parser->nameLen++] = c;
+    }
+
+    if(parser->nameLen == 2 && strncmp(parser->name, "--", 2) == 0) {
+      parser->matched = 0;
+      parser->state = IOTSTREAMPARSER_STATE_COMMENT;
+
+    } else if(parser->nameLen == 7 && strncmp(parser->name, "[CDATA[", 7) == 0) {
+      parser->matched = 0;
+      parser->state = IOTSTREAMPARSER_STATE_CDATA;
+
+    } else if(c == '>') {
+      parser->state = IOTSTREAMPARSER_STATE_TEXT;
+    }
+    break;
+
+  case IOTSTREAMPARSER_STATE_COMMENT:
+    // Skip everything up to "-->"
+    if(c == '>' && parser->matched >= 2) {
+      parser->state = IOTSTREAMPARSER_STATE_TEXT;
+    } else if(c == '-') {
+      parser->matched++;
+    } else {
+      parser->matched = 0;
+    }
+    break;
+
+  case IOTSTREAMPARSER_STATE_CDATA:
+    // Everything up to "]]>" is text, the same as libxml2 hands it to its
+    // characters handler.  The ']'s that might start "]]>" are held back
+    // until the next character shows whether they do.
+    if(c == '>' && parser->matched >= 2) {
+      parser->state = IOTSTREAMPARSER_STATE_TEXT;
+
+    } else if(c == ']') {
+      if(parser->matched == 2) {
+        _iotstreamparser_appendText(parser, "]", 1);
+      } else {
+        parser->matched++;
+      }
+
+    } else {
+      _iotstreamparser_appendText(parser, "]]", parser->matched);
+      _iotstreamparser_appendText(parser, &c, 1);
+      parser->matched = 0;
+    }
+    break;
+
+  default:
+    return FAIL;
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * Append text to the value buffer, truncating at IOTPARSER_VALUE_SIZE
+ */
+static void _iotstreamparser_appendText(iotstreamparser_t *parser, const char *text, int len) {
+  if(len > (int) sizeof(parser->value) - 1 - parser->valueLen) {
+    len = sizeof(parser->value) - 1 - parser->valueLen;
+  }
+
+  if(len > 0) {
+    memcpy(parser->value + parser->valueLen, text, len);
+    parser->valueLen += len;
+    parser->value[parser->valueLen] = '\0';
+  }
+
+  parser->textSpilled = true;
+}
+
+/**
+ * Move text that still points into the caller's buffer into the value buffer
+ * @param parser Parser context
+ * @param end End of the text in the caller's buffer
+ */
+static void _iotstreamparser_spillText(iotstreamparser_t *parser, const char *end) {
+  if(parser->textStart != NULL) {
+    _iotstreamparser_appendText(parser, parser->textStart, end - parser->textStart);
+    parser->textStart = NULL;
+  }
+}
+
+/**
+ * Hand the current text node to the characters handler in one piece
+ */
+static void _iotstreamparser_flushText(iotstreamparser_t *parser) {
+  if(parser->depth > 0 && parser->characters != NULL) {
+    if(parser->textStart != NULL) {
+      parser->characters(parser->ctx, parser->textStart, parser->textEnd - parser->textStart);
+
+    } else if(parser->textSpilled && parser->valueLen > 0) {
+      parser->characters(parser->ctx, parser->value, parser->valueLen);
+    }
+  }
+
+  parser->textStart = NULL;
+  parser->textSpilled = false;
+  parser->valueLen = 0;
+}
+
+/**
+ * Decode the entity reference collected in parser->entity
+ * @param parser Parser context
+ * @param dest Destination for up to 4 bytes of UTF-8
+ * @param len Number of bytes written to dest
+ * @return SUCCESS if the entity was recognized
+ */
+static error_t _iotstreamparser_decodeEntity(iotstreamparser_t *parser, char *dest, int *len) {
+  unsigned long codepoint;
+  char *end;
+
+  parser->entity[parser->entityLen] = '\0';
+  *len = 1;
+
+  if(strcmp(parser->entity, "lt") == 0) {
+    dest[0] = '<';
+
+  } else if(strcmp(parser->entity, "gt") == 0) {
+    dest[0] = '>';
+
+  } else if(strcmp(parser->entity, "amp") == 0) {
+    dest[0] = '&';
+
+  } else if(strcmp(parser->entity, "quot") == 0) {
+    dest[0] = '"';
+
+  } else if(strcmp(parser->entity, "apos") == 0) {
+    dest[0] = '\'';
+
+  } else if(parser->entity[0] == '#' && parser->entityLen > 1) {
+    if(parser->entity[1] == 'x') {
+      codepoint = strtoul(parser->entity + 2, &end, 16);
+      if(end == parser->entity + 2) {
+        return FAIL;
+      }
+    } else {
+      codepoint = strtoul(parser->entity + 1, &end, 10);
+    }
+
+    if(*end != '\0' || codepoint == 0 || codepoint > 0x10FFFF) {
+      return FAIL;
+    }
+
+    if(codepoint < 0x80) {
+      dest[0] = codepoint;
+
+    } else if(codepoint < 0x800) {
+      dest[0] = 0xC0 | (codepoint >> 6);
+      dest[1] = 0x80 | (codepoint & 0x3F);
+      *len = 2;
+
+    } else if(codepoint < 0x10000) {
+      dest[0] = 0xE0 | (codepoint >> 12);
+      dest[1] = 0x80 | ((codepoint >> 6) & 0x3F);
+      dest[2] = 0x80 | (codepoint & 0x3F);
+      *len = 3;
+
+    } else {
+      dest[0] = 0xF0 | (codepoint >> 18);
+      dest[1] = 0x80 | ((codepoint >> 12) & 0x3F);
+      dest[2] = 0x80 | ((codepoint >> 6) & 0x3F);
+      dest[3] = 0x80 | (codepoint & 0x3F);
+      *len = 4;
+    }
+
+  } else {
+    return FAIL;
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * The start tag is complete, hand it to the start element handler
+ * @return FAIL if the element is nested deeper than IOTSTREAMPARSER_MAX_DEPTH
+ */
+static error_t _iotstreamparser_startElement(iotstreamparser_t *parser) {
+  const char *atts[IOTSTREAMPARSER_MAX_ATTRIBUTES * 2 + 1];
+  int i;
+
+  if(parser->depth == IOTSTREAMPARSER_MAX_DEPTH) {
+    return FAIL;
+  }
+
+  _iotstreamparser_flushText(parser);
+  parser->name[parser->nameLen] = '\0';
+  memcpy(parser->openNames[parser->depth], parser->name, parser->nameLen + 1);
+  parser->depth++;
+
+  for(i = 0; i < parser->totalAttrs; i++) {
+    atts[i * 2] = parser->attrNames[i];
+    atts[i * 2 + 1] = parser->attrValues[i];
+  }
+  atts[i * 2] = NULL;
+
+  if(parser->startElement != NULL) {
+    parser->startElement(parser->ctx, parser->name, parser->totalAttrs > 0 ? atts : NULL);
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * The end tag is complete, hand it to the end element handler
+ * @return FAIL if it doesn't close the innermost open element
+ */
+static error_t _iotstreamparser_endElement(iotstreamparser_t *parser) {
+  parser->name[parser->nameLen] = '\0';
+
+  if(parser->depth == 0 || strcmp(parser->openNames[parser->depth - 1], parser->name) != 0) {
+    return FAIL;
+  }
+
+  _iotstreamparser_flushText(parser);
+  parser->depth--;
+
+  if(parser->endElement != NULL) {
+    parser->endElement(parser->ctx, parser->name);
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * @return true if the character can start an element or attribute name
+ */
+static bool _iotstreamparser_isNameStart(char c) {
+  return isalpha((unsigned char) c) || c == '_' || c == ':' || (c & 0x80);
+}
+
+/**
+ * @return true if the character can continue an element or attribute name
+ */
+static bool _iotstreamparser_isName(char c) {
+  return _iotstreamparser_isNameStart(c) || isdigit((unsigned char) c) || c == '-' || c == '.';
+}
+
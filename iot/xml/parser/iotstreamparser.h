@@ -0,0 +1,150 @@
+/*
+ *  Copyright 2013 People Power Company
+ *
+ *  This code was developed with funding from People Power Company
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef IOTSTREAMPARSER_H
+#define IOTSTREAMPARSER_H
+
+#include <stdbool.h>
+#include "ioterror.h"
+#include "iotparser.h"
+
+/** Maximum number of attributes captured on a single element */
+#ifndef IOTSTREAMPARSER_MAX_ATTRIBUTES
+#define IOTSTREAMPARSER_MAX_ATTRIBUTES 8
+#endif
+
+/** Maximum element nesting depth, <s2h><command><param> needs 3 */
+#ifndef IOTSTREAMPARSER_MAX_DEPTH
+#define IOTSTREAMPARSER_MAX_DEPTH 8
+#endif
+
+/** Maximum size of an element or attribute name, including the null */
+#ifndef IOTSTREAMPARSER_NAME_SIZE
+#define IOTSTREAMPARSER_NAME_SIZE 16
+#endif
+
+/** Maximum size of an attribute value, including the null */
+#ifndef IOTSTREAMPARSER_ATTRIBUTE_VALUE_SIZE
+#define IOTSTREAMPARSER_ATTRIBUTE_VALUE_SIZE 64
+#endif
+
+/** Maximum size of an entity reference like "&quot;" or "&#x20AC;" */
+#ifndef IOTSTREAMPARSER_ENTITY_SIZE
+#define IOTSTREAMPARSER_ENTITY_SIZE 12
+#endif
+
+/** Start element handler, atts is a NULL-terminated list of name/value pairs */
+typedef void (*iotstreamparser_startElement_f)(void *ctx, const char *name, const char **atts);
+
+/** End element handler */
+typedef void (*iotstreamparser_endElement_f)(void *ctx, const char *name);
+
+/** Character handler, called once per text node just before the next element callback */
+typedef void (*iotstreamparser_characters_f)(void *ctx, const char *ch, int len);
+
+/**
+ * Lexical states of the streaming parser
+ */
+typedef enum iotstreamparser_state_e {
+  IOTSTREAMPARSER_STATE_TEXT,
+  IOTSTREAMPARSER_STATE_TAG_OPEN,
+  IOTSTREAMPARSER_STATE_START_TAG_NAME,
+  IOTSTREAMPARSER_STATE_END_TAG_NAME,
+  IOTSTREAMPARSER_STATE_END_TAG_CLOSE,
+  IOTSTREAMPARSER_STATE_IN_TAG,
+  IOTSTREAMPARSER_STATE_ATTRIBUTE_NAME,
+  IOTSTREAMPARSER_STATE_ATTRIBUTE_EQUALS,
+  IOTSTREAMPARSER_STATE_ATTRIBUTE_QUOTE,
+  IOTSTREAMPARSER_STATE_ATTRIBUTE_VALUE,
+  IOTSTREAMPARSER_STATE_EMPTY_TAG,
+  IOTSTREAMPARSER_STATE_PROCESSING_INSTRUCTION,
+  IOTSTREAMPARSER_STATE_DECLARATION,
+  IOTSTREAMPARSER_STATE_COMMENT,
+  IOTSTREAMPARSER_STATE_CDATA,
+  IOTSTREAMPARSER_STATE_ERROR,
+} iotstreamparser_state_e;
+
+/**
+ * Parser context.  Everything the parser needs lives in here, so a parse
+ * never touches the heap.  Declare it on the stack or statically and
+ * initialize it with iotstreamparser_init(..)
+ */
+typedef struct iotstreamparser_t {
+
+  /** Handlers and the opaque context passed back to them */
+  iotstreamparser_startElement_f startElement;
+  iotstreamparser_endElement_f endElement;
+  iotstreamparser_characters_f characters;
+  void *ctx;
+
+  /** Current lexical state */
+  iotstreamparser_state_e state;
+
+  /** Element nesting depth */
+  int depth;
+
+  /** Names of the open elements, so each end tag can be matched to its start tag */
+  char openNames[IOTSTREAMPARSER_MAX_DEPTH][IOTSTREAMPARSER_NAME_SIZE];
+
+  /** Generic counter used while matching "-->", "]]>", "?>", etc. */
+  int matched;
+
+  /** Name of the element being opened or closed */
+  char name[IOTSTREAMPARSER_NAME_SIZE];
+  int nameLen;
+
+  /** Attributes of the element being opened */
+  char attrNames[IOTSTREAMPARSER_MAX_ATTRIBUTES][IOTSTREAMPARSER_NAME_SIZE];
+  char attrValues[IOTSTREAMPARSER_MAX_ATTRIBUTES][IOTSTREAMPARSER_ATTRIBUTE_VALUE_SIZE];
+  int attrNameLen;
+  int attrValueLen;
+  int totalAttrs;
+  char quote;
+
+  /** Entity reference being decoded */
+  char entity[IOTSTREAMPARSER_ENTITY_SIZE];
+  int entityLen;
+  bool inEntity;
+
+  /**
+   * Text node in progress.  While a text node sits entirely inside one chunk
+   * with no entity references, textStart and textEnd point straight into the
+   * caller's buffer.  Otherwise the text is spilled into the value buffer.
+   */
+  const char *textStart;
+  const char *textEnd;
+  bool textSpilled;
+  char value[IOTPARSER_VALUE_SIZE];
+  int valueLen;
+
+} iotstreamparser_t;
+
+
+/***************** Public Prototypes ****************/
+void iotstreamparser_init(iotstreamparser_t *parser,
+    iotstreamparser_startElement_f startElement,
+    iotstreamparser_endElement_f endElement,
+    iotstreamparser_characters_f characters,
+    void *ctx);
+
+error_t iotstreamparser_parseChunk(iotstreamparser_t *parser, const char *chunk, int len);
+
+error_t iotstreamparser_finish(iotstreamparser_t *parser);
+
+#endif
+
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2011 People Power Company
+ * All rights reserved.
+ *
+ * This open source code was developed with funding from People Power Company
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the People Power Corporation nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * PEOPLE POWER CO. OR ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE
+ */
+
+
+
+#include <string.h>
+#include <stdio.h>
+#include <iostream>
+#include <fstream>
+#include <rpc/types.h>
+
+#include "cppunit/extensions/HelperMacros.h"
+
+extern "C" {
+#include "iotdebug.h"
+#include "ioterror.h"
+#include "iotcodec.h"
+#include "iotcodec_test.h"
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION( IotCodecTest );
+
+/** A typical message, as the XML codec writes it */
+static const char *measureXml =
+    "<h2s ver=\"2\" hubId=\"HUB-1\" seq=\"7\">"
+    "<measure deviceId=\"DEVICE-1\" deviceType=\"2\" timestamp=\"2013-04-01T12:00:00-07:00\">"
+    "<param name=\"power\" multiplier=\"m\">1250</param>"
+    "<param name=\"energy\">-12</param>"
+    "<param name=\"temp\" index=\"1\">72.5</param>"
+    "<param name=\"outletStatus\">ON</param>"
+    "</measure>"
+    "<add deviceId=\"DEVICE-2\" deviceType=\"2\" />"
+    "</h2s>";
+
+/**
+ * Write {"h2s": {_ "hubId": hubId}} in CBOR, hubId being at most 255 bytes
+ * @return the length of the message
+ */
+static int cborHubId(char *dest, const char *hubId) {
+  int len = 0;
+
+  dest[len++] = (char) 0xA1;
+  dest[len++] = (char) 0x63;
+  memcpy(dest + len, "h2s", 3);
+  len += 3;
+  dest[len++] = (char) 0xBF;
+  dest[len++] = (char) 0x65;
+  memcpy(dest + len, "hubId", 5);
+  len += 5;
+  dest[len++] = (char) 0x78;
+  dest[len++] = (char) strlen(hubId);
+  memcpy(dest + len, hubId, strlen(hubId));
+  len += strlen(hubId);
+  dest[len++] = (char) 0xFF;
+  return len;
+}
+
+void IotCodecTest::testFind(void) {
+  CPPUNIT_ASSERT_MESSAGE("Default codec not found", iotcodec_find(IOTCODEC_DEFAULT) == &iotcodecxml);
+  CPPUNIT_ASSERT_MESSAGE("JSON codec not found", iotcodec_find("json") == &iotcodecjson);
+  CPPUNIT_ASSERT_MESSAGE("CBOR codec not found", iotcodec_find("cbor") == &iotcodeccbor);
+  CPPUNIT_ASSERT_MESSAGE("Found a codec that doesn't exist", iotcodec_find("yaml") == NULL);
+}
+
+void IotCodecTest::testJsonRoundTrip(void) {
+  char json[2048];
+  char xml[2048];
+  int len;
+
+  len = iotcodec_transcode(&iotcodecxml, &iotcodecjson, measureXml, strlen(measureXml), json, sizeof(json));
+  CPPUNIT_ASSERT_MESSAGE("Couldn't write JSON", len > 0);
+  CPPUNIT_ASSERT_MESSAGE("Unexpected JSON layout", strstr(json, "{\"param\":{\"name\":\"power\",\"multiplier\":\"m\",\"value\":\"1250\"}}") != NULL);
+  CPPUNIT_ASSERT_MESSAGE("Empty element has items", strstr(json, "{\"add\":{\"deviceId\":\"DEVICE-2\",\"deviceType\":\"2\"}}") != NULL);
+
+  len = iotcodec_transcode(&iotcodecjson, &iotcodecxml, json, len, xml, sizeof(xml));
+  CPPUNIT_ASSERT_MESSAGE("Couldn't read JSON", len > 0);
+  CPPUNIT_ASSERT_MESSAGE("JSON round trip changed the message", strcmp(xml, measureXml) == 0);
+}
+
+void IotCodecTest::testCborRoundTrip(void) {
+  char cbor[2048];
+  char xml[2048];
+  int len;
+
+  len = iotcodec_transcode(&iotcodecxml, &iotcodeccbor, measureXml, strlen(measureXml), cbor, sizeof(cbor));
+  CPPUNIT_ASSERT_MESSAGE("Couldn't write CBOR", len > 0);
+  CPPUNIT_ASSERT_MESSAGE("CBOR isn't smaller than XML", len < (int) strlen(measureXml) / 2);
+
+  len = iotcodec_transcode(&iotcodeccbor, &iotcodecxml, cbor, len, xml, sizeof(xml));
+  CPPUNIT_ASSERT_MESSAGE("Couldn't read CBOR", len > 0);
+  CPPUNIT_ASSERT_MESSAGE("CBOR round trip changed the message", strcmp(xml, measureXml) == 0);
+}
+
+void IotCodecTest::testEscaping(void) {
+  const char *xmlIn = "<s2h><command type=\"a&quot;b\">x &lt; y &amp; \"z\"</command></s2h>";
+  const char *xmlOut = "<s2h><command type=\"a&quot;b\">x &lt; y &amp; &quot;z&quot;</command></s2h>";
+  const char *jsonIn = "{\"s2h\":{\"items\":[{\"command\":{\"value\":\"line\\nbreak \\u00e9\",\"cmdId\":12}}]}}";
+  char json[512];
+  char xml[512];
+  int len;
+
+  len = iotcodec_transcode(&iotcodecxml, &iotcodecjson, xmlIn, strlen(xmlIn), json, sizeof(json));
+  CPPUNIT_ASSERT_MESSAGE("Couldn't write JSON", len > 0);
+  CPPUNIT_ASSERT_MESSAGE("Quote wasn't escaped", strstr(json, "\"x < y & \\\"z\\\"\"") != NULL);
+
+  len = iotcodec_transcode(&iotcodecjson, &iotcodecxml, json, len, xml, sizeof(xml));
+  CPPUNIT_ASSERT_MESSAGE("Escaped text didn't survive", len > 0 && strcmp(xml, xmlOut) == 0);
+
+  len = iotcodec_transcode(&iotcodecjson, &iotcodecxml, jsonIn, strlen(jsonIn), xml, sizeof(xml));
+  CPPUNIT_ASSERT_MESSAGE("Couldn't read JSON escapes", len > 0);
+  CPPUNIT_ASSERT_MESSAGE("Number attribute wasn't read", strstr(xml, "cmdId=\"12\"") != NULL);
+  CPPUNIT_ASSERT_MESSAGE("Value written before attributes", strstr(xml, ">line\nbreak \xc3\xa9</command>") != NULL);
+}
+
+void IotCodecTest::testOverflow(void) {
+  char dest[64];
+
+  CPPUNIT_ASSERT_MESSAGE("JSON overflow wasn't reported",
+      iotcodec_transcode(&iotcodecxml, &iotcodecjson, measureXml, strlen(measureXml), dest, sizeof(dest)) < 0);
+  CPPUNIT_ASSERT_MESSAGE("CBOR overflow wasn't reported",
+      iotcodec_transcode(&iotcodecxml, &iotcodeccbor, measureXml, strlen(measureXml), dest, sizeof(dest)) < 0);
+  CPPUNIT_ASSERT_MESSAGE("Malformed JSON was read",
+      iotcodec_transcode(&iotcodecjson, &iotcodecxml, "{\"h2s\":{", 8, dest, sizeof(dest)) < 0);
+}
+
+void IotCodecTest::testLongValues(void) {
+  char json[512];
+  char cbor[512];
+  char xml[512];
+  char value[81];
+  int len;
+
+  memset(value, 'x', sizeof(value) - 1);
+  value[sizeof(value) - 1] = '\0';
+
+  len = snprintf(json, sizeof(json), "{\"h2s\":{\"hubId\":\"%s\"}}", value);
+  CPPUNIT_ASSERT_MESSAGE("Long JSON attribute was truncated",
+      iotcodec_transcode(&iotcodecjson, &iotcodecxml, json, len, xml, sizeof(xml)) < 0);
+
+  len = snprintf(json, sizeof(json), "{\"averyveryverylongname\":{}}");
+  CPPUNIT_ASSERT_MESSAGE("Long JSON element name was truncated",
+      iotcodec_transcode(&iotcodecjson, &iotcodecxml, json, len, xml, sizeof(xml)) < 0);
+
+  CPPUNIT_ASSERT_MESSAGE("Unterminated JSON string was read",
+      iotcodec_transcode(&iotcodecjson, &iotcodecxml, "{\"h2s\":{\"a\":\"", 14, xml, sizeof(xml)) < 0);
+
+  len = cborHubId(cbor, value);
+  CPPUNIT_ASSERT_MESSAGE("Long CBOR attribute was truncated",
+      iotcodec_transcode(&iotcodeccbor, &iotcodecxml, cbor, len, xml, sizeof(xml)) < 0);
+
+  len = cborHubId(cbor, "HUB-1");
+  len = iotcodec_transcode(&iotcodeccbor, &iotcodecxml, cbor, len, xml, sizeof(xml));
+  CPPUNIT_ASSERT_MESSAGE("CBOR attribute that fits wasn't read", len > 0 && strcmp(xml, "<h2s hubId=\"HUB-1\" />") == 0);
+}
@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2011 People Power Company
+ * All rights reserved.
+ *
+ * This open source code was developed with funding from People Power Company
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the People Power Corporation nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * PEOPLE POWER CO. OR ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE
+ */
+
+#include <limits.h>
+#include <time.h>
+#include <sys/time.h>
+#include <string.h>
+#include <stdio.h>
+#include <iostream>
+#include <fstream>
+#include <rpc/types.h>
+
+#include "cppunit/extensions/HelperMacros.h"
+
+extern "C" {
+#include "iotdebug.h"
+#include "ioterror.h"
+#include "iotapi.h"
+#include "iotcommandlisteners.h"
+#include "iotcommandlisteners_test.h"
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION( IotCommandListenersTest );
+
+static int setCalls;
+
+static int deleteCalls;
+
+static int anyCalls;
+
+static int deviceCalls;
+
+static int nameCalls;
+
+static void setListener(command_t *cmd) {
+  setCalls++;
+}
+
+static void deleteListener(command_t *cmd) {
+  deleteCalls++;
+}
+
+static void anyListener(command_t *cmd) {
+  anyCalls++;
+}
+
+static void deviceListener(command_t *cmd) {
+  deviceCalls++;
+}
+
+static void nameListener(command_t *cmd) {
+  nameCalls++;
+}
+
+static void selfRemovingListener(command_t *cmd) {
+  iotxml_removeCommandListener(selfRemovingListener);
+  iotxml_addCommandListener(deleteListener, (char *) "delete");
+}
+
+static void resetCalls() {
+  setCalls = 0;
+  deleteCalls = 0;
+  anyCalls = 0;
+  deviceCalls = 0;
+  nameCalls = 0;
+}
+
+static void makeCommand(command_t *cmd, const char *type, const char *deviceId, const char *name) {
+  memset(cmd, 0x0, sizeof(command_t));
+  strncpy(cmd->commandType, type, sizeof(cmd->commandType));
+  strncpy(cmd->deviceId, deviceId, sizeof(cmd->deviceId));
+  strncpy(cmd->commandName, name, sizeof(cmd->commandName));
+}
+
+void IotCommandListenersTest::testExactType(void) {
+  command_t cmd;
+
+  resetCalls();
+  CPPUNIT_ASSERT_MESSAGE("Wrong number of listeners registered", iotcommandlisteners_totalListeners() == 0);
+  CPPUNIT_ASSERT_MESSAGE("Couldn't add set listener", iotxml_addCommandListener(setListener, (char *) "set") == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Couldn't add delete listener", iotxml_addCommandListener(deleteListener, (char *) "delete") == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Couldn't add any listener", iotxml_addCommandListener(anyListener, NULL) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Couldn't add set listener again", iotxml_addCommandListener(setListener, (char *) "set") == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Wrong number of listeners registered", iotcommandlisteners_totalListeners() == 3);
+
+  makeCommand(&cmd, "set", "", "");
+  iotcommandlisteners_broadcast(&cmd);
+  makeCommand(&cmd, "settings", "", "");
+  iotcommandlisteners_broadcast(&cmd);
+  makeCommand(&cmd, "del", "", "");
+  iotcommandlisteners_broadcast(&cmd);
+
+  CPPUNIT_ASSERT_MESSAGE("Set listener matched the wrong types", setCalls == 1);
+  CPPUNIT_ASSERT_MESSAGE("Delete listener matched a partial type", deleteCalls == 0);
+  CPPUNIT_ASSERT_MESSAGE("Any listener missed a command", anyCalls == 3);
+
+  CPPUNIT_ASSERT_MESSAGE("Couldn't remove set listener", iotxml_removeCommandListener(setListener) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Removed set listener twice", iotxml_removeCommandListener(setListener) == FAIL);
+  CPPUNIT_ASSERT_MESSAGE("Couldn't remove delete listener", iotxml_removeCommandListener(deleteListener) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Couldn't remove any listener", iotxml_removeCommandListener(anyListener) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Wrong number of listeners registered", iotcommandlisteners_totalListeners() == 0);
+}
+
+void IotCommandListenersTest::testFilters(void) {
+  command_t cmd;
+
+  resetCalls();
+  iotxml_addCommandListenerFor(deviceListener, "set", "DEVICE-1", NULL);
+  iotxml_addCommandListenerFor(nameListener, "set", NULL, "outletStatus");
+
+  makeCommand(&cmd, "set", "DEVICE-1", "outletStatus");
+  iotcommandlisteners_broadcast(&cmd);
+  makeCommand(&cmd, "set", "DEVICE-2", "outletStatus");
+  iotcommandlisteners_broadcast(&cmd);
+  makeCommand(&cmd, "set", "DEVICE-1", "energy");
+  iotcommandlisteners_broadcast(&cmd);
+
+  CPPUNIT_ASSERT_MESSAGE("Device filter didn't work", deviceCalls == 2);
+  CPPUNIT_ASSERT_MESSAGE("Command name filter didn't work", nameCalls == 2);
+
+  // Everybody gets to hear there are no more commands
+  makeCommand(&cmd, "set", "", "");
+  cmd.noMoreCommands = true;
+  iotcommandlisteners_broadcast(&cmd);
+  CPPUNIT_ASSERT_MESSAGE("Device listener missed noMoreCommands", deviceCalls == 3);
+  CPPUNIT_ASSERT_MESSAGE("Name listener missed noMoreCommands", nameCalls == 3);
+
+  iotxml_removeCommandListener(deviceListener);
+  iotxml_removeCommandListener(nameListener);
+  CPPUNIT_ASSERT_MESSAGE("Wrong number of listeners registered", iotcommandlisteners_totalListeners() == 0);
+}
+
+void IotCommandListenersTest::testManyListeners(void) {
+  command_t cmd;
+  char deviceId[EUI64_STRING_SIZE];
+  int i;
+
+  resetCalls();
+  for(i = 0; i < 50; i++) {
+    snprintf(deviceId, sizeof(deviceId), "DEVICE-%d", i);
+    CPPUNIT_ASSERT_MESSAGE("Couldn't add a device listener", iotxml_addCommandListenerFor(deviceListener, "set", deviceId, NULL) == SUCCESS);
+  }
+  CPPUNIT_ASSERT_MESSAGE("Wrong number of listeners registered", iotcommandlisteners_totalListeners() == 50);
+
+  makeCommand(&cmd, "set", "DEVICE-42", "");
+  iotcommandlisteners_broadcast(&cmd);
+  CPPUNIT_ASSERT_MESSAGE("Wrong number of device listeners called", deviceCalls == 1);
+
+  CPPUNIT_ASSERT_MESSAGE("Couldn't remove device listeners", iotxml_removeCommandListener(deviceListener) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Wrong number of listeners registered", iotcommandlisteners_totalListeners() == 0);
+}
+
+void IotCommandListenersTest::testRemoveWhileBroadcasting(void) {
+  command_t cmd;
+
+  resetCalls();
+  iotxml_addCommandListener(selfRemovingListener, (char *) "set");
+
+  makeCommand(&cmd, "set", "", "");
+  iotcommandlisteners_broadcast(&cmd);
+  iotcommandlisteners_broadcast(&cmd);
+
+  CPPUNIT_ASSERT_MESSAGE("Listener added during a broadcast was called", deleteCalls == 0);
+  CPPUNIT_ASSERT_MESSAGE("Wrong number of listeners registered", iotcommandlisteners_totalListeners() == 1);
+
+  makeCommand(&cmd, "delete", "", "");
+  iotcommandlisteners_broadcast(&cmd);
+  CPPUNIT_ASSERT_MESSAGE("Listener added during a broadcast was lost", deleteCalls == 1);
+
+  iotxml_removeCommandListener(deleteListener);
+}
@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2011 People Power Company
+ * All rights reserved.
+ *
+ * This open source code was developed with funding from People Power Company
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the People Power Corporation nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * PEOPLE POWER CO. OR ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE
+ */
+
+#include <limits.h>
+#include <time.h>
+#include <sys/time.h>
+#include <string.h>
+#include <stdio.h>
+#include <iostream>
+#include <fstream>
+#include <rpc/types.h>
+
+#include "cppunit/extensions/HelperMacros.h"
+
+extern "C" {
+#include "iotdebug.h"
+#include "ioterror.h"
+#include "iotapi.h"
+#include "iotstreamparser.h"
+#include "iotparser_test.h"
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION( IotParserTest );
+
+/** Every command received, one line per command */
+static char received[4096];
+
+static const char *serverMessage =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+    "<s2h ver=\"2\" status=\"CONT\">\n"
+    "<command type=\"set\" cmdId=\"42\" deviceId=\"ABC-123\">\n"
+    "  <param name=\"outletStatus\" index=\"1\">ON</param>\n"
+    "  <param name='label'>a &amp; b &lt;c&gt; &#65;&#x42;</param>\n"
+    "  <param name=\"json\"><![CDATA[{\"a\":[1]]}]]></param>\n"
+    "</command>\n"
+    "<!-- nothing to see here -->\n"
+    "<command type=\"discover\" cmdId=\"43\"/>\n"
+    "<command type=\"ping\" cmdId=\"44\">hello</command>\n"
+    "</s2h>";
+
+/**
+ * Only the first 3 characters of the type are matched, so listen for
+ * each type used in these tests
+ */
+static void commandListener(command_t *cmd) {
+  snprintf(received + strlen(received), sizeof(received) - strlen(received),
+      "%d,%d,%d,%s,%s,%d,%s,%.*s\n",
+      cmd->userIsWatching, cmd->noMoreCommands, cmd->commandId, cmd->deviceId,
+      cmd->commandType, cmd->asciiIndex, cmd->commandName,
+      cmd->argSize, cmd->argument != NULL ? cmd->argument : "");
+}
+
+static void setListener(command_t *cmd) {
+  commandListener(cmd);
+}
+
+static void discoverListener(command_t *cmd) {
+  commandListener(cmd);
+}
+
+static void pingListener(command_t *cmd) {
+  commandListener(cmd);
+}
+
+static void untypedListener(command_t *cmd) {
+  commandListener(cmd);
+}
+
+static void addListeners() {
+  received[0] = '\0';
+  iotxml_addCommandListener(setListener, (char *) "set");
+  iotxml_addCommandListener(discoverListener, (char *) "discover");
+  iotxml_addCommandListener(pingListener, (char *) "ping");
+  iotxml_addCommandListener(untypedListener, (char *) "");
+}
+
+static void removeListeners() {
+  iotxml_removeCommandListener(setListener);
+  iotxml_removeCommandListener(discoverListener);
+  iotxml_removeCommandListener(pingListener);
+  iotxml_removeCommandListener(untypedListener);
+}
+
+/** Text handed to the streaming parser's characters handler */
+static char text[1024];
+
+/** Element events seen by the streaming parser */
+static char events[4096];
+
+static void startElement(void *ctx, const char *name, const char **atts) {
+  snprintf(events + strlen(events), sizeof(events) - strlen(events), "<%s", name);
+  for(; atts != NULL && *atts != NULL; atts += 2) {
+    snprintf(events + strlen(events), sizeof(events) - strlen(events), " %s=%s", atts[0], atts[1]);
+  }
+  snprintf(events + strlen(events), sizeof(events) - strlen(events), ">");
+}
+
+static void endElement(void *ctx, const char *name) {
+  // Text is only guaranteed to be valid up to the next element callback
+  snprintf(events + strlen(events), sizeof(events) - strlen(events), "%s</%s>", text, name);
+  text[0] = '\0';
+}
+
+static void characters(void *ctx, const char *ch, int len) {
+  snprintf(text, sizeof(text), "%.*s", len, ch);
+}
+
+/**
+ * Feed a message to the streaming parser in chunks of the given size,
+ * scribbling over each chunk once the parser is done with it
+ */
+static error_t parseInChunks(const char *xml, int chunkSize) {
+  iotstreamparser_t parser;
+  char chunk[64];
+  int len = strlen(xml);
+  int i;
+  int size;
+
+  events[0] = '\0';
+  text[0] = '\0';
+  iotstreamparser_init(&parser, startElement, endElement, characters, NULL);
+
+  for(i = 0; i < len; i += size) {
+    size = (len - i) < chunkSize ? (len - i) : chunkSize;
+    memcpy(chunk, xml + i, size);
+    if(iotstreamparser_parseChunk(&parser, chunk, size) != SUCCESS) {
+      return FAIL;
+    }
+    memset(chunk, '#', sizeof(chunk));
+  }
+
+  return iotstreamparser_finish(&parser);
+}
+
+/** Commands expected from serverMessage */
+static const char *expectedCommands =
+    "1,0,42,ABC-123,set,49,outletStatus,ON\n"
+    "1,0,42,ABC-123,set,0,label,a & b <c> AB\n"
+    "1,0,42,ABC-123,set,0,json,{\"a\":[1]]}\n"
+    "1,0,43,,discover,0,discover,\n"
+    "1,0,44,,ping,0,ping,hello\n"
+    "1,1,-1,,ping,0,,\n";
+
+void IotParserTest::testCommands(void) {
+  addListeners();
+  CPPUNIT_ASSERT_MESSAGE("Couldn't select the streaming parser", iotxml_setParser(IOTXML_PARSER_STREAM) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Couldn't parse the message", iotxml_parse(serverMessage, strlen(serverMessage)) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Wrong commands received", strcmp(received, expectedCommands) == 0);
+  removeListeners();
+}
+
+void IotParserTest::testParsersMatch(void) {
+  char libxml2Received[sizeof(received)];
+
+  addListeners();
+  CPPUNIT_ASSERT_MESSAGE("Couldn't select the libxml2 parser", iotxml_setParser(IOTXML_PARSER_LIBXML2) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("libxml2 couldn't parse the message", iotxml_parse(serverMessage, strlen(serverMessage)) == SUCCESS);
+  strcpy(libxml2Received, received);
+
+  received[0] = '\0';
+  iotxml_setParser(IOTXML_PARSER_STREAM);
+  CPPUNIT_ASSERT_MESSAGE("Streaming parser couldn't parse the message", iotxml_parse(serverMessage, strlen(serverMessage)) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Parsers produced different commands", strcmp(received, libxml2Received) == 0);
+  removeListeners();
+}
+
+void IotParserTest::testSplitText(void) {
+  // libxml2 delivers long text in several pieces, all of them must arrive
+  char message[1024];
+  char value[401];
+  char *argument;
+
+  memset(value, 'x', sizeof(value) - 1);
+  value[sizeof(value) - 1] = '\0';
+  snprintf(message, sizeof(message), "<s2h><command type=\"set\" cmdId=\"1\"><param name=\"program\">%s</param></command></s2h>", value);
+
+  addListeners();
+  CPPUNIT_ASSERT_MESSAGE("Couldn't select the libxml2 parser", iotxml_setParser(IOTXML_PARSER_LIBXML2) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Couldn't parse the message", iotxml_parse(message, strlen(message)) == SUCCESS);
+
+  argument = strstr(received, "program,");
+  CPPUNIT_ASSERT_MESSAGE("Param wasn't received", argument != NULL);
+  CPPUNIT_ASSERT_MESSAGE("Argument was cut short", strncmp(argument + strlen("program,"), value, strlen(value)) == 0);
+
+  iotxml_setParser(IOTXML_PARSER_STREAM);
+  removeListeners();
+}
+
+void IotParserTest::testChunks(void) {
+  char whole[sizeof(events)];
+  int chunkSize;
+
+  CPPUNIT_ASSERT_MESSAGE("Couldn't parse the whole message", parseInChunks(serverMessage, 64) == SUCCESS);
+  strcpy(whole, events);
+
+  for(chunkSize = 1; chunkSize < 64; chunkSize++) {
+    CPPUNIT_ASSERT_MESSAGE("Couldn't parse the chunked message", parseInChunks(serverMessage, chunkSize) == SUCCESS);
+    CPPUNIT_ASSERT_MESSAGE("Chunked message produced different events", strcmp(whole, events) == 0);
+  }
+}
+
+void IotParserTest::testParseChunk(void) {
+  char chunk[7];
+  int len = strlen(serverMessage);
+  int i;
+  int size;
+
+  addListeners();
+  for(i = 0; i < len; i += size) {
+    size = (len - i) < (int) sizeof(chunk) ? (len - i) : (int) sizeof(chunk);
+    memcpy(chunk, serverMessage + i, size);
+    CPPUNIT_ASSERT_MESSAGE("Couldn't parse a piece of the message", iotxml_parseChunk(chunk, size) == SUCCESS);
+    memset(chunk, '#', sizeof(chunk));
+
+    if(i + size <= (int) (strstr(serverMessage, "</param>") - serverMessage)) {
+      CPPUNIT_ASSERT_MESSAGE("Command arrived before its </param>", received[0] == '\0');
+    }
+  }
+
+  CPPUNIT_ASSERT_MESSAGE("Couldn't finish the message", iotxml_parseFinish() == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Wrong commands received", strcmp(received, expectedCommands) == 0);
+
+  // A new message starts after the last one finished
+  received[0] = '\0';
+  CPPUNIT_ASSERT_MESSAGE("Couldn't parse the next message", iotxml_parseChunk("<s2h status=\"ACK\"/>", 19) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Couldn't finish the next message", iotxml_parseFinish() == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Wrong end of message", strcmp(received, "0,1,-1,,,0,,\n") == 0);
+  removeListeners();
+}
+
+void IotParserTest::testMalformed(void) {
+  CPPUNIT_ASSERT_MESSAGE("Unclosed element was accepted", parseInChunks("<s2h><command>", 8) == FAIL);
+  CPPUNIT_ASSERT_MESSAGE("Unknown entity was accepted", parseInChunks("<s2h>&bogus;</s2h>", 8) == FAIL);
+  CPPUNIT_ASSERT_MESSAGE("Stray end tag was accepted", parseInChunks("</s2h>", 8) == FAIL);
+  CPPUNIT_ASSERT_MESSAGE("Unquoted attribute was accepted", parseInChunks("<s2h a=b></s2h>", 8) == FAIL);
+  CPPUNIT_ASSERT_MESSAGE("Broken message was accepted", iotxml_parse("<s2h><command>", 14) == FAIL);
+  CPPUNIT_ASSERT_MESSAGE("Mismatched end tag was accepted", parseInChunks("<s2h><command></s2h></command>", 8) == FAIL);
+  CPPUNIT_ASSERT_MESSAGE("Misspelled end tag was accepted", parseInChunks("<s2h></s2x>", 8) == FAIL);
+  CPPUNIT_ASSERT_MESSAGE("Long element name was accepted", parseInChunks("<s2habcdefghijklmn></s2habcdefghijklmn>", 8) == FAIL);
+  CPPUNIT_ASSERT_MESSAGE("Long attribute name was accepted", parseInChunks("<s2h abcdefghijklmnop=\"1\"></s2h>", 8) == FAIL);
+  CPPUNIT_ASSERT_MESSAGE("Deep nesting was accepted", parseInChunks("<a><a><a><a><a><a><a><a><a></a></a></a></a></a></a></a></a></a>", 8) == FAIL);
+  CPPUNIT_ASSERT_MESSAGE("Longest element name was refused", parseInChunks("<s2habcdefghijkl></s2habcdefghijkl>", 8) == SUCCESS);
+}
+
+void IotParserTest::testContinuation(void) {
+  const char *message = "<s2h><command type=\"ping\" cmdId=\"1\">CONT</command></s2h>";
+
+  // Only the status on the s2h tag says a user is watching
+  addListeners();
+  CPPUNIT_ASSERT_MESSAGE("Couldn't parse the message", iotxml_parse(message, strlen(message)) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("CONT in a value was taken for the status", strncmp(received, "0,0,1,", 6) == 0);
+  removeListeners();
+}
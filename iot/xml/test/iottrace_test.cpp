@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2011 People Power Company
+ * All rights reserved.
+ *
+ * This open source code was developed with funding from People Power Company
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the People Power Corporation nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * PEOPLE POWER CO. OR ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE
+ */
+
+
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cppunit/extensions/HelperMacros.h"
+
+#include "iottrace_test.h"
+
+extern "C" {
+#include "iotdebug.h"
+#include "ioterror.h"
+#include "iottrace.h"
+}
+
+#define IOTTRACE_TEST_FILENAME "./iottrace_test.json"
+
+CPPUNIT_TEST_SUITE_REGISTRATION( IotTraceTest );
+
+
+void IotTraceTest::testMarkMessage(void) {
+  const char *msg = "<?xml version=\"1.0\" encoding=\"UTF-8\"?><msg><command cmdId=\"12\" type=\"set\"/><command cmdId=\"34\" type=\"set\"/></msg>";
+  char contents[4096];
+  FILE *file;
+  int len;
+
+  unlink(IOTTRACE_TEST_FILENAME);
+  CPPUNIT_ASSERT_MESSAGE("Couldn't start tracing\n", iottrace_start(IOTTRACE_TEST_FILENAME) == SUCCESS);
+
+  iottrace_markMessage(msg, strlen(msg), IOTTRACE_RECEIVED);
+  iottrace_mark(34, IOTTRACE_RESULT, 1);
+  CPPUNIT_ASSERT_MESSAGE("Didn't export 3 trace points\n", iottrace_export(IOTTRACE_TEST_FILENAME) == 3);
+
+  file = fopen(IOTTRACE_TEST_FILENAME, "r");
+  CPPUNIT_ASSERT_MESSAGE("Didn't write the trace file\n", file != NULL);
+  len = fread(contents, 1, sizeof(contents) - 1, file);
+  fclose(file);
+  contents[len] = '\0';
+
+  CPPUNIT_ASSERT_MESSAGE("Trace file doesn't open a JSON array\n", contents[0] == '[');
+  CPPUNIT_ASSERT_MESSAGE("Didn't trace command 12\n", strstr(contents, "\"name\":\"received\",\"cat\":\"command\",\"ph\":\"i\",\"s\":\"t\"") != NULL && strstr(contents, "\"tid\":12,") != NULL);
+  CPPUNIT_ASSERT_MESSAGE("Didn't trace the result of command 34\n", strstr(contents, "\"name\":\"result\"") != NULL && strstr(contents, "\"args\":{\"cmdId\":34,\"arg\":1}") != NULL);
+
+  iottrace_stop();
+  unlink(IOTTRACE_TEST_FILENAME);
+}
+
+void IotTraceTest::testExportOnce(void) {
+  unlink(IOTTRACE_TEST_FILENAME);
+  CPPUNIT_ASSERT_MESSAGE("Couldn't start tracing\n", iottrace_start(IOTTRACE_TEST_FILENAME) == SUCCESS);
+
+  iottrace_mark(56, IOTTRACE_PARSED, 0);
+  iottrace_mark(-1, IOTTRACE_PARSED, 0);
+  CPPUNIT_ASSERT_MESSAGE("Didn't export only the real command\n", iottrace_export(IOTTRACE_TEST_FILENAME) == 1);
+  CPPUNIT_ASSERT_MESSAGE("Exported a trace point twice\n", iottrace_export(IOTTRACE_TEST_FILENAME) == 0);
+
+  iottrace_stop();
+
+  // Nothing is marked once tracing stopped
+  iottrace_mark(78, IOTTRACE_PARSED, 0);
+  CPPUNIT_ASSERT_MESSAGE("Marked a trace point while stopped\n", iottrace_export(IOTTRACE_TEST_FILENAME) == 0);
+  unlink(IOTTRACE_TEST_FILENAME);
+}
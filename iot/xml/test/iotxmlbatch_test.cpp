@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2011 People Power Company
+ * All rights reserved.
+ *
+ * This open source code was developed with funding from People Power Company
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the People Power Corporation nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * PEOPLE POWER CO. OR ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE
+ */
+
+
+#include <limits.h>
+#include <time.h>
+#include <sys/time.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <iostream>
+#include <fstream>
+#include <rpc/types.h>
+
+#include "cppunit/extensions/HelperMacros.h"
+
+extern "C" {
+#include "iotdebug.h"
+#include "ioterror.h"
+#include "iotapi.h"
+#include "iotxmlbatch.h"
+#include "iotxmlcache.h"
+#include "iotxmlbatch_test.h"
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION( IotXmlBatchTest );
+
+/** Frames the batch handed to the application */
+static int totalFrames;
+
+/** Length of the last frame */
+static int lastFrameLen;
+
+/** Copy of the last frame */
+static char lastFrame[IOTXMLBATCH_FRAME_SIZE + 1];
+
+/** What application_send(..) returns */
+static error_t sendResult = SUCCESS;
+
+extern "C" error_t application_send(const char *msg, int len) {
+  totalFrames++;
+  lastFrameLen = len;
+  snprintf(lastFrame, sizeof(lastFrame), "%.*s", len, msg);
+  return sendResult;
+}
+
+static void resetFrames() {
+  totalFrames = 0;
+  lastFrameLen = 0;
+  lastFrame[0] = '\0';
+  sendResult = SUCCESS;
+}
+
+/**
+ * Build one device's block with a single parameter and add it to the batch
+ */
+static void addDevice(iotxmlbatch_t *batch, const char *deviceId, const char *value) {
+  char block[IOTXMLBATCH_FRAME_SIZE * 2];
+  int offset = 0;
+
+  iotxml_newMsg(block, sizeof(block));
+  offset += iotxml_addString(block + offset, sizeof(block) - offset, deviceId, 1, IOT_PARAM_MEASURE, "value", NULL, 0, value);
+  CPPUNIT_ASSERT_MESSAGE("Couldn't add a block", iotxmlbatch_add(batch, block, sizeof(block)) == SUCCESS);
+}
+
+void IotXmlBatchTest::testPacking(void) {
+  iotxmlbatch_t batch;
+
+  resetFrames();
+  iotxmlbatch_init(&batch, 0);
+
+  addDevice(&batch, "DEVICE-1", "1");
+  addDevice(&batch, "DEVICE-2", "2");
+  addDevice(&batch, "DEVICE-3", "3");
+  CPPUNIT_ASSERT_MESSAGE("Frame went out before it was full", totalFrames == 0);
+
+  CPPUNIT_ASSERT_MESSAGE("Couldn't flush", iotxmlbatch_flush(&batch) == SUCCESS);
+  CPPUNIT_ASSERT_MESSAGE("Blocks weren't sent in one frame", totalFrames == 1);
+  CPPUNIT_ASSERT_MESSAGE("Frame length is wrong", lastFrameLen == (int) strlen(lastFrame));
+  CPPUNIT_ASSERT_MESSAGE("First block is missing", strstr(lastFrame, "deviceId=\"DEVICE-1\"") != NULL);
+  CPPUNIT_ASSERT_MESSAGE("Last block is missing", strstr(lastFrame, "deviceId=\"DEVICE-3\"") != NULL);
+  CPPUNIT_ASSERT_MESSAGE("Blocks aren't closed off", strstr(lastFrame, "</measure><measure") != NULL);
+
+  iotxmlbatch_flush(&batch);
+  CPPUNIT_ASSERT_MESSAGE("Empty frame was sent", totalFrames == 1);
+}
+
+void IotXmlBatchTest::testSpill(void) {
+  iotxmlbatch_t batch;
+  char value[64];
+  int blockLen;
+  int i;
+
+  resetFrames();
+  iotxmlbatch_init(&batch, 0);
+  addDevice(&batch, "DEVICE-0", "0");
+  iotxmlbatch_flush(&batch);
+  blockLen = lastFrameLen;
+
+  // Room for 3 blocks, but not 4
+  resetFrames();
+  iotxmlbatch_init(&batch, blockLen * 4 - 1);
+  for(i = 1; i <= 7; i++) {
+    snprintf(value, sizeof(value), "%d", i);
+    addDevice(&batch, "DEVICE-0", value);
+  }
+
+  CPPUNIT_ASSERT_MESSAGE("Full frames weren't spilled", totalFrames == 2);
+  CPPUNIT_ASSERT_MESSAGE("Spilled frame broke the byte budget", lastFrameLen == blockLen * 3);
+  CPPUNIT_ASSERT_MESSAGE("Spilled frame was truncated", strstr(lastFrame, ">6</param></measure>") != NULL);
+
+  iotxmlbatch_flush(&batch);
+  CPPUNIT_ASSERT_MESSAGE("Last block was lost", totalFrames == 3 && strstr(lastFrame, ">7</param>") != NULL);
+}
+
+void IotXmlBatchTest::testOversizedBlock(void) {
+  iotxmlbatch_t batch;
+  char value[256];
+
+  resetFrames();
+  memset(value, 'x', sizeof(value) - 1);
+  value[sizeof(value) - 1] = '\0';
+
+  iotxmlbatch_init(&batch, 128);
+  addDevice(&batch, "DEVICE-1", "1");
+  addDevice(&batch, "DEVICE-2", value);
+
+  CPPUNIT_ASSERT_MESSAGE("Oversized block wasn't sent whole on its own", totalFrames == 2);
+  CPPUNIT_ASSERT_MESSAGE("Oversized block was truncated", strstr(lastFrame, "x</param></measure>") != NULL);
+}
+
+void IotXmlBatchTest::testFailedSend(void) {
+  iotxmlbatch_t batch;
+
+  resetFrames();
+  iotxmlcache_clear();
+  iotxmlcache_setPolicy("value", true, 0, 0);
+  iotxmlbatch_init(&batch, 0);
+
+  addDevice(&batch, "DEVICE-1", "1");
+  iotxmlbatch_flush(&batch);
+  addDevice(&batch, "DEVICE-1", "1");
+  iotxmlbatch_flush(&batch);
+  CPPUNIT_ASSERT_MESSAGE("Unchanged value was sent again", totalFrames == 1);
+
+  addDevice(&batch, "DEVICE-1", "2");
+  sendResult = FAIL;
+  CPPUNIT_ASSERT_MESSAGE("Failed frame was reported as sent", iotxmlbatch_flush(&batch) == FAIL);
+  sendResult = SUCCESS;
+
+  addDevice(&batch, "DEVICE-1", "2");
+  iotxmlbatch_flush(&batch);
+  CPPUNIT_ASSERT_MESSAGE("Value from a failed frame was suppressed", totalFrames == 3 && strstr(lastFrame, ">2</param>") != NULL);
+
+  iotxmlcache_setPolicy("value", false, 0, 0);
+  iotxmlcache_clear();
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2011 People Power Company
+ * All rights reserved.
+ *
+ * This open source code was developed with funding from People Power Company
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the People Power Corporation nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * PEOPLE POWER CO. OR ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE
+ */
+
+
+#include <limits.h>
+#include <time.h>
+#include <sys/time.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <iostream>
+#include <fstream>
+#include <rpc/types.h>
+
+#include "cppunit/extensions/HelperMacros.h"
+
+extern "C" {
+#include "iotdebug.h"
+#include "ioterror.h"
+#include "iotapi.h"
+#include "iotxmlcache.h"
+#include "iotxmlcache_test.h"
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION( IotXmlCacheTest );
+
+void IotXmlCacheTest::testDefaultPolicy(void) {
+  iotxmlcache_clear();
+
+  CPPUNIT_ASSERT_MESSAGE("Default policy suppressed a value", iotxmlcache_shouldSend("DEVICE-1", "plain", 0, "1"));
+  CPPUNIT_ASSERT_MESSAGE("Default policy suppressed a repeated value", iotxmlcache_shouldSend("DEVICE-1", "plain", 0, "1"));
+}
+
+void IotXmlCacheTest::testOnChange(void) {
+  char program[400];
+
+  iotxmlcache_clear();
+  iotxmlcache_setPolicy("program/cool", true, 0, 0);
+
+  memset(program, '1', sizeof(program) - 1);
+  program[sizeof(program) - 1] = '\0';
+
+  CPPUNIT_ASSERT_MESSAGE("First value was suppressed", iotxmlcache_shouldSend("DEVICE-1", "program/cool", 0, program));
+  CPPUNIT_ASSERT_MESSAGE("Unchanged value was sent", !iotxmlcache_shouldSend("DEVICE-1", "program/cool", 0, program));
+  CPPUNIT_ASSERT_MESSAGE("Another device's value was suppressed", iotxmlcache_shouldSend("DEVICE-2", "program/cool", 0, program));
+  CPPUNIT_ASSERT_MESSAGE("Another index was suppressed", iotxmlcache_shouldSend("DEVICE-1", "program/cool", '1', program));
+
+  program[200] = '2';
+  CPPUNIT_ASSERT_MESSAGE("Changed value was suppressed", iotxmlcache_shouldSend("DEVICE-1", "program/cool", 0, program));
+  CPPUNIT_ASSERT_MESSAGE("Unchanged value was sent", !iotxmlcache_shouldSend("DEVICE-1", "program/cool", 0, program));
+
+  CPPUNIT_ASSERT_MESSAGE("Changed value was suppressed", iotxmlcache_shouldSend("DEVICE-2", "program/cool", 0, program));
+
+  iotxmlcache_forget("DEVICE-1");
+  CPPUNIT_ASSERT_MESSAGE("Forgotten value was suppressed", iotxmlcache_shouldSend("DEVICE-1", "program/cool", 0, program));
+  CPPUNIT_ASSERT_MESSAGE("Forgot the wrong device", !iotxmlcache_shouldSend("DEVICE-2", "program/cool", 0, program));
+}
+
+void IotXmlCacheTest::testDeadband(void) {
+  iotxmlcache_clear();
+  iotxmlcache_setPolicy("power", true, 1.0, 0);
+
+  CPPUNIT_ASSERT_MESSAGE("First value was suppressed", iotxmlcache_shouldSend("DEVICE-1", "power", 0, "100.00"));
+  CPPUNIT_ASSERT_MESSAGE("Change within the deadband was sent", !iotxmlcache_shouldSend("DEVICE-1", "power", 0, "100.90"));
+  CPPUNIT_ASSERT_MESSAGE("Creeping change within the deadband was sent", !iotxmlcache_shouldSend("DEVICE-1", "power", 0, "99.10"));
+  CPPUNIT_ASSERT_MESSAGE("Change past the deadband was suppressed", iotxmlcache_shouldSend("DEVICE-1", "power", 0, "101.50"));
+  CPPUNIT_ASSERT_MESSAGE("Non-numeric value was suppressed", iotxmlcache_shouldSend("DEVICE-1", "power", 0, "n/a"));
+}
+
+void IotXmlCacheTest::testMinInterval(void) {
+  iotxmlcache_clear();
+  iotxmlcache_setPolicy("temp", false, 0, 60);
+
+  CPPUNIT_ASSERT_MESSAGE("First value was suppressed", iotxmlcache_shouldSend("DEVICE-1", "temp", 0, "70.00"));
+  CPPUNIT_ASSERT_MESSAGE("Value inside the minimum interval was sent", !iotxmlcache_shouldSend("DEVICE-1", "temp", 0, "71.00"));
+}
+
+void IotXmlCacheTest::testKeyframe(void) {
+  iotxmlcache_clear();
+  iotxmlcache_setPolicy("tmode", true, 0, 0);
+  iotxmlcache_setKeyframePeriod(1);
+
+  CPPUNIT_ASSERT_MESSAGE("First value was suppressed", iotxmlcache_shouldSend("DEVICE-1", "tmode", 0, "1"));
+  CPPUNIT_ASSERT_MESSAGE("Unchanged value was sent", !iotxmlcache_shouldSend("DEVICE-1", "tmode", 0, "1"));
+
+  sleep(2);
+  CPPUNIT_ASSERT_MESSAGE("Keyframe didn't send the unchanged value", iotxmlcache_shouldSend("DEVICE-1", "tmode", 0, "1"));
+  CPPUNIT_ASSERT_MESSAGE("Unchanged value was sent after the keyframe", !iotxmlcache_shouldSend("DEVICE-1", "tmode", 0, "1"));
+
+  iotxmlcache_setKeyframePeriod(IOTXMLCACHE_DEFAULT_KEYFRAME_PERIOD_SEC);
+}
+
+void IotXmlCacheTest::testManyDevices(void) {
+  char deviceId[32];
+  int i;
+
+  iotxmlcache_clear();
+  iotxmlcache_setPolicy("fmode", true, 0, 0);
+
+  for(i = 0; i < 1000; i++) {
+    snprintf(deviceId, sizeof(deviceId), "DEVICE-%d", i);
+    CPPUNIT_ASSERT_MESSAGE("First value was suppressed", iotxmlcache_shouldSend(deviceId, "fmode", 0, "0"));
+  }
+
+  for(i = 0; i < 1000; i++) {
+    snprintf(deviceId, sizeof(deviceId), "DEVICE-%d", i);
+    CPPUNIT_ASSERT_MESSAGE("Value was lost when the cache grew", !iotxmlcache_shouldSend(deviceId, "fmode", 0, "0"));
+  }
+
+  iotxmlcache_clear();
+}
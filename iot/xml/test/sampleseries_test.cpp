@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2011 People Power Company
+ * All rights reserved.
+ *
+ * This open source code was developed with funding from People Power Company
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the People Power Corporation nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * PEOPLE POWER CO. OR ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE
+ */
+
+
+
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "cppunit/extensions/HelperMacros.h"
+
+#include "sampleseries_test.h"
+
+extern "C" {
+#include "iotdebug.h"
+#include "ioterror.h"
+#include "iotapi.h"
+#include "timestamp.h"
+#include "sampleseries.h"
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION( SampleSeriesTest );
+
+/** Count the occurrences of a string in a message */
+static int countOf(const char *msg, const char *str) {
+  int total = 0;
+
+  while((msg = strstr(msg, str)) != NULL) {
+    total++;
+    msg += strlen(str);
+  }
+
+  return total;
+}
+
+void SampleSeriesTest::testWindows(void) {
+  sampleseries_t series;
+  sampleseries_window_t window;
+
+  sampleseries_init(&series, 60, SAMPLESERIES_LAST | SAMPLESERIES_MEAN | SAMPLESERIES_MIN | SAMPLESERIES_MAX, 1);
+  sampleseries_addAt(&series, 1000, 2);
+  sampleseries_addAt(&series, 1010, 1);
+  sampleseries_addAt(&series, 1020, 3);
+  sampleseries_addAt(&series, 1060, 10);
+
+  CPPUNIT_ASSERT_MESSAGE("Window wasn't completed", sampleseries_nextWindow(&series, &window));
+  CPPUNIT_ASSERT_MESSAGE("Wrong window times", window.start == 1000 && window.end == 1020);
+  CPPUNIT_ASSERT_MESSAGE("Wrong window statistics", window.count == 3 && window.min == 1 && window.max == 3 && window.sum == 6 && window.last == 3);
+  CPPUNIT_ASSERT_MESSAGE("Current window was completed early", !sampleseries_nextWindow(&series, &window));
+
+  sampleseries_closeWindow(&series);
+  CPPUNIT_ASSERT_MESSAGE("Closed window is missing", sampleseries_nextWindow(&series, &window) && window.count == 1 && window.last == 10);
+  CPPUNIT_ASSERT_MESSAGE("Raw samples were kept", !series.samples && series.totalSamples == 0);
+  sampleseries_destroy(&series);
+}
+
+void SampleSeriesTest::testRaw(void) {
+  sampleseries_t series;
+  sample_t sample;
+  int i;
+
+  CPPUNIT_ASSERT_MESSAGE("Couldn't allocate raw samples", sampleseries_init(&series, 60, SAMPLESERIES_RAW, 0) == SUCCESS);
+  for(i = 0; i < SAMPLESERIES_MAX_SAMPLES + 5; i++) {
+    sampleseries_addAt(&series, 1000 + i, i);
+  }
+
+  CPPUNIT_ASSERT_MESSAGE("Overwritten samples weren't counted", series.droppedSamples == 5);
+  CPPUNIT_ASSERT_MESSAGE("Oldest samples weren't overwritten", sampleseries_nextSample(&series, &sample) && sample.timestamp == 1005 && sample.value == 5);
+
+  sampleseries_destroy(&series);
+  CPPUNIT_ASSERT_MESSAGE("Samples survived destroy", series.samples == NULL && !sampleseries_nextSample(&series, &sample));
+}
+
+void SampleSeriesTest::testPartialUpload(void) {
+  sampleseries_t series;
+  char msg[1024];
+  int totalMessages = 0;
+  int totalMeans = 0;
+  int offset;
+  int i;
+
+  sampleseries_init(&series, 60, SAMPLESERIES_LAST | SAMPLESERIES_MEAN | SAMPLESERIES_MIN | SAMPLESERIES_MAX, 2);
+  for(i = 0; i < SAMPLESERIES_MAX_WINDOWS; i++) {
+    sampleseries_addAt(&series, 1000 + i * 60, i);
+  }
+  sampleseries_closeWindow(&series);
+
+  while(series.totalWindows > 0 && totalMessages < SAMPLESERIES_MAX_WINDOWS) {
+    iotxml_newMsg(msg, sizeof(msg));
+    offset = sampleseries_addToMsg(msg, sizeof(msg), &series, "DEVICE-1", 1, "power", NULL, 0);
+    CPPUNIT_ASSERT_MESSAGE("Message overflowed", offset < (int) sizeof(msg) - 1 && offset == (int) strlen(msg));
+    CPPUNIT_ASSERT_MESSAGE("Nothing fit in an empty message", offset > 0);
+
+    offset = iotxml_closeMsg(msg, sizeof(msg));
+    CPPUNIT_ASSERT_MESSAGE("Message couldn't be closed off", offset < (int) sizeof(msg) - 1 && strcmp(msg + offset - strlen("</measure>"), "</measure>") == 0);
+
+    totalMeans += countOf(msg, "\"powerMean\"");
+    totalMessages++;
+  }
+
+  CPPUNIT_ASSERT_MESSAGE("Everything fit in one small message", totalMessages > 1);
+  CPPUNIT_ASSERT_MESSAGE("Windows were lost between messages", totalMeans == SAMPLESERIES_MAX_WINDOWS);
+  sampleseries_destroy(&series);
+}
+
+void SampleSeriesTest::testTimestamps(void) {
+  char stamp[TIMESTAMP_STAMP_SIZE];
+  char zone[TIMESTAMP_ZONE_SIZE];
+  char msg[1024];
+  const char *block;
+  time_t when = 1369000000;
+  int offset = 0;
+
+  CPPUNIT_ASSERT_MESSAGE("Timestamp ignored a small buffer", getTimestampAt(stamp, TIMESTAMP_ZONE_SIZE, when) == FAIL);
+  CPPUNIT_ASSERT_MESSAGE("Couldn't write a timestamp", getTimestampAt(stamp, sizeof(stamp), when) > 0);
+  CPPUNIT_ASSERT_MESSAGE("Timestamp didn't read back", parseTimestamp(stamp) == when);
+
+  getTimestamp(stamp, sizeof(stamp));
+  getTimezone(zone, sizeof(zone));
+  CPPUNIT_ASSERT_MESSAGE("Time zones disagree", strcmp(stamp + strlen(stamp) - strlen(zone), zone) == 0);
+
+  // Values captured at different times go in different param blocks
+  iotxml_newMsg(msg, sizeof(msg));
+  offset += iotxml_addStringAt(msg + offset, sizeof(msg) - offset, when, "DEVICE-1", 1, IOT_PARAM_MEASURE, "power", NULL, 0, "1");
+  offset += iotxml_addStringAt(msg + offset, sizeof(msg) - offset, when, "DEVICE-1", 1, IOT_PARAM_MEASURE, "powerMean", NULL, 0, "2");
+  offset += iotxml_addStringAt(msg + offset, sizeof(msg) - offset, when + 60, "DEVICE-1", 1, IOT_PARAM_MEASURE, "power", NULL, 0, "3");
+  iotxml_closeMsg(msg, sizeof(msg));
+
+  CPPUNIT_ASSERT_MESSAGE("Wrong number of param blocks", countOf(msg, "<measure ") == 2 && countOf(msg, "</measure>") == 2);
+
+  block = strstr(msg, "timestamp=\"") + strlen("timestamp=\"");
+  CPPUNIT_ASSERT_MESSAGE("First block has the wrong time", parseTimestamp(block) == when);
+  block = strstr(block, "timestamp=\"") + strlen("timestamp=\"");
+  CPPUNIT_ASSERT_MESSAGE("Second block has the wrong time", parseTimestamp(block) == when + 60);
+}
@@ -48,18 +48,31 @@
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <syslog.h>
 #include <rpc/types.h>
 #include <limits.h>
 #include <stdbool.h>
 
 #include "iotdebug.h"
+#include "libmetrics.h"
 #include "libhttpcomm.h"
 
 struct HttpIoInfo /// structure used to store data to be sent to the server.
 {
     char * buffer;
     int size;
+    const struct iovec * segments; /// further pieces of the message, sent after buffer
+    int totalSegments;
+};
+
+struct HttpRxInfo /// structure used to store data received from the server.
+{
+    char * buffer;
+    int size;
+    int length;
+    void (*RxCallback) (const char *chunk, int len, void *arg);
+    void * rxCallbackArg;
 };
 
 static int _libhttpcomm_configureHttp(CURL * curlHandle, CURLSH * shareCurlHandle, struct curl_slist *slist, CURLoption httpMethod,
@@ -68,6 +81,9 @@ static int _libhttpcomm_configureHttp(CURL * curlHandle, CURLSH * shareCurlHandl
 
 static void _libhttpcomm_closeHttp(CURL * curlHandle, struct curl_slist *slist);
 
+static void _libhttpcomm_recordMetrics(bool failed, double nameResolvingDuration, double connectDuration,
+        double transferDuration, int bytesSent, int bytesReceived);
+
 /**********************************************************************************************//**
  * @brief   Called when a message has to be received from the server. this is a standard streamer
  *              if the size of the data to read, equal to size*nmemb, the function can return
@@ -82,7 +98,7 @@ static void _libhttpcomm_closeHttp(CURL * curlHandle, struct curl_slist *slist);
  ***************************************************************************************************/
 static size_t writer(void *ptr, size_t size, size_t nmemb, void *userp)
 {
-    struct HttpIoInfo *dataToRead = (struct HttpIoInfo *) userp;
+    struct HttpRxInfo *dataToRead = (struct HttpRxInfo *) userp;
     char *data = (char *)ptr;
 
     if (dataToRead == NULL || dataToRead->buffer == NULL)
@@ -92,17 +108,23 @@ static size_t writer(void *ptr, size_t size, size_t nmemb, void *userp)
     }
 
     // keeping one byte for the null byte
-    if((strlen(dataToRead->buffer)+(size * nmemb)) > (dataToRead->size - 1))
+    if((dataToRead->length + (size * nmemb)) > (dataToRead->size - 1))
     {
         SYSLOG_WARNING ("buffer overflow would result -> strlen(writeData): %u, (size * nmemb): %u, max size: %u",
-                strlen(dataToRead->buffer), (size * nmemb), dataToRead->size);
+                dataToRead->length, (size * nmemb), dataToRead->size);
         return 0;
     }
-    else
-    {
 
+    memcpy(dataToRead->buffer + dataToRead->length, data, (size * nmemb));
+    dataToRead->length += (size * nmemb);
+    dataToRead->buffer[dataToRead->length] = '\0';
+
+    // hand the new bytes over while the rest of the response is still in flight
+    if (dataToRead->RxCallback != NULL)
+    {
+        dataToRead->RxCallback(data, (size * nmemb), dataToRead->rxCallbackArg);
     }
-    strncat(dataToRead->buffer, data, (size * nmemb));
+
     return (size * nmemb);
 }
 
@@ -122,8 +144,9 @@ static size_t read_callback(void *ptr, size_t size, size_t nmemb, void *userp)
 {
     struct HttpIoInfo *dataToWrite = (struct HttpIoInfo *) userp;
     int dataWritten = 0;
+    int chunk;
 
-    if (dataToWrite == NULL || dataToWrite->buffer == NULL)
+    if (dataToWrite == NULL || (dataToWrite->buffer == NULL && dataToWrite->totalSegments == 0))
     {
         SYSLOG_ERR ("dataToWrite == NULL");
         return 0;
@@ -135,30 +158,36 @@ static size_t read_callback(void *ptr, size_t size, size_t nmemb, void *userp)
         return 0;
     }
 
-    if (dataToWrite->size > 0)
+    // fill curl's buffer from as many pieces of the message as fit
+    while (dataWritten < size * nmemb)
     {
-        if (dataToWrite->size > (size * nmemb))
+        if (dataToWrite->size <= 0)
         {
-            dataWritten = size * nmemb;
-            SYSLOG_DEBUG("dataToWrite->size = %u is larger than size * nmemb = %u",
-                    dataToWrite->size, size * nmemb);
+            if (dataToWrite->totalSegments == 0)
+            {
+                break;
+            }
+
+            dataToWrite->buffer = (char *) dataToWrite->segments->iov_base;
+            dataToWrite->size = dataToWrite->segments->iov_len;
+            dataToWrite->segments++;
+            dataToWrite->totalSegments--;
+            continue;
         }
-        else
+
+        chunk = size * nmemb - dataWritten;
+        if (chunk > dataToWrite->size)
         {
-            dataWritten = dataToWrite->size;
+            chunk = dataToWrite->size;
         }
-        memcpy (ptr, dataToWrite->buffer, dataWritten);
-        dataToWrite->buffer += dataWritten;
-        dataToWrite->size -= dataWritten;
 
-        return dataWritten; /* we return 1 byte at a time! */
-    }
-    else
-    {
-        return 0;
+        memcpy ((char *) ptr + dataWritten, dataToWrite->buffer, chunk);
+        dataToWrite->buffer += chunk;
+        dataToWrite->size -= chunk;
+        dataWritten += chunk;
     }
 
-    return 0;
+    return dataWritten;
 }
 
 /**
@@ -237,12 +266,98 @@ int libhttpcomm_sendMsg(CURLSH * shareCurlHandle, CURLoption httpMethod, const c
                 char *msgToSendPtr, int msgToSendSize, char *rxBuffer, int maxRxBufferSize, http_param_t params,
                 int (*ProgressCallback) (void *clientp, double dltotal, double dlnow, double ultotal, double ulnow))
 {
+    return libhttpcomm_sendMsgStream(shareCurlHandle, httpMethod, url, sslCertPath, authToken,
+            msgToSendPtr, msgToSendSize, rxBuffer, maxRxBufferSize, params, ProgressCallback, NULL, NULL);
+}
+
+/**
+ * @brief   Sends a message through HTTP to PPC servers, handing each piece of the
+ *              response to a callback as it arrives.  The complete response is
+ *              still collected in rxBuffer.
+ *
+ * @param   shareCurlHandle: Curl handle shared across connections
+ * @param   httpMethod: CURLOPT_POST or CURLOPT_HTTPGET
+ * @param   url: url of the server (hostname + uri)
+ * @param   sslCertPath: location of where the certificate is
+ * @param   authToken: authentication token to be added in the header
+ * @param   msgToSendPtr: ptr to message to send. NULL if none
+ * @param   msgToSendSize: send of msgToSendPtr
+ * @param   rxBuffer: ptr for storing message received by the server -> must exist
+ * @param   maxRxBufferSize: max size of rxBuffer in bytes
+ * @param   timeouts: specifies connect and transfer timeouts for the connection
+ * @param   ProgressCallback: function pointer that will be called every second during the connection
+ * @param   RxCallback: function pointer called with each chunk of the response, NULL if none.
+ *              The chunk is only valid for the duration of the call.
+ * @param   rxCallbackArg: passed back to RxCallback
+ *
+ * @return  true for success, false for failure
+ */
+int libhttpcomm_sendMsgStream(CURLSH * shareCurlHandle, CURLoption httpMethod, const char *url, const char *sslCertPath, const char *authToken,
+                char *msgToSendPtr, int msgToSendSize, char *rxBuffer, int maxRxBufferSize, http_param_t params,
+                int (*ProgressCallback) (void *clientp, double dltotal, double dlnow, double ultotal, double ulnow),
+                void (*RxCallback) (const char *chunk, int len, void *arg), void *rxCallbackArg)
+{
+    return libhttpcomm_sendMsgStreamWithType(shareCurlHandle, httpMethod, url, sslCertPath, authToken,
+            msgToSendPtr, msgToSendSize, rxBuffer, maxRxBufferSize, params, ProgressCallback,
+            RxCallback, rxCallbackArg, NULL);
+}
+
+/**
+ * @brief   Same as libhttpcomm_sendMsgStream, for messages that aren't XML
+ *
+ * @param   contentType: MIME type of the message sent and of the response we
+ *              accept, i.e. "application/json". NULL for XML without an Accept header
+ *
+ * @return  true for success, false for failure
+ */
+int libhttpcomm_sendMsgStreamWithType(CURLSH * shareCurlHandle, CURLoption httpMethod, const char *url, const char *sslCertPath, const char *authToken,
+                char *msgToSendPtr, int msgToSendSize, char *rxBuffer, int maxRxBufferSize, http_param_t params,
+                int (*ProgressCallback) (void *clientp, double dltotal, double dlnow, double ultotal, double ulnow),
+                void (*RxCallback) (const char *chunk, int len, void *arg), void *rxCallbackArg,
+                const char *contentType)
+{
+    struct iovec segment;
+    int result;
+
+    segment.iov_base = msgToSendPtr;
+    segment.iov_len = (msgToSendPtr != NULL && msgToSendSize > 0) ? msgToSendSize : 0;
+
+    result = libhttpcomm_sendMsgVector(shareCurlHandle, httpMethod, url, sslCertPath, authToken,
+            &segment, (msgToSendPtr != NULL) ? 1 : 0, rxBuffer, maxRxBufferSize, params, ProgressCallback,
+            RxCallback, rxCallbackArg, contentType);
+
+    if (result == 0 && msgToSendPtr != NULL)
+    {
+        msgToSendPtr[0] = 0;
+    }
+
+    return result;
+}
+
+/**
+ * @brief   Same as libhttpcomm_sendMsgStreamWithType, for a message in pieces.  The
+ *              pieces are handed to curl one after the other, so a message can be
+ *              framed without copying it into one buffer.
+ *
+ * @param   segments: pieces of the message to send, in order. Must stay valid until we return
+ * @param   totalSegments: number of pieces, 0 if there is no message
+ *
+ * @return  true for success, false for failure
+ */
+int libhttpcomm_sendMsgVector(CURLSH * shareCurlHandle, CURLoption httpMethod, const char *url, const char *sslCertPath, const char *authToken,
+                const struct iovec *segments, int totalSegments, char *rxBuffer, int maxRxBufferSize, http_param_t params,
+                int (*ProgressCallback) (void *clientp, double dltotal, double dlnow, double ultotal, double ulnow),
+                void (*RxCallback) (const char *chunk, int len, void *arg), void *rxCallbackArg,
+                const char *contentType)
+{
+    int msgToSendSize = 0;
+    int i;
     CURL * curlHandle = NULL;
     CURLcode curlResult;
     char tempString[PATH_MAX];
     char errorBuffer[CURL_ERROR_SIZE];
     struct HttpIoInfo outBoundCommInfo;
-    struct HttpIoInfo inBoundCommInfo;
+    struct HttpRxInfo inBoundCommInfo;
     struct curl_slist *slist = NULL;
     double connectDuration = 0.0;
     double transferDuration = 0.0;
@@ -254,12 +369,17 @@ int libhttpcomm_sendMsg(CURLSH * shareCurlHandle, CURLoption httpMethod, const c
     assert (rxBuffer);
     assert(url);
 
+    for (i = 0; i < totalSegments; i++)
+    {
+        msgToSendSize += segments[i].iov_len;
+    }
+
     if (params.verbose == true)
     {
-        if (msgToSendPtr != NULL)
+        if (totalSegments > 0)
         {
-            SYSLOG_DEBUG("httpMethod: 0x%x, url: %s, size: %d, outgoing msg: %s",
-                    httpMethod, url, msgToSendSize, msgToSendPtr);
+            SYSLOG_DEBUG("httpMethod: 0x%x, url: %s, size: %d, outgoing msg: %.*s",
+                    httpMethod, url, msgToSendSize, (int) segments[0].iov_len, (char *) segments[0].iov_base);
         }else
         {
             SYSLOG_DEBUG("httpMethod: 0x%x, url: %s", httpMethod, url);
@@ -275,7 +395,8 @@ int libhttpcomm_sendMsg(CURLSH * shareCurlHandle, CURLoption httpMethod, const c
 	{
 	    if ( msgToSendSize > 0 )
 	    {
-		slist = curl_slist_append(slist, "Content-Type: text/xml");
+		snprintf(tempString, sizeof(tempString), "Content-Type: %s", contentType != NULL ? contentType : "text/xml");
+		slist = curl_slist_append(slist, tempString);
 		snprintf(tempString, sizeof(tempString), "Content-Length: %d", msgToSendSize);
 		slist = curl_slist_append(slist, tempString);
 	    }
@@ -302,6 +423,12 @@ int libhttpcomm_sendMsg(CURLSH * shareCurlHandle, CURLoption httpMethod, const c
 	    }
 	}
 
+	if ( contentType != NULL )
+	{
+	    snprintf(tempString, sizeof(tempString), "Accept: %s", contentType);
+	    slist = curl_slist_append(slist, tempString);
+	}
+
         if (_libhttpcomm_configureHttp(curlHandle, shareCurlHandle, slist, httpMethod, url,
                 sslCertPath, authToken, params.timeouts, ProgressCallback) == false)
         {
@@ -319,7 +446,7 @@ int libhttpcomm_sendMsg(CURLSH * shareCurlHandle, CURLoption httpMethod, const c
 
         // CURLOPT_READFUNCTION and CURLOPT_READDATA in this context refers to
         // data to be sent to the server... so curl will read data from us.
-        if(msgToSendPtr != NULL)
+        if(totalSegments > 0)
         {
 	    if ( msgToSendSize > 0 )
 	    {
@@ -333,8 +460,10 @@ int libhttpcomm_sendMsg(CURLSH * shareCurlHandle, CURLoption httpMethod, const c
 
 		//creating the curl object
 		// TODO: not sure that setting a pointer to a pointer that is scoped elsewhere is correct.
-		outBoundCommInfo.buffer = msgToSendPtr;
-		outBoundCommInfo.size = msgToSendSize;
+		outBoundCommInfo.buffer = NULL;
+		outBoundCommInfo.size = 0;
+		outBoundCommInfo.segments = segments;
+		outBoundCommInfo.totalSegments = totalSegments;
 		/* pointer to pass to our read function */
 		// here you must put the file info
 		curlResult = curl_easy_setopt(curlHandle, CURLOPT_READDATA, &outBoundCommInfo);
@@ -368,6 +497,9 @@ int libhttpcomm_sendMsg(CURLSH * shareCurlHandle, CURLoption httpMethod, const c
 
 	inBoundCommInfo.buffer = rxBuffer;
 	inBoundCommInfo.size = maxRxBufferSize;
+	inBoundCommInfo.length = 0;
+	inBoundCommInfo.RxCallback = RxCallback;
+	inBoundCommInfo.rxCallbackArg = rxCallbackArg;
 
 	curlResult = curl_easy_setopt(curlHandle, CURLOPT_WRITEDATA, &inBoundCommInfo);
 	if (curlResult != CURLE_OK)
@@ -385,6 +517,10 @@ int libhttpcomm_sendMsg(CURLSH * shareCurlHandle, CURLoption httpMethod, const c
         curl_easy_getinfo(curlHandle, CURLINFO_RESPONSE_CODE, &httpResponseCode );
         curl_easy_getinfo(curlHandle, CURLINFO_HTTP_CONNECTCODE, &httpConnectCode );
 
+        _libhttpcomm_recordMetrics((curlResult != CURLE_OK && curlResult != CURLE_ABORTED_BY_CALLBACK)
+                || httpResponseCode >= 300 || httpConnectCode >= 300,
+                nameResolvingDuration, connectDuration, transferDuration, msgToSendSize, inBoundCommInfo.length);
+
         if (httpResponseCode >= 300 || httpConnectCode >= 300)
         {
             if (params.verbose == true) SYSLOG_ERR("HTTP error response code:%ld, connect code:%ld", httpResponseCode, httpConnectCode);
@@ -434,10 +570,6 @@ int libhttpcomm_sendMsg(CURLSH * shareCurlHandle, CURLoption httpMethod, const c
         {
             /* put the result into the main buffer and return */
             if (params.verbose == true) SYSLOG_DEBUG("received msg length %d", strlen(rxBuffer));
-            if(msgToSendPtr != NULL)
-            {
-              msgToSendPtr[0] = 0;
-            }
 
         }else
         {
@@ -484,7 +616,7 @@ int libhttpcomm_postMsg(CURLSH * shareCurlHandle, CURLoption httpMethod, const c
     char tempString[PATH_MAX];
     char errorBuffer[CURL_ERROR_SIZE];
     struct HttpIoInfo outBoundCommInfo;
-    struct HttpIoInfo inBoundCommInfo;
+    struct HttpRxInfo inBoundCommInfo;
     struct curl_slist *slist = NULL;
     double connectDuration = 0.0;
     double transferDuration = 0.0;
@@ -581,6 +713,8 @@ int libhttpcomm_postMsg(CURLSH * shareCurlHandle, CURLoption httpMethod, const c
 		// TODO: not sure that setting a pointer to a pointer that is scoped elsewhere is correct.
 		outBoundCommInfo.buffer = msgToSendPtr;
 		outBoundCommInfo.size = msgToSendSize;
+		outBoundCommInfo.segments = NULL;
+		outBoundCommInfo.totalSegments = 0;
 		/* pointer to pass to our read function */
 		// here you must put the file info
 		curlResult = curl_easy_setopt(curlHandle, CURLOPT_READDATA, &outBoundCommInfo);
@@ -614,6 +748,9 @@ int libhttpcomm_postMsg(CURLSH * shareCurlHandle, CURLoption httpMethod, const c
 
 	inBoundCommInfo.buffer = rxBuffer;
 	inBoundCommInfo.size = maxRxBufferSize;
+	inBoundCommInfo.length = 0;
+	inBoundCommInfo.RxCallback = NULL;
+	inBoundCommInfo.rxCallbackArg = NULL;
 
 	curlResult = curl_easy_setopt(curlHandle, CURLOPT_WRITEDATA, &inBoundCommInfo);
 	if (curlResult != CURLE_OK)
@@ -639,6 +776,10 @@ int libhttpcomm_postMsg(CURLSH * shareCurlHandle, CURLoption httpMethod, const c
         curl_easy_getinfo(curlHandle, CURLINFO_RESPONSE_CODE, &httpResponseCode );
         curl_easy_getinfo(curlHandle, CURLINFO_HTTP_CONNECTCODE, &httpConnectCode );
 
+        _libhttpcomm_recordMetrics((curlResult != CURLE_OK && curlResult != CURLE_ABORTED_BY_CALLBACK)
+                || httpResponseCode >= 300 || httpConnectCode >= 300,
+                nameResolvingDuration, connectDuration, transferDuration, msgToSendSize, inBoundCommInfo.length);
+
         if (httpResponseCode >= 300 || httpConnectCode >= 300)
         {
             if (params.verbose == true) SYSLOG_ERR("HTTP error response code:%ld, connect code:%ld", httpResponseCode, httpConnectCode);
@@ -859,7 +1000,7 @@ int libhttpcomm_sendFile(const char *url, const char *sslCertPath, const char *a
     char tempString[PATH_MAX];
     char errorBuffer[CURL_ERROR_SIZE];
     int fileSize = 0;
-    struct HttpIoInfo inBoundCommInfo;
+    struct HttpRxInfo inBoundCommInfo;
     struct curl_slist *slist = NULL;
     struct stat fileStats;
     double connectDuration = 0.0;
@@ -946,6 +1087,9 @@ int libhttpcomm_sendFile(const char *url, const char *sslCertPath, const char *a
 
         inBoundCommInfo.buffer = rxBuffer;
         inBoundCommInfo.size = maxRxBufferSize;
+        inBoundCommInfo.length = 0;
+        inBoundCommInfo.RxCallback = NULL;
+        inBoundCommInfo.rxCallbackArg = NULL;
 
         curlResult = curl_easy_setopt(curlHandle, CURLOPT_WRITEDATA, &inBoundCommInfo);
         if (curlResult != CURLE_OK)
@@ -1238,3 +1382,52 @@ void _libhttpcomm_closeHttp(CURL * curlHandle, struct curl_slist *slist)
     curl_slist_free_all(slist); /* free the list again */
     curl_easy_cleanup(curlHandle);
 }
+
+/**
+ * @brief   Count a transfer and where its time went
+ *
+ * @param   failed: true if the transfer failed, not counting transfers we stopped ourselves
+ * @param   nameResolvingDuration: seconds spent resolving the host name
+ * @param   connectDuration: seconds until the SSL handshake was done, 0 without SSL
+ * @param   transferDuration: seconds for the whole transfer
+ * @param   bytesSent: bytes in the request body
+ * @param   bytesReceived: bytes in the response body
+ */
+static void _libhttpcomm_recordMetrics(bool failed, double nameResolvingDuration, double connectDuration,
+        double transferDuration, int bytesSent, int bytesReceived)
+{
+    static libmetrics_t *requests = NULL;
+    static libmetrics_t *errors;
+    static libmetrics_t *sent;
+    static libmetrics_t *received;
+    static libmetrics_t *nameResolving;
+    static libmetrics_t *connect;
+    static libmetrics_t *transfer;
+
+    if (requests == NULL)
+    {
+        errors = libmetrics_counter("httpcomm_errors_total", "HTTP transfers that failed");
+        sent = libmetrics_counter("httpcomm_sent_bytes_total", "HTTP request body bytes");
+        received = libmetrics_counter("httpcomm_received_bytes_total", "HTTP response body bytes");
+        nameResolving = libmetrics_histogram("httpcomm_namelookup_seconds", "Time to resolve the server name");
+        connect = libmetrics_histogram("httpcomm_appconnect_seconds", "Time until the SSL handshake was done");
+        transfer = libmetrics_histogram("httpcomm_total_seconds", "Time for the whole HTTP transfer");
+        requests = libmetrics_counter("httpcomm_requests_total", "HTTP transfers attempted");
+    }
+
+    libmetrics_add(requests, 1);
+    libmetrics_add(sent, bytesSent);
+    libmetrics_add(received, bytesReceived);
+
+    if (failed)
+    {
+        libmetrics_add(errors, 1);
+    }
+
+    libmetrics_observe(nameResolving, nameResolvingDuration);
+    if (connectDuration > 0)
+    {
+        libmetrics_observe(connect, connectDuration);
+    }
+    libmetrics_observe(transfer, transferDuration);
+}
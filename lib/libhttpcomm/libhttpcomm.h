@@ -21,6 +21,7 @@
 
 #include <curl/curl.h>
 #include <limits.h>
+#include <sys/uio.h>
 #include <rpc/types.h>
 #include <stdbool.h>
 
@@ -74,6 +75,29 @@ int libhttpcomm_sendMsg(CURLSH * shareCurlHandle, CURLoption httpMethod,
     http_param_t params, int(*ProgressCallback)(void *clientp, double dltotal,
         double dlnow, double ultotal, double ulnow));
 
+int libhttpcomm_sendMsgStream(CURLSH * shareCurlHandle, CURLoption httpMethod,
+    const char *url, const char *sslCertPath, const char *authToken,
+    char *msgToSendPtr, int msgToSendSize, char *rxBuffer, int maxRxBufferSize,
+    http_param_t params, int(*ProgressCallback)(void *clientp, double dltotal,
+        double dlnow, double ultotal, double ulnow),
+    void(*RxCallback)(const char *chunk, int len, void *arg), void *rxCallbackArg);
+
+int libhttpcomm_sendMsgStreamWithType(CURLSH * shareCurlHandle, CURLoption httpMethod,
+    const char *url, const char *sslCertPath, const char *authToken,
+    char *msgToSendPtr, int msgToSendSize, char *rxBuffer, int maxRxBufferSize,
+    http_param_t params, int(*ProgressCallback)(void *clientp, double dltotal,
+        double dlnow, double ultotal, double ulnow),
+    void(*RxCallback)(const char *chunk, int len, void *arg), void *rxCallbackArg,
+    const char *contentType);
+
+int libhttpcomm_sendMsgVector(CURLSH * shareCurlHandle, CURLoption httpMethod,
+    const char *url, const char *sslCertPath, const char *authToken,
+    const struct iovec *segments, int totalSegments, char *rxBuffer, int maxRxBufferSize,
+    http_param_t params, int(*ProgressCallback)(void *clientp, double dltotal,
+        double dlnow, double ultotal, double ulnow),
+    void(*RxCallback)(const char *chunk, int len, void *arg), void *rxCallbackArg,
+    const char *contentType);
+
 int libhttpcomm_postMsg(CURLSH * shareCurlHandle, CURLoption httpMethod,
     const char *url, const char *sslCertPath, const char *authToken,
     char *msgToSendPtr, int msgToSendSize, char *rxBuffer, int maxRxBufferSize,
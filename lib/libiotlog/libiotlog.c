@@ -0,0 +1,656 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ *  @file         libiotlog.c
+ *
+ *  @brief    Logging backend behind the SYSLOG_* macros
+ *
+ *  Every .c file is a module with its own log level, which can be changed at
+ *  runtime.  Messages below the level are skipped before their arguments are
+ *  evaluated, and each module can only log LIBIOTLOG_MAX_PER_SEC messages
+ *  below SYSLOG_LEVEL_ERR per second.  The rest are counted and dropped, and
+ *  how many were dropped is logged once the second is over.  Errors and
+ *  worse are never dropped by the rate limit.
+ *
+ *  Until libiotlog_start() is called, messages go straight to syslog.  After
+ *  that, each thread formats its messages into its own ring, and a writer
+ *  thread drains the rings in order to syslog, stderr or a file, collapsing
+ *  repeats of the same message.  A full ring drops the message instead of
+ *  blocking the thread that logged it.
+ *
+ *  Processes forked after libiotlog_start() go back to logging straight to
+ *  syslog, since they don't get a writer thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "iotdebug.h"
+#include "libiotlog.h"
+
+/***************** Module Variables ****************/
+/** Modules with their own level */
+static iotlog_module_t sModules[LIBIOTLOG_MAX_MODULES];
+
+static int sTotalModules;
+
+/** Module for everything once there's no room for more modules */
+static iotlog_module_t sOtherModule = { "other", IOTLOG_DEFAULT_LEVEL, 0, 0, 0 };
+
+/** Level of modules that weren't given their own */
+static int sDefaultLevel = IOTLOG_DEFAULT_LEVEL;
+
+/** True once we applied the levels from the environment */
+static bool sEnvironmentRead;
+
+static pthread_mutex_t sModulesMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Names of the SYSLOG_LEVEL_* levels */
+static const char *sLevelNames[] = { "debug", "info", "notice", "warning", "err", "crit", "alert" };
+
+/** Syslog priorities of the SYSLOG_LEVEL_* levels */
+static const int sPriorities[] = { LOG_DEBUG, LOG_INFO, LOG_NOTICE, LOG_WARNING, LOG_ERR, LOG_CRIT, LOG_ALERT };
+
+/** Rings of the threads that logged since we started */
+static libiotlog_ring_t sRings[LIBIOTLOG_MAX_THREADS];
+
+/** This thread's ring */
+static __thread libiotlog_ring_t *tRing;
+
+/** Frees a thread's ring when it exits */
+static pthread_key_t sRingKey;
+
+/** Order of the next message */
+static volatile uint32_t sSeq;
+
+/** True while the writer thread drains the rings */
+static volatile bool sAsync;
+
+static bool gTerminate;
+
+static pthread_t sWriterThread;
+
+/** Destination of the writer, NULL for syslog */
+static FILE *sOutput;
+
+/** Last message the writer wrote, to collapse repeats */
+static libiotlog_entry_t sLast;
+
+/** Number of times the last message repeated since it was written */
+static int sRepeats;
+
+/** When the first repeat we haven't mentioned yet happened */
+static time_t sRepeatsSince;
+
+/***************** Private Prototypes ****************/
+static iotlog_module_t *_libiotlog_find(const char *name, int len);
+
+static error_t _libiotlog_applyLevels(const char *levels);
+
+static int _libiotlog_parseLevel(const char *level, int len);
+
+static void _libiotlog_emit(iotlog_module_t *module, int level, time_t now, const char *format, ...);
+
+static void _libiotlog_vemit(iotlog_module_t *module, int level, time_t now, const char *format, va_list ap);
+
+static void _libiotlog_format(char *dest, const char *format, va_list ap);
+
+static void _libiotlog_reportDropped(time_t now);
+
+static libiotlog_ring_t *_libiotlog_ring();
+
+static void _libiotlog_releaseRing(void *ring);
+
+static void _libiotlog_forked();
+
+static void *_libiotlog_writerThread(void *params);
+
+static void _libiotlog_drain();
+
+static void _libiotlog_dedup(const libiotlog_entry_t *entry);
+
+static void _libiotlog_flushRepeats(time_t now);
+
+static void _libiotlog_output(time_t time, int level, iotlog_module_t *module, const char *text);
+
+/***************** Public Functions ****************/
+/**
+ * Find the module a source file's messages belong to, registering it the
+ * first time.  The first call also applies the levels in the IOTLOG_LEVELS
+ * environment variable.
+ * @param file Path of the source file, i.e. __FILE__
+ * @return the module, never NULL
+ */
+iotlog_module_t *libiotlog_module(const char *file) {
+  iotlog_module_t *module;
+  const char *name;
+  int len;
+
+  name = strrchr(file, '/');
+  name = (name != NULL) ? name + 1 : file;
+
+  for(len = 0; name[len] != '\0' && name[len] != '.'; len++);
+
+  pthread_mutex_lock(&sModulesMutex);
+
+  if(!sEnvironmentRead) {
+    sEnvironmentRead = true;
+    if(getenv(LIBIOTLOG_LEVELS_ENV) != NULL) {
+      _libiotlog_applyLevels(getenv(LIBIOTLOG_LEVELS_ENV));
+    }
+  }
+
+  module = _libiotlog_find(name, len);
+
+  pthread_mutex_unlock(&sModulesMutex);
+  return module;
+}
+
+/**
+ * Log a message, called by the SYSLOG_* macros once the level is known to
+ * be high enough
+ * @param module Module of the message
+ * @param level SYSLOG_LEVEL_* level of the message
+ * @param format printf format string, followed by its arguments
+ */
+void libiotlog_write(iotlog_module_t *module, int level, const char *format, ...) {
+  time_t now = time(NULL);
+  uint32_t dropped;
+  va_list ap;
+
+  if(module->windowSec != now) {
+    module->windowSec = now;
+    module->windowCount = 0;
+
+    if((dropped = __sync_lock_test_and_set(&module->dropped, 0)) > 0) {
+      _libiotlog_emit(module, SYSLOG_LEVEL_WARNING, now, "%u messages suppressed", dropped);
+    }
+  }
+
+  if(level < SYSLOG_LEVEL_ERR && __sync_add_and_fetch(&module->windowCount, 1) > LIBIOTLOG_MAX_PER_SEC) {
+    __sync_fetch_and_add(&module->dropped, 1);
+    return;
+  }
+
+  va_start(ap, format);
+  _libiotlog_vemit(module, level, now, format, ap);
+  va_end(ap);
+}
+
+/**
+ * Start the writer thread, after which threads log into their own rings
+ * @param destination "syslog", "stderr" or the path of a file to append to.
+ *     NULL for the IOTLOG_DESTINATION environment variable, or syslog.
+ * @return SUCCESS if the writer is running
+ */
+error_t libiotlog_start(const char *destination) {
+  static bool initialized = false;
+
+  if(sAsync) {
+    return SUCCESS;
+  }
+
+  if(destination == NULL) {
+    destination = getenv(LIBIOTLOG_DESTINATION_ENV);
+  }
+
+  sOutput = NULL;
+  if(destination != NULL && strcmp(destination, "stderr") == 0) {
+    sOutput = stderr;
+
+  } else if(destination != NULL && strcmp(destination, "syslog") != 0) {
+    if((sOutput = fopen(destination, "a")) == NULL) {
+      syslog(LOG_ERR, "Couldn't open log file %s", destination);
+      return FAIL;
+    }
+  }
+
+  if(!initialized) {
+    initialized = true;
+    pthread_key_create(&sRingKey, &_libiotlog_releaseRing);
+    pthread_atfork(NULL, NULL, &_libiotlog_forked);
+  }
+
+  gTerminate = false;
+  if(pthread_create(&sWriterThread, NULL, &_libiotlog_writerThread, NULL) != 0) {
+    syslog(LOG_ERR, "Couldn't create the log writer thread");
+    return FAIL;
+  }
+
+  sAsync = true;
+  return SUCCESS;
+}
+
+/**
+ * Stop the writer thread after it wrote everything waiting in the rings
+ */
+void libiotlog_stop() {
+  if(!sAsync) {
+    return;
+  }
+
+  sAsync = false;
+  gTerminate = true;
+  pthread_join(sWriterThread, NULL);
+
+  if(sOutput != NULL && sOutput != stderr) {
+    fclose(sOutput);
+  }
+  sOutput = NULL;
+}
+
+/**
+ * Set the level of one module, or of every module
+ * @param name Name of the module, i.e. "proxy" for proxy.c, or "*" for all
+ * @param level SYSLOG_LEVEL_* level below which its messages are skipped
+ * @return SUCCESS if the level was set
+ */
+error_t libiotlog_setLevel(const char *name, int level) {
+  char levels[IOTLOG_MODULE_NAME_SIZE + 16];
+  error_t result;
+
+  if(level < SYSLOG_LEVEL_DEBUG || level > SYSLOG_LEVEL_ALERT) {
+    return FAIL;
+  }
+
+  snprintf(levels, sizeof(levels), "%s=%d", name, level);
+
+  pthread_mutex_lock(&sModulesMutex);
+  result = _libiotlog_applyLevels(levels);
+  pthread_mutex_unlock(&sModulesMutex);
+  return result;
+}
+
+/**
+ * Set the levels of several modules at once
+ * @param levels Comma separated list of module=level, where the level is
+ *     a SYSLOG_LEVEL_* number or its name, i.e. "proxy=info,*=warning".
+ *     A module called "*" sets the level of every module.
+ * @return SUCCESS if every level was set
+ */
+error_t libiotlog_setLevels(const char *levels) {
+  error_t result;
+
+  pthread_mutex_lock(&sModulesMutex);
+  result = _libiotlog_applyLevels(levels);
+  pthread_mutex_unlock(&sModulesMutex);
+  return result;
+}
+
+/***************** Private Functions ****************/
+/**
+ * Find a module by name, registering it if it's new.  Call with the
+ * modules mutex held.
+ * @param name Name of the module, not necessarily null-terminated
+ * @param len Length of the name
+ * @return the module, never NULL
+ */
+static iotlog_module_t *_libiotlog_find(const char *name, int len) {
+  iotlog_module_t *module;
+  int i;
+
+  if(len >= IOTLOG_MODULE_NAME_SIZE) {
+    len = IOTLOG_MODULE_NAME_SIZE - 1;
+  }
+
+  for(i = 0; i < sTotalModules; i++) {
+    if(strncmp(sModules[i].name, name, len) == 0 && sModules[i].name[len] == '\0') {
+      return &sModules[i];
+    }
+  }
+
+  if(sTotalModules == LIBIOTLOG_MAX_MODULES) {
+    return &sOtherModule;
+  }
+
+  module = &sModules[sTotalModules];
+  memcpy(module->name, name, len);
+  module->name[len] = '\0';
+  module->level = sDefaultLevel;
+  sTotalModules++;
+  return module;
+}
+
+/**
+ * Apply a list of module=level.  Call with the modules mutex held.
+ * @param levels Comma separated list of module=level
+ * @return SUCCESS if every level was set
+ */
+static error_t _libiotlog_applyLevels(const char *levels) {
+  error_t result = SUCCESS;
+  const char *name = levels;
+  const char *equals;
+  const char *end;
+  int level;
+  int i;
+
+  while(*name != '\0') {
+    while(*name == ',' || isspace((unsigned char) *name)) {
+      name++;
+    }
+
+    if(*name == '\0') {
+      break;
+    }
+
+    for(end = name; *end != '\0' && *end != ','; end++);
+
+    equals = memchr(name, '=', end - name);
+
+    if(equals == NULL || equals == name || (level = _libiotlog_parseLevel(equals + 1, end - equals - 1)) < 0) {
+      syslog(LOG_ERR, "Bad log level %.*s", (int) (end - name), name);
+      result = FAIL;
+
+    } else if(equals - name == 1 && *name == '*') {
+      sDefaultLevel = level;
+      sOtherModule.level = level;
+      for(i = 0; i < sTotalModules; i++) {
+        sModules[i].level = level;
+      }
+
+    } else {
+      _libiotlog_find(name, equals - name)->level = level;
+    }
+
+    name = end;
+  }
+
+  return result;
+}
+
+/**
+ * @param level A SYSLOG_LEVEL_* number or its name, not null-terminated
+ * @param len Length of the level
+ * @return the SYSLOG_LEVEL_* level, or -1 if it isn't one
+ */
+static int _libiotlog_parseLevel(const char *level, int len) {
+  int i;
+
+  if(len == 1 && *level >= '0' + SYSLOG_LEVEL_DEBUG && *level <= '0' + SYSLOG_LEVEL_ALERT) {
+    return *level - '0';
+  }
+
+  for(i = SYSLOG_LEVEL_DEBUG; i <= SYSLOG_LEVEL_ALERT; i++) {
+    if(strlen(sLevelNames[i]) == len && strncasecmp(sLevelNames[i], level, len) == 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * Log a message without rate limiting it
+ */
+static void _libiotlog_emit(iotlog_module_t *module, int level, time_t now, const char *format, ...) {
+  va_list ap;
+
+  va_start(ap, format);
+  _libiotlog_vemit(module, level, now, format, ap);
+  va_end(ap);
+}
+
+/**
+ * Hand a message to this thread's ring, or to syslog if the writer isn't
+ * running or we're out of rings
+ */
+static void _libiotlog_vemit(iotlog_module_t *module, int level, time_t now, const char *format, va_list ap) {
+  char text[LIBIOTLOG_MSG_SIZE];
+  libiotlog_ring_t *ring;
+  libiotlog_entry_t *entry;
+
+  if(!sAsync || (ring = _libiotlog_ring()) == NULL) {
+    vsyslog(sPriorities[level], format, ap);
+    return;
+  }
+
+  if(ring->head - ring->tail >= LIBIOTLOG_RING_SIZE) {
+    if(level >= SYSLOG_LEVEL_ERR) {
+      // Errors aren't dropped, they go out ahead of the messages in the ring
+      _libiotlog_format(text, format, ap);
+      _libiotlog_output(now, level, module, text);
+    } else {
+      __sync_fetch_and_add(&module->dropped, 1);
+    }
+    return;
+  }
+
+  entry = &ring->entries[ring->head & (LIBIOTLOG_RING_SIZE - 1)];
+  _libiotlog_format(entry->text, format, ap);
+  entry->time = now;
+  entry->level = level;
+  entry->module = module;
+  entry->seq = __sync_fetch_and_add(&sSeq, 1);
+
+  // The writer may read the entry as soon as it sees the new head
+  __sync_synchronize();
+  ring->head++;
+}
+
+/**
+ * Format a message, ending it with LIBIOTLOG_TRUNCATED if it doesn't fit
+ * @param dest LIBIOTLOG_MSG_SIZE bytes for the message
+ */
+static void _libiotlog_format(char *dest, const char *format, va_list ap) {
+  if(vsnprintf(dest, LIBIOTLOG_MSG_SIZE, format, ap) >= LIBIOTLOG_MSG_SIZE) {
+    strcpy(dest + LIBIOTLOG_MSG_SIZE - sizeof(LIBIOTLOG_TRUNCATED), LIBIOTLOG_TRUNCATED);
+  }
+}
+
+/**
+ * @return this thread's ring, claiming one the first time, or NULL if there
+ *     are none left
+ */
+static libiotlog_ring_t *_libiotlog_ring() {
+  int i;
+
+  if(tRing != NULL) {
+    return tRing;
+  }
+
+  for(i = 0; i < LIBIOTLOG_MAX_THREADS; i++) {
+    if(__sync_bool_compare_and_swap(&sRings[i].inUse, 0, 1)) {
+      if(sRings[i].entries == NULL
+          && (sRings[i].entries = calloc(LIBIOTLOG_RING_SIZE, sizeof(libiotlog_entry_t))) == NULL) {
+        sRings[i].inUse = 0;
+        return NULL;
+      }
+
+      tRing = &sRings[i];
+      pthread_setspecific(sRingKey, tRing);
+      return tRing;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * A thread with a ring exited, the writer hands the ring to another thread
+ * once it's empty
+ * @param ring The thread's ring
+ */
+static void _libiotlog_releaseRing(void *ring) {
+  ((libiotlog_ring_t *) ring)->released = true;
+}
+
+/**
+ * The writer thread didn't survive the fork, so log straight to syslog
+ */
+static void _libiotlog_forked() {
+  sAsync = false;
+  tRing = NULL;
+}
+
+/**
+ * Drain the rings every LIBIOTLOG_FLUSH_MSEC
+ */
+static void *_libiotlog_writerThread(void *params) {
+  while(!gTerminate) {
+    _libiotlog_drain();
+    usleep(LIBIOTLOG_FLUSH_MSEC * 1000);
+  }
+
+  _libiotlog_drain();
+  _libiotlog_flushRepeats(time(NULL));
+
+  if(sOutput != NULL) {
+    fflush(sOutput);
+  }
+
+  return NULL;
+}
+
+/**
+ * Write the messages waiting in the rings in the order they were logged
+ */
+static void _libiotlog_drain() {
+  libiotlog_ring_t *oldest;
+  libiotlog_entry_t *entry;
+  int i;
+
+  while(true) {
+    oldest = NULL;
+
+    for(i = 0; i < LIBIOTLOG_MAX_THREADS; i++) {
+      if(sRings[i].inUse && sRings[i].tail != sRings[i].head) {
+        if(oldest == NULL || (int32_t) (sRings[i].entries[sRings[i].tail & (LIBIOTLOG_RING_SIZE - 1)].seq
+            - oldest->entries[oldest->tail & (LIBIOTLOG_RING_SIZE - 1)].seq) < 0) {
+          oldest = &sRings[i];
+        }
+      }
+    }
+
+    if(oldest == NULL) {
+      break;
+    }
+
+    __sync_synchronize();
+    entry = &oldest->entries[oldest->tail & (LIBIOTLOG_RING_SIZE - 1)];
+    _libiotlog_dedup(entry);
+
+    // Done with the entry, the thread may reuse it
+    __sync_synchronize();
+    oldest->tail++;
+  }
+
+  // Hand the rings of exited threads to new ones
+  for(i = 0; i < LIBIOTLOG_MAX_THREADS; i++) {
+    if(sRings[i].inUse && sRings[i].released && sRings[i].tail == sRings[i].head) {
+      sRings[i].released = false;
+      sRings[i].head = 0;
+      sRings[i].tail = 0;
+      __sync_synchronize();
+      sRings[i].inUse = 0;
+    }
+  }
+
+  _libiotlog_reportDropped(time(NULL));
+
+  if(sRepeats > 0 && time(NULL) - sRepeatsSince >= LIBIOTLOG_REPEAT_SEC) {
+    _libiotlog_flushRepeats(time(NULL));
+  }
+
+  if(sOutput != NULL) {
+    fflush(sOutput);
+  }
+}
+
+/**
+ * Say how many messages the modules dropped in a second that's over, so a
+ * module that went quiet after hitting the limit still says so
+ * @param now Current time
+ */
+static void _libiotlog_reportDropped(time_t now) {
+  libiotlog_entry_t entry;
+  iotlog_module_t *module;
+  uint32_t dropped;
+  int i;
+
+  for(i = 0; i <= sTotalModules; i++) {
+    module = (i < sTotalModules) ? &sModules[i] : &sOtherModule;
+
+    if(module->dropped == 0 || module->windowSec == now
+        || (dropped = __sync_lock_test_and_set(&module->dropped, 0)) == 0) {
+      continue;
+    }
+
+    snprintf(entry.text, sizeof(entry.text), "%u messages suppressed", dropped);
+    entry.time = now;
+    entry.level = SYSLOG_LEVEL_WARNING;
+    entry.module = module;
+    _libiotlog_dedup(&entry);
+  }
+}
+
+/**
+ * Write a message, unless it's the same as the last one
+ * @param entry The message
+ */
+static void _libiotlog_dedup(const libiotlog_entry_t *entry) {
+  if(entry->module == sLast.module && entry->level == sLast.level && strcmp(entry->text, sLast.text) == 0) {
+    if(sRepeats++ == 0) {
+      sRepeatsSince = entry->time;
+    }
+    return;
+  }
+
+  _libiotlog_flushRepeats(entry->time);
+  _libiotlog_output(entry->time, entry->level, entry->module, entry->text);
+  memcpy(&sLast, entry, sizeof(sLast));
+}
+
+/**
+ * Say how many times the last message repeated, if it did
+ * @param now Current time
+ */
+static void _libiotlog_flushRepeats(time_t now) {
+  char text[LIBIOTLOG_MSG_SIZE];
+
+  if(sRepeats > 0) {
+    snprintf(text, sizeof(text), "Last message repeated %d times", sRepeats);
+    _libiotlog_output(now, sLast.level, sLast.module, text);
+    sRepeats = 0;
+  }
+}
+
+/**
+ * Write a message to the destination
+ */
+static void _libiotlog_output(time_t time, int level, iotlog_module_t *module, const char *text) {
+  char stamp[32];
+  struct tm local;
+
+  if(sOutput == NULL) {
+    syslog(sPriorities[level], "%s", text);
+    return;
+  }
+
+  localtime_r(&time, &local);
+  strftime(stamp, sizeof(stamp), "%b %d %H:%M:%S", &local);
+  fprintf(sOutput, "%s %s %s: %s\n", stamp, sLevelNames[level], module->name, text);
+}
@@ -0,0 +1,110 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef LIBIOTLOG_H
+#define LIBIOTLOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "iotdebug.h"
+
+/** Maximum number of modules with their own log level */
+#ifndef LIBIOTLOG_MAX_MODULES
+#define LIBIOTLOG_MAX_MODULES 96
+#endif
+
+/** Maximum number of threads with their own ring, the others log directly */
+#ifndef LIBIOTLOG_MAX_THREADS
+#define LIBIOTLOG_MAX_THREADS 16
+#endif
+
+/** Messages each thread can have waiting for the writer, a power of 2 */
+#ifndef LIBIOTLOG_RING_SIZE
+#define LIBIOTLOG_RING_SIZE 32
+#endif
+
+/** Longest message, the rest is cut off and replaced with LIBIOTLOG_TRUNCATED */
+#ifndef LIBIOTLOG_MSG_SIZE
+#define LIBIOTLOG_MSG_SIZE 256
+#endif
+
+/** Messages below SYSLOG_LEVEL_ERR a module can log each second before the rest are dropped */
+#ifndef LIBIOTLOG_MAX_PER_SEC
+#define LIBIOTLOG_MAX_PER_SEC 50
+#endif
+
+/** Marks the end of a message that was cut off */
+#define LIBIOTLOG_TRUNCATED "..."
+
+/** Milliseconds between the writer's passes over the rings */
+#ifndef LIBIOTLOG_FLUSH_MSEC
+#define LIBIOTLOG_FLUSH_MSEC 100
+#endif
+
+/** Seconds a repeated message is held back before we say how often it repeated */
+#ifndef LIBIOTLOG_REPEAT_SEC
+#define LIBIOTLOG_REPEAT_SEC 30
+#endif
+
+/** Environment variable with the initial log levels, i.e. "proxy=info,*=warning" */
+#define LIBIOTLOG_LEVELS_ENV "IOTLOG_LEVELS"
+
+/** Environment variable with the default destination: syslog, stderr or a file */
+#define LIBIOTLOG_DESTINATION_ENV "IOTLOG_DESTINATION"
+
+/**
+ * A message waiting for the writer
+ */
+typedef struct libiotlog_entry_t {
+
+  /** Order the message was logged in across all threads */
+  uint32_t seq;
+
+  time_t time;
+
+  int level;
+
+  iotlog_module_t *module;
+
+  char text[LIBIOTLOG_MSG_SIZE];
+
+} libiotlog_entry_t;
+
+/**
+ * Messages from one thread.  The thread only moves the head and the writer
+ * only moves the tail, so neither of them takes a lock.
+ */
+typedef struct libiotlog_ring_t {
+
+  /** True while a thread owns the ring */
+  volatile int inUse;
+
+  /** True once the owner exited, the writer frees the ring after draining it */
+  volatile bool released;
+
+  volatile uint32_t head;
+
+  volatile uint32_t tail;
+
+  libiotlog_entry_t *entries;
+
+} libiotlog_ring_t;
+
+#endif
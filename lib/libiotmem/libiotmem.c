@@ -0,0 +1,642 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ *  @file         libiotmem.c
+ *
+ *  @brief    Heap accounting for the libraries we link
+ *
+ *  libxml2, libcurl and cJSON all let the application replace their
+ *  allocator.  libiotmem_start() replaces each of them with a thin wrapper
+ *  around the C library's that counts, per library, the bytes live, the most
+ *  bytes ever live at once, and the number of allocations, and publishes
+ *  them as the mem_* metrics.  Sizes come from malloc_usable_size(), so
+ *  nothing is added to the allocations themselves, and memory a library
+ *  hands over to be released with free() is still released safely, only
+ *  it stays counted as live.  Use libiotmem_free(..) to release it instead.
+ *
+ *  Processes forked after libiotmem_start() keep counting their own heap,
+ *  but leave the shared metrics to the process that started it.
+ *
+ *  Build with LIBIOTMEM_DEBUG to also remember where each live allocation
+ *  was made, and report what is still live at libiotmem_stop() by call site.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <malloc.h>
+#include <pthread.h>
+
+#include <libxml/xmlmemory.h>
+#include <curl/curl.h>
+
+#if LIBIOTMEM_DEBUG
+#include <execinfo.h>
+#endif
+
+#include "cJSON.h"
+#include "iotdebug.h"
+#include "libmetrics.h"
+#include "libiotmem.h"
+
+/** Usable size of an allocation from the C library */
+#ifndef LIBIOTMEM_USABLE_SIZE
+#define LIBIOTMEM_USABLE_SIZE(ptr) malloc_usable_size(ptr)
+#endif
+
+/**
+ * Frames of ours on the stack when an allocation is tracked: _libiotmem_track(),
+ * _libiotmem_allocated() and the library's hook, more for a reallocation
+ */
+#define LIBIOTMEM_OWN_FRAMES 3
+
+/** Call sites the debug report can tell apart */
+#define LIBIOTMEM_DEBUG_MAX_SITES 256
+
+/**
+ * Accounting of one subsystem
+ */
+typedef struct libiotmem_account_t {
+
+  volatile int64_t liveBytes;
+
+  volatile int64_t peakBytes;
+
+  volatile uint64_t allocations;
+
+  libmetrics_t *liveMetric;
+
+  libmetrics_t *peakMetric;
+
+  libmetrics_t *allocationsMetric;
+
+} libiotmem_account_t;
+
+#if LIBIOTMEM_DEBUG
+/**
+ * A live allocation, or a call site in the report
+ */
+typedef struct libiotmem_site_t {
+
+  /** The allocation, NULL if the entry is free */
+  void *ptr;
+
+  int subsystem;
+
+  /** Bytes, and allocations for a call site */
+  int64_t bytes;
+  int count;
+
+  void *frames[LIBIOTMEM_DEBUG_FRAMES];
+  int totalFrames;
+
+} libiotmem_site_t;
+#endif
+
+/** Names of the subsystems in the metrics and the log */
+static const char *sNames[LIBIOTMEM_TOTAL_SUBSYSTEMS] = {
+  "xml",
+  "curl",
+  "json",
+};
+
+/** Libraries behind the subsystems, for the metric descriptions */
+static const char *sLibraries[LIBIOTMEM_TOTAL_SUBSYSTEMS] = {
+  "libxml2",
+  "libcurl",
+  "cJSON",
+};
+
+static libiotmem_account_t sAccounts[LIBIOTMEM_TOTAL_SUBSYSTEMS];
+
+/** True once the allocators were replaced */
+static bool sStarted;
+
+/** False in processes forked after we started, which don't publish metrics */
+static volatile bool sPublish;
+
+#if LIBIOTMEM_DEBUG
+/** Live allocations, hashed by address with linear probing */
+static libiotmem_site_t *sLive;
+
+/** Allocations that didn't fit in the table */
+static volatile uint64_t sUntracked;
+
+static pthread_mutex_t sLiveMutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/***************** Private Prototypes ****************/
+static void _libiotmem_allocated(libiotmem_subsystem_e subsystem, void *ptr) __attribute__((noinline));
+
+static void _libiotmem_freeing(libiotmem_subsystem_e subsystem, void *ptr);
+
+static void *_libiotmem_realloc(libiotmem_subsystem_e subsystem, void *ptr, size_t size);
+
+static void _libiotmem_forked();
+
+static void *_libiotmem_xmlMalloc(size_t size);
+
+static void *_libiotmem_xmlRealloc(void *ptr, size_t size);
+
+static void _libiotmem_xmlFree(void *ptr);
+
+static char *_libiotmem_xmlStrdup(const char *str);
+
+static void *_libiotmem_curlMalloc(size_t size);
+
+static void *_libiotmem_curlRealloc(void *ptr, size_t size);
+
+static void _libiotmem_curlFree(void *ptr);
+
+static char *_libiotmem_curlStrdup(const char *str);
+
+static void *_libiotmem_curlCalloc(size_t nmemb, size_t size);
+
+static void *_libiotmem_jsonMalloc(size_t size);
+
+static void _libiotmem_jsonFree(void *ptr);
+
+#if LIBIOTMEM_DEBUG
+static void _libiotmem_track(libiotmem_subsystem_e subsystem, void *ptr, int64_t bytes) __attribute__((noinline));
+
+static void _libiotmem_untrack(void *ptr);
+
+static unsigned int _libiotmem_hash(const void *ptr);
+
+static void _libiotmem_reportSites();
+
+static int _libiotmem_compareSites(const void *a, const void *b);
+#endif
+
+/***************** Public Functions ****************/
+/**
+ * @brief   Replace the allocators of libxml2, libcurl and cJSON with our
+ *          accounting ones, and register the mem_* metrics.  Call this
+ *          first thing in main(), after libmetrics_start() and before the
+ *          libraries allocate anything.
+ *
+ * @return  0 on success, -1 if a library wouldn't take our allocator
+ */
+int libiotmem_start() {
+  char name[LIBMETRICS_NAME_SIZE];
+  char help[LIBMETRICS_HELP_SIZE];
+  cJSON_Hooks jsonHooks;
+  int result = 0;
+  int i;
+
+  if (sStarted) {
+    return 0;
+  }
+
+#if LIBIOTMEM_DEBUG
+  if ((sLive = calloc(LIBIOTMEM_DEBUG_MAX_ALLOCATIONS, sizeof(libiotmem_site_t))) == NULL) {
+    SYSLOG_ERR("[mem] No room to track %d allocations", LIBIOTMEM_DEBUG_MAX_ALLOCATIONS);
+  }
+#endif
+
+  for (i = 0; i < LIBIOTMEM_TOTAL_SUBSYSTEMS; i++) {
+    snprintf(name, sizeof(name), "mem_%s_live_bytes", sNames[i]);
+    snprintf(help, sizeof(help), "Bytes %s has allocated and not freed", sLibraries[i]);
+    sAccounts[i].liveMetric = libmetrics_gauge(name, help);
+
+    snprintf(name, sizeof(name), "mem_%s_peak_bytes", sNames[i]);
+    snprintf(help, sizeof(help), "Most bytes %s had allocated at once", sLibraries[i]);
+    sAccounts[i].peakMetric = libmetrics_gauge(name, help);
+
+    snprintf(name, sizeof(name), "mem_%s_allocations_total", sNames[i]);
+    snprintf(help, sizeof(help), "Allocations made by %s", sLibraries[i]);
+    sAccounts[i].allocationsMetric = libmetrics_counter(name, help);
+  }
+
+  sPublish = true;
+  pthread_atfork(NULL, NULL, _libiotmem_forked);
+
+  if (xmlMemSetup(_libiotmem_xmlFree, _libiotmem_xmlMalloc, _libiotmem_xmlRealloc, _libiotmem_xmlStrdup) != 0) {
+    SYSLOG_ERR("[mem] libxml2 didn't take our allocator");
+    result = -1;
+  }
+
+  if (curl_global_init_mem(CURL_GLOBAL_ALL, _libiotmem_curlMalloc, _libiotmem_curlFree,
+      _libiotmem_curlRealloc, _libiotmem_curlStrdup, _libiotmem_curlCalloc) != CURLE_OK) {
+    SYSLOG_ERR("[mem] libcurl didn't take our allocator");
+    result = -1;
+  }
+
+  jsonHooks.malloc_fn = _libiotmem_jsonMalloc;
+  jsonHooks.free_fn = _libiotmem_jsonFree;
+  cJSON_InitHooks(&jsonHooks);
+
+  sStarted = true;
+  return result;
+}
+
+/**
+ * @brief   Log what each subsystem still has on the heap, and in the debug
+ *          mode, where the live allocations were made.  The allocators stay
+ *          in place, the libraries may still free what they hold.
+ */
+void libiotmem_stop() {
+  libiotmem_stats_t stats;
+  int i;
+
+  if (!sStarted) {
+    return;
+  }
+
+  for (i = 0; i < LIBIOTMEM_TOTAL_SUBSYSTEMS; i++) {
+    libiotmem_get(i, &stats);
+    SYSLOG_INFO("[mem] %s: %lld bytes live, %lld bytes at the peak, %llu allocations",
+        sNames[i], (long long) stats.liveBytes, (long long) stats.peakBytes,
+        (unsigned long long) stats.allocations);
+  }
+
+#if LIBIOTMEM_DEBUG
+  _libiotmem_reportSites();
+#endif
+}
+
+/**
+ * @brief   Read what a subsystem has on the heap in this process
+ *
+ * @param   subsystem: LIBIOTMEM_XML, LIBIOTMEM_CURL or LIBIOTMEM_JSON
+ * @param   stats: filled in with its accounting
+ */
+void libiotmem_get(libiotmem_subsystem_e subsystem, libiotmem_stats_t *stats) {
+  stats->liveBytes = sAccounts[subsystem].liveBytes;
+  stats->peakBytes = sAccounts[subsystem].peakBytes;
+  stats->allocations = sAccounts[subsystem].allocations;
+}
+
+/**
+ * @brief   Free memory a library handed over to the application, i.e. the
+ *          text from cJSON_Print(..), so it's no longer counted as live
+ *
+ * @param   subsystem: library the memory came from
+ * @param   ptr: memory to free, may be NULL
+ */
+void libiotmem_free(libiotmem_subsystem_e subsystem, void *ptr) {
+  if (sStarted) {
+    _libiotmem_freeing(subsystem, ptr);
+  }
+
+  free(ptr);
+}
+
+/***************** Private Functions ****************/
+/**
+ * Count an allocation that was just made
+ */
+static void _libiotmem_allocated(libiotmem_subsystem_e subsystem, void *ptr) {
+  libiotmem_account_t *account = &sAccounts[subsystem];
+  int64_t bytes;
+  int64_t live;
+  int64_t peak;
+
+  if (ptr == NULL) {
+    return;
+  }
+
+  bytes = LIBIOTMEM_USABLE_SIZE(ptr);
+  live = __sync_add_and_fetch(&account->liveBytes, bytes);
+  __sync_add_and_fetch(&account->allocations, 1);
+
+  while ((peak = account->peakBytes) < live) {
+    if (__sync_bool_compare_and_swap(&account->peakBytes, peak, live)) {
+      if (sPublish) {
+        libmetrics_set(account->peakMetric, live);
+      }
+      break;
+    }
+  }
+
+  if (sPublish) {
+    libmetrics_set(account->liveMetric, live);
+    libmetrics_add(account->allocationsMetric, 1);
+  }
+
+#if LIBIOTMEM_DEBUG
+  _libiotmem_track(subsystem, ptr, bytes);
+#endif
+}
+
+/**
+ * Count an allocation that's about to be freed
+ */
+static void _libiotmem_freeing(libiotmem_subsystem_e subsystem, void *ptr) {
+  libiotmem_account_t *account = &sAccounts[subsystem];
+  int64_t live;
+
+  if (ptr == NULL) {
+    return;
+  }
+
+  live = __sync_sub_and_fetch(&account->liveBytes, (int64_t) LIBIOTMEM_USABLE_SIZE(ptr));
+
+  if (sPublish) {
+    libmetrics_set(account->liveMetric, live);
+  }
+
+#if LIBIOTMEM_DEBUG
+  _libiotmem_untrack(ptr);
+#endif
+}
+
+/**
+ * Reallocate and count the change. If the reallocation fails, the original
+ * allocation is left as it was, and so is its accounting.
+ */
+static void *_libiotmem_realloc(libiotmem_subsystem_e subsystem, void *ptr, size_t size) {
+  void *resized;
+  int64_t bytes = 0;
+
+  if (ptr != NULL) {
+    // Measure the old block while it's still ours
+    bytes = LIBIOTMEM_USABLE_SIZE(ptr);
+#if LIBIOTMEM_DEBUG
+    _libiotmem_untrack(ptr);
+#endif
+  }
+
+  if ((resized = realloc(ptr, size)) == NULL && size > 0) {
+#if LIBIOTMEM_DEBUG
+    _libiotmem_track(subsystem, ptr, bytes);
+#endif
+    return NULL;
+  }
+
+  __sync_sub_and_fetch(&sAccounts[subsystem].liveBytes, bytes);
+
+  _libiotmem_allocated(subsystem, resized);
+  return resized;
+}
+
+/**
+ * A child process was forked, it leaves the shared metrics to its parent
+ */
+static void _libiotmem_forked() {
+  sPublish = false;
+}
+
+/**
+ * libxml2's allocator
+ */
+static void *_libiotmem_xmlMalloc(size_t size) {
+  void *ptr = malloc(size);
+  _libiotmem_allocated(LIBIOTMEM_XML, ptr);
+  return ptr;
+}
+
+static void *_libiotmem_xmlRealloc(void *ptr, size_t size) {
+  return _libiotmem_realloc(LIBIOTMEM_XML, ptr, size);
+}
+
+static void _libiotmem_xmlFree(void *ptr) {
+  _libiotmem_freeing(LIBIOTMEM_XML, ptr);
+  free(ptr);
+}
+
+static char *_libiotmem_xmlStrdup(const char *str) {
+  char *ptr = strdup(str);
+  _libiotmem_allocated(LIBIOTMEM_XML, ptr);
+  return ptr;
+}
+
+/**
+ * libcurl's allocator
+ */
+static void *_libiotmem_curlMalloc(size_t size) {
+  void *ptr = malloc(size);
+  _libiotmem_allocated(LIBIOTMEM_CURL, ptr);
+  return ptr;
+}
+
+static void *_libiotmem_curlRealloc(void *ptr, size_t size) {
+  return _libiotmem_realloc(LIBIOTMEM_CURL, ptr, size);
+}
+
+static void _libiotmem_curlFree(void *ptr) {
+  _libiotmem_freeing(LIBIOTMEM_CURL, ptr);
+  free(ptr);
+}
+
+static char *_libiotmem_curlStrdup(const char *str) {
+  char *ptr = strdup(str);
+  _libiotmem_allocated(LIBIOTMEM_CURL, ptr);
+  return ptr;
+}
+
+static void *_libiotmem_curlCalloc(size_t nmemb, size_t size) {
+  void *ptr = calloc(nmemb, size);
+  _libiotmem_allocated(LIBIOTMEM_CURL, ptr);
+  return ptr;
+}
+
+/**
+ * cJSON's allocator
+ */
+static void *_libiotmem_jsonMalloc(size_t size) {
+  void *ptr = malloc(size);
+  _libiotmem_allocated(LIBIOTMEM_JSON, ptr);
+  return ptr;
+}
+
+static void _libiotmem_jsonFree(void *ptr) {
+  _libiotmem_freeing(LIBIOTMEM_JSON, ptr);
+  free(ptr);
+}
+
+#if LIBIOTMEM_DEBUG
+/**
+ * Remember where a live allocation was made
+ */
+static void _libiotmem_track(libiotmem_subsystem_e subsystem, void *ptr, int64_t bytes) {
+  void *frames[LIBIOTMEM_DEBUG_FRAMES + LIBIOTMEM_OWN_FRAMES];
+  libiotmem_site_t *entry;
+  unsigned int i;
+  unsigned int probes;
+  int totalFrames;
+
+  if (sLive == NULL) {
+    return;
+  }
+
+  totalFrames = backtrace(frames, LIBIOTMEM_DEBUG_FRAMES + LIBIOTMEM_OWN_FRAMES) - LIBIOTMEM_OWN_FRAMES;
+
+  pthread_mutex_lock(&sLiveMutex);
+
+  i = _libiotmem_hash(ptr);
+  for (probes = 0; probes < LIBIOTMEM_DEBUG_MAX_ALLOCATIONS && sLive[i].ptr != NULL; probes++) {
+    i = (i + 1) & (LIBIOTMEM_DEBUG_MAX_ALLOCATIONS - 1);
+  }
+
+  if (probes == LIBIOTMEM_DEBUG_MAX_ALLOCATIONS) {
+    sUntracked++;
+
+  } else {
+    entry = &sLive[i];
+    entry->ptr = ptr;
+    entry->subsystem = subsystem;
+    entry->bytes = bytes;
+    entry->count = 1;
+    entry->totalFrames = (totalFrames > 0) ? totalFrames : 0;
+    memcpy(entry->frames, &frames[LIBIOTMEM_OWN_FRAMES], entry->totalFrames * sizeof(void *));
+  }
+
+  pthread_mutex_unlock(&sLiveMutex);
+}
+
+/**
+ * Forget a live allocation, shifting back the entries probed past it so
+ * they can still be found
+ */
+static void _libiotmem_untrack(void *ptr) {
+  unsigned int i;
+  unsigned int j;
+  unsigned int home;
+  unsigned int probes;
+
+  if (sLive == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&sLiveMutex);
+
+  i = _libiotmem_hash(ptr);
+  for (probes = 0; probes < LIBIOTMEM_DEBUG_MAX_ALLOCATIONS && sLive[i].ptr != ptr; probes++) {
+    if (sLive[i].ptr == NULL) {
+      // Not tracked, it was made before we started or the table was full
+      pthread_mutex_unlock(&sLiveMutex);
+      return;
+    }
+    i = (i + 1) & (LIBIOTMEM_DEBUG_MAX_ALLOCATIONS - 1);
+  }
+
+  if (probes < LIBIOTMEM_DEBUG_MAX_ALLOCATIONS) {
+    sLive[i].ptr = NULL;
+
+    for (j = (i + 1) & (LIBIOTMEM_DEBUG_MAX_ALLOCATIONS - 1); sLive[j].ptr != NULL; j = (j + 1) & (LIBIOTMEM_DEBUG_MAX_ALLOCATIONS - 1)) {
+      home = _libiotmem_hash(sLive[j].ptr);
+
+      // Move the entry into the hole unless its home lies between the hole and it
+      if (((j - home) & (LIBIOTMEM_DEBUG_MAX_ALLOCATIONS - 1)) >= ((j - i) & (LIBIOTMEM_DEBUG_MAX_ALLOCATIONS - 1))) {
+        sLive[i] = sLive[j];
+        sLive[j].ptr = NULL;
+        i = j;
+      }
+    }
+  }
+
+  pthread_mutex_unlock(&sLiveMutex);
+}
+
+/**
+ * @return the home slot of an allocation in the table
+ */
+static unsigned int _libiotmem_hash(const void *ptr) {
+  return (unsigned int) (((uintptr_t) ptr >> 4) * 2654435761u) & (LIBIOTMEM_DEBUG_MAX_ALLOCATIONS - 1);
+}
+
+/**
+ * Log the allocations still live, grouped by call site, the most bytes first
+ */
+static void _libiotmem_reportSites() {
+  libiotmem_site_t *sites;
+  char **symbols;
+  int totalSites = 0;
+  int i;
+  int j;
+  int k;
+
+  if (sLive == NULL) {
+    return;
+  }
+
+  if ((sites = calloc(LIBIOTMEM_DEBUG_MAX_SITES, sizeof(libiotmem_site_t))) == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&sLiveMutex);
+
+  for (i = 0; i < LIBIOTMEM_DEBUG_MAX_ALLOCATIONS; i++) {
+    if (sLive[i].ptr == NULL) {
+      continue;
+    }
+
+    for (j = 0; j < totalSites; j++) {
+      if (sites[j].subsystem == sLive[i].subsystem
+          && sites[j].totalFrames == sLive[i].totalFrames
+          && memcmp(sites[j].frames, sLive[i].frames, sLive[i].totalFrames * sizeof(void *)) == 0) {
+        break;
+      }
+    }
+
+    if (j == totalSites) {
+      if (totalSites == LIBIOTMEM_DEBUG_MAX_SITES) {
+        continue;
+      }
+
+      sites[j] = sLive[i];
+      sites[j].bytes = 0;
+      sites[j].count = 0;
+      totalSites++;
+    }
+
+    sites[j].bytes += sLive[i].bytes;
+    sites[j].count++;
+  }
+
+  pthread_mutex_unlock(&sLiveMutex);
+
+  qsort(sites, totalSites, sizeof(libiotmem_site_t), _libiotmem_compareSites);
+
+  if (sUntracked > 0) {
+    SYSLOG_WARNING("[mem] %llu allocations didn't fit in the table and aren't reported", (unsigned long long) sUntracked);
+  }
+
+  for (i = 0; i < totalSites && i < LIBIOTMEM_DEBUG_REPORT_SITES; i++) {
+    SYSLOG_WARNING("[mem] %s: %lld bytes in %d allocations still live from:",
+        sNames[sites[i].subsystem], (long long) sites[i].bytes, sites[i].count);
+
+    if ((symbols = backtrace_symbols(sites[i].frames, sites[i].totalFrames)) != NULL) {
+      for (k = 0; k < sites[i].totalFrames; k++) {
+        SYSLOG_WARNING("[mem]     %s", symbols[k]);
+      }
+      free(symbols);
+    }
+  }
+
+  free(sites);
+}
+
+/**
+ * Order call sites by bytes, the most first
+ */
+static int _libiotmem_compareSites(const void *a, const void *b) {
+  const libiotmem_site_t *siteA = a;
+  const libiotmem_site_t *siteB = b;
+
+  if (siteA->bytes == siteB->bytes) {
+    return 0;
+  }
+
+  return (siteA->bytes > siteB->bytes) ? -1 : 1;
+}
+#endif
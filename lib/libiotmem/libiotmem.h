@@ -0,0 +1,90 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef LIBIOTMEM_H
+#define LIBIOTMEM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Set to 1 to remember where every live allocation was made, and report the
+ * allocations still live at libiotmem_stop() by call site.  Needs backtrace()
+ * from glibc, and costs a table entry and a stack walk per allocation.
+ */
+#ifndef LIBIOTMEM_DEBUG
+#define LIBIOTMEM_DEBUG 0
+#endif
+
+/** Live allocations the debug mode can remember, a power of 2 */
+#ifndef LIBIOTMEM_DEBUG_MAX_ALLOCATIONS
+#define LIBIOTMEM_DEBUG_MAX_ALLOCATIONS 65536
+#endif
+
+/** Stack frames remembered for each allocation in the debug mode */
+#ifndef LIBIOTMEM_DEBUG_FRAMES
+#define LIBIOTMEM_DEBUG_FRAMES 6
+#endif
+
+/** Call sites reported at libiotmem_stop(), the biggest first */
+#ifndef LIBIOTMEM_DEBUG_REPORT_SITES
+#define LIBIOTMEM_DEBUG_REPORT_SITES 16
+#endif
+
+/**
+ * Heap users we account for separately
+ */
+typedef enum libiotmem_subsystem_e {
+  /** libxml2, through xmlMemSetup(..) */
+  LIBIOTMEM_XML = 0,
+
+  /** libcurl, through curl_global_init_mem(..) */
+  LIBIOTMEM_CURL,
+
+  /** cJSON, through cJSON_InitHooks(..) */
+  LIBIOTMEM_JSON,
+
+  LIBIOTMEM_TOTAL_SUBSYSTEMS,
+} libiotmem_subsystem_e;
+
+/**
+ * What a subsystem has on the heap
+ */
+typedef struct libiotmem_stats_t {
+
+  /** Bytes allocated and not freed yet */
+  int64_t liveBytes;
+
+  /** Most bytes that were ever live at once */
+  int64_t peakBytes;
+
+  /** Allocations made so far, reallocations included */
+  uint64_t allocations;
+
+} libiotmem_stats_t;
+
+/***************** Public Prototypes ****************/
+int libiotmem_start();
+
+void libiotmem_stop();
+
+void libiotmem_get(libiotmem_subsystem_e subsystem, libiotmem_stats_t *stats);
+
+void libiotmem_free(libiotmem_subsystem_e subsystem, void *ptr);
+
+#endif
@@ -0,0 +1,489 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ *  @file         libmetrics.c
+ *
+ *  @brief    Registry of counters, gauges and latency histograms
+ *
+ *  Updates are atomic adds and stores, so they never block. Counters are
+ *  spread over LIBMETRICS_SHARDS cache lines picked by thread, and summed
+ *  when they're read. The registry is mapped shared, so processes forked
+ *  after libmetrics_start() add into the same metrics as their parent.
+ *
+ *  Registering a metric that already exists returns the existing one, so
+ *  modules register their metrics the first time they need them.
+ *
+ *  A process that doesn't share the proxyserver's registry, like an agent,
+ *  can answer scrapes of its own metrics on a port with libmetrics_serve().
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "iotdebug.h"
+#include "libmetrics.h"
+
+typedef struct libmetrics_registry_t {
+
+  /** Serializes registration, also across processes */
+  volatile int lock;
+
+  /** Number of metrics registered, only ever grows */
+  volatile int totalMetrics;
+
+  libmetrics_t metrics[LIBMETRICS_MAX_METRICS];
+
+} libmetrics_registry_t;
+
+/** Registry used until, or unless, libmetrics_start() maps a shared one */
+static libmetrics_registry_t sLocalRegistry;
+
+static libmetrics_registry_t *sRegistry = &sLocalRegistry;
+
+/** Upper bounds of the histogram buckets */
+static const uint32_t sBucketBoundsMs[LIBMETRICS_TOTAL_BUCKETS - 1] = LIBMETRICS_BUCKET_BOUNDS_MS;
+
+/***************** Private Prototypes ****************/
+static libmetrics_t *_libmetrics_register(const char *name, const char *help, int type);
+
+static int _libmetrics_shard();
+
+static void *_libmetrics_serverThread(void *arg);
+
+/***************** Public Functions ****************/
+/**
+ * @brief   Map the registry so processes forked from now on share it.
+ *          Call this before any metric is registered.
+ *
+ * @return  0 on success, -1 if the registry stays private to this process
+ */
+int libmetrics_start() {
+  libmetrics_registry_t *registry;
+
+  if (sRegistry != &sLocalRegistry) {
+    return 0;
+  }
+
+  registry = mmap(NULL, sizeof(libmetrics_registry_t), PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  if (registry == MAP_FAILED) {
+    SYSLOG_ERR("Couldn't map the metrics registry: %s", strerror(errno));
+    return -1;
+  }
+
+  if (sLocalRegistry.totalMetrics > 0) {
+    SYSLOG_WARNING("%d metrics registered before the registry was shared", sLocalRegistry.totalMetrics);
+    memcpy(registry, &sLocalRegistry, sizeof(libmetrics_registry_t));
+  }
+
+  __sync_synchronize();
+  sRegistry = registry;
+  return 0;
+}
+
+/**
+ * @brief   Find or register a counter, which only goes up
+ *
+ * @param   name: metric name, i.e. "proxy_push_total"
+ * @param   help: one line description
+ * @return  the counter, or NULL if the registry is full
+ */
+libmetrics_t *libmetrics_counter(const char *name, const char *help) {
+  return _libmetrics_register(name, help, LIBMETRICS_COUNTER);
+}
+
+/**
+ * @brief   Find or register a gauge, which holds the last value set
+ */
+libmetrics_t *libmetrics_gauge(const char *name, const char *help) {
+  return _libmetrics_register(name, help, LIBMETRICS_GAUGE);
+}
+
+/**
+ * @brief   Find or register a histogram of durations
+ */
+libmetrics_t *libmetrics_histogram(const char *name, const char *help) {
+  return _libmetrics_register(name, help, LIBMETRICS_HISTOGRAM);
+}
+
+/**
+ * @brief   Add to a counter
+ *
+ * @param   metric: counter, does nothing if NULL
+ * @param   value: amount to add
+ */
+void libmetrics_add(libmetrics_t *metric, uint64_t value) {
+  if (metric != NULL) {
+    __sync_fetch_and_add(&metric->shards[_libmetrics_shard()].value, value);
+  }
+}
+
+/**
+ * @brief   Set a gauge
+ *
+ * @param   metric: gauge, does nothing if NULL
+ * @param   value: new value
+ */
+void libmetrics_set(libmetrics_t *metric, int64_t value) {
+  if (metric != NULL) {
+    metric->shards[0].value = (uint64_t) value;
+    __sync_synchronize();
+  }
+}
+
+/**
+ * @brief   Record a duration in a histogram
+ *
+ * @param   metric: histogram, does nothing if NULL
+ * @param   seconds: duration
+ */
+void libmetrics_observe(libmetrics_t *metric, double seconds) {
+  uint64_t usec;
+  int i;
+
+  if (metric == NULL) {
+    return;
+  }
+
+  usec = (seconds > 0) ? (uint64_t) (seconds * 1000000.0) : 0;
+
+  for (i = 0; i < LIBMETRICS_TOTAL_BUCKETS - 1 && usec > sBucketBoundsMs[i] * 1000ULL; i++) {
+  }
+
+  __sync_fetch_and_add(&metric->buckets[i], 1);
+  __sync_fetch_and_add(&metric->sumUsec, usec);
+}
+
+/**
+ * @return  the counter's total, the gauge's value, or the number of
+ *          observations in the histogram
+ */
+int64_t libmetrics_value(const libmetrics_t *metric) {
+  uint64_t value = 0;
+  int i;
+
+  if (metric == NULL) {
+    return 0;
+  }
+
+  switch (metric->type) {
+  case LIBMETRICS_COUNTER:
+    for (i = 0; i < LIBMETRICS_SHARDS; i++) {
+      value += metric->shards[i].value;
+    }
+    break;
+
+  case LIBMETRICS_GAUGE:
+    value = metric->shards[0].value;
+    break;
+
+  default:
+    for (i = 0; i < LIBMETRICS_TOTAL_BUCKETS; i++) {
+      value += metric->buckets[i];
+    }
+    break;
+  }
+
+  return (int64_t) value;
+}
+
+/**
+ * @return  the mean of the histogram's observations in seconds, 0 if there are none
+ */
+double libmetrics_mean(const libmetrics_t *metric) {
+  int64_t count = libmetrics_value(metric);
+
+  if (count <= 0 || metric->type != LIBMETRICS_HISTOGRAM) {
+    return 0;
+  }
+
+  return (double) metric->sumUsec / 1000000.0 / count;
+}
+
+/**
+ * @brief   Write every metric in the Prometheus text exposition format
+ *
+ * @param   dest: buffer for the text
+ * @param   destLen: size of the buffer
+ * @return  length of the text, or -1 if it didn't fit
+ */
+int libmetrics_print(char *dest, int destLen) {
+  static const char *types[] = { "counter", "gauge", "histogram" };
+  libmetrics_registry_t *registry = sRegistry;
+  libmetrics_t *metric;
+  uint64_t cumulative;
+  int total = registry->totalMetrics;
+  int offset = 0;
+  int i;
+  int j;
+
+  dest[0] = '\0';
+
+  for (i = 0; i < total && offset < destLen; i++) {
+    metric = &registry->metrics[i];
+
+    offset += snprintf(dest + offset, destLen - offset, "# HELP %s %s\n# TYPE %s %s\n",
+        metric->name, metric->help, metric->name, types[metric->type]);
+
+    if (metric->type != LIBMETRICS_HISTOGRAM) {
+      if (offset < destLen) {
+        offset += snprintf(dest + offset, destLen - offset, "%s %lld\n",
+            metric->name, (long long) libmetrics_value(metric));
+      }
+      continue;
+    }
+
+    cumulative = 0;
+    for (j = 0; j < LIBMETRICS_TOTAL_BUCKETS && offset < destLen; j++) {
+      cumulative += metric->buckets[j];
+
+      if (j < LIBMETRICS_TOTAL_BUCKETS - 1) {
+        offset += snprintf(dest + offset, destLen - offset, "%s_bucket{le=\"%g\"} %llu\n",
+            metric->name, sBucketBoundsMs[j] / 1000.0, (unsigned long long) cumulative);
+      } else {
+        offset += snprintf(dest + offset, destLen - offset, "%s_bucket{le=\"+Inf\"} %llu\n",
+            metric->name, (unsigned long long) cumulative);
+      }
+    }
+
+    if (offset < destLen) {
+      offset += snprintf(dest + offset, destLen - offset, "%s_sum %.6f\n%s_count %llu\n",
+          metric->name, metric->sumUsec / 1000000.0, metric->name, (unsigned long long) cumulative);
+    }
+  }
+
+  if (offset >= destLen) {
+    SYSLOG_ERR("Metrics need more than %d bytes", destLen);
+    return -1;
+  }
+
+  return offset;
+}
+
+/**
+ * @brief   Answer a scrape with every metric, as an HTTP response. The text
+ *          grows up to LIBMETRICS_MAX_TEXT_SIZE, past that the scrape gets
+ *          a 500.
+ *
+ * @param   fd: socket the scrape came in on
+ * @return  0 if the metrics were written, -1 if not
+ */
+int libmetrics_respond(int fd) {
+  char header[128];
+  char *text = NULL;
+  char *bigger;
+  int size = LIBMETRICS_TEXT_SIZE / 2;
+  int len = -1;
+  int offset = 0;
+  int written;
+
+  while (len < 0 && size < LIBMETRICS_MAX_TEXT_SIZE) {
+    size *= 2;
+    if ((bigger = realloc(text, size)) == NULL) {
+      break;
+    }
+    text = bigger;
+    len = libmetrics_print(text, size);
+  }
+
+  if (len < 0) {
+    snprintf(header, sizeof(header), "HTTP/1.0 500 Internal Server Error\r\n"
+        "Content-Length: 0\r\n"
+        "Connection: close\r\n\r\n");
+  } else {
+    snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: %d\r\n"
+        "Connection: close\r\n\r\n", len);
+  }
+
+  if (write(fd, header, strlen(header)) < 0) {
+    SYSLOG_ERR("Couldn't answer the scrape: %s", strerror(errno));
+    len = -1;
+  }
+
+  while (offset < len) {
+    if ((written = write(fd, text + offset, len - offset)) <= 0) {
+      SYSLOG_ERR("Scrape cut short");
+      len = -1;
+      break;
+    }
+    offset += written;
+  }
+
+  free(text);
+  return len < 0 ? -1 : 0;
+}
+
+/**
+ * @brief   Answer scrapes of "GET /metrics" on a port of our own, from a
+ *          background thread
+ *
+ * @param   address: IPv4 address to listen on, NULL for the loopback
+ *          interface only
+ * @param   port: TCP port to listen on
+ * @return  0 if we're listening, -1 if not
+ */
+int libmetrics_serve(const char *address, int port) {
+  struct sockaddr_in local;
+  pthread_attr_t attr;
+  pthread_t thread;
+  int reuse = 1;
+  int fd;
+
+  if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+    SYSLOG_ERR("Couldn't open the metrics socket: %s", strerror(errno));
+    return -1;
+  }
+
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  memset(&local, 0, sizeof(local));
+  local.sin_family = AF_INET;
+  local.sin_port = htons(port);
+
+  if (address == NULL) {
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  } else if (inet_pton(AF_INET, address, &local.sin_addr) != 1) {
+    SYSLOG_ERR("Can't serve metrics on %s, not an IPv4 address", address);
+    close(fd);
+    return -1;
+  }
+
+  if (bind(fd, (struct sockaddr *) &local, sizeof(local)) < 0 || listen(fd, 5) < 0) {
+    SYSLOG_ERR("Couldn't serve metrics on %s:%d: %s", address != NULL ? address : "localhost", port, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  if (pthread_create(&thread, &attr, &_libmetrics_serverThread, (void *) (intptr_t) fd) != 0) {
+    SYSLOG_ERR("Couldn't start the metrics thread");
+    pthread_attr_destroy(&attr);
+    close(fd);
+    return -1;
+  }
+
+  pthread_attr_destroy(&attr);
+  SYSLOG_INFO("Serving metrics on %s:%d", address != NULL ? address : "localhost", port);
+  return 0;
+}
+
+/***************** Private Functions ****************/
+/**
+ * Accept scrapes one at a time and answer them
+ */
+static void *_libmetrics_serverThread(void *arg) {
+  static const char *notFound = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+  struct timeval timeout = { 2, 0 };
+  char request[256];
+  int listenFd = (int) (intptr_t) arg;
+  int fd;
+  int n;
+
+  while (true) {
+    if ((fd = accept(listenFd, NULL, NULL)) < 0) {
+      if (errno != EINTR) {
+        SYSLOG_ERR("Metrics socket failed: %s", strerror(errno));
+        sleep(1);
+      }
+      continue;
+    }
+
+    // Don't let a client that never sends its request hold up the others
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    if ((n = read(fd, request, sizeof(request) - 1)) > 0) {
+      request[n] = '\0';
+      if (strncmp(request, LIBMETRICS_REQUEST, strlen(LIBMETRICS_REQUEST)) == 0) {
+        libmetrics_respond(fd);
+      } else if (write(fd, notFound, strlen(notFound)) < 0) {
+        SYSLOG_DEBUG("Couldn't answer a request for something else");
+      }
+    }
+
+    shutdown(fd, SHUT_RDWR);
+    close(fd);
+  }
+
+  return NULL;
+}
+
+/**
+ * Find a metric by name, or add it to the registry
+ */
+static libmetrics_t *_libmetrics_register(const char *name, const char *help, int type) {
+  libmetrics_registry_t *registry = sRegistry;
+  libmetrics_t *metric = NULL;
+  int i;
+
+  while (__sync_lock_test_and_set(&registry->lock, 1)) {
+  }
+
+  for (i = 0; i < registry->totalMetrics && metric == NULL; i++) {
+    if (strcmp(registry->metrics[i].name, name) == 0) {
+      metric = &registry->metrics[i];
+    }
+  }
+
+  if (metric == NULL && registry->totalMetrics < LIBMETRICS_MAX_METRICS) {
+    metric = &registry->metrics[registry->totalMetrics];
+    snprintf(metric->name, sizeof(metric->name), "%s", name);
+    snprintf(metric->help, sizeof(metric->help), "%s", help);
+    metric->type = type;
+
+    // Readers only look as far as totalMetrics
+    __sync_synchronize();
+    registry->totalMetrics++;
+
+  } else if (metric == NULL) {
+    SYSLOG_ERR("No room for metric %s", name);
+  }
+
+  __sync_lock_release(&registry->lock);
+
+  return metric;
+}
+
+/**
+ * @return  the counter slot of the calling thread
+ */
+static int _libmetrics_shard() {
+  uintptr_t thread = (uintptr_t) pthread_self();
+
+  thread ^= thread >> 12;
+  thread ^= thread >> 7;
+  return (int) (thread % LIBMETRICS_SHARDS);
+}
+
@@ -0,0 +1,123 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef LIBMETRICS_H
+#define LIBMETRICS_H
+
+#include <stdint.h>
+
+/** Maximum number of metrics in the registry */
+#ifndef LIBMETRICS_MAX_METRICS
+#define LIBMETRICS_MAX_METRICS 64
+#endif
+
+/** Number of counter slots threads are spread over */
+#ifndef LIBMETRICS_SHARDS
+#define LIBMETRICS_SHARDS 4
+#endif
+
+/** Maximum size of a metric name, including the null */
+#define LIBMETRICS_NAME_SIZE 48
+
+/** Maximum size of a metric's description, including the null */
+#define LIBMETRICS_HELP_SIZE 96
+
+/** Number of histogram buckets, the last one has no upper bound */
+#define LIBMETRICS_TOTAL_BUCKETS 14
+
+/** Request line prefix a scrape starts with */
+#define LIBMETRICS_REQUEST "GET /metrics"
+
+/** Initial size of the text of a scrape */
+#ifndef LIBMETRICS_TEXT_SIZE
+#define LIBMETRICS_TEXT_SIZE 32768
+#endif
+
+/** Largest the text of a scrape may grow to before it's answered with an error */
+#ifndef LIBMETRICS_MAX_TEXT_SIZE
+#define LIBMETRICS_MAX_TEXT_SIZE (LIBMETRICS_TEXT_SIZE * 8)
+#endif
+
+/** Upper bounds of the histogram buckets in milliseconds */
+#define LIBMETRICS_BUCKET_BOUNDS_MS { 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 30000, 60000 }
+
+enum {
+  LIBMETRICS_COUNTER = 0,
+  LIBMETRICS_GAUGE,
+  LIBMETRICS_HISTOGRAM,
+};
+
+/**
+ * Counter slot, one cache line long so threads adding to different slots
+ * don't fight over it
+ */
+typedef struct libmetrics_shard_t {
+  volatile uint64_t value;
+  uint8_t padding[64 - sizeof(uint64_t)];
+} libmetrics_shard_t;
+
+/**
+ * A counter, gauge or latency histogram
+ */
+typedef struct libmetrics_t {
+
+  char name[LIBMETRICS_NAME_SIZE];
+
+  char help[LIBMETRICS_HELP_SIZE];
+
+  /** LIBMETRICS_COUNTER, LIBMETRICS_GAUGE or LIBMETRICS_HISTOGRAM */
+  int type;
+
+  /** Counters add into the thread's slot, gauges only use the first one */
+  libmetrics_shard_t shards[LIBMETRICS_SHARDS];
+
+  /** Histogram observations in each bucket */
+  volatile uint64_t buckets[LIBMETRICS_TOTAL_BUCKETS];
+
+  /** Sum of the histogram observations in microseconds */
+  volatile uint64_t sumUsec;
+
+} libmetrics_t;
+
+/***************** Public Prototypes ****************/
+int libmetrics_start();
+
+libmetrics_t *libmetrics_counter(const char *name, const char *help);
+
+libmetrics_t *libmetrics_gauge(const char *name, const char *help);
+
+libmetrics_t *libmetrics_histogram(const char *name, const char *help);
+
+void libmetrics_add(libmetrics_t *metric, uint64_t value);
+
+void libmetrics_set(libmetrics_t *metric, int64_t value);
+
+void libmetrics_observe(libmetrics_t *metric, double seconds);
+
+int64_t libmetrics_value(const libmetrics_t *metric);
+
+double libmetrics_mean(const libmetrics_t *metric);
+
+int libmetrics_print(char *dest, int destLen);
+
+int libmetrics_respond(int fd);
+
+int libmetrics_serve(const char *address, int port);
+
+#endif
+
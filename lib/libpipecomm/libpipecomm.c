@@ -33,8 +33,17 @@
 #include <unistd.h>
 
 #include "iotdebug.h"
+#include "libmetrics.h"
 #include "libpipecomm.h"
 
+/** Pipe metrics, registered on first use */
+static libmetrics_t *sWrites;
+static libmetrics_t *sWrittenBytes;
+static libmetrics_t *sWriteErrors;
+static libmetrics_t *sReadBytes;
+
+static void _libpipecomm_registerMetrics();
+
 /**
  * @brief   Open named pipe for bidirectional communication
  *
@@ -80,12 +89,18 @@ int libpipecomm_write(int fd, const char *msg, uint16_t msgLen) {
 
     memcpy(rawPacket + 2, msg, msgLen);
 
+    _libpipecomm_registerMetrics();
+
     bytesWritten = write(fd, rawPacket, msgLen + 2);
 
     if (bytesWritten == msgLen + 2) {
+      libmetrics_add(sWrites, 1);
+      libmetrics_add(sWrittenBytes, msgLen);
     } else if (bytesWritten == -1) {
       SYSLOG_ERR("%s for fd %d", strerror(errno), fd);
+      libmetrics_add(sWriteErrors, 1);
     } else {
+      libmetrics_add(sWriteErrors, 1);
       SYSLOG_ERR("Wrote %d bytes to pipe (requested = %d), %s", bytesWritten,
           strlen(rawPacket), strerror(errno));
     }
@@ -135,6 +150,9 @@ int libpipecomm_read(int fd, char *msg, uint16_t maxLen) {
         // should never return 0 here.
         if (bytesRead <= 0) {
           SYSLOG_ERR("Read %d bytes, %s", bytesRead, strerror(errno));
+        } else {
+          _libpipecomm_registerMetrics();
+          libmetrics_add(sReadBytes, bytesRead);
         }
       }
     } else {
@@ -153,3 +171,18 @@ int libpipecomm_read(int fd, char *msg, uint16_t maxLen) {
 
   return bytesRead;
 }
+
+/**
+ * @brief   Register the pipe metrics the first time they're needed.
+ *          Registering twice is harmless.
+ */
+static void _libpipecomm_registerMetrics() {
+  if (sReadBytes != NULL) {
+    return;
+  }
+
+  sWrites = libmetrics_counter("pipecomm_writes_total", "Messages written to pipes and sockets");
+  sWrittenBytes = libmetrics_counter("pipecomm_written_bytes_total", "Message bytes written to pipes and sockets");
+  sWriteErrors = libmetrics_counter("pipecomm_write_errors_total", "Messages that couldn't be written whole");
+  sReadBytes = libmetrics_counter("pipecomm_read_bytes_total", "Message bytes read from pipes");
+}
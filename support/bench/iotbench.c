@@ -0,0 +1,428 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * Microbenchmarks for the paths every message takes through the SDK.
+ *
+ * Each benchmark is run enough times to take IOTBENCH_MIN_TIME_MS, and the
+ * fastest of IOTBENCH_ROUNDS runs is reported as the time per operation.
+ * Allocations are counted by replacing malloc(), so they include whatever
+ * libxml2 and cJSON allocate on our behalf.
+ *
+ * Results are printed one benchmark per line, in the same format a baseline
+ * is read back in. Compared against a baseline, any benchmark that got
+ * slower by more than the threshold, or allocates more than it did, is a
+ * regression and the exit status is 1.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "ioterror.h"
+#include "iotdebug.h"
+#include "iotbench.h"
+
+/** Allocations made by the benchmarking thread */
+static __thread uint64_t sAllocations;
+static __thread uint64_t sAllocatedBytes;
+
+/** Where the corpora are */
+static const char *sCorpusDir = IOTBENCH_DEFAULT_CORPUS_DIR;
+
+/** Baseline to compare against, or NULL */
+static const char *sBaselineFilename;
+
+/** File to save the results to, or NULL */
+static const char *sOutputFilename;
+
+/** Only run benchmarks whose name contains this, or NULL */
+static const char *sFilter;
+
+/** Percent slower that counts as a regression */
+static double sThresholdPercent = IOTBENCH_DEFAULT_THRESHOLD_PERCENT;
+
+/** Minimum time to run each benchmark */
+static long sMinTimeMs = IOTBENCH_MIN_TIME_MS;
+
+/** Baseline results */
+static iotbench_result_t sBaseline[IOTBENCH_MAX_RESULTS];
+static int sTotalBaseline;
+
+/** Keeps the compiler from optimizing results away */
+static const void * volatile sSink;
+
+/** glibc's allocator, which ours passes through to */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+
+/***************** Private Prototypes ****************/
+static void _iotbench_parse(int argc, char *argv[]);
+
+static void _iotbench_printUsage();
+
+static void _iotbench_measure(const iotbench_case_t *benchmark, iotbench_result_t *result);
+
+static uint64_t _iotbench_time(iotbench_f run, long iterations);
+
+static error_t _iotbench_readBaseline(const char *filename);
+
+static int _iotbench_format(char *dest, int maxSize, const iotbench_result_t *result);
+
+static bool _iotbench_compare(const iotbench_result_t *result, char *dest, int maxSize);
+
+static uint64_t _iotbench_nowNs();
+
+
+/***************** Functions ****************/
+/**
+ * Main function
+ */
+int main(int argc, char *argv[]) {
+  iotbench_result_t result;
+  char line[256];
+  char comparison[64];
+  FILE *output = NULL;
+  int regressions = 0;
+  int i;
+
+  _iotbench_parse(argc, argv);
+
+  // The benchmarks measure the work, not the logging
+  libiotlog_setLevels("*=err");
+
+  if (sBaselineFilename != NULL && _iotbench_readBaseline(sBaselineFilename) != SUCCESS) {
+    printf("Couldn't read the baseline %s\n", sBaselineFilename);
+    return 2;
+  }
+
+  if (sOutputFilename != NULL && (output = fopen(sOutputFilename, "w")) == NULL) {
+    printf("Couldn't write %s\n", sOutputFilename);
+    return 2;
+  }
+
+  for (i = 0; iotbenchCases[i].name != NULL; i++) {
+    if (sFilter != NULL && strstr(iotbenchCases[i].name, sFilter) == NULL) {
+      continue;
+    }
+
+    if (iotbenchCases[i].setup != NULL && iotbenchCases[i].setup() < 0) {
+      printf("%-36s skipped\n", iotbenchCases[i].name);
+      continue;
+    }
+
+    _iotbench_measure(&iotbenchCases[i], &result);
+    _iotbench_format(line, sizeof(line), &result);
+
+    comparison[0] = '\0';
+    if (sBaselineFilename != NULL && _iotbench_compare(&result, comparison, sizeof(comparison))) {
+      regressions++;
+    }
+
+    printf("%s%s\n", line, comparison);
+    fflush(stdout);
+
+    if (output != NULL) {
+      fprintf(output, "%s\n", line);
+    }
+  }
+
+  if (output != NULL) {
+    fclose(output);
+  }
+
+  if (regressions > 0) {
+    printf("%d regression%s beyond %.0f%%\n", regressions, regressions > 1 ? "s" : "", sThresholdPercent);
+    return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * Read a corpus file, once. The contents are null-terminated and stay
+ * allocated for the life of the process.
+ *
+ * @param filename File in the corpus directory
+ * @param len Returns the length of the contents
+ * @return The contents, or NULL if the file couldn't be read
+ */
+const char *iotbench_corpus(const char *filename, int *len) {
+  char path[PATH_MAX];
+  char *contents;
+  FILE *file;
+
+  snprintf(path, sizeof(path), "%s/%s", sCorpusDir, filename);
+  if ((file = fopen(path, "r")) == NULL) {
+    printf("Couldn't open %s\n", path);
+    return NULL;
+  }
+
+  if ((contents = __libc_malloc(IOTBENCH_MAX_CORPUS_SIZE + 1)) == NULL) {
+    fclose(file);
+    return NULL;
+  }
+
+  *len = fread(contents, 1, IOTBENCH_MAX_CORPUS_SIZE, file);
+  contents[*len] = '\0';
+  fclose(file);
+  return contents;
+}
+
+/**
+ * Keep a result alive, so the work that produced it can't be optimized away
+ * @param value Anything
+ */
+void iotbench_keep(const void *value) {
+  sSink = value;
+}
+
+/**
+ * Count allocations on the way to glibc
+ */
+void *malloc(size_t size) {
+  sAllocations++;
+  sAllocatedBytes += size;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+  sAllocations++;
+  sAllocatedBytes += nmemb * size;
+  return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  sAllocations++;
+  sAllocatedBytes += size;
+  return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+  __libc_free(ptr);
+}
+
+
+/***************** Private Functions ****************/
+/**
+ * Parse the command line arguments
+ */
+static void _iotbench_parse(int argc, char *argv[]) {
+  int c;
+
+  while ((c = getopt(argc, argv, "c:b:o:t:f:m:lh")) != -1) {
+    switch (c) {
+    case 'c':
+      sCorpusDir = optarg;
+      break;
+
+    case 'b':
+      sBaselineFilename = optarg;
+      break;
+
+    case 'o':
+      sOutputFilename = optarg;
+      break;
+
+    case 't':
+      sThresholdPercent = atof(optarg);
+      break;
+
+    case 'f':
+      sFilter = optarg;
+      break;
+
+    case 'm':
+      sMinTimeMs = atol(optarg);
+      break;
+
+    case 'l':
+      for (c = 0; iotbenchCases[c].name != NULL; c++) {
+        printf("%s\n", iotbenchCases[c].name);
+      }
+      exit(0);
+      break;
+
+    default:
+      _iotbench_printUsage();
+      exit(c == 'h' ? 0 : 2);
+      break;
+    }
+  }
+}
+
+/**
+ * Print the command line usage
+ */
+static void _iotbench_printUsage() {
+  printf("Usage: iotbench [options]\n");
+  printf("\t-c [dir] : Corpus directory, default %s\n", IOTBENCH_DEFAULT_CORPUS_DIR);
+  printf("\t-b [file] : Compare against this baseline, exit 1 on a regression\n");
+  printf("\t-o [file] : Save the results, to use as a baseline later\n");
+  printf("\t-t [percent] : Slowdown that counts as a regression, default %d\n", IOTBENCH_DEFAULT_THRESHOLD_PERCENT);
+  printf("\t-f [text] : Only run benchmarks whose name contains this\n");
+  printf("\t-m [ms] : Minimum time to run each benchmark, default %d\n", IOTBENCH_MIN_TIME_MS);
+  printf("\t-l : List the benchmarks\n");
+  printf("\n");
+}
+
+/**
+ * Find how many iterations take the minimum time, then keep the fastest of
+ * a few runs
+ *
+ * @param benchmark Benchmark to run
+ * @param result Filled in with the cost of one operation
+ */
+static void _iotbench_measure(const iotbench_case_t *benchmark, iotbench_result_t *result) {
+  uint64_t minNs = (uint64_t) sMinTimeMs * 1000000;
+  uint64_t elapsed;
+  uint64_t fastest;
+  long iterations = 1;
+  long next;
+  int round;
+
+  while ((elapsed = _iotbench_time(benchmark->run, iterations)) < minNs) {
+    // Aim a little past the minimum, but don't grow too fast on a fluke
+    next = (elapsed > 0) ? (long) ((double) iterations * minNs * 1.2 / elapsed) : iterations * 100;
+    if (next > iterations * 100) {
+      next = iterations * 100;
+    }
+
+    iterations = (next > iterations) ? next : iterations + 1;
+  }
+
+  fastest = elapsed;
+  for (round = 1; round < IOTBENCH_ROUNDS; round++) {
+    sAllocations = 0;
+    sAllocatedBytes = 0;
+
+    if ((elapsed = _iotbench_time(benchmark->run, iterations)) < fastest) {
+      fastest = elapsed;
+    }
+  }
+
+  snprintf(result->name, sizeof(result->name), "%s", benchmark->name);
+  result->nsPerOp = (double) fastest / iterations;
+  result->allocsPerOp = (double) sAllocations / iterations;
+  result->bytesPerOp = (double) sAllocatedBytes / iterations;
+}
+
+/**
+ * @return Nanoseconds it took to run the benchmark the given number of times
+ */
+static uint64_t _iotbench_time(iotbench_f run, long iterations) {
+  uint64_t start;
+
+  sAllocations = 0;
+  sAllocatedBytes = 0;
+
+  start = _iotbench_nowNs();
+  run(iterations);
+  return _iotbench_nowNs() - start;
+}
+
+/**
+ * Read a baseline saved with -o
+ * @param filename Baseline file
+ * @return SUCCESS if it was read
+ */
+static error_t _iotbench_readBaseline(const char *filename) {
+  char line[256];
+  FILE *file;
+  iotbench_result_t *result;
+
+  if ((file = fopen(filename, "r")) == NULL) {
+    return FAIL;
+  }
+
+  while (fgets(line, sizeof(line), file) != NULL && sTotalBaseline < IOTBENCH_MAX_RESULTS) {
+    result = &sBaseline[sTotalBaseline];
+
+    if (line[0] != '#' && sscanf(line, "%47s %lf ns/op %lf allocs/op %lf B/op",
+        result->name, &result->nsPerOp, &result->allocsPerOp, &result->bytesPerOp) == 4) {
+      sTotalBaseline++;
+    }
+  }
+
+  fclose(file);
+  return SUCCESS;
+}
+
+/**
+ * Format a result the way a baseline is read back in
+ * @return Length of the line
+ */
+static int _iotbench_format(char *dest, int maxSize, const iotbench_result_t *result) {
+  return snprintf(dest, maxSize, "%-36s %12.1f ns/op %8.2f allocs/op %10.1f B/op",
+      result->name, result->nsPerOp, result->allocsPerOp, result->bytesPerOp);
+}
+
+/**
+ * Compare a result with the baseline
+ * @param result The result
+ * @param dest Destination for a note about the difference
+ * @param maxSize Size of the destination
+ * @return true if it's a regression
+ */
+static bool _iotbench_compare(const iotbench_result_t *result, char *dest, int maxSize) {
+  const iotbench_result_t *baseline = NULL;
+  double change;
+  bool slower;
+  bool moreAllocations;
+  int i;
+
+  for (i = 0; i < sTotalBaseline; i++) {
+    if (strcmp(sBaseline[i].name, result->name) == 0) {
+      baseline = &sBaseline[i];
+      break;
+    }
+  }
+
+  if (baseline == NULL) {
+    snprintf(dest, maxSize, "  (new)");
+    return false;
+  }
+
+  change = (baseline->nsPerOp > 0) ? 100.0 * (result->nsPerOp - baseline->nsPerOp) / baseline->nsPerOp : 0;
+  slower = (change > sThresholdPercent);
+
+  // Allocation counts don't vary from run to run, any increase is real
+  moreAllocations = (result->allocsPerOp > baseline->allocsPerOp + 0.01);
+
+  snprintf(dest, maxSize, "  %+6.1f%%%s%s", change,
+      slower ? "  SLOWER" : "",
+      moreAllocations ? "  MORE ALLOCATIONS" : "");
+
+  return slower || moreAllocations;
+}
+
+/**
+ * @return CLOCK_MONOTONIC nanoseconds
+ */
+static uint64_t _iotbench_nowNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
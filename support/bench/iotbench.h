@@ -0,0 +1,99 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef IOTBENCH_H
+#define IOTBENCH_H
+
+#include <stdint.h>
+
+/** Run each benchmark at least this long before trusting the numbers */
+#ifndef IOTBENCH_MIN_TIME_MS
+#define IOTBENCH_MIN_TIME_MS 300
+#endif
+
+/** Measured runs of each benchmark, the fastest one is reported */
+#ifndef IOTBENCH_ROUNDS
+#define IOTBENCH_ROUNDS 5
+#endif
+
+/** Default percent a benchmark may slow down before it counts as a regression */
+#ifndef IOTBENCH_DEFAULT_THRESHOLD_PERCENT
+#define IOTBENCH_DEFAULT_THRESHOLD_PERCENT 10
+#endif
+
+/** Default directory holding the corpora */
+#ifndef IOTBENCH_DEFAULT_CORPUS_DIR
+#define IOTBENCH_DEFAULT_CORPUS_DIR "./corpus"
+#endif
+
+/** Largest corpus file */
+#ifndef IOTBENCH_MAX_CORPUS_SIZE
+#define IOTBENCH_MAX_CORPUS_SIZE 65536
+#endif
+
+/** Most benchmarks in a baseline */
+#define IOTBENCH_MAX_RESULTS 64
+
+/** Longest benchmark name */
+#define IOTBENCH_NAME_SIZE 48
+
+/**
+ * Runs the operation under test the given number of times
+ */
+typedef void (*iotbench_f)(long iterations);
+
+/**
+ * A benchmark
+ */
+typedef struct iotbench_case_t {
+
+  /** Name, "function/corpus" */
+  const char *name;
+
+  /** Prepares the benchmark once, may be NULL. Returns -1 to skip it. */
+  int (*setup)(void);
+
+  /** Runs the benchmark */
+  iotbench_f run;
+
+} iotbench_case_t;
+
+/**
+ * What one operation costs
+ */
+typedef struct iotbench_result_t {
+
+  char name[IOTBENCH_NAME_SIZE];
+
+  double nsPerOp;
+
+  double allocsPerOp;
+
+  double bytesPerOp;
+
+} iotbench_result_t;
+
+/** Benchmarks, terminated by a case with a NULL name */
+extern iotbench_case_t iotbenchCases[];
+
+/***************** Public Prototypes ****************/
+const char *iotbench_corpus(const char *filename, int *len);
+
+void iotbench_keep(const void *value);
+
+#endif
@@ -0,0 +1,416 @@
+/*
+ *  Copyright 2013 People Power Company
+ *  
+ *  This code was developed with funding from People Power Company
+ *  
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * The benchmarks. Each one runs the operation under test in a loop over
+ * the corpora in ./corpus, which are shaped like the traffic we see:
+ *
+ *   s2h_ack.xml       an idle answer from the server
+ *   s2h_commands.xml  a few commands to a few devices
+ *   s2h_burst.xml     a burst of 40 commands
+ *   h2s_measures.xml  a batch of measurements from 8 devices
+ *   tstat.json        an RTOA thermostat's /tstat body
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ioterror.h"
+#include "iotdebug.h"
+#include "iotapi.h"
+#include "h2swrapper.h"
+#include "libpipecomm.h"
+#include "timestamp.h"
+#include "cJSON.h"
+#include "jsonarena.h"
+#include "jsonschema.h"
+#include "jsonwriter.h"
+#include "iotbench.h"
+
+/** Size of the messages we build */
+#define IOTBENCHCASES_MSG_SIZE 8192
+
+/** Size of the messages sent through the pipe */
+#define IOTBENCHCASES_PIPE_MSG_SIZE 256
+
+/** Device type of the synthetic devices */
+#define IOTBENCHCASES_DEVICE_TYPE 9000
+
+/** Size of the arena thermostat statuses are parsed into */
+#define IOTBENCHCASES_ARENA_SIZE 4096
+
+/** Size of the JSON text we write */
+#define IOTBENCHCASES_JSON_SIZE 1024
+
+/** Defined by whatever links the proxy, see proxyserver.c */
+char *argEui64Bytes = NULL;
+char *argDeviceType = NULL;
+
+/** Corpora */
+static const char *sAck;
+static const char *sCommands;
+static const char *sBurst;
+static const char *sMeasures;
+static const char *sTstat;
+static int sAckLen;
+static int sCommandsLen;
+static int sBurstLen;
+static int sMeasuresLen;
+static int sTstatLen;
+
+/** The thermostat's status parsed once, for the benchmarks that print it */
+static cJSON *sTstatTree;
+
+/** Pipe for the round trips */
+static int sPipe[2] = { -1, -1 };
+
+/** A thermostat's measurements, the way the RTOA agent extracts them */
+typedef struct iotbenchcases_tstat_t {
+  double temp;
+  int tmode;
+  int fmode;
+  int override;
+  int hold;
+  double heat;
+  double cool;
+  int tstate;
+  int fstate;
+} iotbenchcases_tstat_t;
+
+static const jsonschema_field_t sTstatFields[] = {
+  JSONSCHEMA_FIELD("temp", JSONSCHEMA_DOUBLE, iotbenchcases_tstat_t, temp, false),
+  JSONSCHEMA_FIELD("tmode", JSONSCHEMA_INT, iotbenchcases_tstat_t, tmode, false),
+  JSONSCHEMA_FIELD("fmode", JSONSCHEMA_INT, iotbenchcases_tstat_t, fmode, false),
+  JSONSCHEMA_FIELD("override", JSONSCHEMA_INT, iotbenchcases_tstat_t, override, false),
+  JSONSCHEMA_FIELD("hold", JSONSCHEMA_INT, iotbenchcases_tstat_t, hold, false),
+  JSONSCHEMA_FIELD("t_heat", JSONSCHEMA_DOUBLE, iotbenchcases_tstat_t, heat, false),
+  JSONSCHEMA_FIELD("t_cool", JSONSCHEMA_DOUBLE, iotbenchcases_tstat_t, cool, false),
+  JSONSCHEMA_FIELD("tstate", JSONSCHEMA_INT, iotbenchcases_tstat_t, tstate, false),
+  JSONSCHEMA_FIELD("fstate", JSONSCHEMA_INT, iotbenchcases_tstat_t, fstate, false),
+  JSONSCHEMA_END,
+};
+
+
+/***************** Private Prototypes ****************/
+static int _iotbenchcases_loadAck(void);
+static int _iotbenchcases_loadCommands(void);
+static int _iotbenchcases_loadBurst(void);
+static int _iotbenchcases_loadMeasures(void);
+static int _iotbenchcases_loadTstat(void);
+static int _iotbenchcases_loadTstatTree(void);
+static int _iotbenchcases_openPipe(void);
+
+static void _iotbenchcases_addString(long iterations);
+static void _iotbenchcases_send(long iterations);
+static void _iotbenchcases_parseAck(long iterations);
+static void _iotbenchcases_parseCommands(long iterations);
+static void _iotbenchcases_parseBurst(long iterations);
+static void _iotbenchcases_parseCommandsLibxml2(long iterations);
+static void _iotbenchcases_wrap(long iterations);
+static void _iotbenchcases_pipeRoundTrip(long iterations);
+static void _iotbenchcases_parseTstat(long iterations);
+static void _iotbenchcases_parseTstatArena(long iterations);
+static void _iotbenchcases_extractTstat(long iterations);
+static void _iotbenchcases_printTstat(long iterations);
+static void _iotbenchcases_writeTstat(long iterations);
+static void _iotbenchcases_writeCommand(long iterations);
+static void _iotbenchcases_getTimestamp(long iterations);
+
+static void _iotbenchcases_parse(iotxml_parser_e type, const char *xml, int len, long iterations);
+static void _iotbenchcases_execute(command_t *cmd);
+
+
+/** Every benchmark, in the order they're run */
+iotbench_case_t iotbenchCases[] = {
+  { "iotxml_addString", NULL, _iotbenchcases_addString },
+  { "iotxml_send", NULL, _iotbenchcases_send },
+  { "iotxml_parse/ack", _iotbenchcases_loadAck, _iotbenchcases_parseAck },
+  { "iotxml_parse/commands", _iotbenchcases_loadCommands, _iotbenchcases_parseCommands },
+  { "iotxml_parse/burst", _iotbenchcases_loadBurst, _iotbenchcases_parseBurst },
+  { "iotxml_parse/commands_libxml2", _iotbenchcases_loadCommands, _iotbenchcases_parseCommandsLibxml2 },
+  { "h2swrapper_wrap/measures", _iotbenchcases_loadMeasures, _iotbenchcases_wrap },
+  { "libpipecomm_roundtrip", _iotbenchcases_openPipe, _iotbenchcases_pipeRoundTrip },
+  { "cJSON_Parse/tstat", _iotbenchcases_loadTstat, _iotbenchcases_parseTstat },
+  { "jsonarena_parse/tstat", _iotbenchcases_loadTstat, _iotbenchcases_parseTstatArena },
+  { "jsonschema_extract/tstat", _iotbenchcases_loadTstat, _iotbenchcases_extractTstat },
+  { "cJSON_PrintUnformatted/tstat", _iotbenchcases_loadTstatTree, _iotbenchcases_printTstat },
+  { "jsonwriter_item/tstat", _iotbenchcases_loadTstatTree, _iotbenchcases_writeTstat },
+  { "jsonwriter/command", NULL, _iotbenchcases_writeCommand },
+  { "getTimestamp", NULL, _iotbenchcases_getTimestamp },
+  { NULL, NULL, NULL },
+};
+
+
+/***************** Public Functions ****************/
+/**
+ * Messages the generator sends go nowhere
+ */
+error_t application_send(const char *msg, int len) {
+  iotbench_keep(msg);
+  return SUCCESS;
+}
+
+
+/***************** Private Functions ****************/
+static int _iotbenchcases_loadAck(void) {
+  return (sAck = iotbench_corpus("s2h_ack.xml", &sAckLen)) != NULL ? 0 : -1;
+}
+
+static int _iotbenchcases_loadCommands(void) {
+  return (sCommands = iotbench_corpus("s2h_commands.xml", &sCommandsLen)) != NULL ? 0 : -1;
+}
+
+static int _iotbenchcases_loadBurst(void) {
+  return (sBurst = iotbench_corpus("s2h_burst.xml", &sBurstLen)) != NULL ? 0 : -1;
+}
+
+static int _iotbenchcases_loadMeasures(void) {
+  return (sMeasures = iotbench_corpus("h2s_measures.xml", &sMeasuresLen)) != NULL ? 0 : -1;
+}
+
+static int _iotbenchcases_loadTstat(void) {
+  return (sTstat = iotbench_corpus("tstat.json", &sTstatLen)) != NULL ? 0 : -1;
+}
+
+static int _iotbenchcases_loadTstatTree(void) {
+  if (sTstatTree == NULL && _iotbenchcases_loadTstat() == 0) {
+    sTstatTree = cJSON_Parse(sTstat);
+  }
+
+  return sTstatTree != NULL ? 0 : -1;
+}
+
+static int _iotbenchcases_openPipe(void) {
+  if (sPipe[0] < 0 && pipe(sPipe) != 0) {
+    return -1;
+  }
+
+  return _iotbenchcases_loadMeasures();
+}
+
+/**
+ * Build a measurement message for one device
+ */
+static void _iotbenchcases_addString(long iterations) {
+  char msg[IOTBENCHCASES_MSG_SIZE];
+  int offset;
+  long i;
+
+  for (i = 0; i < iterations; i++) {
+    iotxml_newMsg(msg, sizeof(msg));
+    offset = iotxml_addString(msg, sizeof(msg), "bench-0", IOTBENCHCASES_DEVICE_TYPE, IOT_PARAM_MEASURE, "volts", "1", 0, "120.1");
+    offset += iotxml_addString(msg + offset, sizeof(msg) - offset, "bench-0", IOTBENCHCASES_DEVICE_TYPE, IOT_PARAM_MEASURE, "energy", "k", 0, "42.7");
+    offset += iotxml_addInt(msg + offset, sizeof(msg) - offset, "bench-0", IOTBENCHCASES_DEVICE_TYPE, IOT_PARAM_MEASURE, "powerFactor", NULL, 0, 98);
+    offset += iotxml_addInt(msg + offset, sizeof(msg) - offset, "bench-0", IOTBENCHCASES_DEVICE_TYPE, IOT_PARAM_MEASURE, "outletStatus", NULL, 0, i & 1);
+    iotxml_closeMsg(msg, sizeof(msg));
+    iotbench_keep(msg);
+  }
+}
+
+/**
+ * Build and send a one-param measurement message
+ */
+static void _iotbenchcases_send(long iterations) {
+  char msg[IOTBENCHCASES_MSG_SIZE];
+  long i;
+
+  for (i = 0; i < iterations; i++) {
+    iotxml_newMsg(msg, sizeof(msg));
+    iotxml_addInt(msg, sizeof(msg), "bench-0", IOTBENCHCASES_DEVICE_TYPE, IOT_PARAM_MEASURE, "power", NULL, 0, (int) i);
+    iotxml_send(msg, sizeof(msg));
+  }
+}
+
+static void _iotbenchcases_parseAck(long iterations) {
+  _iotbenchcases_parse(IOTXML_PARSER_STREAM, sAck, sAckLen, iterations);
+}
+
+static void _iotbenchcases_parseCommands(long iterations) {
+  _iotbenchcases_parse(IOTXML_PARSER_STREAM, sCommands, sCommandsLen, iterations);
+}
+
+static void _iotbenchcases_parseBurst(long iterations) {
+  _iotbenchcases_parse(IOTXML_PARSER_STREAM, sBurst, sBurstLen, iterations);
+}
+
+static void _iotbenchcases_parseCommandsLibxml2(long iterations) {
+  _iotbenchcases_parse(IOTXML_PARSER_LIBXML2, sCommands, sCommandsLen, iterations);
+}
+
+/**
+ * Wrap a batch of measurements in the h2s header
+ */
+static void _iotbenchcases_wrap(long iterations) {
+  char dest[IOTBENCHCASES_MSG_SIZE];
+  long i;
+
+  for (i = 0; i < iterations; i++) {
+    h2swrapper_wrap(dest, (char *) sMeasures, sizeof(dest));
+    iotbench_keep(dest);
+  }
+}
+
+/**
+ * Write a message to a pipe and read it back, like an agent's message on
+ * its way to the proxy thread
+ */
+static void _iotbenchcases_pipeRoundTrip(long iterations) {
+  char msg[IOTBENCHCASES_PIPE_MSG_SIZE];
+  long i;
+
+  for (i = 0; i < iterations; i++) {
+    libpipecomm_write(sPipe[1], sMeasures, sizeof(msg));
+    libpipecomm_read(sPipe[0], msg, sizeof(msg));
+    iotbench_keep(msg);
+  }
+}
+
+/**
+ * Parse a thermostat's status and throw it away
+ */
+static void _iotbenchcases_parseTstat(long iterations) {
+  cJSON *json;
+  long i;
+
+  for (i = 0; i < iterations; i++) {
+    json = cJSON_Parse(sTstat);
+    iotbench_keep(json);
+    cJSON_Delete(json);
+  }
+}
+
+/**
+ * Parse a thermostat's status into an arena and reset it
+ */
+static void _iotbenchcases_parseTstatArena(long iterations) {
+  static char buffer[IOTBENCHCASES_ARENA_SIZE];
+  jsonarena_t arena;
+  cJSON *json;
+  long i;
+
+  jsonarena_init(&arena, buffer, sizeof(buffer));
+
+  for (i = 0; i < iterations; i++) {
+    json = jsonarena_parse(&arena, sTstat);
+    iotbench_keep(json);
+    jsonarena_reset(&arena);
+  }
+}
+
+/**
+ * Extract a thermostat's measurements straight from its status
+ */
+static void _iotbenchcases_extractTstat(long iterations) {
+  iotbenchcases_tstat_t tstat;
+  unsigned int found;
+  long i;
+
+  for (i = 0; i < iterations; i++) {
+    jsonschema_extract(sTstatFields, sTstat, &tstat, &found);
+    iotbench_keep(&tstat);
+  }
+}
+
+/**
+ * Print a thermostat's status the way cJSON does, into its own malloc
+ */
+static void _iotbenchcases_printTstat(long iterations) {
+  char *text;
+  long i;
+
+  for (i = 0; i < iterations; i++) {
+    text = cJSON_PrintUnformatted(sTstatTree);
+    iotbench_keep(text);
+    free(text);
+  }
+}
+
+/**
+ * Write a thermostat's status into our own buffer
+ */
+static void _iotbenchcases_writeTstat(long iterations) {
+  char text[IOTBENCHCASES_JSON_SIZE];
+  jsonwriter_t writer;
+  long i;
+
+  for (i = 0; i < iterations; i++) {
+    jsonwriter_init(&writer, text, sizeof(text));
+    jsonwriter_item(&writer, sTstatTree);
+    iotbench_keep(text);
+  }
+}
+
+/**
+ * Write the body of an RTOA "set" command, like rtoacontrol_execute(..)
+ */
+static void _iotbenchcases_writeCommand(long iterations) {
+  char text[IOTBENCHCASES_JSON_SIZE];
+  jsonwriter_t writer;
+  long i;
+
+  for (i = 0; i < iterations; i++) {
+    jsonwriter_init(&writer, text, sizeof(text));
+    jsonwriter_beginObject(&writer);
+    jsonwriter_key(&writer, "tmode");
+    jsonwriter_int(&writer, 1);
+    jsonwriter_key(&writer, "t_heat");
+    jsonwriter_double(&writer, 68.5);
+    jsonwriter_endObject(&writer);
+    iotbench_keep(text);
+  }
+}
+
+static void _iotbenchcases_getTimestamp(long iterations) {
+  char timestamp[32];
+  long i;
+
+  for (i = 0; i < iterations; i++) {
+    getTimestamp(timestamp, sizeof(timestamp));
+    iotbench_keep(timestamp);
+  }
+}
+
+/**
+ * Parse a message from the server, with a listener for every command
+ */
+static void _iotbenchcases_parse(iotxml_parser_e type, const char *xml, int len, long iterations) {
+  static bool listening = false;
+  long i;
+
+  if (!listening) {
+    iotxml_addCommandListener(&_iotbenchcases_execute, NULL);
+    listening = true;
+  }
+
+  iotxml_setParser(type);
+
+  for (i = 0; i < iterations; i++) {
+    iotxml_parse(xml, len);
+  }
+
+  iotxml_setParser(IOTXML_PARSER_STREAM);
+}
+
+/**
+ * Every command is executed by doing nothing
+ */
+static void _iotbenchcases_execute(command_t *cmd) {
+  iotbench_keep(cmd);
+}